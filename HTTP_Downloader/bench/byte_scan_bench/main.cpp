@@ -0,0 +1,287 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the byte scans in byte_scan.cpp with the _StrStrA() and _StrChrA() searches that they replaced.
+// Every buffer is scanned from start to finish, one match at a time, the way the parsers walk a receive buffer.
+//
+// Usage: byte_scan_bench.exe [header corpus] [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../byte_scan.h"
+
+#include "lite_shell32.h"
+
+extern bool g_bs_use_sse2;
+
+#define SAMPLE_SIZE		( 1024 * 1024 )
+
+struct SAMPLE
+{
+	char			*name;
+	char			*buffer;	// NULL terminated for _StrStrA() and _StrChrA().
+	unsigned int	length;
+};
+
+// Repeats text until the buffer is full. Only whole copies are kept so that lines aren't cut.
+unsigned int FillSample( char *buffer, char *text, unsigned int text_length )
+{
+	unsigned int length = 0;
+
+	while ( length + text_length <= SAMPLE_SIZE )
+	{
+		memcpy( buffer + length, text, text_length );
+		length += text_length;
+	}
+
+	buffer[ length ] = 0;
+
+	return length;
+}
+
+// Header lines from a file of recorded response headers.
+bool LoadHeaderSample( char *file_path, SAMPLE *sample )
+{
+	FILE *f = fopen( file_path, "rb" );
+	if ( f == NULL )
+	{
+		return false;
+	}
+
+	fseek( f, 0, SEEK_END );
+	long file_size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	if ( file_size <= 0 || file_size > SAMPLE_SIZE )
+	{
+		fclose( f );
+
+		return false;
+	}
+
+	char *text = ( char * )malloc( file_size );
+	file_size = ( long )fread( text, 1, file_size, f );
+	fclose( f );
+
+	sample->name = "response headers";
+	sample->buffer = ( char * )malloc( SAMPLE_SIZE + 1 );
+	sample->length = FillSample( sample->buffer, text, ( unsigned int )file_size );
+
+	free( text );
+
+	return true;
+}
+
+// A Unix style FTP directory listing.
+void MakeListingSample( SAMPLE *sample )
+{
+	char *text = ( char * )malloc( 65536 );
+	unsigned int text_length = 0;
+
+	srand( 1 );
+
+	for ( unsigned int i = 0; i < 512; ++i )
+	{
+		text_length += sprintf( text + text_length, "%crw-r--r--   1 ftp      ftp      %10u %s %2u %02u:%02u file_%05u%s\r\n",
+								( i % 8 == 0 ? 'd' : '-' ),
+								( unsigned int )( rand() * rand() ) % 100000000,
+								( i % 3 == 0 ? "Jan" : ( i % 3 == 1 ? "Jun" : "Oct" ) ),
+								1 + ( rand() % 28 ), rand() % 24, rand() % 60,
+								i, ( i % 4 == 0 ? ".tar.gz" : ( i % 4 == 1 ? ".iso" : ( i % 4 == 2 ? ".txt" : "" ) ) ) );
+	}
+
+	sample->name = "FTP listing";
+	sample->buffer = ( char * )malloc( SAMPLE_SIZE + 1 );
+	sample->length = FillSample( sample->buffer, text, text_length );
+
+	free( text );
+}
+
+// Lines that are much longer than the delimiter scan width, like long Location and Set-Cookie values.
+// The chunked content parser skips over chunk data by its length, so this is as far apart as its delimiters get.
+void MakeLongLineSample( SAMPLE *sample, unsigned int line_length, char *name )
+{
+	char *text = ( char * )malloc( line_length + 2 );
+
+	unsigned int text_length = 0;
+
+	for ( ; text_length < line_length; ++text_length )
+	{
+		text[ text_length ] = 'a' + ( char )( text_length % 26 );
+	}
+
+	text[ text_length++ ] = '\r';
+	text[ text_length++ ] = '\n';
+
+	sample->name = name;
+	sample->buffer = ( char * )malloc( SAMPLE_SIZE + 1 );
+	sample->length = FillSample( sample->buffer, text, text_length );
+
+	free( text );
+}
+
+unsigned int CountCRLF_StrStrA( SAMPLE *sample )
+{
+	unsigned int count = 0;
+
+	for ( char *pos = sample->buffer; ( pos = _StrStrA( pos, "\r\n" ) ) != NULL; pos += 2 )
+	{
+		++count;
+	}
+
+	return count;
+}
+
+unsigned int CountCRLF_BS( SAMPLE *sample )
+{
+	unsigned int count = 0;
+
+	char *end = sample->buffer + sample->length;
+
+	for ( char *pos = sample->buffer; ( pos = BS_FindCRLF( pos, ( unsigned int )( end - pos ) ) ) != NULL; pos += 2 )
+	{
+		++count;
+	}
+
+	return count;
+}
+
+unsigned int CountChar_StrChrA( SAMPLE *sample )
+{
+	unsigned int count = 0;
+
+	for ( char *pos = sample->buffer; ( pos = _StrChrA( pos, '\n' ) ) != NULL; ++pos )
+	{
+		++count;
+	}
+
+	return count;
+}
+
+unsigned int CountChar_BS( SAMPLE *sample )
+{
+	unsigned int count = 0;
+
+	char *end = sample->buffer + sample->length;
+
+	for ( char *pos = sample->buffer; ( pos = BS_FindChar( pos, ( unsigned int )( end - pos ), '\n' ) ) != NULL; ++pos )
+	{
+		++count;
+	}
+
+	return count;
+}
+
+typedef unsigned int ( *pCount )( SAMPLE *sample );
+
+// Returns MB/s.
+double TimeCount( pCount count_function, SAMPLE *sample, unsigned int iterations, unsigned int &count )
+{
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency( &frequency );
+
+	QueryPerformanceCounter( &start );
+
+	for ( unsigned int i = 0; i < iterations; ++i )
+	{
+		count = count_function( sample );
+	}
+
+	QueryPerformanceCounter( &stop );
+
+	double elapsed = ( double )( stop.QuadPart - start.QuadPart ) / frequency.QuadPart;
+
+	return ( ( double )sample->length * iterations ) / ( elapsed * 1048576.0 );
+}
+
+int main( int argc, char *argv[] )
+{
+	char *file_path = ( argc > 1 ? argv[ 1 ] : "..\\corpus\\response_headers.txt" );
+	unsigned int iterations = ( argc > 2 ? ( unsigned int )strtoul( argv[ 2 ], NULL, 10 ) : 200 );
+
+	SAMPLE samples[ 4 ];
+	unsigned int sample_count = 0;
+
+	if ( LoadHeaderSample( file_path, &samples[ sample_count ] ) )
+	{
+		++sample_count;
+	}
+	else
+	{
+		printf( "Unable to load %s. Skipping the header sample.\n", file_path );
+	}
+
+	MakeListingSample( &samples[ sample_count++ ] );
+	MakeLongLineSample( &samples[ sample_count++ ], 510, "512 byte lines" );
+	MakeLongLineSample( &samples[ sample_count++ ], 8190, "8 KB lines" );
+
+	for ( unsigned int i = 0; i < sample_count; ++i )
+	{
+		SAMPLE *sample = &samples[ i ];
+
+		unsigned int count[ 3 ] = { 0 };
+		double rate[ 3 ];
+
+		printf( "%s: %u bytes\n", sample->name, sample->length );
+
+		rate[ 0 ] = TimeCount( CountCRLF_StrStrA, sample, iterations, count[ 0 ] );
+		g_bs_use_sse2 = false;
+		rate[ 1 ] = TimeCount( CountCRLF_BS, sample, iterations, count[ 1 ] );
+		BS_Initialize();
+		rate[ 2 ] = TimeCount( CountCRLF_BS, sample, iterations, count[ 2 ] );
+
+		if ( count[ 0 ] != count[ 1 ] || count[ 0 ] != count[ 2 ] )
+		{
+			printf( "  \"\\r\\n\" counts don't match: %u, %u, %u\n", count[ 0 ], count[ 1 ], count[ 2 ] );
+
+			return 1;
+		}
+
+		printf( "  \"\\r\\n\": %u matches, %.1f bytes apart\n", count[ 0 ], ( double )sample->length / count[ 0 ] );
+		printf( "    _StrStrA:           %8.1f MB/s\n", rate[ 0 ] );
+		printf( "    BS_FindCRLF scalar: %8.1f MB/s\n", rate[ 1 ] );
+		printf( "    BS_FindCRLF SSE2:   %8.1f MB/s%s\n", rate[ 2 ], ( g_bs_use_sse2 ? "" : " (SSE2 isn't available)" ) );
+
+		rate[ 0 ] = TimeCount( CountChar_StrChrA, sample, iterations, count[ 0 ] );
+		g_bs_use_sse2 = false;
+		rate[ 1 ] = TimeCount( CountChar_BS, sample, iterations, count[ 1 ] );
+		BS_Initialize();
+		rate[ 2 ] = TimeCount( CountChar_BS, sample, iterations, count[ 2 ] );
+
+		if ( count[ 0 ] != count[ 1 ] || count[ 0 ] != count[ 2 ] )
+		{
+			printf( "  '\\n' counts don't match: %u, %u, %u\n", count[ 0 ], count[ 1 ], count[ 2 ] );
+
+			return 1;
+		}
+
+		printf( "  '\\n': %u matches\n", count[ 0 ] );
+		printf( "    _StrChrA:           %8.1f MB/s\n", rate[ 0 ] );
+		printf( "    BS_FindChar scalar: %8.1f MB/s\n", rate[ 1 ] );
+		printf( "    BS_FindChar SSE2:   %8.1f MB/s\n", rate[ 2 ] );
+	}
+
+	for ( unsigned int i = 0; i < sample_count; ++i )
+	{
+		free( samples[ i ].buffer );
+	}
+
+	return 0;
+}
@@ -0,0 +1,580 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A local HTTP server that sends every response with "Transfer-Encoding: chunked" so that the chunked content parser can be tested.
+//
+// The chunk sizes are random, and some chunks have extensions or leading zeros. The last chunk is sometimes followed by a trailer.
+// In the default mode the response is sent in random pieces with a short delay between each so that the client reads them separately.
+// Every chunk size line and every chunk terminator is split between two pieces.
+// In the throughput mode the response is sent as fast as possible in large pieces.
+//
+// Usage: chunked_server.exe [-p port] [-f file | -s size] [-e content-encoding] [-r seed] [-d delay] [-t]
+//        chunked_server.exe -v file
+//
+// -p  The port to listen on (127.0.0.1). The default is 8080.
+// -f  Send the contents of a file. Use -e with a precompressed file to set its Content-Encoding.
+// -s  Send size bytes of random data. The default is 4 MB.
+// -r  The seed for the chunk sizes, the pieces, and the random data. The default is 1.
+// -d  The number of milliseconds to wait between pieces. The default is 1.
+// -t  Throughput mode.
+// -v  Print the size and CRC-32 of a file (the downloaded file) and exit.
+//
+// The size and CRC-32 of the content are printed when the server starts. They should match the downloaded file.
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_PORT			8080
+#define DEFAULT_RANDOM_SIZE		( 4 * 1024 * 1024 )
+
+#define THROUGHPUT_PIECE_SIZE	65536
+
+unsigned int g_crc32_table[ 256 ];
+
+unsigned int g_random_state = 1;
+
+// xorshift32. The same seed produces the same response with any compiler.
+unsigned int Random()
+{
+	g_random_state ^= g_random_state << 13;
+	g_random_state ^= g_random_state >> 17;
+	g_random_state ^= g_random_state << 5;
+
+	return g_random_state;
+}
+
+void InitializeCRC32()
+{
+	for ( unsigned int i = 0; i < 256; ++i )
+	{
+		unsigned int crc = i;
+
+		for ( unsigned char j = 0; j < 8; ++j )
+		{
+			crc = ( crc & 1 ? ( crc >> 1 ) ^ 0xEDB88320 : crc >> 1 );
+		}
+
+		g_crc32_table[ i ] = crc;
+	}
+}
+
+unsigned int CRC32( unsigned char *buffer, unsigned int length )
+{
+	unsigned int crc = 0xFFFFFFFF;
+
+	for ( unsigned int i = 0; i < length; ++i )
+	{
+		crc = g_crc32_table[ ( crc ^ buffer[ i ] ) & 0xFF ] ^ ( crc >> 8 );
+	}
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+unsigned char *LoadFile( char *file_path, unsigned int &length )
+{
+	FILE *f = fopen( file_path, "rb" );
+	if ( f == NULL )
+	{
+		return NULL;
+	}
+
+	fseek( f, 0, SEEK_END );
+	long file_size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	unsigned char *buffer = ( unsigned char * )malloc( file_size > 0 ? file_size : 1 );
+	length = ( unsigned int )fread( buffer, 1, file_size, f );
+	fclose( f );
+
+	return buffer;
+}
+
+struct PIECE
+{
+	unsigned int offset;
+	unsigned int length;
+};
+
+struct RESPONSE
+{
+	char			*buffer;	// The header and the chunked content.
+	unsigned int	length;
+	unsigned int	size;
+	unsigned int	header_length;
+
+	// Offsets where the response must be split.
+	unsigned int	*splits;
+	unsigned int	split_count;
+	unsigned int	split_size;
+};
+
+void AddSplit( RESPONSE *response, unsigned int offset )
+{
+	if ( response->split_count == response->split_size )
+	{
+		response->split_size = ( response->split_size > 0 ? response->split_size * 2 : 1024 );
+		response->splits = ( unsigned int * )realloc( response->splits, sizeof( unsigned int ) * response->split_size );
+	}
+
+	response->splits[ response->split_count++ ] = offset;
+}
+
+void Append( RESPONSE *response, char *data, unsigned int length )
+{
+	if ( response->length + length > response->size )
+	{
+		response->size = ( response->size * 2 > response->length + length ? response->size * 2 : response->length + length );
+		response->buffer = ( char * )realloc( response->buffer, response->size );
+	}
+
+	memcpy( response->buffer + response->length, data, length );
+	response->length += length;
+}
+
+unsigned int GetChunkSize( unsigned int remaining )
+{
+	unsigned int chunk_size;
+	unsigned int r = Random() % 100;
+
+	if ( r < 20 )
+	{
+		chunk_size = 1 + ( Random() % 16 );
+	}
+	else if ( r < 45 )
+	{
+		chunk_size = 17 + ( Random() % 1008 );
+	}
+	else if ( r < 90 )
+	{
+		chunk_size = 1025 + ( Random() % 15360 );
+	}
+	else
+	{
+		chunk_size = 16385 + ( Random() % 114688 );
+	}
+
+	return ( chunk_size < remaining ? chunk_size : remaining );
+}
+
+// Builds the header and the chunked content. In the fuzz mode, every chunk size line and chunk terminator gets a split inside of it.
+void MakeResponse( RESPONSE *response, unsigned char *content, unsigned int content_length, char *content_encoding, unsigned int content_crc, bool fuzz )
+{
+	char line[ 1024 ];
+	unsigned int line_length = sprintf( line, "HTTP/1.1 200 OK\r\n"
+									 "Content-Type: application/octet-stream\r\n"
+									 "Transfer-Encoding: chunked\r\n"
+									 "%s%.256s%s"
+									 "Connection: close\r\n"
+									 "\r\n",
+									 ( content_encoding != NULL ? "Content-Encoding: " : "" ),
+									 ( content_encoding != NULL ? content_encoding : "" ),
+									 ( content_encoding != NULL ? "\r\n" : "" ) );
+
+	Append( response, line, line_length );
+
+	response->header_length = response->length;
+
+	unsigned int offset = 0;
+
+	while ( offset < content_length )
+	{
+		unsigned int chunk_size = GetChunkSize( content_length - offset );
+
+		unsigned int r = Random() % 100;
+
+		line_length = sprintf( line, ( r & 1 ? "%s%x%s\r\n" : "%s%X%s\r\n" ),
+							   ( r < 10 ? "00" : "" ),
+							   chunk_size,
+							   ( r >= 90 ? ( r >= 95 ? ";ext" : ";name=\"value\"" ) : "" ) );
+
+		if ( fuzz )
+		{
+			AddSplit( response, response->length + 1 + ( Random() % ( line_length - 1 ) ) );
+		}
+
+		Append( response, line, line_length );
+		Append( response, ( char * )content + offset, chunk_size );
+
+		if ( fuzz )
+		{
+			AddSplit( response, response->length + ( Random() % 2 ) );
+		}
+
+		Append( response, "\r\n", 2 );
+
+		offset += chunk_size;
+	}
+
+	// The last chunk.
+	line_length = sprintf( line, "0\r\n" );
+	if ( fuzz )
+	{
+		AddSplit( response, response->length + 1 + ( Random() % ( line_length - 1 ) ) );
+	}
+
+	Append( response, line, line_length );
+
+	if ( Random() % 2 )
+	{
+		line_length = sprintf( line, "X-Content-CRC32: %08x\r\n", content_crc );
+		if ( fuzz )
+		{
+			AddSplit( response, response->length + 1 + ( Random() % ( line_length - 1 ) ) );
+		}
+
+		Append( response, line, line_length );
+	}
+
+	if ( fuzz )
+	{
+		AddSplit( response, response->length + 1 );
+	}
+
+	Append( response, "\r\n", 2 );
+}
+
+// Cuts the response into pieces at the required splits, and at random places in between.
+unsigned int MakePieces( RESPONSE *response, PIECE **pieces, bool fuzz )
+{
+	unsigned int piece_count = 0;
+	unsigned int piece_size = 1024;
+	*pieces = ( PIECE * )malloc( sizeof( PIECE ) * piece_size );
+
+	unsigned int split_index = 0;
+	unsigned int offset = 0;
+
+	while ( offset < response->length )
+	{
+		unsigned int length;
+
+		if ( fuzz )
+		{
+			unsigned int r = Random() % 100;
+
+			length = ( r < 30 ? 1 + ( Random() % 16 ) : ( r < 80 ? 1 + ( Random() % 2048 ) : 1 + ( Random() % 32768 ) ) );
+
+			// Stop at the next required split.
+			while ( split_index < response->split_count && response->splits[ split_index ] <= offset )
+			{
+				++split_index;
+			}
+
+			if ( split_index < response->split_count && response->splits[ split_index ] < offset + length )
+			{
+				length = response->splits[ split_index ] - offset;
+			}
+		}
+		else
+		{
+			length = THROUGHPUT_PIECE_SIZE;
+		}
+
+		if ( length > response->length - offset )
+		{
+			length = response->length - offset;
+		}
+
+		if ( piece_count == piece_size )
+		{
+			piece_size *= 2;
+			*pieces = ( PIECE * )realloc( *pieces, sizeof( PIECE ) * piece_size );
+		}
+
+		( *pieces )[ piece_count ].offset = offset;
+		( *pieces )[ piece_count ].length = length;
+		++piece_count;
+
+		offset += length;
+	}
+
+	return piece_count;
+}
+
+bool SendAll( SOCKET s, char *buffer, unsigned int length )
+{
+	while ( length > 0 )
+	{
+		int sent = send( s, buffer, ( int )length, 0 );
+		if ( sent == SOCKET_ERROR )
+		{
+			return false;
+		}
+
+		buffer += sent;
+		length -= sent;
+	}
+
+	return true;
+}
+
+// Reads the request header and returns true if it's a HEAD request.
+bool ReadRequest( SOCKET s, bool &head )
+{
+	char request[ 8192 ];
+	int request_length = 0;
+
+	while ( request_length < ( int )sizeof( request ) - 1 )
+	{
+		int received = recv( s, request + request_length, ( int )sizeof( request ) - 1 - request_length, 0 );
+		if ( received <= 0 )
+		{
+			return false;
+		}
+
+		request_length += received;
+		request[ request_length ] = 0;
+
+		if ( strstr( request, "\r\n\r\n" ) != NULL )
+		{
+			char *end_line = strstr( request, "\r\n" );
+			*end_line = 0;
+
+			printf( "%s\n", request );
+
+			head = ( strncmp( request, "HEAD ", 5 ) == 0 );
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int main( int argc, char *argv[] )
+{
+	unsigned short port = DEFAULT_PORT;
+	char *file_path = NULL;
+	unsigned int random_size = DEFAULT_RANDOM_SIZE;
+	char *content_encoding = NULL;
+	unsigned int seed = 1;
+	unsigned int delay = 1;
+	bool fuzz = true;
+
+	// The output is a log, so don't hold it back when it's redirected to a file.
+	setvbuf( stdout, NULL, _IONBF, 0 );
+
+	InitializeCRC32();
+
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( strcmp( argv[ i ], "-t" ) == 0 )
+		{
+			fuzz = false;
+		}
+		else if ( i + 1 < argc )
+		{
+			if ( strcmp( argv[ i ], "-p" ) == 0 )
+			{
+				port = ( unsigned short )strtoul( argv[ ++i ], NULL, 10 );
+			}
+			else if ( strcmp( argv[ i ], "-f" ) == 0 )
+			{
+				file_path = argv[ ++i ];
+			}
+			else if ( strcmp( argv[ i ], "-s" ) == 0 )
+			{
+				random_size = ( unsigned int )strtoul( argv[ ++i ], NULL, 10 );
+			}
+			else if ( strcmp( argv[ i ], "-e" ) == 0 )
+			{
+				content_encoding = argv[ ++i ];
+			}
+			else if ( strcmp( argv[ i ], "-r" ) == 0 )
+			{
+				seed = ( unsigned int )strtoul( argv[ ++i ], NULL, 10 );
+			}
+			else if ( strcmp( argv[ i ], "-d" ) == 0 )
+			{
+				delay = ( unsigned int )strtoul( argv[ ++i ], NULL, 10 );
+			}
+			else if ( strcmp( argv[ i ], "-v" ) == 0 )
+			{
+				unsigned int length = 0;
+				unsigned char *buffer = LoadFile( argv[ ++i ], length );
+				if ( buffer == NULL )
+				{
+					printf( "Unable to open %s\n", argv[ i ] );
+
+					return 1;
+				}
+
+				printf( "%u bytes, CRC-32: %08x\n", length, CRC32( buffer, length ) );
+
+				free( buffer );
+
+				return 0;
+			}
+		}
+	}
+
+	g_random_state = ( seed != 0 ? seed : 1 );
+
+	unsigned char *content;
+	unsigned int content_length;
+
+	if ( file_path != NULL )
+	{
+		content = LoadFile( file_path, content_length );
+		if ( content == NULL )
+		{
+			printf( "Unable to open %s\n", file_path );
+
+			return 1;
+		}
+	}
+	else
+	{
+		content_length = random_size;
+		content = ( unsigned char * )malloc( content_length > 0 ? content_length : 1 );
+
+		for ( unsigned int i = 0; i < content_length; ++i )
+		{
+			content[ i ] = ( unsigned char )( Random() >> 24 );
+		}
+	}
+
+	unsigned int content_crc = CRC32( content, content_length );
+
+	printf( "Content: %u bytes, CRC-32: %08x%s%s\n", content_length, content_crc,
+			( content_encoding != NULL ? ", Content-Encoding: " : "" ), ( content_encoding != NULL ? content_encoding : "" ) );
+
+	WSADATA wsa_data;
+	if ( WSAStartup( MAKEWORD( 2, 2 ), &wsa_data ) != 0 )
+	{
+		printf( "WSAStartup failed\n" );
+
+		return 1;
+	}
+
+	SOCKET listen_socket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+
+	sockaddr_in address;
+	memset( &address, 0, sizeof( sockaddr_in ) );
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	address.sin_port = htons( port );
+
+	int reuse = 1;
+	setsockopt( listen_socket, SOL_SOCKET, SO_REUSEADDR, ( char * )&reuse, sizeof( int ) );
+
+	if ( bind( listen_socket, ( sockaddr * )&address, sizeof( sockaddr_in ) ) == SOCKET_ERROR || listen( listen_socket, SOMAXCONN ) == SOCKET_ERROR )
+	{
+		printf( "Unable to listen on port %u\n", port );
+
+		closesocket( listen_socket );
+		WSACleanup();
+
+		return 1;
+	}
+
+	printf( "Listening on http://127.0.0.1:%u/ (%s mode, seed %u)\n", port, ( fuzz ? "fuzz" : "throughput" ), seed );
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency( &frequency );
+
+	unsigned int connection_count = 0;
+
+	while ( true )
+	{
+		SOCKET s = accept( listen_socket, NULL, NULL );
+		if ( s == INVALID_SOCKET )
+		{
+			break;
+		}
+
+		int no_delay = 1;
+		setsockopt( s, IPPROTO_TCP, TCP_NODELAY, ( char * )&no_delay, sizeof( int ) );
+
+		bool head = false;
+
+		if ( ReadRequest( s, head ) )
+		{
+			// Each connection gets a different response. It can be reproduced with the seed and the connection number.
+			g_random_state = ( seed != 0 ? seed : 1 ) + ( ++connection_count * 0x9E3779B9 );
+			if ( g_random_state == 0 )
+			{
+				g_random_state = 1;
+			}
+
+			RESPONSE response;
+			memset( &response, 0, sizeof( RESPONSE ) );
+			MakeResponse( &response, content, content_length, content_encoding, content_crc, fuzz );
+
+			if ( head )
+			{
+				SendAll( s, response.buffer, response.header_length );
+			}
+			else
+			{
+				PIECE *pieces = NULL;
+				unsigned int piece_count = MakePieces( &response, &pieces, fuzz );
+
+				LARGE_INTEGER start, stop;
+				QueryPerformanceCounter( &start );
+
+				unsigned int i = 0;
+				for ( ; i < piece_count; ++i )
+				{
+					if ( !SendAll( s, response.buffer + pieces[ i ].offset, pieces[ i ].length ) )
+					{
+						break;
+					}
+
+					if ( fuzz && delay > 0 )
+					{
+						Sleep( delay );
+					}
+				}
+
+				QueryPerformanceCounter( &stop );
+
+				double elapsed = ( double )( stop.QuadPart - start.QuadPart ) / frequency.QuadPart;
+
+				printf( "Connection %u: %s %u of %u pieces (%u bytes, %u forced splits) in %.3f seconds, %.1f MB/s\n",
+						connection_count, ( i == piece_count ? "sent" : "the client closed the connection after" ), i, piece_count,
+						response.length, response.split_count, elapsed, ( elapsed > 0.0 ? response.length / ( elapsed * 1048576.0 ) : 0.0 ) );
+
+				free( pieces );
+			}
+
+			free( response.splits );
+			free( response.buffer );
+		}
+
+		shutdown( s, SD_SEND );
+
+		// Wait for the client to close the connection.
+		char discard[ 1024 ];
+		while ( recv( s, discard, sizeof( discard ), 0 ) > 0 );
+
+		closesocket( s );
+	}
+
+	closesocket( listen_socket );
+	WSACleanup();
+
+	free( content );
+
+	return 0;
+}
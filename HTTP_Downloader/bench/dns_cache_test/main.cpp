@@ -0,0 +1,290 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tests the DNS cache in dns_cache.cpp against a stub resolver and a clock that only moves when we move it.
+//
+// The stub replaces _GetAddrInfoW() and _FreeAddrInfoW() (lite_ws2_32's function pointers, which are normally loaded from ws2_32.dll),
+// and this program's TW_GetTickCount() replaces the one in timer_wheel.cpp.
+// The program returns 0 if every check passes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../dns_cache.h"
+
+unsigned long long g_current_time = 1000000;
+
+unsigned int g_resolver_calls = 0;
+
+unsigned int g_checks = 0;
+unsigned int g_failed_checks = 0;
+
+unsigned long long TW_GetTickCount()
+{
+	return g_current_time;
+}
+
+addrinfoW *StubAddress( int family, unsigned char last_byte, addrinfoW *next )
+{
+	size_t address_length = ( family == AF_INET6 ? sizeof( sockaddr_in6 ) : sizeof( sockaddr_in ) );
+
+	addrinfoW *ai = ( addrinfoW * )calloc( 1, sizeof( addrinfoW ) );
+	ai->ai_family = family;
+	ai->ai_socktype = SOCK_STREAM;
+	ai->ai_protocol = IPPROTO_TCP;
+	ai->ai_addrlen = address_length;
+	ai->ai_addr = ( sockaddr * )calloc( 1, address_length );
+	ai->ai_next = next;
+
+	if ( family == AF_INET6 )
+	{
+		sockaddr_in6 *sa = ( sockaddr_in6 * )ai->ai_addr;
+		sa->sin6_family = AF_INET6;
+		sa->sin6_addr.s6_addr[ 0 ] = 0x20;
+		sa->sin6_addr.s6_addr[ 1 ] = 0x01;
+		sa->sin6_addr.s6_addr[ 2 ] = 0x0D;
+		sa->sin6_addr.s6_addr[ 3 ] = 0xB8;
+		sa->sin6_addr.s6_addr[ 15 ] = last_byte;
+	}
+	else
+	{
+		sockaddr_in *sa = ( sockaddr_in * )ai->ai_addr;
+		sa->sin_family = AF_INET;
+
+		unsigned char *address = ( unsigned char * )&sa->sin_addr;	// 192.0.2.x
+		address[ 0 ] = 192;
+		address[ 1 ] = 0;
+		address[ 2 ] = 2;
+		address[ 3 ] = last_byte;
+	}
+
+	return ai;
+}
+
+// Hosts ending in ".nx" don't exist, "flaky" always has a temporary failure, and every other host has two IPv4 addresses and one IPv6 address.
+// The IPv6 address comes first so that we can tell that the list was interleaved.
+int WSAAPI StubGetAddrInfoW( PCWSTR pNodeName, PCWSTR pServiceName, const ADDRINFOW *pHints, PADDRINFOW *ppResult )
+{
+	++g_resolver_calls;
+
+	*ppResult = NULL;
+
+	int name_length = lstrlenW( pNodeName );
+
+	if ( name_length >= 3 && lstrcmpW( pNodeName + name_length - 3, L".nx" ) == 0 )
+	{
+		return WSAHOST_NOT_FOUND;
+	}
+	else if ( lstrcmpW( pNodeName, L"flaky" ) == 0 )
+	{
+		return WSATRY_AGAIN;
+	}
+
+	*ppResult = StubAddress( AF_INET6, 1, StubAddress( AF_INET, 1, StubAddress( AF_INET, 2, NULL ) ) );
+
+	return 0;
+}
+
+void WSAAPI StubFreeAddrInfoW( PADDRINFOW pAddrInfo )
+{
+	while ( pAddrInfo != NULL )
+	{
+		addrinfoW *next = pAddrInfo->ai_next;
+
+		free( pAddrInfo->ai_addr );
+		free( pAddrInfo );
+
+		pAddrInfo = next;
+	}
+}
+
+pGetAddrInfoW	_GetAddrInfoW = StubGetAddrInfoW;
+pFreeAddrInfoW	_FreeAddrInfoW = StubFreeAddrInfoW;
+
+int CompareKeys( void *a, void *b )
+{
+	return lstrcmpW( ( wchar_t * )a, ( wchar_t * )b );
+}
+
+void Check( bool passed, char *description )
+{
+	++g_checks;
+
+	if ( !passed )
+	{
+		++g_failed_checks;
+	}
+
+	printf( "%s: %s\n", ( passed ? "PASS" : "FAIL" ), description );
+}
+
+unsigned int CountAddresses( addrinfoW *address_info )
+{
+	unsigned int count = 0;
+
+	for ( ; address_info != NULL; address_info = address_info->ai_next )
+	{
+		++count;
+	}
+
+	return count;
+}
+
+// Looks up a host the way the resolver thread does. Returns the cache status and the number of addresses that it was given.
+char Lookup( wchar_t *host, wchar_t *port, unsigned int &address_count, addrinfoW **first_address = NULL )
+{
+	wchar_t *key = GetDNSCacheKey( host, port );
+
+	addrinfoW *address_info = NULL;
+	char cache_status = ResolveAddressInfo( key, host, port, &address_info );
+
+	address_count = CountAddresses( address_info );
+
+	if ( first_address != NULL && address_info != NULL )
+	{
+		*first_address = CopyAddressInfo( address_info );
+	}
+
+	FreeAddressInfo( address_info );
+	GlobalFree( key );
+
+	return cache_status;
+}
+
+int main( int argc, char *argv[] )
+{
+	InitializeCriticalSection( &dns_cache_cs );
+
+	g_dns_cache = dllrbt_create( CompareKeys );
+
+	unsigned int address_count;
+	unsigned int resolver_calls;
+	LONG hits, misses;
+	char cache_status;
+
+	// Positive entries.
+	{
+		addrinfoW *first_address = NULL;
+
+		cache_status = Lookup( L"example.test", L"443", address_count, &first_address );
+		Check( cache_status == DNS_CACHE_MISS && g_resolver_calls == 1 && address_count == 3, "The first lookup of a host goes to the resolver" );
+		Check( first_address != NULL && first_address->ai_family == AF_INET &&
+			   first_address->ai_next->ai_family == AF_INET6 &&
+			   first_address->ai_next->ai_next->ai_family == AF_INET, "The resolved addresses are interleaved, beginning with IPv4" );
+		Check( g_dns_cache_misses == 1 && g_dns_cache_hits == 0 && g_dns_cache_count == 1, "The miss is counted and the host is cached" );
+
+		FreeAddressInfo( first_address );
+	}
+
+	g_current_time += 1000;
+
+	cache_status = Lookup( L"example.test", L"443", address_count );
+	Check( cache_status == DNS_CACHE_HIT && g_resolver_calls == 1 && address_count == 3, "A second lookup is answered by the cache" );
+	Check( g_dns_cache_hits == 1 && g_dns_cache_misses == 1, "The hit is counted" );
+
+	cache_status = Lookup( L"example.test", L"80", address_count );
+	Check( cache_status == DNS_CACHE_MISS && g_resolver_calls == 2 && g_dns_cache_count == 2, "A different port is a different entry" );
+
+	g_current_time += DNS_CACHE_TTL - 1000 - 1;	// 1 millisecond before the first entry expires.
+
+	cache_status = Lookup( L"example.test", L"443", address_count );
+	Check( cache_status == DNS_CACHE_HIT && g_resolver_calls == 2, "An entry is used until its TTL is up" );
+
+	g_current_time += 1;
+
+	resolver_calls = g_resolver_calls;
+	misses = g_dns_cache_misses;
+
+	cache_status = Lookup( L"example.test", L"443", address_count );
+	Check( cache_status == DNS_CACHE_MISS && g_resolver_calls == resolver_calls + 1 && address_count == 3, "An expired entry is looked up again" );
+	Check( g_dns_cache_misses == misses + 1 && g_dns_cache_count == 2, "The expired entry is replaced rather than added" );
+
+	g_current_time += 1000;
+
+	cache_status = Lookup( L"example.test", L"443", address_count );
+	Check( cache_status == DNS_CACHE_HIT && g_resolver_calls == resolver_calls + 1, "The replacement is cached with a new TTL" );
+
+	// Negative entries.
+	resolver_calls = g_resolver_calls;
+	hits = g_dns_cache_hits;
+
+	cache_status = Lookup( L"missing.nx", L"443", address_count );
+	Check( cache_status == DNS_CACHE_MISS && g_resolver_calls == resolver_calls + 1 && address_count == 0, "A host that doesn't exist goes to the resolver" );
+
+	g_current_time += DNS_NEGATIVE_CACHE_TTL - 1;
+
+	cache_status = Lookup( L"missing.nx", L"443", address_count );
+	Check( cache_status == DNS_CACHE_NEGATIVE && g_resolver_calls == resolver_calls + 1 && address_count == 0, "The host is known not to exist until the negative TTL is up" );
+	Check( g_dns_cache_hits == hits + 1, "A negative entry counts as a hit" );
+
+	g_current_time += 1;
+
+	cache_status = Lookup( L"missing.nx", L"443", address_count );
+	Check( cache_status == DNS_CACHE_MISS && g_resolver_calls == resolver_calls + 2, "An expired negative entry is looked up again" );
+
+	// Temporary failures.
+	resolver_calls = g_resolver_calls;
+	unsigned int cache_count = g_dns_cache_count;
+
+	Lookup( L"flaky", L"443", address_count );
+	cache_status = Lookup( L"flaky", L"443", address_count );
+	Check( cache_status == DNS_CACHE_MISS && g_resolver_calls == resolver_calls + 2 && address_count == 0 && g_dns_cache_count == cache_count, "Temporary failures aren't cached" );
+
+	// A full cache.
+	FreeDNSCache();
+	g_dns_cache = dllrbt_create( CompareKeys );
+
+	wchar_t host[ 32 ];
+
+	for ( unsigned int i = 0; i < DNS_CACHE_SIZE; ++i )
+	{
+		swprintf( host, 32, L"host%u.test", i );
+		Lookup( host, L"443", address_count );
+	}
+
+	Check( g_dns_cache_count == DNS_CACHE_SIZE, "The cache holds DNS_CACHE_SIZE hosts" );
+
+	g_current_time += 1000;
+
+	resolver_calls = g_resolver_calls;
+
+	Lookup( L"extra.test", L"443", address_count );
+	cache_status = Lookup( L"extra.test", L"443", address_count );
+	Check( cache_status == DNS_CACHE_MISS && g_resolver_calls == resolver_calls + 2 && g_dns_cache_count == DNS_CACHE_SIZE, "A full cache of unexpired entries doesn't take more" );
+
+	cache_status = Lookup( L"host0.test", L"443", address_count );
+	Check( cache_status == DNS_CACHE_HIT, "The entries that were there are kept" );
+
+	g_current_time += DNS_CACHE_TTL;
+
+	Lookup( L"extra.test", L"443", address_count );
+	Check( g_dns_cache_count == 1, "Adding to a full cache removes the expired entries" );
+
+	cache_status = Lookup( L"extra.test", L"443", address_count );
+	Check( cache_status == DNS_CACHE_HIT, "The new entry is cached" );
+
+	FreeDNSCache();
+	Check( g_dns_cache == NULL && g_dns_cache_count == 0, "FreeDNSCache() empties the cache" );
+
+	DeleteCriticalSection( &dns_cache_cs );
+
+	printf( "\n%u of %u checks passed. %ld hits, %ld misses, %u resolver calls.\n", g_checks - g_failed_checks, g_checks, g_dns_cache_hits, g_dns_cache_misses, g_resolver_calls );
+
+	return ( g_failed_checks == 0 ? 0 : 1 );
+}
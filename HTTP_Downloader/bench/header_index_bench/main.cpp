@@ -0,0 +1,352 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the header field lookups that ParseHTTPHeader() used to do with the HEADER_INDEX that it builds now.
+//
+// Old: find the end of the header with _StrStrA(), then call GetHeaderValue() for each field that's looked up.
+//      Every lookup rescans the header from the beginning.
+// New: IndexHeaderField() finds the end of each field and indexes it in the same pass. Each lookup is a table read.
+//
+// Usage: header_index_bench.exe [header corpus] [iterations]
+// The corpus is a file of raw response headers, each ending with "\r\n\r\n" (the output of "curl -s -D - -o NUL <url>" can be appended to it).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../header_index.h"
+#include "../../byte_scan.h"
+
+#include "lite_shell32.h"
+
+struct LOOKUP
+{
+	char			*name;
+	unsigned long	name_length;
+	unsigned char	field;
+};
+
+// The fields that ParseHTTPHeader() and its callers look up for a response.
+LOOKUP g_lookups[] =
+{
+	{ "Transfer-Encoding", 17, HEADER_FIELD_TRANSFER_ENCODING },
+	{ "Content-Length", 14, HEADER_FIELD_CONTENT_LENGTH },
+	{ "Content-Range", 13, HEADER_FIELD_CONTENT_RANGE },
+	{ "Location", 8, HEADER_FIELD_LOCATION },
+	{ "Connection", 10, HEADER_FIELD_CONNECTION },
+	{ "Content-Encoding", 16, HEADER_FIELD_CONTENT_ENCODING },
+	{ "Content-Type", 12, HEADER_FIELD_CONTENT_TYPE },
+	{ "Content-Disposition", 19, HEADER_FIELD_CONTENT_DISPOSITION },
+	{ "Last-Modified", 13, HEADER_FIELD_LAST_MODIFIED },
+	{ "ETag", 4, HEADER_FIELD_ETAG },
+	{ "WWW-Authenticate", 16, HEADER_FIELD_WWW_AUTHENTICATE }
+};
+
+#define LOOKUP_COUNT	( sizeof( g_lookups ) / sizeof( g_lookups[ 0 ] ) )
+
+struct RESPONSE
+{
+	char			*header;
+	unsigned int	header_length;
+};
+
+// The end of header search from ParseHTTPHeader() before the index was added.
+char *FindEndOfHeader_Old( char *header_buffer, unsigned int header_buffer_length )
+{
+	char *end_of_header = NULL;
+
+	char *next_field = _StrStrA( header_buffer, "\r\n" );
+	if ( next_field != NULL )
+	{
+		do
+		{
+			next_field += 2;
+
+			if ( ( unsigned int )( ( next_field + 2 ) - header_buffer ) <= header_buffer_length )
+			{
+				if ( next_field[ 0 ] == '\r' && next_field[ 1 ] == '\n' )
+				{
+					end_of_header = next_field + 2;
+
+					break;
+				}
+				else
+				{
+					next_field = _StrStrA( next_field, "\r\n" );
+				}
+			}
+			else
+			{
+				break;
+			}
+		}
+		while ( next_field != NULL );
+	}
+
+	return end_of_header;
+}
+
+// The same loop with each field being indexed.
+char *FindEndOfHeader_New( HEADER_INDEX *header_index, char *header_buffer, unsigned int header_buffer_length )
+{
+	char *end_of_header = NULL;
+
+	char *next_field = IndexHeaderField( header_index, header_buffer, header_buffer + header_buffer_length );
+	if ( next_field != NULL )
+	{
+		do
+		{
+			next_field += 2;
+
+			if ( ( unsigned int )( ( next_field + 2 ) - header_buffer ) <= header_buffer_length )
+			{
+				if ( next_field[ 0 ] == '\r' && next_field[ 1 ] == '\n' )
+				{
+					end_of_header = next_field + 2;
+
+					break;
+				}
+				else
+				{
+					next_field = IndexHeaderField( header_index, next_field, header_buffer + header_buffer_length );
+				}
+			}
+			else
+			{
+				break;
+			}
+		}
+		while ( next_field != NULL );
+	}
+
+	return end_of_header;
+}
+
+// Returns a checksum of the values that were found so that both methods can be compared.
+unsigned int ParseResponse_Old( RESPONSE *response )
+{
+	unsigned int checksum = 0;
+
+	char *end_of_header = FindEndOfHeader_Old( response->header, response->header_length );
+	if ( end_of_header == NULL )
+	{
+		return 0;
+	}
+
+	// ParseHTTPHeader() terminated the header so that GetHeaderValue() wouldn't search the content.
+	char tmp_terminator = *end_of_header;
+	*end_of_header = 0;
+
+	char *value_start, *value_end;
+
+	for ( unsigned int i = 0; i < LOOKUP_COUNT; ++i )
+	{
+		if ( GetHeaderValue( response->header, g_lookups[ i ].name, g_lookups[ i ].name_length, &value_start, &value_end ) != NULL )
+		{
+			checksum = ( checksum * 31 ) + ( unsigned int )( value_start - response->header ) + ( unsigned int )( value_end - value_start );
+		}
+	}
+
+	// Every cookie is looked up.
+	char *field = GetHeaderValue( response->header, "Set-Cookie", 10, &value_start, &value_end );
+	while ( field != NULL )
+	{
+		checksum = ( checksum * 31 ) + ( unsigned int )( value_start - response->header ) + ( unsigned int )( value_end - value_start );
+
+		field = GetHeaderValue( value_end, "Set-Cookie", 10, &value_start, &value_end );
+	}
+
+	*end_of_header = tmp_terminator;
+
+	return checksum;
+}
+
+unsigned int ParseResponse_New( RESPONSE *response )
+{
+	unsigned int checksum = 0;
+
+	HEADER_INDEX header_index;
+	memset( &header_index, 0, sizeof( HEADER_INDEX ) );
+
+	char *end_of_header = FindEndOfHeader_New( &header_index, response->header, response->header_length );
+	if ( end_of_header == NULL )
+	{
+		return 0;
+	}
+
+	char tmp_terminator = *end_of_header;
+	*end_of_header = 0;
+
+	char *value_start, *value_end;
+
+	for ( unsigned int i = 0; i < LOOKUP_COUNT; ++i )
+	{
+		if ( GetIndexedHeaderValue( &header_index, g_lookups[ i ].field, &value_start, &value_end ) != NULL )
+		{
+			checksum = ( checksum * 31 ) + ( unsigned int )( value_start - response->header ) + ( unsigned int )( value_end - value_start );
+		}
+	}
+
+	// The same as GetCookies(). Only the first cookie is indexed and the count tells us if we need to search for more.
+	unsigned short set_cookie_count = header_index.fields[ HEADER_FIELD_SET_COOKIE ].count;
+	char *field = GetIndexedHeaderValue( &header_index, HEADER_FIELD_SET_COOKIE, &value_start, &value_end );
+	while ( field != NULL )
+	{
+		checksum = ( checksum * 31 ) + ( unsigned int )( value_start - response->header ) + ( unsigned int )( value_end - value_start );
+
+		field = ( --set_cookie_count > 0 ? GetHeaderValue( value_end, "Set-Cookie", 10, &value_start, &value_end ) : NULL );
+	}
+
+	*end_of_header = tmp_terminator;
+
+	return checksum;
+}
+
+// Splits the corpus into separate NULL terminated buffers, one for each header.
+unsigned int LoadCorpus( char *file_path, RESPONSE **responses )
+{
+	FILE *f = fopen( file_path, "rb" );
+	if ( f == NULL )
+	{
+		return 0;
+	}
+
+	fseek( f, 0, SEEK_END );
+	long file_size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	char *corpus = ( char * )malloc( file_size + 1 );
+	file_size = ( long )fread( corpus, 1, file_size, f );
+	corpus[ file_size ] = 0;
+	fclose( f );
+
+	unsigned int response_count = 0;
+	unsigned int response_size = 16;
+	*responses = ( RESPONSE * )malloc( sizeof( RESPONSE ) * response_size );
+
+	char *header_start = corpus;
+	char *corpus_end = corpus + file_size;
+
+	while ( header_start < corpus_end )
+	{
+		char *header_end = strstr( header_start, "\r\n\r\n" );
+		if ( header_end == NULL )
+		{
+			break;
+		}
+
+		header_end += 4;
+
+		if ( response_count == response_size )
+		{
+			response_size *= 2;
+			*responses = ( RESPONSE * )realloc( *responses, sizeof( RESPONSE ) * response_size );
+		}
+
+		RESPONSE *response = &( *responses )[ response_count++ ];
+		response->header_length = ( unsigned int )( header_end - header_start );
+		response->header = ( char * )malloc( response->header_length + 1 );
+		memcpy( response->header, header_start, response->header_length );
+		response->header[ response->header_length ] = 0;
+
+		header_start = header_end;
+	}
+
+	free( corpus );
+
+	return response_count;
+}
+
+int main( int argc, char *argv[] )
+{
+	char *file_path = ( argc > 1 ? argv[ 1 ] : "..\\corpus\\response_headers.txt" );
+	unsigned int iterations = ( argc > 2 ? ( unsigned int )strtoul( argv[ 2 ], NULL, 10 ) : 200000 );
+
+	BS_Initialize();
+
+	RESPONSE *responses = NULL;
+	unsigned int response_count = LoadCorpus( file_path, &responses );
+	if ( response_count == 0 )
+	{
+		printf( "Unable to load any headers from %s\n", file_path );
+
+		return 1;
+	}
+
+	unsigned long long total_length = 0;
+	unsigned int field_count = 0;
+
+	for ( unsigned int i = 0; i < response_count; ++i )
+	{
+		total_length += responses[ i ].header_length;
+
+		for ( char *s = responses[ i ].header; ( s = strstr( s, "\r\n" ) ) != NULL; s += 2 )
+		{
+			++field_count;
+		}
+
+		// Both methods have to find the same values.
+		if ( ParseResponse_Old( &responses[ i ] ) != ParseResponse_New( &responses[ i ] ) )
+		{
+			printf( "Header %u: the indexed values don't match the searched values.\n", i + 1 );
+
+			return 1;
+		}
+	}
+
+	printf( "%u headers, %u lines, %llu bytes (%.1f bytes per header)\n", response_count, field_count, total_length, ( double )total_length / response_count );
+
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency( &frequency );
+
+	volatile unsigned int sink = 0;
+	double elapsed[ 2 ];
+
+	for ( unsigned char method = 0; method < 2; ++method )
+	{
+		QueryPerformanceCounter( &start );
+
+		for ( unsigned int j = 0; j < iterations; ++j )
+		{
+			for ( unsigned int i = 0; i < response_count; ++i )
+			{
+				sink += ( method == 0 ? ParseResponse_Old( &responses[ i ] ) : ParseResponse_New( &responses[ i ] ) );
+			}
+		}
+
+		QueryPerformanceCounter( &stop );
+
+		elapsed[ method ] = ( double )( stop.QuadPart - start.QuadPart ) / frequency.QuadPart;
+
+		double ns_per_header = ( elapsed[ method ] * 1000000000.0 ) / ( ( double )iterations * response_count );
+
+		printf( "%s: %8.1f ns per header, %7.1f MB/s\n", ( method == 0 ? "GetHeaderValue scans" : "HEADER_INDEX lookups" ), ns_per_header,
+				( ( double )total_length * iterations ) / ( elapsed[ method ] * 1048576.0 ) );
+	}
+
+	printf( "Speedup: %.2fx\n", elapsed[ 0 ] / elapsed[ 1 ] );
+
+	for ( unsigned int i = 0; i < response_count; ++i )
+	{
+		free( responses[ i ].header );
+	}
+
+	free( responses );
+
+	return 0;
+}
@@ -0,0 +1,2434 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the size and load time of version 5 and version 6 download history files.
+//
+// file_operations.cpp can't be linked here because it needs the rest of the program, so this is a model of it.
+// The functions that write, index, and parse entries are copied from it unchanged, with DOWNLOAD_INFO cut down to the fields that are saved:
+// version 5 is written with write_download_history_entry() from before version 6 replaced it, and read with parse_download_history_entry().
+// Version 6 is written with encode_download_history_entry() and read with decode_download_history_entry().
+// Loading is timed the way read_download_history() does it on one thread: index the entries, then parse each one.
+// The listview, the icons, and the journal are the same for both versions and aren't included.
+//
+// Usage: history_bench.exe [entries] [seed] [runs]
+//        history_bench.exe -f download_history [runs]
+//
+// With -f, the entries of a history file (either version) are loaded and saved in both versions.
+// Otherwise a history is generated. See GenerateEntry() for what's in it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "../../doublylinkedlist.h"
+
+#define _memcpy			memcpy
+#define _memset			memset
+#define _memcmp			memcmp
+#define _memmove		memmove
+
+#define _memzero( dest, count ) _memset( dest, 0, count )
+
+#define MAGIC_ID_DOWNLOADS		"HDM\x15"	// Version 6
+#define MAGIC_ID_DOWNLOADS_5	"HDM\x14"	// Version 5
+
+#define STATUS_NONE						0x00000000
+#define STATUS_PAUSED					0x00000004
+#define STATUS_QUEUED					0x00000008
+#define STATUS_COMPLETED				0x00000010
+#define STATUS_STOPPED					0x00000020
+#define STATUS_FAILED					0x00000080
+
+#define METHOD_GET			1
+#define METHOD_POST			2
+
+#define DOWNLOAD_OPERATION_GET_EXTENSION		0x10
+
+// The same as file_operations.cpp.
+#define HISTORY_ENTRY_FIXED_SIZE	( ( sizeof( ULONGLONG ) * 2 ) + ( sizeof( unsigned long long ) * 3 ) + ( sizeof( unsigned char ) * 5 ) + sizeof( unsigned int ) + sizeof( bool ) )
+
+#define HISTORY_VARINT_MAX_SIZE		10		// A 64-bit value in 7-bit groups.
+#define HISTORY_RECORD_LENGTH_SIZE	5		// A 32-bit value in 7-bit groups.
+
+// Each field's key is its id shifted left by 1 and OR'd with its wire type.
+#define HISTORY_WIRE_VARINT			0
+#define HISTORY_WIRE_BYTES			1		// A varint length followed by that many bytes.
+
+#define HISTORY_FIELD_ADD_TIME				1
+#define HISTORY_FIELD_DOWNLOADED			2
+#define HISTORY_FIELD_FILE_SIZE				3
+#define HISTORY_FIELD_DOWNLOAD_SPEED_LIMIT	4
+#define HISTORY_FIELD_PARTS					5
+#define HISTORY_FIELD_PARTS_LIMIT			6
+#define HISTORY_FIELD_STATUS				7
+#define HISTORY_FIELD_SSL_VERSION			8
+#define HISTORY_FIELD_PROCESSED_HEADER		9
+#define HISTORY_FIELD_DOWNLOAD_OPERATIONS	10
+#define HISTORY_FIELD_METHOD				11
+#define HISTORY_FIELD_LAST_MODIFIED			12
+#define HISTORY_FIELD_DOWNLOAD_DIRECTORY	13		// UTF-8
+#define HISTORY_FIELD_FILENAME				14		// UTF-8
+#define HISTORY_FIELD_URL					15		// UTF-8
+#define HISTORY_FIELD_COOKIES				16
+#define HISTORY_FIELD_HEADERS				17
+#define HISTORY_FIELD_DATA					18
+#define HISTORY_FIELD_USERNAME				19		// Encoded with encode_cipher.
+#define HISTORY_FIELD_PASSWORD				20		// Encoded with encode_cipher.
+#define HISTORY_FIELD_RANGE					21		// One per range: start, length, content length, content offset, and file write offset. Only read.
+#define HISTORY_FIELD_RANGE_DELTA			22		// One per range: the same values as HISTORY_FIELD_RANGE, stored as differences from what they usually are.
+
+struct RANGE_INFO
+{
+	unsigned long long	range_start;
+	unsigned long long	range_end;
+	unsigned long long	content_length;
+	unsigned long long	content_offset;
+
+	unsigned long long	file_write_offset;
+};
+
+struct AUTH_CREDENTIALS
+{
+	char				*username;
+	char				*password;
+};
+
+// The fields of connection.h's DOWNLOAD_INFO that are saved, and the ones that loading sets.
+struct DOWNLOAD_INFO
+{
+	wchar_t				file_path[ MAX_PATH ];
+	ULARGE_INTEGER		add_time;
+	ULARGE_INTEGER		last_modified;
+	unsigned long long	last_downloaded;
+	unsigned long long	downloaded;
+	unsigned long long	file_size;
+	unsigned long long	download_speed_limit;
+	AUTH_CREDENTIALS	auth_info;
+	wchar_t				*url;
+	DoublyLinkedList	*range_list;
+	DoublyLinkedList	*print_range_list;
+	char				*cookies;
+	char				*headers;
+	char				*data;
+	HANDLE				hFile;
+	unsigned int		filename_offset;
+	unsigned int		file_extension_offset;
+	unsigned int		status;
+	unsigned char		parts;
+	unsigned char		parts_limit;
+	unsigned char		download_operations;
+	unsigned char		method;
+	char				ssl_version;
+	bool				processed_header;
+};
+
+// lite_ntdll.cpp
+// A NULL source zeroes the destination. The version 5 writer relies on this for empty cookies, headers, and data.
+
+void *_memcpy_s( void *dest, size_t size, const void *src, size_t count )
+{
+	if ( src == NULL || size < count )
+	{
+		_memzero( dest, size );
+		return dest;
+	}
+
+	return _memcpy( dest, src, count );
+}
+
+void *_wmemcpy_s( void *dest, size_t size, const void *src, size_t count )
+{
+	size_t wsize = sizeof( wchar_t ) * size;
+	size_t wcount = sizeof( wchar_t ) * count;
+
+	if ( src == NULL || wsize < wcount )
+	{
+		_memzero( dest, wsize );
+		return dest;
+	}
+
+	return _memcpy( dest, src, wcount );
+}
+
+// utilities.cpp
+
+#define ROTATE_LEFT( x, n ) ( ( ( x ) << ( n ) ) | ( ( x ) >> ( 8 - ( n ) ) ) )
+#define ROTATE_RIGHT( x, n ) ( ( ( x ) >> ( n ) ) | ( ( x ) << ( 8 - ( n ) ) ) )
+
+void encode_cipher( char *buffer, int buffer_length )
+{
+	int offset = buffer_length + 128;
+	for ( int i = 0; i < buffer_length; ++i )
+	{
+		*buffer ^= ( unsigned char )buffer_length;
+		*buffer = ( *buffer + offset ) % 256;
+		*buffer = ROTATE_LEFT( ( unsigned char )*buffer, offset % 8 );
+
+		buffer++;
+		--offset;
+	}
+}
+
+void decode_cipher( char *buffer, int buffer_length )
+{
+	int offset = buffer_length + 128;
+	for ( int i = buffer_length; i > 0; --i )
+	{
+		*buffer = ROTATE_RIGHT( ( unsigned char )*buffer, offset % 8 );
+		*buffer = ( *buffer - offset ) % 256;
+		*buffer ^= ( unsigned char )buffer_length;
+
+		buffer++;
+		--offset;
+	}
+}
+
+// CRC-32 (IEEE 802.3) lookup tables for the reflected polynomial 0xEDB88320.
+// Table 0 is the byte-at-a-time table. Table n advances a byte through n more zero bytes so that eight bytes can be folded in per step.
+const unsigned int crc32_table[ 8 ][ 256 ] =
+{
+	{
+		0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+		0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+		0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+		0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+		0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+		0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+		0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+		0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+		0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+		0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+		0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+		0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+		0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+		0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+		0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+		0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+		0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+		0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+		0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+		0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+		0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+		0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+		0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+		0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+		0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+		0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+		0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+		0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+		0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+		0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+		0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+		0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+	},
+	{
+		0x00000000, 0x191B3141, 0x32366282, 0x2B2D53C3, 0x646CC504, 0x7D77F445, 0x565AA786, 0x4F4196C7,
+		0xC8D98A08, 0xD1C2BB49, 0xFAEFE88A, 0xE3F4D9CB, 0xACB54F0C, 0xB5AE7E4D, 0x9E832D8E, 0x87981CCF,
+		0x4AC21251, 0x53D92310, 0x78F470D3, 0x61EF4192, 0x2EAED755, 0x37B5E614, 0x1C98B5D7, 0x05838496,
+		0x821B9859, 0x9B00A918, 0xB02DFADB, 0xA936CB9A, 0xE6775D5D, 0xFF6C6C1C, 0xD4413FDF, 0xCD5A0E9E,
+		0x958424A2, 0x8C9F15E3, 0xA7B24620, 0xBEA97761, 0xF1E8E1A6, 0xE8F3D0E7, 0xC3DE8324, 0xDAC5B265,
+		0x5D5DAEAA, 0x44469FEB, 0x6F6BCC28, 0x7670FD69, 0x39316BAE, 0x202A5AEF, 0x0B07092C, 0x121C386D,
+		0xDF4636F3, 0xC65D07B2, 0xED705471, 0xF46B6530, 0xBB2AF3F7, 0xA231C2B6, 0x891C9175, 0x9007A034,
+		0x179FBCFB, 0x0E848DBA, 0x25A9DE79, 0x3CB2EF38, 0x73F379FF, 0x6AE848BE, 0x41C51B7D, 0x58DE2A3C,
+		0xF0794F05, 0xE9627E44, 0xC24F2D87, 0xDB541CC6, 0x94158A01, 0x8D0EBB40, 0xA623E883, 0xBF38D9C2,
+		0x38A0C50D, 0x21BBF44C, 0x0A96A78F, 0x138D96CE, 0x5CCC0009, 0x45D73148, 0x6EFA628B, 0x77E153CA,
+		0xBABB5D54, 0xA3A06C15, 0x888D3FD6, 0x91960E97, 0xDED79850, 0xC7CCA911, 0xECE1FAD2, 0xF5FACB93,
+		0x7262D75C, 0x6B79E61D, 0x4054B5DE, 0x594F849F, 0x160E1258, 0x0F152319, 0x243870DA, 0x3D23419B,
+		0x65FD6BA7, 0x7CE65AE6, 0x57CB0925, 0x4ED03864, 0x0191AEA3, 0x188A9FE2, 0x33A7CC21, 0x2ABCFD60,
+		0xAD24E1AF, 0xB43FD0EE, 0x9F12832D, 0x8609B26C, 0xC94824AB, 0xD05315EA, 0xFB7E4629, 0xE2657768,
+		0x2F3F79F6, 0x362448B7, 0x1D091B74, 0x04122A35, 0x4B53BCF2, 0x52488DB3, 0x7965DE70, 0x607EEF31,
+		0xE7E6F3FE, 0xFEFDC2BF, 0xD5D0917C, 0xCCCBA03D, 0x838A36FA, 0x9A9107BB, 0xB1BC5478, 0xA8A76539,
+		0x3B83984B, 0x2298A90A, 0x09B5FAC9, 0x10AECB88, 0x5FEF5D4F, 0x46F46C0E, 0x6DD93FCD, 0x74C20E8C,
+		0xF35A1243, 0xEA412302, 0xC16C70C1, 0xD8774180, 0x9736D747, 0x8E2DE606, 0xA500B5C5, 0xBC1B8484,
+		0x71418A1A, 0x685ABB5B, 0x4377E898, 0x5A6CD9D9, 0x152D4F1E, 0x0C367E5F, 0x271B2D9C, 0x3E001CDD,
+		0xB9980012, 0xA0833153, 0x8BAE6290, 0x92B553D1, 0xDDF4C516, 0xC4EFF457, 0xEFC2A794, 0xF6D996D5,
+		0xAE07BCE9, 0xB71C8DA8, 0x9C31DE6B, 0x852AEF2A, 0xCA6B79ED, 0xD37048AC, 0xF85D1B6F, 0xE1462A2E,
+		0x66DE36E1, 0x7FC507A0, 0x54E85463, 0x4DF36522, 0x02B2F3E5, 0x1BA9C2A4, 0x30849167, 0x299FA026,
+		0xE4C5AEB8, 0xFDDE9FF9, 0xD6F3CC3A, 0xCFE8FD7B, 0x80A96BBC, 0x99B25AFD, 0xB29F093E, 0xAB84387F,
+		0x2C1C24B0, 0x350715F1, 0x1E2A4632, 0x07317773, 0x4870E1B4, 0x516BD0F5, 0x7A468336, 0x635DB277,
+		0xCBFAD74E, 0xD2E1E60F, 0xF9CCB5CC, 0xE0D7848D, 0xAF96124A, 0xB68D230B, 0x9DA070C8, 0x84BB4189,
+		0x03235D46, 0x1A386C07, 0x31153FC4, 0x280E0E85, 0x674F9842, 0x7E54A903, 0x5579FAC0, 0x4C62CB81,
+		0x8138C51F, 0x9823F45E, 0xB30EA79D, 0xAA1596DC, 0xE554001B, 0xFC4F315A, 0xD7626299, 0xCE7953D8,
+		0x49E14F17, 0x50FA7E56, 0x7BD72D95, 0x62CC1CD4, 0x2D8D8A13, 0x3496BB52, 0x1FBBE891, 0x06A0D9D0,
+		0x5E7EF3EC, 0x4765C2AD, 0x6C48916E, 0x7553A02F, 0x3A1236E8, 0x230907A9, 0x0824546A, 0x113F652B,
+		0x96A779E4, 0x8FBC48A5, 0xA4911B66, 0xBD8A2A27, 0xF2CBBCE0, 0xEBD08DA1, 0xC0FDDE62, 0xD9E6EF23,
+		0x14BCE1BD, 0x0DA7D0FC, 0x268A833F, 0x3F91B27E, 0x70D024B9, 0x69CB15F8, 0x42E6463B, 0x5BFD777A,
+		0xDC656BB5, 0xC57E5AF4, 0xEE530937, 0xF7483876, 0xB809AEB1, 0xA1129FF0, 0x8A3FCC33, 0x9324FD72
+	},
+	{
+		0x00000000, 0x01C26A37, 0x0384D46E, 0x0246BE59, 0x0709A8DC, 0x06CBC2EB, 0x048D7CB2, 0x054F1685,
+		0x0E1351B8, 0x0FD13B8F, 0x0D9785D6, 0x0C55EFE1, 0x091AF964, 0x08D89353, 0x0A9E2D0A, 0x0B5C473D,
+		0x1C26A370, 0x1DE4C947, 0x1FA2771E, 0x1E601D29, 0x1B2F0BAC, 0x1AED619B, 0x18ABDFC2, 0x1969B5F5,
+		0x1235F2C8, 0x13F798FF, 0x11B126A6, 0x10734C91, 0x153C5A14, 0x14FE3023, 0x16B88E7A, 0x177AE44D,
+		0x384D46E0, 0x398F2CD7, 0x3BC9928E, 0x3A0BF8B9, 0x3F44EE3C, 0x3E86840B, 0x3CC03A52, 0x3D025065,
+		0x365E1758, 0x379C7D6F, 0x35DAC336, 0x3418A901, 0x3157BF84, 0x3095D5B3, 0x32D36BEA, 0x331101DD,
+		0x246BE590, 0x25A98FA7, 0x27EF31FE, 0x262D5BC9, 0x23624D4C, 0x22A0277B, 0x20E69922, 0x2124F315,
+		0x2A78B428, 0x2BBADE1F, 0x29FC6046, 0x283E0A71, 0x2D711CF4, 0x2CB376C3, 0x2EF5C89A, 0x2F37A2AD,
+		0x709A8DC0, 0x7158E7F7, 0x731E59AE, 0x72DC3399, 0x7793251C, 0x76514F2B, 0x7417F172, 0x75D59B45,
+		0x7E89DC78, 0x7F4BB64F, 0x7D0D0816, 0x7CCF6221, 0x798074A4, 0x78421E93, 0x7A04A0CA, 0x7BC6CAFD,
+		0x6CBC2EB0, 0x6D7E4487, 0x6F38FADE, 0x6EFA90E9, 0x6BB5866C, 0x6A77EC5B, 0x68315202, 0x69F33835,
+		0x62AF7F08, 0x636D153F, 0x612BAB66, 0x60E9C151, 0x65A6D7D4, 0x6464BDE3, 0x662203BA, 0x67E0698D,
+		0x48D7CB20, 0x4915A117, 0x4B531F4E, 0x4A917579, 0x4FDE63FC, 0x4E1C09CB, 0x4C5AB792, 0x4D98DDA5,
+		0x46C49A98, 0x4706F0AF, 0x45404EF6, 0x448224C1, 0x41CD3244, 0x400F5873, 0x4249E62A, 0x438B8C1D,
+		0x54F16850, 0x55330267, 0x5775BC3E, 0x56B7D609, 0x53F8C08C, 0x523AAABB, 0x507C14E2, 0x51BE7ED5,
+		0x5AE239E8, 0x5B2053DF, 0x5966ED86, 0x58A487B1, 0x5DEB9134, 0x5C29FB03, 0x5E6F455A, 0x5FAD2F6D,
+		0xE1351B80, 0xE0F771B7, 0xE2B1CFEE, 0xE373A5D9, 0xE63CB35C, 0xE7FED96B, 0xE5B86732, 0xE47A0D05,
+		0xEF264A38, 0xEEE4200F, 0xECA29E56, 0xED60F461, 0xE82FE2E4, 0xE9ED88D3, 0xEBAB368A, 0xEA695CBD,
+		0xFD13B8F0, 0xFCD1D2C7, 0xFE976C9E, 0xFF5506A9, 0xFA1A102C, 0xFBD87A1B, 0xF99EC442, 0xF85CAE75,
+		0xF300E948, 0xF2C2837F, 0xF0843D26, 0xF1465711, 0xF4094194, 0xF5CB2BA3, 0xF78D95FA, 0xF64FFFCD,
+		0xD9785D60, 0xD8BA3757, 0xDAFC890E, 0xDB3EE339, 0xDE71F5BC, 0xDFB39F8B, 0xDDF521D2, 0xDC374BE5,
+		0xD76B0CD8, 0xD6A966EF, 0xD4EFD8B6, 0xD52DB281, 0xD062A404, 0xD1A0CE33, 0xD3E6706A, 0xD2241A5D,
+		0xC55EFE10, 0xC49C9427, 0xC6DA2A7E, 0xC7184049, 0xC25756CC, 0xC3953CFB, 0xC1D382A2, 0xC011E895,
+		0xCB4DAFA8, 0xCA8FC59F, 0xC8C97BC6, 0xC90B11F1, 0xCC440774, 0xCD866D43, 0xCFC0D31A, 0xCE02B92D,
+		0x91AF9640, 0x906DFC77, 0x922B422E, 0x93E92819, 0x96A63E9C, 0x976454AB, 0x9522EAF2, 0x94E080C5,
+		0x9FBCC7F8, 0x9E7EADCF, 0x9C381396, 0x9DFA79A1, 0x98B56F24, 0x99770513, 0x9B31BB4A, 0x9AF3D17D,
+		0x8D893530, 0x8C4B5F07, 0x8E0DE15E, 0x8FCF8B69, 0x8A809DEC, 0x8B42F7DB, 0x89044982, 0x88C623B5,
+		0x839A6488, 0x82580EBF, 0x801EB0E6, 0x81DCDAD1, 0x8493CC54, 0x8551A663, 0x8717183A, 0x86D5720D,
+		0xA9E2D0A0, 0xA820BA97, 0xAA6604CE, 0xABA46EF9, 0xAEEB787C, 0xAF29124B, 0xAD6FAC12, 0xACADC625,
+		0xA7F18118, 0xA633EB2F, 0xA4755576, 0xA5B73F41, 0xA0F829C4, 0xA13A43F3, 0xA37CFDAA, 0xA2BE979D,
+		0xB5C473D0, 0xB40619E7, 0xB640A7BE, 0xB782CD89, 0xB2CDDB0C, 0xB30FB13B, 0xB1490F62, 0xB08B6555,
+		0xBBD72268, 0xBA15485F, 0xB853F606, 0xB9919C31, 0xBCDE8AB4, 0xBD1CE083, 0xBF5A5EDA, 0xBE9834ED
+	},
+	{
+		0x00000000, 0xB8BC6765, 0xAA09C88B, 0x12B5AFEE, 0x8F629757, 0x37DEF032, 0x256B5FDC, 0x9DD738B9,
+		0xC5B428EF, 0x7D084F8A, 0x6FBDE064, 0xD7018701, 0x4AD6BFB8, 0xF26AD8DD, 0xE0DF7733, 0x58631056,
+		0x5019579F, 0xE8A530FA, 0xFA109F14, 0x42ACF871, 0xDF7BC0C8, 0x67C7A7AD, 0x75720843, 0xCDCE6F26,
+		0x95AD7F70, 0x2D111815, 0x3FA4B7FB, 0x8718D09E, 0x1ACFE827, 0xA2738F42, 0xB0C620AC, 0x087A47C9,
+		0xA032AF3E, 0x188EC85B, 0x0A3B67B5, 0xB28700D0, 0x2F503869, 0x97EC5F0C, 0x8559F0E2, 0x3DE59787,
+		0x658687D1, 0xDD3AE0B4, 0xCF8F4F5A, 0x7733283F, 0xEAE41086, 0x525877E3, 0x40EDD80D, 0xF851BF68,
+		0xF02BF8A1, 0x48979FC4, 0x5A22302A, 0xE29E574F, 0x7F496FF6, 0xC7F50893, 0xD540A77D, 0x6DFCC018,
+		0x359FD04E, 0x8D23B72B, 0x9F9618C5, 0x272A7FA0, 0xBAFD4719, 0x0241207C, 0x10F48F92, 0xA848E8F7,
+		0x9B14583D, 0x23A83F58, 0x311D90B6, 0x89A1F7D3, 0x1476CF6A, 0xACCAA80F, 0xBE7F07E1, 0x06C36084,
+		0x5EA070D2, 0xE61C17B7, 0xF4A9B859, 0x4C15DF3C, 0xD1C2E785, 0x697E80E0, 0x7BCB2F0E, 0xC377486B,
+		0xCB0D0FA2, 0x73B168C7, 0x6104C729, 0xD9B8A04C, 0x446F98F5, 0xFCD3FF90, 0xEE66507E, 0x56DA371B,
+		0x0EB9274D, 0xB6054028, 0xA4B0EFC6, 0x1C0C88A3, 0x81DBB01A, 0x3967D77F, 0x2BD27891, 0x936E1FF4,
+		0x3B26F703, 0x839A9066, 0x912F3F88, 0x299358ED, 0xB4446054, 0x0CF80731, 0x1E4DA8DF, 0xA6F1CFBA,
+		0xFE92DFEC, 0x462EB889, 0x549B1767, 0xEC277002, 0x71F048BB, 0xC94C2FDE, 0xDBF98030, 0x6345E755,
+		0x6B3FA09C, 0xD383C7F9, 0xC1366817, 0x798A0F72, 0xE45D37CB, 0x5CE150AE, 0x4E54FF40, 0xF6E89825,
+		0xAE8B8873, 0x1637EF16, 0x048240F8, 0xBC3E279D, 0x21E91F24, 0x99557841, 0x8BE0D7AF, 0x335CB0CA,
+		0xED59B63B, 0x55E5D15E, 0x47507EB0, 0xFFEC19D5, 0x623B216C, 0xDA874609, 0xC832E9E7, 0x708E8E82,
+		0x28ED9ED4, 0x9051F9B1, 0x82E4565F, 0x3A58313A, 0xA78F0983, 0x1F336EE6, 0x0D86C108, 0xB53AA66D,
+		0xBD40E1A4, 0x05FC86C1, 0x1749292F, 0xAFF54E4A, 0x322276F3, 0x8A9E1196, 0x982BBE78, 0x2097D91D,
+		0x78F4C94B, 0xC048AE2E, 0xD2FD01C0, 0x6A4166A5, 0xF7965E1C, 0x4F2A3979, 0x5D9F9697, 0xE523F1F2,
+		0x4D6B1905, 0xF5D77E60, 0xE762D18E, 0x5FDEB6EB, 0xC2098E52, 0x7AB5E937, 0x680046D9, 0xD0BC21BC,
+		0x88DF31EA, 0x3063568F, 0x22D6F961, 0x9A6A9E04, 0x07BDA6BD, 0xBF01C1D8, 0xADB46E36, 0x15080953,
+		0x1D724E9A, 0xA5CE29FF, 0xB77B8611, 0x0FC7E174, 0x9210D9CD, 0x2AACBEA8, 0x38191146, 0x80A57623,
+		0xD8C66675, 0x607A0110, 0x72CFAEFE, 0xCA73C99B, 0x57A4F122, 0xEF189647, 0xFDAD39A9, 0x45115ECC,
+		0x764DEE06, 0xCEF18963, 0xDC44268D, 0x64F841E8, 0xF92F7951, 0x41931E34, 0x5326B1DA, 0xEB9AD6BF,
+		0xB3F9C6E9, 0x0B45A18C, 0x19F00E62, 0xA14C6907, 0x3C9B51BE, 0x842736DB, 0x96929935, 0x2E2EFE50,
+		0x2654B999, 0x9EE8DEFC, 0x8C5D7112, 0x34E11677, 0xA9362ECE, 0x118A49AB, 0x033FE645, 0xBB838120,
+		0xE3E09176, 0x5B5CF613, 0x49E959FD, 0xF1553E98, 0x6C820621, 0xD43E6144, 0xC68BCEAA, 0x7E37A9CF,
+		0xD67F4138, 0x6EC3265D, 0x7C7689B3, 0xC4CAEED6, 0x591DD66F, 0xE1A1B10A, 0xF3141EE4, 0x4BA87981,
+		0x13CB69D7, 0xAB770EB2, 0xB9C2A15C, 0x017EC639, 0x9CA9FE80, 0x241599E5, 0x36A0360B, 0x8E1C516E,
+		0x866616A7, 0x3EDA71C2, 0x2C6FDE2C, 0x94D3B949, 0x090481F0, 0xB1B8E695, 0xA30D497B, 0x1BB12E1E,
+		0x43D23E48, 0xFB6E592D, 0xE9DBF6C3, 0x516791A6, 0xCCB0A91F, 0x740CCE7A, 0x66B96194, 0xDE0506F1
+	},
+	{
+		0x00000000, 0x3D6029B0, 0x7AC05360, 0x47A07AD0, 0xF580A6C0, 0xC8E08F70, 0x8F40F5A0, 0xB220DC10,
+		0x30704BC1, 0x0D106271, 0x4AB018A1, 0x77D03111, 0xC5F0ED01, 0xF890C4B1, 0xBF30BE61, 0x825097D1,
+		0x60E09782, 0x5D80BE32, 0x1A20C4E2, 0x2740ED52, 0x95603142, 0xA80018F2, 0xEFA06222, 0xD2C04B92,
+		0x5090DC43, 0x6DF0F5F3, 0x2A508F23, 0x1730A693, 0xA5107A83, 0x98705333, 0xDFD029E3, 0xE2B00053,
+		0xC1C12F04, 0xFCA106B4, 0xBB017C64, 0x866155D4, 0x344189C4, 0x0921A074, 0x4E81DAA4, 0x73E1F314,
+		0xF1B164C5, 0xCCD14D75, 0x8B7137A5, 0xB6111E15, 0x0431C205, 0x3951EBB5, 0x7EF19165, 0x4391B8D5,
+		0xA121B886, 0x9C419136, 0xDBE1EBE6, 0xE681C256, 0x54A11E46, 0x69C137F6, 0x2E614D26, 0x13016496,
+		0x9151F347, 0xAC31DAF7, 0xEB91A027, 0xD6F18997, 0x64D15587, 0x59B17C37, 0x1E1106E7, 0x23712F57,
+		0x58F35849, 0x659371F9, 0x22330B29, 0x1F532299, 0xAD73FE89, 0x9013D739, 0xD7B3ADE9, 0xEAD38459,
+		0x68831388, 0x55E33A38, 0x124340E8, 0x2F236958, 0x9D03B548, 0xA0639CF8, 0xE7C3E628, 0xDAA3CF98,
+		0x3813CFCB, 0x0573E67B, 0x42D39CAB, 0x7FB3B51B, 0xCD93690B, 0xF0F340BB, 0xB7533A6B, 0x8A3313DB,
+		0x0863840A, 0x3503ADBA, 0x72A3D76A, 0x4FC3FEDA, 0xFDE322CA, 0xC0830B7A, 0x872371AA, 0xBA43581A,
+		0x9932774D, 0xA4525EFD, 0xE3F2242D, 0xDE920D9D, 0x6CB2D18D, 0x51D2F83D, 0x167282ED, 0x2B12AB5D,
+		0xA9423C8C, 0x9422153C, 0xD3826FEC, 0xEEE2465C, 0x5CC29A4C, 0x61A2B3FC, 0x2602C92C, 0x1B62E09C,
+		0xF9D2E0CF, 0xC4B2C97F, 0x8312B3AF, 0xBE729A1F, 0x0C52460F, 0x31326FBF, 0x7692156F, 0x4BF23CDF,
+		0xC9A2AB0E, 0xF4C282BE, 0xB362F86E, 0x8E02D1DE, 0x3C220DCE, 0x0142247E, 0x46E25EAE, 0x7B82771E,
+		0xB1E6B092, 0x8C869922, 0xCB26E3F2, 0xF646CA42, 0x44661652, 0x79063FE2, 0x3EA64532, 0x03C66C82,
+		0x8196FB53, 0xBCF6D2E3, 0xFB56A833, 0xC6368183, 0x74165D93, 0x49767423, 0x0ED60EF3, 0x33B62743,
+		0xD1062710, 0xEC660EA0, 0xABC67470, 0x96A65DC0, 0x248681D0, 0x19E6A860, 0x5E46D2B0, 0x6326FB00,
+		0xE1766CD1, 0xDC164561, 0x9BB63FB1, 0xA6D61601, 0x14F6CA11, 0x2996E3A1, 0x6E369971, 0x5356B0C1,
+		0x70279F96, 0x4D47B626, 0x0AE7CCF6, 0x3787E546, 0x85A73956, 0xB8C710E6, 0xFF676A36, 0xC2074386,
+		0x4057D457, 0x7D37FDE7, 0x3A978737, 0x07F7AE87, 0xB5D77297, 0x88B75B27, 0xCF1721F7, 0xF2770847,
+		0x10C70814, 0x2DA721A4, 0x6A075B74, 0x576772C4, 0xE547AED4, 0xD8278764, 0x9F87FDB4, 0xA2E7D404,
+		0x20B743D5, 0x1DD76A65, 0x5A7710B5, 0x67173905, 0xD537E515, 0xE857CCA5, 0xAFF7B675, 0x92979FC5,
+		0xE915E8DB, 0xD475C16B, 0x93D5BBBB, 0xAEB5920B, 0x1C954E1B, 0x21F567AB, 0x66551D7B, 0x5B3534CB,
+		0xD965A31A, 0xE4058AAA, 0xA3A5F07A, 0x9EC5D9CA, 0x2CE505DA, 0x11852C6A, 0x562556BA, 0x6B457F0A,
+		0x89F57F59, 0xB49556E9, 0xF3352C39, 0xCE550589, 0x7C75D999, 0x4115F029, 0x06B58AF9, 0x3BD5A349,
+		0xB9853498, 0x84E51D28, 0xC34567F8, 0xFE254E48, 0x4C059258, 0x7165BBE8, 0x36C5C138, 0x0BA5E888,
+		0x28D4C7DF, 0x15B4EE6F, 0x521494BF, 0x6F74BD0F, 0xDD54611F, 0xE03448AF, 0xA794327F, 0x9AF41BCF,
+		0x18A48C1E, 0x25C4A5AE, 0x6264DF7E, 0x5F04F6CE, 0xED242ADE, 0xD044036E, 0x97E479BE, 0xAA84500E,
+		0x4834505D, 0x755479ED, 0x32F4033D, 0x0F942A8D, 0xBDB4F69D, 0x80D4DF2D, 0xC774A5FD, 0xFA148C4D,
+		0x78441B9C, 0x4524322C, 0x028448FC, 0x3FE4614C, 0x8DC4BD5C, 0xB0A494EC, 0xF704EE3C, 0xCA64C78C
+	},
+	{
+		0x00000000, 0xCB5CD3A5, 0x4DC8A10B, 0x869472AE, 0x9B914216, 0x50CD91B3, 0xD659E31D, 0x1D0530B8,
+		0xEC53826D, 0x270F51C8, 0xA19B2366, 0x6AC7F0C3, 0x77C2C07B, 0xBC9E13DE, 0x3A0A6170, 0xF156B2D5,
+		0x03D6029B, 0xC88AD13E, 0x4E1EA390, 0x85427035, 0x9847408D, 0x531B9328, 0xD58FE186, 0x1ED33223,
+		0xEF8580F6, 0x24D95353, 0xA24D21FD, 0x6911F258, 0x7414C2E0, 0xBF481145, 0x39DC63EB, 0xF280B04E,
+		0x07AC0536, 0xCCF0D693, 0x4A64A43D, 0x81387798, 0x9C3D4720, 0x57619485, 0xD1F5E62B, 0x1AA9358E,
+		0xEBFF875B, 0x20A354FE, 0xA6372650, 0x6D6BF5F5, 0x706EC54D, 0xBB3216E8, 0x3DA66446, 0xF6FAB7E3,
+		0x047A07AD, 0xCF26D408, 0x49B2A6A6, 0x82EE7503, 0x9FEB45BB, 0x54B7961E, 0xD223E4B0, 0x197F3715,
+		0xE82985C0, 0x23755665, 0xA5E124CB, 0x6EBDF76E, 0x73B8C7D6, 0xB8E41473, 0x3E7066DD, 0xF52CB578,
+		0x0F580A6C, 0xC404D9C9, 0x4290AB67, 0x89CC78C2, 0x94C9487A, 0x5F959BDF, 0xD901E971, 0x125D3AD4,
+		0xE30B8801, 0x28575BA4, 0xAEC3290A, 0x659FFAAF, 0x789ACA17, 0xB3C619B2, 0x35526B1C, 0xFE0EB8B9,
+		0x0C8E08F7, 0xC7D2DB52, 0x4146A9FC, 0x8A1A7A59, 0x971F4AE1, 0x5C439944, 0xDAD7EBEA, 0x118B384F,
+		0xE0DD8A9A, 0x2B81593F, 0xAD152B91, 0x6649F834, 0x7B4CC88C, 0xB0101B29, 0x36846987, 0xFDD8BA22,
+		0x08F40F5A, 0xC3A8DCFF, 0x453CAE51, 0x8E607DF4, 0x93654D4C, 0x58399EE9, 0xDEADEC47, 0x15F13FE2,
+		0xE4A78D37, 0x2FFB5E92, 0xA96F2C3C, 0x6233FF99, 0x7F36CF21, 0xB46A1C84, 0x32FE6E2A, 0xF9A2BD8F,
+		0x0B220DC1, 0xC07EDE64, 0x46EAACCA, 0x8DB67F6F, 0x90B34FD7, 0x5BEF9C72, 0xDD7BEEDC, 0x16273D79,
+		0xE7718FAC, 0x2C2D5C09, 0xAAB92EA7, 0x61E5FD02, 0x7CE0CDBA, 0xB7BC1E1F, 0x31286CB1, 0xFA74BF14,
+		0x1EB014D8, 0xD5ECC77D, 0x5378B5D3, 0x98246676, 0x852156CE, 0x4E7D856B, 0xC8E9F7C5, 0x03B52460,
+		0xF2E396B5, 0x39BF4510, 0xBF2B37BE, 0x7477E41B, 0x6972D4A3, 0xA22E0706, 0x24BA75A8, 0xEFE6A60D,
+		0x1D661643, 0xD63AC5E6, 0x50AEB748, 0x9BF264ED, 0x86F75455, 0x4DAB87F0, 0xCB3FF55E, 0x006326FB,
+		0xF135942E, 0x3A69478B, 0xBCFD3525, 0x77A1E680, 0x6AA4D638, 0xA1F8059D, 0x276C7733, 0xEC30A496,
+		0x191C11EE, 0xD240C24B, 0x54D4B0E5, 0x9F886340, 0x828D53F8, 0x49D1805D, 0xCF45F2F3, 0x04192156,
+		0xF54F9383, 0x3E134026, 0xB8873288, 0x73DBE12D, 0x6EDED195, 0xA5820230, 0x2316709E, 0xE84AA33B,
+		0x1ACA1375, 0xD196C0D0, 0x5702B27E, 0x9C5E61DB, 0x815B5163, 0x4A0782C6, 0xCC93F068, 0x07CF23CD,
+		0xF6999118, 0x3DC542BD, 0xBB513013, 0x700DE3B6, 0x6D08D30E, 0xA65400AB, 0x20C07205, 0xEB9CA1A0,
+		0x11E81EB4, 0xDAB4CD11, 0x5C20BFBF, 0x977C6C1A, 0x8A795CA2, 0x41258F07, 0xC7B1FDA9, 0x0CED2E0C,
+		0xFDBB9CD9, 0x36E74F7C, 0xB0733DD2, 0x7B2FEE77, 0x662ADECF, 0xAD760D6A, 0x2BE27FC4, 0xE0BEAC61,
+		0x123E1C2F, 0xD962CF8A, 0x5FF6BD24, 0x94AA6E81, 0x89AF5E39, 0x42F38D9C, 0xC467FF32, 0x0F3B2C97,
+		0xFE6D9E42, 0x35314DE7, 0xB3A53F49, 0x78F9ECEC, 0x65FCDC54, 0xAEA00FF1, 0x28347D5F, 0xE368AEFA,
+		0x16441B82, 0xDD18C827, 0x5B8CBA89, 0x90D0692C, 0x8DD55994, 0x46898A31, 0xC01DF89F, 0x0B412B3A,
+		0xFA1799EF, 0x314B4A4A, 0xB7DF38E4, 0x7C83EB41, 0x6186DBF9, 0xAADA085C, 0x2C4E7AF2, 0xE712A957,
+		0x15921919, 0xDECECABC, 0x585AB812, 0x93066BB7, 0x8E035B0F, 0x455F88AA, 0xC3CBFA04, 0x089729A1,
+		0xF9C19B74, 0x329D48D1, 0xB4093A7F, 0x7F55E9DA, 0x6250D962, 0xA90C0AC7, 0x2F987869, 0xE4C4ABCC
+	},
+	{
+		0x00000000, 0xA6770BB4, 0x979F1129, 0x31E81A9D, 0xF44F2413, 0x52382FA7, 0x63D0353A, 0xC5A73E8E,
+		0x33EF4E67, 0x959845D3, 0xA4705F4E, 0x020754FA, 0xC7A06A74, 0x61D761C0, 0x503F7B5D, 0xF64870E9,
+		0x67DE9CCE, 0xC1A9977A, 0xF0418DE7, 0x56368653, 0x9391B8DD, 0x35E6B369, 0x040EA9F4, 0xA279A240,
+		0x5431D2A9, 0xF246D91D, 0xC3AEC380, 0x65D9C834, 0xA07EF6BA, 0x0609FD0E, 0x37E1E793, 0x9196EC27,
+		0xCFBD399C, 0x69CA3228, 0x582228B5, 0xFE552301, 0x3BF21D8F, 0x9D85163B, 0xAC6D0CA6, 0x0A1A0712,
+		0xFC5277FB, 0x5A257C4F, 0x6BCD66D2, 0xCDBA6D66, 0x081D53E8, 0xAE6A585C, 0x9F8242C1, 0x39F54975,
+		0xA863A552, 0x0E14AEE6, 0x3FFCB47B, 0x998BBFCF, 0x5C2C8141, 0xFA5B8AF5, 0xCBB39068, 0x6DC49BDC,
+		0x9B8CEB35, 0x3DFBE081, 0x0C13FA1C, 0xAA64F1A8, 0x6FC3CF26, 0xC9B4C492, 0xF85CDE0F, 0x5E2BD5BB,
+		0x440B7579, 0xE27C7ECD, 0xD3946450, 0x75E36FE4, 0xB044516A, 0x16335ADE, 0x27DB4043, 0x81AC4BF7,
+		0x77E43B1E, 0xD19330AA, 0xE07B2A37, 0x460C2183, 0x83AB1F0D, 0x25DC14B9, 0x14340E24, 0xB2430590,
+		0x23D5E9B7, 0x85A2E203, 0xB44AF89E, 0x123DF32A, 0xD79ACDA4, 0x71EDC610, 0x4005DC8D, 0xE672D739,
+		0x103AA7D0, 0xB64DAC64, 0x87A5B6F9, 0x21D2BD4D, 0xE47583C3, 0x42028877, 0x73EA92EA, 0xD59D995E,
+		0x8BB64CE5, 0x2DC14751, 0x1C295DCC, 0xBA5E5678, 0x7FF968F6, 0xD98E6342, 0xE86679DF, 0x4E11726B,
+		0xB8590282, 0x1E2E0936, 0x2FC613AB, 0x89B1181F, 0x4C162691, 0xEA612D25, 0xDB8937B8, 0x7DFE3C0C,
+		0xEC68D02B, 0x4A1FDB9F, 0x7BF7C102, 0xDD80CAB6, 0x1827F438, 0xBE50FF8C, 0x8FB8E511, 0x29CFEEA5,
+		0xDF879E4C, 0x79F095F8, 0x48188F65, 0xEE6F84D1, 0x2BC8BA5F, 0x8DBFB1EB, 0xBC57AB76, 0x1A20A0C2,
+		0x8816EAF2, 0x2E61E146, 0x1F89FBDB, 0xB9FEF06F, 0x7C59CEE1, 0xDA2EC555, 0xEBC6DFC8, 0x4DB1D47C,
+		0xBBF9A495, 0x1D8EAF21, 0x2C66B5BC, 0x8A11BE08, 0x4FB68086, 0xE9C18B32, 0xD82991AF, 0x7E5E9A1B,
+		0xEFC8763C, 0x49BF7D88, 0x78576715, 0xDE206CA1, 0x1B87522F, 0xBDF0599B, 0x8C184306, 0x2A6F48B2,
+		0xDC27385B, 0x7A5033EF, 0x4BB82972, 0xEDCF22C6, 0x28681C48, 0x8E1F17FC, 0xBFF70D61, 0x198006D5,
+		0x47ABD36E, 0xE1DCD8DA, 0xD034C247, 0x7643C9F3, 0xB3E4F77D, 0x1593FCC9, 0x247BE654, 0x820CEDE0,
+		0x74449D09, 0xD23396BD, 0xE3DB8C20, 0x45AC8794, 0x800BB91A, 0x267CB2AE, 0x1794A833, 0xB1E3A387,
+		0x20754FA0, 0x86024414, 0xB7EA5E89, 0x119D553D, 0xD43A6BB3, 0x724D6007, 0x43A57A9A, 0xE5D2712E,
+		0x139A01C7, 0xB5ED0A73, 0x840510EE, 0x22721B5A, 0xE7D525D4, 0x41A22E60, 0x704A34FD, 0xD63D3F49,
+		0xCC1D9F8B, 0x6A6A943F, 0x5B828EA2, 0xFDF58516, 0x3852BB98, 0x9E25B02C, 0xAFCDAAB1, 0x09BAA105,
+		0xFFF2D1EC, 0x5985DA58, 0x686DC0C5, 0xCE1ACB71, 0x0BBDF5FF, 0xADCAFE4B, 0x9C22E4D6, 0x3A55EF62,
+		0xABC30345, 0x0DB408F1, 0x3C5C126C, 0x9A2B19D8, 0x5F8C2756, 0xF9FB2CE2, 0xC813367F, 0x6E643DCB,
+		0x982C4D22, 0x3E5B4696, 0x0FB35C0B, 0xA9C457BF, 0x6C636931, 0xCA146285, 0xFBFC7818, 0x5D8B73AC,
+		0x03A0A617, 0xA5D7ADA3, 0x943FB73E, 0x3248BC8A, 0xF7EF8204, 0x519889B0, 0x6070932D, 0xC6079899,
+		0x304FE870, 0x9638E3C4, 0xA7D0F959, 0x01A7F2ED, 0xC400CC63, 0x6277C7D7, 0x539FDD4A, 0xF5E8D6FE,
+		0x647E3AD9, 0xC209316D, 0xF3E12BF0, 0x55962044, 0x90311ECA, 0x3646157E, 0x07AE0FE3, 0xA1D90457,
+		0x579174BE, 0xF1E67F0A, 0xC00E6597, 0x66796E23, 0xA3DE50AD, 0x05A95B19, 0x34414184, 0x92364A30
+	},
+	{
+		0x00000000, 0xCCAA009E, 0x4225077D, 0x8E8F07E3, 0x844A0EFA, 0x48E00E64, 0xC66F0987, 0x0AC50919,
+		0xD3E51BB5, 0x1F4F1B2B, 0x91C01CC8, 0x5D6A1C56, 0x57AF154F, 0x9B0515D1, 0x158A1232, 0xD92012AC,
+		0x7CBB312B, 0xB01131B5, 0x3E9E3656, 0xF23436C8, 0xF8F13FD1, 0x345B3F4F, 0xBAD438AC, 0x767E3832,
+		0xAF5E2A9E, 0x63F42A00, 0xED7B2DE3, 0x21D12D7D, 0x2B142464, 0xE7BE24FA, 0x69312319, 0xA59B2387,
+		0xF9766256, 0x35DC62C8, 0xBB53652B, 0x77F965B5, 0x7D3C6CAC, 0xB1966C32, 0x3F196BD1, 0xF3B36B4F,
+		0x2A9379E3, 0xE639797D, 0x68B67E9E, 0xA41C7E00, 0xAED97719, 0x62737787, 0xECFC7064, 0x205670FA,
+		0x85CD537D, 0x496753E3, 0xC7E85400, 0x0B42549E, 0x01875D87, 0xCD2D5D19, 0x43A25AFA, 0x8F085A64,
+		0x562848C8, 0x9A824856, 0x140D4FB5, 0xD8A74F2B, 0xD2624632, 0x1EC846AC, 0x9047414F, 0x5CED41D1,
+		0x299DC2ED, 0xE537C273, 0x6BB8C590, 0xA712C50E, 0xADD7CC17, 0x617DCC89, 0xEFF2CB6A, 0x2358CBF4,
+		0xFA78D958, 0x36D2D9C6, 0xB85DDE25, 0x74F7DEBB, 0x7E32D7A2, 0xB298D73C, 0x3C17D0DF, 0xF0BDD041,
+		0x5526F3C6, 0x998CF358, 0x1703F4BB, 0xDBA9F425, 0xD16CFD3C, 0x1DC6FDA2, 0x9349FA41, 0x5FE3FADF,
+		0x86C3E873, 0x4A69E8ED, 0xC4E6EF0E, 0x084CEF90, 0x0289E689, 0xCE23E617, 0x40ACE1F4, 0x8C06E16A,
+		0xD0EBA0BB, 0x1C41A025, 0x92CEA7C6, 0x5E64A758, 0x54A1AE41, 0x980BAEDF, 0x1684A93C, 0xDA2EA9A2,
+		0x030EBB0E, 0xCFA4BB90, 0x412BBC73, 0x8D81BCED, 0x8744B5F4, 0x4BEEB56A, 0xC561B289, 0x09CBB217,
+		0xAC509190, 0x60FA910E, 0xEE7596ED, 0x22DF9673, 0x281A9F6A, 0xE4B09FF4, 0x6A3F9817, 0xA6959889,
+		0x7FB58A25, 0xB31F8ABB, 0x3D908D58, 0xF13A8DC6, 0xFBFF84DF, 0x37558441, 0xB9DA83A2, 0x7570833C,
+		0x533B85DA, 0x9F918544, 0x111E82A7, 0xDDB48239, 0xD7718B20, 0x1BDB8BBE, 0x95548C5D, 0x59FE8CC3,
+		0x80DE9E6F, 0x4C749EF1, 0xC2FB9912, 0x0E51998C, 0x04949095, 0xC83E900B, 0x46B197E8, 0x8A1B9776,
+		0x2F80B4F1, 0xE32AB46F, 0x6DA5B38C, 0xA10FB312, 0xABCABA0B, 0x6760BA95, 0xE9EFBD76, 0x2545BDE8,
+		0xFC65AF44, 0x30CFAFDA, 0xBE40A839, 0x72EAA8A7, 0x782FA1BE, 0xB485A120, 0x3A0AA6C3, 0xF6A0A65D,
+		0xAA4DE78C, 0x66E7E712, 0xE868E0F1, 0x24C2E06F, 0x2E07E976, 0xE2ADE9E8, 0x6C22EE0B, 0xA088EE95,
+		0x79A8FC39, 0xB502FCA7, 0x3B8DFB44, 0xF727FBDA, 0xFDE2F2C3, 0x3148F25D, 0xBFC7F5BE, 0x736DF520,
+		0xD6F6D6A7, 0x1A5CD639, 0x94D3D1DA, 0x5879D144, 0x52BCD85D, 0x9E16D8C3, 0x1099DF20, 0xDC33DFBE,
+		0x0513CD12, 0xC9B9CD8C, 0x4736CA6F, 0x8B9CCAF1, 0x8159C3E8, 0x4DF3C376, 0xC37CC495, 0x0FD6C40B,
+		0x7AA64737, 0xB60C47A9, 0x3883404A, 0xF42940D4, 0xFEEC49CD, 0x32464953, 0xBCC94EB0, 0x70634E2E,
+		0xA9435C82, 0x65E95C1C, 0xEB665BFF, 0x27CC5B61, 0x2D095278, 0xE1A352E6, 0x6F2C5505, 0xA386559B,
+		0x061D761C, 0xCAB77682, 0x44387161, 0x889271FF, 0x825778E6, 0x4EFD7878, 0xC0727F9B, 0x0CD87F05,
+		0xD5F86DA9, 0x19526D37, 0x97DD6AD4, 0x5B776A4A, 0x51B26353, 0x9D1863CD, 0x1397642E, 0xDF3D64B0,
+		0x83D02561, 0x4F7A25FF, 0xC1F5221C, 0x0D5F2282, 0x079A2B9B, 0xCB302B05, 0x45BF2CE6, 0x89152C78,
+		0x50353ED4, 0x9C9F3E4A, 0x121039A9, 0xDEBA3937, 0xD47F302E, 0x18D530B0, 0x965A3753, 0x5AF037CD,
+		0xFF6B144A, 0x33C114D4, 0xBD4E1337, 0x71E413A9, 0x7B211AB0, 0xB78B1A2E, 0x39041DCD, 0xF5AE1D53,
+		0x2C8E0FFF, 0xE0240F61, 0x6EAB0882, 0xA201081C, 0xA8C40105, 0x646E019B, 0xEAE10678, 0x264B06E6
+	}
+};
+
+unsigned int crc32_checksum( char *buffer, unsigned int length )
+{
+	unsigned int crc = 0xFFFFFFFF;
+	unsigned char *p = ( unsigned char * )buffer;
+
+	// Slicing-by-8. The 4 byte loads assume a little-endian processor that allows unaligned reads (x86 and x64).
+	for ( ; length >= 8; length -= 8, p += 8 )
+	{
+		unsigned int one = *( unsigned int * )p ^ crc;
+		unsigned int two = *( unsigned int * )( p + 4 );
+
+		crc = crc32_table[ 7 ][ one & 0xFF ] ^
+			  crc32_table[ 6 ][ ( one >> 8 ) & 0xFF ] ^
+			  crc32_table[ 5 ][ ( one >> 16 ) & 0xFF ] ^
+			  crc32_table[ 4 ][ one >> 24 ] ^
+			  crc32_table[ 3 ][ two & 0xFF ] ^
+			  crc32_table[ 2 ][ ( two >> 8 ) & 0xFF ] ^
+			  crc32_table[ 1 ][ ( two >> 16 ) & 0xFF ] ^
+			  crc32_table[ 0 ][ two >> 24 ];
+	}
+
+	for ( ; length > 0; --length, ++p )
+	{
+		crc = crc32_table[ 0 ][ ( crc ^ *p ) & 0xFF ] ^ ( crc >> 8 );
+	}
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+// Returns the position of the file extension if found, or the length of the filename if not found.
+unsigned long get_file_extension_offset( wchar_t *filename, unsigned long length )
+{
+	unsigned long tmp_length = length;
+
+	while ( tmp_length != 0 )
+	{
+		if ( filename[ --tmp_length ] == L'.' )
+		{
+			return tmp_length;
+		}
+	}
+
+	return length;
+}
+
+// file_operations.cpp
+
+void free_download_history_entry( DOWNLOAD_INFO *di )
+{
+	if ( di != NULL )
+	{
+		GlobalFree( di->url );
+		GlobalFree( di->cookies );
+		GlobalFree( di->headers );
+		GlobalFree( di->data );
+		GlobalFree( di->auth_info.username );
+		GlobalFree( di->auth_info.password );
+
+		while ( di->range_list != NULL )
+		{
+			DoublyLinkedList *range_node = di->range_list;
+			di->range_list = di->range_list->next;
+
+			GlobalFree( range_node->data );
+			GlobalFree( range_node );
+		}
+
+		GlobalFree( di );
+	}
+}
+
+// Version 5 (file_operations.cpp before version 6 was added)
+
+unsigned int get_download_history_entry_length( DOWNLOAD_INFO *di )
+{
+	unsigned char range_count = 0;
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL )
+	{
+		++range_count;
+
+		range_node = range_node->next;
+	}
+
+	// lstrlen is safe for NULL values.
+	return ( di->filename_offset * sizeof( wchar_t ) ) +	// Includes the NULL terminator.
+		   ( ( lstrlenW( di->file_path + di->filename_offset ) + 1 ) * sizeof( wchar_t ) ) +
+		   ( ( lstrlenW( di->url ) + 1 ) * sizeof( wchar_t ) ) +
+		   ( lstrlenA( di->cookies ) + 1 ) +
+		   ( lstrlenA( di->headers ) + 1 ) +
+		   ( lstrlenA( di->data ) + 1 ) +
+			 lstrlenA( di->auth_info.username ) +
+			 lstrlenA( di->auth_info.password ) +
+		   ( sizeof( int ) * 2 ) + ( sizeof( ULONGLONG ) * 2 ) + ( sizeof( unsigned long long ) * 3 ) + ( sizeof( unsigned char ) * 5 ) + sizeof( unsigned int ) + sizeof( bool ) +
+			 sizeof( unsigned char ) + ( range_count * ( sizeof( unsigned long long ) * 5 ) );
+}
+
+// Writes the range count and each range's values.
+unsigned int write_download_history_ranges( DOWNLOAD_INFO *di, char *write_buf, unsigned int size )
+{
+	unsigned int pos = 0;
+
+	unsigned char range_count = 0;
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL )
+	{
+		++range_count;
+
+		range_node = range_node->next;
+	}
+
+	_memcpy_s( write_buf + pos, size - pos, &range_count, sizeof( unsigned char ) );
+	pos += sizeof( unsigned char );
+
+	range_node = di->range_list;
+	for ( unsigned char i = 0; i < range_count; ++i )
+	{
+		RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
+
+		_memcpy_s( write_buf + pos, size - pos, &ri->range_start, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
+
+		_memcpy_s( write_buf + pos, size - pos, &ri->range_end, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
+
+		_memcpy_s( write_buf + pos, size - pos, &ri->content_length, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
+
+		_memcpy_s( write_buf + pos, size - pos, &ri->content_offset, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
+
+		_memcpy_s( write_buf + pos, size - pos, &ri->file_write_offset, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
+
+		range_node = range_node->next;
+	}
+
+	return pos;
+}
+
+// The buffer must be at least get_download_history_entry_length() in size. Returns the number of bytes that were written.
+unsigned int write_download_history_entry( DOWNLOAD_INFO *di, char *write_buf, unsigned int size )
+{
+	unsigned int pos = 0;
+
+	// lstrlen is safe for NULL values.
+	int download_directory_length = di->filename_offset * sizeof( wchar_t );	// Includes the NULL terminator.
+	int filename_length = ( lstrlenW( di->file_path + di->filename_offset ) + 1 ) * sizeof( wchar_t );
+	int url_length = ( lstrlenW( di->url ) + 1 ) * sizeof( wchar_t );
+
+	int cookies_length = lstrlenA( di->cookies ) + 1;
+	int headers_length = lstrlenA( di->headers ) + 1;
+	int data_length = lstrlenA( di->data ) + 1;
+
+	int username_length = lstrlenA( di->auth_info.username );
+	int password_length = lstrlenA( di->auth_info.password );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->add_time.QuadPart, sizeof( ULONGLONG ) );
+	pos += sizeof( ULONGLONG );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->downloaded, sizeof( unsigned long long ) );
+	pos += sizeof( unsigned long long );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->file_size, sizeof( unsigned long long ) );
+	pos += sizeof( unsigned long long );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->download_speed_limit, sizeof( unsigned long long ) );
+	pos += sizeof( unsigned long long );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->parts, sizeof( unsigned char ) );
+	pos += sizeof( unsigned char );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->parts_limit, sizeof( unsigned char ) );
+	pos += sizeof( unsigned char );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->status, sizeof( unsigned int ) );
+	pos += sizeof( unsigned int );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->ssl_version, sizeof( char ) );
+	pos += sizeof( char );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->processed_header, sizeof( bool ) );
+	pos += sizeof( bool );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->download_operations, sizeof( unsigned char ) );
+	pos += sizeof( unsigned char );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->method, sizeof( unsigned char ) );
+	pos += sizeof( unsigned char );
+
+	_memcpy_s( write_buf + pos, size - pos, &di->last_modified.QuadPart, sizeof( ULONGLONG ) );
+	pos += sizeof( ULONGLONG );
+
+	_memcpy_s( write_buf + pos, size - pos, di->file_path, download_directory_length );
+	pos += download_directory_length;
+
+	_memcpy_s( write_buf + pos, size - pos, di->file_path + di->filename_offset, filename_length );
+	pos += filename_length;
+
+	_memcpy_s( write_buf + pos, size - pos, di->url, url_length );
+	pos += url_length;
+
+	_memcpy_s( write_buf + pos, size - pos, di->cookies, cookies_length );
+	pos += cookies_length;
+
+	_memcpy_s( write_buf + pos, size - pos, di->headers, headers_length );
+	pos += headers_length;
+
+	_memcpy_s( write_buf + pos, size - pos, di->data, data_length );
+	pos += data_length;
+
+	if ( di->auth_info.username != NULL )
+	{
+		_memcpy_s( write_buf + pos, size - pos, &username_length, sizeof( int ) );
+		pos += sizeof( int );
+
+		_memcpy_s( write_buf + pos, size - pos, di->auth_info.username, username_length );
+		encode_cipher( write_buf + pos, username_length );
+		pos += username_length;
+	}
+	else
+	{
+		_memset( write_buf + pos, 0, sizeof( int ) );
+		pos += sizeof( int );
+	}
+
+	if ( di->auth_info.password != NULL )
+	{
+		_memcpy_s( write_buf + pos, size - pos, &password_length, sizeof( int ) );
+		pos += sizeof( int );
+
+		_memcpy_s( write_buf + pos, size - pos, di->auth_info.password, password_length );
+		encode_cipher( write_buf + pos, password_length );
+		pos += password_length;
+	}
+	else
+	{
+		_memset( write_buf + pos, 0, sizeof( int ) );
+		pos += sizeof( int );
+	}
+
+	pos += write_download_history_ranges( di, write_buf + pos, size - pos );
+
+	return pos;
+}
+
+// Version 5 (file_operations.cpp)
+
+// Returns the number of characters in a wide string (including the NULL character), or 0 if it's not terminated within length bytes.
+// The history file is mapped into memory so we can't rely on there being a NULL character at the end of the buffer.
+int get_history_string_length_w( char *p, DWORD length )
+{
+	for ( DWORD i = 0; i + 1 < length; i += sizeof( wchar_t ) )
+	{
+		if ( p[ i ] == 0 && p[ i + 1 ] == 0 )
+		{
+			return ( int )( i / sizeof( wchar_t ) ) + 1;
+		}
+	}
+
+	return 0;
+}
+
+// Returns the number of characters in a string (including the NULL character), or 0 if it's not terminated within length bytes.
+int get_history_string_length_a( char *p, DWORD length )
+{
+	for ( DWORD i = 0; i < length; ++i )
+	{
+		if ( p[ i ] == 0 )
+		{
+			return ( int )i + 1;
+		}
+	}
+
+	return 0;
+}
+
+// Parses one entry of the download history. Nothing past buf + length is read.
+// The download info that's returned hasn't been added to the listview. NULL is returned if the entry is incomplete.
+DOWNLOAD_INFO *parse_download_history_entry( char *buf, DWORD length, DWORD &entry_length )
+{
+	DWORD offset = 0;
+
+	char *p = buf;
+
+	ULARGE_INTEGER		add_time;
+	unsigned long long	downloaded;
+	unsigned long long	file_size;
+	unsigned long long	download_speed_limit;
+
+	char				*download_directory = NULL;
+	unsigned int		download_directory_length = 0;
+	char				*filename = NULL;
+	unsigned int		filename_length = 0;
+
+	wchar_t				*url = NULL;
+	DoublyLinkedList	*range_list = NULL;
+	unsigned char		parts;
+	unsigned char		parts_limit;
+	unsigned int		status;
+
+	char				*cookies = NULL;
+	char				*headers = NULL;
+	char				*data = NULL;
+
+	char				*username = NULL;
+	char				*password = NULL;
+
+	char				ssl_version;
+
+	bool				processed_header;
+	unsigned char		download_operations;
+	unsigned char		method;
+
+	ULARGE_INTEGER		last_modified;
+
+	unsigned char		range_count;
+
+	int					string_length;
+
+	DOWNLOAD_INFO		*di = NULL;
+
+	// Add Time.
+	offset += sizeof( ULONGLONG );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &add_time.QuadPart, sizeof( ULONGLONG ), p, sizeof( ULONGLONG ) );
+	p += sizeof( ULONGLONG );
+
+	// Downloaded
+	offset += sizeof( unsigned long long );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &downloaded, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
+
+	// File Size
+	offset += sizeof( unsigned long long );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &file_size, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
+
+	// Download Speed Limit
+	offset += sizeof( unsigned long long );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &download_speed_limit, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
+
+	// Parts
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &parts, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
+
+	// Parts Limit
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &parts_limit, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
+
+	// Status
+	offset += sizeof( unsigned int );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &status, sizeof( unsigned int ), p, sizeof( unsigned int ) );
+	p += sizeof( unsigned int );
+
+	// SSL Version
+	offset += sizeof( char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &ssl_version, sizeof( char ), p, sizeof( char ) );
+	p += sizeof( char );
+
+	// Create Range
+	offset += sizeof( bool );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &processed_header, sizeof( bool ), p, sizeof( bool ) );
+	p += sizeof( bool );
+
+	// Download Operations
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &download_operations, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
+
+	// Method
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &method, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
+
+	// Last Modified
+	offset += sizeof( ULONGLONG );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &last_modified.QuadPart, sizeof( ULONGLONG ), p, sizeof( ULONGLONG ) );
+	p += sizeof( ULONGLONG );
+
+	// Download Directory
+	string_length = get_history_string_length_w( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += ( string_length * sizeof( wchar_t ) );
+	if ( offset >= length ) { goto CLEANUP; }
+
+	download_directory = p;
+	download_directory_length = string_length;
+
+	p += ( string_length * sizeof( wchar_t ) );
+
+	// Filename
+	string_length = get_history_string_length_w( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += ( string_length * sizeof( wchar_t ) );
+	if ( offset >= length ) { goto CLEANUP; }
+
+	filename = p;
+	filename_length = string_length - 1;
+
+	p += ( string_length * sizeof( wchar_t ) );
+
+	// URL
+	string_length = get_history_string_length_w( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += ( string_length * sizeof( wchar_t ) );
+	if ( offset >= length ) { goto CLEANUP; }
+
+	url = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * string_length );
+	_wmemcpy_s( url, string_length, p, string_length );
+	*( url + ( string_length - 1 ) ) = 0;	// Sanity
+
+	p += ( string_length * sizeof( wchar_t ) );
+
+	// Cookies
+	string_length = get_history_string_length_a( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+
+	// Let's not allocate an empty string.
+	if ( string_length > 1 )
+	{
+		cookies = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
+		_memcpy_s( cookies, string_length, p, string_length );
+		*( cookies + ( string_length - 1 ) ) = 0;	// Sanity
+	}
+
+	p += string_length;
+
+	// Headers
+	string_length = get_history_string_length_a( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+
+	// Let's not allocate an empty string.
+	if ( string_length > 1 )
+	{
+		headers = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
+		_memcpy_s( headers, string_length, p, string_length );
+		*( headers + ( string_length - 1 ) ) = 0;	// Sanity
+	}
+
+	p += string_length;
+
+	// Data
+	string_length = get_history_string_length_a( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+
+	// Let's not allocate an empty string.
+	if ( string_length > 1 )
+	{
+		data = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
+		_memcpy_s( data, string_length, p, string_length );
+		*( data + ( string_length - 1 ) ) = 0;	// Sanity
+	}
+
+	p += string_length;
+
+	// Username
+	offset += sizeof( int );
+	if ( offset >= length ) { goto CLEANUP; }
+
+	// Length of the string - not including the NULL character.
+	_memcpy_s( &string_length, sizeof( int ), p, sizeof( int ) );
+	p += sizeof( int );
+
+	if ( string_length < 0 ) { goto CLEANUP; }
+
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+	if ( string_length > 0 )
+	{
+		// string_length does not contain the NULL character of the string.
+		username = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( string_length + 1 ) );
+		_memcpy_s( username, string_length, p, string_length );
+		username[ string_length ] = 0; // Sanity;
+
+		decode_cipher( username, string_length );
+
+		p += string_length;
+	}
+
+	// Password
+	offset += sizeof( int );
+	if ( offset >= length ) { goto CLEANUP; }
+
+	// Length of the string - not including the NULL character.
+	_memcpy_s( &string_length, sizeof( int ), p, sizeof( int ) );
+	p += sizeof( int );
+
+	if ( string_length < 0 ) { goto CLEANUP; }
+
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+	if ( string_length > 0 )
+	{
+		// string_length does not contain the NULL character of the string.
+		password = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( string_length + 1 ) );
+		_memcpy_s( password, string_length, p, string_length );
+		password[ string_length ] = 0; // Sanity;
+
+		decode_cipher( password, string_length );
+
+		p += string_length;
+	}
+
+	// Range Info.
+	offset += sizeof( unsigned char );
+	if ( offset > length ) { goto CLEANUP; }
+
+	range_count = *p;
+	p += sizeof( unsigned char );
+
+	for ( unsigned char i = 0; i < range_count; ++i )
+	{
+		offset += ( sizeof( unsigned long long ) * 5 );
+		if ( offset > length ) { goto CLEANUP; }
+
+		RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+
+		_memcpy_s( &ri->range_start, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->range_end, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->content_length, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->content_offset, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->file_write_offset, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
+
+		DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+		DLL_AddNode( &range_list, range_node, -1 );
+	}
+
+	di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+	if ( di == NULL ) { goto CLEANUP; }
+
+	di->hFile = INVALID_HANDLE_VALUE;
+
+	di->add_time.QuadPart = add_time.QuadPart;
+	di->downloaded = downloaded;
+	di->last_downloaded = downloaded;
+	di->file_size = file_size;
+	di->download_speed_limit = download_speed_limit;
+	di->parts = parts;
+	di->parts_limit = parts_limit;
+	di->status = status;
+	di->ssl_version = ssl_version;
+	di->processed_header = processed_header;
+	di->download_operations = download_operations;
+	di->method = method;
+	di->last_modified.QuadPart = last_modified.QuadPart;
+	di->url = url;
+	di->cookies = cookies;
+	di->headers = headers;
+	di->data = data;
+	di->auth_info.username = username;
+	di->auth_info.password = password;
+
+	di->range_list = range_list;
+	di->print_range_list = di->range_list;
+
+	_wmemcpy_s( di->file_path, MAX_PATH, download_directory, download_directory_length );
+	di->file_path[ download_directory_length ] = 0;	// Sanity.
+
+	di->filename_offset = download_directory_length;	// Includes the NULL terminator.
+
+	_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, filename, filename_length + 1 );
+	di->file_path[ di->filename_offset + filename_length + 1 ] = 0;	// Sanity.
+
+	di->file_extension_offset = di->filename_offset + ( ( di->download_operations & DOWNLOAD_OPERATION_GET_EXTENSION ) ? filename_length : get_file_extension_offset( di->file_path + di->filename_offset, filename_length ) );
+
+	if ( di->file_extension_offset == ( di->filename_offset + filename_length ) )
+	{
+		di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
+	}
+
+	entry_length = offset;
+
+	return di;
+
+CLEANUP:
+
+	GlobalFree( url );
+	GlobalFree( cookies );
+	GlobalFree( headers );
+	GlobalFree( data );
+	GlobalFree( username );
+	GlobalFree( password );
+
+	while ( range_list != NULL )
+	{
+		DoublyLinkedList *range_node = range_list;
+		range_list = range_list->next;
+
+		GlobalFree( range_node->data );
+		GlobalFree( range_node );
+	}
+
+	return NULL;
+}
+
+// Returns the size of the entry at buf without building it, or 0 if the entry is incomplete.
+// This must agree with the checks in parse_download_history_entry.
+DWORD get_download_history_entry_size( char *buf, DWORD length )
+{
+	DWORD offset = HISTORY_ENTRY_FIXED_SIZE;
+	int string_length;
+
+	if ( offset >= length ) { return 0; }
+
+	// Download Directory, Filename, and URL
+	for ( unsigned char i = 0; i < 3; ++i )
+	{
+		string_length = get_history_string_length_w( buf + offset, length - offset );
+		if ( string_length == 0 ) { return 0; }
+
+		offset += ( string_length * sizeof( wchar_t ) );
+		if ( offset >= length ) { return 0; }
+	}
+
+	// Cookies, Headers, and Data
+	for ( unsigned char i = 0; i < 3; ++i )
+	{
+		string_length = get_history_string_length_a( buf + offset, length - offset );
+		if ( string_length == 0 ) { return 0; }
+
+		offset += string_length;
+		if ( offset >= length ) { return 0; }
+	}
+
+	// Username and Password
+	for ( unsigned char i = 0; i < 2; ++i )
+	{
+		offset += sizeof( int );
+		if ( offset >= length ) { return 0; }
+
+		_memcpy_s( &string_length, sizeof( int ), buf + ( offset - sizeof( int ) ), sizeof( int ) );
+		if ( string_length < 0 ) { return 0; }
+
+		offset += string_length;
+		if ( offset >= length ) { return 0; }
+	}
+
+	// Range Info.
+	unsigned char range_count = *( buf + offset );
+
+	offset += sizeof( unsigned char ) + ( range_count * ( sizeof( unsigned long long ) * 5 ) );
+	if ( offset > length ) { return 0; }
+
+	return offset;
+}
+
+// Version 6 (file_operations.cpp)
+
+unsigned char write_varint( char *buf, unsigned long long value )
+{
+	unsigned char length = 0;
+
+	while ( value >= 0x80 )
+	{
+		buf[ length++ ] = ( char )( ( value & 0x7F ) | 0x80 );
+		value >>= 7;
+	}
+
+	buf[ length++ ] = ( char )value;
+
+	return length;
+}
+
+// Differences are zigzag encoded so that small negative values stay small.
+unsigned long long zigzag_encode( unsigned long long value )
+{
+	return ( value << 1 ) ^ ( 0 - ( value >> 63 ) );
+}
+
+unsigned long long zigzag_decode( unsigned long long value )
+{
+	return ( value >> 1 ) ^ ( 0 - ( value & 1 ) );
+}
+
+bool read_varint( char *buf, DWORD length, DWORD &offset, unsigned long long &value )
+{
+	value = 0;
+
+	for ( unsigned char shift = 0; shift < 64 && offset < length; shift += 7 )
+	{
+		unsigned char byte = ( unsigned char )buf[ offset++ ];
+
+		value |= ( ( unsigned long long )( byte & 0x7F ) << shift );
+
+		if ( !( byte & 0x80 ) )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Zero values aren't written. They're the default for a missing field.
+unsigned int write_history_varint_field( char *buf, unsigned char field, unsigned long long value )
+{
+	if ( value == 0 )
+	{
+		return 0;
+	}
+
+	unsigned int pos = write_varint( buf, ( field << 1 ) | HISTORY_WIRE_VARINT );
+	pos += write_varint( buf + pos, value );
+
+	return pos;
+}
+
+unsigned int write_history_bytes_field( char *buf, unsigned int size, unsigned char field, char *value, int value_length, bool encode = false )
+{
+	if ( value_length <= 0 )
+	{
+		return 0;
+	}
+
+	unsigned int pos = write_varint( buf, ( field << 1 ) | HISTORY_WIRE_BYTES );
+	pos += write_varint( buf + pos, value_length );
+
+	_memcpy_s( buf + pos, size - pos, value, value_length );
+
+	if ( encode )
+	{
+		encode_cipher( buf + pos, value_length );
+	}
+
+	return pos + value_length;
+}
+
+// Wide strings are stored as UTF-8.
+unsigned int write_history_string_field( char *buf, unsigned int size, unsigned char field, wchar_t *value, int value_length )
+{
+	if ( value_length <= 0 )
+	{
+		return 0;
+	}
+
+	int utf8_length = WideCharToMultiByte( CP_UTF8, 0, value, value_length, NULL, 0, NULL, NULL );
+
+	unsigned int pos = write_varint( buf, ( field << 1 ) | HISTORY_WIRE_BYTES );
+	pos += write_varint( buf + pos, utf8_length );
+
+	WideCharToMultiByte( CP_UTF8, 0, value, value_length, buf + pos, size - pos, NULL, NULL );
+
+	return pos + utf8_length;
+}
+
+// Returns the most space that an encoded entry could need.
+unsigned int get_download_history_entry_bound( DOWNLOAD_INFO *di )
+{
+	unsigned int range_count = 0;
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL )
+	{
+		++range_count;
+
+		range_node = range_node->next;
+	}
+
+	// lstrlen is safe for NULL values.
+	return HISTORY_RECORD_LENGTH_SIZE + sizeof( unsigned int ) +
+		 ( 12 * ( 1 + HISTORY_VARINT_MAX_SIZE ) ) +	// The numeric fields.
+		 ( 8 * ( 1 + HISTORY_RECORD_LENGTH_SIZE ) ) +	// The key and length of each string field.
+		 ( ( lstrlenW( di->file_path ) + lstrlenW( di->file_path + di->filename_offset ) + lstrlenW( di->url ) ) * 3 ) +	// A UTF-16 code unit is at most 3 bytes of UTF-8.
+		   lstrlenA( di->cookies ) +
+		   lstrlenA( di->headers ) +
+		   lstrlenA( di->data ) +
+		   lstrlenA( di->auth_info.username ) +
+		   lstrlenA( di->auth_info.password ) +
+		 ( range_count * ( 2 + ( 5 * HISTORY_VARINT_MAX_SIZE ) ) );
+}
+
+// Writes an entry as a length prefixed list of fields followed by a checksum of the fields.
+// The buffer must be at least get_download_history_entry_bound() in size. Returns the number of bytes that were written.
+unsigned int encode_download_history_entry( DOWNLOAD_INFO *di, char *buf, unsigned int size )
+{
+	unsigned int pos = HISTORY_RECORD_LENGTH_SIZE;	// Leave room for the record length.
+
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_ADD_TIME, di->add_time.QuadPart );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_DOWNLOADED, di->downloaded );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_FILE_SIZE, di->file_size );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_DOWNLOAD_SPEED_LIMIT, di->download_speed_limit );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_PARTS, di->parts );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_PARTS_LIMIT, di->parts_limit );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_STATUS, di->status );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_SSL_VERSION, ( unsigned char )di->ssl_version );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_PROCESSED_HEADER, ( di->processed_header ? 1 : 0 ) );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_DOWNLOAD_OPERATIONS, di->download_operations );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_METHOD, di->method );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_LAST_MODIFIED, di->last_modified.QuadPart );
+
+	pos += write_history_string_field( buf + pos, size - pos, HISTORY_FIELD_DOWNLOAD_DIRECTORY, di->file_path, di->filename_offset - 1 );
+	pos += write_history_string_field( buf + pos, size - pos, HISTORY_FIELD_FILENAME, di->file_path + di->filename_offset, lstrlenW( di->file_path + di->filename_offset ) );
+	pos += write_history_string_field( buf + pos, size - pos, HISTORY_FIELD_URL, di->url, lstrlenW( di->url ) );
+
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_COOKIES, di->cookies, lstrlenA( di->cookies ) );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_HEADERS, di->headers, lstrlenA( di->headers ) );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_DATA, di->data, lstrlenA( di->data ) );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_USERNAME, di->auth_info.username, lstrlenA( di->auth_info.username ), true );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_PASSWORD, di->auth_info.password, lstrlenA( di->auth_info.password ), true );
+
+	// Each range is its own field. The range end is stored as a length, and the values are stored as differences from what they usually are:
+	// a range starts where the previous one ended, is as long as it, and has the same content length (the file size, which is the first range's end + 1).
+	// A finished range's content offset is its length, and the file write offset is the range start plus the content offset. Most of the values then fit in 1 byte.
+	RANGE_INFO *last_ri = NULL;
+
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL )
+	{
+		RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
+
+		unsigned long long range_start = ( last_ri != NULL ? last_ri->range_end + 1 : 0 );
+		unsigned long long range_end = ri->range_start + ( last_ri != NULL ? last_ri->range_end - last_ri->range_start : 0 );
+		unsigned long long content_length = ( last_ri != NULL ? last_ri->content_length : ri->range_end + 1 );
+
+		unsigned char range_length = write_varint( buf + pos + 2, zigzag_encode( ri->range_start - range_start ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ri->range_end - range_end ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ri->content_length - content_length ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ( ri->range_end - ri->range_start + 1 ) - ri->content_offset ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ri->file_write_offset - ( ri->range_start + ri->content_offset ) ) );
+
+		// The key and length (at most 50 bytes) fit in 1 byte each.
+		buf[ pos ] = ( HISTORY_FIELD_RANGE_DELTA << 1 ) | HISTORY_WIRE_BYTES;
+		buf[ pos + 1 ] = range_length;
+
+		pos += 2 + range_length;
+
+		last_ri = ri;
+
+		range_node = range_node->next;
+	}
+
+	unsigned int record_length = pos - HISTORY_RECORD_LENGTH_SIZE;
+
+	// Move the fields up against the actual length of the record.
+	char length_buf[ HISTORY_RECORD_LENGTH_SIZE ];
+	unsigned char length_size = write_varint( length_buf, record_length );
+
+	_memmove( buf + length_size, buf + HISTORY_RECORD_LENGTH_SIZE, record_length );
+	_memcpy_s( buf, size, length_buf, length_size );
+
+	pos = length_size + record_length;
+
+	unsigned int checksum = crc32_checksum( buf + length_size, record_length );
+	_memcpy_s( buf + pos, size - pos, &checksum, sizeof( unsigned int ) );
+	pos += sizeof( unsigned int );
+
+	return pos;
+}
+
+// Returns the size of the encoded entry at buf, or 0 if the entry is incomplete.
+DWORD get_encoded_history_entry_size( char *buf, DWORD length )
+{
+	DWORD offset = 0;
+	unsigned long long record_length;
+
+	if ( !read_varint( buf, length, offset, record_length ) ||
+		 record_length > length - offset ||
+		 length - offset - ( DWORD )record_length < sizeof( unsigned int ) )
+	{
+		return 0;
+	}
+
+	return offset + ( DWORD )record_length + sizeof( unsigned int );
+}
+
+// Converts a UTF-8 string to a wide string. ASCII strings (most paths and URLs) are converted without MultiByteToWideChar.
+// Returns the number of characters that were written, or 0 if they didn't fit.
+int decode_history_utf8( char *value, DWORD value_length, wchar_t *buffer, int buffer_size )
+{
+	if ( value_length <= ( DWORD )buffer_size )
+	{
+		// Widen every byte and check for non-ASCII characters once at the end. It's cheaper than checking each byte.
+		unsigned char high = 0;
+
+		for ( DWORD i = 0; i < value_length; ++i )
+		{
+			high |= ( unsigned char )value[ i ];
+			buffer[ i ] = ( unsigned char )value[ i ];
+		}
+
+		if ( !( high & 0x80 ) )
+		{
+			return ( int )value_length;
+		}
+	}
+
+	int string_length = MultiByteToWideChar( CP_UTF8, 0, value, value_length, buffer, buffer_size );
+
+	return ( string_length > 0 ? string_length : 0 );
+}
+
+wchar_t *decode_history_string_w( char *value, DWORD value_length )
+{
+	// A UTF-8 string has at least as many bytes as its UTF-16 string has characters.
+	wchar_t *string = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( value_length + 1 ) );
+	if ( string != NULL )
+	{
+		int string_length = decode_history_utf8( value, value_length, string, value_length );
+		if ( string_length == 0 )
+		{
+			GlobalFree( string );
+
+			return NULL;
+		}
+
+		string[ string_length ] = 0;	// Sanity.
+	}
+
+	return string;
+}
+
+char *decode_history_string_a( char *value, DWORD value_length, bool decode = false )
+{
+	char *string = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( value_length + 1 ) );
+	if ( string != NULL )
+	{
+		_memcpy_s( string, value_length + 1, value, value_length );
+		string[ value_length ] = 0;	// Sanity.
+
+		if ( decode )
+		{
+			decode_cipher( string, value_length );
+		}
+	}
+
+	return string;
+}
+
+RANGE_INFO *decode_history_range( char *value, DWORD value_length )
+{
+	DWORD offset = 0;
+	unsigned long long range_start, range_length, content_length, content_offset, file_write_offset;
+
+	if ( !read_varint( value, value_length, offset, range_start ) ||
+		 !read_varint( value, value_length, offset, range_length ) ||
+		 !read_varint( value, value_length, offset, content_length ) ||
+		 !read_varint( value, value_length, offset, content_offset ) ||
+		 !read_varint( value, value_length, offset, file_write_offset ) )
+	{
+		return NULL;
+	}
+
+	RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+	if ( ri != NULL )
+	{
+		ri->range_start = range_start;
+		ri->range_end = range_start + range_length;
+		ri->content_length = content_length;
+		ri->content_offset = content_offset;
+		ri->file_write_offset = file_write_offset;
+	}
+
+	return ri;
+}
+
+// Decodes a range that was written as HISTORY_FIELD_RANGE_DELTA. last_ri is the range that came before it, or NULL.
+RANGE_INFO *decode_history_range_delta( char *value, DWORD value_length, RANGE_INFO *last_ri )
+{
+	DWORD offset = 0;
+	unsigned long long range_start, range_end, content_length, content_remaining, file_write_offset;
+
+	if ( !read_varint( value, value_length, offset, range_start ) ||
+		 !read_varint( value, value_length, offset, range_end ) ||
+		 !read_varint( value, value_length, offset, content_length ) ||
+		 !read_varint( value, value_length, offset, content_remaining ) ||
+		 !read_varint( value, value_length, offset, file_write_offset ) )
+	{
+		return NULL;
+	}
+
+	RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+	if ( ri != NULL )
+	{
+		ri->range_start = ( last_ri != NULL ? last_ri->range_end + 1 : 0 ) + zigzag_decode( range_start );
+		ri->range_end = ri->range_start + ( last_ri != NULL ? last_ri->range_end - last_ri->range_start : 0 ) + zigzag_decode( range_end );
+		ri->content_length = ( last_ri != NULL ? last_ri->content_length : ri->range_end + 1 ) + zigzag_decode( content_length );
+		ri->content_offset = ( ri->range_end - ri->range_start + 1 ) - zigzag_decode( content_remaining );
+		ri->file_write_offset = ri->range_start + ri->content_offset + zigzag_decode( file_write_offset );
+	}
+
+	return ri;
+}
+
+// Decodes an entry that was written by encode_download_history_entry. Unknown fields are skipped.
+// NULL is returned if the entry is incomplete or its checksum doesn't match.
+DOWNLOAD_INFO *decode_download_history_entry( char *buf, DWORD length )
+{
+	DWORD offset = 0;
+	unsigned long long record_length;
+
+	char *record;
+	DWORD record_end;
+	unsigned int checksum;
+
+	unsigned long long key;
+	unsigned long long value;
+
+	char *download_directory = NULL;
+	DWORD download_directory_length = 0;
+	char *filename = NULL;
+	DWORD filename_length = 0;
+	int string_length;
+
+	RANGE_INFO *last_ri = NULL;
+
+	DOWNLOAD_INFO *di = NULL;
+
+	if ( !read_varint( buf, length, offset, record_length ) ||
+		 record_length > length - offset ||
+		 length - offset - ( DWORD )record_length < sizeof( unsigned int ) )
+	{
+		return NULL;
+	}
+
+	record = buf + offset;
+	record_end = ( DWORD )record_length;
+
+	_memcpy_s( &checksum, sizeof( unsigned int ), record + record_end, sizeof( unsigned int ) );
+	if ( crc32_checksum( record, record_end ) != checksum )
+	{
+		return NULL;
+	}
+
+	di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+	if ( di == NULL )
+	{
+		return NULL;
+	}
+
+	di->hFile = INVALID_HANDLE_VALUE;
+
+	offset = 0;
+
+	while ( offset < record_end )
+	{
+		if ( !read_varint( record, record_end, offset, key ) ) { goto CLEANUP; }
+
+		if ( ( key & 1 ) == HISTORY_WIRE_BYTES )
+		{
+			if ( !read_varint( record, record_end, offset, value ) || value > record_end - offset ) { goto CLEANUP; }
+
+			char *field = record + offset;
+			DWORD field_length = ( DWORD )value;
+
+			offset += field_length;
+
+			switch ( key >> 1 )
+			{
+				case HISTORY_FIELD_DOWNLOAD_DIRECTORY: { download_directory = field; download_directory_length = field_length; } break;
+				case HISTORY_FIELD_FILENAME: { filename = field; filename_length = field_length; } break;
+				case HISTORY_FIELD_URL: { GlobalFree( di->url ); di->url = decode_history_string_w( field, field_length ); } break;
+				case HISTORY_FIELD_COOKIES: { GlobalFree( di->cookies ); di->cookies = decode_history_string_a( field, field_length ); } break;
+				case HISTORY_FIELD_HEADERS: { GlobalFree( di->headers ); di->headers = decode_history_string_a( field, field_length ); } break;
+				case HISTORY_FIELD_DATA: { GlobalFree( di->data ); di->data = decode_history_string_a( field, field_length ); } break;
+				case HISTORY_FIELD_USERNAME: { GlobalFree( di->auth_info.username ); di->auth_info.username = decode_history_string_a( field, field_length, true ); } break;
+				case HISTORY_FIELD_PASSWORD: { GlobalFree( di->auth_info.password ); di->auth_info.password = decode_history_string_a( field, field_length, true ); } break;
+
+				case HISTORY_FIELD_RANGE:
+				case HISTORY_FIELD_RANGE_DELTA:
+				{
+					RANGE_INFO *ri = ( ( key >> 1 ) == HISTORY_FIELD_RANGE ? decode_history_range( field, field_length ) : decode_history_range_delta( field, field_length, last_ri ) );
+					if ( ri == NULL ) { goto CLEANUP; }
+
+					DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+					if ( range_node == NULL ) { GlobalFree( ri ); goto CLEANUP; }
+
+					DLL_AddNode( &di->range_list, range_node, -1 );
+
+					last_ri = ri;
+				}
+				break;
+			}
+		}
+		else
+		{
+			if ( !read_varint( record, record_end, offset, value ) ) { goto CLEANUP; }
+
+			switch ( key >> 1 )
+			{
+				case HISTORY_FIELD_ADD_TIME: { di->add_time.QuadPart = value; } break;
+				case HISTORY_FIELD_DOWNLOADED: { di->downloaded = value; } break;
+				case HISTORY_FIELD_FILE_SIZE: { di->file_size = value; } break;
+				case HISTORY_FIELD_DOWNLOAD_SPEED_LIMIT: { di->download_speed_limit = value; } break;
+				case HISTORY_FIELD_PARTS: { di->parts = ( unsigned char )value; } break;
+				case HISTORY_FIELD_PARTS_LIMIT: { di->parts_limit = ( unsigned char )value; } break;
+				case HISTORY_FIELD_STATUS: { di->status = ( unsigned int )value; } break;
+				case HISTORY_FIELD_SSL_VERSION: { di->ssl_version = ( char )value; } break;
+				case HISTORY_FIELD_PROCESSED_HEADER: { di->processed_header = ( value != 0 ); } break;
+				case HISTORY_FIELD_DOWNLOAD_OPERATIONS: { di->download_operations = ( unsigned char )value; } break;
+				case HISTORY_FIELD_METHOD: { di->method = ( unsigned char )value; } break;
+				case HISTORY_FIELD_LAST_MODIFIED: { di->last_modified.QuadPart = value; } break;
+			}
+		}
+	}
+
+	// Every entry needs a URL and a filename.
+	if ( di->url == NULL || filename_length == 0 ) { goto CLEANUP; }
+
+	di->last_downloaded = di->downloaded;
+	di->print_range_list = di->range_list;
+
+	string_length = 0;
+
+	if ( download_directory_length > 0 )
+	{
+		string_length = decode_history_utf8( download_directory, download_directory_length, di->file_path, MAX_PATH - 2 );
+		if ( string_length == 0 ) { goto CLEANUP; }
+	}
+
+	di->file_path[ string_length ] = 0;	// Sanity.
+
+	di->filename_offset = string_length + 1;	// Includes the NULL terminator.
+
+	string_length = decode_history_utf8( filename, filename_length, di->file_path + di->filename_offset, MAX_PATH - di->filename_offset - 1 );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	di->file_path[ di->filename_offset + string_length ] = 0;	// Sanity.
+
+	di->file_extension_offset = di->filename_offset + ( ( di->download_operations & DOWNLOAD_OPERATION_GET_EXTENSION ) ? string_length : get_file_extension_offset( di->file_path + di->filename_offset, string_length ) );
+
+	if ( di->file_extension_offset == ( di->filename_offset + string_length ) )
+	{
+		di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
+	}
+
+	return di;
+
+CLEANUP:
+
+	free_download_history_entry( di );
+
+	return NULL;
+}
+
+// Builds a list of where each entry begins. The list has one more offset than the number of entries (the end of the last entry).
+// Scanning stops at the first incomplete entry.
+DWORD *index_download_history( char *buf, DWORD length, unsigned char version, unsigned int &entry_count )
+{
+	unsigned int capacity = 1024;
+	DWORD offset = 0;
+
+	entry_count = 0;
+
+	DWORD *offsets = ( DWORD * )GlobalAlloc( GMEM_FIXED, sizeof( DWORD ) * capacity );
+	if ( offsets == NULL )
+	{
+		return NULL;
+	}
+
+	offsets[ 0 ] = 0;
+
+	while ( offset < length )
+	{
+		DWORD entry_size = ( version == 5 ? get_download_history_entry_size( buf + offset, length - offset ) : get_encoded_history_entry_size( buf + offset, length - offset ) );
+		if ( entry_size == 0 )
+		{
+			break;
+		}
+
+		offset += entry_size;
+
+		if ( entry_count + 2 > capacity )
+		{
+			capacity *= 2;
+
+			DWORD *realloc_buffer = ( DWORD * )GlobalReAlloc( offsets, sizeof( DWORD ) * capacity, GMEM_MOVEABLE );
+			if ( realloc_buffer == NULL )
+			{
+				break;
+			}
+
+			offsets = realloc_buffer;
+		}
+
+		offsets[ ++entry_count ] = offset;
+	}
+
+	return offsets;
+}
+
+// The bench.
+
+#define DEFAULT_ENTRY_COUNT		10000
+#define DEFAULT_RUN_COUNT		10
+
+unsigned int g_random_state = 1;
+
+// xorshift32. The same seed gives the same history.
+unsigned int Random()
+{
+	g_random_state ^= g_random_state << 13;
+	g_random_state ^= g_random_state >> 17;
+	g_random_state ^= g_random_state << 5;
+
+	return g_random_state;
+}
+
+// Returns a value from low to high inclusive.
+unsigned int RandomRange( unsigned int low, unsigned int high )
+{
+	return low + ( Random() % ( high - low + 1 ) );
+}
+
+// Returns true percent out of 100 times.
+bool RandomChance( unsigned int percent )
+{
+	return ( Random() % 100 ) < percent;
+}
+
+wchar_t *g_download_directories[] =
+{
+	L"C:\\Users\\user\\Downloads",
+	L"C:\\Users\\user\\Downloads",
+	L"C:\\Users\\user\\Downloads",
+	L"C:\\Users\\user\\Downloads\\Programs",
+	L"C:\\Users\\user\\Videos",
+	L"C:\\Users\\user\\Documents\\Papers",
+	L"D:\\Downloads",
+	L"D:\\ISO",
+	L"E:\\Media\\Podcasts",
+	L"C:\\Users\\\x0410\x043D\x0434\x0440\x0435\x0439\\\x0417\x0430\x0433\x0440\x0443\x0437\x043A\x0438",	// Cyrillic
+	L"D:\\\x4E0B\x8F7D"	// Chinese
+};
+
+wchar_t *g_hosts[] =
+{
+	L"releases.ubuntu.com",
+	L"download.mozilla.org",
+	L"github.com",
+	L"objects.githubusercontent.com",
+	L"dl.google.com",
+	L"cdn.kernel.org",
+	L"download.visualstudio.microsoft.com",
+	L"ia800204.us.archive.org",
+	L"files.pythonhosted.org",
+	L"mirrors.edge.kernel.org",
+	L"www.7-zip.org",
+	L"get.videolan.org",
+	L"ftp.gnu.org",
+	L"cdimage.debian.org",
+	L"media.example.com",
+	L"static.example-cdn.net",
+	L"images.example.org",
+	L"s3.amazonaws.com"
+};
+
+wchar_t *g_path_segments[] =
+{
+	L"pub", L"releases", L"download", L"files", L"latest", L"stable", L"x86_64", L"amd64", L"iso-cd", L"v1.4.2",
+	L"2020", L"09", L"media", L"video", L"images", L"archive", L"dist", L"packages", L"linux", L"windows"
+};
+
+wchar_t *g_filename_stems[] =
+{
+	L"ubuntu-20.04.1-desktop-amd64", L"Firefox Setup 80.0.1", L"vlc-3.0.11-win64", L"7z1900-x64", L"python-3.8.5-amd64",
+	L"linux-5.8.9", L"debian-10.5.0-amd64-netinst", L"IMG_2041", L"report_final", L"dataset", L"podcast-episode-112",
+	L"backup", L"node-v12.18.3-x64", L"gcc-10.2.0", L"lecture 07 - dynamic programming", L"wallpaper", L"manual", L"setup"
+};
+
+wchar_t *g_non_ascii_filename_stems[] =
+{
+	L"\x8D44\x6599",												// Chinese
+	L"\x041E\x0442\x0447\x0435\x0442 \x0437\x0430 2020",			// Cyrillic
+	L"\x5199\x771F\x96C6",											// Japanese
+	L"R\x00E9sum\x00E9"												// Latin-1
+};
+
+wchar_t *g_extensions[] =
+{
+	L".iso", L".exe", L".zip", L".tar.xz", L".mp4", L".mkv", L".jpg", L".pdf", L".msi", L".7z", L".mp3", L".tar.gz", L".png", L""
+};
+
+#define _countof_array( a ) ( sizeof( a ) / sizeof( a[ 0 ] ) )
+
+int AppendW( wchar_t *buffer, int length, int size, wchar_t *value )
+{
+	while ( *value != 0 && length < size - 1 )
+	{
+		buffer[ length++ ] = *value++;
+	}
+
+	buffer[ length ] = 0;
+
+	return length;
+}
+
+// Appends random letters and numbers.
+int AppendRandomW( wchar_t *buffer, int length, int size, unsigned int count, wchar_t *alphabet )
+{
+	int alphabet_length = lstrlenW( alphabet );
+
+	while ( count-- > 0 && length < size - 1 )
+	{
+		buffer[ length++ ] = alphabet[ Random() % alphabet_length ];
+	}
+
+	buffer[ length ] = 0;
+
+	return length;
+}
+
+// Appends a filename to a URL. Spaces and non-ASCII characters are percent encoded (as UTF-8).
+int AppendURLEncodedW( wchar_t *buffer, int length, int size, wchar_t *value )
+{
+	wchar_t *hex = L"0123456789ABCDEF";
+
+	while ( *value != 0 && length < size - 10 )
+	{
+		unsigned int c = *value++;
+		unsigned char utf8[ 3 ];
+		int utf8_length;
+
+		if ( c > 0x20 && c < 0x80 )
+		{
+			buffer[ length++ ] = ( wchar_t )c;
+
+			continue;
+		}
+		else if ( c < 0x80 )
+		{
+			utf8[ 0 ] = ( unsigned char )c;
+			utf8_length = 1;
+		}
+		else if ( c < 0x800 )
+		{
+			utf8[ 0 ] = ( unsigned char )( 0xC0 | ( c >> 6 ) );
+			utf8[ 1 ] = ( unsigned char )( 0x80 | ( c & 0x3F ) );
+			utf8_length = 2;
+		}
+		else
+		{
+			utf8[ 0 ] = ( unsigned char )( 0xE0 | ( c >> 12 ) );
+			utf8[ 1 ] = ( unsigned char )( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+			utf8[ 2 ] = ( unsigned char )( 0x80 | ( c & 0x3F ) );
+			utf8_length = 3;
+		}
+
+		for ( int i = 0; i < utf8_length; ++i )
+		{
+			buffer[ length++ ] = L'%';
+			buffer[ length++ ] = hex[ utf8[ i ] >> 4 ];
+			buffer[ length++ ] = hex[ utf8[ i ] & 0x0F ];
+		}
+	}
+
+	buffer[ length ] = 0;
+
+	return length;
+}
+
+char *RandomStringA( unsigned int low, unsigned int high, char *prefix )
+{
+	char *alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	unsigned int count = RandomRange( low, high );
+	int prefix_length = lstrlenA( prefix );
+
+	char *string = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( prefix_length + count + 1 ) );
+	_memcpy_s( string, prefix_length + count + 1, prefix, prefix_length );
+
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		string[ prefix_length + i ] = alphabet[ Random() % 62 ];
+	}
+
+	string[ prefix_length + count ] = 0;
+
+	return string;
+}
+
+void AddRange( DOWNLOAD_INFO *di, unsigned long long range_start, unsigned long long range_end, unsigned long long content_offset )
+{
+	RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+	ri->range_start = range_start;
+	ri->range_end = range_end;
+	ri->content_length = di->file_size;	// Content-Range gives the size of the whole file.
+	ri->content_offset = content_offset;
+	ri->file_write_offset = range_start + content_offset;
+
+	DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+	DLL_AddNode( &di->range_list, range_node, -1 );
+}
+
+// Makes an entry that looks like one from a history that's been used for a while.
+// Most entries are finished downloads of a few hundred KB to a few GB, with 1 to 16 parts (each part keeps its range).
+// Some are stopped or paused part way, and a few failed before getting a response.
+// About 1 in 20 have a non-ASCII directory or filename. A few have long signed URLs, cookies, headers, POST data, or a username and password.
+DOWNLOAD_INFO *GenerateEntry( unsigned int index )
+{
+	DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+
+	di->hFile = INVALID_HANDLE_VALUE;
+
+	// The download directory and filename.
+	wchar_t *download_directory = g_download_directories[ RandomChance( 5 ) ? RandomRange( 9, 10 ) : RandomRange( 0, 8 ) ];
+
+	int length = AppendW( di->file_path, 0, MAX_PATH, download_directory );
+	di->filename_offset = length + 1;
+
+	wchar_t filename[ MAX_PATH ];
+	int filename_length = AppendW( filename, 0, MAX_PATH, ( RandomChance( 5 ) ? g_non_ascii_filename_stems[ Random() % _countof_array( g_non_ascii_filename_stems ) ] :
+																				  g_filename_stems[ Random() % _countof_array( g_filename_stems ) ] ) );
+	if ( RandomChance( 30 ) )
+	{
+		filename_length = AppendW( filename, filename_length, MAX_PATH, L"_" );
+		filename_length = AppendRandomW( filename, filename_length, MAX_PATH, RandomRange( 1, 4 ), L"0123456789" );
+	}
+
+	filename_length = AppendW( filename, filename_length, MAX_PATH, g_extensions[ Random() % _countof_array( g_extensions ) ] );
+
+	_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, filename, filename_length + 1 );
+
+	di->file_extension_offset = di->filename_offset + get_file_extension_offset( filename, filename_length );
+	if ( di->file_extension_offset == di->filename_offset + filename_length )
+	{
+		di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
+	}
+
+	// The URL.
+	wchar_t url[ 2048 ];
+	unsigned int scheme = Random() % 100;
+	length = AppendW( url, 0, 2048, ( scheme < 90 ? L"https://" : ( scheme < 98 ? L"http://" : L"ftp://" ) ) );
+	length = AppendW( url, length, 2048, g_hosts[ Random() % _countof_array( g_hosts ) ] );
+
+	for ( unsigned int i = RandomRange( 0, 4 ); i > 0; --i )
+	{
+		length = AppendW( url, length, 2048, L"/" );
+		length = AppendW( url, length, 2048, g_path_segments[ Random() % _countof_array( g_path_segments ) ] );
+	}
+
+	length = AppendW( url, length, 2048, L"/" );
+	length = AppendURLEncodedW( url, length, 2048, filename );
+
+	unsigned int query = Random() % 100;
+	if ( query < 8 )	// A signed URL.
+	{
+		length = AppendW( url, length, 2048, L"?X-Amz-Algorithm=AWS4-HMAC-SHA256&X-Amz-Credential=" );
+		length = AppendRandomW( url, length, 2048, 20, L"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789" );
+		length = AppendW( url, length, 2048, L"%2F20200918%2Fus-east-1%2Fs3%2Faws4_request&X-Amz-Date=20200918T101500Z&X-Amz-Expires=300&X-Amz-Signature=" );
+		length = AppendRandomW( url, length, 2048, 64, L"0123456789abcdef" );
+		length = AppendW( url, length, 2048, L"&X-Amz-SignedHeaders=host" );
+	}
+	else if ( query < 20 )
+	{
+		length = AppendW( url, length, 2048, L"?v=" );
+		length = AppendRandomW( url, length, 2048, RandomRange( 6, 12 ), L"abcdefghijklmnopqrstuvwxyz0123456789" );
+	}
+
+	di->url = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( length + 1 ) );
+	_wmemcpy_s( di->url, length + 1, url, length + 1 );
+
+	// Entries were added about an hour apart from the start of 2019.
+	di->add_time.QuadPart = 131908320000000000ULL + ( index * 36000000000ULL ) + ( Random() % 36000000000ULL );
+
+	di->method = METHOD_GET;
+	di->ssl_version = 4;	// TLS 1.2, the default.
+
+	unsigned int parts = Random() % 100;
+	di->parts = ( parts < 60 ? 1 : ( parts < 65 ? 2 : ( parts < 85 ? 4 : ( parts < 97 ? 8 : 16 ) ) ) );
+
+	if ( RandomChance( 3 ) )
+	{
+		di->download_speed_limit = RandomRange( 1, 10 ) * 1048576;
+	}
+
+	unsigned int status = Random() % 100;
+	if ( status < 85 )
+	{
+		di->status = STATUS_COMPLETED;
+	}
+	else if ( status < 92 )
+	{
+		di->status = STATUS_STOPPED;
+	}
+	else if ( status < 95 )
+	{
+		di->status = STATUS_PAUSED;
+	}
+	else if ( status < 98 )
+	{
+		di->status = STATUS_FAILED;
+	}
+	else
+	{
+		di->status = STATUS_QUEUED;
+	}
+
+	// Failed and queued downloads never got a response.
+	if ( di->status != STATUS_FAILED && di->status != STATUS_QUEUED )
+	{
+		di->processed_header = true;
+
+		// 16 KB to 8 GB, evenly spread over each power of 2.
+		unsigned int size_bits = RandomRange( 14, 32 );
+		di->file_size = ( 1ULL << size_bits ) + ( ( ( unsigned long long )Random() << 1 ) % ( 1ULL << size_bits ) );
+
+		if ( RandomChance( 80 ) )
+		{
+			di->last_modified.QuadPart = di->add_time.QuadPart - ( ( unsigned long long )Random() * 100000ULL );
+		}
+
+		for ( unsigned char i = 0; i < di->parts; ++i )
+		{
+			unsigned long long range_start = ( di->file_size * i ) / di->parts;
+			unsigned long long range_end = ( ( di->file_size * ( i + 1 ) ) / di->parts ) - 1;
+			unsigned long long content_offset = range_end - range_start + 1;
+
+			if ( di->status != STATUS_COMPLETED )
+			{
+				content_offset = ( content_offset * RandomRange( 0, 100 ) ) / 100;
+			}
+
+			AddRange( di, range_start, range_end, content_offset );
+
+			di->downloaded += content_offset;
+		}
+	}
+
+	di->last_downloaded = di->downloaded;
+	di->print_range_list = di->range_list;
+
+	if ( RandomChance( 5 ) )
+	{
+		di->cookies = RandomStringA( 60, 400, "session=" );
+	}
+
+	if ( RandomChance( 3 ) )
+	{
+		di->headers = RandomStringA( 20, 120, "Referer: https://www.example.com/\r\nAuthorization: Bearer " );
+	}
+
+	if ( RandomChance( 1 ) )
+	{
+		di->method = METHOD_POST;
+		di->data = RandomStringA( 20, 120, "id=" );
+	}
+
+	if ( RandomChance( 2 ) )
+	{
+		di->auth_info.username = RandomStringA( 4, 12, "" );
+		di->auth_info.password = RandomStringA( 8, 20, "" );
+	}
+
+	return di;
+}
+
+bool CompareStringsW( wchar_t *a, wchar_t *b )
+{
+	return ( ( a == NULL || a[ 0 ] == 0 ) && ( b == NULL || b[ 0 ] == 0 ) ) || ( a != NULL && b != NULL && lstrcmpW( a, b ) == 0 );
+}
+
+bool CompareStringsA( char *a, char *b )
+{
+	return ( ( a == NULL || a[ 0 ] == 0 ) && ( b == NULL || b[ 0 ] == 0 ) ) || ( a != NULL && b != NULL && lstrcmpA( a, b ) == 0 );
+}
+
+// Returns true if a loaded entry has the same values as the one that was saved.
+bool CompareEntries( DOWNLOAD_INFO *a, DOWNLOAD_INFO *b )
+{
+	if ( a->add_time.QuadPart != b->add_time.QuadPart ||
+		 a->last_modified.QuadPart != b->last_modified.QuadPart ||
+		 a->downloaded != b->downloaded ||
+		 a->file_size != b->file_size ||
+		 a->download_speed_limit != b->download_speed_limit ||
+		 a->parts != b->parts ||
+		 a->parts_limit != b->parts_limit ||
+		 a->status != b->status ||
+		 a->ssl_version != b->ssl_version ||
+		 a->processed_header != b->processed_header ||
+		 a->download_operations != b->download_operations ||
+		 a->method != b->method ||
+		 a->filename_offset != b->filename_offset ||
+		 a->file_extension_offset != b->file_extension_offset ||
+		 lstrcmpW( a->file_path, b->file_path ) != 0 ||
+		 lstrcmpW( a->file_path + a->filename_offset, b->file_path + b->filename_offset ) != 0 ||
+		 !CompareStringsW( a->url, b->url ) ||
+		 !CompareStringsA( a->cookies, b->cookies ) ||
+		 !CompareStringsA( a->headers, b->headers ) ||
+		 !CompareStringsA( a->data, b->data ) ||
+		 !CompareStringsA( a->auth_info.username, b->auth_info.username ) ||
+		 !CompareStringsA( a->auth_info.password, b->auth_info.password ) )
+	{
+		return false;
+	}
+
+	DoublyLinkedList *range_node_a = a->range_list;
+	DoublyLinkedList *range_node_b = b->range_list;
+
+	while ( range_node_a != NULL && range_node_b != NULL )
+	{
+		if ( _memcmp( range_node_a->data, range_node_b->data, sizeof( RANGE_INFO ) ) != 0 )
+		{
+			return false;
+		}
+
+		range_node_a = range_node_a->next;
+		range_node_b = range_node_b->next;
+	}
+
+	return ( range_node_a == NULL && range_node_b == NULL );
+}
+
+// Writes the entries the way write_download_history() does. The history buffer stands in for the file.
+char *SaveHistory( DOWNLOAD_INFO **entries, unsigned int entry_count, unsigned char version, DWORD &history_length )
+{
+	unsigned int size = ( 524288 + 1 );
+	unsigned int pos = 0;
+
+	unsigned int history_size = 4;
+
+	for ( unsigned int i = 0; i < entry_count; ++i )
+	{
+		history_size += ( version == 5 ? get_download_history_entry_length( entries[ i ] ) : get_download_history_entry_bound( entries[ i ] ) );
+	}
+
+	char *history_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * history_size );
+	char *write_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * size );
+	if ( history_buf == NULL || write_buf == NULL )
+	{
+		GlobalFree( history_buf );
+		GlobalFree( write_buf );
+
+		return NULL;
+	}
+
+	history_length = 0;
+
+	_memcpy_s( write_buf + pos, size - pos, ( version == 5 ? MAGIC_ID_DOWNLOADS_5 : MAGIC_ID_DOWNLOADS ), sizeof( char ) * 4 );
+	pos += ( sizeof( char ) * 4 );
+
+	for ( unsigned int i = 0; i < entry_count; ++i )
+	{
+		DOWNLOAD_INFO *di = entries[ i ];
+
+		unsigned int entry_length = ( version == 5 ? get_download_history_entry_length( di ) : get_download_history_entry_bound( di ) );
+
+		// See if the next entry can fit in the buffer. If it can't, then we dump the buffer.
+		if ( pos + entry_length > size )
+		{
+			_memcpy_s( history_buf + history_length, history_size - history_length, write_buf, pos );
+			history_length += pos;
+			pos = 0;
+		}
+
+		// The entry is larger than our buffer (really long cookies, headers, or data). Write it separately.
+		if ( entry_length > size )
+		{
+			char *entry_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * entry_length );
+			if ( entry_buf != NULL )
+			{
+				unsigned int entry_size = ( version == 5 ? write_download_history_entry( di, entry_buf, entry_length ) : encode_download_history_entry( di, entry_buf, entry_length ) );
+
+				_memcpy_s( history_buf + history_length, history_size - history_length, entry_buf, entry_size );
+				history_length += entry_size;
+
+				GlobalFree( entry_buf );
+			}
+		}
+		else
+		{
+			pos += ( version == 5 ? write_download_history_entry( di, write_buf + pos, size - pos ) : encode_download_history_entry( di, write_buf + pos, size - pos ) );
+		}
+	}
+
+	// If there's anything remaining in the buffer, then write it to the file.
+	if ( pos > 0 )
+	{
+		_memcpy_s( history_buf + history_length, history_size - history_length, write_buf, pos );
+		history_length += pos;
+	}
+
+	GlobalFree( write_buf );
+
+	return history_buf;
+}
+
+// Indexes and parses the entries the way read_download_history() does, but on one thread.
+DOWNLOAD_INFO **LoadHistory( char *history_buf, DWORD history_length, unsigned int &entry_count )
+{
+	unsigned char version = 0;
+
+	entry_count = 0;
+
+	if ( history_length >= 4 )
+	{
+		if ( _memcmp( history_buf, MAGIC_ID_DOWNLOADS, 4 ) == 0 )
+		{
+			version = 6;
+		}
+		else if ( _memcmp( history_buf, MAGIC_ID_DOWNLOADS_5, 4 ) == 0 )
+		{
+			version = 5;
+		}
+	}
+
+	if ( version == 0 )
+	{
+		return NULL;
+	}
+
+	DOWNLOAD_INFO **entries = NULL;
+
+	DWORD *offsets = index_download_history( history_buf + 4, history_length - 4, version, entry_count );
+	if ( offsets != NULL && entry_count > 0 )
+	{
+		entries = ( DOWNLOAD_INFO ** )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO * ) * entry_count );
+		if ( entries != NULL )
+		{
+			for ( unsigned int i = 0; i < entry_count; ++i )
+			{
+				if ( version == 5 )
+				{
+					DWORD entry_length = 0;
+
+					entries[ i ] = parse_download_history_entry( history_buf + 4 + offsets[ i ], offsets[ i + 1 ] - offsets[ i ], entry_length );
+				}
+				else
+				{
+					entries[ i ] = decode_download_history_entry( history_buf + 4 + offsets[ i ], offsets[ i + 1 ] - offsets[ i ] );
+				}
+			}
+		}
+	}
+
+	GlobalFree( offsets );
+
+	return entries;
+}
+
+void FreeHistory( DOWNLOAD_INFO **entries, unsigned int entry_count )
+{
+	if ( entries != NULL )
+	{
+		for ( unsigned int i = 0; i < entry_count; ++i )
+		{
+			free_download_history_entry( entries[ i ] );
+		}
+
+		GlobalFree( entries );
+	}
+}
+
+char *ReadHistoryFile( char *file_path, DWORD &history_length )
+{
+	FILE *f = fopen( file_path, "rb" );
+	if ( f == NULL )
+	{
+		return NULL;
+	}
+
+	fseek( f, 0, SEEK_END );
+	long file_size = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	char *history_buf = NULL;
+
+	if ( file_size > 0 )
+	{
+		history_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * file_size );
+		if ( history_buf != NULL )
+		{
+			history_length = ( DWORD )fread( history_buf, sizeof( char ), file_size, f );
+		}
+	}
+
+	fclose( f );
+
+	return history_buf;
+}
+
+double GetElapsedMilliseconds( LARGE_INTEGER &start, LARGE_INTEGER &stop, LARGE_INTEGER &frequency )
+{
+	return ( double )( stop.QuadPart - start.QuadPart ) * 1000.0 / ( double )frequency.QuadPart;
+}
+
+struct VERSION_RESULT
+{
+	DWORD	history_length;
+	double	save_time;		// The fastest run in milliseconds.
+	double	load_time;
+	bool	matched;		// Every loaded entry matched the one that was saved.
+};
+
+void MeasureVersion( DOWNLOAD_INFO **entries, unsigned int entry_count, unsigned char version, unsigned int run_count, VERSION_RESULT &result )
+{
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency( &frequency );
+
+	result.save_time = 0;
+	result.load_time = 0;
+	result.matched = true;
+
+	for ( unsigned int run = 0; run < run_count; ++run )
+	{
+		QueryPerformanceCounter( &start );
+
+		char *history_buf = SaveHistory( entries, entry_count, version, result.history_length );
+
+		QueryPerformanceCounter( &stop );
+
+		double save_time = GetElapsedMilliseconds( start, stop, frequency );
+
+		unsigned int loaded_count = 0;
+
+		QueryPerformanceCounter( &start );
+
+		DOWNLOAD_INFO **loaded_entries = LoadHistory( history_buf, result.history_length, loaded_count );
+
+		QueryPerformanceCounter( &stop );
+
+		double load_time = GetElapsedMilliseconds( start, stop, frequency );
+
+		if ( run == 0 || save_time < result.save_time ) { result.save_time = save_time; }
+		if ( run == 0 || load_time < result.load_time ) { result.load_time = load_time; }
+
+		if ( run == 0 )
+		{
+			result.matched = ( loaded_count == entry_count );
+
+			for ( unsigned int i = 0; i < loaded_count && result.matched; ++i )
+			{
+				result.matched = ( loaded_entries[ i ] != NULL && CompareEntries( entries[ i ], loaded_entries[ i ] ) );
+			}
+		}
+
+		FreeHistory( loaded_entries, loaded_count );
+		GlobalFree( history_buf );
+	}
+}
+
+int main( int argc, char *argv[] )
+{
+	unsigned int entry_count = DEFAULT_ENTRY_COUNT;
+	unsigned int run_count = DEFAULT_RUN_COUNT;
+	char *file_path = NULL;
+
+	if ( argc > 2 && lstrcmpA( argv[ 1 ], "-f" ) == 0 )
+	{
+		file_path = argv[ 2 ];
+
+		if ( argc > 3 ) { run_count = strtoul( argv[ 3 ], NULL, 10 ); }
+	}
+	else
+	{
+		if ( argc > 1 ) { entry_count = strtoul( argv[ 1 ], NULL, 10 ); }
+		if ( argc > 2 ) { g_random_state = strtoul( argv[ 2 ], NULL, 10 ); }
+		if ( argc > 3 ) { run_count = strtoul( argv[ 3 ], NULL, 10 ); }
+	}
+
+	if ( g_random_state == 0 ) { g_random_state = 1; }	// xorshift never leaves 0.
+	if ( run_count == 0 ) { run_count = 1; }
+
+	DOWNLOAD_INFO **entries;
+
+	if ( file_path != NULL )
+	{
+		DWORD history_length = 0;
+		char *history_buf = ReadHistoryFile( file_path, history_length );
+		if ( history_buf == NULL )
+		{
+			printf( "Can't read %s\n", file_path );
+
+			return 1;
+		}
+
+		entries = LoadHistory( history_buf, history_length, entry_count );
+
+		GlobalFree( history_buf );
+
+		// Leave out any entries that didn't load so that both versions save the same ones.
+		unsigned int loaded_count = 0;
+		for ( unsigned int i = 0; entries != NULL && i < entry_count; ++i )
+		{
+			if ( entries[ i ] != NULL )
+			{
+				entries[ loaded_count++ ] = entries[ i ];
+			}
+		}
+
+		if ( loaded_count == 0 )
+		{
+			printf( "%s isn't a version 5 or version 6 history file, or it has no entries.\n", file_path );
+
+			return 1;
+		}
+
+		printf( "%u entries from %s\n\n", loaded_count, file_path );
+
+		entry_count = loaded_count;
+	}
+	else
+	{
+		printf( "%u generated entries (seed %u)\n\n", entry_count, g_random_state );
+
+		entries = ( DOWNLOAD_INFO ** )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO * ) * ( entry_count > 0 ? entry_count : 1 ) );
+
+		for ( unsigned int i = 0; i < entry_count; ++i )
+		{
+			entries[ i ] = GenerateEntry( i );
+		}
+	}
+
+	VERSION_RESULT v5, v6;
+
+	MeasureVersion( entries, entry_count, 5, run_count, v5 );
+	MeasureVersion( entries, entry_count, 6, run_count, v6 );
+
+	printf( "           Size (bytes)   Per entry   Save (ms)   Load (ms)   Entries match\n" );
+	printf( "Version 5  %12lu   %9.1f   %9.3f   %9.3f   %s\n", v5.history_length, ( double )v5.history_length / entry_count, v5.save_time, v5.load_time, ( v5.matched ? "yes" : "NO" ) );
+	printf( "Version 6  %12lu   %9.1f   %9.3f   %9.3f   %s\n", v6.history_length, ( double )v6.history_length / entry_count, v6.save_time, v6.load_time, ( v6.matched ? "yes" : "NO" ) );
+
+	printf( "\nVersion 6 is %.2fx smaller than version 5 and loads %.2fx as fast (fastest of %u runs).\n",
+			( double )v5.history_length / v6.history_length, v5.load_time / v6.load_time, run_count );
+
+	FreeHistory( entries, entry_count );
+
+	return ( v5.matched && v6.matched ? 0 : 1 );
+}
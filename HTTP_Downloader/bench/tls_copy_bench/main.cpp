@@ -0,0 +1,567 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Counts the bytes that are copied for each byte that's received over TLS, before and after records were decrypted in place.
+//
+// SSL_WSARecv_Decrypt() can't be linked here because it needs an SChannel context, so this is a model of it.
+// DecryptRecv(), SSL_WSARecv() and both versions of SSL_WSARecv_Decrypt() are reproduced with their buffer handling unchanged.
+// DecryptMessage() is replaced with a function that does what SChannel does with the buffers:
+// the record is "decrypted" where it is, the data buffer points into the record, and the extra buffer points at the next record.
+// The ciphertext is just the plaintext with a TLS 1.2 AES-GCM record header, nonce, and tag around it.
+//
+// Usage: tls_copy_bench.exe [megabytes] [input buffer KB] [seed]
+//
+// The input buffer only grows when a record doesn't fit, and it keeps the size that the handshake left it at.
+// The default is 8 KB, which is enough for most certificate chains.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define BUFFER_SIZE				16384	// The same as connection.h.
+
+#define RECORD_HEADER_SIZE		5
+#define RECORD_NONCE_SIZE		8
+#define RECORD_TAG_SIZE			16
+#define MAX_RECORD_DATA_SIZE	16384
+
+#define STATUS_OK				0
+#define STATUS_CONTINUE_NEEDED	1
+#define STATUS_INCOMPLETE		2
+
+struct COPY_STATS
+{
+	unsigned long long received;		// Ciphertext bytes received.
+	unsigned long long delivered;		// Plaintext bytes given to the caller's buffer.
+	unsigned long long caller_copy;		// Plaintext copied into the caller's buffer. Both versions have to do this.
+	unsigned long long leftover_copy;	// Plaintext that didn't fit, copied out of the input buffer.
+	unsigned long long leftover_move;	// Plaintext that didn't fit, moved after part of it was handed out.
+	unsigned long long extra_move;		// Undecrypted data moved to the front of the input buffer.
+	unsigned long long realloc_copy;	// Input buffer growth.
+	unsigned long long records;
+};
+
+COPY_STATS g_stats;
+
+struct SSL_MODEL
+{
+	unsigned char	*pbIoBuffer;
+	DWORD			sbIoBuffer;
+	DWORD			cbIoBuffer;
+	DWORD			ibIoBuffer;	// Only used by the new version.
+
+	unsigned char	*pbRecDataBuf;
+	DWORD			sbRecDataBuf;	// Only used by the old version.
+	DWORD			cbRecDataBuf;
+
+	int				scRet;
+	bool			continue_decrypt;
+};
+
+struct BUFFER_MODEL
+{
+	char	*buf;
+	DWORD	len;
+};
+
+// What SChannel's DecryptMessage() does with the buffers when it's given a single SECBUFFER_DATA buffer.
+int FakeDecryptMessage( unsigned char *input, DWORD input_length, unsigned char **data, DWORD *data_length, unsigned char **extra, DWORD *extra_length )
+{
+	if ( input_length < RECORD_HEADER_SIZE )
+	{
+		return STATUS_INCOMPLETE;
+	}
+
+	DWORD record_length = ( ( DWORD )input[ 3 ] << 8 ) | input[ 4 ];
+
+	if ( input_length < RECORD_HEADER_SIZE + record_length )
+	{
+		return STATUS_INCOMPLETE;
+	}
+
+	*data = input + RECORD_HEADER_SIZE + RECORD_NONCE_SIZE;
+	*data_length = record_length - RECORD_NONCE_SIZE - RECORD_TAG_SIZE;
+
+	if ( input_length > RECORD_HEADER_SIZE + record_length )
+	{
+		*extra = input + RECORD_HEADER_SIZE + record_length;
+		*extra_length = input_length - ( RECORD_HEADER_SIZE + record_length );
+	}
+	else
+	{
+		*extra = NULL;
+		*extra_length = 0;
+	}
+
+	++g_stats.records;
+
+	return STATUS_OK;
+}
+
+// SSL_WSARecv_Decrypt() before records were decrypted in place.
+int Decrypt_Old( SSL_MODEL *ssl, BUFFER_MODEL *lpBuffers, DWORD &lpNumberOfBytesDecrypted )
+{
+	lpNumberOfBytesDecrypted = 0;
+
+	if ( ssl->scRet == STATUS_CONTINUE_NEEDED )
+	{
+		if ( lpBuffers->buf != NULL && lpBuffers->len > 0 && ssl->cbRecDataBuf > 0 )
+		{
+			lpNumberOfBytesDecrypted = min( ( DWORD )lpBuffers->len, ssl->cbRecDataBuf );
+			memcpy( lpBuffers->buf, ssl->pbRecDataBuf, lpNumberOfBytesDecrypted );
+			g_stats.caller_copy += lpNumberOfBytesDecrypted;
+
+			DWORD rbytes = ssl->cbRecDataBuf - lpNumberOfBytesDecrypted;
+			if ( rbytes > 0 )
+			{
+				memmove( ssl->pbRecDataBuf, ( ( char * )ssl->pbRecDataBuf ) + lpNumberOfBytesDecrypted, rbytes );
+				g_stats.leftover_move += rbytes;
+			}
+			else
+			{
+				ssl->scRet = STATUS_OK;
+			}
+			ssl->cbRecDataBuf = rbytes;
+		}
+
+		return ssl->scRet;
+	}
+
+	unsigned char *data, *extra;
+	DWORD data_length, extra_length;
+
+	ssl->scRet = FakeDecryptMessage( ssl->pbIoBuffer, ssl->cbIoBuffer, &data, &data_length, &extra, &extra_length );
+
+	if ( ssl->scRet == STATUS_INCOMPLETE )
+	{
+		return ssl->scRet;
+	}
+
+	lpNumberOfBytesDecrypted = min( ( DWORD )lpBuffers->len, data_length );
+	memcpy( lpBuffers->buf, data, lpNumberOfBytesDecrypted );
+	g_stats.caller_copy += lpNumberOfBytesDecrypted;
+
+	DWORD rbytes = data_length - lpNumberOfBytesDecrypted;
+	if ( rbytes > 0 )
+	{
+		if ( ssl->sbRecDataBuf < rbytes )
+		{
+			ssl->sbRecDataBuf = rbytes;
+			ssl->pbRecDataBuf = ( unsigned char * )realloc( ssl->pbRecDataBuf, ssl->sbRecDataBuf );
+		}
+
+		memcpy( ssl->pbRecDataBuf, data + lpNumberOfBytesDecrypted, rbytes );
+		g_stats.leftover_copy += rbytes;
+		ssl->cbRecDataBuf = rbytes;
+
+		ssl->scRet = STATUS_CONTINUE_NEEDED;
+	}
+
+	if ( extra != NULL )
+	{
+		memmove( ssl->pbIoBuffer, extra, extra_length );
+		g_stats.extra_move += extra_length;
+		ssl->cbIoBuffer = extra_length;
+	}
+	else
+	{
+		ssl->cbIoBuffer = 0;
+	}
+
+	return ssl->scRet;
+}
+
+// SSL_WSARecv_Decrypt() now.
+int Decrypt_New( SSL_MODEL *ssl, BUFFER_MODEL *lpBuffers, DWORD &lpNumberOfBytesDecrypted )
+{
+	lpNumberOfBytesDecrypted = 0;
+
+	if ( ssl->scRet == STATUS_CONTINUE_NEEDED )
+	{
+		if ( lpBuffers->buf != NULL && lpBuffers->len > 0 && ssl->cbRecDataBuf > 0 )
+		{
+			lpNumberOfBytesDecrypted = min( ( DWORD )lpBuffers->len, ssl->cbRecDataBuf );
+			memcpy( lpBuffers->buf, ssl->pbRecDataBuf, lpNumberOfBytesDecrypted );
+			g_stats.caller_copy += lpNumberOfBytesDecrypted;
+
+			DWORD rbytes = ssl->cbRecDataBuf - lpNumberOfBytesDecrypted;
+			if ( rbytes > 0 )
+			{
+				ssl->pbRecDataBuf += lpNumberOfBytesDecrypted;
+			}
+			else
+			{
+				ssl->pbRecDataBuf = NULL;
+
+				ssl->scRet = STATUS_OK;
+			}
+			ssl->cbRecDataBuf = rbytes;
+		}
+
+		return ssl->scRet;
+	}
+
+	unsigned char *data, *extra;
+	DWORD data_length, extra_length;
+
+	ssl->scRet = FakeDecryptMessage( ssl->pbIoBuffer + ssl->ibIoBuffer, ssl->cbIoBuffer, &data, &data_length, &extra, &extra_length );
+
+	if ( ssl->scRet == STATUS_INCOMPLETE )
+	{
+		if ( ssl->ibIoBuffer > 0 )
+		{
+			if ( ssl->cbIoBuffer > 0 )
+			{
+				memmove( ssl->pbIoBuffer, ssl->pbIoBuffer + ssl->ibIoBuffer, ssl->cbIoBuffer );
+				g_stats.extra_move += ssl->cbIoBuffer;
+			}
+
+			ssl->ibIoBuffer = 0;
+		}
+
+		return ssl->scRet;
+	}
+
+	lpNumberOfBytesDecrypted = min( ( DWORD )lpBuffers->len, data_length );
+	memcpy( lpBuffers->buf, data, lpNumberOfBytesDecrypted );
+	g_stats.caller_copy += lpNumberOfBytesDecrypted;
+
+	DWORD rbytes = data_length - lpNumberOfBytesDecrypted;
+	if ( rbytes > 0 )
+	{
+		ssl->pbRecDataBuf = data + lpNumberOfBytesDecrypted;
+		ssl->cbRecDataBuf = rbytes;
+
+		ssl->scRet = STATUS_CONTINUE_NEEDED;
+	}
+
+	if ( extra != NULL )
+	{
+		ssl->ibIoBuffer = ( DWORD )( extra - ssl->pbIoBuffer );
+		ssl->cbIoBuffer = extra_length;
+	}
+	else
+	{
+		ssl->ibIoBuffer = 0;
+		ssl->cbIoBuffer = 0;
+	}
+
+	return ssl->scRet;
+}
+
+typedef int ( *pDecrypt )( SSL_MODEL *ssl, BUFFER_MODEL *lpBuffers, DWORD &lpNumberOfBytesDecrypted );
+
+// DecryptRecv() from connection.cpp.
+int DecryptRecv( pDecrypt Decrypt, SSL_MODEL *ssl, BUFFER_MODEL *wsabuf, DWORD &io_size )
+{
+	int scRet;
+
+	DWORD bytes_decrypted = 0;
+
+	if ( ssl->scRet == STATUS_INCOMPLETE )
+	{
+		ssl->cbIoBuffer += io_size;
+	}
+	else
+	{
+		ssl->cbIoBuffer = io_size;
+	}
+
+	io_size = 0;
+
+	ssl->continue_decrypt = false;
+
+	BUFFER_MODEL wsa_decrypt = *wsabuf;
+
+	// Decrypt records until one is incomplete (an empty input buffer is an incomplete record), or the caller's buffer is full.
+	while ( true )
+	{
+		scRet = Decrypt( ssl, &wsa_decrypt, bytes_decrypted );
+
+		io_size += bytes_decrypted;
+
+		wsa_decrypt.buf += bytes_decrypted;
+		wsa_decrypt.len -= bytes_decrypted;
+
+		if ( scRet == STATUS_CONTINUE_NEEDED )
+		{
+			ssl->continue_decrypt = true;
+
+			return scRet;
+		}
+		else if ( scRet != STATUS_OK )
+		{
+			return scRet;
+		}
+	}
+}
+
+unsigned int g_random_state = 1;
+
+unsigned int Random()
+{
+	g_random_state ^= g_random_state << 13;
+	g_random_state ^= g_random_state >> 17;
+	g_random_state ^= g_random_state << 5;
+
+	return g_random_state;
+}
+
+struct STREAM
+{
+	unsigned char	*ciphertext;
+	unsigned int	length;
+	unsigned int	offset;
+};
+
+// The record sizes that servers use: full 16 KB records for bulk data, or records that fit in a TCP segment.
+#define RECORDS_FULL		0
+#define RECORDS_SMALL		1
+#define RECORDS_MIXED		2
+
+unsigned int MakeStream( STREAM *stream, unsigned char *plaintext, unsigned int plaintext_length, unsigned char record_sizes )
+{
+	// No record has less than 512 bytes of data, except for the last one.
+	stream->ciphertext = ( unsigned char * )malloc( plaintext_length + ( ( plaintext_length / 512 ) + 1 ) * ( RECORD_HEADER_SIZE + RECORD_NONCE_SIZE + RECORD_TAG_SIZE ) );
+	stream->length = 0;
+	stream->offset = 0;
+
+	unsigned int record_count = 0;
+	unsigned int offset = 0;
+
+	while ( offset < plaintext_length )
+	{
+		unsigned int data_length;
+
+		if ( record_sizes == RECORDS_FULL )
+		{
+			data_length = MAX_RECORD_DATA_SIZE;
+		}
+		else if ( record_sizes == RECORDS_SMALL )
+		{
+			data_length = 1369;	// Fits in a 1460 byte segment with the IP and TCP options.
+		}
+		else
+		{
+			data_length = ( Random() % 4 == 0 ? 1369 : 512 + ( Random() % ( MAX_RECORD_DATA_SIZE - 511 ) ) );
+		}
+
+		if ( data_length > plaintext_length - offset )
+		{
+			data_length = plaintext_length - offset;
+		}
+
+		unsigned int record_length = RECORD_NONCE_SIZE + data_length + RECORD_TAG_SIZE;
+
+		unsigned char *record = stream->ciphertext + stream->length;
+		record[ 0 ] = 0x17;
+		record[ 1 ] = 0x03;
+		record[ 2 ] = 0x03;
+		record[ 3 ] = ( unsigned char )( record_length >> 8 );
+		record[ 4 ] = ( unsigned char )record_length;
+		memset( record + RECORD_HEADER_SIZE, 0, RECORD_NONCE_SIZE );
+		memcpy( record + RECORD_HEADER_SIZE + RECORD_NONCE_SIZE, plaintext + offset, data_length );
+		memset( record + RECORD_HEADER_SIZE + RECORD_NONCE_SIZE + data_length, 0, RECORD_TAG_SIZE );
+
+		stream->length += RECORD_HEADER_SIZE + record_length;
+		offset += data_length;
+		++record_count;
+	}
+
+	return record_count;
+}
+
+// How much the socket has for each WSARecv().
+#define LINK_FAST			0	// Whatever fits in the buffer.
+#define LINK_SEGMENTS		1	// 1 to 4 TCP segments.
+#define LINK_RANDOM			2	// 1 byte to 16 KB.
+
+unsigned int GetAvailable( unsigned char link )
+{
+	if ( link == LINK_FAST )
+	{
+		return 0xFFFFFFFF;
+	}
+	else if ( link == LINK_SEGMENTS )
+	{
+		return 1460 * ( 1 + ( Random() % 4 ) );
+	}
+	else
+	{
+		return 1 + ( Random() % 16384 );
+	}
+}
+
+// Receives and decrypts the whole stream the way the IO_GetContent completion does.
+// Returns false if the plaintext that was delivered doesn't match.
+bool Run( pDecrypt Decrypt, STREAM *stream, unsigned char *plaintext, unsigned int plaintext_length, unsigned char link, DWORD input_buffer_size, unsigned int seed )
+{
+	memset( &g_stats, 0, sizeof( COPY_STATS ) );
+	g_random_state = seed;
+	stream->offset = 0;
+
+	SSL_MODEL ssl;
+	memset( &ssl, 0, sizeof( SSL_MODEL ) );
+	ssl.sbIoBuffer = input_buffer_size;
+	ssl.pbIoBuffer = ( unsigned char * )malloc( ssl.sbIoBuffer );
+
+	char *buffer = ( char * )malloc( BUFFER_SIZE );
+	bool matches = true;
+
+	while ( true )
+	{
+		DWORD io_size;
+
+		if ( ssl.continue_decrypt )
+		{
+			io_size = ssl.cbIoBuffer;
+		}
+		else
+		{
+			if ( stream->offset == stream->length )
+			{
+				break;
+			}
+
+			// SSL_WSARecv()
+			if ( ssl.sbIoBuffer <= ssl.cbIoBuffer )
+			{
+				g_stats.realloc_copy += ssl.sbIoBuffer;
+
+				ssl.sbIoBuffer += 2048;
+				ssl.pbIoBuffer = ( unsigned char * )realloc( ssl.pbIoBuffer, ssl.sbIoBuffer );
+			}
+
+			DWORD available = GetAvailable( link );
+
+			io_size = min( ssl.sbIoBuffer - ssl.cbIoBuffer, stream->length - stream->offset );
+			io_size = min( io_size, available );
+
+			memcpy( ssl.pbIoBuffer + ssl.cbIoBuffer, stream->ciphertext + stream->offset, io_size );	// This is the receive.
+			stream->offset += io_size;
+			g_stats.received += io_size;
+		}
+
+		BUFFER_MODEL wsabuf;
+		wsabuf.buf = buffer;
+		wsabuf.len = BUFFER_SIZE;
+
+		DecryptRecv( Decrypt, &ssl, &wsabuf, io_size );
+
+		if ( io_size > 0 )
+		{
+			if ( g_stats.delivered + io_size > plaintext_length || memcmp( buffer, plaintext + g_stats.delivered, io_size ) != 0 )
+			{
+				matches = false;
+
+				break;
+			}
+
+			g_stats.delivered += io_size;
+		}
+	}
+
+	free( buffer );
+	free( ssl.pbIoBuffer );
+
+	if ( Decrypt == Decrypt_Old )
+	{
+		free( ssl.pbRecDataBuf );
+	}
+
+	return ( matches && g_stats.delivered == plaintext_length );
+}
+
+int main( int argc, char *argv[] )
+{
+	unsigned int megabytes = ( argc > 1 ? ( unsigned int )strtoul( argv[ 1 ], NULL, 10 ) : 64 );
+	DWORD input_buffer_size = ( argc > 2 ? ( DWORD )strtoul( argv[ 2 ], NULL, 10 ) : 8 ) * 1024;
+	unsigned int seed = ( argc > 3 ? ( unsigned int )strtoul( argv[ 3 ], NULL, 10 ) : 1 );
+	if ( seed == 0 )
+	{
+		seed = 1;
+	}
+
+	if ( input_buffer_size == 0 )
+	{
+		input_buffer_size = 2048;
+	}
+
+	unsigned int plaintext_length = megabytes * 1024 * 1024;
+	unsigned char *plaintext = ( unsigned char * )malloc( plaintext_length );
+
+	g_random_state = seed;
+	for ( unsigned int i = 0; i < plaintext_length; ++i )
+	{
+		plaintext[ i ] = ( unsigned char )( Random() >> 24 );
+	}
+
+	char *record_names[] = { "16 KB records", "1369 byte records", "mixed records" };
+	char *link_names[] = { "full buffer reads", "1-4 segment reads", "1 B-16 KB reads" };
+
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency( &frequency );
+
+	printf( "%u MB of plaintext, %u byte input buffer. Bytes copied per byte received (excluding the receive itself):\n\n", megabytes, input_buffer_size );
+	printf( "%-18s %-18s %-8s %10s %10s %10s %10s %10s %9s\n", "", "", "", "caller", "leftover", "extra", "total", "no caller", "ms" );
+
+	for ( unsigned char record_sizes = RECORDS_FULL; record_sizes <= RECORDS_MIXED; ++record_sizes )
+	{
+		STREAM stream;
+		g_random_state = seed;
+		MakeStream( &stream, plaintext, plaintext_length, record_sizes );
+
+		for ( unsigned char link = LINK_FAST; link <= LINK_RANDOM; ++link )
+		{
+			for ( unsigned char version = 0; version < 2; ++version )
+			{
+				QueryPerformanceCounter( &start );
+
+				bool matches = Run( ( version == 0 ? Decrypt_Old : Decrypt_New ), &stream, plaintext, plaintext_length, link, input_buffer_size, seed );
+
+				QueryPerformanceCounter( &stop );
+
+				if ( !matches )
+				{
+					printf( "%s, %s: the %s version delivered the wrong plaintext.\n", record_names[ record_sizes ], link_names[ link ], ( version == 0 ? "old" : "new" ) );
+
+					return 1;
+				}
+
+				double received = ( double )g_stats.received;
+				double leftover = ( double )( g_stats.leftover_copy + g_stats.leftover_move );
+				double total = ( double )( g_stats.caller_copy + g_stats.leftover_copy + g_stats.leftover_move + g_stats.extra_move + g_stats.realloc_copy );
+
+				printf( "%-18s %-18s %-8s %10.3f %10.3f %10.3f %10.3f %10.3f %9.1f\n",
+						( version == 0 ? record_names[ record_sizes ] : "" ), ( version == 0 ? link_names[ link ] : "" ), ( version == 0 ? "old" : "new" ),
+						g_stats.caller_copy / received, leftover / received, g_stats.extra_move / received, total / received, ( total - g_stats.caller_copy ) / received,
+						( ( double )( stop.QuadPart - start.QuadPart ) * 1000.0 ) / frequency.QuadPart );
+			}
+		}
+
+		free( stream.ciphertext );
+	}
+
+	free( plaintext );
+
+	return 0;
+}
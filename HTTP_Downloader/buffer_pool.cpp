@@ -0,0 +1,487 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "globals.h"
+#include "buffer_pool.h"
+#include "connection.h"
+#include "doublylinkedlist.h"
+
+#define POOL_UNPOOLED			POOL_COUNT	// Buffers that are too large for the largest class.
+
+// Each buffer is preceded by this header. Free buffers use it to link to the next buffer in their pool.
+struct POOL_BUFFER
+{
+	POOL_BUFFER		*next;
+	unsigned int	pool;
+	unsigned int	size;			// The number of bytes after the header.
+};
+
+struct POOL
+{
+	POOL_BUFFER		*free_list;			// The shared cache.
+	unsigned int	free_count;
+	unsigned int	size;				// The size of each object.
+	unsigned int	cache_limit;		// The number of free objects that the shared cache holds onto.
+	unsigned int	thread_cache_limit;	// The number of free objects that each thread's cache holds onto.
+	bool			limited;			// Counts towards BUFFER_POOL_LIMIT.
+	POOL_STATS		stats;				// Includes the counts from thread caches that have been released.
+};
+
+// Allocations and frees go to the calling thread's cache first so that the worker threads don't contend for buffer_pool_cs.
+struct POOL_THREAD_CACHE
+{
+	DoublyLinkedList	node;	// Self reference in g_thread_cache_list.
+	POOL_BUFFER			*free_list[ POOL_COUNT ];
+	unsigned int		free_count[ POOL_COUNT ];
+	unsigned long long	allocations[ POOL_COUNT ];
+	unsigned long long	frees[ POOL_COUNT ];
+	unsigned long long	thread_cache_hits[ POOL_COUNT ];
+};
+
+CRITICAL_SECTION buffer_pool_cs;	// Guard access to the shared caches and the thread cache list.
+
+POOL g_pools[ POOL_COUNT ];
+DoublyLinkedList *g_thread_cache_list = NULL;
+DWORD g_pool_tls_index = TLS_OUT_OF_INDEXES;
+
+unsigned long long g_buffer_pool_size = 0;	// The bytes allocated for the limited pools (free or in use).
+
+void BP_InitializePool( unsigned char pool, unsigned int size, unsigned int cache_limit, unsigned int thread_cache_limit, bool limited )
+{
+	_memzero( &g_pools[ pool ], sizeof( POOL ) );
+
+	g_pools[ pool ].size = size;
+	g_pools[ pool ].cache_limit = cache_limit;
+	g_pools[ pool ].thread_cache_limit = thread_cache_limit;
+	g_pools[ pool ].limited = limited;
+	g_pools[ pool ].stats.object_size = size;
+}
+
+void BP_Initialize()
+{
+	InitializeCriticalSection( &buffer_pool_cs );
+
+	g_pool_tls_index = TlsAlloc();
+
+	// Every buffer class reserves an extra byte so that the data in a full buffer can still be NULL terminated.
+	for ( unsigned char i = 0; i < BUFFER_POOL_CLASSES; ++i )
+	{
+		BP_InitializePool( i, ( BUFFER_POOL_MIN_SIZE << i ) + 1, 16, ( i == 0 ? 8 : 2 ), ( i > 0 ) );
+	}
+
+	BP_InitializePool( POOL_SOCKET_CONTEXT, sizeof( SOCKET_CONTEXT ), 64, 16, false );
+	BP_InitializePool( POOL_WRITE_BUFFER, WRITE_BUFFER_SIZE, 8, 2, false );
+}
+
+// Must be called with buffer_pool_cs held.
+void BP_ReturnBuffer( POOL_BUFFER *pb )
+{
+	POOL *pool = &g_pools[ pb->pool ];
+
+	if ( pool->free_count < pool->cache_limit )
+	{
+		pb->next = pool->free_list;
+		pool->free_list = pb;
+		++pool->free_count;
+	}
+	else
+	{
+		++pool->stats.system_frees;
+
+		if ( pool->limited )
+		{
+			g_buffer_pool_size -= pb->size;
+		}
+
+		GlobalFree( pb );
+	}
+}
+
+POOL_THREAD_CACHE *BP_GetThreadCache()
+{
+	if ( g_pool_tls_index == TLS_OUT_OF_INDEXES )
+	{
+		return NULL;
+	}
+
+	POOL_THREAD_CACHE *tc = ( POOL_THREAD_CACHE * )TlsGetValue( g_pool_tls_index );
+	if ( tc == NULL )
+	{
+		tc = ( POOL_THREAD_CACHE * )GlobalAlloc( GPTR, sizeof( POOL_THREAD_CACHE ) );
+		if ( tc != NULL )
+		{
+			if ( TlsSetValue( g_pool_tls_index, tc ) == FALSE )
+			{
+				GlobalFree( tc );
+
+				return NULL;
+			}
+
+			tc->node.data = tc;
+
+			EnterCriticalSection( &buffer_pool_cs );
+
+			DLL_AddNode( &g_thread_cache_list, &tc->node, -1 );
+
+			LeaveCriticalSection( &buffer_pool_cs );
+		}
+	}
+
+	return tc;
+}
+
+// Moves the thread cache's free objects and counts into the shared pools. Must be called with buffer_pool_cs held.
+void BP_MergeThreadCache( POOL_THREAD_CACHE *tc )
+{
+	for ( unsigned char i = 0; i < POOL_COUNT; ++i )
+	{
+		while ( tc->free_list[ i ] != NULL )
+		{
+			POOL_BUFFER *pb = tc->free_list[ i ];
+			tc->free_list[ i ] = pb->next;
+
+			BP_ReturnBuffer( pb );
+		}
+
+		tc->free_count[ i ] = 0;
+
+		g_pools[ i ].stats.allocations += tc->allocations[ i ];
+		g_pools[ i ].stats.frees += tc->frees[ i ];
+		g_pools[ i ].stats.thread_cache_hits += tc->thread_cache_hits[ i ];
+	}
+
+	DLL_RemoveNode( &g_thread_cache_list, &tc->node );
+}
+
+// Threads that allocate or free buffers should call this before they exit.
+void BP_ReleaseThreadCache()
+{
+	if ( g_pool_tls_index == TLS_OUT_OF_INDEXES )
+	{
+		return;
+	}
+
+	POOL_THREAD_CACHE *tc = ( POOL_THREAD_CACHE * )TlsGetValue( g_pool_tls_index );
+	if ( tc != NULL )
+	{
+		EnterCriticalSection( &buffer_pool_cs );
+
+		BP_MergeThreadCache( tc );
+
+		LeaveCriticalSection( &buffer_pool_cs );
+
+		TlsSetValue( g_pool_tls_index, NULL );
+
+		GlobalFree( tc );
+	}
+}
+
+// The contents of the returned object are undefined.
+// Returns NULL if the allocation failed, or if enforce_limit is set and it would put the limited pools over BUFFER_POOL_LIMIT.
+void *BP_AllocatePool( unsigned char pool_index, bool enforce_limit )
+{
+	POOL *pool = &g_pools[ pool_index ];
+	POOL_BUFFER *pb = NULL;
+
+	POOL_THREAD_CACHE *tc = BP_GetThreadCache();
+	if ( tc != NULL && tc->free_list[ pool_index ] != NULL )
+	{
+		pb = tc->free_list[ pool_index ];
+		tc->free_list[ pool_index ] = pb->next;
+		--tc->free_count[ pool_index ];
+
+		++tc->allocations[ pool_index ];
+		++tc->thread_cache_hits[ pool_index ];
+
+		pb->next = NULL;
+
+		return ( void * )( pb + 1 );
+	}
+
+	EnterCriticalSection( &buffer_pool_cs );
+
+	if ( pool->free_list != NULL )
+	{
+		pb = pool->free_list;
+		pool->free_list = pb->next;
+		--pool->free_count;
+
+		++pool->stats.cache_hits;
+	}
+	else
+	{
+		if ( pool->limited )
+		{
+			if ( enforce_limit && g_buffer_pool_size + pool->size > BUFFER_POOL_LIMIT )
+			{
+				LeaveCriticalSection( &buffer_pool_cs );
+
+				return NULL;
+			}
+
+			// Reserve the space before we allocate it so that other threads can't go over the limit.
+			g_buffer_pool_size += pool->size;
+		}
+
+		++pool->stats.system_allocations;
+	}
+
+	if ( tc == NULL )
+	{
+		++pool->stats.allocations;
+	}
+
+	LeaveCriticalSection( &buffer_pool_cs );
+
+	if ( pb == NULL )
+	{
+		pb = ( POOL_BUFFER * )GlobalAlloc( GMEM_FIXED, sizeof( POOL_BUFFER ) + pool->size );
+		if ( pb == NULL )
+		{
+			EnterCriticalSection( &buffer_pool_cs );
+
+			if ( pool->limited )
+			{
+				g_buffer_pool_size -= pool->size;
+			}
+
+			--pool->stats.system_allocations;
+
+			if ( tc == NULL )
+			{
+				--pool->stats.allocations;
+			}
+
+			LeaveCriticalSection( &buffer_pool_cs );
+
+			return NULL;
+		}
+
+		pb->pool = pool_index;
+		pb->size = pool->size;
+	}
+
+	if ( tc != NULL )
+	{
+		++tc->allocations[ pool_index ];
+	}
+
+	pb->next = NULL;
+
+	return ( void * )( pb + 1 );
+}
+
+// The contents of the returned buffer are undefined.
+// Optional allocations (like growing a buffer that works fine at its current size) should enforce the limit.
+char *BP_Allocate( unsigned int size, bool enforce_limit )
+{
+	for ( unsigned char i = 0; i < BUFFER_POOL_CLASSES; ++i )
+	{
+		if ( size <= g_pools[ i ].size )
+		{
+			return ( char * )BP_AllocatePool( i, enforce_limit );
+		}
+	}
+
+	if ( enforce_limit )
+	{
+		return NULL;
+	}
+
+	POOL_BUFFER *pb = ( POOL_BUFFER * )GlobalAlloc( GMEM_FIXED, sizeof( POOL_BUFFER ) + size );
+	if ( pb == NULL )
+	{
+		return NULL;
+	}
+
+	pb->next = NULL;
+	pb->pool = POOL_UNPOOLED;
+	pb->size = size;
+
+	return ( char * )( pb + 1 );
+}
+
+// Copies length bytes into a buffer that can hold size bytes. The remainder of the new buffer is zeroed.
+// If the new buffer can't be allocated, then NULL is returned and the old buffer remains valid.
+char *BP_Reallocate( char *buffer, unsigned int length, unsigned int size )
+{
+	char *new_buffer = BP_Allocate( size );
+	if ( new_buffer != NULL )
+	{
+		if ( length > size )
+		{
+			length = size;
+		}
+
+		if ( buffer != NULL )
+		{
+			_memcpy_s( new_buffer, size, buffer, length );
+
+			BP_Free( buffer );
+		}
+		else
+		{
+			length = 0;
+		}
+
+		_memzero( new_buffer + length, size - length );
+	}
+
+	return new_buffer;
+}
+
+// The contents of the returned object are undefined.
+void *BP_AllocateObject( unsigned char pool )
+{
+	if ( pool < BUFFER_POOL_CLASSES || pool >= POOL_COUNT )
+	{
+		return NULL;
+	}
+
+	return BP_AllocatePool( pool, false );
+}
+
+void BP_Free( void *buffer )
+{
+	if ( buffer == NULL )
+	{
+		return;
+	}
+
+	POOL_BUFFER *pb = ( POOL_BUFFER * )buffer - 1;
+
+	if ( pb->pool < POOL_COUNT )
+	{
+		POOL_THREAD_CACHE *tc = BP_GetThreadCache();
+		if ( tc != NULL )
+		{
+			++tc->frees[ pb->pool ];
+
+			if ( tc->free_count[ pb->pool ] < g_pools[ pb->pool ].thread_cache_limit )
+			{
+				pb->next = tc->free_list[ pb->pool ];
+				tc->free_list[ pb->pool ] = pb;
+				++tc->free_count[ pb->pool ];
+
+				return;
+			}
+		}
+
+		EnterCriticalSection( &buffer_pool_cs );
+
+		if ( tc == NULL )
+		{
+			++g_pools[ pb->pool ].stats.frees;
+		}
+
+		BP_ReturnBuffer( pb );
+
+		LeaveCriticalSection( &buffer_pool_cs );
+	}
+	else
+	{
+		GlobalFree( pb );
+	}
+}
+
+// Release the calling thread's cache and the shared caches back to the system.
+void BP_FreeCache()
+{
+	BP_ReleaseThreadCache();
+
+	EnterCriticalSection( &buffer_pool_cs );
+
+	for ( unsigned char i = 0; i < POOL_COUNT; ++i )
+	{
+		while ( g_pools[ i ].free_list != NULL )
+		{
+			POOL_BUFFER *pb = g_pools[ i ].free_list;
+			g_pools[ i ].free_list = pb->next;
+
+			if ( g_pools[ i ].limited )
+			{
+				g_buffer_pool_size -= pb->size;
+			}
+
+			GlobalFree( pb );
+		}
+
+		g_pools[ i ].free_count = 0;
+	}
+
+	LeaveCriticalSection( &buffer_pool_cs );
+}
+
+// Any threads that are still using the pools must have exited.
+void BP_Uninitialize()
+{
+	EnterCriticalSection( &buffer_pool_cs );
+
+	while ( g_thread_cache_list != NULL )
+	{
+		POOL_THREAD_CACHE *tc = ( POOL_THREAD_CACHE * )g_thread_cache_list->data;
+
+		BP_MergeThreadCache( tc );
+
+		GlobalFree( tc );
+	}
+
+	LeaveCriticalSection( &buffer_pool_cs );
+
+	BP_FreeCache();
+
+	if ( g_pool_tls_index != TLS_OUT_OF_INDEXES )
+	{
+		TlsFree( g_pool_tls_index );
+		g_pool_tls_index = TLS_OUT_OF_INDEXES;
+	}
+
+	DeleteCriticalSection( &buffer_pool_cs );
+}
+
+// The thread cache counts are read without their threads' knowledge, so they're approximate while those threads are running.
+bool BP_GetStats( unsigned char pool, POOL_STATS *stats )
+{
+	if ( pool >= POOL_COUNT || stats == NULL )
+	{
+		return false;
+	}
+
+	EnterCriticalSection( &buffer_pool_cs );
+
+	_memcpy_s( stats, sizeof( POOL_STATS ), &g_pools[ pool ].stats, sizeof( POOL_STATS ) );
+
+	stats->cached = g_pools[ pool ].free_count;
+
+	DoublyLinkedList *node = g_thread_cache_list;
+	while ( node != NULL )
+	{
+		POOL_THREAD_CACHE *tc = ( POOL_THREAD_CACHE * )node->data;
+
+		stats->allocations += tc->allocations[ pool ];
+		stats->frees += tc->frees[ pool ];
+		stats->thread_cache_hits += tc->thread_cache_hits[ pool ];
+		stats->cached += tc->free_count[ pool ];
+
+		node = node->next;
+	}
+
+	LeaveCriticalSection( &buffer_pool_cs );
+
+	return true;
+}
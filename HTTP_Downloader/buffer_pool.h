@@ -0,0 +1,61 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BUFFER_POOL_H
+#define _BUFFER_POOL_H
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define BUFFER_POOL_MIN_SIZE	16384		// The size of the smallest class. Matches BUFFER_SIZE.
+#define BUFFER_POOL_CLASSES		5			// 16, 32, 64, 128, and 256 kilobytes.
+#define BUFFER_POOL_LIMIT		67108864	// 64 megabytes. Allocations that enforce the limit fail once the buffers larger than the smallest class use this much.
+
+// Typed object pools come after the buffer classes.
+#define POOL_SOCKET_CONTEXT		( BUFFER_POOL_CLASSES )
+#define POOL_WRITE_BUFFER		( BUFFER_POOL_CLASSES + 1 )
+
+#define POOL_COUNT				( BUFFER_POOL_CLASSES + 2 )
+
+struct POOL_STATS
+{
+	unsigned long long	allocations;
+	unsigned long long	frees;
+	unsigned long long	thread_cache_hits;	// Allocations that came from the calling thread's cache.
+	unsigned long long	cache_hits;			// Allocations that came from the shared cache.
+	unsigned long long	system_allocations;	// Allocations that had to go to GlobalAlloc.
+	unsigned long long	system_frees;		// Frees that went to GlobalFree because the caches were full.
+	unsigned int		object_size;
+	unsigned int		cached;				// The number of free objects held by the shared and thread caches.
+};
+
+void BP_Initialize();
+void BP_Uninitialize();
+
+char *BP_Allocate( unsigned int size, bool enforce_limit = false );
+char *BP_Reallocate( char *buffer, unsigned int length, unsigned int size );
+void *BP_AllocateObject( unsigned char pool );
+void BP_Free( void *buffer );
+
+void BP_ReleaseThreadCache();
+void BP_FreeCache();
+
+bool BP_GetStats( unsigned char pool, POOL_STATS *stats );
+
+#endif
@@ -0,0 +1,161 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "byte_scan.h"
+
+// SSE2 only. The delimiters in headers and listings are usually less than 100 bytes apart, so 32 byte compares wouldn't save much.
+#if defined( _M_IX86 ) || defined( _M_X64 )
+	#define BYTE_SCAN_SSE2
+	#include <emmintrin.h>
+	#include <intrin.h>
+#endif
+
+bool g_bs_use_sse2 = false;
+
+void BS_Initialize()
+{
+#if defined( _M_X64 )
+	g_bs_use_sse2 = true;	// Every x64 processor has SSE2.
+#elif defined( _M_IX86 )
+	g_bs_use_sse2 = ( IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE ) != FALSE );
+#endif
+}
+
+#ifdef BYTE_SCAN_SSE2
+
+// Returns the offset of the first match in a 16 byte comparison mask. The mask must not be 0.
+__forceinline unsigned int BS_FirstMatch( int mask )
+{
+	unsigned long index;
+	_BitScanForward( &index, ( unsigned long )mask );
+
+	return index;
+}
+
+#endif
+
+char *BS_FindChar( char *buffer, unsigned int length, char character )
+{
+	char *end = buffer + length;
+
+#ifdef BYTE_SCAN_SSE2
+	if ( g_bs_use_sse2 )
+	{
+		__m128i match = _mm_set1_epi8( character );
+
+		while ( end - buffer >= 16 )
+		{
+			int mask = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( ( __m128i * )buffer ), match ) );
+			if ( mask != 0 )
+			{
+				return buffer + BS_FirstMatch( mask );
+			}
+
+			buffer += 16;
+		}
+	}
+#endif
+
+	// Whatever is left over (or everything if SSE2 isn't available).
+	for ( ; buffer < end; ++buffer )
+	{
+		if ( *buffer == character )
+		{
+			return buffer;
+		}
+	}
+
+	return NULL;
+}
+
+// Returns the first position that matches any of the characters.
+char *BS_FindChars( char *buffer, unsigned int length, char character1, char character2, char character3 )
+{
+	char *end = buffer + length;
+
+#ifdef BYTE_SCAN_SSE2
+	if ( g_bs_use_sse2 )
+	{
+		__m128i match1 = _mm_set1_epi8( character1 );
+		__m128i match2 = _mm_set1_epi8( character2 );
+		__m128i match3 = _mm_set1_epi8( character3 );
+
+		while ( end - buffer >= 16 )
+		{
+			__m128i block = _mm_loadu_si128( ( __m128i * )buffer );
+
+			int mask = _mm_movemask_epi8( _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( block, match1 ),
+																	   _mm_cmpeq_epi8( block, match2 ) ),
+																	   _mm_cmpeq_epi8( block, match3 ) ) );
+			if ( mask != 0 )
+			{
+				return buffer + BS_FirstMatch( mask );
+			}
+
+			buffer += 16;
+		}
+	}
+#endif
+
+	for ( ; buffer < end; ++buffer )
+	{
+		if ( *buffer == character1 || *buffer == character2 || *buffer == character3 )
+		{
+			return buffer;
+		}
+	}
+
+	return NULL;
+}
+
+// Returns the position of the first "\r\n".
+char *BS_FindCRLF( char *buffer, unsigned int length )
+{
+	char *end = buffer + length;
+
+#ifdef BYTE_SCAN_SSE2
+	if ( g_bs_use_sse2 )
+	{
+		__m128i cr = _mm_set1_epi8( '\r' );
+		__m128i lf = _mm_set1_epi8( '\n' );
+
+		// Compare each byte with '\r' and the byte after it with '\n'. The second load needs one more byte.
+		while ( end - buffer >= 17 )
+		{
+			int mask = _mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( _mm_loadu_si128( ( __m128i * )buffer ), cr ),
+														 _mm_cmpeq_epi8( _mm_loadu_si128( ( __m128i * )( buffer + 1 ) ), lf ) ) );
+			if ( mask != 0 )
+			{
+				return buffer + BS_FirstMatch( mask );
+			}
+
+			buffer += 16;
+		}
+	}
+#endif
+
+	for ( ; ( end - buffer ) >= 2; ++buffer )
+	{
+		if ( buffer[ 0 ] == '\r' && buffer[ 1 ] == '\n' )
+		{
+			return buffer;
+		}
+	}
+
+	return NULL;
+}
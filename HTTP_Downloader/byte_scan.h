@@ -0,0 +1,35 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BYTE_SCAN_H
+#define _BYTE_SCAN_H
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// Length bounded searches for the delimiters that the HTTP and FTP parsers look for.
+// None of them depend on the buffer being NULL terminated, and none of them read past buffer + length.
+
+void BS_Initialize();
+
+char *BS_FindChar( char *buffer, unsigned int length, char character );
+char *BS_FindChars( char *buffer, unsigned int length, char character1, char character2, char character3 );
+char *BS_FindCRLF( char *buffer, unsigned int length );
+
+#endif
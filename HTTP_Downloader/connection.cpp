@@ -31,6 +31,7 @@
 #include "utilities.h"
 #include "login_manager_utilities.h"
 #include "list_operations.h"
+#include "file_operations.h"
 
 #include "string_tables.h"
 #include "cmessagebox.h"
@@ -38,6 +39,7 @@
 #include "menus.h"
 
 #include "doublylinkedlist.h"
+#include "download_model.h"
 
 HANDLE g_hIOCP = NULL;
 
@@ -47,6 +49,16 @@ bool g_end_program = false;
 
 DoublyLinkedList *g_context_list = NULL;
 
+dllrbt_tree *g_host_parts = NULL;	// The number of parts that adaptive downloads settled on for each host.
+bool host_parts_changed = false;
+
+DoublyLinkedList *g_connection_pool = NULL;	// Idle keep-alive connections. The longest idle is at the head.
+unsigned int g_connection_pool_count = 0;
+TIMER g_connection_pool_timer;				// Closes the connections that have been idle for too long.
+
+DoublyLinkedList *g_resolve_queue = NULL;	// Hosts that are waiting to be looked up by the resolver thread.
+HANDLE g_resolver_semaphore = NULL;
+
 PCCERT_CONTEXT g_pCertContext = NULL;
 
 SOCKET g_listen_socket = INVALID_SOCKET;
@@ -107,13 +119,20 @@ DoublyLinkedList *download_queue = NULL;
 
 DoublyLinkedList *active_download_list = NULL;		// List of active DOWNLOAD_INFO objects.
 
+dllrbt_tree *g_filename_index = NULL;				// Filenames of the queued and active downloads.
+
 DoublyLinkedList *file_size_prompt_list = NULL;		// List of downloads that need to be prompted to continue.
 DoublyLinkedList *rename_file_prompt_list = NULL;	// List of downloads that need to be prompted to continue.
 DoublyLinkedList *last_modified_prompt_list = NULL;	// List of downloads that need to be prompted to continue.
 
 DoublyLinkedList *move_file_queue = NULL;			// List of downloads that need to be moved to a new folder.
 
-HANDLE g_timeout_semaphore = NULL;
+HANDLE g_scheduler_semaphore = NULL;
+
+TIMER_WHEEL g_scheduler_wheel;				// Connection timeouts, FTP keep-alives, and receives that are deferred because of the speed limit.
+unsigned long long g_scheduler_wake_time = 0;	// The time (in milliseconds) that the scheduler will next wake up.
+
+TOKEN_BUCKET g_bandwidth_bucket;			// The global speed limit.
 
 CRITICAL_SECTION context_list_cs;				// Guard access to the global context list.
 CRITICAL_SECTION active_download_list_cs;		// Guard access to the global active download list.
@@ -123,6 +142,14 @@ CRITICAL_SECTION rename_file_prompt_list_cs;	// Guard access to the rename file
 CRITICAL_SECTION last_modified_prompt_list_cs;	// Guard access to the last modified prompt list.
 CRITICAL_SECTION move_file_queue_cs;			// Guard access to the move file queue.
 CRITICAL_SECTION cleanup_cs;
+CRITICAL_SECTION bandwidth_cs;					// Guard access to the token buckets.
+CRITICAL_SECTION timer_wheel_cs;				// Guard access to the scheduler's timer wheel.
+CRITICAL_SECTION host_parts_cs;					// Guard access to the host parts tree.
+CRITICAL_SECTION connection_pool_cs;			// Guard access to the connection pool.
+CRITICAL_SECTION resolve_queue_cs;				// Guard access to the resolve queue.
+CRITICAL_SECTION decoder_stats_cs;				// Guard access to the decoder statistics.
+CRITICAL_SECTION filename_index_cs;				// Guard access to the filename index.
+CRITICAL_SECTION range_list_cs;					// Guard access to the range lists. Held with (never instead of) the download info's shared_cs when changing one.
 
 LPFN_ACCEPTEX _AcceptEx = NULL;
 LPFN_CONNECTEX _ConnectEx = NULL;
@@ -170,11 +197,6 @@ void EnableTimers( bool timer_state )
 		{
 			g_timers_running = true;
 
-			if ( g_timeout_semaphore != NULL )
-			{
-				ReleaseSemaphore( g_timeout_semaphore, 1, NULL );
-			}
-
 			if ( g_timer_semaphore != NULL )
 			{
 				ReleaseSemaphore( g_timer_semaphore, 1, NULL );
@@ -189,100 +211,333 @@ void EnableTimers( bool timer_state )
 	}
 }
 
-DWORD WINAPI Timeout( LPVOID WorkThreadContext )
+// Returns the number of milliseconds until the context's timeout timer should fire again, or INFINITE if it shouldn't.
+// This should be done in the timer wheel's critical section.
+unsigned long CheckTimeout( SOCKET_CONTEXT *context )
+{
+	unsigned long delay = TIMEOUT_POLL_DELAY;
+
+	// Try again shortly rather than block the scheduler. No time is lost since the timeout is measured from the last completed operation.
+	if ( TryEnterCriticalSection( &context->context_cs ) == FALSE )
+	{
+		return TIMEOUT_RETRY_DELAY;
+	}
+
+	// Only contexts that are in the global context list can time out.
+	bool in_context_list = ( context->context_node.prev != NULL || g_context_list == &context->context_node );
+
+	if ( in_context_list && context->cleanup == 0 && context->status != STATUS_ALLOCATING_FILE )
+	{
+		DWORD current_time = GetTickCount();
+
+		// Don't time out the Control connection.
+		// It'll be forced to time out if the Data connection times out.
+		if ( context->ftp_context != NULL && context->ftp_connection_type & FTP_CONNECTION_TYPE_CONTROL )
+		{
+			if ( cfg_ftp_send_keep_alive && context->ftp_connection_type == FTP_CONNECTION_TYPE_CONTROL )
+			{
+				DWORD elapsed = current_time - ( DWORD )context->keep_alive_time;
+
+				if ( elapsed >= FTP_KEEP_ALIVE_INTERVAL )
+				{
+					InterlockedExchange( &context->keep_alive_time, ( LONG )current_time );
+
+					SendFTPKeepAlive( context );
+
+					delay = FTP_KEEP_ALIVE_INTERVAL;
+				}
+				else
+				{
+					delay = FTP_KEEP_ALIVE_INTERVAL - elapsed;
+				}
+			}
+			else	// Only count the time that the Control connection is idle.
+			{
+				InterlockedExchange( &context->keep_alive_time, ( LONG )current_time );
+			}
+		}
+		else if ( cfg_timeout > 0 )
+		{
+			DWORD elapsed = current_time - ( DWORD )context->last_activity;
+			DWORD timeout = ( DWORD )cfg_timeout * 1000;
+
+			if ( elapsed < timeout )
+			{
+				delay = timeout - elapsed;
+			}
+			else if ( IS_STATUS( context->status, STATUS_PAUSED | STATUS_QUEUED ) )	// Ignore paused and queued downloads.
+			{
+				InterlockedExchange( &context->last_activity, ( LONG )current_time );
+
+				delay = timeout;
+			}
+			else
+			{
+				context->timed_out = TIME_OUT_TRUE;
+
+				context->cleanup = 2;	// Force the cleanup.
+
+				InterlockedIncrement( &context->pending_operations );
+
+				context->overlapped_close.current_operation = ( context->ssl != NULL ? IO_Shutdown : IO_Close );
+
+				PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context, ( OVERLAPPED * )&context->overlapped_close );
+
+				// Keep polling in case the context is retried.
+			}
+		}
+		else	// Timeouts are disabled. UpdateTimeoutTimers will restart the timer if they're enabled.
+		{
+			delay = INFINITE;
+		}
+	}
+
+	LeaveCriticalSection( &context->context_cs );
+
+	return delay;
+}
+
+DWORD WINAPI Scheduler( LPVOID WorkThreadContext )
 {
-	bool run_timer = g_timers_running;
+	unsigned long delay = INFINITE;
 
 	while ( !g_end_program )
 	{
-		// Check the timeout counter every second, or wait indefinitely if we're using the system default.
-		WaitForSingleObject( g_timeout_semaphore, ( run_timer ? ( cfg_timeout > 0 ? 1000 : INFINITE ) : INFINITE ) );
+		// Sleep until the next timer is due, or until an earlier timer has been added.
+		WaitForSingleObject( g_scheduler_semaphore, delay );
 
 		if ( g_end_program )
 		{
 			break;
 		}
 
-		// This will allow the timer to go through at least one loop after it's been disabled (g_timers_running == false).
-		run_timer = g_timers_running;
+		EnterCriticalSection( &timer_wheel_cs );
+
+		DoublyLinkedList *timer_node = TW_Advance( &g_scheduler_wheel );
 
-		if ( TryEnterCriticalSection( &context_list_cs ) == TRUE )
+		while ( timer_node != NULL )
 		{
-			DoublyLinkedList *context_node = g_context_list;
+			SOCKET_CONTEXT *context = ( SOCKET_CONTEXT * )timer_node->data;
 
-			// Go through the list of active connections.
-			while ( context_node != NULL && context_node->data != NULL )
+			TIMER *timer = ( TIMER * )timer_node;
+
+			timer_node = timer_node->next;
+
+			if ( timer == &g_connection_pool_timer )	// Has no context.
 			{
-				if ( g_end_program )
+				unsigned long prune_delay = PruneConnectionPool();
+				if ( prune_delay != INFINITE )
 				{
-					break;
+					TW_AddTimer( &g_scheduler_wheel, timer, NULL, prune_delay );
 				}
+			}
+			else if ( timer == &context->race_timer )
+			{
+				// Start the second connection attempt. The timer is already counted as a pending operation.
+				context->overlapped_race.current_operation = IO_StartConnectRace;
 
-				SOCKET_CONTEXT *context = ( SOCKET_CONTEXT * )context_node->data;
-
-				if ( TryEnterCriticalSection( &context->context_cs ) == TRUE )
+				PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context, ( OVERLAPPED * )&context->overlapped_race );
+			}
+			else if ( timer == &context->bandwidth_timer )
+			{
+				// The worker threads will handle the deferred receive as if it had just completed.
+				PostQueuedCompletionStatus( g_hIOCP, context->current_bytes_read, ( ULONG_PTR )context, ( OVERLAPPED * )&context->overlapped );
+			}
+			else	// Timeout timer.
+			{
+				unsigned long timeout_delay = CheckTimeout( context );
+				if ( timeout_delay != INFINITE )
 				{
-					if ( context->cleanup == 0 && context->status != STATUS_ALLOCATING_FILE )
-					{
-						// Don't increment the Control connection's timeout value.
-						// It'll be forced to time out if the Data connection times out.
-						if ( context->ftp_context != NULL && context->ftp_connection_type & FTP_CONNECTION_TYPE_CONTROL )
-						{
-							if ( cfg_ftp_send_keep_alive && context->ftp_connection_type == FTP_CONNECTION_TYPE_CONTROL )
-							{
-								InterlockedIncrement( &context->keep_alive_timeout );	// Increment the timeout counter.
+					TW_AddTimer( &g_scheduler_wheel, timer, ( void * )context, timeout_delay );
+				}
+			}
+		}
 
-								if ( context->keep_alive_timeout >= 30 )
-								{
-									InterlockedExchange( &context->keep_alive_timeout, 0 );	// Reset timeout counter.
+		delay = TW_GetNextDelay( &g_scheduler_wheel );
 
-									SendFTPKeepAlive( context );
-								}
-							}
-						}
-						else
-						{
-							InterlockedIncrement( &context->timeout );	// Increment the timeout counter.
+		g_scheduler_wake_time = ( delay != INFINITE ? TW_GetTickCount() + delay : 0xFFFFFFFFFFFFFFFF );
 
-							// See if we've reached the timeout limit.
-							if ( ( context->timeout >= cfg_timeout ) && ( cfg_timeout > 0 ) )
-							{
-								// Ignore paused and queued downloads.
-								if ( IS_STATUS( context->status, STATUS_PAUSED | STATUS_QUEUED ) )
-								{
-									InterlockedExchange( &context->timeout, 0 );	// Reset timeout counter.
-								}
-								else
-								{
-									context->timed_out = TIME_OUT_TRUE;
+		LeaveCriticalSection( &timer_wheel_cs );
+	}
 
-									context->cleanup = 2;	// Force the cleanup.
+	CloseHandle( g_scheduler_semaphore );
+	g_scheduler_semaphore = NULL;
 
-									InterlockedIncrement( &context->pending_operations );
+	_ExitThread( 0 );
+	return 0;
+}
 
-									context->overlapped_close.current_operation = ( context->ssl != NULL ? IO_Shutdown : IO_Close );
+// Adds (or moves) a timer in the scheduler's timer wheel and wakes the scheduler if the timer is due before its next wake up.
+void AddSchedulerTimer( TIMER *timer, SOCKET_CONTEXT *context, unsigned long delay )
+{
+	bool wake_scheduler;
 
-									PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context, ( OVERLAPPED * )&context->overlapped_close );
-								}
-							}
-						}
-					}
+	EnterCriticalSection( &timer_wheel_cs );
 
-					LeaveCriticalSection( &context->context_cs );
-				}
+	TW_AddTimer( &g_scheduler_wheel, timer, ( void * )context, delay );
+
+	wake_scheduler = ( TW_GetTickCount() + delay < g_scheduler_wake_time );
+
+	LeaveCriticalSection( &timer_wheel_cs );
+
+	if ( wake_scheduler && g_scheduler_semaphore != NULL )
+	{
+		ReleaseSemaphore( g_scheduler_semaphore, 1, NULL );
+	}
+}
+
+void SetTimeoutTimer( SOCKET_CONTEXT *context, unsigned long delay )
+{
+	AddSchedulerTimer( &context->timeout_timer, context, delay );
+}
+
+// This must be done before the context is freed.
+void RemoveTimers( SOCKET_CONTEXT *context )
+{
+	EnterCriticalSection( &timer_wheel_cs );
+
+	TW_RemoveTimer( &g_scheduler_wheel, &context->timeout_timer );
+	TW_RemoveTimer( &g_scheduler_wheel, &context->bandwidth_timer );
+	TW_RemoveTimer( &g_scheduler_wheel, &context->race_timer );
+
+	LeaveCriticalSection( &timer_wheel_cs );
+}
+
+// Have every context check its timeout against the current setting.
+void UpdateTimeoutTimers()
+{
+	EnterCriticalSection( &context_list_cs );
+
+	DoublyLinkedList *context_node = g_context_list;
+
+	while ( context_node != NULL )
+	{
+		SOCKET_CONTEXT *context = ( SOCKET_CONTEXT * )context_node->data;
+
+		if ( context != NULL )
+		{
+			SetTimeoutTimer( context, 0 );
+		}
+
+		context_node = context_node->next;
+	}
+
+	LeaveCriticalSection( &context_list_cs );
+}
+
+// Adds tokens for the time that's elapsed and then removes the tokens for bytes.
+// Returns the number of milliseconds until the bucket is no longer in debt.
+unsigned long ChargeTokenBucket( TOKEN_BUCKET *tb, unsigned long long rate, unsigned long long current_time, DWORD bytes )
+{
+	if ( rate == 0 )	// Unlimited.
+	{
+		tb->last_refill = current_time;
+		tb->tokens = 0;
 
-				context_node = context_node->next;
+		return 0;
+	}
+
+	unsigned long long elapsed = current_time - tb->last_refill;
+
+	// A full bucket holds less than this and it keeps the multiplication below from overflowing.
+	if ( elapsed > 1000 )
+	{
+		elapsed = 1000;
+	}
+
+	tb->last_refill = current_time;
+
+	// The rate is in bytes per second, which is also thousandths of a byte per millisecond.
+	long long burst = ( long long )( rate * BANDWIDTH_BURST );
+
+	tb->tokens += ( long long )( rate * elapsed );
+
+	if ( tb->tokens > burst )
+	{
+		tb->tokens = burst;
+	}
+
+	tb->tokens -= ( long long )bytes * 1000;
+
+	if ( tb->tokens >= 0 )
+	{
+		return 0;
+	}
+
+	return ( unsigned long )( ( ( unsigned long long )( -tb->tokens ) + ( rate - 1 ) ) / rate );
+}
+
+// Charges the received data against the global, download, and part token buckets (in that order).
+// Returns the number of milliseconds to wait before the data can be processed, or 0 if it can be processed now.
+// This should be done in the context's critical section.
+unsigned long GetBandwidthDelay( SOCKET_CONTEXT *context, DWORD io_size )
+{
+	DOWNLOAD_INFO *di = context->download_info;
+
+	unsigned long long download_speed_limit = ( di != NULL ? di->download_speed_limit : 0 );
+
+	if ( cfg_download_speed_limit == 0 && download_speed_limit == 0 )
+	{
+		context->bandwidth_release = 0;
+
+		return 0;
+	}
+
+	unsigned long long current_time = TW_GetTickCount();
+
+	// Only charge the data once. A deferred receive that comes back through here just waits out its release time.
+	if ( context->bandwidth_release == 0 )
+	{
+		unsigned long delay, bucket_delay;
+
+		EnterCriticalSection( &bandwidth_cs );
+
+		delay = ChargeTokenBucket( &g_bandwidth_bucket, cfg_download_speed_limit, current_time, io_size );
+
+		if ( di != NULL )
+		{
+			bucket_delay = ChargeTokenBucket( &di->bandwidth_bucket, download_speed_limit, current_time, io_size );
+			if ( bucket_delay > delay )
+			{
+				delay = bucket_delay;
 			}
 
-			LeaveCriticalSection( &context_list_cs );
+			// Each part gets an equal share of the download's limit so that a fast part can't starve the others.
+			bucket_delay = ChargeTokenBucket( &context->bandwidth_bucket, download_speed_limit / ( di->active_parts > 1 ? di->active_parts : 1 ), current_time, io_size );
+			if ( bucket_delay > delay )
+			{
+				delay = bucket_delay;
+			}
+		}
+
+		LeaveCriticalSection( &bandwidth_cs );
+
+		if ( delay == 0 )
+		{
+			return 0;
 		}
+
+		context->bandwidth_release = current_time + delay;
 	}
 
-	CloseHandle( g_timeout_semaphore );
-	g_timeout_semaphore = NULL;
+	if ( current_time >= context->bandwidth_release )
+	{
+		context->bandwidth_release = 0;
 
-	_ExitThread( 0 );
-	return 0;
+		return 0;
+	}
+
+	unsigned long long delay = context->bandwidth_release - current_time;
+
+	// Long waits are broken up so that the timeout counter gets reset.
+	return ( unsigned long )( delay > BANDWIDTH_MAX_DELAY ? BANDWIDTH_MAX_DELAY : delay );
+}
+
+// Posts the context's last receive completion again after delay milliseconds.
+// The context's pending operations must have already been incremented.
+void DeferCompletion( SOCKET_CONTEXT *context, unsigned long delay )
+{
+	AddSchedulerTimer( &context->bandwidth_timer, context, delay );
 }
 
 void InitializeServerInfo()
@@ -484,6 +739,19 @@ DWORD WINAPI IOCPDownloader( LPVOID pArgs )
 
 	_WSAResetEvent( g_cleanup_event[ 0 ] );
 
+	g_scheduler_semaphore = CreateSemaphore( NULL, 0, 1, NULL );
+
+	g_resolver_semaphore = CreateSemaphore( NULL, 0, 0x7FFFFFFF, NULL );	// Released once for each queued request.
+
+	EnterCriticalSection( &dns_cache_cs );
+	g_dns_cache = dllrbt_create( dllrbt_compare_w );
+	LeaveCriticalSection( &dns_cache_cs );
+
+	EnterCriticalSection( &timer_wheel_cs );
+	TW_Initialize( &g_scheduler_wheel );
+	g_scheduler_wake_time = 0xFFFFFFFFFFFFFFFF;
+	LeaveCriticalSection( &timer_wheel_cs );
+
 	// Spawn our IOCP worker threads.
 	for ( DWORD dwCPU = 0; dwCPU < dwThreadCount; ++dwCPU )
 	{
@@ -511,12 +779,9 @@ DWORD WINAPI IOCPDownloader( LPVOID pArgs )
 		ReleaseSemaphore( downloader_ready_semaphore, 1, NULL );
 	}
 
-	g_timeout_semaphore = CreateSemaphore( NULL, 0, 1, NULL );
+	CloseHandle( _CreateThread( NULL, 0, Scheduler, NULL, 0, NULL ) );
 
-	//CloseHandle( _CreateThread( NULL, 0, Timeout, NULL, 0, NULL ) );
-	HANDLE timeout_handle = _CreateThread( NULL, 0, Timeout, NULL, 0, NULL );
-	SetThreadPriority( timeout_handle, THREAD_PRIORITY_LOWEST );
-	CloseHandle( timeout_handle );
+	CloseHandle( _CreateThread( NULL, 0, Resolver, NULL, 0, NULL ) );
 
 	_WSAWaitForMultipleEvents( 1, g_cleanup_event, TRUE, WSA_INFINITE, FALSE );
 
@@ -544,9 +809,14 @@ DWORD WINAPI IOCPDownloader( LPVOID pArgs )
 		}
 	}
 
-	if ( g_timeout_semaphore != NULL )
+	if ( g_scheduler_semaphore != NULL )
+	{
+		ReleaseSemaphore( g_scheduler_semaphore, 1, NULL );
+	}
+
+	if ( g_resolver_semaphore != NULL )
 	{
-		ReleaseSemaphore( g_timeout_semaphore, 1, NULL );
+		ReleaseSemaphore( g_resolver_semaphore, 1, NULL );
 	}
 
 	if ( g_listen_socket != INVALID_SOCKET )
@@ -562,6 +832,13 @@ DWORD WINAPI IOCPDownloader( LPVOID pArgs )
 	// Clean up our context list.
 	FreeContexts();
 
+	// Close any idle keep-alive connections.
+	FreeConnectionPool();
+
+	FreeDNSCache();
+
+	BP_FreeCache();
+
 	download_queue = NULL;
 	total_downloading = 0;
 
@@ -647,11 +924,13 @@ SOCKET_CONTEXT *UpdateCompletionPort( SOCKET socket, bool use_ssl, unsigned char
 			SSL *ssl = SSL_new( protocol, is_server );
 			if ( ssl == NULL )
 			{
+				RemoveTimers( context );
+
 				DeleteCriticalSection( &context->context_cs );
 
-				if ( context->buffer != NULL ) { GlobalFree( context->buffer ); }
+				BP_Free( context->buffer );
 
-				GlobalFree( context );
+				BP_Free( context );
 				context = NULL;
 
 				return NULL;
@@ -684,11 +963,13 @@ SOCKET_CONTEXT *UpdateCompletionPort( SOCKET socket, bool use_ssl, unsigned char
 		{
 			if ( context->ssl != NULL ) { SSL_free( context->ssl ); }
 
+			RemoveTimers( context );
+
 			DeleteCriticalSection( &context->context_cs );
 
-			if ( context->buffer != NULL ) { GlobalFree( context->buffer ); }
+			BP_Free( context->buffer );
 
-			GlobalFree( context );
+			BP_Free( context );
 			context = NULL;
 		}
 	}
@@ -953,6 +1234,7 @@ SECURITY_STATUS DecryptRecv( SOCKET_CONTEXT *context, DWORD &io_size )
 			//case SEC_I_CONTEXT_EXPIRED:
 			default:
 			{
+				context->ssl->ibIoBuffer = 0;
 				context->ssl->cbIoBuffer = 0;
 
 				return scRet;
@@ -961,6 +1243,7 @@ SECURITY_STATUS DecryptRecv( SOCKET_CONTEXT *context, DWORD &io_size )
 		}
 	}
 
+	context->ssl->ibIoBuffer = 0;
 	context->ssl->cbIoBuffer = 0;
 
 	return scRet;
@@ -1029,20 +1312,14 @@ THREAD_RETURN RenameFilePrompt( void *pArguments )
 			// Rename the file and try again.
 			if ( rename_only == 1 || g_rename_file_cmb_ret == CMBIDRENAME || g_rename_file_cmb_ret == CMBIDRENAMEALL )
 			{
-				// Creates a tree of active and queued downloads.
-				dllrbt_tree *add_files_tree = CreateFilenameTree();
-
 				bool rename_succeeded;
 
 				EnterCriticalSection( &di->shared_cs );
 
-				rename_succeeded = RenameFile( di, add_files_tree, file_path, filename_offset, file_extension_offset );
+				rename_succeeded = RenameFile( di, file_path, filename_offset, file_extension_offset );
 
 				LeaveCriticalSection( &di->shared_cs );
 
-				// The tree is only used to determine duplicate filenames.
-				DestroyFilenameTree( add_files_tree );
-
 				if ( !rename_succeeded )
 				{
 					if ( g_rename_file_cmb_ret2 != CMBIDOKALL && !( di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS ) )
@@ -1402,7 +1679,7 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 			continue;
 		}
 
-		InterlockedExchange( &context->timeout, 0 );	// Reset timeout counter.
+		InterlockedExchange( &context->last_activity, ( LONG )GetTickCount() );	// Push back the timeout.
 
 		EnterCriticalSection( &context->context_cs );
 
@@ -1410,9 +1687,35 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 
 		LeaveCriticalSection( &context->context_cs );
 
+		// Only one of a connect race's attempts continues as the context's connection.
+		if ( *current_operation == IO_Connect || *current_operation == IO_ConnectRace )
+		{
+			EnterCriticalSection( &context->context_cs );
+
+			char race_status = UpdateConnectRace( context, ( *current_operation == IO_ConnectRace ), ( completion_status != FALSE ) );
+
+			LeaveCriticalSection( &context->context_cs );
+
+			if ( race_status == CONNECT_RACE_SKIP )
+			{
+				continue;
+			}
+			else if ( race_status != CONNECT_RACE_CONTINUE )
+			{
+				// The context's connection continues on its main overlapped structure.
+				overlapped = &context->overlapped;
+				current_operation = &overlapped->current_operation;
+				next_operation = &overlapped->next_operation;
+
+				*current_operation = IO_Connect;
+
+				completion_status = ( race_status == CONNECT_RACE_CONNECTED ? TRUE : FALSE );
+			}
+		}
+
 		use_ssl = ( context->ssl != NULL ? true : false );
 
-		if ( completion_status == FALSE )
+		if ( completion_status == FALSE && *current_operation != IO_ConnectRace )
 		{
 			EnterCriticalSection( &context->context_cs );
 
@@ -1482,6 +1785,7 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 				else
 				{
 					bool skip_process = false;
+					unsigned long delay;
 
 					EnterCriticalSection( &context->context_cs );
 
@@ -1507,21 +1811,19 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 
 						context->is_paused = true;	// Tells us how to stop the download if it's pausing/paused.
 
+						// Make sure what's been copied into the file's mapping is on the disk and accounted for while we're paused.
+						UnmapFileView( context );
+
 						skip_process = true;
 					}
-					else if ( ( cfg_download_speed_limit > 0 &&
-							  ( g_session_total_downloaded - g_session_last_total_downloaded ) > cfg_download_speed_limit ) ||
-							  ( context->download_info != NULL &&
-								context->download_info->download_speed_limit > 0 &&
-							  ( context->download_info->downloaded - context->download_info->last_downloaded ) > context->download_info->download_speed_limit ) ) // Preempt the next receive.
+					else if ( ( delay = GetBandwidthDelay( context, io_size ) ) > 0 ) // Preempt the next receive.
 					{
-						Sleep( 1 );	// Prevents high CPU usage for some reason.
-
 						context->current_bytes_read = io_size;
 
 						InterlockedIncrement( &context->pending_operations );
 
-						PostQueuedCompletionStatus( hIOCP, context->current_bytes_read, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+						// The scheduler will post the completion again once we're within the speed limit.
+						DeferCompletion( context, delay );
 
 						skip_process = true;
 					}
@@ -1744,11 +2046,13 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 				{
 					// Allow the connect socket to inherit the properties of the previously set properties.
 					// Must be done so that shutdown() will work.
-					nRet = _setsockopt( context->socket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0 );
+					// A connection from the pool has already done this (and has already established its SSL/TLS session).
+					nRet = ( context->reused_connection ? 0 : _setsockopt( context->socket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0 ) );
 					if ( nRet != SOCKET_ERROR )
 					{
-						if ( context->request_info.protocol == PROTOCOL_HTTPS ||
-							 context->request_info.protocol == PROTOCOL_FTPS )	// FTPES starts out unencrypted and is upgraded later.
+						if ( !context->reused_connection &&
+						   ( context->request_info.protocol == PROTOCOL_HTTPS ||
+							 context->request_info.protocol == PROTOCOL_FTPS ) )	// FTPES starts out unencrypted and is upgraded later.
 						{
 							char shared_protocol = ( context->download_info != NULL ? context->download_info->ssl_version : 0 );
 							DWORD protocol = 0;
@@ -1803,8 +2107,26 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 						{
 							InterlockedIncrement( &context->pending_operations );
 
+							// The pooled connection's SSL/TLS session is still established. Send the request.
+							if ( context->reused_connection && context->ssl != NULL )
+							{
+								context->wsabuf.buf = context->buffer;
+								context->wsabuf.len = context->buffer_size;
+
+								*next_operation = IO_GetContent;
+
+								ConstructRequest( context, false );
+
+								SSL_WSASend( context, overlapped, &context->wsabuf, sent );
+								if ( !sent )
+								{
+									InterlockedDecrement( &context->pending_operations );
+
+									connection_failed = true;
+								}
+							}
 							// If it's an HTTPS or FTPS (not FTPES) request and we're not going through a SSL/TLS proxy, then begin the SSL/TLS handshake.
-							if ( ( context->request_info.protocol == PROTOCOL_HTTPS ||
+							else if ( ( context->request_info.protocol == PROTOCOL_HTTPS ||
 								   context->request_info.protocol == PROTOCOL_FTPS ) &&
 								   !cfg_enable_proxy_s && !cfg_enable_proxy_socks )
 							{
@@ -1920,38 +2242,111 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 			}
 			break;
 
-			case IO_ClientHandshakeResponse:
-			case IO_ClientHandshakeReply:
+			case IO_StartConnectRace:	// The first connection attempt hasn't completed in time.
+			case IO_ConnectRace:		// The second connection attempt was cancelled, or there were no more addresses to try.
 			{
 				EnterCriticalSection( &context->context_cs );
 
-				if ( context->cleanup == 0 )
+				if ( *current_operation == IO_StartConnectRace && context->connect_race == CONNECT_RACE_WAITING )
 				{
-					context->wsabuf.buf = context->buffer;
-					context->wsabuf.len = context->buffer_size;
-
-					InterlockedIncrement( &context->pending_operations );
-
-					if ( *current_operation == IO_ClientHandshakeReply )
+					if ( context->cleanup != 0 || !StartRaceAttempt( context ) )
 					{
-						context->ssl->cbIoBuffer += io_size;
-
-						if ( context->ssl->cbIoBuffer > 0 )
-						{
-							*current_operation = IO_ClientHandshakeResponse;
-							*next_operation = IO_ClientHandshakeResponse;
+						context->connect_race = CONNECT_RACE_NONE;
+					}
+				}
 
-							scRet = SSL_WSAConnect_Reply( context, overlapped, sent );
-						}
-						else
-						{
-							sent = false;
-							scRet = SEC_E_INTERNAL_ERROR;
-						}
+				// The first attempt continues on its own. We only need to allow any pending cleanup to continue.
+				if ( context->connect_race != CONNECT_RACE_RUNNING )
+				{
+					if ( context->cleanup == 2 )	// If we've forced the cleanup, then allow it to continue its steps.
+					{
+						context->cleanup = 1;	// Auto cleanup.
 					}
-					else
+					else if ( context->cleanup == 1 )	// We've already shutdown and/or closed the connection.
 					{
-						*current_operation = IO_ClientHandshakeReply;
+						InterlockedIncrement( &context->pending_operations );
+
+						*current_operation = IO_Close;
+
+						PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+					}
+				}
+
+				LeaveCriticalSection( &context->context_cs );
+			}
+			break;
+
+			case IO_ResolveAddress:	// The resolver thread has looked up the host.
+			{
+				bool connection_failed = false;
+
+				EnterCriticalSection( &context->context_cs );
+
+				if ( context->cleanup == 0 )
+				{
+					// The address_info will be NULL if the host couldn't be resolved.
+					if ( context->address_info == NULL ||
+						!CreateConnection( context, context->request_info.host, context->request_info.port ) )
+					{
+						context->status = STATUS_FAILED;
+
+						connection_failed = true;
+					}
+				}
+				else if ( context->cleanup == 2 )	// If we've forced the cleanup, then allow it to continue its steps.
+				{
+					context->cleanup = 1;	// Auto cleanup.
+				}
+				else	// We've already shutdown and/or closed the connection.
+				{
+					connection_failed = true;
+				}
+
+				if ( connection_failed )
+				{
+					InterlockedIncrement( &context->pending_operations );
+
+					*current_operation = IO_Close;
+
+					PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+				}
+
+				LeaveCriticalSection( &context->context_cs );
+			}
+			break;
+
+			case IO_ClientHandshakeResponse:
+			case IO_ClientHandshakeReply:
+			{
+				EnterCriticalSection( &context->context_cs );
+
+				if ( context->cleanup == 0 )
+				{
+					context->wsabuf.buf = context->buffer;
+					context->wsabuf.len = context->buffer_size;
+
+					InterlockedIncrement( &context->pending_operations );
+
+					if ( *current_operation == IO_ClientHandshakeReply )
+					{
+						context->ssl->cbIoBuffer += io_size;
+
+						if ( context->ssl->cbIoBuffer > 0 )
+						{
+							*current_operation = IO_ClientHandshakeResponse;
+							*next_operation = IO_ClientHandshakeResponse;
+
+							scRet = SSL_WSAConnect_Reply( context, overlapped, sent );
+						}
+						else
+						{
+							sent = false;
+							scRet = SEC_E_INTERNAL_ERROR;
+						}
+					}
+					else
+					{
+						*current_operation = IO_ClientHandshakeReply;
 
 						scRet = SSL_WSAConnect_Response( context, overlapped, sent );
 					}
@@ -2222,7 +2617,7 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 							context->header_info.content_encoding = CONTENT_ENCODING_NONE;
 							context->header_info.chunked_transfer = false;
 							//context->header_info.etag = false;
-							context->header_info.got_chunk_start = false;
+							context->header_info.chunk_state = CHUNK_STATE_SIZE_START;
 							context->header_info.got_chunk_terminator = false;
 
 							context->header_info.range_info->content_length = 0;	// We must reset this to get the real request length (not the length of the 2XX request).
@@ -2686,6 +3081,15 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 						}
 						else
 						{
+							// Plain text content reads can use a larger buffer. SSL records are never more than BUFFER_SIZE.
+							if ( content_status == CONTENT_STATUS_READ_MORE_CONTENT &&
+								 context->download_info != NULL &&
+								 context->wsabuf.buf == context->buffer &&
+								 context->wsabuf.len == context->buffer_size )
+							{
+								AdjustReceiveBuffer( context );
+							}
+
 							nRet = _WSARecv( context->socket, &context->wsabuf, 1, NULL, &dwFlags, ( WSAOVERLAPPED * )overlapped, NULL );
 							if ( nRet == SOCKET_ERROR && ( _WSAGetLastError() != ERROR_IO_PENDING ) )
 							{
@@ -2720,9 +3124,15 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 				if ( context->cleanup == 0 )
 				{
 					EnterCriticalSection( &context->download_info->shared_cs );
-					context->download_info->downloaded += io_size;				// The total amount of data (decoded) that was saved/simulated.
+					AddDownloadProgress( context->download_info, io_size );	// The total amount of data (decoded) that was saved/simulated.
+					bool add_part = UpdateAdaptiveParts( context );
 					LeaveCriticalSection( &context->download_info->shared_cs );
 
+					if ( add_part )
+					{
+						AddAdaptivePart( context );
+					}
+
 					EnterCriticalSection( &session_totals_cs );
 					g_session_total_downloaded += io_size;
 					LeaveCriticalSection( &session_totals_cs );
@@ -2739,6 +3149,17 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 						context->write_wsabuf.buf += io_size;
 						context->write_wsabuf.len -= io_size;
 
+						// Continue writing where the last write left off.
+						LARGE_INTEGER li;
+						li.LowPart = overlapped->overlapped.Offset;
+						li.HighPart = overlapped->overlapped.OffsetHigh;
+						li.QuadPart += io_size;
+
+						overlapped->overlapped.Internal = NULL;
+						overlapped->overlapped.InternalHigh = NULL;
+						overlapped->overlapped.Offset = li.LowPart;
+						overlapped->overlapped.OffsetHigh = li.HighPart;
+
 						BOOL bRet = WriteFile( context->download_info->hFile, context->write_wsabuf.buf, context->write_wsabuf.len, NULL, ( WSAOVERLAPPED * )overlapped );
 						if ( bRet == FALSE && ( GetLastError() != ERROR_IO_PENDING ) )
 						{
@@ -2764,37 +3185,49 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 						context->header_info.range_info->content_offset += context->content_offset;	// The true amount that was downloaded. Allows us to resume if we stop the download.
 						context->content_offset = 0;
 
-						if ( context->header_info.chunked_transfer )
+						// The decompression window filled up before everything we received was decoded. Decode the rest now that the window has been written.
+						if ( content_status == CONTENT_STATUS_DECODE_CONTENT )
+						{
+							content_status = ResumeDecompression( context );
+						}
+
+						// If another write was started, then we'll continue when it completes.
+						if ( content_status != CONTENT_STATUS_NONE )
 						{
-							if ( ( context->parts == 1 && context->header_info.connection == CONNECTION_KEEP_ALIVE && context->header_info.got_chunk_terminator ) ||
-								 ( context->parts > 1 && ( context->header_info.range_info->content_offset >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
+							if ( context->header_info.chunked_transfer )
 							{
-								InterlockedIncrement( &context->pending_operations );
+								if ( ( context->parts == 1 && context->header_info.connection == CONNECTION_KEEP_ALIVE && context->header_info.got_chunk_terminator ) ||
+									 ( context->parts > 1 && ( GetBufferedContentOffset( context ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
+								{
+									InterlockedIncrement( &context->pending_operations );
 
-								*current_operation = ( use_ssl ? IO_Shutdown : IO_Close );
+									*current_operation = ( use_ssl ? IO_Shutdown : IO_Close );
 
-								PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+									PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
 
-								content_status = CONTENT_STATUS_NONE;
+									content_status = CONTENT_STATUS_NONE;
+								}
 							}
-						}
-						else
-						{
-							// We need to force the keep-alive connections closed since the server will just keep it open after we've gotten all the data.
-							if ( ( ( ( context->request_info.protocol == PROTOCOL_FTP ||
-									   context->request_info.protocol == PROTOCOL_FTPS ||
-									   context->request_info.protocol == PROTOCOL_FTPES ) && context->parts > 1 ) ||
-								   context->header_info.connection == CONNECTION_KEEP_ALIVE ) &&
-								 ( context->header_info.range_info->content_length == 0 ||
-								 ( context->header_info.range_info->content_offset >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
+							else
 							{
-								InterlockedIncrement( &context->pending_operations );
+								// We need to force the keep-alive connections closed since the server will just keep it open after we've gotten all the data.
+								// Range requests are also closed since their range might have been shortened by StealRange.
+								if ( ( ( ( context->request_info.protocol == PROTOCOL_FTP ||
+										   context->request_info.protocol == PROTOCOL_FTPS ||
+										   context->request_info.protocol == PROTOCOL_FTPES ) && context->parts > 1 ) ||
+									   ( context->parts > 1 && context->processed_header ) ||
+									   context->header_info.connection == CONNECTION_KEEP_ALIVE ) &&
+									 ( context->header_info.range_info->content_length == 0 ||
+									 ( GetBufferedContentOffset( context ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
+								{
+									InterlockedIncrement( &context->pending_operations );
 
-								*current_operation = ( use_ssl ? IO_Shutdown : IO_Close );
+									*current_operation = ( use_ssl ? IO_Shutdown : IO_Close );
 
-								PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+									PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
 
-								content_status = CONTENT_STATUS_NONE;
+									content_status = CONTENT_STATUS_NONE;
+								}
 							}
 						}
 
@@ -2874,6 +3307,112 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 			}
 			break;
 
+			case IO_WriteBehind:	// A coalesced block has been written to the file while we continued to receive.
+			{
+				EnterCriticalSection( &context->context_cs );
+
+				// Make sure we've written the entire block before we account for it.
+				if ( context->cleanup == 0 && io_size < context->write_behind_wsabuf.len )
+				{
+					EnterCriticalSection( &context->download_info->shared_cs );
+
+					InterlockedIncrement( &context->pending_operations );
+
+					context->write_behind_wsabuf.buf += io_size;
+					context->write_behind_wsabuf.len -= io_size;
+
+					// Continue writing where the last write left off.
+					LARGE_INTEGER li;
+					li.LowPart = overlapped->overlapped.Offset;
+					li.HighPart = overlapped->overlapped.OffsetHigh;
+					li.QuadPart += io_size;
+
+					overlapped->overlapped.Internal = NULL;
+					overlapped->overlapped.InternalHigh = NULL;
+					overlapped->overlapped.Offset = li.LowPart;
+					overlapped->overlapped.OffsetHigh = li.HighPart;
+
+					BOOL bRet = WriteFile( context->download_info->hFile, context->write_behind_wsabuf.buf, context->write_behind_wsabuf.len, NULL, ( WSAOVERLAPPED * )overlapped );
+					if ( bRet == FALSE && ( GetLastError() != ERROR_IO_PENDING ) )
+					{
+						*current_operation = IO_Close;
+
+						PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+					}
+
+					LeaveCriticalSection( &context->download_info->shared_cs );
+				}
+				else
+				{
+					// An incomplete block is left unaccounted for. FlushFileData() will write it again when the context is cleaned up.
+					if ( io_size >= context->write_behind_wsabuf.len )
+					{
+						EnterCriticalSection( &context->download_info->shared_cs );
+						AddDownloadProgress( context->download_info, context->write_behind_length );	// The total amount of data (decoded) that was saved/simulated.
+						bool add_part = ( context->cleanup == 0 && UpdateAdaptiveParts( context ) );
+						LeaveCriticalSection( &context->download_info->shared_cs );
+
+						if ( add_part )
+						{
+							AddAdaptivePart( context );
+						}
+
+						EnterCriticalSection( &session_totals_cs );
+						g_session_total_downloaded += context->write_behind_length;
+						LeaveCriticalSection( &session_totals_cs );
+
+						// Only identity encoded content is coalesced so the written length is also the amount that was downloaded.
+						context->header_info.range_info->file_write_offset += context->write_behind_length;
+						context->header_info.range_info->content_offset += context->write_behind_length;
+
+						context->write_behind_length = 0;
+
+						// We stopped receiving while the block was being written. Now that it's accounted for, write what came after it.
+						if ( context->write_pending && context->cleanup == 0 )
+						{
+							context->write_pending = false;
+
+							EnterCriticalSection( &context->download_info->shared_cs );
+
+							bool written = ( context->download_info->hFile != INVALID_HANDLE_VALUE && WritePendingData( context ) );
+							if ( !written )
+							{
+								context->download_info->status = STATUS_FILE_IO_ERROR;
+								context->status = STATUS_FILE_IO_ERROR;
+							}
+
+							LeaveCriticalSection( &context->download_info->shared_cs );
+
+							if ( !written )
+							{
+								InterlockedIncrement( &context->pending_operations );
+
+								*current_operation = IO_Close;
+
+								PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+							}
+						}
+					}
+
+					// Any receive operation continues on its own. We only need to allow any pending cleanup to continue.
+					if ( context->cleanup == 2 )	// If we've forced the cleanup, then allow it to continue its steps.
+					{
+						context->cleanup = 1;	// Auto cleanup.
+					}
+					else if ( context->cleanup == 1 )	// We've already shutdown and/or closed the connection.
+					{
+						InterlockedIncrement( &context->pending_operations );
+
+						*current_operation = IO_Close;
+
+						PostQueuedCompletionStatus( hIOCP, 0, ( ULONG_PTR )context, ( WSAOVERLAPPED * )overlapped );
+					}
+				}
+
+				LeaveCriticalSection( &context->context_cs );
+			}
+			break;
+
 			case IO_Write:
 			{
 				EnterCriticalSection( &context->context_cs );
@@ -3007,7 +3546,8 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 
 				EnterCriticalSection( &context->context_cs );
 
-				if ( context->cleanup == 0 || context->cleanup == 2 )
+				// Connections that will be pooled keep their SSL/TLS session open.
+				if ( ( context->cleanup == 0 || context->cleanup == 2 ) && !IsConnectionReusable( context ) )
 				{
 					context->cleanup += 10;	// Allow IO_Write to continue to process.
 
@@ -3065,13 +3605,20 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 
 					context->cleanup = 1;	// Auto cleanup.
 
-					if ( context->socket != INVALID_SOCKET )
+					// A connection that will be pooled has no pending socket operations. It's only waiting on a file write.
+					if ( context->socket != INVALID_SOCKET && !IsConnectionReusable( context ) )
 					{
 						SOCKET s = context->socket;
 						context->socket = INVALID_SOCKET;
 						_shutdown( s, SD_BOTH );
 						_closesocket( s );	// Saves us from having to post if there's already a pending IO operation. Should force the operation to complete.
 					}
+
+					if ( context->race_socket != INVALID_SOCKET )
+					{
+						_closesocket( context->race_socket );
+						context->race_socket = INVALID_SOCKET;
+					}
 				}
 
 				LeaveCriticalSection( &context->context_cs );
@@ -3085,18 +3632,73 @@ DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext )
 		}
 	}
 
+	BP_ReleaseThreadCache();
+
 	_ExitThread( 0 );
 	return 0;
 }
 
+// Resize the receive buffer to match how much data the connection delivers per read.
+// The buffer doubles when a read fills it and drops a step when a read fills less than an eighth of it.
+// Must only be called when there's no partial data in the buffer.
+void AdjustReceiveBuffer( SOCKET_CONTEXT *context )
+{
+	unsigned int new_size = context->buffer_size;
+
+	if ( context->current_bytes_read >= context->buffer_size )
+	{
+		if ( context->buffer_size < RECEIVE_BUFFER_MAX_SIZE )
+		{
+			new_size = min( context->buffer_size * 2, RECEIVE_BUFFER_MAX_SIZE );
+		}
+	}
+	else if ( context->buffer_size > BUFFER_SIZE && context->current_bytes_read < ( context->buffer_size / 8 ) )
+	{
+		new_size = context->buffer_size / 2;
+	}
+
+	// BufferFileData needs to leave enough room in the write buffer for one full receive.
+	if ( new_size > context->buffer_size && ( context->write_buffer_length + new_size ) > WRITE_BUFFER_SIZE )
+	{
+		new_size = context->buffer_size;
+	}
+
+	if ( new_size != context->buffer_size )
+	{
+		// If the pool is at its limit, then keep using the buffer we have.
+		char *new_buffer = BP_Allocate( sizeof( char ) * ( new_size + 1 ), true );
+		if ( new_buffer != NULL )
+		{
+			BP_Free( context->buffer );
+
+			context->buffer = new_buffer;
+			context->buffer_size = new_size;
+
+			// The chunked transfer decoder allocates its buffer to match the receive buffer.
+			if ( context->header_info.chunk_buffer != NULL )
+			{
+				GlobalFree( context->header_info.chunk_buffer );
+				context->header_info.chunk_buffer = NULL;
+			}
+		}
+	}
+
+	context->wsabuf.buf = context->buffer;
+	context->wsabuf.len = context->buffer_size;
+}
+
 SOCKET_CONTEXT *CreateSocketContext()
 {
-	SOCKET_CONTEXT *context = ( SOCKET_CONTEXT * )GlobalAlloc( GPTR, sizeof( SOCKET_CONTEXT ) );
+	SOCKET_CONTEXT *context = ( SOCKET_CONTEXT * )BP_AllocateObject( POOL_SOCKET_CONTEXT );
 	if ( context != NULL )
 	{
-		context->buffer = ( char * )GlobalAlloc( GPTR, sizeof( char ) * ( BUFFER_SIZE + 1 ) );
+		_memzero( context, sizeof( SOCKET_CONTEXT ) );
+
+		context->buffer = BP_Allocate( sizeof( char ) * ( BUFFER_SIZE + 1 ) );
 		if ( context->buffer != NULL )
 		{
+			_memzero( context->buffer, sizeof( char ) * ( BUFFER_SIZE + 1 ) );
+
 			context->buffer_size = BUFFER_SIZE;
 
 			context->wsabuf.buf = context->buffer;
@@ -3108,12 +3710,20 @@ SOCKET_CONTEXT *CreateSocketContext()
 			context->overlapped.context = context;
 			context->overlapped_close.context = context;
 			context->overlapped_keep_alive.context = context;
+			context->overlapped_write_behind.context = context;
+			context->overlapped_race.context = context;
+
+			context->race_socket = INVALID_SOCKET;
 
 			InitializeCriticalSection( &context->context_cs );
+
+			context->last_activity = context->keep_alive_time = ( LONG )GetTickCount();
+
+			SetTimeoutTimer( context, ( cfg_timeout > 0 ? ( DWORD )cfg_timeout * 1000 : TIMEOUT_POLL_DELAY ) );
 		}
 		else
 		{
-			GlobalFree( context );
+			BP_Free( context );
 			context = NULL;
 		}
 	}
@@ -3121,2013 +3731,4520 @@ SOCKET_CONTEXT *CreateSocketContext()
 	return context;
 }
 
-bool CreateConnection( SOCKET_CONTEXT *context, char *host, unsigned short port )
+// The file offset and content offset of our range, including any coalesced content that has yet to be written.
+unsigned long long GetBufferedFileOffset( SOCKET_CONTEXT *context )
 {
-	if ( context == NULL || host == NULL )
-	{
-		return false;
-	}
+	return context->header_info.range_info->file_write_offset + context->mapped_pending_length + context->write_behind_length + context->write_buffer_length;
+}
 
-	int nRet = 0;
+unsigned long long GetBufferedContentOffset( SOCKET_CONTEXT *context )
+{
+	return context->header_info.range_info->content_offset + context->mapped_pending_length + context->write_behind_length + context->write_buffer_length;
+}
 
-	struct addrinfoW hints;
+// Hands the first block_length bytes of the write buffer to a background write and moves any remainder into the other buffer.
+// The download_info's shared_cs must be held.
+bool WriteBehind( SOCKET_CONTEXT *context, unsigned int block_length )
+{
+	LARGE_INTEGER li;
+	li.QuadPart = context->header_info.range_info->file_write_offset;	// The write behind buffer is empty so our block begins here.
 
-	bool use_ipv6 = false;
+	char *buffer = context->write_behind_buffer;
+	context->write_behind_buffer = context->write_buffer;
+	context->write_buffer = buffer;
 
-	wchar_t *whost = NULL, *t_whost = NULL;
-	wchar_t wcs_ip[ 16 ];
-	wchar_t wport[ 6 ];
+	context->write_behind_length = block_length;
 
-	if ( context->address_info == NULL )
-	{
-		// Resolve the remote host.
-		_memzero( &hints, sizeof( addrinfoW ) );
-		hints.ai_family = AF_INET;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_IP;
+	context->write_behind_wsabuf.buf = context->write_behind_buffer;
+	context->write_behind_wsabuf.len = block_length;
 
-		if ( cfg_enable_proxy && context->request_info.protocol == PROTOCOL_HTTP )
-		{
-			__snwprintf( wport, 6, L"%hu", cfg_port );
+	context->write_buffer_length -= block_length;
+	if ( context->write_buffer_length > 0 )
+	{
+		_memcpy_s( context->write_buffer, WRITE_BUFFER_SIZE, context->write_behind_buffer + block_length, context->write_buffer_length );
+	}
 
-			if ( cfg_address_type == 0 )
-			{
-				whost = ( g_punycode_hostname != NULL ? g_punycode_hostname : cfg_hostname );
-			}
-			else
-			{
-				struct sockaddr_in src_addr;
-				_memzero( &src_addr, sizeof( sockaddr_in ) );
+	InterlockedIncrement( &context->pending_operations );
 
-				src_addr.sin_family = AF_INET;
-				src_addr.sin_addr.s_addr = _htonl( cfg_ip_address );
+	context->overlapped_write_behind.current_operation = IO_WriteBehind;
 
-				DWORD wcs_ip_length = 16;
-				_WSAAddressToStringW( ( SOCKADDR * )&src_addr, sizeof( struct sockaddr_in ), NULL, wcs_ip, &wcs_ip_length );
+	_memzero( &context->overlapped_write_behind.overlapped, sizeof( WSAOVERLAPPED ) );
+	context->overlapped_write_behind.overlapped.Offset = li.LowPart;
+	context->overlapped_write_behind.overlapped.OffsetHigh = li.HighPart;
 
-				whost = wcs_ip;
-			}
-		}
-		else if ( cfg_enable_proxy_s && context->request_info.protocol == PROTOCOL_HTTPS )
-		{
-			__snwprintf( wport, 6, L"%hu", cfg_port_s );
+	BOOL bRet = WriteFile( context->download_info->hFile, context->write_behind_wsabuf.buf, context->write_behind_wsabuf.len, NULL, ( OVERLAPPED * )&context->overlapped_write_behind );
+	if ( bRet == FALSE && ( GetLastError() != ERROR_IO_PENDING ) )
+	{
+		InterlockedDecrement( &context->pending_operations );
 
-			if ( cfg_address_type_s == 0 )
-			{
-				whost = ( g_punycode_hostname_s != NULL ? g_punycode_hostname_s : cfg_hostname_s );
-			}
-			else
-			{
-				struct sockaddr_in src_addr;
-				_memzero( &src_addr, sizeof( sockaddr_in ) );
+		return false;
+	}
 
-				src_addr.sin_family = AF_INET;
-				src_addr.sin_addr.s_addr = _htonl( cfg_ip_address_s );
+	return true;
+}
 
-				DWORD wcs_ip_length = 16;
-				_WSAAddressToStringW( ( SOCKADDR * )&src_addr, sizeof( struct sockaddr_in ), NULL, wcs_ip, &wcs_ip_length );
+// Writes everything in the write buffer with IO_WriteFile, which continues to receive once it's written.
+// The write behind buffer must have been written and accounted for. The download_info's shared_cs must be held.
+bool WritePendingData( SOCKET_CONTEXT *context )
+{
+	LARGE_INTEGER li;
+	li.QuadPart = context->header_info.range_info->file_write_offset;
 
-				whost = wcs_ip;
-			}
-		}
-		else if ( cfg_enable_proxy_socks )
-		{
-			__snwprintf( wport, 6, L"%hu", cfg_port_socks );
+	InterlockedIncrement( &context->pending_operations );
 
-			if ( cfg_address_type_socks == 0 )
-			{
-				whost = ( g_punycode_hostname_socks != NULL ? g_punycode_hostname_socks : cfg_hostname_socks );
-			}
-			else
-			{
-				struct sockaddr_in src_addr;
-				_memzero( &src_addr, sizeof( sockaddr_in ) );
+	context->overlapped.current_operation = IO_WriteFile;
 
-				src_addr.sin_family = AF_INET;
-				src_addr.sin_addr.s_addr = _htonl( cfg_ip_address_socks );
+	context->write_wsabuf.buf = context->write_buffer;
+	context->write_wsabuf.len = context->write_buffer_length;
 
-				DWORD wcs_ip_length = 16;
-				_WSAAddressToStringW( ( SOCKADDR * )&src_addr, sizeof( struct sockaddr_in ), NULL, wcs_ip, &wcs_ip_length );
+	context->overlapped.overlapped.hEvent = NULL;
+	context->overlapped.overlapped.Internal = NULL;
+	context->overlapped.overlapped.InternalHigh = NULL;
+	//context->overlapped.Pointer = NULL;	// union
+	context->overlapped.overlapped.Offset = li.LowPart;
+	context->overlapped.overlapped.OffsetHigh = li.HighPart;
 
-				whost = wcs_ip;
-			}
-		}
-		else
-		{
-			__snwprintf( wport, 6, L"%hu", port );
+	context->content_offset = context->write_buffer_length;	// IO_WriteFile accounts for this block once it's written.
 
-			int whost_length = MultiByteToWideChar( CP_UTF8, 0, host, -1, NULL, 0 );	// Include the NULL terminator.
-			whost = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * whost_length );
-			MultiByteToWideChar( CP_UTF8, 0, host, -1, whost, whost_length );
+	context->write_buffer_length = 0;
 
-			t_whost = whost;
-		}
+	BOOL bRet = WriteFile( context->download_info->hFile, context->write_wsabuf.buf, context->write_wsabuf.len, NULL, ( OVERLAPPED * )&context->overlapped );
+	if ( bRet == FALSE && ( GetLastError() != ERROR_IO_PENDING ) )
+	{
+		InterlockedDecrement( &context->pending_operations );
 
-		nRet = _GetAddrInfoW( whost, wport, &hints, &context->address_info );
-		if ( nRet == WSAHOST_NOT_FOUND )
-		{
-			use_ipv6 = true;
+		// Leave it for FlushFileData() to write.
+		context->write_buffer_length = ( unsigned int )context->content_offset;
 
-			hints.ai_family = AF_INET6;	// Try IPv6
-			nRet = _GetAddrInfoW( whost, wport, &hints, &context->address_info );
-		}
+		context->content_offset = 0;
 
-		GlobalFree( t_whost );
+		return false;
+	}
 
-		if ( nRet != 0 )
-		{
-			return false;
-		}
+	return true;
+}
+
+// Coalesces identity encoded content into large blocks that are written to the file in the background while we continue to receive.
+// Returns content_status if we can continue to receive, CONTENT_STATUS_NONE if IO_WriteFile will continue once the block has been written,
+// or CONTENT_STATUS_FAILED if the write failed. Setting flush writes everything we've coalesced so far.
+char BufferFileData( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_length, bool flush, char content_status )
+{
+	WSABUF slice;
+	slice.buf = buffer;
+	slice.len = buffer_length;
+
+	return BufferFileSlices( context, &slice, 1, flush, content_status );
+}
+
+// The same as BufferFileData(), but for a list of slices (the payloads of a chunked transfer) that are copied in order.
+// Together the slices must be no larger than the receive buffer.
+char BufferFileSlices( SOCKET_CONTEXT *context, WSABUF *slices, unsigned int slice_count, bool flush, char content_status )
+{
+	if ( context == NULL || context->download_info == NULL || context->header_info.range_info == NULL )
+	{
+		return CONTENT_STATUS_FAILED;
 	}
 
-	if ( cfg_enable_proxy_socks &&
-		 context->proxy_address_info == NULL &&
-		 ( ( cfg_socks_type == SOCKS_TYPE_V4 && !cfg_resolve_domain_names_v4a ) ||
-		   ( cfg_socks_type == SOCKS_TYPE_V5 && !cfg_resolve_domain_names ) ) )
+	if ( context->write_buffer == NULL )
 	{
-		_memzero( &hints, sizeof( addrinfoW ) );
-		hints.ai_family = AF_INET;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_IP;
+		context->write_buffer = ( char * )BP_AllocateObject( POOL_WRITE_BUFFER );
+		context->write_buffer_length = 0;
+	}
 
-		__snwprintf( wport, 6, L"%hu", context->request_info.port );
+	if ( context->write_behind_buffer == NULL )
+	{
+		context->write_behind_buffer = ( char * )BP_AllocateObject( POOL_WRITE_BUFFER );
+		context->write_behind_length = 0;
+	}
 
-		int whost_length = MultiByteToWideChar( CP_UTF8, 0, context->request_info.host, -1, NULL, 0 );	// Include the NULL terminator.
-		whost = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * whost_length );
-		MultiByteToWideChar( CP_UTF8, 0, context->request_info.host, -1, whost, whost_length );
+	for ( unsigned int i = 0; i < slice_count; ++i )
+	{
+		char *buffer = slices[ i ].buf;
+		unsigned int buffer_length = slices[ i ].len;
 
-		nRet = _GetAddrInfoW( whost, wport, &hints, &context->proxy_address_info );
-		if ( nRet == WSAHOST_NOT_FOUND && cfg_socks_type == SOCKS_TYPE_V5 )	// Allow IPv6 for SOCKS 5
+		// Copy the content straight into the file if there's nothing coalesced that needs to be written before it.
+		if ( context->write_buffer_length == 0 && context->write_behind_length == 0 && context->mapping_state != MAPPING_STATE_DISABLED )
 		{
-			hints.ai_family = AF_INET6;	// Try IPv6
-			_GetAddrInfoW( whost, wport, &hints, &context->proxy_address_info );
+			unsigned int mapped_length = MapFileData( context, buffer, buffer_length );
+
+			if ( mapped_length == buffer_length )
+			{
+				continue;
+			}
+
+			buffer += mapped_length;
+			buffer_length -= mapped_length;
+
+			// Don't mix the mapping with WriteFile. What's in the view is written and accounted for, and the rest of the part uses WriteFile.
+			if ( !ReleaseFileMapping( context ) )
+			{
+				EnterCriticalSection( &context->download_info->shared_cs );
+
+				context->download_info->status = STATUS_FILE_IO_ERROR;
+				context->status = STATUS_FILE_IO_ERROR;
+
+				LeaveCriticalSection( &context->download_info->shared_cs );
+
+				return CONTENT_STATUS_FAILED;
+			}
+
+			context->mapping_state = MAPPING_STATE_DISABLED;
 		}
 
-		GlobalFree( whost );
+		// Shouldn't happen. We always leave enough room for one receive buffer.
+		if ( context->write_buffer == NULL || context->write_behind_buffer == NULL || buffer_length > ( WRITE_BUFFER_SIZE - context->write_buffer_length ) )
+		{
+			return CONTENT_STATUS_FAILED;
+		}
+
+		_memcpy_s( context->write_buffer + context->write_buffer_length, WRITE_BUFFER_SIZE - context->write_buffer_length, buffer, buffer_length );
+		context->write_buffer_length += buffer_length;
 	}
 
-	SOCKET socket = CreateSocket( use_ipv6 );
-	if ( socket == INVALID_SOCKET )
+	unsigned int block_length = 0;
+
+	if ( flush )
 	{
-		return false;
+		block_length = context->write_buffer_length;
 	}
+	else
+	{
+		unsigned long long block_start = context->header_info.range_info->file_write_offset + context->write_behind_length;
+		unsigned long long block_end = ( block_start + ( WRITE_BUFFER_SIZE - context->buffer_size ) ) & ~( ( unsigned long long )WRITE_BUFFER_ALIGNMENT - 1 );
 
-	context->socket = socket;
+		if ( block_end > block_start && ( block_start + context->write_buffer_length ) >= block_end )
+		{
+			block_length = ( unsigned int )( block_end - block_start );
+		}
+		else if ( ( context->write_buffer_length + context->buffer_size ) > WRITE_BUFFER_SIZE )	// Make sure the next receive will fit.
+		{
+			block_length = context->write_buffer_length;
+		}
+	}
 
-	g_hIOCP = CreateIoCompletionPort( ( HANDLE )socket, g_hIOCP, 0/*( ULONG_PTR )context*/, 0 );
-	if ( g_hIOCP == NULL )
+	if ( block_length == 0 )
 	{
-		return false;
+		return content_status;
 	}
 
-	// Socket must be bound before we can use it with ConnectEx.
-	struct sockaddr_in ipv4_addr;
-	struct sockaddr_in6 ipv6_addr;
+	EnterCriticalSection( &context->download_info->shared_cs );
 
-	if ( use_ipv6 )
+	if ( context->download_info->hFile == INVALID_HANDLE_VALUE )	// Shouldn't happen.
 	{
-		_memzero( &ipv6_addr, sizeof( ipv6_addr ) );
-		ipv6_addr.sin6_family = AF_INET6;
-		//ipv6_addr.sin6_addr = in6addr_any;	// This assignment requires the CRT, but it's all zeros anyway and it gets set by _memzero().
-		//ipv6_addr.sin6_port = 0;
-		nRet = _bind( socket, ( SOCKADDR * )&ipv6_addr, sizeof( ipv6_addr ) );
+		content_status = CONTENT_STATUS_FAILED;
 	}
-	else
+	else if ( context->write_behind_length == 0 )	// Write the block in the background and continue receiving.
 	{
-		_memzero( &ipv4_addr, sizeof( ipv4_addr ) );
-		ipv4_addr.sin_family = AF_INET;
-		//ipv4_addr.sin_addr.s_addr = INADDR_ANY;
-		//ipv4_addr.sin_port = 0;
-		nRet = _bind( socket, ( SOCKADDR * )&ipv4_addr, sizeof( ipv4_addr ) );
+		if ( !WriteBehind( context, block_length ) )
+		{
+			content_status = CONTENT_STATUS_FAILED;
+		}
 	}
-
-	if ( nRet == SOCKET_ERROR )
+	else	// The previous block is still being written. Stop receiving until it's been accounted for. IO_WriteBehind will then write everything we have.
 	{
-		return false;
-	}
+		context->content_status = content_status;	// Causes IO_WriteFile to continue where we left off.
 
-	// Attempt to connect to the host.
-	InterlockedIncrement( &context->pending_operations );
+		context->write_pending = true;
 
-	context->overlapped.current_operation = IO_Connect;
+		content_status = CONTENT_STATUS_NONE;	// Exits IO_GetContent.
+	}
 
-	DWORD lpdwBytesSent = 0;
-	BOOL bRet = _ConnectEx( socket, context->address_info->ai_addr, ( int )context->address_info->ai_addrlen, NULL, 0, &lpdwBytesSent, ( OVERLAPPED * )&context->overlapped );
-	if ( bRet == FALSE && ( _WSAGetLastError() != ERROR_IO_PENDING ) )
+	if ( content_status == CONTENT_STATUS_FAILED )
 	{
-		InterlockedDecrement( &context->pending_operations );
+		context->download_info->status = STATUS_FILE_IO_ERROR;
+		context->status = STATUS_FILE_IO_ERROR;
 
-		/*if ( context->address_info != NULL )
-		{
-			_FreeAddrInfoW( context->address_info );
-		}*/
+		context->write_buffer_length = 0;
 
-		return false;
+		if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
+		{
+			CloseHandle( context->download_info->hFile );
+			context->download_info->hFile = INVALID_HANDLE_VALUE;
+		}
 	}
 
-	/*if ( context->address_info != NULL )
-	{
-		_FreeAddrInfoW( context->address_info );
-	}*/
+	LeaveCriticalSection( &context->download_info->shared_cs );
 
-	return true;
+	return content_status;
 }
 
-void UpdateRangeList( DOWNLOAD_INFO *di )
+// Writes any coalesced content that remains once a context has no more pending operations.
+void FlushFileData( SOCKET_CONTEXT *context )
 {
-	if ( di == NULL )
+	if ( context == NULL )
 	{
 		return;
 	}
 
-	RANGE_INFO *ri;
-	RANGE_INFO *ri_copy;
-	DoublyLinkedList *range_node = di->range_list;
-	DoublyLinkedList *range_node_copy;
+	// Anything that was copied into the file's mapping comes before what we've coalesced.
+	ReleaseFileMapping( context );
 
-	if ( range_node != NULL )
+	if ( context->write_behind_length == 0 && context->write_buffer_length == 0 )
 	{
-		unsigned char range_info_count = 0;
+		return;
+	}
 
-		DoublyLinkedList *active_range_list = NULL;
+	if ( context->download_info != NULL && context->header_info.range_info != NULL )
+	{
+		EnterCriticalSection( &context->download_info->shared_cs );
 
-		// Determine the number of ranges that still need downloading.
-		while ( range_node != NULL )
+		if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
 		{
-			ri = ( RANGE_INFO * )range_node->data;
-
-			// Check if our range still needs to download.
-			if ( ri != NULL && ( ri->content_offset < ( ( ri->range_end - ri->range_start ) + 1 ) ) )
+			HANDLE hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+			if ( hEvent != NULL )
 			{
-				++range_info_count;
+				OVERLAPPED ov;
 
-				RANGE_INFO *ri_copy = ( RANGE_INFO * )GlobalAlloc( GMEM_FIXED, sizeof( RANGE_INFO ) );
+				// An incomplete background write comes before the write buffer. Write it first so that our offsets remain contiguous.
+				char *buffers[ 2 ] = { context->write_behind_buffer, context->write_buffer };
+				unsigned int lengths[ 2 ] = { context->write_behind_length, context->write_buffer_length };
 
-				ri_copy->content_length = ri->content_length;
-				ri_copy->content_offset = ri->content_offset;
-				ri_copy->file_write_offset = ri->file_write_offset;
-				ri_copy->range_end = ri->range_end;
-				ri_copy->range_start = ri->range_start;
+				for ( unsigned char i = 0; i < 2; ++i )
+				{
+					DWORD written = 0;
 
-				DoublyLinkedList *new_range_node = DLL_CreateNode( ( void * )ri_copy );
-				DLL_AddNode( &active_range_list, new_range_node, -1 );
-			}
+					if ( lengths[ i ] > 0 )
+					{
+						LARGE_INTEGER li;
+						li.QuadPart = context->header_info.range_info->file_write_offset;
 
-			range_node = range_node->next;
-		}
+						_memzero( &ov, sizeof( OVERLAPPED ) );
+						ov.Offset = li.LowPart;
+						ov.OffsetHigh = li.HighPart;
+						ov.hEvent = ( HANDLE )( ( ULONG_PTR )hEvent | 1 );	// Setting the low-order bit prevents the completion from being queued to our completion port.
 
-		// Can we split any remaining parts to fill the total?
-		if ( range_info_count > 0 && range_info_count < di->parts )
-		{
-			unsigned char parts = di->parts / range_info_count;
-			unsigned char rem_parts = di->parts % range_info_count;
-			unsigned char total_parts = di->parts - rem_parts;
+						BOOL bRet = WriteFile( context->download_info->hFile, buffers[ i ], lengths[ i ], NULL, &ov );
+						if ( bRet != FALSE || GetLastError() == ERROR_IO_PENDING )
+						{
+							GetOverlappedResult( context->download_info->hFile, &ov, &written, TRUE );
+						}
+					}
 
-			range_node = di->range_list;
-			range_node_copy = active_range_list;
+					if ( written < lengths[ i ] )
+					{
+						break;
+					}
 
-			while ( range_node_copy != NULL )
-			{
-				unsigned char t_parts = parts;
+					AddDownloadProgress( context->download_info, written );	// The total amount of data (decoded) that was saved/simulated.
 
-				if ( rem_parts > 0 )	// Distribute any remainder parts amongst the remaining ranges.
-				{
-					++t_parts;
-					--rem_parts;
+					EnterCriticalSection( &session_totals_cs );
+					g_session_total_downloaded += written;
+					LeaveCriticalSection( &session_totals_cs );
+
+					context->header_info.range_info->file_write_offset += written;
+					context->header_info.range_info->content_offset += written;
 				}
 
-				ri_copy = ( RANGE_INFO * )range_node_copy->data;
+				CloseHandle( hEvent );
+			}
+		}
 
-				unsigned long long remaining_length = ( ( ri_copy->range_end - ri_copy->range_start ) + 1 ) - ri_copy->content_offset;
+		LeaveCriticalSection( &context->download_info->shared_cs );
+	}
 
-				// We'll only use 1 part for this range since it's too small to split up and the remainder of parts will be used for the next range.
-				if ( remaining_length < t_parts )
-				{
-					rem_parts += ( t_parts - 1 );
-					t_parts = 1;
-				}
+	// Anything we couldn't write will be downloaded again.
+	context->write_behind_length = 0;
+	context->write_buffer_length = 0;
 
-				unsigned long long range_size = remaining_length / t_parts;
-				unsigned long long range_offset = ri_copy->range_start + ri_copy->content_offset;
-				unsigned long long range_end = ri_copy->range_end;
+	context->write_pending = false;
+}
 
-				for ( unsigned char i = 1; i <= t_parts; ++i )
-				{
-					// Download was restarted before a range list was created.
-					if ( range_node == NULL )
-					{
-						ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+// Copies identity encoded content straight into a mapped view of the file. This saves a copy into the write buffer and the WriteFile call.
+// The content is accounted for once its view has been flushed and unmapped.
+// Returns the number of bytes that were copied. Anything that wasn't copied must be written with WriteFile.
+unsigned int MapFileData( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_length )
+{
+	// The file's clusters must already be allocated (not sparse) so that copying into the view can't fail on a full disk.
+	if ( context->mapping_state == MAPPING_STATE_DISABLED || !cfg_enable_file_mapping || !cfg_enable_quick_allocation || !g_can_fast_allocate )
+	{
+		return 0;
+	}
 
-						range_node = DLL_CreateNode( ( void * )ri );
-						DLL_AddNode( &di->range_list, range_node, -1 );
-					}
-					else
-					{
-						ri = ( RANGE_INFO * )range_node->data;
-					}
+	unsigned int copied = 0;
 
-					// Reuse this range info.
-					ri->content_length = 0;
-					ri->content_offset = 0;
+	while ( copied < buffer_length )
+	{
+		unsigned long long offset = context->header_info.range_info->file_write_offset + context->mapped_pending_length;
 
-					if ( i == 1 )
-					{
-						ri->range_start = range_offset;
-					}
-					else
-					{
-						ri->range_start = range_offset + 1;
-					}
+		// Slide the window forward. The old view is flushed and accounted for first.
+		if ( context->mapped_view == NULL ||
+			 offset < context->mapped_offset ||
+			 offset >= ( context->mapped_offset + context->mapped_length ) )
+		{
+			if ( !MapFileView( context, offset ) )
+			{
+				break;
+			}
+		}
 
-					if ( i < t_parts )
-					{
-						range_offset += range_size;
-						ri->range_end = range_offset;
-					}
-					else	// Make sure we have an accurate range end for the last part.
-					{
-						ri->range_end = range_end;
-					}
+		unsigned int length = ( unsigned int )( ( context->mapped_offset + context->mapped_length ) - offset );
+		if ( length > ( buffer_length - copied ) )
+		{
+			length = buffer_length - copied;
+		}
 
-					ri->file_write_offset = ri->range_start;
+		_memcpy_s( context->mapped_view + ( offset - context->mapped_offset ), context->mapped_length - ( unsigned int )( offset - context->mapped_offset ), buffer + copied, length );
 
-					range_node = range_node->next;
-				}
+		context->mapped_pending_length += length;
 
-				range_node_copy = range_node_copy->next;
-			}
+		copied += length;
+	}
 
-			di->range_list_end = range_node;
+	return copied;
+}
 
-			// Zero out the unused range info.
-			/*while ( range_node != NULL )
-			{
-				ri = ( RANGE_INFO * )range_node->data;
-				ri->content_length = 0;
-				ri->content_offset = 0;
-				ri->file_write_offset = 0;
-				ri->range_end = 0;
-				ri->range_start = 0;
+// Maps the window of the file that contains offset.
+bool MapFileView( SOCKET_CONTEXT *context, unsigned long long offset )
+{
+	if ( !UnmapFileView( context ) )
+	{
+		return false;
+	}
 
-				range_node = range_node->next;
-			}*/
+	if ( context->hMapping == NULL )
+	{
+		EnterCriticalSection( &context->download_info->shared_cs );
+
+		BY_HANDLE_FILE_INFORMATION bhfi;
+
+		if ( context->download_info->hFile != INVALID_HANDLE_VALUE &&
+			 GetFileInformationByHandle( context->download_info->hFile, &bhfi ) != FALSE &&
+			 !( bhfi.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE ) )	// A resumed file might have been allocated as a sparse file.
+		{
+			LARGE_INTEGER li;
+			li.HighPart = bhfi.nFileSizeHigh;
+			li.LowPart = bhfi.nFileSizeLow;
+
+			context->mapped_file_size = li.QuadPart;
+
+			context->hMapping = CreateFileMapping( context->download_info->hFile, NULL, PAGE_READWRITE, 0, 0, NULL );
 		}
 
-		while ( active_range_list != NULL )
+		LeaveCriticalSection( &context->download_info->shared_cs );
+
+		if ( context->hMapping == NULL )
 		{
-			range_node = active_range_list;
-			active_range_list = active_range_list->next;
+			context->mapping_state = MAPPING_STATE_DISABLED;
 
-			GlobalFree( range_node->data );
-			GlobalFree( range_node );
+			return false;
 		}
+
+		context->mapping_state = MAPPING_STATE_MAPPED;
 	}
-	else
+
+	// The file was allocated to its full size. Anything past it can't be mapped.
+	if ( offset >= context->mapped_file_size )
 	{
-		ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
-		range_node = DLL_CreateNode( ( void * )ri );
-		DLL_AddNode( &di->range_list, range_node, -1 );
+		return false;
+	}
+
+	LARGE_INTEGER li;
+	li.QuadPart = offset & ~( ( unsigned long long )MAPPED_VIEW_ALIGNMENT - 1 );
+
+	unsigned int length = MAPPED_VIEW_SIZE;
+	if ( ( unsigned long long )length > ( context->mapped_file_size - li.QuadPart ) )
+	{
+		length = ( unsigned int )( context->mapped_file_size - li.QuadPart );
 	}
+
+	context->mapped_view = ( char * )MapViewOfFile( context->hMapping, FILE_MAP_WRITE, li.HighPart, li.LowPart, length );
+	if ( context->mapped_view == NULL )
+	{
+		ReleaseFileMapping( context );
+
+		context->mapping_state = MAPPING_STATE_DISABLED;
+
+		return false;
+	}
+
+	context->mapped_offset = li.QuadPart;
+	context->mapped_length = length;
+
+	return true;
 }
 
-void StartDownload( DOWNLOAD_INFO *di, bool check_if_file_exists )
+// Writes the view's pages and accounts for the content that was copied into it before the view is unmapped.
+// Returns false (and leaves the view mapped) if the pages couldn't be written.
+bool UnmapFileView( SOCKET_CONTEXT *context )
 {
-	if ( di == NULL )
+	if ( context->mapped_view != NULL )
 	{
-		return;
+		if ( context->mapped_pending_length > 0 )
+		{
+			if ( FlushViewOfFile( context->mapped_view, 0 ) == FALSE )
+			{
+				return false;
+			}
+
+			unsigned int length = context->mapped_pending_length;
+
+			context->mapped_pending_length = 0;
+
+			EnterCriticalSection( &context->download_info->shared_cs );
+			AddDownloadProgress( context->download_info, length );	// The total amount of data (decoded) that was saved/simulated.
+			bool add_part = ( context->cleanup == 0 && UpdateAdaptiveParts( context ) );
+			LeaveCriticalSection( &context->download_info->shared_cs );
+
+			if ( add_part )
+			{
+				AddAdaptivePart( context );
+			}
+
+			EnterCriticalSection( &session_totals_cs );
+			g_session_total_downloaded += length;
+			LeaveCriticalSection( &session_totals_cs );
+
+			// Only identity encoded content is mapped so the copied length is also the amount that was downloaded.
+			context->header_info.range_info->file_write_offset += length;
+			context->header_info.range_info->content_offset += length;
+		}
+
+		UnmapViewOfFile( context->mapped_view );
+		context->mapped_view = NULL;
+
+		context->mapped_offset = 0;
+		context->mapped_length = 0;
 	}
 
-	unsigned char add_state = 0;
+	return true;
+}
 
-	PROTOCOL protocol = PROTOCOL_UNKNOWN;
-	wchar_t *host = NULL;
-	wchar_t *resource = NULL;
-	unsigned short port = 0;
+// Returns false if the content in the view couldn't be written. It will be downloaded again.
+bool ReleaseFileMapping( SOCKET_CONTEXT *context )
+{
+	bool flushed = UnmapFileView( context );
+	if ( !flushed )
+	{
+		UnmapViewOfFile( context->mapped_view );
+		context->mapped_view = NULL;
 
-	bool skip_start = false;
+		context->mapped_offset = 0;
+		context->mapped_length = 0;
 
-	EnterCriticalSection( &di->shared_cs );
+		context->mapped_pending_length = 0;
+	}
 
-	wchar_t prompt_message[ MAX_PATH + 512 ];
-	wchar_t file_path[ MAX_PATH ];
+	if ( context->hMapping != NULL )
+	{
+		CloseHandle( context->hMapping );
+		context->hMapping = NULL;
 
-	int filename_offset;
-	int file_extension_offset;
+		context->mapping_state = MAPPING_STATE_NONE;
+	}
 
-	if ( cfg_use_temp_download_directory )
+	return flushed;
+}
+
+// Has the resolver thread look up the host so that the worker threads don't block on it.
+// The request takes ownership of key. IO_ResolveAddress is posted to the context once its address_info has been set.
+bool QueueResolve( SOCKET_CONTEXT *context, wchar_t *key, wchar_t *host, wchar_t *port )
+{
+	if ( g_resolver_semaphore == NULL || key == NULL )
 	{
-		int filename_length = GetTemporaryFilePath( di, file_path );
+		GlobalFree( key );
 
-		filename_offset = g_temp_download_directory_length + 1;
-		file_extension_offset = filename_offset + get_file_extension_offset( di->file_path + di->filename_offset, filename_length );
+		return false;
 	}
-	else
+
+	RESOLVE_REQUEST *rr = ( RESOLVE_REQUEST * )GlobalAlloc( GPTR, sizeof( RESOLVE_REQUEST ) );
+	if ( rr == NULL )
 	{
-		GetDownloadFilePath( di, file_path );
+		GlobalFree( key );
 
-		filename_offset = di->filename_offset;
-		file_extension_offset = di->file_extension_offset;
+		return false;
 	}
 
-	// See if the file exits.
-	if ( GetFileAttributesW( file_path ) != INVALID_FILE_ATTRIBUTES )
+	rr->host = GlobalStrDupW( host );
+	if ( rr->host == NULL )
 	{
-		if ( check_if_file_exists )
-		{
-			if ( cfg_prompt_rename == 0 && di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS )
-			{
-				di->status = STATUS_SKIPPED;
+		GlobalFree( key );
+		GlobalFree( rr );
 
-				skip_start = true;
-			}
-			else
-			{
-				// If the last return value was not set to remember our choice, then prompt again.
-				if ( cfg_prompt_rename == 0 &&
-					 g_rename_file_cmb_ret != CMBIDRENAMEALL &&
-					 g_rename_file_cmb_ret != CMBIDOVERWRITEALL &&
-					 g_rename_file_cmb_ret != CMBIDSKIPALL )
-				{
-					__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___already_exists, file_path );
+		return false;
+	}
 
-					g_rename_file_cmb_ret = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_RENAMEOVERWRITESKIPALL );
-				}
+	rr->key = key;
+	_wmemcpy_s( rr->port, 6, port, 6 );
+	rr->context = context;
+	rr->queue_node.data = rr;
 
-				// Rename the file and try again.
-				if ( cfg_prompt_rename == 1 ||
-				   ( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDRENAME ||
-												 g_rename_file_cmb_ret == CMBIDRENAMEALL ) ) )
-				{
-					// Creates a tree of active and queued downloads.
-					dllrbt_tree *add_files_tree = CreateFilenameTree();
+	InterlockedIncrement( &context->pending_operations );
 
-					bool rename_succeeded = RenameFile( di, add_files_tree, file_path, filename_offset, file_extension_offset );
+	context->overlapped.current_operation = IO_ResolveAddress;
 
-					// The tree is only used to determine duplicate filenames.
-					DestroyFilenameTree( add_files_tree );
+	EnterCriticalSection( &resolve_queue_cs );
 
-					if ( !rename_succeeded )
-					{
-						if ( g_rename_file_cmb_ret2 != CMBIDOKALL && !( di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS ) )
-						{
-							__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___could_not_be_renamed, file_path );
+	DLL_AddNode( &g_resolve_queue, &rr->queue_node, -1 );
 
-							g_rename_file_cmb_ret2 = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_OKALL );
-						}
+	LeaveCriticalSection( &resolve_queue_cs );
 
-						di->status = STATUS_SKIPPED;
+	ReleaseSemaphore( g_resolver_semaphore, 1, NULL );
 
-						skip_start = true;
-					}
-				}
-				else if ( cfg_prompt_rename == 3 ||
-						( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDFAIL ||
-													  g_rename_file_cmb_ret == CMBIDSKIP ||
-													  g_rename_file_cmb_ret == CMBIDSKIPALL ) ) ) // Skip the rename or overwrite if the return value fails, or the user selected skip.
-				{
-					di->status = STATUS_SKIPPED;
+	return true;
+}
 
-					skip_start = true;
-				}
-			}
-		}
-	}
-	else if ( !( di->download_operations & DOWNLOAD_OPERATION_SIMULATE ) &&
-				 di->downloaded > 0 )	// If the file doesn't exist and it's been partially downloaded, then ask to restart.
+// Looks up the hosts in the resolve queue one at a time. Contexts that are waiting on the same host
+// will find its addresses in the cache once the first lookup has completed.
+DWORD WINAPI Resolver( LPVOID WorkThreadContext )
+{
+	while ( !g_end_program )
 	{
-		if ( g_file_not_exist_cmb_ret != CMBIDNOALL && g_file_not_exist_cmb_ret != CMBIDYESALL )
+		WaitForSingleObject( g_resolver_semaphore, INFINITE );
+
+		if ( g_end_program )
 		{
-			g_file_not_exist_cmb_ret = CMessageBoxW( g_hWnd_main, ST_V_PROMPT_The_specified_file_was_not_found, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_YESNOALL );
+			break;
 		}
 
-		if ( g_file_not_exist_cmb_ret == CMBIDYES || g_file_not_exist_cmb_ret == CMBIDYESALL )
-		{
-			_SendMessageW( g_hWnd_main, WM_RESET_PROGRESS, 0, ( LPARAM )di );
+		RESOLVE_REQUEST *rr = NULL;
 
-			while ( di->range_list != NULL )
-			{
-				DoublyLinkedList *range_node = di->range_list;
-				di->range_list = di->range_list->next;
+		EnterCriticalSection( &resolve_queue_cs );
 
-				GlobalFree( range_node->data );
-				GlobalFree( range_node );
-			}
+		if ( g_resolve_queue != NULL )
+		{
+			rr = ( RESOLVE_REQUEST * )g_resolve_queue->data;
 
-			di->range_list_end = NULL;
+			DLL_RemoveNode( &g_resolve_queue, &rr->queue_node );
+		}
 
-			di->processed_header = false;
+		LeaveCriticalSection( &resolve_queue_cs );
 
-			di->downloaded = 0;
+		if ( rr == NULL )
+		{
+			continue;
+		}
 
-			di->last_modified.QuadPart = 0;
+		addrinfoW *address_info = NULL;
 
-			// If we manually start a download, then set the incomplete retry attempts back to 0.
-			di->retries = 0;
-			di->start_time.QuadPart = 0;
+		ResolveAddressInfo( rr->key, rr->host, rr->port, &address_info );
 
-			// If we manually start a download that was added remotely, then allow the prompts to display.
-			di->download_operations &= ~DOWNLOAD_OPERATION_OVERRIDE_PROMPTS;
+		if ( !g_end_program )
+		{
+			// A NULL address_info tells the context that the host couldn't be resolved.
+			rr->context->address_info = address_info;
+
+			PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )rr->context, ( OVERLAPPED * )&rr->context->overlapped );
 		}
 		else
 		{
-			di->status = STATUS_SKIPPED;
-
-			skip_start = true;
+			FreeAddressInfo( address_info );
 		}
+
+		GlobalFree( rr->key );
+		GlobalFree( rr->host );
+		GlobalFree( rr );
 	}
 
-	LeaveCriticalSection( &di->shared_cs );
+	// The contexts of any remaining requests are freed along with the context list.
+	EnterCriticalSection( &resolve_queue_cs );
 
-	if ( skip_start )
+	while ( g_resolve_queue != NULL )
 	{
-		return;
+		RESOLVE_REQUEST *rr = ( RESOLVE_REQUEST * )g_resolve_queue->data;
+
+		DLL_RemoveNode( &g_resolve_queue, &rr->queue_node );
+
+		GlobalFree( rr->key );
+		GlobalFree( rr->host );
+		GlobalFree( rr );
 	}
 
-	unsigned int host_length = 0;
-	unsigned int resource_length = 0;
+	LeaveCriticalSection( &resolve_queue_cs );
 
-	ParseURL_W( di->url, NULL, protocol, &host, host_length, port, &resource, resource_length, NULL, NULL, NULL, NULL );
+	CloseHandle( g_resolver_semaphore );
+	g_resolver_semaphore = NULL;
 
-	wchar_t *w_resource;
+	_ExitThread( 0 );
+	return 0;
+}
 
-	if ( protocol == PROTOCOL_FTP ||
-		 protocol == PROTOCOL_FTPS ||
-		 protocol == PROTOCOL_FTPES )
-	{
-		w_resource = url_decode_w( resource, resource_length, &resource_length );
+// Unlinks and frees an address from the context's address list.
+void RemoveAddressInfo( SOCKET_CONTEXT *context, addrinfoW *address_info )
+{
+	addrinfoW **next = &context->address_info;
 
-		if ( w_resource != NULL )
+	while ( *next != NULL )
+	{
+		if ( *next == address_info )
 		{
-			GlobalFree( resource );
-			resource = w_resource;
+			*next = address_info->ai_next;
+			address_info->ai_next = NULL;
+
+			FreeAddressInfo( address_info );
+
+			break;
 		}
+
+		next = &( *next )->ai_next;
 	}
+}
 
-	w_resource = resource;
+// Moves an address to the front of the context's address list.
+// The front is the address that we're connected to, or that RetryTimedOut() will move past.
+void PromoteAddressInfo( SOCKET_CONTEXT *context, addrinfoW *address_info )
+{
+	addrinfoW **next = &context->address_info;
 
-	if ( protocol != PROTOCOL_FTP &&
-		 protocol != PROTOCOL_FTPS &&
-		 protocol != PROTOCOL_FTPES )
+	while ( *next != NULL )
 	{
-		while ( *w_resource != NULL )
+		if ( *next == address_info )
 		{
-			if ( *w_resource == L'#' )
-			{
-				*w_resource = 0;
-				resource_length = ( unsigned int )( w_resource - resource );
+			*next = address_info->ai_next;
 
-				break;
-			}
+			address_info->ai_next = context->address_info;
+			context->address_info = address_info;
 
-			++w_resource;
+			break;
 		}
-	}
 
-	/*w_resource = url_encode_w( resource, resource_length, &w_resource_length );
+		next = &( *next )->ai_next;
+	}
+}
 
-	// Did we encode anything?
-	if ( resource_length != w_resource_length )
+// Creates a socket that's associated with the completion port and bound so that it can be used with ConnectEx.
+SOCKET CreateConnectSocket( bool use_ipv6 )
+{
+	int nRet;
+
+	SOCKET socket = CreateSocket( use_ipv6 );
+	if ( socket == INVALID_SOCKET )
 	{
-		GlobalFree( resource );
-		resource = w_resource;
+		return INVALID_SOCKET;
+	}
 
-		resource_length = w_resource_length;
+	HANDLE hIOCP = CreateIoCompletionPort( ( HANDLE )socket, g_hIOCP, 0/*( ULONG_PTR )context*/, 0 );
+	if ( hIOCP == NULL )
+	{
+		_closesocket( socket );
+
+		return INVALID_SOCKET;
+	}
+
+	// Socket must be bound before we can use it with ConnectEx.
+	struct sockaddr_in ipv4_addr;
+	struct sockaddr_in6 ipv6_addr;
+
+	if ( use_ipv6 )
+	{
+		_memzero( &ipv6_addr, sizeof( ipv6_addr ) );
+		ipv6_addr.sin6_family = AF_INET6;
+		//ipv6_addr.sin6_addr = in6addr_any;	// This assignment requires the CRT, but it's all zeros anyway and it gets set by _memzero().
+		//ipv6_addr.sin6_port = 0;
+		nRet = _bind( socket, ( SOCKADDR * )&ipv6_addr, sizeof( ipv6_addr ) );
 	}
 	else
 	{
-		GlobalFree( w_resource );
-	}*/
+		_memzero( &ipv4_addr, sizeof( ipv4_addr ) );
+		ipv4_addr.sin_family = AF_INET;
+		//ipv4_addr.sin_addr.s_addr = INADDR_ANY;
+		//ipv4_addr.sin_port = 0;
+		nRet = _bind( socket, ( SOCKADDR * )&ipv4_addr, sizeof( ipv4_addr ) );
+	}
 
-	if ( normaliz_state == NORMALIZ_STATE_RUNNING )
+	if ( nRet == SOCKET_ERROR )
 	{
-		int punycode_length = _IdnToAscii( 0, host, host_length, NULL, 0 );
-
-		if ( ( unsigned int )punycode_length > host_length )
-		{
-			wchar_t *punycode = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( punycode_length + 1 ) );
-			host_length = _IdnToAscii( 0, host, host_length, punycode, punycode_length );
-			punycode[ host_length ] = 0;	// Sanity.
+		_closesocket( socket );
 
-			GlobalFree( host );
-			host = punycode;
-		}
+		return INVALID_SOCKET;
 	}
 
-	unsigned char part = 1;
-
-	//EnterCriticalSection( &cleanup_cs );
+	return socket;
+}
 
-	// If the number of ranges is less than the total number of parts that's been set for the download,
-	// then the remaining ranges will be split to equal the total number of parts.
-	UpdateRangeList( di );
+// Sets the timer that starts a second connection attempt to the host's next address.
+// Must be done before the first attempt is made so that its completion can always see the timer.
+void StartConnectRace( SOCKET_CONTEXT *context )
+{
+	context->connect_race = CONNECT_RACE_WAITING;
 
-	di->print_range_list = di->range_list;
-	di->range_queue = NULL;
+	// The timer counts as a pending operation until it either fires or is removed.
+	InterlockedIncrement( &context->pending_operations );
 
-	DoublyLinkedList *range_node = di->range_list;
+	AddSchedulerTimer( &context->race_timer, context, CONNECT_RACE_DELAY );
+}
 
-	while ( range_node != di->range_list_end )
+// Removes the timer of a race that hasn't started its second attempt yet.
+void StopConnectRace( SOCKET_CONTEXT *context )
+{
+	if ( context->connect_race == CONNECT_RACE_WAITING )
 	{
-		RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
+		bool removed = false;
 
-		// Check if our range still needs to download.
-		if ( ri != NULL && ( ri->content_offset < ( ( ri->range_end - ri->range_start ) + 1 ) ) )
+		EnterCriticalSection( &timer_wheel_cs );
+
+		// If the timer has already fired, then IO_StartConnectRace will see that the race is over.
+		if ( context->race_timer.active )
 		{
-			// Split the remaining range_list off into the range_queue.
-			if ( di->parts_limit > 0 && part > di->parts_limit )
-			{
-				di->range_queue = range_node;
+			TW_RemoveTimer( &g_scheduler_wheel, &context->race_timer );
 
-				break;
-			}
+			removed = true;
+		}
 
-			// Check the state of our downloads/queue once.
-			if ( add_state == 0 )
-			{
-				if ( total_downloading < cfg_max_downloads )
-				{
-					add_state = 1;	// Create the connection.
+		LeaveCriticalSection( &timer_wheel_cs );
 
-					// Set the start time only if we've manually started the download.
-					if ( di->start_time.QuadPart == 0 )
-					{
-						FILETIME ft;
-						GetSystemTimeAsFileTime( &ft );
-						di->start_time.LowPart = ft.dwLowDateTime;
-						di->start_time.HighPart = ft.dwHighDateTime;
-					}
+		if ( removed )
+		{
+			InterlockedDecrement( &context->pending_operations );
+		}
 
-					di->status = STATUS_CONNECTING;	// Connecting.
+		context->connect_race = CONNECT_RACE_NONE;
+	}
+}
 
-					EnableTimers( true );
+// Connects to the next address after the first in the address list. Addresses that fail right away are removed.
+bool StartRaceAttempt( SOCKET_CONTEXT *context )
+{
+	addrinfoW *address_info = ( context->address_info != NULL ? context->address_info->ai_next : NULL );
 
-					EnterCriticalSection( &active_download_list_cs );
+	while ( address_info != NULL )
+	{
+		addrinfoW *next_address_info = address_info->ai_next;
 
-					// Add to the global active download list.
-					di->download_node.data = di;
-					DLL_AddNode( &active_download_list, &di->download_node, -1 );
+		SOCKET socket = CreateConnectSocket( ( address_info->ai_family == AF_INET6 ) );
+		if ( socket != INVALID_SOCKET )
+		{
+			context->race_socket = socket;
+			context->race_address_info = address_info;
 
-					++total_downloading;
+			InterlockedIncrement( &context->pending_operations );
 
-					LeaveCriticalSection( &active_download_list_cs );
-				}
-				else
-				{
-					add_state = 2;	// Queue the download.
+			_memzero( &context->overlapped_race.overlapped, sizeof( WSAOVERLAPPED ) );
 
-					di->status = STATUS_CONNECTING | STATUS_QUEUED;	// Queued.
+			context->overlapped_race.current_operation = IO_ConnectRace;
 
-					EnterCriticalSection( &download_queue_cs );
-					
-					// Add to the global download queue.
-					di->queue_node.data = di;
-					DLL_AddNode( &download_queue, &di->queue_node, -1 );
+			DWORD lpdwBytesSent = 0;
+			BOOL bRet = _ConnectEx( socket, address_info->ai_addr, ( int )address_info->ai_addrlen, NULL, 0, &lpdwBytesSent, ( OVERLAPPED * )&context->overlapped_race );
+			if ( bRet == FALSE && ( _WSAGetLastError() != ERROR_IO_PENDING ) )
+			{
+				InterlockedDecrement( &context->pending_operations );
 
-					LeaveCriticalSection( &download_queue_cs );
-				}
+				_closesocket( socket );
+
+				context->race_socket = INVALID_SOCKET;
+				context->race_address_info = NULL;
 			}
+			else
+			{
+				context->connect_race = CONNECT_RACE_RUNNING;
 
-			di->last_downloaded = di->downloaded;
+				return true;
+			}
+		}
 
-			if ( add_state == 1 )
-			{
-				// Save the request information, the header information (if we got any), and create a new connection.
-				SOCKET_CONTEXT *context = CreateSocketContext();
+		RemoveAddressInfo( context, address_info );
 
-				if ( protocol == PROTOCOL_FTP ||
-					 protocol == PROTOCOL_FTPS ||
-					 protocol == PROTOCOL_FTPES )
-				{
-					context->ftp_connection_type = FTP_CONNECTION_TYPE_CONTROL;
-				}
+		address_info = next_address_info;
+	}
 
-				context->processed_header = di->processed_header;
+	return false;
+}
 
-				context->part = part;
-				context->parts = di->parts;
+// Decides how a completed connection attempt is handled while a connect race is in progress.
+// racer is true for the second attempt's completion. The context_cs must be held.
+char UpdateConnectRace( SOCKET_CONTEXT *context, bool racer, bool connected )
+{
+	char ret = CONNECT_RACE_CONTINUE;
 
-				// If we've processed the header, then we would have already gotten a content disposition filename.
-				if ( di->processed_header )
+	if ( !racer )
+	{
+		switch ( context->connect_race )
+		{
+			case CONNECT_RACE_WAITING:	// We didn't need a second attempt.
+			{
+				StopConnectRace( context );
+			}
+			break;
+
+			case CONNECT_RACE_RUNNING:
+			{
+				if ( !connected )
 				{
-					context->got_filename = 1;
-				}
+					// Let the second attempt continue on its own. Its completion will be handled as ours.
+					if ( context->socket != INVALID_SOCKET )
+					{
+						_closesocket( context->socket );
+						context->socket = INVALID_SOCKET;
+					}
 
-				context->request_info.port = port;
-				context->request_info.protocol = protocol;
+					context->connect_race = CONNECT_RACE_ALONE;
 
-				int cfg_val_length = WideCharToMultiByte( CP_UTF8, 0, host, host_length + 1, NULL, 0, NULL, NULL );
-				char *utf8_cfg_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * cfg_val_length ); // Size includes the null character.
-				WideCharToMultiByte( CP_UTF8, 0, host, host_length + 1, utf8_cfg_val, cfg_val_length, NULL, NULL );
+					ret = CONNECT_RACE_SKIP;
+				}
+				else	// We won. Cancel the second attempt.
+				{
+					if ( context->race_socket != INVALID_SOCKET )
+					{
+						_closesocket( context->race_socket );
+						context->race_socket = INVALID_SOCKET;
+					}
 
-				context->request_info.host = utf8_cfg_val;
+					context->connect_race = CONNECT_RACE_NONE;
+				}
+			}
+			break;
 
-				cfg_val_length = WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, NULL, 0, NULL, NULL );
-				utf8_cfg_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * cfg_val_length ); // Size includes the null character.
-				WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, utf8_cfg_val, cfg_val_length, NULL, NULL );
+			case CONNECT_RACE_WON:	// The context's socket is now the second attempt's.
+			{
+				context->connect_race = CONNECT_RACE_NONE;
 
-				context->request_info.resource = utf8_cfg_val;
+				ret = CONNECT_RACE_CONNECTED;
+			}
+			break;
+		}
+	}
+	else
+	{
+		switch ( context->connect_race )
+		{
+			case CONNECT_RACE_RUNNING:
+			{
+				if ( connected && context->cleanup == 0 )
+				{
+					// Cancel the first attempt. Its completion will continue with our socket.
+					SOCKET s = context->socket;
+					context->socket = context->race_socket;
+					context->race_socket = INVALID_SOCKET;
 
-				context->download_info = di;
+					if ( s != INVALID_SOCKET )
+					{
+						_closesocket( s );
+					}
 
-				ri->range_start += ri->content_offset;	// Begin where we left off.
-				ri->content_offset = 0;	// Reset.
+					PromoteAddressInfo( context, context->race_address_info );
+					context->race_address_info = NULL;
 
-				context->header_info.range_info = ri;
+					context->connect_race = CONNECT_RACE_WON;
 
-				if ( di->cookies != NULL )
+					ret = CONNECT_RACE_SKIP;
+				}
+				else
 				{
-					char *new_cookies = NULL;
-
-					// This value will be saved
-					if ( !ParseCookieValues( di->cookies, &context->header_info.cookie_tree, &new_cookies ) )
+					if ( context->race_socket != INVALID_SOCKET )
 					{
-						GlobalFree( new_cookies );
-						new_cookies = NULL;
+						_closesocket( context->race_socket );
+						context->race_socket = INVALID_SOCKET;
 					}
 
-					// If we got a new cookie.
-					if ( new_cookies != NULL )
+					context->connect_race = CONNECT_RACE_NONE;
+
+					if ( !connected && context->cleanup == 0 )
 					{
-						// Then see if the new cookie is not blank.
-						if ( new_cookies[ 0 ] != NULL )
-						{
-							context->header_info.cookies = new_cookies;
-						}
-						else	// Otherwise, if the cookie is blank, then free it.
+						RemoveAddressInfo( context, context->race_address_info );
+						context->race_address_info = NULL;
+
+						// Try the next address while the first attempt continues.
+						if ( StartRaceAttempt( context ) )
 						{
-							GlobalFree( new_cookies );
+							ret = CONNECT_RACE_SKIP;
 						}
 					}
 				}
+			}
+			break;
 
-				//
+			case CONNECT_RACE_ALONE:
+			{
+				context->connect_race = CONNECT_RACE_NONE;
 
-				// Add to the parts list.
-				context->parts_node.data = context;
+				if ( connected )
+				{
+					context->socket = context->race_socket;
+					context->race_socket = INVALID_SOCKET;
 
-				EnterCriticalSection( &di->shared_cs );
+					PromoteAddressInfo( context, context->race_address_info );
+					context->race_address_info = NULL;
 
-				DLL_AddNode( &di->parts_list, &context->parts_node, -1 );
+					ret = CONNECT_RACE_CONNECTED;
+				}
+				else
+				{
+					if ( context->race_socket != INVALID_SOCKET )
+					{
+						_closesocket( context->race_socket );
+						context->race_socket = INVALID_SOCKET;
+					}
 
-				++( di->active_parts );
+					// RetryTimedOut() will move past the first attempt's address.
+					RemoveAddressInfo( context, context->race_address_info );
+					context->race_address_info = NULL;
 
-				LeaveCriticalSection( &di->shared_cs );
+					ret = CONNECT_RACE_FAILED;
+				}
+			}
+			break;
 
-				//
+			default:	// The race was called off.
+			{
+				if ( context->race_socket != INVALID_SOCKET )
+				{
+					_closesocket( context->race_socket );
+					context->race_socket = INVALID_SOCKET;
+				}
 
-				// Add to the global download list.
-				context->context_node.data = context;
+				context->race_address_info = NULL;
+			}
+			break;
+		}
+	}
 
-				EnterCriticalSection( &context_list_cs );
+	return ret;
+}
 
-				DLL_AddNode( &g_context_list, &context->context_node, 0 );
+// Only direct HTTP and HTTPS connections are pooled. A proxied connection is tied to the state of its tunnel.
+bool IsPoolableConnection( SOCKET_CONTEXT *context )
+{
+	return ( context != NULL &&
+			 context->download_info != NULL &&
+		   ( context->request_info.protocol == PROTOCOL_HTTP || context->request_info.protocol == PROTOCOL_HTTPS ) &&
+			!cfg_enable_proxy && !cfg_enable_proxy_s && !cfg_enable_proxy_socks );
+}
 
-				LeaveCriticalSection( &context_list_cs );
+// The connection can be pooled if its response has been read in its entirety and the server will keep it open.
+// Chunked responses aren't pooled since trailer fields might follow the last chunk.
+bool IsConnectionReusable( SOCKET_CONTEXT *context )
+{
+	if ( g_end_program ||
+		!IsPoolableConnection( context ) ||
+		 context->socket == INVALID_SOCKET ||
+		 context->timed_out != TIME_OUT_FALSE ||
+		 context->status != STATUS_DOWNLOADING ||
+		 context->header_info.connection != CONNECTION_KEEP_ALIVE ||
+		 context->header_info.chunked_transfer ||
+	   ( context->header_info.http_status != 200 && context->header_info.http_status != 206 ) ||
+		 context->header_info.range_info == NULL ||
+		 context->header_info.range_info->content_length == 0 )
+	{
+		return false;
+	}
 
-				//
+	// Anything beyond the end of our range is still in the socket.
+	if ( GetBufferedContentOffset( context ) != ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) )
+	{
+		return false;
+	}
 
-				context->status = STATUS_CONNECTING;
-
-				if ( !CreateConnection( context, context->request_info.host, context->request_info.port ) )
-				{
-					context->status = STATUS_FAILED;
+	// Nor can there be any data that's been received but not yet decrypted.
+	if ( context->ssl != NULL && ( context->ssl->cbIoBuffer > 0 || context->ssl->cbRecDataBuf > 0 || context->ssl->continue_decrypt ) )
+	{
+		return false;
+	}
 
-					InterlockedIncrement( &context->pending_operations );
+	return true;
+}
 
-					context->overlapped.current_operation = IO_Close;
+void ClosePooledConnection( POOLED_CONNECTION *pc )
+{
+	if ( pc->socket != INVALID_SOCKET )
+	{
+		_shutdown( pc->socket, SD_BOTH );
+		_closesocket( pc->socket );
+	}
 
-					PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context, ( OVERLAPPED * )&context->overlapped );
-				}
-			}
-			else if ( add_state == 2 )
-			{
-				add_state = 3;	// Skip adding anymore values to the queue.
+	SSL_free( pc->ssl );
 
-				EnterCriticalSection( &di->shared_cs );
+	GlobalFree( pc->host );
+	GlobalFree( pc );
+}
 
-				di->active_parts = 0;
+// Moves the context's socket and SSL/TLS session into the connection pool. The context must have no pending operations.
+bool ParkConnection( SOCKET_CONTEXT *context )
+{
+	if ( !IsConnectionReusable( context ) )
+	{
+		return false;
+	}
 
-				LeaveCriticalSection( &di->shared_cs );
-			}
+	POOLED_CONNECTION *pc = ( POOLED_CONNECTION * )GlobalAlloc( GPTR, sizeof( POOLED_CONNECTION ) );
+	if ( pc == NULL )
+	{
+		return false;
+	}
 
-			++part;
-		}
+	pc->host = GlobalStrDupA( context->request_info.host );
+	if ( pc->host == NULL )
+	{
+		GlobalFree( pc );
 
-		range_node = range_node->next;
+		return false;
 	}
 
-	//LeaveCriticalSection( &cleanup_cs );
+	pc->pool_node.data = pc;
+	pc->idle_time = TW_GetTickCount();
+	pc->ssl = context->ssl;
+	pc->socket = context->socket;
+	pc->protocol = context->request_info.protocol;
+	pc->port = context->request_info.port;
+	pc->ssl_version = context->download_info->ssl_version;
 
-	GlobalFree( host );
-	GlobalFree( resource );
-}
+	context->ssl = NULL;
+	context->socket = INVALID_SOCKET;
 
-dllrbt_tree *CreateFilenameTree()
-{
-	DOWNLOAD_INFO *di = NULL;
-	wchar_t *filename = NULL;
+	POOLED_CONNECTION *evicted_pc = NULL;
 
-	// Make a tree of active and queued downloads to find filenames that need to be renamed.
-	dllrbt_tree *filename_tree = dllrbt_create( dllrbt_compare_w );
+	EnterCriticalSection( &connection_pool_cs );
 
-	EnterCriticalSection( &download_queue_cs );
+	bool was_empty = ( g_connection_pool == NULL );
 
-	DoublyLinkedList *tmp_node = download_queue;
-	while ( tmp_node != NULL )
+	// Make room by closing the connection that's been idle the longest.
+	if ( g_connection_pool_count >= CONNECTION_POOL_SIZE )
 	{
-		di = ( DOWNLOAD_INFO * )tmp_node->data;
-		if ( di != NULL )
-		{
-			filename = GlobalStrDupW( di->file_path + di->filename_offset );
+		evicted_pc = ( POOLED_CONNECTION * )g_connection_pool->data;
 
-			if ( dllrbt_insert( filename_tree, ( void * )filename, ( void * )filename ) != DLLRBT_STATUS_OK )
-			{
-				GlobalFree( filename );
-			}
-		}
+		DLL_RemoveNode( &g_connection_pool, &evicted_pc->pool_node );
 
-		tmp_node = tmp_node->next;
+		--g_connection_pool_count;
 	}
 
-	LeaveCriticalSection( &download_queue_cs );
-
-	EnterCriticalSection( &active_download_list_cs );
+	DLL_AddNode( &g_connection_pool, &pc->pool_node, -1 );
 
-	tmp_node = active_download_list;
-	while ( tmp_node != NULL )
-	{
-		di = ( DOWNLOAD_INFO * )tmp_node->data;
-		if ( di != NULL )
-		{
-			filename = GlobalStrDupW( di->file_path + di->filename_offset );
+	++g_connection_pool_count;
 
-			if ( dllrbt_insert( filename_tree, ( void * )filename, ( void * )filename ) != DLLRBT_STATUS_OK )
-			{
-				GlobalFree( filename );
-			}
-		}
+	LeaveCriticalSection( &connection_pool_cs );
 
-		tmp_node = tmp_node->next;
+	if ( evicted_pc != NULL )
+	{
+		ClosePooledConnection( evicted_pc );
 	}
 
-	LeaveCriticalSection( &active_download_list_cs );
+	// The scheduler keeps the timer going while the pool has connections.
+	if ( was_empty )
+	{
+		AddSchedulerTimer( &g_connection_pool_timer, NULL, CONNECTION_POOL_IDLE_TIMEOUT );
+	}
 
-	return filename_tree;
+	return true;
 }
 
-void DestroyFilenameTree( dllrbt_tree *filename_tree )
+// Gives the context the most recently pooled connection to its host, if there is one.
+bool TakePooledConnection( SOCKET_CONTEXT *context )
 {
-	// The tree is only used to determine duplicate filenames.
-	node_type *node = dllrbt_get_head( filename_tree );
-	while ( node != NULL )
+	if ( !IsPoolableConnection( context ) || context->request_info.host == NULL )
+	{
+		return false;
+	}
+
+	POOLED_CONNECTION *pc = NULL;
+	DoublyLinkedList *expired_list = NULL;
+
+	unsigned long long current_time = TW_GetTickCount();
+
+	EnterCriticalSection( &connection_pool_cs );
+
+	DoublyLinkedList *pool_node = g_connection_pool;
+	while ( pool_node != NULL )
 	{
-		wchar_t *filename = ( wchar_t * )node->val;
+		POOLED_CONNECTION *t_pc = ( POOLED_CONNECTION * )pool_node->data;
 
-		if ( filename != NULL )
+		pool_node = pool_node->next;
+
+		if ( ( current_time - t_pc->idle_time ) >= CONNECTION_POOL_IDLE_TIMEOUT )
+		{
+			DLL_RemoveNode( &g_connection_pool, &t_pc->pool_node );
+			DLL_AddNode( &expired_list, &t_pc->pool_node, -1 );
+
+			--g_connection_pool_count;
+		}
+		else if ( t_pc->protocol == context->request_info.protocol &&
+				  t_pc->port == context->request_info.port &&
+				  t_pc->ssl_version == context->download_info->ssl_version &&
+				  lstrcmpiA( t_pc->host, context->request_info.host ) == 0 )
 		{
-			GlobalFree( filename );
+			pc = t_pc;	// Keep looking for a more recent one.
 		}
+	}
+
+	if ( pc != NULL )
+	{
+		DLL_RemoveNode( &g_connection_pool, &pc->pool_node );
 
-		node = node->next;
+		--g_connection_pool_count;
 	}
-	dllrbt_delete_recursively( filename_tree );
-}
 
-bool RenameFile( DOWNLOAD_INFO *di, dllrbt_tree *filename_tree, wchar_t *file_path, unsigned int filename_offset, unsigned int file_extension_offset )
-{
-	unsigned int rename_count = 0;
+	LeaveCriticalSection( &connection_pool_cs );
 
-	// The maximum folder path length is 248 (including the trailing '\').
-	// The maximum file name length in the case above is 11 (not including the NULL terminator).
-	// The total is 259 characters (not including the NULL terminator).
-	// MAX_PATH is 260.
+	while ( expired_list != NULL )
+	{
+		POOLED_CONNECTION *t_pc = ( POOLED_CONNECTION * )expired_list->data;
 
-	// We don't want to overwrite the download info until the very end.
-	wchar_t new_file_path[ MAX_PATH ];
-	_wmemcpy_s( new_file_path, MAX_PATH, file_path, MAX_PATH );
+		DLL_RemoveNode( &expired_list, &t_pc->pool_node );
 
-	new_file_path[ filename_offset - 1 ] = L'\\';	// Replace the download directory NULL terminator with a directory slash.
+		ClosePooledConnection( t_pc );
+	}
 
-	do
+	if ( pc == NULL )
 	{
-		while ( dllrbt_find( filename_tree, ( void * )( new_file_path + filename_offset ), false ) != NULL )
-		{
-			// If there's a file extension, then put the counter before it.
-			int ret = __snwprintf( new_file_path + file_extension_offset, MAX_PATH - file_extension_offset - 1, L" (%lu)%s", ++rename_count, file_path + file_extension_offset );
-
-			// Can't rename.
-			if ( ret < 0 )
-			{
-				return false;
-			}
-		}
+		return false;
+	}
 
-		// Add the new filename to the add files tree.
-		wchar_t *filename = GlobalStrDupW( new_file_path + filename_offset );
+	context->socket = pc->socket;
+	context->ssl = pc->ssl;
 
-		if ( dllrbt_insert( filename_tree, ( void * )filename, ( void * )filename ) != DLLRBT_STATUS_OK )
-		{
-			GlobalFree( filename );
-		}
+	if ( context->ssl != NULL )
+	{
+		context->ssl->s = context->socket;
 	}
-	while ( GetFileAttributesW( new_file_path ) != INVALID_FILE_ATTRIBUTES );
 
-	// Set the new filename.
-	_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, new_file_path + filename_offset, MAX_PATH - di->filename_offset );
-	di->file_path[ MAX_PATH - 1 ] = 0;	// Sanity.
+	context->reused_connection = true;
 
-	// Get the new file extension offset.
-	di->file_extension_offset = di->filename_offset + get_file_extension_offset( di->file_path + di->filename_offset, lstrlenW( di->file_path + di->filename_offset ) );
+	GlobalFree( pc->host );
+	GlobalFree( pc );
 
 	return true;
 }
 
-ICON_INFO *CacheIcon( DOWNLOAD_INFO *di, SHFILEINFO *sfi )
+// Closes the idle connections to the context's host.
+void DiscardPooledConnections( SOCKET_CONTEXT *context )
 {
-	ICON_INFO *ii = NULL;
-
-	if ( di != NULL && sfi != NULL )
+	if ( context == NULL || context->request_info.host == NULL )
 	{
-		// Cache our file's icon.
-		EnterCriticalSection( &icon_cache_cs );
-		ii = ( ICON_INFO * )dllrbt_find( g_icon_handles, ( void * )( di->file_path + di->file_extension_offset ), true );
-		if ( ii == NULL )
-		{
-			bool destroy = true;
-			#ifndef OLE32_USE_STATIC_LIB
-				if ( ole32_state == OLE32_STATE_SHUTDOWN )
-				{
-					destroy = InitializeOle32();
-				}
-			#endif
-
-			if ( destroy )
-			{
-				_CoInitializeEx( NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE );
-			}
-
-			// Use an unknown file type icon for extensionless files.
-			_SHGetFileInfoW( ( di->file_path[ di->file_extension_offset ] != 0 ? di->file_path + di->file_extension_offset : L" " ), FILE_ATTRIBUTE_NORMAL, sfi, sizeof( SHFILEINFO ), SHGFI_USEFILEATTRIBUTES | SHGFI_ICON | SHGFI_SMALLICON );
+		return;
+	}
 
-			if ( destroy )
-			{
-				_CoUninitialize();
-			}
+	DoublyLinkedList *discard_list = NULL;
 
-			ii = ( ICON_INFO * )GlobalAlloc( GMEM_FIXED, sizeof( DOWNLOAD_INFO ) );
+	EnterCriticalSection( &connection_pool_cs );
 
-			ii->file_extension = GlobalStrDupW( di->file_path + di->file_extension_offset );
-			ii->icon = sfi->hIcon;
+	DoublyLinkedList *pool_node = g_connection_pool;
+	while ( pool_node != NULL )
+	{
+		POOLED_CONNECTION *pc = ( POOLED_CONNECTION * )pool_node->data;
 
-			ii->count = 1;
+		pool_node = pool_node->next;
 
-			if ( dllrbt_insert( g_icon_handles, ( void * )ii->file_extension, ( void * )ii ) != DLLRBT_STATUS_OK )
-			{
-				DestroyIcon( ii->icon );
-				GlobalFree( ii->file_extension );
-				GlobalFree( ii );
-				ii = NULL;
-			}
-		}
-		else
+		if ( pc->protocol == context->request_info.protocol &&
+			 pc->port == context->request_info.port &&
+			 lstrcmpiA( pc->host, context->request_info.host ) == 0 )
 		{
-			++( ii->count );
+			DLL_RemoveNode( &g_connection_pool, &pc->pool_node );
+			DLL_AddNode( &discard_list, &pc->pool_node, -1 );
+
+			--g_connection_pool_count;
 		}
-		LeaveCriticalSection( &icon_cache_cs );
 	}
 
-	return ii;
-}
+	LeaveCriticalSection( &connection_pool_cs );
 
-DWORD WINAPI AddURL( void *add_info )
-{
-	if ( add_info == NULL )
+	while ( discard_list != NULL )
 	{
-		_ExitThread( 0 );
-		return 0;
-	}
+		POOLED_CONNECTION *pc = ( POOLED_CONNECTION * )discard_list->data;
 
-	EnterCriticalSection( &worker_cs );
+		DLL_RemoveNode( &discard_list, &pc->pool_node );
 
-	in_worker_thread = true;
+		ClosePooledConnection( pc );
+	}
+}
 
-	ProcessingList( true );
+// Closes the connections that have been idle for too long.
+// Returns the number of milliseconds until the next connection expires, or INFINITE if the pool is empty.
+// Called by the scheduler while it holds timer_wheel_cs.
+unsigned long PruneConnectionPool()
+{
+	unsigned long delay = INFINITE;
 
-	ADD_INFO *ai = ( ADD_INFO * )add_info;
+	unsigned long long current_time = TW_GetTickCount();
 
-	wchar_t *url_list = ai->urls;
+	EnterCriticalSection( &connection_pool_cs );
 
-	wchar_t *host = NULL;
-	wchar_t *resource = NULL;
+	// The longest idle connections are at the head.
+	while ( g_connection_pool != NULL )
+	{
+		POOLED_CONNECTION *pc = ( POOLED_CONNECTION * )g_connection_pool->data;
 
-	PROTOCOL protocol = PROTOCOL_UNKNOWN;
-	unsigned short port = 0;
+		if ( ( current_time - pc->idle_time ) < CONNECTION_POOL_IDLE_TIMEOUT )
+		{
+			delay = ( unsigned long )( CONNECTION_POOL_IDLE_TIMEOUT - ( current_time - pc->idle_time ) );
 
-	unsigned int host_length = 0;
-	unsigned int resource_length = 0;
+			break;
+		}
 
-	wchar_t *url_username = NULL;
-	wchar_t *url_password = NULL;
+		DLL_RemoveNode( &g_connection_pool, &pc->pool_node );
 
-	unsigned int url_username_length = 0;
-	unsigned int url_password_length = 0;
+		--g_connection_pool_count;
 
-	int ai_username_length = 0;	// The original length from our auth_info struct.
-	int ai_password_length = 0;
+		ClosePooledConnection( pc );
+	}
 
-	char *username = NULL;
-	char *password = NULL;
+	LeaveCriticalSection( &connection_pool_cs );
 
-	int username_length = 0;
-	int password_length = 0;
-	int cookies_length = 0;
-	int headers_length = 0;
-	int data_length = 0;
+	return delay;
+}
 
-	if ( ai->auth_info.username != NULL )
-	{
-		username = ai->auth_info.username;
-		username_length = ai_username_length = lstrlenA( username );
-	}
+void FreeConnectionPool()
+{
+	EnterCriticalSection( &timer_wheel_cs );
 
-	if ( ai->auth_info.password != NULL )
-	{
-		password = ai->auth_info.password;
-		password_length = ai_password_length = lstrlenA( password );
-	}
+	TW_RemoveTimer( &g_scheduler_wheel, &g_connection_pool_timer );
 
-	if ( ai->utf8_cookies != NULL )
-	{
-		cookies_length = lstrlenA( ai->utf8_cookies );
-	}
+	LeaveCriticalSection( &timer_wheel_cs );
 
-	if ( ai->utf8_headers != NULL )
-	{
-		headers_length = lstrlenA( ai->utf8_headers );
-	}
+	EnterCriticalSection( &connection_pool_cs );
 
-	if ( ai->utf8_data != NULL )
+	while ( g_connection_pool != NULL )
 	{
-		data_length = lstrlenA( ai->utf8_data );
-	}
+		POOLED_CONNECTION *pc = ( POOLED_CONNECTION * )g_connection_pool->data;
 
-	if ( ai->method == METHOD_NONE )
-	{
-		ai->method = METHOD_GET;
+		DLL_RemoveNode( &g_connection_pool, &pc->pool_node );
+
+		ClosePooledConnection( pc );
 	}
 
-	SHFILEINFO *sfi = ( SHFILEINFO * )GlobalAlloc( GMEM_FIXED, sizeof( SHFILEINFO ) );
+	g_connection_pool_count = 0;
 
-	// Creates a tree of active and queued downloads.
-	dllrbt_tree *add_files_tree = CreateFilenameTree();
+	LeaveCriticalSection( &connection_pool_cs );
+}
 
-	while ( url_list != NULL )
+bool CreateConnection( SOCKET_CONTEXT *context, char *host, unsigned short port )
+{
+	if ( context == NULL || host == NULL )
 	{
-		// Stop processing and exit the thread.
-		if ( kill_worker_thread_flag )
-		{
-			break;
-		}
-
-		// See if we're overwriting the filename.
-		wchar_t *filename_start = url_list;
-		wchar_t *filename_end;
+		return false;
+	}
 
-		unsigned int w_filename_length = 0;
+	context->reused_connection = false;
 
-		if ( *filename_start == L'[' )
-		{
-			++filename_start;
-			url_list = filename_start;
+	// Skip the connection and SSL/TLS handshake if there's an idle connection to the host.
+	if ( TakePooledConnection( context ) )
+	{
+		InterlockedIncrement( &context->pending_operations );
 
-			while ( *url_list != 0 )
-			{
-				if ( *url_list == L']' )
-				{
-					filename_end = url_list;
+		_memzero( &context->overlapped.overlapped, sizeof( WSAOVERLAPPED ) );
 
-					w_filename_length = ( unsigned int )( filename_end - filename_start );
+		// The worker threads will send our request as if the connection had just been established.
+		context->overlapped.current_operation = IO_Connect;
 
-					*url_list = 0;	// Sanity.
+		PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context, ( OVERLAPPED * )&context->overlapped );
 
-					EscapeFilename( filename_start );
+		return true;
+	}
 
-					++url_list;
+	int nRet = 0;
 
-					url_list = url_list;
+	struct addrinfoW hints;
 
-					break;
-				}
+	bool use_ipv6 = false;
 
-				++url_list;
-			}
-		}
+	wchar_t *whost = NULL, *t_whost = NULL;
+	wchar_t wcs_ip[ 16 ];
+	wchar_t wport[ 6 ];
 
-		// Remove anything before our URL (spaces, tabs, newlines, etc.)
-		while ( *url_list != 0 && ( ( *url_list != L'h' && *url_list != L'H' ) && ( *url_list != L'f' && *url_list != L'F' ) ) )
+	if ( context->address_info == NULL )
+	{
+		// Resolve the remote host.
+		if ( cfg_enable_proxy && context->request_info.protocol == PROTOCOL_HTTP )
 		{
-			++url_list;
-		}
+			__snwprintf( wport, 6, L"%hu", cfg_port );
 
-		// Find the end of the current url.
-		wchar_t *current_url = url_list;
+			if ( cfg_address_type == 0 )
+			{
+				whost = ( g_punycode_hostname != NULL ? g_punycode_hostname : cfg_hostname );
+			}
+			else
+			{
+				struct sockaddr_in src_addr;
+				_memzero( &src_addr, sizeof( sockaddr_in ) );
 
-		int current_url_length = 0;
+				src_addr.sin_family = AF_INET;
+				src_addr.sin_addr.s_addr = _htonl( cfg_ip_address );
 
-		bool decode_converted_resource = false;
-		unsigned int white_space_count = 0;
+				DWORD wcs_ip_length = 16;
+				_WSAAddressToStringW( ( SOCKADDR * )&src_addr, sizeof( struct sockaddr_in ), NULL, wcs_ip, &wcs_ip_length );
 
-		while ( *url_list != NULL )
-		{
-			if ( *url_list == L'%' )
-			{
-				decode_converted_resource = true;
+				whost = wcs_ip;
 			}
-			else if ( *url_list == L' ' )
+		}
+		else if ( cfg_enable_proxy_s && context->request_info.protocol == PROTOCOL_HTTPS )
+		{
+			__snwprintf( wport, 6, L"%hu", cfg_port_s );
+
+			if ( cfg_address_type_s == 0 )
 			{
-				++white_space_count;
+				whost = ( g_punycode_hostname_s != NULL ? g_punycode_hostname_s : cfg_hostname_s );
 			}
-			else if ( *url_list == L'\r' && *( url_list + 1 ) == L'\n' )
+			else
 			{
-				*url_list = 0;	// Sanity.
+				struct sockaddr_in src_addr;
+				_memzero( &src_addr, sizeof( sockaddr_in ) );
 
-				current_url_length = ( int )( url_list - current_url );
+				src_addr.sin_family = AF_INET;
+				src_addr.sin_addr.s_addr = _htonl( cfg_ip_address_s );
 
-				url_list += 2;
+				DWORD wcs_ip_length = 16;
+				_WSAAddressToStringW( ( SOCKADDR * )&src_addr, sizeof( struct sockaddr_in ), NULL, wcs_ip, &wcs_ip_length );
 
-				break;
+				whost = wcs_ip;
 			}
-
-			++url_list;
 		}
-
-		if ( *url_list == NULL )
+		else if ( cfg_enable_proxy_socks )
 		{
-			current_url_length = ( int )( url_list - current_url );
-
-			url_list = NULL;
-		}
+			__snwprintf( wport, 6, L"%hu", cfg_port_socks );
 
-		// Remove whitespace at the end of our URL.
-		while ( current_url_length > 0 )
-		{
-			if ( current_url[ current_url_length - 1 ] != L' ' && current_url[ current_url_length - 1 ] != L'\t' && current_url[ current_url_length - 1 ] != L'\f' )
+			if ( cfg_address_type_socks == 0 )
 			{
-				break;
+				whost = ( g_punycode_hostname_socks != NULL ? g_punycode_hostname_socks : cfg_hostname_socks );
 			}
 			else
 			{
-				if ( current_url[ current_url_length - 1 ] == L' ' )
-				{
-					--white_space_count;
-				}
+				struct sockaddr_in src_addr;
+				_memzero( &src_addr, sizeof( sockaddr_in ) );
 
-				current_url[ current_url_length - 1 ] = 0;	// Sanity.
+				src_addr.sin_family = AF_INET;
+				src_addr.sin_addr.s_addr = _htonl( cfg_ip_address_socks );
+
+				DWORD wcs_ip_length = 16;
+				_WSAAddressToStringW( ( SOCKADDR * )&src_addr, sizeof( struct sockaddr_in ), NULL, wcs_ip, &wcs_ip_length );
+
+				whost = wcs_ip;
 			}
+		}
+		else
+		{
+			__snwprintf( wport, 6, L"%hu", port );
 
-			--current_url_length;
+			int whost_length = MultiByteToWideChar( CP_UTF8, 0, host, -1, NULL, 0 );	// Include the NULL terminator.
+			whost = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * whost_length );
+			MultiByteToWideChar( CP_UTF8, 0, host, -1, whost, whost_length );
+
+			t_whost = whost;
 		}
 
-		wchar_t *current_url_encoded = NULL;
+		wchar_t *key = GetDNSCacheKey( whost, wport );
 
-		if ( white_space_count > 0 && *current_url != L'f' && *current_url != L'F' )
+		// Use the cached addresses of the host, or have the resolver thread look them up. CreateConnection() is called again once it has.
+		char cache_status = GetCachedAddressInfo( key, &context->address_info );
+		if ( cache_status == DNS_CACHE_MISS )
 		{
-			wchar_t *pstr = current_url;
-			current_url_encoded = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( current_url_length + ( white_space_count * 2 ) + 1 ) );
-			wchar_t *pbuf = current_url_encoded;
+			bool queued = QueueResolve( context, key, whost, wport );
 
-			while ( pstr < ( current_url + current_url_length ) )
-			{
-				if ( *pstr == L' ' )
-				{
-					pbuf[ 0 ] = L'%';
-					pbuf[ 1 ] = L'2';
-					pbuf[ 2 ] = L'0';
+			GlobalFree( t_whost );
 
-					pbuf = pbuf + 3;
-				}
-				else
-				{
-					*pbuf++ = *pstr;
-				}
+			return queued;
+		}
 
-				++pstr;
-			}
+		GlobalFree( key );
+		GlobalFree( t_whost );
 
-			*pbuf = L'\0';
+		if ( cache_status == DNS_CACHE_NEGATIVE )
+		{
+			return false;
 		}
+	}
 
-		// Reset.
-		protocol = PROTOCOL_UNKNOWN;
-		host = NULL;
-		resource = NULL;
-		port = 0;
+	// Retries might be on any of the host's addresses.
+	use_ipv6 = ( context->address_info->ai_family == AF_INET6 );
 
-		host_length = 0;
-		resource_length = 0;
+	if ( cfg_enable_proxy_socks &&
+		 context->proxy_address_info == NULL &&
+		 ( ( cfg_socks_type == SOCKS_TYPE_V4 && !cfg_resolve_domain_names_v4a ) ||
+		   ( cfg_socks_type == SOCKS_TYPE_V5 && !cfg_resolve_domain_names ) ) )
+	{
+		_memzero( &hints, sizeof( addrinfoW ) );
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_IP;
 
-		url_username = NULL;
-		url_password = NULL;
+		__snwprintf( wport, 6, L"%hu", context->request_info.port );
 
-		url_username_length = 0;
-		url_password_length = 0;
+		int whost_length = MultiByteToWideChar( CP_UTF8, 0, context->request_info.host, -1, NULL, 0 );	// Include the NULL terminator.
+		whost = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * whost_length );
+		MultiByteToWideChar( CP_UTF8, 0, context->request_info.host, -1, whost, whost_length );
+
+		nRet = _GetAddrInfoW( whost, wport, &hints, &context->proxy_address_info );
+		if ( nRet == WSAHOST_NOT_FOUND && cfg_socks_type == SOCKS_TYPE_V5 )	// Allow IPv6 for SOCKS 5
+		{
+			hints.ai_family = AF_INET6;	// Try IPv6
+			_GetAddrInfoW( whost, wport, &hints, &context->proxy_address_info );
+		}
+
+		GlobalFree( whost );
+	}
+
+	SOCKET socket = CreateConnectSocket( use_ipv6 );
+	if ( socket == INVALID_SOCKET )
+	{
+		return false;
+	}
+
+	context->socket = socket;
+
+	// If the host has more than one address, then race the next one against this one should it be slow to connect.
+	if ( context->address_info->ai_next != NULL )
+	{
+		StartConnectRace( context );
+	}
+
+	// Attempt to connect to the host.
+	InterlockedIncrement( &context->pending_operations );
+
+	context->overlapped.current_operation = IO_Connect;
+
+	DWORD lpdwBytesSent = 0;
+	BOOL bRet = _ConnectEx( socket, context->address_info->ai_addr, ( int )context->address_info->ai_addrlen, NULL, 0, &lpdwBytesSent, ( OVERLAPPED * )&context->overlapped );
+	if ( bRet == FALSE && ( _WSAGetLastError() != ERROR_IO_PENDING ) )
+	{
+		InterlockedDecrement( &context->pending_operations );
 
-		ParseURL_W( ( current_url_encoded != NULL ? current_url_encoded : current_url ), NULL, protocol, &host, host_length, port, &resource, resource_length, &url_username, &url_username_length, &url_password, &url_password_length );
+		StopConnectRace( context );
 
-		// The username and password could be encoded.
-		if ( url_username != NULL )
+		/*if ( context->address_info != NULL )
 		{
-			int val_length = WideCharToMultiByte( CP_UTF8, 0, url_username, url_username_length + 1, NULL, 0, NULL, NULL );
-			char *utf8_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * val_length ); // Size includes the null character.
-			WideCharToMultiByte( CP_UTF8, 0, url_username, url_username_length + 1, utf8_val, val_length, NULL, NULL );
+			_FreeAddrInfoW( context->address_info );
+		}*/
 
-			url_username_length = 0;
-			username = url_decode_a( utf8_val, val_length - 1, &url_username_length );
-			username_length = url_username_length;
-			GlobalFree( utf8_val );
+		return false;
+	}
 
-			//
+	/*if ( context->address_info != NULL )
+	{
+		_FreeAddrInfoW( context->address_info );
+	}*/
 
-			if ( url_password != NULL )
-			{
-				val_length = WideCharToMultiByte( CP_UTF8, 0, url_password, url_password_length + 1, NULL, 0, NULL, NULL );
-				utf8_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * val_length ); // Size includes the null character.
-				WideCharToMultiByte( CP_UTF8, 0, url_password, url_password_length + 1, utf8_val, val_length, NULL, NULL );
+	return true;
+}
 
-				url_password_length = 0;
-				password = url_decode_a( utf8_val, val_length - 1, &url_password_length );
-				password_length = url_password_length;
-				GlobalFree( utf8_val );
-			}
-			else
+void UpdateRangeList( DOWNLOAD_INFO *di )
+{
+	if ( di == NULL )
+	{
+		return;
+	}
+
+	RANGE_INFO *ri;
+	RANGE_INFO *ri_copy;
+	DoublyLinkedList *range_node = di->range_list;
+	DoublyLinkedList *range_node_copy;
+
+	EnterCriticalSection( &range_list_cs );
+
+	if ( range_node != NULL )
+	{
+		unsigned int range_info_count = 0;
+
+		DoublyLinkedList *active_range_list = NULL;
+
+		// Determine the number of ranges that still need downloading.
+		while ( range_node != NULL )
+		{
+			ri = ( RANGE_INFO * )range_node->data;
+
+			// Check if our range still needs to download.
+			if ( ri != NULL && ( ri->content_offset < ( ( ri->range_end - ri->range_start ) + 1 ) ) )
 			{
-				password = NULL;
-				password_length = 0;
+				++range_info_count;
+
+				RANGE_INFO *ri_copy = ( RANGE_INFO * )GlobalAlloc( GMEM_FIXED, sizeof( RANGE_INFO ) );
+
+				ri_copy->content_length = ri->content_length;
+				ri_copy->content_offset = ri->content_offset;
+				ri_copy->file_write_offset = ri->file_write_offset;
+				ri_copy->range_end = ri->range_end;
+				ri_copy->range_start = ri->range_start;
+
+				DoublyLinkedList *new_range_node = DLL_CreateNode( ( void * )ri_copy );
+				DLL_AddNode( &active_range_list, new_range_node, -1 );
 			}
+
+			range_node = range_node->next;
 		}
 
-		if ( ( protocol != PROTOCOL_UNKNOWN && protocol != PROTOCOL_RELATIVE ) &&
-			   host != NULL && resource != NULL && port != 0 )
+		// Can we split any remaining parts to fill the total?
+		if ( range_info_count > 0 && range_info_count < di->parts )
 		{
-			DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+			unsigned char parts = di->parts / range_info_count;
+			unsigned char rem_parts = di->parts % range_info_count;
+			unsigned char total_parts = di->parts - rem_parts;
 
-			if ( !( ai->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
-			{
-				di->filename_offset = lstrlenW( ai->download_directory );
-				_wmemcpy_s( di->file_path, MAX_PATH, ai->download_directory, di->filename_offset );
-				di->file_path[ di->filename_offset ] = 0;	// Sanity.
+			range_node = di->range_list;
+			range_node_copy = active_range_list;
 
-				++di->filename_offset;	// Include the NULL terminator.
-			}
-			else
+			while ( range_node_copy != NULL )
 			{
-				di->filename_offset = 1;
-			}
+				unsigned char t_parts = parts;
 
-			if ( w_filename_length > 0 )
-			{
-				w_filename_length = min( w_filename_length, ( int )( MAX_PATH - di->filename_offset - 1 ) );
+				if ( rem_parts > 0 )	// Distribute any remainder parts amongst the remaining ranges.
+				{
+					++t_parts;
+					--rem_parts;
+				}
+
+				ri_copy = ( RANGE_INFO * )range_node_copy->data;
+
+				unsigned long long remaining_length = ( ( ri_copy->range_end - ri_copy->range_start ) + 1 ) - ri_copy->content_offset;
+
+				// We'll only use 1 part for this range since it's too small to split up and the remainder of parts will be used for the next range.
+				if ( remaining_length < t_parts )
+				{
+					rem_parts += ( t_parts - 1 );
+					t_parts = 1;
+				}
+
+				unsigned long long range_size = remaining_length / t_parts;
+				unsigned long long range_offset = ri_copy->range_start + ri_copy->content_offset;
+				unsigned long long range_end = ri_copy->range_end;
+
+				for ( unsigned char i = 1; i <= t_parts; ++i )
+				{
+					// Download was restarted before a range list was created.
+					if ( range_node == NULL )
+					{
+						ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+
+						range_node = DLL_CreateNode( ( void * )ri );
+						DLL_AddNode( &di->range_list, range_node, -1 );
+					}
+					else
+					{
+						ri = ( RANGE_INFO * )range_node->data;
+					}
+
+					// Reuse this range info.
+					ri->content_length = 0;
+					ri->content_offset = 0;
+
+					if ( i == 1 )
+					{
+						ri->range_start = range_offset;
+					}
+					else
+					{
+						ri->range_start = range_offset + 1;
+					}
+
+					if ( i < t_parts )
+					{
+						range_offset += range_size;
+						ri->range_end = range_offset;
+					}
+					else	// Make sure we have an accurate range end for the last part.
+					{
+						ri->range_end = range_end;
+					}
+
+					ri->file_write_offset = ri->range_start;
+
+					range_node = range_node->next;
+				}
+
+				range_node_copy = range_node_copy->next;
+			}
+
+			di->range_list_end = range_node;
+
+			// Zero out the unused range info.
+			/*while ( range_node != NULL )
+			{
+				ri = ( RANGE_INFO * )range_node->data;
+				ri->content_length = 0;
+				ri->content_offset = 0;
+				ri->file_write_offset = 0;
+				ri->range_end = 0;
+				ri->range_start = 0;
+
+				range_node = range_node->next;
+			}*/
+		}
+
+		while ( active_range_list != NULL )
+		{
+			range_node = active_range_list;
+			active_range_list = active_range_list->next;
+
+			GlobalFree( range_node->data );
+			GlobalFree( range_node );
+		}
+	}
+	else
+	{
+		ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+		range_node = DLL_CreateNode( ( void * )ri );
+		DLL_AddNode( &di->range_list, range_node, -1 );
+	}
+
+	LeaveCriticalSection( &range_list_cs );
+}
+
+void StartDownload( DOWNLOAD_INFO *di, bool check_if_file_exists )
+{
+	if ( di == NULL )
+	{
+		return;
+	}
+
+	unsigned char add_state = 0;
+
+	PROTOCOL protocol = PROTOCOL_UNKNOWN;
+	wchar_t *host = NULL;
+	wchar_t *resource = NULL;
+	unsigned short port = 0;
+
+	bool skip_start = false;
+
+	EnterCriticalSection( &di->shared_cs );
+
+	wchar_t prompt_message[ MAX_PATH + 512 ];
+	wchar_t file_path[ MAX_PATH ];
+
+	int filename_offset;
+	int file_extension_offset;
+
+	if ( cfg_use_temp_download_directory )
+	{
+		int filename_length = GetTemporaryFilePath( di, file_path );
+
+		filename_offset = g_temp_download_directory_length + 1;
+		file_extension_offset = filename_offset + get_file_extension_offset( di->file_path + di->filename_offset, filename_length );
+	}
+	else
+	{
+		GetDownloadFilePath( di, file_path );
+
+		filename_offset = di->filename_offset;
+		file_extension_offset = di->file_extension_offset;
+	}
+
+	// See if the file exits.
+	if ( GetFileAttributesW( file_path ) != INVALID_FILE_ATTRIBUTES )
+	{
+		if ( check_if_file_exists )
+		{
+			if ( cfg_prompt_rename == 0 && di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS )
+			{
+				di->status = STATUS_SKIPPED;
+
+				skip_start = true;
+			}
+			else
+			{
+				// If the last return value was not set to remember our choice, then prompt again.
+				if ( cfg_prompt_rename == 0 &&
+					 g_rename_file_cmb_ret != CMBIDRENAMEALL &&
+					 g_rename_file_cmb_ret != CMBIDOVERWRITEALL &&
+					 g_rename_file_cmb_ret != CMBIDSKIPALL )
+				{
+					__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___already_exists, file_path );
+
+					g_rename_file_cmb_ret = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_RENAMEOVERWRITESKIPALL );
+				}
+
+				// Rename the file and try again.
+				if ( cfg_prompt_rename == 1 ||
+				   ( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDRENAME ||
+												 g_rename_file_cmb_ret == CMBIDRENAMEALL ) ) )
+				{
+					bool rename_succeeded = RenameFile( di, file_path, filename_offset, file_extension_offset );
+
+					if ( !rename_succeeded )
+					{
+						if ( g_rename_file_cmb_ret2 != CMBIDOKALL && !( di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS ) )
+						{
+							__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___could_not_be_renamed, file_path );
+
+							g_rename_file_cmb_ret2 = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_OKALL );
+						}
+
+						di->status = STATUS_SKIPPED;
+
+						skip_start = true;
+					}
+				}
+				else if ( cfg_prompt_rename == 3 ||
+						( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDFAIL ||
+													  g_rename_file_cmb_ret == CMBIDSKIP ||
+													  g_rename_file_cmb_ret == CMBIDSKIPALL ) ) ) // Skip the rename or overwrite if the return value fails, or the user selected skip.
+				{
+					di->status = STATUS_SKIPPED;
+
+					skip_start = true;
+				}
+			}
+		}
+	}
+	else if ( !( di->download_operations & DOWNLOAD_OPERATION_SIMULATE ) &&
+				 di->downloaded > 0 )	// If the file doesn't exist and it's been partially downloaded, then ask to restart.
+	{
+		if ( g_file_not_exist_cmb_ret != CMBIDNOALL && g_file_not_exist_cmb_ret != CMBIDYESALL )
+		{
+			g_file_not_exist_cmb_ret = CMessageBoxW( g_hWnd_main, ST_V_PROMPT_The_specified_file_was_not_found, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_YESNOALL );
+		}
+
+		if ( g_file_not_exist_cmb_ret == CMBIDYES || g_file_not_exist_cmb_ret == CMBIDYESALL )
+		{
+			_SendMessageW( g_hWnd_main, WM_RESET_PROGRESS, 0, ( LPARAM )di );
+
+			while ( di->range_list != NULL )
+			{
+				DoublyLinkedList *range_node = di->range_list;
+				di->range_list = di->range_list->next;
+
+				GlobalFree( range_node->data );
+				GlobalFree( range_node );
+			}
+
+			di->range_list_end = NULL;
+
+			di->processed_header = false;
+
+			SetDownloadProgress( di, 0, di->file_size );
+
+			di->last_modified.QuadPart = 0;
+
+			// If we manually start a download, then set the incomplete retry attempts back to 0.
+			di->retries = 0;
+			di->start_time.QuadPart = 0;
+
+			// If we manually start a download that was added remotely, then allow the prompts to display.
+			di->download_operations &= ~DOWNLOAD_OPERATION_OVERRIDE_PROMPTS;
+		}
+		else
+		{
+			di->status = STATUS_SKIPPED;
+
+			skip_start = true;
+		}
+	}
+
+	LeaveCriticalSection( &di->shared_cs );
+
+	if ( skip_start )
+	{
+		RemoveFilenameIndex( di );	// In case it came from the download queue.
+
+		journal_download_history( di, JOURNAL_RECORD_STATUS );
+
+		return;
+	}
+
+	unsigned int host_length = 0;
+	unsigned int resource_length = 0;
+
+	ParseURL_W( di->url, NULL, protocol, &host, host_length, port, &resource, resource_length, NULL, NULL, NULL, NULL );
+
+	wchar_t *w_resource;
+
+	if ( protocol == PROTOCOL_FTP ||
+		 protocol == PROTOCOL_FTPS ||
+		 protocol == PROTOCOL_FTPES )
+	{
+		w_resource = url_decode_w( resource, resource_length, &resource_length );
+
+		if ( w_resource != NULL )
+		{
+			GlobalFree( resource );
+			resource = w_resource;
+		}
+	}
+
+	w_resource = resource;
+
+	if ( protocol != PROTOCOL_FTP &&
+		 protocol != PROTOCOL_FTPS &&
+		 protocol != PROTOCOL_FTPES )
+	{
+		while ( *w_resource != NULL )
+		{
+			if ( *w_resource == L'#' )
+			{
+				*w_resource = 0;
+				resource_length = ( unsigned int )( w_resource - resource );
+
+				break;
+			}
+
+			++w_resource;
+		}
+	}
+
+	/*w_resource = url_encode_w( resource, resource_length, &w_resource_length );
+
+	// Did we encode anything?
+	if ( resource_length != w_resource_length )
+	{
+		GlobalFree( resource );
+		resource = w_resource;
+
+		resource_length = w_resource_length;
+	}
+	else
+	{
+		GlobalFree( w_resource );
+	}*/
+
+	if ( normaliz_state == NORMALIZ_STATE_RUNNING )
+	{
+		int punycode_length = _IdnToAscii( 0, host, host_length, NULL, 0 );
+
+		if ( ( unsigned int )punycode_length > host_length )
+		{
+			wchar_t *punycode = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( punycode_length + 1 ) );
+			host_length = _IdnToAscii( 0, host, host_length, punycode, punycode_length );
+			punycode[ host_length ] = 0;	// Sanity.
+
+			GlobalFree( host );
+			host = punycode;
+		}
+	}
+
+	unsigned char part = 1;
+
+	//EnterCriticalSection( &cleanup_cs );
+
+	// If the number of ranges is less than the total number of parts that's been set for the download,
+	// then the remaining ranges will be split to equal the total number of parts.
+	UpdateRangeList( di );
+
+	di->print_range_list = di->range_list;
+	di->range_queue = NULL;
+
+	DoublyLinkedList *range_node = di->range_list;
+
+	while ( range_node != di->range_list_end )
+	{
+		RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
+
+		// Check if our range still needs to download.
+		if ( ri != NULL && ( ri->content_offset < ( ( ri->range_end - ri->range_start ) + 1 ) ) )
+		{
+			// Split the remaining range_list off into the range_queue.
+			if ( di->parts_limit > 0 && part > di->parts_limit )
+			{
+				di->range_queue = range_node;
+
+				break;
+			}
+
+			// Check the state of our downloads/queue once.
+			if ( add_state == 0 )
+			{
+				if ( total_downloading < cfg_max_downloads )
+				{
+					add_state = 1;	// Create the connection.
+
+					// Set the start time only if we've manually started the download.
+					if ( di->start_time.QuadPart == 0 )
+					{
+						FILETIME ft;
+						GetSystemTimeAsFileTime( &ft );
+						di->start_time.LowPart = ft.dwLowDateTime;
+						di->start_time.HighPart = ft.dwHighDateTime;
+					}
+
+					di->status = STATUS_CONNECTING;	// Connecting.
+
+					EnableTimers( true );
+
+					EnterCriticalSection( &active_download_list_cs );
+
+					// Add to the global active download list.
+					di->download_node.data = di;
+					DLL_AddNode( &active_download_list, &di->download_node, -1 );
+
+					++total_downloading;
+
+					LeaveCriticalSection( &active_download_list_cs );
+				}
+				else
+				{
+					add_state = 2;	// Queue the download.
+
+					di->status = STATUS_CONNECTING | STATUS_QUEUED;	// Queued.
+
+					EnterCriticalSection( &download_queue_cs );
+					
+					// Add to the global download queue.
+					di->queue_node.data = di;
+					DLL_AddNode( &download_queue, &di->queue_node, -1 );
+
+					LeaveCriticalSection( &download_queue_cs );
+				}
+
+				AddFilenameIndex( di );
+
+				// Record the new status before any connection can finish and record its own.
+				// This also picks up a renamed file or a reset range list.
+				journal_download_history( di, JOURNAL_RECORD_ADDED );
+			}
+
+			di->last_downloaded = di->downloaded;
+
+			if ( add_state == 1 )
+			{
+				// Save the request information, the header information (if we got any), and create a new connection.
+				SOCKET_CONTEXT *context = CreateSocketContext();
+
+				if ( protocol == PROTOCOL_FTP ||
+					 protocol == PROTOCOL_FTPS ||
+					 protocol == PROTOCOL_FTPES )
+				{
+					context->ftp_connection_type = FTP_CONNECTION_TYPE_CONTROL;
+				}
+
+				context->processed_header = di->processed_header;
+
+				context->part = part;
+				context->parts = di->parts;
+
+				// If we've processed the header, then we would have already gotten a content disposition filename.
+				if ( di->processed_header )
+				{
+					context->got_filename = 1;
+				}
+
+				context->request_info.port = port;
+				context->request_info.protocol = protocol;
+
+				int cfg_val_length = WideCharToMultiByte( CP_UTF8, 0, host, host_length + 1, NULL, 0, NULL, NULL );
+				char *utf8_cfg_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * cfg_val_length ); // Size includes the null character.
+				WideCharToMultiByte( CP_UTF8, 0, host, host_length + 1, utf8_cfg_val, cfg_val_length, NULL, NULL );
+
+				context->request_info.host = utf8_cfg_val;
+
+				cfg_val_length = WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, NULL, 0, NULL, NULL );
+				utf8_cfg_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * cfg_val_length ); // Size includes the null character.
+				WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, utf8_cfg_val, cfg_val_length, NULL, NULL );
+
+				context->request_info.resource = utf8_cfg_val;
+
+				context->download_info = di;
+
+				ri->range_start += ri->content_offset;	// Begin where we left off.
+				ri->content_offset = 0;	// Reset.
+
+				context->header_info.range_info = ri;
+
+				if ( di->cookies != NULL )
+				{
+					char *new_cookies = NULL;
+
+					// This value will be saved
+					if ( !ParseCookieValues( di->cookies, &context->header_info.cookie_tree, &new_cookies ) )
+					{
+						GlobalFree( new_cookies );
+						new_cookies = NULL;
+					}
+
+					// If we got a new cookie.
+					if ( new_cookies != NULL )
+					{
+						// Then see if the new cookie is not blank.
+						if ( new_cookies[ 0 ] != NULL )
+						{
+							context->header_info.cookies = new_cookies;
+						}
+						else	// Otherwise, if the cookie is blank, then free it.
+						{
+							GlobalFree( new_cookies );
+						}
+					}
+				}
+
+				//
+
+				// Add to the parts list.
+				context->parts_node.data = context;
+
+				EnterCriticalSection( &di->shared_cs );
+
+				DLL_AddNode( &di->parts_list, &context->parts_node, -1 );
+
+				++( di->active_parts );
+
+				LeaveCriticalSection( &di->shared_cs );
+
+				//
+
+				// Add to the global download list.
+				context->context_node.data = context;
+
+				EnterCriticalSection( &context_list_cs );
+
+				DLL_AddNode( &g_context_list, &context->context_node, 0 );
+
+				LeaveCriticalSection( &context_list_cs );
+
+				//
+
+				context->status = STATUS_CONNECTING;
+
+				if ( !CreateConnection( context, context->request_info.host, context->request_info.port ) )
+				{
+					context->status = STATUS_FAILED;
+
+					InterlockedIncrement( &context->pending_operations );
+
+					context->overlapped.current_operation = IO_Close;
+
+					PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context, ( OVERLAPPED * )&context->overlapped );
+				}
+			}
+			else if ( add_state == 2 )
+			{
+				add_state = 3;	// Skip adding anymore values to the queue.
+
+				EnterCriticalSection( &di->shared_cs );
+
+				di->active_parts = 0;
+
+				LeaveCriticalSection( &di->shared_cs );
+			}
+
+			++part;
+		}
+
+		range_node = range_node->next;
+	}
+
+	// Nothing needed to be downloaded.
+	if ( add_state == 0 )
+	{
+		RemoveFilenameIndex( di );
+	}
+
+	//LeaveCriticalSection( &cleanup_cs );
+
+	GlobalFree( host );
+	GlobalFree( resource );
+}
+
+// The filename index holds the filenames of queued and active downloads so that collisions can be found without walking the lists.
+// Each entry is shared by every download with the same (case-insensitive) filename.
+// filename_index_cs must be held when calling this.
+FILENAME_INFO *IndexFilename( wchar_t *filename )
+{
+	FILENAME_INFO *fi = ( FILENAME_INFO * )dllrbt_find( g_filename_index, ( void * )filename, true );
+	if ( fi != NULL )
+	{
+		++fi->count;
+	}
+	else
+	{
+		fi = ( FILENAME_INFO * )GlobalAlloc( GMEM_FIXED, sizeof( FILENAME_INFO ) );
+		if ( fi == NULL )
+		{
+			return NULL;
+		}
+
+		fi->filename = GlobalStrDupW( filename );
+		fi->count = 1;
+
+		if ( fi->filename == NULL || dllrbt_insert( g_filename_index, ( void * )fi->filename, ( void * )fi ) != DLLRBT_STATUS_OK )
+		{
+			GlobalFree( fi->filename );
+			GlobalFree( fi );
+			fi = NULL;
+		}
+	}
+
+	return fi;
+}
+
+// filename_index_cs must be held when calling this.
+void UnindexFilename( FILENAME_INFO *fi )
+{
+	if ( fi != NULL )
+	{
+		--fi->count;
+
+		if ( fi->count == 0 )
+		{
+			dllrbt_iterator *itr = dllrbt_find( g_filename_index, ( void * )fi->filename, false );
+			if ( itr != NULL )
+			{
+				dllrbt_remove( g_filename_index, itr );
+			}
+
+			GlobalFree( fi->filename );
+			GlobalFree( fi );
+		}
+	}
+}
+
+// Call this after the download has been added to the download queue or active download list.
+void AddFilenameIndex( DOWNLOAD_INFO *di )
+{
+	if ( di != NULL )
+	{
+		EnterCriticalSection( &filename_index_cs );
+
+		if ( di->filename_info == NULL )
+		{
+			di->filename_info = IndexFilename( di->file_path + di->filename_offset );
+		}
+
+		LeaveCriticalSection( &filename_index_cs );
+	}
+}
+
+// Call this after the download has been removed from the download queue or active download list.
+// The filename stays in the index until the download is in neither of them.
+void RemoveFilenameIndex( DOWNLOAD_INFO *di )
+{
+	if ( di != NULL )
+	{
+		EnterCriticalSection( &filename_index_cs );
+
+		if ( di->filename_info != NULL && di->queue_node.data == NULL && di->download_node.data == NULL )
+		{
+			UnindexFilename( di->filename_info );
+			di->filename_info = NULL;
+		}
+
+		LeaveCriticalSection( &filename_index_cs );
+	}
+}
+
+// Call this after the filename of a queued or active download has changed.
+void UpdateFilenameIndex( DOWNLOAD_INFO *di )
+{
+	if ( di != NULL )
+	{
+		EnterCriticalSection( &filename_index_cs );
+
+		if ( di->filename_info != NULL && lstrcmpiW( di->filename_info->filename, di->file_path + di->filename_offset ) != 0 )
+		{
+			UnindexFilename( di->filename_info );
+			di->filename_info = IndexFilename( di->file_path + di->filename_offset );
+		}
+
+		LeaveCriticalSection( &filename_index_cs );
+	}
+}
+
+bool RenameFile( DOWNLOAD_INFO *di, wchar_t *file_path, unsigned int filename_offset, unsigned int file_extension_offset )
+{
+	unsigned int rename_count = 0;
+
+	// The maximum folder path length is 248 (including the trailing '\').
+	// The maximum file name length in the case above is 11 (not including the NULL terminator).
+	// The total is 259 characters (not including the NULL terminator).
+	// MAX_PATH is 260.
+
+	// We don't want to overwrite the download info until the very end.
+	wchar_t new_file_path[ MAX_PATH ];
+	_wmemcpy_s( new_file_path, MAX_PATH, file_path, MAX_PATH );
+
+	new_file_path[ filename_offset - 1 ] = L'\\';	// Replace the download directory NULL terminator with a directory slash.
+
+	// Hold the index until the new filename is in it so that no other download can pick the same one.
+	EnterCriticalSection( &filename_index_cs );
+
+	// Skip any filename that a queued or active download is using, or that already exists.
+	while ( dllrbt_find( g_filename_index, ( void * )( new_file_path + filename_offset ), false ) != NULL ||
+			GetFileAttributesW( new_file_path ) != INVALID_FILE_ATTRIBUTES )
+	{
+		// If there's a file extension, then put the counter before it.
+		int ret = __snwprintf( new_file_path + file_extension_offset, MAX_PATH - file_extension_offset - 1, L" (%lu)%s", ++rename_count, file_path + file_extension_offset );
+
+		// Can't rename.
+		if ( ret < 0 )
+		{
+			LeaveCriticalSection( &filename_index_cs );
+
+			return false;
+		}
+	}
+
+	// Set the new filename.
+	_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, new_file_path + filename_offset, MAX_PATH - di->filename_offset );
+	di->file_path[ MAX_PATH - 1 ] = 0;	// Sanity.
+
+	// Get the new file extension offset.
+	di->file_extension_offset = di->filename_offset + get_file_extension_offset( di->file_path + di->filename_offset, lstrlenW( di->file_path + di->filename_offset ) );
+
+	// The new filename is reserved even if the download isn't queued or active yet. RemoveFilenameIndex() releases it once it's in neither list.
+	UnindexFilename( di->filename_info );
+	di->filename_info = IndexFilename( di->file_path + di->filename_offset );
+
+	LeaveCriticalSection( &filename_index_cs );
+
+	return true;
+}
+
+ICON_INFO *CacheIcon( DOWNLOAD_INFO *di, SHFILEINFO *sfi )
+{
+	ICON_INFO *ii = NULL;
+
+	if ( di != NULL && sfi != NULL )
+	{
+		// Cache our file's icon.
+		EnterCriticalSection( &icon_cache_cs );
+		ii = ( ICON_INFO * )dllrbt_find( g_icon_handles, ( void * )( di->file_path + di->file_extension_offset ), true );
+		if ( ii == NULL )
+		{
+			bool destroy = true;
+			#ifndef OLE32_USE_STATIC_LIB
+				if ( ole32_state == OLE32_STATE_SHUTDOWN )
+				{
+					destroy = InitializeOle32();
+				}
+			#endif
+
+			if ( destroy )
+			{
+				_CoInitializeEx( NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE );
+			}
+
+			// Use an unknown file type icon for extensionless files.
+			_SHGetFileInfoW( ( di->file_path[ di->file_extension_offset ] != 0 ? di->file_path + di->file_extension_offset : L" " ), FILE_ATTRIBUTE_NORMAL, sfi, sizeof( SHFILEINFO ), SHGFI_USEFILEATTRIBUTES | SHGFI_ICON | SHGFI_SMALLICON );
+
+			if ( destroy )
+			{
+				_CoUninitialize();
+			}
+
+			ii = ( ICON_INFO * )GlobalAlloc( GMEM_FIXED, sizeof( DOWNLOAD_INFO ) );
+
+			ii->file_extension = GlobalStrDupW( di->file_path + di->file_extension_offset );
+			ii->icon = sfi->hIcon;
+
+			ii->count = 1;
+
+			if ( dllrbt_insert( g_icon_handles, ( void * )ii->file_extension, ( void * )ii ) != DLLRBT_STATUS_OK )
+			{
+				DestroyIcon( ii->icon );
+				GlobalFree( ii->file_extension );
+				GlobalFree( ii );
+				ii = NULL;
+			}
+		}
+		else
+		{
+			++( ii->count );
+		}
+		LeaveCriticalSection( &icon_cache_cs );
+	}
+
+	return ii;
+}
+
+// Splits the URL list into its URLs (and any filenames that override them).
+// The list is modified in place and each entry points into it.
+ADD_URL_ENTRY *SplitURLList( wchar_t *url_list, unsigned int &entry_count )
+{
+	unsigned int capacity = 1024;
+
+	entry_count = 0;
+
+	ADD_URL_ENTRY *entries = ( ADD_URL_ENTRY * )GlobalAlloc( GMEM_FIXED, sizeof( ADD_URL_ENTRY ) * capacity );
+	if ( entries == NULL )
+	{
+		return NULL;
+	}
+
+	while ( url_list != NULL )
+	{
+		// See if we're overwriting the filename.
+		wchar_t *filename_start = url_list;
+		wchar_t *filename_end;
+
+		unsigned int w_filename_length = 0;
+
+		if ( *filename_start == L'[' )
+		{
+			++filename_start;
+			url_list = filename_start;
+
+			while ( *url_list != 0 )
+			{
+				if ( *url_list == L']' )
+				{
+					filename_end = url_list;
+
+					w_filename_length = ( unsigned int )( filename_end - filename_start );
+
+					*url_list = 0;	// Sanity.
+
+					EscapeFilename( filename_start );
+
+					++url_list;
+
+					url_list = url_list;
+
+					break;
+				}
+
+				++url_list;
+			}
+		}
+
+		// Remove anything before our URL (spaces, tabs, newlines, etc.)
+		while ( *url_list != 0 && ( ( *url_list != L'h' && *url_list != L'H' ) && ( *url_list != L'f' && *url_list != L'F' ) ) )
+		{
+			++url_list;
+		}
+
+		// Find the end of the current url.
+		wchar_t *current_url = url_list;
+
+		int current_url_length = 0;
+
+		bool decode_converted_resource = false;
+		unsigned int white_space_count = 0;
+
+		while ( *url_list != NULL )
+		{
+			if ( *url_list == L'%' )
+			{
+				decode_converted_resource = true;
+			}
+			else if ( *url_list == L' ' )
+			{
+				++white_space_count;
+			}
+			else if ( *url_list == L'\r' && *( url_list + 1 ) == L'\n' )
+			{
+				*url_list = 0;	// Sanity.
+
+				current_url_length = ( int )( url_list - current_url );
+
+				url_list += 2;
+
+				break;
+			}
+
+			++url_list;
+		}
+
+		if ( *url_list == NULL )
+		{
+			current_url_length = ( int )( url_list - current_url );
+
+			url_list = NULL;
+		}
+
+		// Remove whitespace at the end of our URL.
+		while ( current_url_length > 0 )
+		{
+			if ( current_url[ current_url_length - 1 ] != L' ' && current_url[ current_url_length - 1 ] != L'\t' && current_url[ current_url_length - 1 ] != L'\f' )
+			{
+				break;
+			}
+			else
+			{
+				if ( current_url[ current_url_length - 1 ] == L' ' )
+				{
+					--white_space_count;
+				}
+
+				current_url[ current_url_length - 1 ] = 0;	// Sanity.
+			}
+
+			--current_url_length;
+		}
+
+		if ( entry_count >= capacity )
+		{
+			capacity *= 2;
+
+			ADD_URL_ENTRY *realloc_buffer = ( ADD_URL_ENTRY * )GlobalReAlloc( entries, sizeof( ADD_URL_ENTRY ) * capacity, GMEM_MOVEABLE );
+			if ( realloc_buffer == NULL )
+			{
+				break;
+			}
+
+			entries = realloc_buffer;
+		}
+
+		ADD_URL_ENTRY *aue = &entries[ entry_count++ ];
+
+		aue->url = current_url;
+		aue->url_length = current_url_length;
+		aue->filename = ( w_filename_length > 0 ? filename_start : NULL );
+		aue->filename_length = w_filename_length;
+		aue->white_space_count = white_space_count;
+		aue->decode_converted_resource = decode_converted_resource;
+		aue->di = NULL;
+		aue->host = NULL;
+		aue->duplicate = false;
+	}
+
+	return entries;
+}
+
+// Creates the download info for a URL. Returns NULL if the URL couldn't be parsed.
+// Nothing in here touches the listview or the download lists so that URLs can be parsed on several threads at once.
+DOWNLOAD_INFO *CreateDownloadInfo( ADD_URL_PARSE_INFO *aupi, ADD_URL_ENTRY *aue )
+{
+	ADD_INFO *ai = aupi->ai;
+
+	DOWNLOAD_INFO *di = NULL;
+
+	wchar_t *current_url = aue->url;
+	int current_url_length = aue->url_length;
+
+	unsigned int w_filename_length = aue->filename_length;
+
+	wchar_t *host = NULL;
+	wchar_t *resource = NULL;
+
+	PROTOCOL protocol = PROTOCOL_UNKNOWN;
+	unsigned short port = 0;
+
+	unsigned int host_length = 0;
+	unsigned int resource_length = 0;
+
+	wchar_t *url_username = NULL;
+	wchar_t *url_password = NULL;
+
+	unsigned int url_username_length = 0;
+	unsigned int url_password_length = 0;
+
+	char *username = ai->auth_info.username;
+	char *password = ai->auth_info.password;
+
+	int username_length = aupi->username_length;
+	int password_length = aupi->password_length;
+
+	wchar_t *current_url_encoded = NULL;
+
+	if ( aue->white_space_count > 0 && *current_url != L'f' && *current_url != L'F' )
+	{
+		wchar_t *pstr = current_url;
+		current_url_encoded = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( current_url_length + ( aue->white_space_count * 2 ) + 1 ) );
+		wchar_t *pbuf = current_url_encoded;
+
+		while ( pstr < ( current_url + current_url_length ) )
+		{
+			if ( *pstr == L' ' )
+			{
+				pbuf[ 0 ] = L'%';
+				pbuf[ 1 ] = L'2';
+				pbuf[ 2 ] = L'0';
+
+				pbuf = pbuf + 3;
+			}
+			else
+			{
+				*pbuf++ = *pstr;
+			}
+
+			++pstr;
+		}
+
+		*pbuf = L'\0';
+	}
+
+	ParseURL_W( ( current_url_encoded != NULL ? current_url_encoded : current_url ), NULL, protocol, &host, host_length, port, &resource, resource_length, &url_username, &url_username_length, &url_password, &url_password_length );
+
+	// The username and password could be encoded.
+	if ( url_username != NULL )
+	{
+		int val_length = WideCharToMultiByte( CP_UTF8, 0, url_username, url_username_length + 1, NULL, 0, NULL, NULL );
+		char *utf8_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * val_length ); // Size includes the null character.
+		WideCharToMultiByte( CP_UTF8, 0, url_username, url_username_length + 1, utf8_val, val_length, NULL, NULL );
+
+		url_username_length = 0;
+		username = url_decode_a( utf8_val, val_length - 1, &url_username_length );
+		username_length = url_username_length;
+		GlobalFree( utf8_val );
+
+		//
+
+		if ( url_password != NULL )
+		{
+			val_length = WideCharToMultiByte( CP_UTF8, 0, url_password, url_password_length + 1, NULL, 0, NULL, NULL );
+			utf8_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * val_length ); // Size includes the null character.
+			WideCharToMultiByte( CP_UTF8, 0, url_password, url_password_length + 1, utf8_val, val_length, NULL, NULL );
+
+			url_password_length = 0;
+			password = url_decode_a( utf8_val, val_length - 1, &url_password_length );
+			password_length = url_password_length;
+			GlobalFree( utf8_val );
+		}
+		else
+		{
+			password = NULL;
+			password_length = 0;
+		}
+	}
+
+	if ( ( protocol != PROTOCOL_UNKNOWN && protocol != PROTOCOL_RELATIVE ) &&
+		   host != NULL && resource != NULL && port != 0 )
+	{
+		di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+
+		if ( !( ai->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
+		{
+			di->filename_offset = aupi->download_directory_length;
+			_wmemcpy_s( di->file_path, MAX_PATH, ai->download_directory, di->filename_offset );
+			di->file_path[ di->filename_offset ] = 0;	// Sanity.
+
+			++di->filename_offset;	// Include the NULL terminator.
+		}
+		else
+		{
+			di->filename_offset = 1;
+		}
+
+		if ( w_filename_length > 0 )
+		{
+			w_filename_length = min( w_filename_length, ( int )( MAX_PATH - di->filename_offset - 1 ) );
+
+			_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, aue->filename, w_filename_length );
+			di->file_path[ di->filename_offset + w_filename_length ] = 0;	// Sanity.
+
+			di->download_operations |= DOWNLOAD_OPERATION_OVERRIDE_FILENAME;
+		}
+		else
+		{
+			wchar_t *directory = NULL;
+
+			if ( aue->decode_converted_resource )
+			{
+				int val_length = WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, NULL, 0, NULL, NULL );
+				char *utf8_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * val_length ); // Size includes the null character.
+				WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, utf8_val, val_length, NULL, NULL );
+
+				unsigned int directory_length = 0;
+				char *c_directory = url_decode_a( utf8_val, val_length - 1, &directory_length );
+				GlobalFree( utf8_val );
+
+				val_length = MultiByteToWideChar( CP_UTF8, 0, c_directory, directory_length + 1, NULL, 0 );	// Include the NULL terminator.
+				directory = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * val_length );
+				MultiByteToWideChar( CP_UTF8, 0, c_directory, directory_length + 1, directory, val_length );
+
+				GlobalFree( c_directory );	
+			}
+			else
+			{
+				directory = url_decode_w( resource, resource_length, NULL );
+			}
+
+			// Try to create a filename from the resource path.
+			if ( directory != NULL )
+			{
+				wchar_t *directory_ptr = directory;
+				wchar_t *current_directory = directory;
+				wchar_t *last_directory = NULL;
+
+				// Iterate forward because '/' can be found after '#'.
+				while ( *directory_ptr != NULL )
+				{
+					if ( *directory_ptr == L'?' || *directory_ptr == L'#' )
+					{
+						*directory_ptr = 0;	// Sanity.
+
+						break;
+					}
+					else if ( *directory_ptr == L'/' )
+					{
+						last_directory = current_directory;
+						current_directory = directory_ptr + 1; 
+					}
+
+					++directory_ptr;
+				}
+
+				if ( *current_directory == NULL )
+				{
+					// Adjust for '/'. current_directory will always be at least 1 greater than last_directory.
+					if ( last_directory != NULL && ( current_directory - 1 ) - last_directory > 0 )
+					{
+						w_filename_length = ( unsigned int )( ( current_directory - 1 ) - last_directory );
+						current_directory = last_directory;
+					}
+					else	// No filename could be made from the resource path. Use the host name instead.
+					{
+						w_filename_length = host_length;
+						current_directory = host;
+
+						di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
+					}
+				}
+				else
+				{
+					w_filename_length = ( unsigned int )( directory_ptr - current_directory );
+				}
+
+				w_filename_length = min( w_filename_length, ( int )( MAX_PATH - di->filename_offset - 1 ) );
+
+				_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, current_directory, w_filename_length );
+				di->file_path[ di->filename_offset + w_filename_length ] = 0;	// Sanity.
+
+				EscapeFilename( di->file_path + di->filename_offset );
+
+				GlobalFree( directory );
+			}
+			else	// Shouldn't happen.
+			{
+				w_filename_length = 11;
+				_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, L"NO_FILENAME\0", 12 );
+			}
+		}
+
+		di->file_extension_offset = di->filename_offset + ( ( di->download_operations & DOWNLOAD_OPERATION_GET_EXTENSION ) ? w_filename_length : get_file_extension_offset( di->file_path + di->filename_offset, w_filename_length ) );
+
+		if ( di->file_extension_offset == ( di->filename_offset + w_filename_length ) )
+		{
+			di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
+		}
+
+		di->hFile = INVALID_HANDLE_VALUE;
+
+		InitializeCriticalSection( &di->shared_cs );
+
+		if ( current_url_encoded != NULL )
+		{
+			di->url = current_url_encoded;
+			current_url_encoded = NULL;
+		}
+		else
+		{
+			//di->url = GlobalStrDupW( current_url );
+			di->url = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( current_url_length + 1 ) );
+			_wmemcpy_s( di->url, current_url_length + 1, current_url, current_url_length );
+			di->url[ current_url_length ] = 0;	// Sanity.
+		}
+
+		di->parts = ai->parts;
+
+		di->download_speed_limit = ai->download_speed_limit;
+
+		di->ssl_version = ai->ssl_version;
+
+		di->download_operations |= ai->download_operations;
+
+		if ( ai->download_operations & DOWNLOAD_OPERATION_ADD_STOPPED )
+		{
+			di->status = STATUS_STOPPED;
+			di->download_operations &= ~DOWNLOAD_OPERATION_ADD_STOPPED;
+		}
+
+		di->method = ai->method;
+
+		if ( username == NULL && password == NULL )
+		{
+			// The login manager can change the site logins while we parse. SetSiteLogin() looks it up once worker_cs is held.
+			aue->host = host;
+			aue->protocol = protocol;
+			aue->port = port;
+
+			host = NULL;
+		}
+		else
+		{
+			if ( username != NULL && username_length > 0 )
+			{
+				di->auth_info.username = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( username_length + 1 ) );
+				_memcpy_s( di->auth_info.username, username_length + 1, username, username_length );
+				di->auth_info.username[ username_length ] = 0;	// Sanity.
+			}
+
+			if ( password != NULL && password_length > 0 )
+			{
+				di->auth_info.password = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( password_length + 1 ) );
+				_memcpy_s( di->auth_info.password, password_length + 1, password, password_length );
+				di->auth_info.password[ password_length ] = 0;	// Sanity.
+			}
+		}
+
+		if ( ai->utf8_cookies != NULL && aupi->cookies_length > 0 )
+		{
+			di->cookies = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( aupi->cookies_length + 1 ) );
+			_memcpy_s( di->cookies, aupi->cookies_length + 1, ai->utf8_cookies, aupi->cookies_length );
+			di->cookies[ aupi->cookies_length ] = 0;	// Sanity.
+		}
+
+		if ( ai->utf8_headers != NULL && aupi->headers_length > 0 )
+		{
+			di->headers = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( aupi->headers_length + 1 ) );
+			_memcpy_s( di->headers, aupi->headers_length + 1, ai->utf8_headers, aupi->headers_length );
+			di->headers[ aupi->headers_length ] = 0;	// Sanity.
+		}
+
+		if ( ai->utf8_data != NULL && aupi->data_length > 0 )
+		{
+			di->data = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( aupi->data_length + 1 ) );
+			_memcpy_s( di->data, aupi->data_length + 1, ai->utf8_data, aupi->data_length );
+			di->data[ aupi->data_length ] = 0;	// Sanity.
+		}
+
+		SYSTEMTIME st;
+		FILETIME ft;
+
+		GetLocalTime( &st );
+		SystemTimeToFileTime( &st, &ft );
+
+		di->add_time.LowPart = ft.dwLowDateTime;
+		di->add_time.HighPart = ft.dwHighDateTime;
+
+		int buffer_length = 0;
+
+		#ifndef NTDLL_USE_STATIC_LIB
+			//buffer_length = 64;	// Should be enough to hold most translated values.
+			buffer_length = __snwprintf( NULL, 0, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
+		#else
+			buffer_length = _scwprintf( L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
+		#endif
+
+		di->w_add_time = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * buffer_length );
+
+		__snwprintf( di->w_add_time, buffer_length, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) );
+
+	}
+
+	GlobalFree( current_url_encoded );
+	GlobalFree( host );
+	GlobalFree( resource );
+
+	// If we got a username and password from the URL, then the username and password character strings were allocated and we need to free them.
+	if ( url_username != NULL ) { GlobalFree( username ); GlobalFree( url_username ); }
+	if ( url_password != NULL ) { GlobalFree( password ); GlobalFree( url_password ); }
+
+	return di;
+}
+
+// Frees a download info that was never added to the download list.
+void FreeDownloadInfo( DOWNLOAD_INFO *di )
+{
+	if ( di != NULL )
+	{
+		GlobalFree( di->url );
+		GlobalFree( di->w_add_time );
+		GlobalFree( di->cookies );
+		GlobalFree( di->headers );
+		GlobalFree( di->data );
+		GlobalFree( di->auth_info.username );
+		GlobalFree( di->auth_info.password );
+
+		DeleteCriticalSection( &di->shared_cs );
+
+		GlobalFree( di );
+	}
+}
+
+// Sets the username and password of a parsed URL from the site login that matches its host. worker_cs must be held.
+void SetSiteLogin( ADD_URL_ENTRY *aue )
+{
+	if ( aue->di == NULL || aue->host == NULL )
+	{
+		return;
+	}
+
+	DOWNLOAD_INFO *di = aue->di;
+
+	LOGIN_INFO tli;
+	tli.host = aue->host;
+	tli.protocol = aue->protocol;
+	tli.port = aue->port;
+	LOGIN_INFO *li = ( LOGIN_INFO * )dllrbt_find( g_login_info, ( void * )&tli, true );
+
+	if ( li != NULL )
+	{
+		int username_length = lstrlenA( li->username );
+		if ( username_length > 0 )
+		{
+			di->auth_info.username = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( username_length + 1 ) );
+			_memcpy_s( di->auth_info.username, username_length + 1, li->username, username_length );
+			di->auth_info.username[ username_length ] = 0;	// Sanity.
+		}
+
+		int password_length = lstrlenA( li->password );
+		if ( password_length > 0 )
+		{
+			di->auth_info.password = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( password_length + 1 ) );
+			_memcpy_s( di->auth_info.password, password_length + 1, li->password, password_length );
+			di->auth_info.password[ password_length ] = 0;	// Sanity.
+		}
+	}
+}
+
+// Asks what to do with a URL that's already in the download list with the same download directory and filename.
+// Returns true if the URL should be added, or false if it should be skipped. Sets overwrite if the URL wasn't renamed. worker_cs must be held.
+bool KeepDuplicateURL( DOWNLOAD_INFO *di, bool &overwrite )
+{
+	overwrite = false;
+
+	// Simulated downloads don't write a file that could be overwritten.
+	if ( di->download_operations & DOWNLOAD_OPERATION_SIMULATE )
+	{
+		return true;
+	}
+
+	if ( cfg_prompt_rename == 0 && di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS )
+	{
+		return false;
+	}
+
+	wchar_t prompt_message[ MAX_PATH + 512 ];
+	wchar_t file_path[ MAX_PATH ];
+
+	GetDownloadFilePath( di, file_path );
+
+	// If the last return value was not set to remember our choice, then prompt again.
+	if ( cfg_prompt_rename == 0 &&
+		 g_rename_file_cmb_ret != CMBIDRENAMEALL &&
+		 g_rename_file_cmb_ret != CMBIDOVERWRITEALL &&
+		 g_rename_file_cmb_ret != CMBIDSKIPALL )
+	{
+		__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___already_exists, file_path );
+
+		g_rename_file_cmb_ret = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_RENAMEOVERWRITESKIPALL );
+	}
+
+	if ( cfg_prompt_rename == 1 ||
+	   ( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDRENAME ||
+									 g_rename_file_cmb_ret == CMBIDRENAMEALL ) ) )
+	{
+		EnterCriticalSection( &filename_index_cs );
+
+		// The download that's in the list might not be queued or active. Hold its filename so that RenameFile() gives us a different one.
+		FILENAME_INFO *fi = IndexFilename( di->file_path + di->filename_offset );
+
+		bool rename_succeeded = RenameFile( di, file_path, di->filename_offset, di->file_extension_offset );
+
+		UnindexFilename( fi );
+
+		LeaveCriticalSection( &filename_index_cs );
+
+		if ( !rename_succeeded )
+		{
+			if ( g_rename_file_cmb_ret2 != CMBIDOKALL && !( di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS ) )
+			{
+				__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___could_not_be_renamed, file_path );
+
+				g_rename_file_cmb_ret2 = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_OKALL );
+			}
+
+			return false;
+		}
+	}
+	else if ( cfg_prompt_rename == 3 ||
+			( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDFAIL ||
+										  g_rename_file_cmb_ret == CMBIDSKIP ||
+										  g_rename_file_cmb_ret == CMBIDSKIPALL ) ) ) // Skip the URL if the return value fails, or the user selected skip.
+	{
+		return false;
+	}
+	else	// Overwrite.
+	{
+		overwrite = true;
+	}
+
+	return true;
+}
+
+void ParseURLRange( ADD_URL_PARSE_INFO *aupi )
+{
+	for ( unsigned int i = aupi->start; i < aupi->end; ++i )
+	{
+		// Stop processing and exit the thread.
+		if ( kill_worker_thread_flag )
+		{
+			break;
+		}
+
+		aupi->entries[ i ].di = CreateDownloadInfo( aupi, &aupi->entries[ i ] );
+	}
+}
+
+THREAD_RETURN ParseURLEntries( void *pArguments )
+{
+	ParseURLRange( ( ADD_URL_PARSE_INFO * )pArguments );
+
+	_ExitThread( 0 );
+	return 0;
+}
+
+// Splits the URLs between as many threads as there are processors.
+void ParseURLList( ADD_URL_PARSE_INFO *aupi_template, ADD_URL_ENTRY *entries, unsigned int entry_count )
+{
+	ADD_URL_PARSE_INFO aupi[ MAXIMUM_WAIT_OBJECTS ];
+	HANDLE threads[ MAXIMUM_WAIT_OBJECTS ];
+	unsigned int thread_count = 0;
+
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo( &systemInfo );
+
+	unsigned int part_count = entry_count / ADD_URL_PARSE_MIN_ENTRIES;
+	if ( part_count > systemInfo.dwNumberOfProcessors )
+	{
+		part_count = systemInfo.dwNumberOfProcessors;
+	}
+
+	if ( part_count > MAXIMUM_WAIT_OBJECTS )
+	{
+		part_count = MAXIMUM_WAIT_OBJECTS;
+	}
+	else if ( part_count == 0 )
+	{
+		part_count = 1;
+	}
+
+	unsigned int part_size = entry_count / part_count;
+
+	for ( unsigned int i = 0; i < part_count; ++i )
+	{
+		aupi[ i ] = *aupi_template;
+		aupi[ i ].entries = entries;
+		aupi[ i ].start = i * part_size;
+		aupi[ i ].end = ( i == part_count - 1 ? entry_count : ( i + 1 ) * part_size );
+	}
+
+	// The first part is parsed on this thread.
+	for ( unsigned int i = 1; i < part_count; ++i )
+	{
+		HANDLE thread = ( HANDLE )_CreateThread( NULL, 0, ParseURLEntries, ( void * )&aupi[ i ], 0, NULL );
+		if ( thread != NULL )
+		{
+			threads[ thread_count++ ] = thread;
+		}
+		else	// Parse it ourself if we couldn't create the thread.
+		{
+			ParseURLRange( &aupi[ i ] );
+		}
+	}
+
+	ParseURLRange( &aupi[ 0 ] );
+
+	if ( thread_count > 0 )
+	{
+		WaitForMultipleObjects( thread_count, threads, TRUE, INFINITE );
+
+		for ( unsigned int i = 0; i < thread_count; ++i )
+		{
+			CloseHandle( threads[ i ] );
+		}
+	}
+}
+
+// Orders downloads by their URL, download directory, and filename.
+// URLs are compared ordinally since they have to match exactly. The paths are compared without case.
+int CompareDownloadURL( DOWNLOAD_INFO *di1, DOWNLOAD_INFO *di2 )
+{
+	wchar_t *url1 = di1->url;
+	wchar_t *url2 = di2->url;
+
+	while ( *url1 != 0 && *url1 == *url2 )
+	{
+		++url1;
+		++url2;
+	}
+
+	if ( *url1 != *url2 )
+	{
+		return ( *url1 < *url2 ? -1 : 1 );
+	}
+
+	if ( di1->filename_offset != di2->filename_offset )
+	{
+		return ( di1->filename_offset < di2->filename_offset ? -1 : 1 );
+	}
+
+	// The download directory isn't NULL terminated while its file is being moved or deleted.
+	int ret = CompareStringW( LOCALE_USER_DEFAULT, NORM_IGNORECASE, di1->file_path, di1->filename_offset - 1, di2->file_path, di2->filename_offset - 1 ) - CSTR_EQUAL;
+	if ( ret == 0 )
+	{
+		ret = lstrcmpiW( di1->file_path + di1->filename_offset, di2->file_path + di2->filename_offset );
+	}
+
+	return ret;
+}
+
+// FNV-1a
+unsigned long HashURL( wchar_t *url )
+{
+	unsigned long hash = 2166136261;
+
+	while ( *url != 0 )
+	{
+		hash = ( hash ^ *url++ ) * 16777619;
+	}
+
+	return hash;
+}
+
+// URLs are ordered by their hash first. Equal downloads are ordered by where they are in the URL list so that the first one is kept.
+int CompareURLEntries( ADD_URL_ENTRY *entries, unsigned int index1, unsigned int index2 )
+{
+	if ( entries[ index1 ].url_hash != entries[ index2 ].url_hash )
+	{
+		return ( entries[ index1 ].url_hash < entries[ index2 ].url_hash ? -1 : 1 );
+	}
+
+	int ret = CompareDownloadURL( entries[ index1 ].di, entries[ index2 ].di );
+	if ( ret == 0 )
+	{
+		ret = ( index1 < index2 ? -1 : ( index1 > index2 ? 1 : 0 ) );
+	}
+
+	return ret;
+}
+
+// A heap sort of the entries' indices. It doesn't need any more memory than the indices themselves.
+void SortURLEntries( ADD_URL_ENTRY *entries, unsigned int *order, unsigned int order_count )
+{
+	if ( order_count < 2 )
+	{
+		return;
+	}
+
+	// Build the heap, then repeatedly move its largest value to the end.
+	for ( unsigned int start = order_count / 2, end = order_count; end > 1; )
+	{
+		if ( start > 0 )
+		{
+			--start;
+		}
+		else
+		{
+			--end;
+
+			unsigned int tmp = order[ end ];
+			order[ end ] = order[ 0 ];
+			order[ 0 ] = tmp;
+		}
+
+		// Sift the value at start down to where it belongs.
+		unsigned int root = start;
+		unsigned int child;
+
+		while ( ( child = ( root * 2 ) + 1 ) < end )
+		{
+			if ( child + 1 < end && CompareURLEntries( entries, order[ child ], order[ child + 1 ] ) < 0 )
+			{
+				++child;
+			}
+
+			if ( CompareURLEntries( entries, order[ root ], order[ child ] ) < 0 )
+			{
+				unsigned int tmp = order[ root ];
+				order[ root ] = order[ child ];
+				order[ child ] = tmp;
+
+				root = child;
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+}
+
+// Drops any URL that's repeated in the URL list, and marks any URL that's already in the download list with the same download directory and filename.
+// Returns the number of entries that are left, including the marked ones.
+unsigned int RemoveDuplicateURLs( ADD_URL_ENTRY *entries, unsigned int entry_count )
+{
+	unsigned int order_count = 0;
+
+	unsigned int *order = ( unsigned int * )GlobalAlloc( GMEM_FIXED, sizeof( unsigned int ) * ( entry_count > 0 ? entry_count : 1 ) );
+	if ( order == NULL )
+	{
+		// Keep everything.
+		for ( unsigned int i = 0; i < entry_count; ++i )
+		{
+			if ( entries[ i ].di != NULL )
+			{
+				++order_count;
+			}
+		}
+
+		return order_count;
+	}
+
+	for ( unsigned int i = 0; i < entry_count; ++i )
+	{
+		if ( entries[ i ].di != NULL )
+		{
+			entries[ i ].url_hash = HashURL( entries[ i ].di->url );
+
+			order[ order_count++ ] = i;
+		}
+	}
+
+	SortURLEntries( entries, order, order_count );
+
+	// Repeated URLs are next to each other and the first one in the list comes first.
+	unsigned int unique_count = 0;
+
+	for ( unsigned int i = 0; i < order_count; ++i )
+	{
+		if ( unique_count > 0 &&
+			 entries[ order[ unique_count - 1 ] ].url_hash == entries[ order[ i ] ].url_hash &&
+			 CompareDownloadURL( entries[ order[ unique_count - 1 ] ].di, entries[ order[ i ] ].di ) == 0 )
+		{
+			FreeDownloadInfo( entries[ order[ i ] ].di );
+			entries[ order[ i ] ].di = NULL;
+		}
+		else
+		{
+			order[ unique_count++ ] = order[ i ];
+		}
+	}
+
+	// Look up each existing download in the sorted URLs.
+	unsigned int item_count = DM_GetItemCount();
+
+	for ( unsigned int i = 0; i < item_count && unique_count > 0; ++i )
+	{
+		DOWNLOAD_INFO *di = DM_GetItem( i );
+		if ( di == NULL || di->url == NULL )
+		{
+			continue;
+		}
+
+		unsigned long url_hash = HashURL( di->url );
+
+		unsigned int low = 0;
+		unsigned int high = unique_count;
+
+		while ( low < high )
+		{
+			unsigned int mid = low + ( ( high - low ) / 2 );
+
+			ADD_URL_ENTRY *aue = &entries[ order[ mid ] ];
+
+			int ret = ( aue->url_hash != url_hash ? ( aue->url_hash < url_hash ? -1 : 1 ) : CompareDownloadURL( aue->di, di ) );
+			if ( ret < 0 )
+			{
+				low = mid + 1;
+			}
+			else if ( ret > 0 )
+			{
+				high = mid;
+			}
+			else	// AddURL() asks whether to rename, overwrite, or skip it.
+			{
+				aue->duplicate = true;
+
+				break;
+			}
+		}
+	}
+
+	GlobalFree( order );
+
+	return unique_count;
+}
+
+DWORD WINAPI AddURL( void *add_info )
+{
+	if ( add_info == NULL )
+	{
+		_ExitThread( 0 );
+		return 0;
+	}
+
+	ADD_INFO *ai = ( ADD_INFO * )add_info;
+
+	if ( ai->method == METHOD_NONE )
+	{
+		ai->method = METHOD_GET;
+	}
+
+	// The values that every URL shares.
+	ADD_URL_PARSE_INFO aupi;
+	_memzero( &aupi, sizeof( ADD_URL_PARSE_INFO ) );
+
+	aupi.ai = ai;
+
+	if ( ai->auth_info.username != NULL )
+	{
+		aupi.username_length = lstrlenA( ai->auth_info.username );
+	}
+
+	if ( ai->auth_info.password != NULL )
+	{
+		aupi.password_length = lstrlenA( ai->auth_info.password );
+	}
+
+	if ( ai->utf8_cookies != NULL )
+	{
+		aupi.cookies_length = lstrlenA( ai->utf8_cookies );
+	}
+
+	if ( ai->utf8_headers != NULL )
+	{
+		aupi.headers_length = lstrlenA( ai->utf8_headers );
+	}
+
+	if ( ai->utf8_data != NULL )
+	{
+		aupi.data_length = lstrlenA( ai->utf8_data );
+	}
+
+	if ( ai->download_directory != NULL )
+	{
+		aupi.download_directory_length = lstrlenW( ai->download_directory );
+	}
+
+	unsigned int entry_count = 0;
+	unsigned int add_count = 0;
+
+	// The URLs are parsed in three stages. None of the URLs are added to the download list until they've all been parsed and checked for duplicates.
+	// Splitting and parsing don't touch the download list, so other list operations can continue while they run.
+	ADD_URL_ENTRY *entries = SplitURLList( ai->urls, entry_count );
+
+	if ( entries != NULL )
+	{
+		ParseURLList( &aupi, entries, entry_count );
+	}
+
+	EnterCriticalSection( &worker_cs );
+
+	in_worker_thread = true;
+
+	ProcessingList( true );
+
+	if ( entries != NULL )
+	{
+		add_count = RemoveDuplicateURLs( entries, entry_count );
+	}
+
+	if ( add_count > 0 )
+	{
+		SHFILEINFO *sfi = ( SHFILEINFO * )GlobalAlloc( GMEM_FIXED, sizeof( SHFILEINFO ) );
+
+		// Allocate space for all of the URLs at once.
+		DM_ReserveItems( add_count );
+
+		for ( unsigned int i = 0; i < entry_count; ++i )
+		{
+			DOWNLOAD_INFO *di = entries[ i ].di;
+
+			if ( di == NULL )
+			{
+				continue;
+			}
+
+			bool overwrite = false;
+
+			// Don't add anything else if we're exiting the thread, or if a URL that's already in the download list is being skipped.
+			if ( kill_worker_thread_flag || ( entries[ i ].duplicate && !KeepDuplicateURL( di, overwrite ) ) )
+			{
+				FreeDownloadInfo( di );
+				entries[ i ].di = NULL;
+
+				continue;
+			}
+
+			SetSiteLogin( &entries[ i ] );
+
+			// Cache our file's icon.
+			ICON_INFO *ii = CacheIcon( di, sfi );
+
+			if ( ii != NULL )
+			{
+				di->icon = &ii->icon;
+			}
+
+			//EnterCriticalSection( &cleanup_cs );
+
+			DM_InsertItem( di );
+
+			journal_download_history( di, JOURNAL_RECORD_ADDED );
+
+			if ( !( ai->download_operations & DOWNLOAD_OPERATION_ADD_STOPPED ) )
+			{
+				// Don't ask again if we've already been told to overwrite the file.
+				StartDownload( di, !( di->download_operations & DOWNLOAD_OPERATION_SIMULATE ) && !overwrite );
+			}
+			else
+			{
+				RemoveFilenameIndex( di );	// In case KeepDuplicateURL() renamed it.
+			}
+
+			//LeaveCriticalSection( &cleanup_cs );
+		}
+
+		GlobalFree( sfi );
+
+		// Update the listview once for the whole batch.
+		UpdateDownloadListCount( false );
+	}
+
+	if ( entries != NULL )
+	{
+		for ( unsigned int i = 0; i < entry_count; ++i )
+		{
+			GlobalFree( entries[ i ].host );
+		}
+
+		GlobalFree( entries );
+	}
+
+	GlobalFree( ai->utf8_data );
+	GlobalFree( ai->utf8_headers );
+	GlobalFree( ai->utf8_cookies );
+	GlobalFree( ai->auth_info.username );
+	GlobalFree( ai->auth_info.password );
+	GlobalFree( ai->download_directory );
+	GlobalFree( ai->urls );
+	GlobalFree( ai );
+
+	if ( cfg_sort_added_and_updating_items &&
+		 cfg_sorted_column_index != COLUMN_NUM )	// #
+	{
+		SORT_INFO si;
+		si.column = cfg_sorted_column_index;
+		si.hWnd = g_hWnd_files;
+		si.direction = cfg_sorted_direction;
+
+		SortDownloadList( &si );
+	}
+
+	ProcessingList( false );
+
+	// Release the semaphore if we're killing the thread.
+	if ( worker_semaphore != NULL )
+	{
+		ReleaseSemaphore( worker_semaphore, 1, NULL );
+	}
+
+	in_worker_thread = false;
+
+	LeaveCriticalSection( &worker_cs );
+
+	_ExitThread( 0 );
+	return 0;
+}
+
+void StartQueuedItem()
+{
+	EnterCriticalSection( &download_queue_cs );
+
+	if ( download_queue != NULL )
+	{
+		DoublyLinkedList *download_queue_node = download_queue;
+
+		DOWNLOAD_INFO *di = NULL;
+
+		// Run through our download queue and start the first context that hasn't been paused or stopped.
+		// Continue to dequeue if we haven't hit our maximum allowed active downloads.
+		while ( download_queue_node != NULL )
+		{
+			di = ( DOWNLOAD_INFO * )download_queue_node->data;
+
+			download_queue_node = download_queue_node->next;
+
+			if ( di != NULL )
+			{
+				// Remove the item from the download queue.
+				DLL_RemoveNode( &download_queue, &di->queue_node );
+				di->queue_node.data = NULL;
+
+				LeaveCriticalSection( &download_queue_cs );
+
+				StartDownload( di, false );
+
+				EnterCriticalSection( &download_queue_cs );
+
+				// Exit the loop if we've hit our maximum allowed active downloads.
+				if ( total_downloading >= cfg_max_downloads )
+				{
+					break;
+				}
+			}
+		}
+	}
+
+	LeaveCriticalSection( &download_queue_cs );
+}
+
+bool RetryTimedOut( SOCKET_CONTEXT *context )
+{
+	// Attempt to connect to a new address if we time out.
+	if ( context != NULL &&
+		 context->timed_out == TIME_OUT_RETRY && 
+		 context->address_info != NULL &&
+		 context->address_info->ai_next != NULL )
+	{
+		if ( context->socket != INVALID_SOCKET )
+		{
+			_shutdown( context->socket, SD_BOTH );
+			_closesocket( context->socket );
+			context->socket = INVALID_SOCKET;
+		}
+
+		if ( context->ssl != NULL )
+		{
+			SSL_free( context->ssl );
+			context->ssl = NULL;
+		}
+
+		addrinfoW *old_address_info = context->address_info;
+		context->address_info = context->address_info->ai_next;
+		old_address_info->ai_next = NULL;
+
+		FreeAddressInfo( old_address_info );
+
+		// If we're going to restart the download, then we need to reset these values.
+		context->header_info.chunk_length = 0;
+		context->header_info.end_of_header = NULL;
+		context->header_info.http_status = 0;
+		context->header_info.connection = CONNECTION_NONE;
+		context->header_info.content_encoding = CONTENT_ENCODING_NONE;
+		context->header_info.chunked_transfer = false;
+		//context->header_info.etag = false;
+		context->header_info.chunk_state = CHUNK_STATE_SIZE_START;
+		context->header_info.got_chunk_terminator = false;
+
+		if ( context->header_info.range_info != NULL )
+		{
+			context->header_info.range_info->content_length = 0;	// We must reset this to get the real request length (not the length of the 401/407 request).
+
+			context->header_info.range_info->range_start += context->header_info.range_info->content_offset;	// Begin where we left off.
+			context->header_info.range_info->content_offset = 0;	// Reset.
+		}
+
+		context->content_status = CONTENT_STATUS_NONE;
+
+		context->timed_out = TIME_OUT_FALSE;
+
+		context->status = STATUS_CONNECTING;
+
+		context->cleanup = 0;	// Reset. Can only be set in CleanupConnection and if there's no more pending operations.
+
+		// Connect to the remote server.
+		if ( !CreateConnection( context, context->request_info.host, context->request_info.port ) )
+		{
+			context->status = STATUS_FAILED;
+		}
+		else
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool RetryReusedConnection( SOCKET_CONTEXT *context )
+{
+	// A pooled connection that fails before we get a response was most likely closed by the server while it was idle.
+	// This isn't counted as a retry. The new connection doesn't come from the pool.
+	if ( context != NULL &&
+		!g_end_program &&
+		 context->reused_connection &&
+		 context->header_info.http_status == 0 &&
+	   ( IS_STATUS( context->status,
+			STATUS_CONNECTING |
+			STATUS_DOWNLOADING ) ) )
+	{
+		if ( context->socket != INVALID_SOCKET )
+		{
+			_shutdown( context->socket, SD_BOTH );
+			_closesocket( context->socket );
+			context->socket = INVALID_SOCKET;
+		}
+
+		if ( context->ssl != NULL )
+		{
+			SSL_free( context->ssl );
+			context->ssl = NULL;
+		}
+
+		// The other connections to the host have likely been closed as well.
+		DiscardPooledConnections( context );
+
+		// If we're going to restart the download, then we need to reset these values.
+		context->header_info.chunk_length = 0;
+		context->header_info.end_of_header = NULL;
+		context->header_info.http_status = 0;
+		context->header_info.connection = CONNECTION_NONE;
+		context->header_info.content_encoding = CONTENT_ENCODING_NONE;
+		context->header_info.chunked_transfer = false;
+		//context->header_info.etag = false;
+		context->header_info.chunk_state = CHUNK_STATE_SIZE_START;
+		context->header_info.got_chunk_terminator = false;
+
+		if ( context->header_info.range_info != NULL )
+		{
+			context->header_info.range_info->content_length = 0;	// We must reset this to get the real request length (not the length of the 401/407 request).
+
+			context->header_info.range_info->range_start += context->header_info.range_info->content_offset;	// Begin where we left off.
+			context->header_info.range_info->content_offset = 0;	// Reset.
+		}
+
+		context->content_status = CONTENT_STATUS_NONE;
+
+		context->timed_out = TIME_OUT_FALSE;
+
+		context->status = STATUS_CONNECTING;
+
+		context->cleanup = 0;	// Reset. Can only be set in CleanupConnection and if there's no more pending operations.
+
+		// Connect to the remote server.
+		if ( !CreateConnection( context, context->request_info.host, context->request_info.port ) )
+		{
+			context->status = STATUS_FAILED;
+		}
+		else
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+DWORD CALLBACK MoveFileProgress( LARGE_INTEGER TotalFileSize, LARGE_INTEGER TotalBytesTransferred, LARGE_INTEGER StreamSize, LARGE_INTEGER StreamBytesTransferred, DWORD dwStreamNumber, DWORD dwCallbackReason, HANDLE hSourceFile, HANDLE hDestinationFile, LPVOID lpData )
+{
+	DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lpData;
+
+	if ( di != NULL )
+	{
+		if ( di->moving_state == 0 )
+		{
+			di->moving_state = 1;	// Move file.
+		}
+
+		di->last_downloaded = TotalBytesTransferred.QuadPart;
+
+		if ( di->moving_state == 2 )
+		{
+			di->last_downloaded = TotalFileSize.QuadPart; // Reset.
+
+			return PROGRESS_CANCEL;
+		}
+		else
+		{
+			return PROGRESS_CONTINUE;
+		}
+	}
+	else
+	{
+		return PROGRESS_CANCEL;
+	}
+}
+
+THREAD_RETURN ProcessMoveQueue( void *pArguments )
+{
+	DOWNLOAD_INFO *di = NULL;
+
+	bool skip_processing = false;
+
+	wchar_t prompt_message[ MAX_PATH + 512 ];
+	wchar_t file_path[ MAX_PATH ];
+
+	do
+	{
+		EnterCriticalSection( &move_file_queue_cs );
+
+		DoublyLinkedList *move_file_queue_node = move_file_queue;
+
+		if ( move_file_queue_node != NULL )
+		{
+			di = ( DOWNLOAD_INFO * )move_file_queue_node->data;
+
+			DLL_RemoveNode( &move_file_queue, move_file_queue_node );
+		}
+
+		LeaveCriticalSection( &move_file_queue_cs );
+
+		if ( di != NULL )
+		{
+			di->queue_node.data = NULL;
+
+			GetTemporaryFilePath( di, file_path );
+
+			di->file_path[ di->filename_offset - 1 ] = L'\\';	// Replace the download directory NULL terminator with a directory slash.
+
+			di->status &= ~STATUS_QUEUED;
+
+			DWORD move_type = MOVEFILE_COPY_ALLOWED;
+
+			while ( true )
+			{
+				if ( MoveFileWithProgressW( file_path, di->file_path, MoveFileProgress, di, move_type ) == FALSE )
+				{
+					if ( GetLastError() == ERROR_FILE_EXISTS )
+					{
+						if ( cfg_prompt_rename == 0 && di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS )
+						{
+							di->status = STATUS_SKIPPED;
+						}
+						else
+						{
+							// If the last return value was not set to remember our choice, then prompt again.
+							if ( cfg_prompt_rename == 0 &&
+								 g_rename_file_cmb_ret != CMBIDRENAMEALL &&
+								 g_rename_file_cmb_ret != CMBIDOVERWRITEALL &&
+								 g_rename_file_cmb_ret != CMBIDSKIPALL )
+							{
+								__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___already_exists, di->file_path );
+
+								g_rename_file_cmb_ret = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_RENAMEOVERWRITESKIPALL );
+							}
+
+							// Rename the file and try again.
+							if ( cfg_prompt_rename == 1 ||
+							   ( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDRENAME ||
+															 g_rename_file_cmb_ret == CMBIDRENAMEALL ) ) )
+							{
+								bool rename_succeeded = RenameFile( di, di->file_path, di->filename_offset, di->file_extension_offset );
+
+								if ( !rename_succeeded )
+								{
+									if ( g_rename_file_cmb_ret2 != CMBIDOKALL && !( di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS ) )
+									{
+										__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___could_not_be_renamed, file_path );
+
+										g_rename_file_cmb_ret2 = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_OKALL );
+									}
+
+									di->status = STATUS_SKIPPED;
+								}
+								else
+								{
+									continue;	// Try the move with our new filename.
+								}
+							}
+							else if ( cfg_prompt_rename == 3 ||
+									( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDFAIL ||
+																  g_rename_file_cmb_ret == CMBIDSKIP ||
+																  g_rename_file_cmb_ret == CMBIDSKIPALL ) ) ) // Skip the rename or overwrite if the return value fails, or the user selected skip.
+							{
+								di->status = STATUS_SKIPPED;
+							}
+							else	// Overwrite.
+							{
+								move_type |= MOVEFILE_REPLACE_EXISTING;
 
-				_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, filename_start, w_filename_length );
-				di->file_path[ di->filename_offset + w_filename_length ] = 0;	// Sanity.
+								continue;
+							}
+						}
+					}
+					else// if ( GetLastError() == ERROR_REQUEST_ABORTED )
+					{
+						di->status = STATUS_STOPPED;
+					}
+					/*else
+					{
+						di->status = STATUS_FILE_IO_ERROR;
+					}*/
+				}
+				else
+				{
+					di->status = STATUS_COMPLETED;
+				}
 
-				di->download_operations |= DOWNLOAD_OPERATION_OVERRIDE_FILENAME;
+				break;
 			}
-			else
-			{
-				wchar_t *directory = NULL;
 
-				if ( decode_converted_resource )
-				{
-					int val_length = WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, NULL, 0, NULL, NULL );
-					char *utf8_val = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * val_length ); // Size includes the null character.
-					WideCharToMultiByte( CP_UTF8, 0, resource, resource_length + 1, utf8_val, val_length, NULL, NULL );
+			di->file_path[ di->filename_offset - 1 ] = 0;	// Restore.
 
-					unsigned int directory_length = 0;
-					char *c_directory = url_decode_a( utf8_val, val_length - 1, &directory_length );
-					GlobalFree( utf8_val );
+			RemoveFilenameIndex( di );	// In case the file was renamed.
+		}
 
-					val_length = MultiByteToWideChar( CP_UTF8, 0, c_directory, directory_length + 1, NULL, 0 );	// Include the NULL terminator.
-					directory = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * val_length );
-					MultiByteToWideChar( CP_UTF8, 0, c_directory, directory_length + 1, directory, val_length );
+		EnterCriticalSection( &move_file_queue_cs );
 
-					GlobalFree( c_directory );	
-				}
-				else
-				{
-					directory = url_decode_w( resource, resource_length, NULL );
-				}
+		if ( move_file_queue == NULL )
+		{
+			skip_processing = true;
 
-				// Try to create a filename from the resource path.
-				if ( directory != NULL )
-				{
-					wchar_t *directory_ptr = directory;
-					wchar_t *current_directory = directory;
-					wchar_t *last_directory = NULL;
+			move_file_process_active = false;
+		}
 
-					// Iterate forward because '/' can be found after '#'.
-					while ( *directory_ptr != NULL )
-					{
-						if ( *directory_ptr == L'?' || *directory_ptr == L'#' )
-						{
-							*directory_ptr = 0;	// Sanity.
+		LeaveCriticalSection( &move_file_queue_cs );
+	}
+	while ( !skip_processing );
 
-							break;
-						}
-						else if ( *directory_ptr == L'/' )
-						{
-							last_directory = current_directory;
-							current_directory = directory_ptr + 1; 
-						}
+	EnterCriticalSection( &cleanup_cs );
 
-						++directory_ptr;
-					}
+	if ( total_downloading == 0 )
+	{
+		EnableTimers( false );
+	}
 
-					if ( *current_directory == NULL )
-					{
-						// Adjust for '/'. current_directory will always be at least 1 greater than last_directory.
-						if ( last_directory != NULL && ( current_directory - 1 ) - last_directory > 0 )
-						{
-							w_filename_length = ( unsigned int )( ( current_directory - 1 ) - last_directory );
-							current_directory = last_directory;
-						}
-						else	// No filename could be made from the resource path. Use the host name instead.
-						{
-							w_filename_length = host_length;
-							current_directory = host;
+	LeaveCriticalSection( &cleanup_cs );
 
-							di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
-						}
-					}
-					else
-					{
-						w_filename_length = ( unsigned int )( directory_ptr - current_directory );
-					}
+	_ExitThread( 0 );
+	return 0;
+}
 
-					w_filename_length = min( w_filename_length, ( int )( MAX_PATH - di->filename_offset - 1 ) );
+void AddToMoveFileQueue( DOWNLOAD_INFO *di )
+{
+	if ( di != NULL )
+	{
+		// Add item to move file queue and continue.
+		EnterCriticalSection( &move_file_queue_cs );
 
-					_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, current_directory, w_filename_length );
-					di->file_path[ di->filename_offset + w_filename_length ] = 0;	// Sanity.
+		di->queue_node.data = di;
+		DLL_AddNode( &move_file_queue, &di->queue_node, -1 );
 
-					EscapeFilename( di->file_path + di->filename_offset );
+		di->status = STATUS_MOVING_FILE | STATUS_QUEUED;
 
-					GlobalFree( directory );
-				}
-				else	// Shouldn't happen.
-				{
-					w_filename_length = 11;
-					_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, L"NO_FILENAME\0", 12 );
-				}
-			}
+		if ( !move_file_process_active )
+		{
+			move_file_process_active = true;
 
-			di->file_extension_offset = di->filename_offset + ( ( di->download_operations & DOWNLOAD_OPERATION_GET_EXTENSION ) ? w_filename_length : get_file_extension_offset( di->file_path + di->filename_offset, w_filename_length ) );
+			HANDLE handle_prompt = ( HANDLE )_CreateThread( NULL, 0, ProcessMoveQueue, NULL, 0, NULL );
 
-			if ( di->file_extension_offset == ( di->filename_offset + w_filename_length ) )
+			// Make sure our thread spawned.
+			if ( handle_prompt == NULL )
 			{
-				di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
-			}
-
-			di->hFile = INVALID_HANDLE_VALUE;
+				DLL_RemoveNode( &move_file_queue, &di->queue_node );
+				di->queue_node.data = NULL;
 
-			InitializeCriticalSection( &di->shared_cs );
+				move_file_process_active = false;
 
-			if ( current_url_encoded != NULL )
-			{
-				di->url = current_url_encoded;
-				current_url_encoded = NULL;
+				di->status = STATUS_STOPPED;
 			}
 			else
 			{
-				//di->url = GlobalStrDupW( current_url );
-				di->url = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( current_url_length + 1 ) );
-				_wmemcpy_s( di->url, current_url_length + 1, current_url, current_url_length );
-				di->url[ current_url_length ] = 0;	// Sanity.
+				CloseHandle( handle_prompt );
 			}
+		}
 
-			// Cache our file's icon.
-			ICON_INFO *ii = CacheIcon( di, sfi );
+		LeaveCriticalSection( &move_file_queue_cs );
+	}
+}
 
-			if ( ii != NULL )
-			{
-				di->icon = &ii->icon;
-			}
+bool CleanupFTPContexts( SOCKET_CONTEXT *context )
+{
+	bool skip_cleanup = false;
 
-			di->parts = ai->parts;
+	if ( context != NULL )
+	{
+		EnterCriticalSection( &cleanup_cs );
 
-			di->download_speed_limit = ai->download_speed_limit;
+		// This forces the FTP control context to cleanup everything.
+		if ( context->download_info != NULL )
+		{
+			DOWNLOAD_INFO *di = context->download_info;
 
-			di->ssl_version = ai->ssl_version;
+			EnterCriticalSection( &di->shared_cs );
 
-			di->download_operations |= ai->download_operations;
+			EnterCriticalSection( &context->context_cs );
 
-			if ( ai->download_operations & DOWNLOAD_OPERATION_ADD_STOPPED )
+			// We want the control port to handle everything.
+			if ( context->ftp_context != NULL )
 			{
-				di->status = STATUS_STOPPED;
-				di->download_operations &= ~DOWNLOAD_OPERATION_ADD_STOPPED;
-			}
+				if ( context->ftp_connection_type & ( FTP_CONNECTION_TYPE_CONTROL | FTP_CONNECTION_TYPE_CONTROL_SUCCESS ) )	// Control context.
+				{
+					context->cleanup = 0;	// Reset.
 
-			di->method = ai->method;
+					// Force the listen context to complete if it's still waiting.
+					// This will have been set to INVALID_SOCKET if the AcceptEx completed.
+					if ( context->ftp_connection_type == FTP_CONNECTION_TYPE_CONTROL &&
+						 context->listen_socket != INVALID_SOCKET )
+					{
+						_shutdown( context->listen_socket, SD_BOTH );
+						_closesocket( context->listen_socket );
+						context->listen_socket = INVALID_SOCKET;
+					}
 
-			if ( username == NULL && password == NULL )
-			{
-				LOGIN_INFO tli;
-				tli.host = host;
-				tli.protocol = protocol;
-				tli.port = port;
-				LOGIN_INFO *li = ( LOGIN_INFO * )dllrbt_find( g_login_info, ( void * )&tli, true );
+					context->ftp_connection_type = ( FTP_CONNECTION_TYPE_CONTROL | FTP_CONNECTION_TYPE_CONTROL_WAIT );	// Wait for Data to finish.
 
-				if ( li != NULL )
+					skip_cleanup = true;
+				}
+				else	// Data context.
 				{
-					username_length = lstrlenA( li->username );
-					if ( username_length > 0 )
+					if ( context->timed_out != TIME_OUT_FALSE )
 					{
-						di->auth_info.username = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( username_length + 1 ) );
-						_memcpy_s( di->auth_info.username, username_length + 1, li->username, username_length );
-						di->auth_info.username[ username_length ] = 0;	// Sanity.
+						// Force the Control connection to time out.
+						InterlockedExchange( &context->ftp_context->last_activity, ( LONG )( GetTickCount() - ( ( DWORD )cfg_timeout * 1000 ) ) );
+
+						SetTimeoutTimer( context->ftp_context, 0 );
 					}
 
-					password_length = lstrlenA( li->password );
-					if ( password_length > 0 )
+					if ( context->ftp_context->ftp_connection_type & FTP_CONNECTION_TYPE_CONTROL_WAIT )	// Control is waiting.
 					{
-						di->auth_info.password = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( password_length + 1 ) );
-						_memcpy_s( di->auth_info.password, password_length + 1, li->password, password_length );
-						di->auth_info.password[ password_length ] = 0;	// Sanity.
-					}
-				}
-			}
-			else
-			{
-				if ( username != NULL && username_length > 0 )
-				{
-					di->auth_info.username = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( username_length + 1 ) );
-					_memcpy_s( di->auth_info.username, username_length + 1, username, username_length );
-					di->auth_info.username[ username_length ] = 0;	// Sanity.
-				}
+						InterlockedIncrement( &context->ftp_context->pending_operations );
 
-				if ( password != NULL && password_length > 0 )
-				{
-					di->auth_info.password = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( password_length + 1 ) );
-					_memcpy_s( di->auth_info.password, password_length + 1, password, password_length );
-					di->auth_info.password[ password_length ] = 0;	// Sanity.
-				}
-			}
+						context->ftp_context->overlapped_close.current_operation = IO_Close;	// No need to shutdown.
 
-			if ( ai->utf8_cookies != NULL && cookies_length > 0 )
-			{
-				di->cookies = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( cookies_length + 1 ) );
-				_memcpy_s( di->cookies, cookies_length + 1, ai->utf8_cookies, cookies_length );
-				di->cookies[ cookies_length ] = 0;	// Sanity.
-			}
+						PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context->ftp_context, ( OVERLAPPED * )&context->ftp_context->overlapped_close );
+					}
 
-			if ( ai->utf8_headers != NULL && headers_length > 0 )
-			{
-				di->headers = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( headers_length + 1 ) );
-				_memcpy_s( di->headers, headers_length + 1, ai->utf8_headers, headers_length );
-				di->headers[ headers_length ] = 0;	// Sanity.
-			}
+					context->ftp_context->ftp_context = NULL;
 
-			if ( ai->utf8_data != NULL && data_length > 0 )
-			{
-				di->data = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( data_length + 1 ) );
-				_memcpy_s( di->data, data_length + 1, ai->utf8_data, data_length );
-				di->data[ data_length ] = 0;	// Sanity.
+					DLL_RemoveNode( &context->download_info->parts_list, &context->parts_node );
+
+					context->download_info = NULL;
+				}
 			}
 
-			SYSTEMTIME st;
-			FILETIME ft;
+			LeaveCriticalSection( &context->context_cs );
 
-			GetLocalTime( &st );
-			SystemTimeToFileTime( &st, &ft );
+			LeaveCriticalSection( &di->shared_cs );
+		}
 
-			di->add_time.LowPart = ft.dwLowDateTime;
-			di->add_time.HighPart = ft.dwHighDateTime;
+		LeaveCriticalSection( &cleanup_cs );
+	}
 
-			int buffer_length = 0;
+	return skip_cleanup;
+}
 
-			#ifndef NTDLL_USE_STATIC_LIB
-				//buffer_length = 64;	// Should be enough to hold most translated values.
-				buffer_length = __snwprintf( NULL, 0, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
-			#else
-				buffer_length = _scwprintf( L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
-			#endif
+bool SetCleanupState( SOCKET_CONTEXT *context )
+{
+	bool skip_cleanup = false;
 
-			di->w_add_time = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * buffer_length );
+	if ( context != NULL )
+	{
+		EnterCriticalSection( &context->context_cs );
 
-			__snwprintf( di->w_add_time, buffer_length, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) );
+		// If we've forced the cleanup, then skip everything below and wait for the pending operation to enter CleanupConnection to clean things up.
+		if ( context->cleanup == 2 )
+		{
+			context->cleanup = 1;	// All pending operations will shutdown/close and enter CleanupConnection to clean things up.
 
-			//EnterCriticalSection( &cleanup_cs );
+			skip_cleanup = true;
+		}
+		else if ( context->cleanup == 12 )	// We forced the cleanup and are waiting for IO_Write to complete.
+		{
+			context->cleanup = 10;	// Let IO_Write do its thing.
 
-			LVITEM lvi;
-			_memzero( &lvi, sizeof( LVITEM ) );
-			lvi.mask = LVIF_PARAM | LVIF_TEXT;
-			lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
-			lvi.lParam = ( LPARAM )di;
-			lvi.pszText = di->file_path + di->filename_offset;
-			_SendMessageW( g_hWnd_files, LVM_INSERTITEM, 0, ( LPARAM )&lvi );
+			skip_cleanup = true;
+		}
+		else if ( context->cleanup == 10 )
+		{
+			skip_cleanup = true;
+		}
+		else	// 0 or 1
+		{
+			context->cleanup = 1;	// All pending operations will shutdown/close and enter CleanupConnection to clean things up.
+		}
 
-			if ( !( ai->download_operations & DOWNLOAD_OPERATION_ADD_STOPPED ) )
-			{
-				StartDownload( di, !( di->download_operations & DOWNLOAD_OPERATION_SIMULATE ) );
-			}
+		LeaveCriticalSection( &context->context_cs );
+	}
 
-			download_history_changed = true;
+	return skip_cleanup;
+}
 
-			//LeaveCriticalSection( &cleanup_cs );
-		}
+// A finished range that was written straight to the file.
+bool IsFinishedRange( RANGE_INFO *ri )
+{
+	return ( ri != NULL &&
+			 ri->content_offset >= ( ( ri->range_end - ri->range_start ) + 1 ) &&
+			 ri->file_write_offset == ri->range_end + 1 );
+}
 
-		GlobalFree( current_url_encoded );
-		GlobalFree( host );
-		GlobalFree( resource );
+// Returns true if a part (including the one that's asking) still points to the range.
+bool IsRangeInUse( SOCKET_CONTEXT *context, RANGE_INFO *ri )
+{
+	if ( context->header_info.range_info == ri )
+	{
+		return true;
+	}
 
-		// If we got a username and password from the URL, then the username and password character strings were allocated and we need to free them.
-		if ( url_username != NULL ) { GlobalFree( username ); GlobalFree( url_username ); }
-		if ( url_password != NULL ) { GlobalFree( password ); GlobalFree( url_password ); }
+	DoublyLinkedList *parts_node = context->download_info->parts_list;
+	while ( parts_node != NULL )
+	{
+		SOCKET_CONTEXT *part_context = ( SOCKET_CONTEXT * )parts_node->data;
 
-		// Reset our username and password character strings.
-		username = ai->auth_info.username;
-		username_length = ai_username_length;
+		if ( part_context != NULL && part_context->header_info.range_info == ri )
+		{
+			return true;
+		}
 
-		password = ai->auth_info.password;
-		password_length = ai_password_length;
+		parts_node = parts_node->next;
 	}
 
-	// The tree is only used to determine duplicate filenames.
-	DestroyFilenameTree( add_files_tree );
+	return false;
+}
 
-	GlobalFree( sfi );
+// Joins neighboring ranges that have finished so that repeated steals don't keep growing the range list.
+// Returns the number of ranges that are left in use.
+// The download_info's shared_cs and range_list_cs must be held.
+unsigned int MergeFinishedRanges( SOCKET_CONTEXT *context )
+{
+	DOWNLOAD_INFO *di = context->download_info;
 
-	GlobalFree( ai->utf8_data );
-	GlobalFree( ai->utf8_headers );
-	GlobalFree( ai->utf8_cookies );
-	GlobalFree( ai->auth_info.username );
-	GlobalFree( ai->auth_info.password );
-	GlobalFree( ai->download_directory );
-	GlobalFree( ai->urls );
-	GlobalFree( ai );
+	unsigned int range_count = 0;
 
-	if ( cfg_sort_added_and_updating_items &&
-		 cfg_sorted_column_index != COLUMN_NUM )	// #
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL && range_node != di->range_list_end )
 	{
-		SORT_INFO si;
-		si.column = GetColumnIndexFromVirtualIndex( cfg_sorted_column_index, download_columns, NUM_COLUMNS );
-		si.hWnd = g_hWnd_files;
-		si.direction = cfg_sorted_direction;
+		DoublyLinkedList *next_range_node = range_node->next;
 
-		_SendMessageW( g_hWnd_files, LVM_SORTITEMS, ( WPARAM )&si, ( LPARAM )( PFNLVCOMPARE )DMCompareFunc );
-	}
+		RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
+		RANGE_INFO *next_ri = ( next_range_node != NULL ? ( RANGE_INFO * )next_range_node->data : NULL );
+
+		if ( next_range_node != di->range_list_end &&
+			 next_range_node != di->range_queue &&
+			 IsFinishedRange( ri ) &&
+			 IsFinishedRange( next_ri ) &&
+			 ri->range_end + 1 == next_ri->range_start &&
+			!IsRangeInUse( context, ri ) &&
+			!IsRangeInUse( context, next_ri ) )
+		{
+			ri->range_end = next_ri->range_end;
+			ri->content_length += next_ri->content_length;
+			ri->content_offset += next_ri->content_offset;
+			ri->file_write_offset = next_ri->file_write_offset;
 
-	ProcessingList( false );
+			DLL_RemoveNode( &di->range_list, next_range_node );
 
-	// Release the semaphore if we're killing the thread.
-	if ( worker_semaphore != NULL )
-	{
-		ReleaseSemaphore( worker_semaphore, 1, NULL );
-	}
+			GlobalFree( next_ri );
+			GlobalFree( next_range_node );
 
-	in_worker_thread = false;
+			continue;	// See if the range that follows can be joined as well.
+		}
 
-	LeaveCriticalSection( &worker_cs );
+		++range_count;
 
-	_ExitThread( 0 );
-	return 0;
+		range_node = next_range_node;
+	}
+
+	return range_count;
 }
 
-void StartQueuedItem()
+// Splits the largest range that another part is downloading and returns its second half.
+// The part that owned the range will stop once it reaches the new end of its range.
+// The download_info's shared_cs must be held.
+RANGE_INFO *StealRange( SOCKET_CONTEXT *context )
 {
-	EnterCriticalSection( &download_queue_cs );
+	if ( context == NULL || context->download_info == NULL ||
+	   ( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) ||
+	   ( context->request_info.protocol != PROTOCOL_HTTP && context->request_info.protocol != PROTOCOL_HTTPS ) )
+	{
+		return NULL;
+	}
+
+	DOWNLOAD_INFO *di = context->download_info;
+
+	SOCKET_CONTEXT *steal_context = NULL;
+	unsigned long long steal_length = 0;
 
-	if ( download_queue != NULL )
+	// Find the part with the most remaining. The values might change while we look, but they're checked again below.
+	DoublyLinkedList *parts_node = di->parts_list;
+	while ( parts_node != NULL )
 	{
-		DoublyLinkedList *download_queue_node = download_queue;
-
-		DOWNLOAD_INFO *di = NULL;
+		SOCKET_CONTEXT *part_context = ( SOCKET_CONTEXT * )parts_node->data;
 
-		// Run through our download queue and start the first context that hasn't been paused or stopped.
-		// Continue to dequeue if we haven't hit our maximum allowed active downloads.
-		while ( download_queue_node != NULL )
+		if ( part_context != NULL && part_context != context && part_context->header_info.range_info != NULL )
 		{
-			di = ( DOWNLOAD_INFO * )download_queue_node->data;
+			RANGE_INFO *ri = part_context->header_info.range_info;
 
-			download_queue_node = download_queue_node->next;
+			unsigned long long range_length = ( ri->range_end - ri->range_start ) + 1;
+			unsigned long long content_offset = GetBufferedContentOffset( part_context );
 
-			if ( di != NULL )
+			if ( content_offset < range_length && ( range_length - content_offset ) > steal_length )
 			{
-				// Remove the item from the download queue.
-				DLL_RemoveNode( &download_queue, &di->queue_node );
-				di->queue_node.data = NULL;
+				steal_context = part_context;
+				steal_length = range_length - content_offset;
+			}
+		}
 
-				LeaveCriticalSection( &download_queue_cs );
+		parts_node = parts_node->next;
+	}
 
-				StartDownload( di, false );
+	if ( steal_context == NULL || steal_length < MIN_STEAL_LENGTH )
+	{
+		return NULL;
+	}
 
-				EnterCriticalSection( &download_queue_cs );
+	EnterCriticalSection( &range_list_cs );
 
-				// Exit the loop if we've hit our maximum allowed active downloads.
-				if ( total_downloading >= cfg_max_downloads )
-				{
-					break;
-				}
-			}
-		}
-	}
+	unsigned int range_count = MergeFinishedRanges( context );
 
-	LeaveCriticalSection( &download_queue_cs );
-}
+	LeaveCriticalSection( &range_list_cs );
 
-bool RetryTimedOut( SOCKET_CONTEXT *context )
-{
-	// Attempt to connect to a new address if we time out.
-	if ( context != NULL &&
-		 context->timed_out == TIME_OUT_RETRY && 
-		 context->address_info != NULL &&
-		 context->address_info->ai_next != NULL )
+	if ( range_count >= MAX_RANGE_COUNT )
 	{
-		if ( context->socket != INVALID_SOCKET )
-		{
-			_shutdown( context->socket, SD_BOTH );
-			_closesocket( context->socket );
-			context->socket = INVALID_SOCKET;
-		}
+		return NULL;
+	}
 
-		if ( context->ssl != NULL )
+	RANGE_INFO *new_ri = NULL;
+
+	// The part might be waiting on the shared_cs that we hold, so don't wait on it.
+	if ( TryEnterCriticalSection( &steal_context->context_cs ) == TRUE )
+	{
+		RANGE_INFO *ri = steal_context->header_info.range_info;
+
+		// Only take from parts that have gotten their 206 response and whose content maps directly to the file.
+		if ( steal_context->cleanup == 0 &&
+			 steal_context->status == STATUS_DOWNLOADING &&
+			 steal_context->header_info.http_status == 206 &&
+			 steal_context->header_info.content_encoding == CONTENT_ENCODING_NONE &&
+			!steal_context->header_info.chunked_transfer &&
+			 ri->content_length > 0 &&
+		   ( steal_context->content_status == CONTENT_STATUS_GET_CONTENT || steal_context->content_status == CONTENT_STATUS_READ_MORE_CONTENT ) )
 		{
-			SSL_free( context->ssl );
-			context->ssl = NULL;
-		}
+			unsigned long long range_length = ( ri->range_end - ri->range_start ) + 1;
+			unsigned long long content_offset = GetBufferedContentOffset( steal_context );
 
-		addrinfoW *old_address_info = context->address_info;
-		context->address_info = context->address_info->ai_next;
-		old_address_info->ai_next = NULL;
+			if ( content_offset < range_length && ( range_length - content_offset ) >= MIN_STEAL_LENGTH )
+			{
+				// Allocate everything before the part's range is shortened so that a failure can't lose the second half.
+				new_ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+				DoublyLinkedList *new_range_node = ( new_ri != NULL ? DLL_CreateNode( ( void * )new_ri ) : NULL );
 
-		_FreeAddrInfoW( old_address_info );
+				if ( new_range_node == NULL )
+				{
+					GlobalFree( new_ri );
+					new_ri = NULL;
+				}
+				else
+				{
+					new_ri->range_start = ri->range_start + content_offset + ( ( range_length - content_offset ) / 2 );
+					new_ri->range_end = ri->range_end;
+					new_ri->file_write_offset = new_ri->range_start;
 
-		// If we're going to restart the download, then we need to reset these values.
-		context->header_info.chunk_length = 0;
-		context->header_info.end_of_header = NULL;
-		context->header_info.http_status = 0;
-		context->header_info.connection = CONNECTION_NONE;
-		context->header_info.content_encoding = CONTENT_ENCODING_NONE;
-		context->header_info.chunked_transfer = false;
-		//context->header_info.etag = false;
-		context->header_info.got_chunk_start = false;
-		context->header_info.got_chunk_terminator = false;
+					EnterCriticalSection( &range_list_cs );
 
-		if ( context->header_info.range_info != NULL )
-		{
-			context->header_info.range_info->content_length = 0;	// We must reset this to get the real request length (not the length of the 401/407 request).
+					ri->range_end = new_ri->range_start - 1;
 
-			context->header_info.range_info->range_start += context->header_info.range_info->content_offset;	// Begin where we left off.
-			context->header_info.range_info->content_offset = 0;	// Reset.
-		}
+					// The rest of the original range is still going to be sent, so the connection can't be pooled.
+					steal_context->header_info.connection = CONNECTION_CLOSE;
 
-		context->content_status = CONTENT_STATUS_NONE;
+					// Keep the range list in file order. It's what the progress bar expects.
+					DoublyLinkedList *range_node = di->range_list;
+					while ( range_node != NULL && range_node->data != ri )
+					{
+						range_node = range_node->next;
+					}
 
-		context->timed_out = TIME_OUT_FALSE;
+					if ( range_node != NULL )
+					{
+						new_range_node->prev = range_node;
+						new_range_node->next = range_node->next;
 
-		context->status = STATUS_CONNECTING;
+						if ( range_node->next != NULL )
+						{
+							range_node->next->prev = new_range_node;
+						}
+						else	// The new node is the tail.
+						{
+							di->range_list->prev = new_range_node;
+						}
 
-		context->cleanup = 0;	// Reset. Can only be set in CleanupConnection and if there's no more pending operations.
+						range_node->next = new_range_node;
+					}
+					else
+					{
+						DLL_AddNode( &di->range_list, new_range_node, -1 );
+					}
 
-		// Connect to the remote server.
-		if ( !CreateConnection( context, context->request_info.host, context->request_info.port ) )
-		{
-			context->status = STATUS_FAILED;
-		}
-		else
-		{
-			return true;
+					LeaveCriticalSection( &range_list_cs );
+				}
+			}
 		}
+
+		LeaveCriticalSection( &steal_context->context_cs );
 	}
 
-	return false;
+	return new_ri;
 }
 
-DWORD CALLBACK MoveFileProgress( LARGE_INTEGER TotalFileSize, LARGE_INTEGER TotalBytesTransferred, LARGE_INTEGER StreamSize, LARGE_INTEGER StreamBytesTransferred, DWORD dwStreamNumber, DWORD dwCallbackReason, HANDLE hSourceFile, HANDLE hDestinationFile, LPVOID lpData )
+// Returns the number of parts that an adaptive download from the host last settled on, or 0 if we haven't seen the host.
+unsigned char GetHostParts( char *host )
 {
-	DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lpData;
+	unsigned char parts = 0;
 
-	if ( di != NULL )
+	if ( host != NULL )
 	{
-		if ( di->moving_state == 0 )
+		EnterCriticalSection( &host_parts_cs );
+
+		HOST_PARTS *hp = ( HOST_PARTS * )dllrbt_find( g_host_parts, ( void * )host, true );
+		if ( hp != NULL )
 		{
-			di->moving_state = 1;	// Move file.
+			parts = hp->parts;
 		}
 
-		di->last_downloaded = TotalBytesTransferred.QuadPart;
+		LeaveCriticalSection( &host_parts_cs );
+	}
 
-		if ( di->moving_state == 2 )
-		{
-			di->last_downloaded = TotalFileSize.QuadPart; // Reset.
+	return parts;
+}
 
-			return PROGRESS_CANCEL;
-		}
-		else
+void SetHostParts( char *host, unsigned char parts )
+{
+	if ( host == NULL || parts == 0 )
+	{
+		return;
+	}
+
+	EnterCriticalSection( &host_parts_cs );
+
+	HOST_PARTS *hp = ( HOST_PARTS * )dllrbt_find( g_host_parts, ( void * )host, true );
+	if ( hp == NULL )
+	{
+		hp = ( HOST_PARTS * )GlobalAlloc( GMEM_FIXED, sizeof( HOST_PARTS ) );
+		if ( hp != NULL )
 		{
-			return PROGRESS_CONTINUE;
+			hp->host = GlobalStrDupA( host );
+			hp->parts = parts;
+
+			if ( hp->host == NULL || dllrbt_insert( g_host_parts, ( void * )hp->host, ( void * )hp ) != DLLRBT_STATUS_OK )
+			{
+				GlobalFree( hp->host );
+				GlobalFree( hp );
+			}
+			else
+			{
+				host_parts_changed = true;
+			}
 		}
 	}
-	else
+	else if ( hp->parts != parts )
 	{
-		return PROGRESS_CANCEL;
+		hp->parts = parts;
+
+		host_parts_changed = true;
 	}
+
+	LeaveCriticalSection( &host_parts_cs );
 }
 
-THREAD_RETURN ProcessMoveQueue( void *pArguments )
+// The progress values are published with a sequence count so that the UI can read them without taking the download's shared_cs.
+// The count is odd while the values are being changed. There can only be one writer, so an active download's shared_cs must be held.
+void SetDownloadProgress( DOWNLOAD_INFO *di, unsigned long long downloaded, unsigned long long file_size )
 {
-	DOWNLOAD_INFO *di = NULL;
+	InterlockedIncrement( &di->progress_sequence );
 
-	bool skip_processing = false;
+	di->downloaded = downloaded;
+	di->file_size = file_size;
 
-	wchar_t prompt_message[ MAX_PATH + 512 ];
-	wchar_t file_path[ MAX_PATH ];
+	InterlockedIncrement( &di->progress_sequence );
+}
 
-	do
-	{
-		EnterCriticalSection( &move_file_queue_cs );
+// The download_info's shared_cs must be held.
+void AddDownloadProgress( DOWNLOAD_INFO *di, unsigned long long length )
+{
+	InterlockedIncrement( &di->progress_sequence );
 
-		DoublyLinkedList *move_file_queue_node = move_file_queue;
+	di->downloaded += length;
 
-		if ( move_file_queue_node != NULL )
+	InterlockedIncrement( &di->progress_sequence );
+}
+
+// Reads a consistent copy of the progress values without locking. The 64-bit values could otherwise be torn on 32-bit systems.
+void GetDownloadProgress( DOWNLOAD_INFO *di, unsigned long long &downloaded, unsigned long long &file_size )
+{
+	for ( ;; )
+	{
+		LONG sequence = di->progress_sequence;
+
+		if ( sequence & 1 )
 		{
-			di = ( DOWNLOAD_INFO * )move_file_queue_node->data;
+			YieldProcessor();	// A writer is in the middle of an update.
 
-			DLL_RemoveNode( &move_file_queue, move_file_queue_node );
+			continue;
 		}
 
-		LeaveCriticalSection( &move_file_queue_cs );
+		MemoryBarrier();
 
-		if ( di != NULL )
-		{
-			di->queue_node.data = NULL;
+		downloaded = di->downloaded;
+		file_size = di->file_size;
 
-			GetTemporaryFilePath( di, file_path );
+		MemoryBarrier();
 
-			di->file_path[ di->filename_offset - 1 ] = L'\\';	// Replace the download directory NULL terminator with a directory slash.
+		if ( sequence == di->progress_sequence )
+		{
+			break;
+		}
+	}
+}
 
-			di->status &= ~STATUS_QUEUED;
+// Sets the number of parts that a new download starts with if it can be downloaded adaptively.
+// The ranges beyond that number are queued for when we add more parts.
+void InitializeAdaptiveParts( SOCKET_CONTEXT *context )
+{
+	DOWNLOAD_INFO *di = context->download_info;
 
-			DWORD move_type = MOVEFILE_COPY_ALLOWED;
+	// Adaptive downloads take ranges from their other parts, which only works for HTTP(S).
+	if ( !cfg_adaptive_download_parts || di == NULL || context->parts <= 1 ||
+	   ( di->download_operations & DOWNLOAD_OPERATION_SIMULATE ) ||
+	   ( context->request_info.protocol != PROTOCOL_HTTP && context->request_info.protocol != PROTOCOL_HTTPS ) )
+	{
+		return;
+	}
 
-			while ( true )
-			{
-				if ( MoveFileWithProgressW( file_path, di->file_path, MoveFileProgress, di, move_type ) == FALSE )
-				{
-					if ( GetLastError() == ERROR_FILE_EXISTS )
-					{
-						if ( cfg_prompt_rename == 0 && di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS )
-						{
-							di->status = STATUS_SKIPPED;
-						}
-						else
-						{
-							// If the last return value was not set to remember our choice, then prompt again.
-							if ( cfg_prompt_rename == 0 &&
-								 g_rename_file_cmb_ret != CMBIDRENAMEALL &&
-								 g_rename_file_cmb_ret != CMBIDOVERWRITEALL &&
-								 g_rename_file_cmb_ret != CMBIDSKIPALL )
-							{
-								__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___already_exists, di->file_path );
+	EnterCriticalSection( &di->shared_cs );
 
-								g_rename_file_cmb_ret = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_RENAMEOVERWRITESKIPALL );
-							}
+	// Don't override a limit that was set by hand.
+	if ( di->parts_limit == 0 || di->adaptive_state != ADAPTIVE_PARTS_OFF )
+	{
+		unsigned char parts = GetHostParts( context->request_info.host );
+		if ( parts == 0 )
+		{
+			parts = ADAPTIVE_PARTS_START;
+		}
 
-							// Rename the file and try again.
-							if ( cfg_prompt_rename == 1 ||
-							   ( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDRENAME ||
-															 g_rename_file_cmb_ret == CMBIDRENAMEALL ) ) )
-							{
-								// Creates a tree of active and queued downloads.
-								dllrbt_tree *add_files_tree = CreateFilenameTree();
+		if ( parts < context->parts )
+		{
+			di->parts_limit = parts;
 
-								bool rename_succeeded = RenameFile( di, add_files_tree, di->file_path, di->filename_offset, di->file_extension_offset );
+			di->adaptive_state = ADAPTIVE_PARTS_PROBING;
+			di->adaptive_sample_time = 0;
+			di->adaptive_sample_downloaded = 0;
+			di->adaptive_speed = 0;
+		}
+		else
+		{
+			di->parts_limit = 0;
 
-								// The tree is only used to determine duplicate filenames.
-								DestroyFilenameTree( add_files_tree );
+			di->adaptive_state = ADAPTIVE_PARTS_OFF;
+		}
+	}
 
-								if ( !rename_succeeded )
-								{
-									if ( g_rename_file_cmb_ret2 != CMBIDOKALL && !( di->download_operations & DOWNLOAD_OPERATION_OVERRIDE_PROMPTS ) )
-									{
-										__snwprintf( prompt_message, MAX_PATH + 512, ST_V_PROMPT___could_not_be_renamed, file_path );
+	LeaveCriticalSection( &di->shared_cs );
+}
 
-										g_rename_file_cmb_ret2 = CMessageBoxW( g_hWnd_main, prompt_message, PROGRAM_CAPTION, CMB_ICONWARNING | CMB_OKALL );
-									}
+// Samples the download's throughput and raises its part limit if the last part that was added made it faster.
+// Returns true if a part should be added with AddAdaptivePart.
+// The download_info's shared_cs must be held.
+bool UpdateAdaptiveParts( SOCKET_CONTEXT *context )
+{
+	DOWNLOAD_INFO *di = context->download_info;
 
-									di->status = STATUS_SKIPPED;
-								}
-								else
-								{
-									continue;	// Try the move with our new filename.
-								}
-							}
-							else if ( cfg_prompt_rename == 3 ||
-									( cfg_prompt_rename == 0 && ( g_rename_file_cmb_ret == CMBIDFAIL ||
-																  g_rename_file_cmb_ret == CMBIDSKIP ||
-																  g_rename_file_cmb_ret == CMBIDSKIPALL ) ) ) // Skip the rename or overwrite if the return value fails, or the user selected skip.
-							{
-								di->status = STATUS_SKIPPED;
-							}
-							else	// Overwrite.
-							{
-								move_type |= MOVEFILE_REPLACE_EXISTING;
+	if ( di == NULL || di->adaptive_state != ADAPTIVE_PARTS_PROBING || di->status != STATUS_DOWNLOADING )
+	{
+		return false;
+	}
 
-								continue;
-							}
-						}
-					}
-					else// if ( GetLastError() == ERROR_REQUEST_ABORTED )
-					{
-						di->status = STATUS_STOPPED;
-					}
-					/*else
-					{
-						di->status = STATUS_FILE_IO_ERROR;
-					}*/
-				}
-				else
-				{
-					di->status = STATUS_COMPLETED;
-				}
+	unsigned long long current_time = TW_GetTickCount();
 
-				break;
-			}
+	if ( di->adaptive_sample_time == 0 || di->downloaded < di->adaptive_sample_downloaded )
+	{
+		di->adaptive_sample_time = current_time;
+		di->adaptive_sample_downloaded = di->downloaded;
 
-			di->file_path[ di->filename_offset - 1 ] = 0;	// Restore.
-		}
+		return false;
+	}
 
-		EnterCriticalSection( &move_file_queue_cs );
+	unsigned long long elapsed = current_time - di->adaptive_sample_time;
+	if ( elapsed < ADAPTIVE_PARTS_INTERVAL )
+	{
+		return false;
+	}
 
-		if ( move_file_queue == NULL )
-		{
-			skip_processing = true;
+	unsigned long long speed = ( ( di->downloaded - di->adaptive_sample_downloaded ) * 1000 ) / elapsed;
 
-			move_file_process_active = false;
-		}
+	di->adaptive_sample_time = current_time;
+	di->adaptive_sample_downloaded = di->downloaded;
 
-		LeaveCriticalSection( &move_file_queue_cs );
+	// Wait until every part that's allowed to run is running. A speed limit would also hide any gains.
+	if ( di->active_parts < di->parts_limit || cfg_download_speed_limit > 0 || di->download_speed_limit > 0 )
+	{
+		return false;
 	}
-	while ( !skip_processing );
 
-	EnterCriticalSection( &cleanup_cs );
+	if ( ( speed * 100 ) > ( di->adaptive_speed * ( 100 + ADAPTIVE_PARTS_GAIN ) ) )
+	{
+		di->adaptive_speed = speed;
 
-	if ( total_downloading == 0 )
+		if ( di->parts_limit < di->parts )
+		{
+			++( di->parts_limit );
+
+			return true;
+		}
+	}
+	else if ( di->parts_limit > 1 )
 	{
-		EnableTimers( false );
+		// The last part that was added didn't help. It can finish its range, but it won't be given another.
+		--( di->parts_limit );
 	}
 
-	LeaveCriticalSection( &cleanup_cs );
+	di->adaptive_state = ADAPTIVE_PARTS_SETTLED;
 
-	_ExitThread( 0 );
-	return 0;
+	SetHostParts( context->request_info.host, di->parts_limit );
+
+	return false;
 }
 
-void AddToMoveFileQueue( DOWNLOAD_INFO *di )
+// Lowers the part limit of an adaptive download when one of its parts fails (server 503/429 responses, resets, and timeouts).
+// Parts that finish while the download is over its limit won't be given another range.
+void ReduceAdaptiveParts( SOCKET_CONTEXT *context )
 {
-	if ( di != NULL )
+	DOWNLOAD_INFO *di = context->download_info;
+
+	if ( di == NULL )
 	{
-		// Add item to move file queue and continue.
-		EnterCriticalSection( &move_file_queue_cs );
+		return;
+	}
 
-		di->queue_node.data = di;
-		DLL_AddNode( &move_file_queue, &di->queue_node, -1 );
+	EnterCriticalSection( &di->shared_cs );
 
-		di->status = STATUS_MOVING_FILE | STATUS_QUEUED;
+	if ( di->adaptive_state != ADAPTIVE_PARTS_OFF )
+	{
+		unsigned long long current_time = TW_GetTickCount();
 
-		if ( !move_file_process_active )
+		// The server will often drop all of our connections at once. Count that as one failure.
+		if ( di->adaptive_state == ADAPTIVE_PARTS_PROBING || ( current_time - di->adaptive_sample_time ) >= ADAPTIVE_PARTS_INTERVAL )
 		{
-			move_file_process_active = true;
-
-			HANDLE handle_prompt = ( HANDLE )_CreateThread( NULL, 0, ProcessMoveQueue, NULL, 0, NULL );
+			unsigned char parts_limit = ( di->active_parts < di->parts_limit ? di->active_parts : di->parts_limit );
 
-			// Make sure our thread spawned.
-			if ( handle_prompt == NULL )
-			{
-				DLL_RemoveNode( &move_file_queue, &di->queue_node );
-				di->queue_node.data = NULL;
+			di->parts_limit = ( parts_limit > 1 ? parts_limit - 1 : 1 );
 
-				move_file_process_active = false;
+			di->adaptive_state = ADAPTIVE_PARTS_SETTLED;
+			di->adaptive_sample_time = current_time;
+			di->adaptive_sample_downloaded = di->downloaded;
 
-				di->status = STATUS_STOPPED;
-			}
-			else
-			{
-				CloseHandle( handle_prompt );
-			}
+			SetHostParts( context->request_info.host, di->parts_limit );
 		}
-
-		LeaveCriticalSection( &move_file_queue_cs );
 	}
+
+	LeaveCriticalSection( &di->shared_cs );
 }
 
-bool CleanupFTPContexts( SOCKET_CONTEXT *context )
+// Creates a connection for the next queued range, or for half of the largest range that another part is downloading.
+void AddAdaptivePart( SOCKET_CONTEXT *context )
 {
-	bool skip_cleanup = false;
+	DOWNLOAD_INFO *di = context->download_info;
 
-	if ( context != NULL )
+	if ( di == NULL )
 	{
-		EnterCriticalSection( &cleanup_cs );
+		return;
+	}
 
-		// This forces the FTP control context to cleanup everything.
-		if ( context->download_info != NULL )
-		{
-			DOWNLOAD_INFO *di = context->download_info;
+	// Create the context before we take a range so that an allocation failure can't lose it.
+	SOCKET_CONTEXT *new_context = CreatePartContext( context );
+	if ( new_context == NULL )
+	{
+		return;
+	}
 
-			EnterCriticalSection( &di->shared_cs );
+	RANGE_INFO *ri = NULL;
 
-			EnterCriticalSection( &context->context_cs );
+	EnterCriticalSection( &di->shared_cs );
 
-			// We want the control port to handle everything.
-			if ( context->ftp_context != NULL )
-			{
-				if ( context->ftp_connection_type & ( FTP_CONNECTION_TYPE_CONTROL | FTP_CONNECTION_TYPE_CONTROL_SUCCESS ) )	// Control context.
-				{
-					context->cleanup = 0;	// Reset.
+	if ( di->range_queue != NULL && di->range_queue != di->range_list_end )
+	{
+		ri = ( RANGE_INFO * )di->range_queue->data;
+		di->range_queue = di->range_queue->next;
 
-					// Force the listen context to complete if it's still waiting.
-					// This will have been set to INVALID_SOCKET if the AcceptEx completed.
-					if ( context->ftp_connection_type == FTP_CONNECTION_TYPE_CONTROL &&
-						 context->listen_socket != INVALID_SOCKET )
-					{
-						_shutdown( context->listen_socket, SD_BOTH );
-						_closesocket( context->listen_socket );
-						context->listen_socket = INVALID_SOCKET;
-					}
+		ri->content_length = 0;
 
-					context->ftp_connection_type = ( FTP_CONNECTION_TYPE_CONTROL | FTP_CONNECTION_TYPE_CONTROL_WAIT );	// Wait for Data to finish.
+		ri->range_start += ri->content_offset;	// Begin where we left off.
+		ri->content_offset = 0;	// Reset.
+	}
+	else
+	{
+		ri = StealRange( context );
+	}
 
-					skip_cleanup = true;
-				}
-				else	// Data context.
-				{
-					if ( context->timed_out != TIME_OUT_FALSE )
-					{
-						// Force the Control connection to time out.
-						// Make sure it's larger than 300 and less than LONG_MAX.
-						InterlockedExchange( &context->ftp_context->timeout, SHRT_MAX );
-					}
+	if ( ri != NULL )
+	{
+		++( di->active_parts );
+	}
+	else	// There's nothing left to give the part.
+	{
+		--( di->parts_limit );
 
-					if ( context->ftp_context->ftp_connection_type & FTP_CONNECTION_TYPE_CONTROL_WAIT )	// Control is waiting.
-					{
-						InterlockedIncrement( &context->ftp_context->pending_operations );
+		di->adaptive_state = ADAPTIVE_PARTS_SETTLED;
+	}
 
-						context->ftp_context->overlapped_close.current_operation = IO_Close;	// No need to shutdown.
+	LeaveCriticalSection( &di->shared_cs );
 
-						PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )context->ftp_context, ( OVERLAPPED * )&context->ftp_context->overlapped_close );
-					}
+	if ( ri == NULL )
+	{
+		FreeSocketContext( new_context );
 
-					context->ftp_context->ftp_context = NULL;
+		return;
+	}
 
-					DLL_RemoveNode( &context->download_info->parts_list, &context->parts_node );
+	new_context->part = di->parts_limit;
 
-					context->download_info = NULL;
-				}
-			}
+	new_context->header_info.range_info = ri;
 
-			LeaveCriticalSection( &context->context_cs );
+	new_context->context_node.data = new_context;
 
-			LeaveCriticalSection( &di->shared_cs );
-		}
+	EnterCriticalSection( &context_list_cs );
 
-		LeaveCriticalSection( &cleanup_cs );
-	}
+	DLL_AddNode( &g_context_list, &new_context->context_node, 0 );
 
-	return skip_cleanup;
+	LeaveCriticalSection( &context_list_cs );
+
+	// Add to the parts list.
+	EnterCriticalSection( &di->shared_cs );
+
+	new_context->download_info = di;
+
+	new_context->parts_node.data = new_context;
+	DLL_AddNode( &di->parts_list, &new_context->parts_node, -1 );
+
+	LeaveCriticalSection( &di->shared_cs );
+
+	new_context->status = STATUS_CONNECTING;
+
+	if ( !CreateConnection( new_context, new_context->request_info.host, new_context->request_info.port ) )
+	{
+		new_context->status = STATUS_FAILED;
+
+		InterlockedIncrement( &new_context->pending_operations );
+
+		new_context->overlapped.current_operation = IO_Close;
+
+		PostQueuedCompletionStatus( g_hIOCP, 0, ( ULONG_PTR )new_context, ( OVERLAPPED * )&new_context->overlapped );
+	}
 }
 
-bool SetCleanupState( SOCKET_CONTEXT *context )
+// Frees a context that has no pending operations and is no longer in any list.
+void FreeSocketContext( SOCKET_CONTEXT *context )
 {
-	bool skip_cleanup = false;
+	if ( context->socket != INVALID_SOCKET )
+	{
+		_shutdown( context->socket, SD_BOTH );
+		_closesocket( context->socket );
+		context->socket = INVALID_SOCKET;
+	}
 
-	if ( context != NULL )
+	if ( context->listen_socket != INVALID_SOCKET )
 	{
-		EnterCriticalSection( &context->context_cs );
+		_shutdown( context->listen_socket, SD_BOTH );
+		_closesocket( context->listen_socket );
+		context->listen_socket = INVALID_SOCKET;
+	}
 
-		// If we've forced the cleanup, then skip everything below and wait for the pending operation to enter CleanupConnection to clean things up.
-		if ( context->cleanup == 2 )
-		{
-			context->cleanup = 1;	// All pending operations will shutdown/close and enter CleanupConnection to clean things up.
+	if ( context->race_socket != INVALID_SOCKET )
+	{
+		_closesocket( context->race_socket );
+		context->race_socket = INVALID_SOCKET;
+	}
 
-			skip_cleanup = true;
-		}
-		else if ( context->cleanup == 12 )	// We forced the cleanup and are waiting for IO_Write to complete.
-		{
-			context->cleanup = 10;	// Let IO_Write do its thing.
+	ReleaseFileMapping( context );
 
-			skip_cleanup = true;
-		}
-		else if ( context->cleanup == 10 )
-		{
-			skip_cleanup = true;
-		}
-		else	// 0 or 1
+	if ( context->ssl != NULL ) { SSL_free( context->ssl ); }
+
+	if ( context->address_info != NULL ) { FreeAddressInfo( context->address_info ); }
+	if ( context->proxy_address_info != NULL ) { _FreeAddrInfoW( context->proxy_address_info ); }
+
+	BP_Free( context->decompressed_buf );
+	BP_Free( context->write_buffer );
+	BP_Free( context->write_behind_buffer );
+	FreeDecompressionState( context );
+
+	FreePOSTInfo( &context->post_info );
+
+	FreeAuthInfo( &context->header_info.digest_info );
+	FreeAuthInfo( &context->header_info.proxy_digest_info );
+
+	if ( context->header_info.url_location.host != NULL ) { GlobalFree( context->header_info.url_location.host ); }
+	if ( context->header_info.url_location.resource != NULL ) { GlobalFree( context->header_info.url_location.resource ); }
+	if ( context->header_info.url_location.auth_info.username != NULL ) { GlobalFree( context->header_info.url_location.auth_info.username ); }
+	if ( context->header_info.url_location.auth_info.password != NULL ) { GlobalFree( context->header_info.url_location.auth_info.password ); }
+
+	if ( context->header_info.chunk_buffer != NULL ) { GlobalFree( context->header_info.chunk_buffer ); }
+
+	if ( context->header_info.cookies != NULL ) { GlobalFree( context->header_info.cookies ); }
+	if ( context->header_info.cookie_tree != NULL )
+	{
+		node_type *node = dllrbt_get_head( context->header_info.cookie_tree );
+		while ( node != NULL )
 		{
-			context->cleanup = 1;	// All pending operations will shutdown/close and enter CleanupConnection to clean things up.
+			COOKIE_CONTAINER *cc = ( COOKIE_CONTAINER * )node->val;
+			if ( cc != NULL )
+			{
+				GlobalFree( cc->cookie_name );
+				GlobalFree( cc->cookie_value );
+				GlobalFree( cc );
+			}
+
+			node = node->next;
 		}
 
-		LeaveCriticalSection( &context->context_cs );
+		dllrbt_delete_recursively( context->header_info.cookie_tree );
 	}
 
-	return skip_cleanup;
+	if ( context->request_info.host != NULL ) { GlobalFree( context->request_info.host ); }
+	if ( context->request_info.resource != NULL ) { GlobalFree( context->request_info.resource ); }
+
+	if ( context->request_info.auth_info.username != NULL ) { GlobalFree( context->request_info.auth_info.username ); }
+	if ( context->request_info.auth_info.password != NULL ) { GlobalFree( context->request_info.auth_info.password ); }
+
+	// context->download_info is freed in WM_DESTROY.
+
+	RemoveTimers( context );
+
+	DeleteCriticalSection( &context->context_cs );
+
+	BP_Free( context->buffer );
+
+	BP_Free( context );
 }
 
 void CleanupConnection( SOCKET_CONTEXT *context )
@@ -5146,6 +8263,9 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 			return;
 		}
 
+		// Write any coalesced content before we determine whether the part has completed.
+		FlushFileData( context );
+
 		// Check if our context timed out and if it has any additional addresses to connect to.
 		// If it does, then reuse the context and connect to the new address.
 		if ( RetryTimedOut( context ) )
@@ -5153,6 +8273,15 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 			return;
 		}
 
+		// A pooled connection might have been closed by the server while it was idle. If so, then connect again.
+		if ( RetryReusedConnection( context ) )
+		{
+			return;
+		}
+
+		// Hand a finished keep-alive connection to the pool before the context moves on to its next range or is freed.
+		ParkConnection( context );
+
 		bool retry_context_connection = false;
 
 		// This critical section must encompass the (context->download_info != NULL) section below so that any listview manipulation (like remove_items(...))
@@ -5179,6 +8308,15 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 					incomplete_part = true;
 				}
 
+				// The server might be refusing (503/429) or dropping our connections. Adaptive downloads will use fewer parts.
+				if ( incomplete_part &&
+				   ( IS_STATUS( context->status,
+						STATUS_CONNECTING |
+						STATUS_DOWNLOADING ) ) )
+				{
+					ReduceAdaptiveParts( context );
+				}
+
 				// Connecting, Downloading, Paused.
 				if ( incomplete_part &&
 					 context->retries < cfg_retry_parts_count &&
@@ -5215,7 +8353,7 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 					context->header_info.content_encoding = CONTENT_ENCODING_NONE;
 					context->header_info.chunked_transfer = false;
 					//context->header_info.etag = false;
-					context->header_info.got_chunk_start = false;
+					context->header_info.chunk_state = CHUNK_STATE_SIZE_START;
 					context->header_info.got_chunk_terminator = false;
 
 					if ( context->header_info.range_info != NULL )
@@ -5269,29 +8407,45 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 
 					LeaveCriticalSection( &download_queue_cs );
 
+					RemoveFilenameIndex( context->download_info );
+
 					EnterCriticalSection( &context->download_info->shared_cs );
 
 					DLL_RemoveNode( &context->download_info->parts_list, &context->parts_node );
 
 					if ( context->download_info->active_parts > 0 )
 					{
+						RANGE_INFO *next_range_info = NULL;
+
 						// If incomplete_part is tested below and is true and the new range fails, then the download will stop.
 						// If incomplete_part is not tested, then all queued ranges will be tried until they either all succeed or all fail.
+						// The part isn't given another range if an adaptive download has lowered its limit below the number of active parts.
 						if ( /*!incomplete_part &&*/
+						   ( context->download_info->parts_limit == 0 || context->download_info->active_parts <= context->download_info->parts_limit ) &&
 							 IS_STATUS_NOT( context->status,
 								STATUS_STOPPED |
 								STATUS_REMOVE |
 								STATUS_RESTART |
-								STATUS_UPDATING ) &&
-							 context->download_info->range_queue != NULL &&
-							 context->download_info->range_queue != context->download_info->range_list_end )
+								STATUS_UPDATING ) )
+						{
+							if ( context->download_info->range_queue != NULL &&
+								 context->download_info->range_queue != context->download_info->range_list_end )
+							{
+								next_range_info = ( RANGE_INFO * )context->download_info->range_queue->data;
+								context->download_info->range_queue = context->download_info->range_queue->next;
+							}
+							else if ( !incomplete_part && context->status == STATUS_DOWNLOADING )
+							{
+								// Nothing is queued, so help out the part that has the most left.
+								next_range_info = StealRange( context );
+							}
+						}
+
+						if ( next_range_info != NULL )
 						{
 							// Add back to the parts list.
 							DLL_AddNode( &context->download_info->parts_list, &context->parts_node, -1 );
 
-							DoublyLinkedList *range_queue_node = context->download_info->range_queue;
-							context->download_info->range_queue = context->download_info->range_queue->next;
-
 							context->retries = 0;
 
 							if ( context->socket != INVALID_SOCKET )
@@ -5321,10 +8475,10 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 							context->header_info.content_encoding = CONTENT_ENCODING_NONE;
 							context->header_info.chunked_transfer = false;
 							//context->header_info.etag = false;
-							context->header_info.got_chunk_start = false;
+							context->header_info.chunk_state = CHUNK_STATE_SIZE_START;
 							context->header_info.got_chunk_terminator = false;
 
-							context->header_info.range_info = ( RANGE_INFO * )range_queue_node->data;
+							context->header_info.range_info = next_range_info;
 
 							if ( context->header_info.range_info != NULL )
 							{
@@ -5428,11 +8582,25 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 
 							LeaveCriticalSection( &active_download_list_cs );
 
+							RemoveFilenameIndex( context->download_info );
+
 							context->download_info->time_remaining = 0;
 							context->download_info->speed = 0;
 
 							if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
 							{
+								// Every range has been written, so the file no longer needs to be sparse.
+								if ( context->download_info->status == STATUS_COMPLETED )
+								{
+									BY_HANDLE_FILE_INFORMATION bhfi;
+
+									if ( GetFileInformationByHandle( context->download_info->hFile, &bhfi ) != FALSE &&
+										 ( bhfi.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE ) )
+									{
+										SetSparseFile( context->download_info->hFile, false );
+									}
+								}
+
 								CloseHandle( context->download_info->hFile );
 								context->download_info->hFile = INVALID_HANDLE_VALUE;
 							}
@@ -5525,6 +8693,8 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 							else if ( IS_STATUS( context->status, STATUS_RESTART ) )
 							{
 								// Safe to free this here since the print_range_list will have been reset.
+								EnterCriticalSection( &range_list_cs );
+
 								while ( context->download_info->range_list != NULL )
 								{
 									DoublyLinkedList *range_node = context->download_info->range_list;
@@ -5534,9 +8704,11 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 									GlobalFree( range_node );
 								}
 
+								LeaveCriticalSection( &range_list_cs );
+
 								context->download_info->processed_header = false;
 
-								context->download_info->downloaded = 0;
+								SetDownloadProgress( context->download_info, 0, context->download_info->file_size );
 
 								context->download_info->last_modified.QuadPart = 0;
 
@@ -5550,6 +8722,8 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 							}
 							else
 							{
+								journal_download_history( context->download_info, JOURNAL_RECORD_PROGRESS );
+
 								if ( incomplete_download )
 								{
 									if ( context->download_info->retries < cfg_retry_downloads_count )
@@ -5600,73 +8774,7 @@ void CleanupConnection( SOCKET_CONTEXT *context )
 
 		if ( !retry_context_connection )
 		{
-			if ( context->socket != INVALID_SOCKET )
-			{
-				_shutdown( context->socket, SD_BOTH );
-				_closesocket( context->socket );
-				context->socket = INVALID_SOCKET;
-			}
-
-			if ( context->listen_socket != INVALID_SOCKET )
-			{
-				_shutdown( context->listen_socket, SD_BOTH );
-				_closesocket( context->listen_socket );
-				context->listen_socket = INVALID_SOCKET;
-			}
-
-			if ( context->ssl != NULL ) { SSL_free( context->ssl ); }
-
-			if ( context->address_info != NULL ) { _FreeAddrInfoW( context->address_info ); }
-			if ( context->proxy_address_info != NULL ) { _FreeAddrInfoW( context->proxy_address_info ); }
-
-			if ( context->decompressed_buf != NULL ) { GlobalFree( context->decompressed_buf ); }
-			if ( zlib1_state == ZLIB1_STATE_RUNNING ) { _inflateEnd( &context->stream ); }
-
-			FreePOSTInfo( &context->post_info );
-
-			FreeAuthInfo( &context->header_info.digest_info );
-			FreeAuthInfo( &context->header_info.proxy_digest_info );
-
-			if ( context->header_info.url_location.host != NULL ) { GlobalFree( context->header_info.url_location.host ); }
-			if ( context->header_info.url_location.resource != NULL ) { GlobalFree( context->header_info.url_location.resource ); }
-			if ( context->header_info.url_location.auth_info.username != NULL ) { GlobalFree( context->header_info.url_location.auth_info.username ); }
-			if ( context->header_info.url_location.auth_info.password != NULL ) { GlobalFree( context->header_info.url_location.auth_info.password ); }
-
-			if ( context->header_info.chunk_buffer != NULL ) { GlobalFree( context->header_info.chunk_buffer ); }
-
-			if ( context->header_info.cookies != NULL ) { GlobalFree( context->header_info.cookies ); }
-			if ( context->header_info.cookie_tree != NULL )
-			{
-				node_type *node = dllrbt_get_head( context->header_info.cookie_tree );
-				while ( node != NULL )
-				{
-					COOKIE_CONTAINER *cc = ( COOKIE_CONTAINER * )node->val;
-					if ( cc != NULL )
-					{
-						GlobalFree( cc->cookie_name );
-						GlobalFree( cc->cookie_value );
-						GlobalFree( cc );
-					}
-
-					node = node->next;
-				}
-
-				dllrbt_delete_recursively( context->header_info.cookie_tree );
-			}
-
-			if ( context->request_info.host != NULL ) { GlobalFree( context->request_info.host ); }
-			if ( context->request_info.resource != NULL ) { GlobalFree( context->request_info.resource ); }
-
-			if ( context->request_info.auth_info.username != NULL ) { GlobalFree( context->request_info.auth_info.username ); }
-			if ( context->request_info.auth_info.password != NULL ) { GlobalFree( context->request_info.auth_info.password ); }
-
-			// context->download_info is freed in WM_DESTROY.
-
-			DeleteCriticalSection( &context->context_cs );
-
-			if ( context->buffer != NULL ){ GlobalFree( context->buffer ); }
-
-			GlobalFree( context );
+			FreeSocketContext( context );
 		}
 
 		LeaveCriticalSection( &cleanup_cs );
@@ -22,15 +22,63 @@
 #include "globals.h"
 #include "ssl.h"
 #include "doublylinkedlist.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
 #include "dllrbt.h"
+#include "dns_cache.h"
 #include "zlib.h"
 
 #include <mswsock.h>
 
 #define BUFFER_SIZE				16384	// Maximum size of an SSL record.
+#define RECEIVE_BUFFER_MAX_SIZE	262144	// Plain text content receives can grow their buffer up to this size. Must be a power of 2 multiple of BUFFER_SIZE.
+
+#define WRITE_BUFFER_SIZE		1048576	// Received content is coalesced into blocks of up to this size before being written to the file.
+#define WRITE_BUFFER_ALIGNMENT	65536	// Coalesced blocks end on this file offset boundary so that the blocks that follow are aligned.
+
+#define MAPPED_VIEW_SIZE		4194304	// The size of the window that a part maps of the file when it copies content straight into it.
+#define MAPPED_VIEW_ALIGNMENT	65536	// Views must begin on the system's allocation granularity.
+
+#define MAPPING_STATE_NONE		0
+#define MAPPING_STATE_MAPPED	1
+#define MAPPING_STATE_DISABLED	2		// The file can't be mapped. Content is written with WriteFile.
+
+#define MIN_STEAL_LENGTH		2097152	// A part must have at least this much left to download before a finished part will take half of it.
+#define MAX_RANGE_COUNT			1024	// Ranges aren't split any further once a download has this many that can't be merged.
+
+#define ADAPTIVE_PARTS_START	2		// The number of parts an adaptive download starts with if we haven't downloaded from its host before.
+#define ADAPTIVE_PARTS_INTERVAL	3000	// Milliseconds between samples of a download's throughput.
+#define ADAPTIVE_PARTS_GAIN		10		// The percentage that the throughput must increase by for another part to be added.
+
+#define ADAPTIVE_PARTS_OFF		0
+#define ADAPTIVE_PARTS_PROBING	1		// Parts are added while the throughput keeps rising.
+#define ADAPTIVE_PARTS_SETTLED	2		// The throughput leveled off, or the server pushed back.
+
+#define CONNECTION_POOL_SIZE			32		// The maximum number of idle keep-alive connections that are kept open.
+#define CONNECTION_POOL_IDLE_TIMEOUT	15000	// Milliseconds that an idle connection is kept before it's closed. Servers commonly close theirs after 15 seconds or more.
+
+#define CONNECT_RACE_DELAY		250		// Milliseconds to wait on a connection attempt before the host's next address is tried alongside it. (RFC 8305)
+
+#define CONNECT_RACE_NONE		0
+#define CONNECT_RACE_WAITING	1		// The timer that starts the second attempt is set.
+#define CONNECT_RACE_RUNNING	2		// Both attempts are in progress.
+#define CONNECT_RACE_WON		3		// The second attempt connected. The first attempt is being cancelled.
+#define CONNECT_RACE_ALONE		4		// The first attempt failed. The second attempt continues on its own.
+
+#define CONNECT_RACE_CONTINUE	0
+#define CONNECT_RACE_SKIP		1		// The completion has been handled.
+#define CONNECT_RACE_CONNECTED	2		// Handle the completion as a successful IO_Connect.
+#define CONNECT_RACE_FAILED		3		// Handle the completion as a failed IO_Connect.
 
 #define MAX_FILE_SIZE			4294967296	// 4GB
 
+#define TIMEOUT_POLL_DELAY		1000	// How often (in milliseconds) a context's timeout timer fires while it can't time out.
+#define TIMEOUT_RETRY_DELAY		100		// How soon (in milliseconds) a timeout timer fires again if the context was busy.
+#define FTP_KEEP_ALIVE_INTERVAL	30000	// Milliseconds of idle time before a keep-alive is sent on the FTP Control connection.
+
+#define BANDWIDTH_BURST			100		// Milliseconds worth of tokens that a bucket can accumulate.
+#define BANDWIDTH_MAX_DELAY		250		// Deferred receives are rechecked at least this often (in milliseconds) so that they don't time out.
+
 #define STATUS_NONE						0x00000000
 #define STATUS_CONNECTING				0x00000001
 #define STATUS_DOWNLOADING				0x00000002
@@ -74,6 +122,21 @@
 #define CONTENT_ENCODING_GZIP		1
 #define CONTENT_ENCODING_DEFLATE	2
 #define CONTENT_ENCODING_UNHANDLED	3
+#define CONTENT_ENCODING_BROTLI		4
+#define CONTENT_ENCODING_ZSTD		5
+#define CONTENT_ENCODING_COUNT		6
+
+#define CHUNK_STATE_SIZE_START		0	// Before the first digit of the chunk size.
+#define CHUNK_STATE_SIZE			1
+#define CHUNK_STATE_EXTENSION		2
+#define CHUNK_STATE_SIZE_LF			3
+#define CHUNK_STATE_DATA			4
+#define CHUNK_STATE_DATA_CR			5
+#define CHUNK_STATE_DATA_LF			6
+#define CHUNK_STATE_TRAILER			7	// The start of a trailer field, or the blank line that ends the body.
+#define CHUNK_STATE_TRAILER_FIELD	8
+#define CHUNK_STATE_TRAILER_LF		9
+#define CHUNK_STATE_DONE			10
 
 #define AUTH_TYPE_NONE			0
 #define AUTH_TYPE_BASIC			1
@@ -92,6 +155,7 @@
 #define CONTENT_STATUS_ALLOCATE_FILE		8
 #define CONTENT_STATUS_HANDLE_RESPONSE		9	// Deals with HTTP status 206 and 401 responses.
 #define CONTENT_STATUS_HANDLE_REQUEST		10
+#define CONTENT_STATUS_DECODE_CONTENT		11	// The decompression window filled up. Decoding resumes once it's been written.
 
 #define SOCKS_STATUS_FAILED				   -1
 #define SOCKS_STATUS_NONE					0
@@ -119,6 +183,8 @@
 #define DOWNLOAD_OPERATION_OVERRIDE_FILENAME	0x08
 #define DOWNLOAD_OPERATION_GET_EXTENSION		0x10
 
+#define ADD_URL_PARSE_MIN_ENTRIES	256		// The fewest URLs that are worth giving their own thread.
+
 enum PROTOCOL
 {
 	PROTOCOL_UNKNOWN,
@@ -134,6 +200,9 @@ enum IO_OPERATION
 {
 	IO_Accept,
 	IO_Connect,
+	IO_ResolveAddress,
+	IO_StartConnectRace,
+	IO_ConnectRace,
 	IO_ClientHandshakeReply,
 	IO_ClientHandshakeResponse,
 	IO_ServerHandshakeResponse,
@@ -144,6 +213,7 @@ enum IO_OPERATION
 	IO_GetContent,
 	IO_ResumeGetContent,
 	IO_WriteFile,
+	IO_WriteBehind,
 	IO_Write,
 	IO_Shutdown,
 	IO_Close,
@@ -209,10 +279,10 @@ struct HEADER_INFO
 	unsigned short		http_status;
 	unsigned char		http_method;
 	unsigned char		connection;			// 0 = none/not found, 1 = keep-alive, 2 = close
-	unsigned char		content_encoding;	// 0 = none/not found, 1 = gzip, 2 = deflate, 3 = unhandled
+	unsigned char		content_encoding;	// 0 = none/not found, 1 = gzip, 2 = deflate, 3 = unhandled, 4 = brotli, 5 = zstd
+	unsigned char		chunk_state;		// Where the chunked transfer decoder left off. It picks up from here on the next read.
 	bool				chunked_transfer;
 	//bool				etag;
-	bool				got_chunk_start;
 	bool				got_chunk_terminator;
 };
 
@@ -241,6 +311,39 @@ struct OVERLAPPEDEX
 	IO_OPERATION		next_operation;
 };
 
+struct TOKEN_BUCKET
+{
+	unsigned long long	last_refill;	// The time (in milliseconds) that tokens were last added.
+	long long			tokens;			// In thousandths of a byte. Negative values are owed.
+};
+
+struct HOST_PARTS
+{
+	char				*host;
+	unsigned char		parts;			// The number of parts that an adaptive download from the host last settled on.
+};
+
+struct RESOLVE_REQUEST
+{
+	DoublyLinkedList	queue_node;		// Self reference to the g_resolve_queue.
+	SOCKET_CONTEXT		*context;
+	wchar_t				*key;			// host:port
+	wchar_t				*host;
+	wchar_t				port[ 6 ];
+};
+
+struct POOLED_CONNECTION
+{
+	DoublyLinkedList	pool_node;		// Self reference to the g_connection_pool.
+	unsigned long long	idle_time;		// The time (in milliseconds) that the connection was added to the pool.
+	char				*host;
+	SSL					*ssl;
+	SOCKET				socket;
+	PROTOCOL			protocol;
+	unsigned short		port;
+	char				ssl_version;	// The SSL/TLS session was negotiated with this version setting.
+};
+
 struct DOWNLOAD_INFO;
 
 struct SOCKET_CONTEXT
@@ -249,6 +352,8 @@ struct SOCKET_CONTEXT
 
 	z_stream			stream;
 
+	void				*decoder_state;		// The brotli or zstd decoder instance.
+
 	CRITICAL_SECTION	context_cs;
 
 	URL_LOCATION		request_info;
@@ -256,15 +361,27 @@ struct SOCKET_CONTEXT
 	OVERLAPPEDEX		overlapped;
 	OVERLAPPEDEX		overlapped_close;
 	OVERLAPPEDEX		overlapped_keep_alive;
+	OVERLAPPEDEX		overlapped_write_behind;
+	OVERLAPPEDEX		overlapped_race;	// The second connection attempt of a connect race.
 
 	DoublyLinkedList	context_node;	// Self reference to the g_context_list.
 	DoublyLinkedList	parts_node;		// Self reference to the parts_list of this context's download_info.
 
+	TIMER				timeout_timer;		// Times out the connection, or sends keep-alives on the FTP Control connection.
+	TIMER				bandwidth_timer;	// Defers the processing of received data while we're over the speed limit.
+	TIMER				race_timer;			// Starts the second connection attempt if the first hasn't connected in time.
+	TOKEN_BUCKET		bandwidth_bucket;	// This part's share of the download's speed limit.
+
 	WSABUF				wsabuf;
 	WSABUF				write_wsabuf;
 	WSABUF				keep_alive_wsabuf;
+	WSABUF				write_behind_wsabuf;
+	WSABUF				decode_wsabuf;	// The received content that's decoded once the full decompression window has been written.
 
 	unsigned long long	content_offset;
+	unsigned long long	bandwidth_release;	// The time (in milliseconds) that the last received data can be processed. 0 = not charged.
+	unsigned long long	mapped_offset;		// The file offset of mapped_view.
+	unsigned long long	mapped_file_size;	// The size of the file when it was mapped. Views never extend past it.
 
 	char				keep_alive_buffer[ 8 ];
 
@@ -272,9 +389,15 @@ struct SOCKET_CONTEXT
 
 	addrinfoW			*address_info;			// Address info of the server we're connecting to.
 	addrinfoW			*proxy_address_info;	// Address info of the server that we want to proxy.
+	addrinfoW			*race_address_info;		// The address (in address_info) of the second connection attempt.
 
 	char				*buffer;
 	char				*decompressed_buf;
+	char				*write_buffer;			// Coalesces received content into larger blocks before it's written to the file.
+	char				*write_behind_buffer;	// The block that's being written to the file while we continue to receive.
+	char				*mapped_view;			// The window of the file that content is copied into.
+
+	HANDLE				hMapping;				// A mapping of the download's file.
 
 	DOWNLOAD_INFO		*download_info;
 
@@ -283,17 +406,23 @@ struct SOCKET_CONTEXT
 	SSL					*ssl;
     SOCKET				socket;
 	SOCKET				listen_socket;	// Used for active (EPRT/PORT) FTP connections.
+	SOCKET				race_socket;	// The socket of the second connection attempt.
 
 	DWORD				current_bytes_read;
 
 	unsigned int		buffer_size;
 	unsigned int		decompressed_buf_size;
+	unsigned int		decompressed_length;	// The amount of decoded content in decompressed_buf that has yet to be written.
+	unsigned int		write_buffer_length;	// The amount of content in write_buffer that has yet to be written.
+	unsigned int		write_behind_length;	// The amount of content in write_behind_buffer that has yet to be written.
+	unsigned int		mapped_length;			// The length of mapped_view.
+	unsigned int		mapped_pending_length;	// The amount of content in mapped_view that has yet to be flushed and accounted for.
 
 	unsigned int		status;
 
 	volatile LONG		pending_operations;
-	volatile LONG		timeout;
-	volatile LONG		keep_alive_timeout;
+	volatile LONG		last_activity;		// The tick count (in milliseconds) when the last operation completed.
+	volatile LONG		keep_alive_time;	// The tick count (in milliseconds) when the FTP Control connection became idle or last sent a keep-alive.
 
 	char				content_status;
 
@@ -308,6 +437,11 @@ struct SOCKET_CONTEXT
 
 	unsigned char		cleanup;			// In cleanup function, or in worker thread doing/calling cleanup.
 
+	unsigned char		connect_race;		// The state of the connection attempts to the host's addresses.
+
+	unsigned char		mapping_state;
+	unsigned char		decoder_encoding;	// The content encoding that decoder_state was created for.
+
 	unsigned char		got_filename;		// For Content-Disposition header fields. 0 = none/not found, 1 = renamed (doesn't exist), 2 = renamed (exists)
 	unsigned char		got_last_modified;	// For Last-Modified header fields. 0 = none/not found, 1 = found, 2 = prompt
 
@@ -318,6 +452,10 @@ struct SOCKET_CONTEXT
 	bool				processed_header;
 
 	bool				is_paused;			// The last IO has completed while status is in the paused state.
+
+	bool				reused_connection;	// The socket (and its SSL/TLS session) was taken from the connection pool.
+
+	bool				write_pending;		// write_buffer is written once write_behind_buffer has been written. Receiving resumes after that.
 };
 
 struct ADD_INFO
@@ -335,6 +473,38 @@ struct ADD_INFO
 	char				ssl_version;
 };
 
+// A URL that was split from an ADD_INFO's URL list.
+struct ADD_URL_ENTRY
+{
+	wchar_t				*url;
+	wchar_t				*filename;			// Overrides the filename in the URL. NULL = Use the URL.
+	DOWNLOAD_INFO		*di;				// NULL if the URL couldn't be parsed or is a duplicate.
+	wchar_t				*host;				// Set if the site's login needs to be looked up. It's done once worker_cs is held.
+	PROTOCOL			protocol;
+	unsigned short		port;
+	unsigned int		url_length;
+	unsigned int		filename_length;
+	unsigned int		white_space_count;	// The number of spaces that need to be encoded.
+	unsigned long		url_hash;			// Lets most URLs be ordered without comparing their strings.
+	bool				decode_converted_resource;
+	bool				duplicate;			// The download list already has the URL with the same download directory and filename.
+};
+
+// A range of URLs for a thread to parse and the values that they share.
+struct ADD_URL_PARSE_INFO
+{
+	ADD_INFO			*ai;
+	ADD_URL_ENTRY		*entries;
+	unsigned int		start;
+	unsigned int		end;
+	int					username_length;
+	int					password_length;
+	int					cookies_length;
+	int					headers_length;
+	int					data_length;
+	unsigned int		download_directory_length;
+};
+
 struct RENAME_INFO
 {
 	DOWNLOAD_INFO		*di;
@@ -342,6 +512,12 @@ struct RENAME_INFO
 	unsigned short		filename_length;
 };
 
+struct FILENAME_INFO
+{
+	wchar_t				*filename;
+	unsigned int		count;		// The number of queued and active downloads that use the filename.
+};
+
 struct DOWNLOAD_INFO
 {
 	wchar_t				file_path[ MAX_PATH ];
@@ -358,6 +534,10 @@ struct DOWNLOAD_INFO
 	unsigned long long	time_remaining;
 	unsigned long long	time_elapsed;
 	unsigned long long	download_speed_limit;
+	TOKEN_BUCKET		bandwidth_bucket;
+	unsigned long long	adaptive_sample_time;		// When the throughput was last sampled.
+	unsigned long long	adaptive_sample_downloaded;	// The amount that was downloaded when the throughput was last sampled.
+	unsigned long long	adaptive_speed;				// The highest throughput that's been sampled.
 	AUTH_CREDENTIALS	auth_info;
 	wchar_t				*url;
 	wchar_t				*w_add_time;
@@ -367,6 +547,7 @@ struct DOWNLOAD_INFO
 	DoublyLinkedList	*range_queue;		// Inactive ranges that make up each download part.
 	DoublyLinkedList	*parts_list;		// The contexts that make up each download part.
 	HICON				*icon;
+	FILENAME_INFO		*filename_info;		// The download's entry in the filename index. NULL = Not queued or active.
 	char				*cookies;
 	char				*headers;
 	char				*data;				// POST payload.
@@ -375,9 +556,12 @@ struct DOWNLOAD_INFO
 	unsigned int		filename_offset;
 	unsigned int		file_extension_offset;
 	unsigned int		status;
+	unsigned int		history_id;			// The download's entry in the history journal. 0 = Not journaled yet.
+	volatile LONG		progress_sequence;	// Odd while downloaded or file_size is being changed. See GetDownloadProgress.
 	unsigned char		parts;
 	unsigned char		active_parts;
-	unsigned char		parts_limit;		// This is set if we reduce an active download's parts number.
+	unsigned char		parts_limit;		// This is set if we reduce an active download's parts number, or by the adaptive parts count.
+	unsigned char		adaptive_state;
 	unsigned char		retries;			// The number of times a download has been retried.
 	unsigned char		download_operations;
 	unsigned char		method;				// 1 = GET, 2 = POST
@@ -403,15 +587,69 @@ SECURITY_STATUS SSL_WSAShutdown( SOCKET_CONTEXT *context, OVERLAPPEDEX *overlapp
 
 DWORD WINAPI IOCPDownloader( LPVOID pArgs );
 DWORD WINAPI IOCPConnection( LPVOID WorkThreadContext );
+DWORD WINAPI Resolver( LPVOID WorkThreadContext );
 
 SOCKET CreateListenSocket();
 char CreateAcceptSocket( SOCKET listen_socket, bool use_ipv6 );
 SOCKET_CONTEXT *UpdateCompletionPort( SOCKET socket, bool use_ssl, unsigned char ssl_version, bool add_context, bool is_server );
 
 SOCKET_CONTEXT *CreateSocketContext();
+void AdjustReceiveBuffer( SOCKET_CONTEXT *context );
 bool CreateConnection( SOCKET_CONTEXT *context, char *host, unsigned short port );
 bool LoadConnectEx();
 void CleanupConnection( SOCKET_CONTEXT *context );
+void FreeSocketContext( SOCKET_CONTEXT *context );
+RANGE_INFO *StealRange( SOCKET_CONTEXT *context );
+
+void InitializeAdaptiveParts( SOCKET_CONTEXT *context );
+bool UpdateAdaptiveParts( SOCKET_CONTEXT *context );
+void ReduceAdaptiveParts( SOCKET_CONTEXT *context );
+void AddAdaptivePart( SOCKET_CONTEXT *context );
+
+void SetDownloadProgress( DOWNLOAD_INFO *di, unsigned long long downloaded, unsigned long long file_size );
+void AddDownloadProgress( DOWNLOAD_INFO *di, unsigned long long length );
+void GetDownloadProgress( DOWNLOAD_INFO *di, unsigned long long &downloaded, unsigned long long &file_size );
+
+bool QueueResolve( SOCKET_CONTEXT *context, wchar_t *key, wchar_t *host, wchar_t *port );
+
+void RemoveAddressInfo( SOCKET_CONTEXT *context, addrinfoW *address_info );
+void PromoteAddressInfo( SOCKET_CONTEXT *context, addrinfoW *address_info );
+
+SOCKET CreateConnectSocket( bool use_ipv6 );
+void StartConnectRace( SOCKET_CONTEXT *context );
+void StopConnectRace( SOCKET_CONTEXT *context );
+bool StartRaceAttempt( SOCKET_CONTEXT *context );
+char UpdateConnectRace( SOCKET_CONTEXT *context, bool racer, bool connected );
+
+bool IsPoolableConnection( SOCKET_CONTEXT *context );
+bool IsConnectionReusable( SOCKET_CONTEXT *context );
+bool ParkConnection( SOCKET_CONTEXT *context );
+bool TakePooledConnection( SOCKET_CONTEXT *context );
+void DiscardPooledConnections( SOCKET_CONTEXT *context );
+unsigned long PruneConnectionPool();
+void FreeConnectionPool();
+
+unsigned char GetHostParts( char *host );
+void SetHostParts( char *host, unsigned char parts );
+
+char BufferFileData( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_length, bool flush, char content_status );
+char BufferFileSlices( SOCKET_CONTEXT *context, WSABUF *slices, unsigned int slice_count, bool flush, char content_status );
+bool WritePendingData( SOCKET_CONTEXT *context );
+void FlushFileData( SOCKET_CONTEXT *context );
+
+unsigned int MapFileData( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_length );
+bool MapFileView( SOCKET_CONTEXT *context, unsigned long long offset );
+bool UnmapFileView( SOCKET_CONTEXT *context );
+bool ReleaseFileMapping( SOCKET_CONTEXT *context );
+unsigned long long GetBufferedFileOffset( SOCKET_CONTEXT *context );
+unsigned long long GetBufferedContentOffset( SOCKET_CONTEXT *context );
+
+unsigned long GetBandwidthDelay( SOCKET_CONTEXT *context, DWORD io_size );
+void DeferCompletion( SOCKET_CONTEXT *context, unsigned long delay );
+
+void SetTimeoutTimer( SOCKET_CONTEXT *context, unsigned long delay );
+void RemoveTimers( SOCKET_CONTEXT *context );
+void UpdateTimeoutTimers();
 
 SOCKET CreateSocket( bool IPv6 = false );
 
@@ -423,9 +661,10 @@ void EnableTimers( bool timer_state );
 DWORD WINAPI AddURL( void *add_info );
 void StartDownload( DOWNLOAD_INFO *di, bool check_if_file_exits );
 
-dllrbt_tree *CreateFilenameTree();
-void DestroyFilenameTree( dllrbt_tree *filename_tree );
-bool RenameFile( DOWNLOAD_INFO *di, dllrbt_tree *filename_tree, wchar_t *file_path, unsigned int filename_offset, unsigned int file_extension_offset );
+void AddFilenameIndex( DOWNLOAD_INFO *di );
+void RemoveFilenameIndex( DOWNLOAD_INFO *di );
+void UpdateFilenameIndex( DOWNLOAD_INFO *di );
+bool RenameFile( DOWNLOAD_INFO *di, wchar_t *file_path, unsigned int filename_offset, unsigned int file_extension_offset );
 
 THREAD_RETURN RenameFilePrompt( void *pArguments );
 THREAD_RETURN FileSizePrompt( void *pArguments );
@@ -456,17 +695,31 @@ extern CRITICAL_SECTION rename_file_prompt_list_cs;		// Guard access to the rena
 extern CRITICAL_SECTION last_modified_prompt_list_cs;	// Guard access to the last modified prompt list.
 extern CRITICAL_SECTION move_file_queue_cs;				// Guard access to the move file queue.
 extern CRITICAL_SECTION cleanup_cs;
+extern CRITICAL_SECTION bandwidth_cs;					// Guard access to the token buckets.
+extern CRITICAL_SECTION timer_wheel_cs;					// Guard access to the scheduler's timer wheel.
+extern CRITICAL_SECTION host_parts_cs;					// Guard access to the host parts tree.
+extern CRITICAL_SECTION connection_pool_cs;				// Guard access to the connection pool.
+extern CRITICAL_SECTION resolve_queue_cs;				// Guard access to the resolve queue.
+extern CRITICAL_SECTION decoder_stats_cs;				// Guard access to the decoder statistics.
+extern CRITICAL_SECTION filename_index_cs;				// Guard access to the filename index.
+extern CRITICAL_SECTION range_list_cs;					// Guard access to the range lists. Held with (never instead of) the download info's shared_cs when changing one.
 
 extern LPFN_ACCEPTEX _AcceptEx;
 extern LPFN_CONNECTEX _ConnectEx;
 
 extern DoublyLinkedList *g_context_list;
 
+extern dllrbt_tree *g_host_parts;
+
+extern bool host_parts_changed;
+
 extern unsigned long total_downloading;
 extern DoublyLinkedList *download_queue;
 
 extern DoublyLinkedList *active_download_list;
 
+extern dllrbt_tree *g_filename_index;				// Filenames of the queued and active downloads.
+
 extern DoublyLinkedList *file_size_prompt_list;		// List of downloads that need to be prompted to continue.
 extern DoublyLinkedList *rename_file_prompt_list;	// List of downloads that need to be prompted to continue.
 extern DoublyLinkedList *last_modified_prompt_list;	// List of downloads that need to be prompted to continue.
@@ -0,0 +1,354 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dns_cache.h"
+
+#include "lite_ntdll.h"
+#include "timer_wheel.h"
+
+dllrbt_tree *g_dns_cache = NULL;			// Resolved addresses (and hosts that don't exist) keyed by host:port.
+unsigned int g_dns_cache_count = 0;
+volatile LONG g_dns_cache_hits = 0;			// Lookups that were answered by the cache.
+volatile LONG g_dns_cache_misses = 0;		// Lookups that went to the system's resolver.
+
+CRITICAL_SECTION dns_cache_cs;				// Guard access to the DNS cache.
+
+// Copies an address list into allocations of our own so that contexts and the DNS cache can each have one.
+// The copy must be freed with FreeAddressInfo().
+addrinfoW *CopyAddressInfo( addrinfoW *address_info )
+{
+	addrinfoW *copy = NULL;
+	addrinfoW **next = &copy;
+
+	while ( address_info != NULL )
+	{
+		// The address is stored after the structure.
+		addrinfoW *ai = ( addrinfoW * )GlobalAlloc( GPTR, sizeof( addrinfoW ) + address_info->ai_addrlen );
+		if ( ai == NULL )
+		{
+			break;
+		}
+
+		ai->ai_flags = address_info->ai_flags;
+		ai->ai_family = address_info->ai_family;
+		ai->ai_socktype = address_info->ai_socktype;
+		ai->ai_protocol = address_info->ai_protocol;
+		ai->ai_addrlen = address_info->ai_addrlen;
+		ai->ai_addr = ( struct sockaddr * )( ai + 1 );
+
+		_memcpy_s( ai->ai_addr, ai->ai_addrlen, address_info->ai_addr, address_info->ai_addrlen );
+
+		*next = ai;
+		next = &ai->ai_next;
+
+		address_info = address_info->ai_next;
+	}
+
+	return copy;
+}
+
+void FreeAddressInfo( addrinfoW *address_info )
+{
+	while ( address_info != NULL )
+	{
+		addrinfoW *next = address_info->ai_next;
+
+		GlobalFree( address_info );
+
+		address_info = next;
+	}
+}
+
+// Reorders an address list so that its IPv4 and IPv6 addresses alternate, beginning with IPv4.
+// A connect race will then have its second attempt use the other address family. (RFC 8305)
+addrinfoW *InterleaveAddressInfo( addrinfoW *address_info )
+{
+	addrinfoW *ipv4_list = NULL, *ipv6_list = NULL;
+	addrinfoW **ipv4_next = &ipv4_list, **ipv6_next = &ipv6_list;
+
+	while ( address_info != NULL )
+	{
+		addrinfoW *ai = address_info;
+		address_info = address_info->ai_next;
+		ai->ai_next = NULL;
+
+		if ( ai->ai_family == AF_INET6 )
+		{
+			*ipv6_next = ai;
+			ipv6_next = &ai->ai_next;
+		}
+		else
+		{
+			*ipv4_next = ai;
+			ipv4_next = &ai->ai_next;
+		}
+	}
+
+	addrinfoW *interleaved = NULL;
+	addrinfoW **next = &interleaved;
+
+	while ( ipv4_list != NULL || ipv6_list != NULL )
+	{
+		if ( ipv4_list != NULL )
+		{
+			*next = ipv4_list;
+			next = &ipv4_list->ai_next;
+			ipv4_list = ipv4_list->ai_next;
+		}
+
+		if ( ipv6_list != NULL )
+		{
+			*next = ipv6_list;
+			next = &ipv6_list->ai_next;
+			ipv6_list = ipv6_list->ai_next;
+		}
+	}
+
+	*next = NULL;
+
+	return interleaved;
+}
+
+void FreeDNSCacheEntry( DNS_CACHE_ENTRY *dce )
+{
+	if ( dce != NULL )
+	{
+		FreeAddressInfo( dce->address_info );
+		GlobalFree( dce->key );
+		GlobalFree( dce );
+	}
+}
+
+// Returns host:port, which must be freed with GlobalFree().
+wchar_t *GetDNSCacheKey( wchar_t *host, wchar_t *port )
+{
+	int host_length = lstrlenW( host );
+	int port_length = lstrlenW( port ) + 1;	// Include the NULL terminator.
+	int key_length = host_length + 1 + port_length;
+
+	wchar_t *key = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * key_length );
+	if ( key != NULL )
+	{
+		_wmemcpy_s( key, key_length, host, host_length );
+		key[ host_length ] = L':';
+		_wmemcpy_s( key + host_length + 1, port_length, port, port_length );
+	}
+
+	return key;
+}
+
+// Gives address_info a copy of the host's cached addresses.
+// Returns DNS_CACHE_HIT, DNS_CACHE_NEGATIVE if the host is known not to exist, or DNS_CACHE_MISS.
+char GetCachedAddressInfo( wchar_t *key, addrinfoW **address_info )
+{
+	char cache_status = DNS_CACHE_MISS;
+
+	if ( key == NULL )
+	{
+		return cache_status;
+	}
+
+	EnterCriticalSection( &dns_cache_cs );
+
+	if ( g_dns_cache != NULL )
+	{
+		dllrbt_iterator *itr = dllrbt_find( g_dns_cache, ( void * )key, false );
+		if ( itr != NULL )
+		{
+			DNS_CACHE_ENTRY *dce = ( DNS_CACHE_ENTRY * )( ( node_type * )itr )->val;
+
+			if ( TW_GetTickCount() < dce->expires )
+			{
+				if ( dce->address_info != NULL )
+				{
+					*address_info = CopyAddressInfo( dce->address_info );
+					if ( *address_info != NULL )
+					{
+						cache_status = DNS_CACHE_HIT;
+					}
+				}
+				else
+				{
+					cache_status = DNS_CACHE_NEGATIVE;
+				}
+			}
+			else	// Expired.
+			{
+				dllrbt_remove( g_dns_cache, itr );
+
+				--g_dns_cache_count;
+
+				FreeDNSCacheEntry( dce );
+			}
+		}
+	}
+
+	LeaveCriticalSection( &dns_cache_cs );
+
+	if ( cache_status != DNS_CACHE_MISS )
+	{
+		InterlockedIncrement( &g_dns_cache_hits );
+	}
+
+	return cache_status;
+}
+
+// Adds a copy of the host's addresses to the cache, or replaces the ones that are there.
+// A NULL address_info caches a host that doesn't exist.
+void CacheAddressInfo( wchar_t *key, addrinfoW *address_info )
+{
+	if ( key == NULL )
+	{
+		return;
+	}
+
+	DNS_CACHE_ENTRY *dce = ( DNS_CACHE_ENTRY * )GlobalAlloc( GPTR, sizeof( DNS_CACHE_ENTRY ) );
+	if ( dce == NULL )
+	{
+		return;
+	}
+
+	int key_length = lstrlenW( key ) + 1;	// Include the NULL terminator.
+
+	dce->key = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * key_length );
+	if ( dce->key != NULL )
+	{
+		_wmemcpy_s( dce->key, key_length, key, key_length );
+	}
+
+	dce->address_info = CopyAddressInfo( address_info );
+
+	if ( dce->key == NULL || ( address_info != NULL && dce->address_info == NULL ) )
+	{
+		FreeDNSCacheEntry( dce );
+
+		return;
+	}
+
+	unsigned long long current_time = TW_GetTickCount();
+
+	dce->expires = current_time + ( address_info != NULL ? DNS_CACHE_TTL : DNS_NEGATIVE_CACHE_TTL );
+
+	EnterCriticalSection( &dns_cache_cs );
+
+	if ( g_dns_cache != NULL )
+	{
+		dllrbt_iterator *itr = dllrbt_find( g_dns_cache, ( void * )key, false );
+		if ( itr != NULL )
+		{
+			DNS_CACHE_ENTRY *old_dce = ( DNS_CACHE_ENTRY * )( ( node_type * )itr )->val;
+
+			dllrbt_remove( g_dns_cache, itr );
+
+			--g_dns_cache_count;
+
+			FreeDNSCacheEntry( old_dce );
+		}
+
+		// Make room by removing the entries that have expired.
+		if ( g_dns_cache_count >= DNS_CACHE_SIZE )
+		{
+			node_type *node = dllrbt_get_head( g_dns_cache );
+			while ( node != NULL )
+			{
+				DNS_CACHE_ENTRY *expired_dce = ( DNS_CACHE_ENTRY * )node->val;
+
+				node_type *next_node = node->next;
+
+				if ( current_time >= expired_dce->expires )
+				{
+					dllrbt_remove( g_dns_cache, node );
+
+					--g_dns_cache_count;
+
+					FreeDNSCacheEntry( expired_dce );
+				}
+
+				node = next_node;
+			}
+		}
+
+		// If the cache is still full, then the host isn't cached.
+		if ( g_dns_cache_count < DNS_CACHE_SIZE && dllrbt_insert( g_dns_cache, ( void * )dce->key, ( void * )dce ) == DLLRBT_STATUS_OK )
+		{
+			++g_dns_cache_count;
+
+			dce = NULL;
+		}
+	}
+
+	LeaveCriticalSection( &dns_cache_cs );
+
+	FreeDNSCacheEntry( dce );
+}
+
+// Gives address_info the host's cached addresses, or looks them up with the system's resolver and caches them.
+// Hosts that don't exist are cached as well. Temporary failures aren't cached, and leave address_info NULL.
+// Returns the status of the cache lookup.
+char ResolveAddressInfo( wchar_t *key, wchar_t *host, wchar_t *port, addrinfoW **address_info )
+{
+	char cache_status = GetCachedAddressInfo( key, address_info );
+	if ( cache_status == DNS_CACHE_MISS )
+	{
+		InterlockedIncrement( &g_dns_cache_misses );
+
+		struct addrinfoW hints;
+		addrinfoW *result = NULL;
+
+		_memzero( &hints, sizeof( addrinfoW ) );
+		hints.ai_family = AF_UNSPEC;	// Both IPv4 and IPv6 addresses can be raced.
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_IP;
+
+		int nRet = _GetAddrInfoW( host, port, &hints, &result );
+		if ( nRet == 0 )
+		{
+			*address_info = InterleaveAddressInfo( CopyAddressInfo( result ) );
+
+			_FreeAddrInfoW( result );
+
+			CacheAddressInfo( key, *address_info );
+		}
+		else if ( nRet == WSAHOST_NOT_FOUND || nRet == WSANO_DATA )	// Temporary failures aren't cached.
+		{
+			CacheAddressInfo( key, NULL );
+		}
+	}
+
+	return cache_status;
+}
+
+void FreeDNSCache()
+{
+	EnterCriticalSection( &dns_cache_cs );
+
+	node_type *node = dllrbt_get_head( g_dns_cache );
+	while ( node != NULL )
+	{
+		FreeDNSCacheEntry( ( DNS_CACHE_ENTRY * )node->val );
+
+		node = node->next;
+	}
+
+	dllrbt_delete_recursively( g_dns_cache );
+	g_dns_cache = NULL;
+
+	g_dns_cache_count = 0;
+
+	LeaveCriticalSection( &dns_cache_cs );
+}
@@ -0,0 +1,58 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DNS_CACHE_H
+#define _DNS_CACHE_H
+
+#include "lite_ws2_32.h"
+#include "dllrbt.h"
+
+#define DNS_CACHE_SIZE			256		// The maximum number of hosts whose addresses are cached.
+#define DNS_CACHE_TTL			60000	// Milliseconds that a host's addresses are cached. GetAddrInfoW doesn't give us the record TTLs, but the system's resolver honors them.
+#define DNS_NEGATIVE_CACHE_TTL	10000	// Milliseconds that a host that doesn't exist is cached.
+
+#define DNS_CACHE_MISS			0
+#define DNS_CACHE_HIT			1
+#define DNS_CACHE_NEGATIVE		2		// The host is known not to exist.
+
+struct DNS_CACHE_ENTRY
+{
+	wchar_t				*key;			// host:port
+	addrinfoW			*address_info;	// NULL if the host doesn't exist.
+	unsigned long long	expires;		// The time (in milliseconds) that the entry is no longer valid.
+};
+
+addrinfoW *CopyAddressInfo( addrinfoW *address_info );
+void FreeAddressInfo( addrinfoW *address_info );
+addrinfoW *InterleaveAddressInfo( addrinfoW *address_info );
+
+wchar_t *GetDNSCacheKey( wchar_t *host, wchar_t *port );
+char GetCachedAddressInfo( wchar_t *key, addrinfoW **address_info );
+void CacheAddressInfo( wchar_t *key, addrinfoW *address_info );
+char ResolveAddressInfo( wchar_t *key, wchar_t *host, wchar_t *port, addrinfoW **address_info );
+void FreeDNSCache();
+
+extern dllrbt_tree *g_dns_cache;
+extern unsigned int g_dns_cache_count;
+
+extern volatile LONG g_dns_cache_hits;
+extern volatile LONG g_dns_cache_misses;
+
+extern CRITICAL_SECTION dns_cache_cs;			// Guard access to the DNS cache.
+
+#endif
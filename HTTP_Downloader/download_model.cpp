@@ -0,0 +1,269 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "download_model.h"
+
+#include "lite_ntdll.h"
+
+#define DOWNLOAD_MODEL_MIN_CAPACITY	1024
+
+CRITICAL_SECTION download_model_cs;
+
+DOWNLOAD_INFO **g_download_items = NULL;
+unsigned int g_download_item_count = 0;
+unsigned int g_download_item_capacity = 0;
+
+void DM_Initialize()
+{
+	InitializeCriticalSection( &download_model_cs );
+}
+
+void DM_Uninitialize()
+{
+	GlobalFree( g_download_items );
+	g_download_items = NULL;
+	g_download_item_count = 0;
+	g_download_item_capacity = 0;
+
+	DeleteCriticalSection( &download_model_cs );
+}
+
+// download_model_cs must be held.
+bool DM_GrowItems( unsigned int count )
+{
+	if ( count <= g_download_item_capacity )
+	{
+		return true;
+	}
+
+	unsigned int capacity = ( g_download_item_capacity > 0 ? g_download_item_capacity : DOWNLOAD_MODEL_MIN_CAPACITY );
+	while ( capacity < count )
+	{
+		capacity *= 2;
+	}
+
+	DOWNLOAD_INFO **items = ( DOWNLOAD_INFO ** )GlobalAlloc( GMEM_FIXED, sizeof( DOWNLOAD_INFO * ) * capacity );
+	if ( items == NULL )
+	{
+		return false;
+	}
+
+	if ( g_download_item_count > 0 )
+	{
+		_memcpy_s( items, sizeof( DOWNLOAD_INFO * ) * capacity, g_download_items, sizeof( DOWNLOAD_INFO * ) * g_download_item_count );
+	}
+
+	GlobalFree( g_download_items );
+	g_download_items = items;
+	g_download_item_capacity = capacity;
+
+	return true;
+}
+
+// Makes room for count more items so that a large batch doesn't keep growing the array.
+bool DM_ReserveItems( unsigned int count )
+{
+	EnterCriticalSection( &download_model_cs );
+
+	bool ret = DM_GrowItems( g_download_item_count + count );
+
+	LeaveCriticalSection( &download_model_cs );
+
+	return ret;
+}
+
+// Appends an item. The listview's item count has to be updated afterward.
+bool DM_InsertItem( DOWNLOAD_INFO *di )
+{
+	bool ret = false;
+
+	if ( di == NULL )
+	{
+		return false;
+	}
+
+	EnterCriticalSection( &download_model_cs );
+
+	if ( DM_GrowItems( g_download_item_count + 1 ) )
+	{
+		g_download_items[ g_download_item_count++ ] = di;
+
+		ret = true;
+	}
+
+	LeaveCriticalSection( &download_model_cs );
+
+	return ret;
+}
+
+// Removes the items at each index in one pass. The indices can be in any order.
+void DM_RemoveItems( int *index_array, unsigned int count )
+{
+	if ( index_array == NULL )
+	{
+		return;
+	}
+
+	EnterCriticalSection( &download_model_cs );
+
+	// The model never holds a NULL item, so use it to mark the items that are going away.
+	for ( unsigned int i = 0; i < count; ++i )
+	{
+		if ( index_array[ i ] >= 0 && ( unsigned int )index_array[ i ] < g_download_item_count )
+		{
+			g_download_items[ index_array[ i ] ] = NULL;
+		}
+	}
+
+	unsigned int item_count = 0;
+
+	for ( unsigned int i = 0; i < g_download_item_count; ++i )
+	{
+		if ( g_download_items[ i ] != NULL )
+		{
+			g_download_items[ item_count++ ] = g_download_items[ i ];
+		}
+	}
+
+	g_download_item_count = item_count;
+
+	LeaveCriticalSection( &download_model_cs );
+}
+
+void DM_RemoveAllItems()
+{
+	EnterCriticalSection( &download_model_cs );
+
+	GlobalFree( g_download_items );
+	g_download_items = NULL;
+	g_download_item_count = 0;
+	g_download_item_capacity = 0;
+
+	LeaveCriticalSection( &download_model_cs );
+}
+
+// Returns NULL if the index is out of range. The listview's item count can briefly be larger than the model's.
+DOWNLOAD_INFO *DM_GetItem( int index )
+{
+	DOWNLOAD_INFO *di = NULL;
+
+	EnterCriticalSection( &download_model_cs );
+
+	if ( index >= 0 && ( unsigned int )index < g_download_item_count )
+	{
+		di = g_download_items[ index ];
+	}
+
+	LeaveCriticalSection( &download_model_cs );
+
+	return di;
+}
+
+unsigned int DM_GetItemCount()
+{
+	return g_download_item_count;
+}
+
+// Sorts the items with a listview compare function. Items that compare equal keep their order.
+// Returns an array that maps each item's old index to its new index. It must be freed by the caller.
+int *DM_SortItems( int ( CALLBACK *compare )( LPARAM, LPARAM, LPARAM ), LPARAM lParamSort, unsigned int &item_count )
+{
+	EnterCriticalSection( &download_model_cs );
+
+	item_count = g_download_item_count;
+
+	int *index_map = ( int * )GlobalAlloc( GMEM_FIXED, sizeof( int ) * ( item_count > 0 ? item_count : 1 ) );
+	unsigned int *order = ( unsigned int * )GlobalAlloc( GMEM_FIXED, sizeof( unsigned int ) * ( item_count > 0 ? item_count * 2 : 1 ) );
+	DOWNLOAD_INFO **items = ( DOWNLOAD_INFO ** )GlobalAlloc( GMEM_FIXED, sizeof( DOWNLOAD_INFO * ) * ( item_count > 0 ? item_count : 1 ) );
+
+	if ( index_map != NULL && order != NULL && items != NULL )
+	{
+		unsigned int *src = order;
+		unsigned int *dst = order + item_count;
+
+		for ( unsigned int i = 0; i < item_count; ++i )
+		{
+			src[ i ] = i;
+		}
+
+		// Bottom-up merge sort of the indices.
+		for ( unsigned int width = 1; width < item_count; width *= 2 )
+		{
+			for ( unsigned int start = 0; start < item_count; start += ( width * 2 ) )
+			{
+				unsigned int middle = ( start + width < item_count ? start + width : item_count );
+				unsigned int end = ( middle + width < item_count ? middle + width : item_count );
+
+				unsigned int left = start;
+				unsigned int right = middle;
+				unsigned int pos = start;
+
+				while ( left < middle && right < end )
+				{
+					// Take from the right only if it's strictly less than the left. This keeps the sort stable.
+					if ( compare( ( LPARAM )g_download_items[ src[ left ] ], ( LPARAM )g_download_items[ src[ right ] ], lParamSort ) > 0 )
+					{
+						dst[ pos++ ] = src[ right++ ];
+					}
+					else
+					{
+						dst[ pos++ ] = src[ left++ ];
+					}
+				}
+
+				while ( left < middle )
+				{
+					dst[ pos++ ] = src[ left++ ];
+				}
+
+				while ( right < end )
+				{
+					dst[ pos++ ] = src[ right++ ];
+				}
+			}
+
+			unsigned int *swap = src;
+			src = dst;
+			dst = swap;
+		}
+
+		for ( unsigned int i = 0; i < item_count; ++i )
+		{
+			items[ i ] = g_download_items[ src[ i ] ];
+			index_map[ src[ i ] ] = i;
+		}
+
+		// Copy the items back rather than swapping arrays. A reader that holds worker_cs instead of download_model_cs always sees a valid item.
+		if ( item_count > 0 )
+		{
+			_memcpy_s( g_download_items, sizeof( DOWNLOAD_INFO * ) * g_download_item_capacity, items, sizeof( DOWNLOAD_INFO * ) * item_count );
+		}
+	}
+	else
+	{
+		GlobalFree( index_map );
+		index_map = NULL;
+	}
+
+	GlobalFree( items );
+	GlobalFree( order );
+
+	LeaveCriticalSection( &download_model_cs );
+
+	return index_map;
+}
@@ -0,0 +1,46 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DOWNLOAD_MODEL_H
+#define _DOWNLOAD_MODEL_H
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+struct DOWNLOAD_INFO;
+
+// The download list is an owner data listview. This is its data.
+// Items are only added or removed while worker_cs is held, and they're taken out of the model before they're freed.
+// A thread that doesn't hold worker_cs can hold download_model_cs to keep an item alive while it's being used (drawing, for example).
+extern CRITICAL_SECTION download_model_cs;
+
+void DM_Initialize();
+void DM_Uninitialize();
+
+bool DM_ReserveItems( unsigned int count );
+bool DM_InsertItem( DOWNLOAD_INFO *di );
+void DM_RemoveItems( int *index_array, unsigned int count );
+void DM_RemoveAllItems();
+
+DOWNLOAD_INFO *DM_GetItem( int index );
+unsigned int DM_GetItemCount();
+
+int *DM_SortItems( int ( CALLBACK *compare )( LPARAM, LPARAM, LPARAM ), LPARAM lParamSort, unsigned int &item_count );
+
+#endif
@@ -27,6 +27,10 @@
 
 #include "ftp_parsing.h"
 #include "connection.h"
+#include "download_model.h"
+#include "list_operations.h"
+
+#include <winioctl.h>
 
 wchar_t *UTF8StringToWideString( char *utf8_string, int string_length )
 {
@@ -46,6 +50,38 @@ char *WideStringToUTF8String( wchar_t *wide_string, int *utf8_string_length, int
 	return utf8_val;
 }
 
+// Marks the file as sparse so that extending it doesn't have the file system zero out the new space.
+// Fails on volumes that don't support sparse files (FAT32, exFAT).
+// A completed download clears the flag. Every range has been written by then, so nothing is left to allocate.
+bool SetSparseFile( HANDLE hFile, bool sparse )
+{
+	bool ret = false;
+
+	HANDLE hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+	if ( hEvent != NULL )
+	{
+		OVERLAPPED ov;
+		_memzero( &ov, sizeof( OVERLAPPED ) );
+		ov.hEvent = ( HANDLE )( ( ULONG_PTR )hEvent | 1 );	// Setting the low-order bit prevents the completion from being queued to our completion port.
+
+		FILE_SET_SPARSE_BUFFER fssb;
+		fssb.SetSparse = ( sparse ? TRUE : FALSE );
+
+		DWORD bytes = 0;
+		BOOL bRet = DeviceIoControl( hFile, FSCTL_SET_SPARSE, &fssb, sizeof( FILE_SET_SPARSE_BUFFER ), NULL, 0, &bytes, &ov );
+		if ( bRet == FALSE && GetLastError() == ERROR_IO_PENDING )
+		{
+			bRet = GetOverlappedResult( hFile, &ov, &bytes, TRUE );
+		}
+
+		ret = ( bRet != FALSE );
+
+		CloseHandle( hEvent );
+	}
+
+	return ret;
+}
+
 char read_config()
 {
 	char ret_status = 0;
@@ -75,7 +111,7 @@ char read_config()
 			{
 				char version = cfg_buf[ 3 ];
 
-				reserved = 1024 - ( version == 5 ? 636 : 588 );
+				reserved = 1024 - ( version == 5 ? 639 : 588 );
 
 				char *next = cfg_buf + 4;
 
@@ -460,6 +496,25 @@ char read_config()
 						_memcpy_s( td_progress_colors[ i ], sizeof( COLORREF ), next, sizeof( COLORREF ) );
 						next += sizeof( COLORREF );
 					}
+
+					// Older settings files have a reserved (zeroed) byte here. Keep the default for them.
+					if ( *next != 0 )
+					{
+						cfg_adaptive_download_parts = ( *next == 1 );	// 1 = On, 2 = Off
+					}
+					next += sizeof( unsigned char );
+
+					if ( *next != 0 )
+					{
+						cfg_accept_compressed_content = ( *next == 1 );	// 1 = On, 2 = Off
+					}
+					next += sizeof( unsigned char );
+
+					if ( *next != 0 )
+					{
+						cfg_enable_file_mapping = ( *next == 1 );	// 1 = On, 2 = Off
+					}
+					next += sizeof( unsigned char );
 				}
 
 
@@ -1167,10 +1222,10 @@ char save_config()
 	HANDLE hFile_cfg = CreateFile( base_directory, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
 	if ( hFile_cfg != INVALID_HANDLE_VALUE )
 	{
-		int reserved = 1024 - 636;
+		int reserved = 1024 - 639;
 		int size = ( sizeof( int ) * 22 ) +
 				   ( sizeof( unsigned short ) * 7 ) +
-				   ( sizeof( char ) * 50 ) +
+				   ( sizeof( char ) * 53 ) +
 				   ( sizeof( bool ) * 34 ) +
 				   ( sizeof( unsigned long ) * 6 ) +
 				   ( sizeof( LONG ) * 4 ) +
@@ -1566,6 +1621,19 @@ char save_config()
 			pos += sizeof( COLORREF );
 		}
 
+		// 0 is what older versions reserved, so the setting is stored as 1 = on and 2 = off.
+		unsigned char adaptive_download_parts = ( cfg_adaptive_download_parts ? 1 : 2 );
+		_memcpy_s( write_buf + pos, size - pos, &adaptive_download_parts, sizeof( unsigned char ) );
+		pos += sizeof( unsigned char );
+
+		unsigned char accept_compressed_content = ( cfg_accept_compressed_content ? 1 : 2 );
+		_memcpy_s( write_buf + pos, size - pos, &accept_compressed_content, sizeof( unsigned char ) );
+		pos += sizeof( unsigned char );
+
+		unsigned char enable_file_mapping = ( cfg_enable_file_mapping ? 1 : 2 );
+		_memcpy_s( write_buf + pos, size - pos, &enable_file_mapping, sizeof( unsigned char ) );
+		pos += sizeof( unsigned char );
+
 
 		//
 
@@ -1910,702 +1978,2347 @@ char save_config()
 	return ret_status;
 }
 
-char read_download_history( wchar_t *file_path )
+// Add time, downloaded, file size, download speed limit, parts, parts limit, status, SSL version, processed header, download operations, method, and last modified.
+#define HISTORY_ENTRY_FIXED_SIZE	( ( sizeof( ULONGLONG ) * 2 ) + ( sizeof( unsigned long long ) * 3 ) + ( sizeof( unsigned char ) * 5 ) + sizeof( unsigned int ) + sizeof( bool ) )
+
+#define HISTORY_PARSE_MIN_ENTRIES	256		// The fewest entries that are worth giving their own thread.
+
+#define HISTORY_VARINT_MAX_SIZE		10		// A 64-bit value in 7-bit groups.
+#define HISTORY_RECORD_LENGTH_SIZE	5		// A 32-bit value in 7-bit groups.
+
+// Each field's key is its id shifted left by 1 and OR'd with its wire type.
+#define HISTORY_WIRE_VARINT			0
+#define HISTORY_WIRE_BYTES			1		// A varint length followed by that many bytes.
+
+#define HISTORY_FIELD_ADD_TIME				1
+#define HISTORY_FIELD_DOWNLOADED			2
+#define HISTORY_FIELD_FILE_SIZE				3
+#define HISTORY_FIELD_DOWNLOAD_SPEED_LIMIT	4
+#define HISTORY_FIELD_PARTS					5
+#define HISTORY_FIELD_PARTS_LIMIT			6
+#define HISTORY_FIELD_STATUS				7
+#define HISTORY_FIELD_SSL_VERSION			8
+#define HISTORY_FIELD_PROCESSED_HEADER		9
+#define HISTORY_FIELD_DOWNLOAD_OPERATIONS	10
+#define HISTORY_FIELD_METHOD				11
+#define HISTORY_FIELD_LAST_MODIFIED			12
+#define HISTORY_FIELD_DOWNLOAD_DIRECTORY	13		// UTF-8
+#define HISTORY_FIELD_FILENAME				14		// UTF-8
+#define HISTORY_FIELD_URL					15		// UTF-8
+#define HISTORY_FIELD_COOKIES				16
+#define HISTORY_FIELD_HEADERS				17
+#define HISTORY_FIELD_DATA					18
+#define HISTORY_FIELD_USERNAME				19		// Encoded with encode_cipher.
+#define HISTORY_FIELD_PASSWORD				20		// Encoded with encode_cipher.
+#define HISTORY_FIELD_RANGE					21		// One per range: start, length, content length, content offset, and file write offset. Only read.
+#define HISTORY_FIELD_RANGE_DELTA			22		// One per range: the same values as HISTORY_FIELD_RANGE, stored as differences from what they usually are.
+
+// Download infos that have been read, but not yet added to the listview. The index of each entry is its history_id - 1.
+struct HISTORY_ENTRIES
 {
-	char ret_status = 0;
+	DOWNLOAD_INFO	**entries;
+	unsigned int	count;
+	unsigned int	capacity;
+};
 
-	HANDLE hFile_read = CreateFile( file_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
-	if ( hFile_read != INVALID_HANDLE_VALUE )
+// A range of indexed entries for a thread to parse.
+struct HISTORY_PARSE_INFO
+{
+	char			*buf;
+	DWORD			*offsets;
+	DOWNLOAD_INFO	**entries;
+	unsigned int	start;
+	unsigned int	end;
+	unsigned char	version;	// The history file's version.
+};
+
+CRITICAL_SECTION history_journal_cs;	// Guard access to the history journal.
+
+HANDLE g_hFile_journal = INVALID_HANDLE_VALUE;
+char *g_journal_buf = NULL;				// Records are assembled in here before they're written.
+unsigned int g_journal_buf_size = 0;
+unsigned long long g_journal_size = 0;
+unsigned int g_next_history_id = 1;
+
+// Frees a download info that was never added to the listview.
+void free_download_history_entry( DOWNLOAD_INFO *di )
+{
+	if ( di != NULL )
 	{
-		DWORD read = 0, total_read = 0, offset = 0, last_entry = 0, last_total = 0;
-
-		char *p = NULL;
+		GlobalFree( di->url );
+		GlobalFree( di->cookies );
+		GlobalFree( di->headers );
+		GlobalFree( di->data );
+		GlobalFree( di->auth_info.username );
+		GlobalFree( di->auth_info.password );
+
+		while ( di->range_list != NULL )
+		{
+			DoublyLinkedList *range_node = di->range_list;
+			di->range_list = di->range_list->next;
 
-		ULARGE_INTEGER		add_time;
-		unsigned long long	downloaded;
-		unsigned long long	file_size;
-		unsigned long long	download_speed_limit;
+			GlobalFree( range_node->data );
+			GlobalFree( range_node );
+		}
 
-		char				*download_directory;
-		unsigned int		download_directory_length;
-		char				*filename;
-		unsigned int		filename_length;
+		GlobalFree( di );
+	}
+}
 
-		wchar_t				*url;
-		DoublyLinkedList	*range_list;
-		unsigned char		parts;
-		unsigned char		parts_limit;
-		unsigned int		status;
+bool set_history_entry( HISTORY_ENTRIES *he, unsigned int index, DOWNLOAD_INFO *di )
+{
+	if ( index >= he->capacity )
+	{
+		unsigned int capacity = ( he->capacity > 0 ? he->capacity : 1024 );
+		while ( capacity <= index )
+		{
+			capacity *= 2;
+		}
 
-		char				*cookies;
-		char				*headers;
-		char				*data;
+		DOWNLOAD_INFO **entries = ( DOWNLOAD_INFO ** )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO * ) * capacity );
+		if ( entries == NULL )
+		{
+			return false;
+		}
 
-		char				*username;
-		char				*password;
+		if ( he->entries != NULL )
+		{
+			_memcpy_s( entries, sizeof( DOWNLOAD_INFO * ) * capacity, he->entries, sizeof( DOWNLOAD_INFO * ) * he->count );
 
-		char				ssl_version;
+			GlobalFree( he->entries );
+		}
 
-		bool				processed_header;
-		unsigned char		download_operations;
-		unsigned char		method;
+		he->entries = entries;
+		he->capacity = capacity;
+	}
 
-		ULARGE_INTEGER		last_modified;
+	if ( he->entries[ index ] != NULL )
+	{
+		free_download_history_entry( he->entries[ index ] );
+	}
 
-		unsigned char range_count;
+	he->entries[ index ] = di;
 
-		char magic_identifier[ 4 ];
-		ReadFile( hFile_read, magic_identifier, sizeof( char ) * 4, &read, NULL );
-		if ( read == 4 && _memcmp( magic_identifier, MAGIC_ID_DOWNLOADS, 4 ) == 0 )
-		{
-			DWORD fz = GetFileSize( hFile_read, NULL ) - 4;
+	if ( index >= he->count )
+	{
+		he->count = index + 1;
+	}
 
-			char *history_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( 524288 + 1 ) );	// 512 KB buffer.
+	return true;
+}
 
-			SHFILEINFO *sfi = ( SHFILEINFO * )GlobalAlloc( GMEM_FIXED, sizeof( SHFILEINFO ) );
+// Returns the number of characters in a wide string (including the NULL character), or 0 if it's not terminated within length bytes.
+// The history file is mapped into memory so we can't rely on there being a NULL character at the end of the buffer.
+int get_history_string_length_w( char *p, DWORD length )
+{
+	for ( DWORD i = 0; i + 1 < length; i += sizeof( wchar_t ) )
+	{
+		if ( p[ i ] == 0 && p[ i + 1 ] == 0 )
+		{
+			return ( int )( i / sizeof( wchar_t ) ) + 1;
+		}
+	}
 
-			while ( total_read < fz )
-			{
-				ReadFile( hFile_read, history_buf, sizeof( char ) * 524288, &read, NULL );
-
-				history_buf[ read ] = 0;	// Guarantee a NULL terminated buffer.
-
-				// Make sure that we have at least part of the entry. This is the minimum size an entry could be.
-				// Include 3 wide NULL strings and 3 char NULL strings.
-				// Include 2 ints for username and password lengths.
-				// Include 1 unsigned char for range info.
-				if ( read < ( ( ( sizeof( ULONGLONG ) * 2 ) + ( sizeof( unsigned long long ) * 3 ) + ( sizeof( unsigned char ) * 5 ) + sizeof( unsigned int ) + sizeof( bool ) ) +
-							  ( ( sizeof( wchar_t ) * 3 ) + ( sizeof( char ) * 3 ) ) +
-								( sizeof( int ) * 2 ) + 
-								  sizeof( unsigned char ) ) )
-				{
-					break;
-				}
+	return 0;
+}
 
-				total_read += read;
+// Returns the number of characters in a string (including the NULL character), or 0 if it's not terminated within length bytes.
+int get_history_string_length_a( char *p, DWORD length )
+{
+	for ( DWORD i = 0; i < length; ++i )
+	{
+		if ( p[ i ] == 0 )
+		{
+			return ( int )i + 1;
+		}
+	}
 
-				// Prevent an infinite loop if a really really long entry causes us to jump back to the same point in the file.
-				// If it's larger than our buffer, then the file is probably invalid/corrupt.
-				if ( total_read == last_total )
-				{
-					break;
-				}
+	return 0;
+}
 
-				last_total = total_read;
+// Parses one entry of the download history. Nothing past buf + length is read.
+// The download info that's returned hasn't been added to the listview. NULL is returned if the entry is incomplete.
+DOWNLOAD_INFO *parse_download_history_entry( char *buf, DWORD length, DWORD &entry_length )
+{
+	DWORD offset = 0;
+
+	char *p = buf;
+
+	ULARGE_INTEGER		add_time;
+	unsigned long long	downloaded;
+	unsigned long long	file_size;
+	unsigned long long	download_speed_limit;
+
+	char				*download_directory = NULL;
+	unsigned int		download_directory_length = 0;
+	char				*filename = NULL;
+	unsigned int		filename_length = 0;
+
+	wchar_t				*url = NULL;
+	DoublyLinkedList	*range_list = NULL;
+	unsigned char		parts;
+	unsigned char		parts_limit;
+	unsigned int		status;
+
+	char				*cookies = NULL;
+	char				*headers = NULL;
+	char				*data = NULL;
+
+	char				*username = NULL;
+	char				*password = NULL;
+
+	char				ssl_version;
+
+	bool				processed_header;
+	unsigned char		download_operations;
+	unsigned char		method;
+
+	ULARGE_INTEGER		last_modified;
+
+	unsigned char		range_count;
+
+	int					string_length;
+
+	DOWNLOAD_INFO		*di = NULL;
+
+	// Add Time.
+	offset += sizeof( ULONGLONG );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &add_time.QuadPart, sizeof( ULONGLONG ), p, sizeof( ULONGLONG ) );
+	p += sizeof( ULONGLONG );
+
+	// Downloaded
+	offset += sizeof( unsigned long long );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &downloaded, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
+
+	// File Size
+	offset += sizeof( unsigned long long );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &file_size, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
 
-				p = history_buf;
-				offset = last_entry = 0;
+	// Download Speed Limit
+	offset += sizeof( unsigned long long );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &download_speed_limit, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
 
-				while ( offset < read )
-				{
-					download_directory = NULL;
-					download_directory_length = 0;
-					filename = NULL;
-					filename_length = 0;
-					url = NULL;
-					cookies = NULL;
-					headers = NULL;
-					data = NULL;
-					username = NULL;
-					password = NULL;
-					range_list = NULL;
-
-					// Add Time.
-					offset += sizeof( ULONGLONG );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &add_time.QuadPart, sizeof( ULONGLONG ), p, sizeof( ULONGLONG ) );
-					p += sizeof( ULONGLONG );
-
-					// Downloaded
-					offset += sizeof( unsigned long long );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &downloaded, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-					p += sizeof( unsigned long long );
-
-					// File Size
-					offset += sizeof( unsigned long long );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &file_size, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-					p += sizeof( unsigned long long );
-
-					// Download Speed Limit
-					offset += sizeof( unsigned long long );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &download_speed_limit, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-					p += sizeof( unsigned long long );
-
-					// Parts
-					offset += sizeof( unsigned char );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &parts, sizeof( unsigned char ), p, sizeof( unsigned char ) );
-					p += sizeof( unsigned char );
-
-					// Parts Limit
-					offset += sizeof( unsigned char );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &parts_limit, sizeof( unsigned char ), p, sizeof( unsigned char ) );
-					p += sizeof( unsigned char );
-
-					// Status
-					offset += sizeof( unsigned int );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &status, sizeof( unsigned int ), p, sizeof( unsigned int ) );
-					p += sizeof( unsigned int );
-
-					// SSL Version
-					offset += sizeof( char );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &ssl_version, sizeof( char ), p, sizeof( char ) );
-					p += sizeof( char );
-
-					// Create Range
-					offset += sizeof( bool );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &processed_header, sizeof( bool ), p, sizeof( bool ) );
-					p += sizeof( bool );
-
-					// Download Operations
-					offset += sizeof( unsigned char );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &download_operations, sizeof( unsigned char ), p, sizeof( unsigned char ) );
-					p += sizeof( unsigned char );
-
-					// Method
-					offset += sizeof( unsigned char );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &method, sizeof( unsigned char ), p, sizeof( unsigned char ) );
-					p += sizeof( unsigned char );
-
-					// Last Modified
-					offset += sizeof( ULONGLONG );
-					if ( offset >= read ) { goto CLEANUP; }
-					_memcpy_s( &last_modified.QuadPart, sizeof( ULONGLONG ), p, sizeof( ULONGLONG ) );
-					p += sizeof( ULONGLONG );
-
-					// Download Directory
-					int string_length = lstrlenW( ( wchar_t * )p ) + 1;
-
-					offset += ( string_length * sizeof( wchar_t ) );
-					if ( offset >= read ) { goto CLEANUP; }
-
-					download_directory = p;
-					download_directory_length = string_length;
-
-					p += ( string_length * sizeof( wchar_t ) );
-
-					// Filename
-					string_length = lstrlenW( ( wchar_t * )p ) + 1;
-
-					offset += ( string_length * sizeof( wchar_t ) );
-					if ( offset >= read ) { goto CLEANUP; }
-
-					filename = p;
-					filename_length = string_length - 1;
-
-					p += ( string_length * sizeof( wchar_t ) );
-
-					// URL
-					string_length = lstrlenW( ( wchar_t * )p ) + 1;
-
-					offset += ( string_length * sizeof( wchar_t ) );
-					if ( offset >= read ) { goto CLEANUP; }
-
-					url = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * string_length );
-					_wmemcpy_s( url, string_length, p, string_length );
-					*( url + ( string_length - 1 ) ) = 0;	// Sanity
-
-					p += ( string_length * sizeof( wchar_t ) );
-
-					// Cookies
-					string_length = lstrlenA( ( char * )p ) + 1;
-
-					offset += string_length;
-					if ( offset >= read ) { goto CLEANUP; }
+	// Parts
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &parts, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
 
-					// Let's not allocate an empty string.
-					if ( string_length > 1 )
-					{
-						cookies = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
-						_memcpy_s( cookies, string_length, p, string_length );
-						*( cookies + ( string_length - 1 ) ) = 0;	// Sanity
-					}
+	// Parts Limit
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &parts_limit, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
 
-					p += string_length;
+	// Status
+	offset += sizeof( unsigned int );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &status, sizeof( unsigned int ), p, sizeof( unsigned int ) );
+	p += sizeof( unsigned int );
 
-					// Headers
-					string_length = lstrlenA( ( char * )p ) + 1;
+	// SSL Version
+	offset += sizeof( char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &ssl_version, sizeof( char ), p, sizeof( char ) );
+	p += sizeof( char );
 
-					offset += string_length;
-					if ( offset >= read ) { goto CLEANUP; }
+	// Create Range
+	offset += sizeof( bool );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &processed_header, sizeof( bool ), p, sizeof( bool ) );
+	p += sizeof( bool );
 
-					// Let's not allocate an empty string.
-					if ( string_length > 1 )
-					{
-						headers = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
-						_memcpy_s( headers, string_length, p, string_length );
-						*( headers + ( string_length - 1 ) ) = 0;	// Sanity
-					}
+	// Download Operations
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &download_operations, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
 
-					p += string_length;
+	// Method
+	offset += sizeof( unsigned char );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &method, sizeof( unsigned char ), p, sizeof( unsigned char ) );
+	p += sizeof( unsigned char );
+
+	// Last Modified
+	offset += sizeof( ULONGLONG );
+	if ( offset >= length ) { goto CLEANUP; }
+	_memcpy_s( &last_modified.QuadPart, sizeof( ULONGLONG ), p, sizeof( ULONGLONG ) );
+	p += sizeof( ULONGLONG );
 
-					// Data
-					string_length = lstrlenA( ( char * )p ) + 1;
+	// Download Directory
+	string_length = get_history_string_length_w( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
 
-					offset += string_length;
-					if ( offset >= read ) { goto CLEANUP; }
+	offset += ( string_length * sizeof( wchar_t ) );
+	if ( offset >= length ) { goto CLEANUP; }
 
-					// Let's not allocate an empty string.
-					if ( string_length > 1 )
-					{
-						data = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
-						_memcpy_s( data, string_length, p, string_length );
-						*( data + ( string_length - 1 ) ) = 0;	// Sanity
-					}
+	download_directory = p;
+	download_directory_length = string_length;
 
-					p += string_length;
+	p += ( string_length * sizeof( wchar_t ) );
 
-					// Username
-					offset += sizeof( int );
-					if ( offset >= read ) { goto CLEANUP; }
+	// Filename
+	string_length = get_history_string_length_w( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
 
-					// Length of the string - not including the NULL character.
-					_memcpy_s( &string_length, sizeof( int ), p, sizeof( int ) );
-					p += sizeof( int );
+	offset += ( string_length * sizeof( wchar_t ) );
+	if ( offset >= length ) { goto CLEANUP; }
+
+	filename = p;
+	filename_length = string_length - 1;
+
+	p += ( string_length * sizeof( wchar_t ) );
+
+	// URL
+	string_length = get_history_string_length_w( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += ( string_length * sizeof( wchar_t ) );
+	if ( offset >= length ) { goto CLEANUP; }
+
+	url = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * string_length );
+	_wmemcpy_s( url, string_length, p, string_length );
+	*( url + ( string_length - 1 ) ) = 0;	// Sanity
+
+	p += ( string_length * sizeof( wchar_t ) );
+
+	// Cookies
+	string_length = get_history_string_length_a( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+
+	// Let's not allocate an empty string.
+	if ( string_length > 1 )
+	{
+		cookies = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
+		_memcpy_s( cookies, string_length, p, string_length );
+		*( cookies + ( string_length - 1 ) ) = 0;	// Sanity
+	}
 
-					offset += string_length;
-					if ( offset >= read ) { goto CLEANUP; }
-					if ( string_length > 0 )
-					{
-						// string_length does not contain the NULL character of the string.
-						username = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( string_length + 1 ) );
-						_memcpy_s( username, string_length, p, string_length );
-						username[ string_length ] = 0; // Sanity;
+	p += string_length;
 
-						decode_cipher( username, string_length );
+	// Headers
+	string_length = get_history_string_length_a( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
 
-						p += string_length;
-					}
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
 
-					// Password
-					offset += sizeof( int );
-					if ( offset >= read ) { goto CLEANUP; }
+	// Let's not allocate an empty string.
+	if ( string_length > 1 )
+	{
+		headers = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
+		_memcpy_s( headers, string_length, p, string_length );
+		*( headers + ( string_length - 1 ) ) = 0;	// Sanity
+	}
 
-					// Length of the string - not including the NULL character.
-					_memcpy_s( &string_length, sizeof( int ), p, sizeof( int ) );
-					p += sizeof( int );
+	p += string_length;
 
-					offset += string_length;
-					if ( offset >= read ) { goto CLEANUP; }
-					if ( string_length > 0 )
-					{
-						// string_length does not contain the NULL character of the string.
-						password = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( string_length + 1 ) );
-						_memcpy_s( password, string_length, p, string_length );
-						password[ string_length ] = 0; // Sanity;
+	// Data
+	string_length = get_history_string_length_a( p, length - offset );
+	if ( string_length == 0 ) { goto CLEANUP; }
 
-						decode_cipher( password, string_length );
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
 
-						p += string_length;
-					}
+	// Let's not allocate an empty string.
+	if ( string_length > 1 )
+	{
+		data = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
+		_memcpy_s( data, string_length, p, string_length );
+		*( data + ( string_length - 1 ) ) = 0;	// Sanity
+	}
 
-					// Range Info.
-					offset += sizeof( unsigned char );
-					if ( offset <= read )
-					{
-						range_count = *p;
-						p += sizeof( unsigned char );
+	p += string_length;
 
-						for ( unsigned char i = 0; i < range_count; ++i )
-						{
-							offset += ( sizeof( unsigned long long ) * 5 );
-							if ( offset > read ) { goto CLEANUP; }
+	// Username
+	offset += sizeof( int );
+	if ( offset >= length ) { goto CLEANUP; }
 
-							RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+	// Length of the string - not including the NULL character.
+	_memcpy_s( &string_length, sizeof( int ), p, sizeof( int ) );
+	p += sizeof( int );
 
-							_memcpy_s( &ri->range_start, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-							p += sizeof( unsigned long long );
+	if ( string_length < 0 ) { goto CLEANUP; }
 
-							_memcpy_s( &ri->range_end, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-							p += sizeof( unsigned long long );
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+	if ( string_length > 0 )
+	{
+		// string_length does not contain the NULL character of the string.
+		username = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( string_length + 1 ) );
+		_memcpy_s( username, string_length, p, string_length );
+		username[ string_length ] = 0; // Sanity;
 
-							_memcpy_s( &ri->content_length, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-							p += sizeof( unsigned long long );
+		decode_cipher( username, string_length );
 
-							_memcpy_s( &ri->content_offset, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-							p += sizeof( unsigned long long );
+		p += string_length;
+	}
 
-							_memcpy_s( &ri->file_write_offset, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
-							p += sizeof( unsigned long long );
+	// Password
+	offset += sizeof( int );
+	if ( offset >= length ) { goto CLEANUP; }
 
-							DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
-							DLL_AddNode( &range_list, range_node, -1 );
-						}
-					}
+	// Length of the string - not including the NULL character.
+	_memcpy_s( &string_length, sizeof( int ), p, sizeof( int ) );
+	p += sizeof( int );
 
-					last_entry = offset;	// This value is the ending offset of the last valid entry.
+	if ( string_length < 0 ) { goto CLEANUP; }
 
-					DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+	offset += string_length;
+	if ( offset >= length ) { goto CLEANUP; }
+	if ( string_length > 0 )
+	{
+		// string_length does not contain the NULL character of the string.
+		password = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( string_length + 1 ) );
+		_memcpy_s( password, string_length, p, string_length );
+		password[ string_length ] = 0; // Sanity;
 
-					di->hFile = INVALID_HANDLE_VALUE;
+		decode_cipher( password, string_length );
 
-					di->add_time.QuadPart = add_time.QuadPart;
-					di->downloaded = downloaded;
-					di->last_downloaded = downloaded;
-					di->file_size = file_size;
-					di->download_speed_limit = download_speed_limit;
-					di->parts = parts;
-					di->parts_limit = parts_limit;
-					di->status = status;
-					di->ssl_version = ssl_version;
-					di->processed_header = processed_header;
-					di->download_operations = download_operations;
-					di->method = method;
-					di->last_modified.QuadPart = last_modified.QuadPart;
-					di->url = url;
-					di->cookies = cookies;
-					di->headers = headers;
-					di->data = data;
-					di->auth_info.username = username;
-					di->auth_info.password = password;
+		p += string_length;
+	}
 
-					di->range_list = range_list;
-					di->print_range_list = di->range_list;
+	// Range Info.
+	offset += sizeof( unsigned char );
+	if ( offset > length ) { goto CLEANUP; }
 
-					_wmemcpy_s( di->file_path, MAX_PATH, download_directory, download_directory_length );
-					di->file_path[ download_directory_length ] = 0;	// Sanity.
+	range_count = *p;
+	p += sizeof( unsigned char );
 
-					di->filename_offset = download_directory_length;	// Includes the NULL terminator.
+	for ( unsigned char i = 0; i < range_count; ++i )
+	{
+		offset += ( sizeof( unsigned long long ) * 5 );
+		if ( offset > length ) { goto CLEANUP; }
 
-					_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, filename, filename_length + 1 );
-					di->file_path[ di->filename_offset + filename_length + 1 ] = 0;	// Sanity.
+		RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
 
-					di->file_extension_offset = di->filename_offset + ( ( di->download_operations & DOWNLOAD_OPERATION_GET_EXTENSION ) ? filename_length : get_file_extension_offset( di->file_path + di->filename_offset, filename_length ) );
+		_memcpy_s( &ri->range_start, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
 
-					if ( di->file_extension_offset == ( di->filename_offset + filename_length ) )
-					{
-						di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
-					}
+		_memcpy_s( &ri->range_end, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
 
-					// Cache our file's icon.
-					ICON_INFO *ii = CacheIcon( di, sfi );
+		_memcpy_s( &ri->content_length, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
 
-					if ( ii != NULL )
-					{
-						di->icon = &ii->icon;
-					}
+		_memcpy_s( &ri->content_offset, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
 
-					InitializeCriticalSection( &di->shared_cs );
+		_memcpy_s( &ri->file_write_offset, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+		p += sizeof( unsigned long long );
 
-					SYSTEMTIME st;
-					FILETIME ft;
-					ft.dwHighDateTime = di->add_time.HighPart;
-					ft.dwLowDateTime = di->add_time.LowPart;
-					FileTimeToSystemTime( &ft, &st );
+		DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+		DLL_AddNode( &range_list, range_node, -1 );
+	}
 
-					int buffer_length = 0;
+	di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+	if ( di == NULL ) { goto CLEANUP; }
+
+	di->hFile = INVALID_HANDLE_VALUE;
+
+	di->add_time.QuadPart = add_time.QuadPart;
+	di->downloaded = downloaded;
+	di->last_downloaded = downloaded;
+	di->file_size = file_size;
+	di->download_speed_limit = download_speed_limit;
+	di->parts = parts;
+	di->parts_limit = parts_limit;
+	di->status = status;
+	di->ssl_version = ssl_version;
+	di->processed_header = processed_header;
+	di->download_operations = download_operations;
+	di->method = method;
+	di->last_modified.QuadPart = last_modified.QuadPart;
+	di->url = url;
+	di->cookies = cookies;
+	di->headers = headers;
+	di->data = data;
+	di->auth_info.username = username;
+	di->auth_info.password = password;
+
+	di->range_list = range_list;
+	di->print_range_list = di->range_list;
+
+	_wmemcpy_s( di->file_path, MAX_PATH, download_directory, download_directory_length );
+	di->file_path[ download_directory_length ] = 0;	// Sanity.
+
+	di->filename_offset = download_directory_length;	// Includes the NULL terminator.
+
+	_wmemcpy_s( di->file_path + di->filename_offset, MAX_PATH - di->filename_offset, filename, filename_length + 1 );
+	di->file_path[ di->filename_offset + filename_length + 1 ] = 0;	// Sanity.
+
+	di->file_extension_offset = di->filename_offset + ( ( di->download_operations & DOWNLOAD_OPERATION_GET_EXTENSION ) ? filename_length : get_file_extension_offset( di->file_path + di->filename_offset, filename_length ) );
+
+	if ( di->file_extension_offset == ( di->filename_offset + filename_length ) )
+	{
+		di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
+	}
 
-					#ifndef NTDLL_USE_STATIC_LIB
-						//buffer_length = 64;	// Should be enough to hold most translated values.
-						buffer_length = __snwprintf( NULL, 0, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
-					#else
-						buffer_length = _scwprintf( L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
-					#endif
+	entry_length = offset;
 
-					di->w_add_time = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * buffer_length );
+	return di;
 
-					__snwprintf( di->w_add_time, buffer_length, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) );
+CLEANUP:
 
+	GlobalFree( url );
+	GlobalFree( cookies );
+	GlobalFree( headers );
+	GlobalFree( data );
+	GlobalFree( username );
+	GlobalFree( password );
 
-					LVITEM lvi;
-					_memzero( &lvi, sizeof( LVITEM ) );
-					lvi.mask = LVIF_PARAM | LVIF_TEXT;
-					lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
-					lvi.lParam = ( LPARAM )di;
-					lvi.pszText = di->file_path + di->filename_offset;
-					_SendMessageW( g_hWnd_files, LVM_INSERTITEM, 0, ( LPARAM )&lvi );
+	while ( range_list != NULL )
+	{
+		DoublyLinkedList *range_node = range_list;
+		range_list = range_list->next;
 
-					if ( IS_STATUS( di->status, STATUS_PAUSED ) )	// Paused
-					{
-						di->status = STATUS_STOPPED;	// Stopped
-					}
-					else if ( IS_STATUS( di->status,
-								 STATUS_CONNECTING |
-								 STATUS_DOWNLOADING |
-								 STATUS_RESTART ) )	// Connecting, Downloading, Queued, or Restarting
-					{
-						if ( cfg_resume_downloads )
-						{
-							download_history_changed = true;
+		GlobalFree( range_node->data );
+		GlobalFree( range_node );
+	}
 
-							StartDownload( di, false );
-						}
-						else
-						{
-							di->status = STATUS_STOPPED;	// Stopped
-						}
-					}
-					else if ( di->status == STATUS_ALLOCATING_FILE )	// If we were allocating the file, then set it to a File IO Error.
-					{
-						di->status = STATUS_FILE_IO_ERROR;
-					}
+	return NULL;
+}
 
-					continue;
+// Writes the range count and each range's values.
+unsigned int write_download_history_ranges( DOWNLOAD_INFO *di, char *write_buf, unsigned int size )
+{
+	unsigned int pos = 0;
 
-	CLEANUP:
-					GlobalFree( url );
-					GlobalFree( cookies );
-					GlobalFree( headers );
-					GlobalFree( data );
-					GlobalFree( username );
-					GlobalFree( password );
+	unsigned int range_count = 0;
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL )
+	{
+		++range_count;
 
-					DoublyLinkedList *range_node;
-					while ( range_list != NULL )
-					{
-						range_node = range_list;
-						range_list = range_list->next;
+		range_node = range_node->next;
+	}
 
-						GlobalFree( range_node->data );
-						GlobalFree( range_node );
-					}
+	_memcpy_s( write_buf + pos, size - pos, &range_count, sizeof( unsigned int ) );
+	pos += sizeof( unsigned int );
 
-					// Go back to the last valid entry.
-					if ( total_read < fz )
-					{
-						total_read -= ( read - last_entry );
-						SetFilePointer( hFile_read, total_read + 4, NULL, FILE_BEGIN );	// Offset past the magic identifier.
-					}
+	range_node = di->range_list;
+	for ( unsigned int i = 0; i < range_count; ++i )
+	{
+		RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
 
-					break;
-				}
-			}
+		_memcpy_s( write_buf + pos, size - pos, &ri->range_start, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
 
-			GlobalFree( sfi );
+		_memcpy_s( write_buf + pos, size - pos, &ri->range_end, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
 
-			GlobalFree( history_buf );
+		_memcpy_s( write_buf + pos, size - pos, &ri->content_length, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
 
-			if ( cfg_sorted_column_index != COLUMN_NUM )		// #
-			{
-				SORT_INFO si;
-				si.column = GetColumnIndexFromVirtualIndex( cfg_sorted_column_index, download_columns, NUM_COLUMNS );
-				si.hWnd = g_hWnd_files;
-				si.direction = cfg_sorted_direction;
+		_memcpy_s( write_buf + pos, size - pos, &ri->content_offset, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
 
-				_SendMessageW( g_hWnd_files, LVM_SORTITEMS, ( WPARAM )&si, ( LPARAM )( PFNLVCOMPARE )DMCompareFunc );
-			}
-		}
-		else
-		{
-			ret_status = -2;	// Bad file format.
-		}
+		_memcpy_s( write_buf + pos, size - pos, &ri->file_write_offset, sizeof( unsigned long long ) );
+		pos += sizeof( unsigned long long );
 
-		CloseHandle( hFile_read );	
-	}
-	else
-	{
-		ret_status = -1;	// Can't open file for reading.
+		range_node = range_node->next;
 	}
 
-	return ret_status;
+	return pos;
 }
 
-char save_download_history( wchar_t *file_path )
+unsigned char write_varint( char *buf, unsigned long long value )
 {
-	char ret_status = 0;
+	unsigned char length = 0;
 
-	HANDLE hFile_downloads = CreateFile( file_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
-	if ( hFile_downloads != INVALID_HANDLE_VALUE )
+	while ( value >= 0x80 )
 	{
-		//int size = ( 32768 + 1 );
-		int size = ( 524288 + 1 );
-		int pos = 0;
-		DWORD write = 0;
-
-		char *write_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * size );
+		buf[ length++ ] = ( char )( ( value & 0x7F ) | 0x80 );
+		value >>= 7;
+	}
 
-		_memcpy_s( write_buf + pos, size - pos, MAGIC_ID_DOWNLOADS, sizeof( char ) * 4 );	// Magic identifier for the call log history.
-		pos += ( sizeof( char ) * 4 );
+	buf[ length++ ] = ( char )value;
 
-		int item_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
+	return length;
+}
 
-		LVITEM lvi;
-		_memzero( &lvi, sizeof( LVITEM ) );
-		lvi.mask = LVIF_PARAM;
+// Differences are zigzag encoded so that small negative values stay small.
+unsigned long long zigzag_encode( unsigned long long value )
+{
+	return ( value << 1 ) ^ ( 0 - ( value >> 63 ) );
+}
 
-		for ( lvi.iItem = 0; lvi.iItem < item_count; ++lvi.iItem )
-		{
-			_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
+unsigned long long zigzag_decode( unsigned long long value )
+{
+	return ( value >> 1 ) ^ ( 0 - ( value & 1 ) );
+}
 
-			DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+bool read_varint( char *buf, DWORD length, DWORD &offset, unsigned long long &value )
+{
+	value = 0;
 
-			// lstrlen is safe for NULL values.
-			int download_directory_length = di->filename_offset * sizeof( wchar_t );	// Includes the NULL terminator.
-			int filename_length = ( lstrlenW( di->file_path + di->filename_offset ) + 1 ) * sizeof( wchar_t );
-			int url_length = ( lstrlenW( di->url ) + 1 ) * sizeof( wchar_t );
+	for ( unsigned char shift = 0; shift < 64 && offset < length; shift += 7 )
+	{
+		unsigned char byte = ( unsigned char )buf[ offset++ ];
 
-			int cookies_length = lstrlenA( di->cookies ) + 1;
-			int headers_length = lstrlenA( di->headers ) + 1;
-			int data_length = lstrlenA( di->data ) + 1;
+		value |= ( ( unsigned long long )( byte & 0x7F ) << shift );
 
-			int username_length = lstrlenA( di->auth_info.username );
-			int password_length = lstrlenA( di->auth_info.password );
+		if ( !( byte & 0x80 ) )
+		{
+			return true;
+		}
+	}
 
-			// See if the next entry can fit in the buffer. If it can't, then we dump the buffer.
-			if ( ( signed )( pos + filename_length + download_directory_length + url_length + cookies_length + headers_length + data_length + username_length + password_length +
-						   ( sizeof( int ) * 2 ) + ( sizeof( ULONGLONG ) * 2 ) + ( sizeof( unsigned long long ) * 3 ) + ( sizeof( unsigned char ) * 5 ) + sizeof( unsigned int ) + sizeof( bool ) ) > size )
-			{
-				// Dump the buffer.
-				WriteFile( hFile_downloads, write_buf, pos, &write, NULL );
-				pos = 0;
-			}
+	return false;
+}
 
-			_memcpy_s( write_buf + pos, size - pos, &di->add_time.QuadPart, sizeof( ULONGLONG ) );
-			pos += sizeof( ULONGLONG );
+// Zero values aren't written. They're the default for a missing field.
+unsigned int write_history_varint_field( char *buf, unsigned char field, unsigned long long value )
+{
+	if ( value == 0 )
+	{
+		return 0;
+	}
 
-			_memcpy_s( write_buf + pos, size - pos, &di->downloaded, sizeof( unsigned long long ) );
-			pos += sizeof( unsigned long long );
+	unsigned int pos = write_varint( buf, ( field << 1 ) | HISTORY_WIRE_VARINT );
+	pos += write_varint( buf + pos, value );
 
-			_memcpy_s( write_buf + pos, size - pos, &di->file_size, sizeof( unsigned long long ) );
-			pos += sizeof( unsigned long long );
+	return pos;
+}
 
-			_memcpy_s( write_buf + pos, size - pos, &di->download_speed_limit, sizeof( unsigned long long ) );
-			pos += sizeof( unsigned long long );
+unsigned int write_history_bytes_field( char *buf, unsigned int size, unsigned char field, char *value, int value_length, bool encode = false )
+{
+	if ( value_length <= 0 )
+	{
+		return 0;
+	}
 
-			_memcpy_s( write_buf + pos, size - pos, &di->parts, sizeof( unsigned char ) );
-			pos += sizeof( unsigned char );
+	unsigned int pos = write_varint( buf, ( field << 1 ) | HISTORY_WIRE_BYTES );
+	pos += write_varint( buf + pos, value_length );
 
-			_memcpy_s( write_buf + pos, size - pos, &di->parts_limit, sizeof( unsigned char ) );
-			pos += sizeof( unsigned char );
+	_memcpy_s( buf + pos, size - pos, value, value_length );
 
-			_memcpy_s( write_buf + pos, size - pos, &di->status, sizeof( unsigned int ) );
-			pos += sizeof( unsigned int );
+	if ( encode )
+	{
+		encode_cipher( buf + pos, value_length );
+	}
 
-			_memcpy_s( write_buf + pos, size - pos, &di->ssl_version, sizeof( char ) );
-			pos += sizeof( char );
+	return pos + value_length;
+}
 
-			_memcpy_s( write_buf + pos, size - pos, &di->processed_header, sizeof( bool ) );
-			pos += sizeof( bool );
+// Wide strings are stored as UTF-8.
+unsigned int write_history_string_field( char *buf, unsigned int size, unsigned char field, wchar_t *value, int value_length )
+{
+	if ( value_length <= 0 )
+	{
+		return 0;
+	}
 
-			_memcpy_s( write_buf + pos, size - pos, &di->download_operations, sizeof( unsigned char ) );
-			pos += sizeof( unsigned char );
+	int utf8_length = WideCharToMultiByte( CP_UTF8, 0, value, value_length, NULL, 0, NULL, NULL );
 
-			_memcpy_s( write_buf + pos, size - pos, &di->method, sizeof( unsigned char ) );
-			pos += sizeof( unsigned char );
+	unsigned int pos = write_varint( buf, ( field << 1 ) | HISTORY_WIRE_BYTES );
+	pos += write_varint( buf + pos, utf8_length );
 
-			_memcpy_s( write_buf + pos, size - pos, &di->last_modified.QuadPart, sizeof( ULONGLONG ) );
-			pos += sizeof( ULONGLONG );
+	WideCharToMultiByte( CP_UTF8, 0, value, value_length, buf + pos, size - pos, NULL, NULL );
 
-			_memcpy_s( write_buf + pos, size - pos, di->file_path, download_directory_length );
-			pos += download_directory_length;
+	return pos + utf8_length;
+}
 
-			_memcpy_s( write_buf + pos, size - pos, di->file_path + di->filename_offset, filename_length );
-			pos += filename_length;
+// Returns the most space that an encoded entry could need.
+unsigned int get_download_history_entry_bound( DOWNLOAD_INFO *di )
+{
+	unsigned int range_count = 0;
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL )
+	{
+		++range_count;
 
-			_memcpy_s( write_buf + pos, size - pos, di->url, url_length );
-			pos += url_length;
+		range_node = range_node->next;
+	}
 
-			_memcpy_s( write_buf + pos, size - pos, di->cookies, cookies_length );
-			pos += cookies_length;
+	// lstrlen is safe for NULL values.
+	return HISTORY_RECORD_LENGTH_SIZE + sizeof( unsigned int ) +
+		 ( 12 * ( 1 + HISTORY_VARINT_MAX_SIZE ) ) +	// The numeric fields.
+		 ( 8 * ( 1 + HISTORY_RECORD_LENGTH_SIZE ) ) +	// The key and length of each string field.
+		 ( ( lstrlenW( di->file_path ) + lstrlenW( di->file_path + di->filename_offset ) + lstrlenW( di->url ) ) * 3 ) +	// A UTF-16 code unit is at most 3 bytes of UTF-8.
+		   lstrlenA( di->cookies ) +
+		   lstrlenA( di->headers ) +
+		   lstrlenA( di->data ) +
+		   lstrlenA( di->auth_info.username ) +
+		   lstrlenA( di->auth_info.password ) +
+		 ( range_count * ( 2 + ( 5 * HISTORY_VARINT_MAX_SIZE ) ) );
+}
 
-			_memcpy_s( write_buf + pos, size - pos, di->headers, headers_length );
-			pos += headers_length;
+// Writes an entry as a length prefixed list of fields followed by a checksum of the fields.
+// The buffer must be at least get_download_history_entry_bound() in size. Returns the number of bytes that were written.
+unsigned int encode_download_history_entry( DOWNLOAD_INFO *di, char *buf, unsigned int size )
+{
+	unsigned int pos = HISTORY_RECORD_LENGTH_SIZE;	// Leave room for the record length.
+
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_ADD_TIME, di->add_time.QuadPart );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_DOWNLOADED, di->downloaded );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_FILE_SIZE, di->file_size );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_DOWNLOAD_SPEED_LIMIT, di->download_speed_limit );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_PARTS, di->parts );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_PARTS_LIMIT, di->parts_limit );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_STATUS, di->status );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_SSL_VERSION, ( unsigned char )di->ssl_version );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_PROCESSED_HEADER, ( di->processed_header ? 1 : 0 ) );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_DOWNLOAD_OPERATIONS, di->download_operations );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_METHOD, di->method );
+	pos += write_history_varint_field( buf + pos, HISTORY_FIELD_LAST_MODIFIED, di->last_modified.QuadPart );
+
+	pos += write_history_string_field( buf + pos, size - pos, HISTORY_FIELD_DOWNLOAD_DIRECTORY, di->file_path, di->filename_offset - 1 );
+	pos += write_history_string_field( buf + pos, size - pos, HISTORY_FIELD_FILENAME, di->file_path + di->filename_offset, lstrlenW( di->file_path + di->filename_offset ) );
+	pos += write_history_string_field( buf + pos, size - pos, HISTORY_FIELD_URL, di->url, lstrlenW( di->url ) );
+
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_COOKIES, di->cookies, lstrlenA( di->cookies ) );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_HEADERS, di->headers, lstrlenA( di->headers ) );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_DATA, di->data, lstrlenA( di->data ) );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_USERNAME, di->auth_info.username, lstrlenA( di->auth_info.username ), true );
+	pos += write_history_bytes_field( buf + pos, size - pos, HISTORY_FIELD_PASSWORD, di->auth_info.password, lstrlenA( di->auth_info.password ), true );
+
+	// Each range is its own field. The range end is stored as a length, and the values are stored as differences from what they usually are:
+	// a range starts where the previous one ended, is as long as it, and has the same content length (the file size, which is the first range's end + 1).
+	// A finished range's content offset is its length, and the file write offset is the range start plus the content offset. Most of the values then fit in 1 byte.
+	RANGE_INFO *last_ri = NULL;
+
+	DoublyLinkedList *range_node = di->range_list;
+	while ( range_node != NULL )
+	{
+		RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
 
-			_memcpy_s( write_buf + pos, size - pos, di->data, data_length );
-			pos += data_length;
+		unsigned long long range_start = ( last_ri != NULL ? last_ri->range_end + 1 : 0 );
+		unsigned long long range_end = ri->range_start + ( last_ri != NULL ? last_ri->range_end - last_ri->range_start : 0 );
+		unsigned long long content_length = ( last_ri != NULL ? last_ri->content_length : ri->range_end + 1 );
 
-			if ( di->auth_info.username != NULL )
-			{
-				_memcpy_s( write_buf + pos, size - pos, &username_length, sizeof( int ) );
-				pos += sizeof( int );
+		unsigned char range_length = write_varint( buf + pos + 2, zigzag_encode( ri->range_start - range_start ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ri->range_end - range_end ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ri->content_length - content_length ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ( ri->range_end - ri->range_start + 1 ) - ri->content_offset ) );
+		range_length += write_varint( buf + pos + 2 + range_length, zigzag_encode( ri->file_write_offset - ( ri->range_start + ri->content_offset ) ) );
 
-				_memcpy_s( write_buf + pos, size - pos, di->auth_info.username, username_length );
-				encode_cipher( write_buf + pos, username_length );
-				pos += username_length;
-			}
-			else
-			{
-				_memset( write_buf + pos, 0, sizeof( int ) );
-				pos += sizeof( int );
-			}
+		// The key and length (at most 50 bytes) fit in 1 byte each.
+		buf[ pos ] = ( HISTORY_FIELD_RANGE_DELTA << 1 ) | HISTORY_WIRE_BYTES;
+		buf[ pos + 1 ] = range_length;
 
-			if ( di->auth_info.password != NULL )
-			{
-				_memcpy_s( write_buf + pos, size - pos, &password_length, sizeof( int ) );
-				pos += sizeof( int );
+		pos += 2 + range_length;
 
-				_memcpy_s( write_buf + pos, size - pos, di->auth_info.password, password_length );
-				encode_cipher( write_buf + pos, password_length );
-				pos += password_length;
-			}
-			else
-			{
-				_memset( write_buf + pos, 0, sizeof( int ) );
-				pos += sizeof( int );
-			}
+		last_ri = ri;
 
-			unsigned char range_count = 0;
-			DoublyLinkedList *range_node = di->range_list;
-			while ( range_node != NULL )
-			{
-				++range_count;
+		range_node = range_node->next;
+	}
 
-				range_node = range_node->next;
-			}
+	unsigned int record_length = pos - HISTORY_RECORD_LENGTH_SIZE;
 
-			// See if the next entry can fit in the buffer. If it can't, then we dump the buffer.
-			if ( ( signed )( pos + sizeof( unsigned char ) + ( range_count * ( ( sizeof( unsigned long long ) * 5 ) ) ) ) > size )
-			{
-				// Dump the buffer.
-				WriteFile( hFile_downloads, write_buf, pos, &write, NULL );
-				pos = 0;
-			}
+	// Move the fields up against the actual length of the record.
+	char length_buf[ HISTORY_RECORD_LENGTH_SIZE ];
+	unsigned char length_size = write_varint( length_buf, record_length );
 
-			_memcpy_s( write_buf + pos, size - pos, &range_count, sizeof( unsigned char ) );
-			pos += sizeof( unsigned char );
+	_memmove( buf + length_size, buf + HISTORY_RECORD_LENGTH_SIZE, record_length );
+	_memcpy_s( buf, size, length_buf, length_size );
 
-			range_node = di->range_list;
-			while ( range_node != NULL )
-			{
-				RANGE_INFO *ri = ( RANGE_INFO * )range_node->data;
+	pos = length_size + record_length;
 
-				//_memcpy_s( write_buf + pos, size - pos, ri, sizeof( RANGE_INFO ) );
-				//pos += sizeof( RANGE_INFO );
+	unsigned int checksum = crc32_checksum( buf + length_size, record_length );
+	_memcpy_s( buf + pos, size - pos, &checksum, sizeof( unsigned int ) );
+	pos += sizeof( unsigned int );
 
-				_memcpy_s( write_buf + pos, size - pos, &ri->range_start, sizeof( unsigned long long ) );
-				pos += sizeof( unsigned long long );
+	return pos;
+}
 
-				_memcpy_s( write_buf + pos, size - pos, &ri->range_end, sizeof( unsigned long long ) );
-				pos += sizeof( unsigned long long );
+// Returns the size of the encoded entry at buf, or 0 if the entry is incomplete.
+DWORD get_encoded_history_entry_size( char *buf, DWORD length )
+{
+	DWORD offset = 0;
+	unsigned long long record_length;
 
-				_memcpy_s( write_buf + pos, size - pos, &ri->content_length, sizeof( unsigned long long ) );
-				pos += sizeof( unsigned long long );
+	if ( !read_varint( buf, length, offset, record_length ) ||
+		 record_length > length - offset ||
+		 length - offset - ( DWORD )record_length < sizeof( unsigned int ) )
+	{
+		return 0;
+	}
 
-				_memcpy_s( write_buf + pos, size - pos, &ri->content_offset, sizeof( unsigned long long ) );
-				pos += sizeof( unsigned long long );
+	return offset + ( DWORD )record_length + sizeof( unsigned int );
+}
 
-				_memcpy_s( write_buf + pos, size - pos, &ri->file_write_offset, sizeof( unsigned long long ) );
-				pos += sizeof( unsigned long long );
+// Converts a UTF-8 string to a wide string. ASCII strings (most paths and URLs) are converted without MultiByteToWideChar.
+// Returns the number of characters that were written, or 0 if they didn't fit.
+int decode_history_utf8( char *value, DWORD value_length, wchar_t *buffer, int buffer_size )
+{
+	if ( value_length <= ( DWORD )buffer_size )
+	{
+		// Widen every byte and check for non-ASCII characters once at the end. It's cheaper than checking each byte.
+		unsigned char high = 0;
 
-				range_node = range_node->next;
-			}
+		for ( DWORD i = 0; i < value_length; ++i )
+		{
+			high |= ( unsigned char )value[ i ];
+			buffer[ i ] = ( unsigned char )value[ i ];
 		}
 
-		// If there's anything remaining in the buffer, then write it to the file.
-		if ( pos > 0 )
+		if ( !( high & 0x80 ) )
 		{
-			WriteFile( hFile_downloads, write_buf, pos, &write, NULL );
+			return ( int )value_length;
 		}
-
-		GlobalFree( write_buf );
-
-		CloseHandle( hFile_downloads );
-	}
-	else
-	{
-		ret_status = -1;	// Can't open file for writing.
 	}
 
-	return ret_status;
+	int string_length = MultiByteToWideChar( CP_UTF8, 0, value, value_length, buffer, buffer_size );
+
+	return ( string_length > 0 ? string_length : 0 );
+}
+
+wchar_t *decode_history_string_w( char *value, DWORD value_length )
+{
+	// A UTF-8 string has at least as many bytes as its UTF-16 string has characters.
+	wchar_t *string = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * ( value_length + 1 ) );
+	if ( string != NULL )
+	{
+		int string_length = decode_history_utf8( value, value_length, string, value_length );
+		if ( string_length == 0 )
+		{
+			GlobalFree( string );
+
+			return NULL;
+		}
+
+		string[ string_length ] = 0;	// Sanity.
+	}
+
+	return string;
+}
+
+char *decode_history_string_a( char *value, DWORD value_length, bool decode = false )
+{
+	char *string = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( value_length + 1 ) );
+	if ( string != NULL )
+	{
+		_memcpy_s( string, value_length + 1, value, value_length );
+		string[ value_length ] = 0;	// Sanity.
+
+		if ( decode )
+		{
+			decode_cipher( string, value_length );
+		}
+	}
+
+	return string;
+}
+
+RANGE_INFO *decode_history_range( char *value, DWORD value_length )
+{
+	DWORD offset = 0;
+	unsigned long long range_start, range_length, content_length, content_offset, file_write_offset;
+
+	if ( !read_varint( value, value_length, offset, range_start ) ||
+		 !read_varint( value, value_length, offset, range_length ) ||
+		 !read_varint( value, value_length, offset, content_length ) ||
+		 !read_varint( value, value_length, offset, content_offset ) ||
+		 !read_varint( value, value_length, offset, file_write_offset ) )
+	{
+		return NULL;
+	}
+
+	RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+	if ( ri != NULL )
+	{
+		ri->range_start = range_start;
+		ri->range_end = range_start + range_length;
+		ri->content_length = content_length;
+		ri->content_offset = content_offset;
+		ri->file_write_offset = file_write_offset;
+	}
+
+	return ri;
+}
+
+// Decodes a range that was written as HISTORY_FIELD_RANGE_DELTA. last_ri is the range that came before it, or NULL.
+RANGE_INFO *decode_history_range_delta( char *value, DWORD value_length, RANGE_INFO *last_ri )
+{
+	DWORD offset = 0;
+	unsigned long long range_start, range_end, content_length, content_remaining, file_write_offset;
+
+	if ( !read_varint( value, value_length, offset, range_start ) ||
+		 !read_varint( value, value_length, offset, range_end ) ||
+		 !read_varint( value, value_length, offset, content_length ) ||
+		 !read_varint( value, value_length, offset, content_remaining ) ||
+		 !read_varint( value, value_length, offset, file_write_offset ) )
+	{
+		return NULL;
+	}
+
+	RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+	if ( ri != NULL )
+	{
+		ri->range_start = ( last_ri != NULL ? last_ri->range_end + 1 : 0 ) + zigzag_decode( range_start );
+		ri->range_end = ri->range_start + ( last_ri != NULL ? last_ri->range_end - last_ri->range_start : 0 ) + zigzag_decode( range_end );
+		ri->content_length = ( last_ri != NULL ? last_ri->content_length : ri->range_end + 1 ) + zigzag_decode( content_length );
+		ri->content_offset = ( ri->range_end - ri->range_start + 1 ) - zigzag_decode( content_remaining );
+		ri->file_write_offset = ri->range_start + ri->content_offset + zigzag_decode( file_write_offset );
+	}
+
+	return ri;
+}
+
+// Decodes an entry that was written by encode_download_history_entry. Unknown fields are skipped.
+// NULL is returned if the entry is incomplete or its checksum doesn't match.
+DOWNLOAD_INFO *decode_download_history_entry( char *buf, DWORD length )
+{
+	DWORD offset = 0;
+	unsigned long long record_length;
+
+	char *record;
+	DWORD record_end;
+	unsigned int checksum;
+
+	unsigned long long key;
+	unsigned long long value;
+
+	char *download_directory = NULL;
+	DWORD download_directory_length = 0;
+	char *filename = NULL;
+	DWORD filename_length = 0;
+	int string_length;
+
+	RANGE_INFO *last_ri = NULL;
+
+	DOWNLOAD_INFO *di = NULL;
+
+	if ( !read_varint( buf, length, offset, record_length ) ||
+		 record_length > length - offset ||
+		 length - offset - ( DWORD )record_length < sizeof( unsigned int ) )
+	{
+		return NULL;
+	}
+
+	record = buf + offset;
+	record_end = ( DWORD )record_length;
+
+	_memcpy_s( &checksum, sizeof( unsigned int ), record + record_end, sizeof( unsigned int ) );
+	if ( crc32_checksum( record, record_end ) != checksum )
+	{
+		return NULL;
+	}
+
+	di = ( DOWNLOAD_INFO * )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO ) );
+	if ( di == NULL )
+	{
+		return NULL;
+	}
+
+	di->hFile = INVALID_HANDLE_VALUE;
+
+	offset = 0;
+
+	while ( offset < record_end )
+	{
+		if ( !read_varint( record, record_end, offset, key ) ) { goto CLEANUP; }
+
+		if ( ( key & 1 ) == HISTORY_WIRE_BYTES )
+		{
+			if ( !read_varint( record, record_end, offset, value ) || value > record_end - offset ) { goto CLEANUP; }
+
+			char *field = record + offset;
+			DWORD field_length = ( DWORD )value;
+
+			offset += field_length;
+
+			switch ( key >> 1 )
+			{
+				case HISTORY_FIELD_DOWNLOAD_DIRECTORY: { download_directory = field; download_directory_length = field_length; } break;
+				case HISTORY_FIELD_FILENAME: { filename = field; filename_length = field_length; } break;
+				case HISTORY_FIELD_URL: { GlobalFree( di->url ); di->url = decode_history_string_w( field, field_length ); } break;
+				case HISTORY_FIELD_COOKIES: { GlobalFree( di->cookies ); di->cookies = decode_history_string_a( field, field_length ); } break;
+				case HISTORY_FIELD_HEADERS: { GlobalFree( di->headers ); di->headers = decode_history_string_a( field, field_length ); } break;
+				case HISTORY_FIELD_DATA: { GlobalFree( di->data ); di->data = decode_history_string_a( field, field_length ); } break;
+				case HISTORY_FIELD_USERNAME: { GlobalFree( di->auth_info.username ); di->auth_info.username = decode_history_string_a( field, field_length, true ); } break;
+				case HISTORY_FIELD_PASSWORD: { GlobalFree( di->auth_info.password ); di->auth_info.password = decode_history_string_a( field, field_length, true ); } break;
+
+				case HISTORY_FIELD_RANGE:
+				case HISTORY_FIELD_RANGE_DELTA:
+				{
+					RANGE_INFO *ri = ( ( key >> 1 ) == HISTORY_FIELD_RANGE ? decode_history_range( field, field_length ) : decode_history_range_delta( field, field_length, last_ri ) );
+					if ( ri == NULL ) { goto CLEANUP; }
+
+					DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+					if ( range_node == NULL ) { GlobalFree( ri ); goto CLEANUP; }
+
+					DLL_AddNode( &di->range_list, range_node, -1 );
+
+					last_ri = ri;
+				}
+				break;
+			}
+		}
+		else
+		{
+			if ( !read_varint( record, record_end, offset, value ) ) { goto CLEANUP; }
+
+			switch ( key >> 1 )
+			{
+				case HISTORY_FIELD_ADD_TIME: { di->add_time.QuadPart = value; } break;
+				case HISTORY_FIELD_DOWNLOADED: { di->downloaded = value; } break;
+				case HISTORY_FIELD_FILE_SIZE: { di->file_size = value; } break;
+				case HISTORY_FIELD_DOWNLOAD_SPEED_LIMIT: { di->download_speed_limit = value; } break;
+				case HISTORY_FIELD_PARTS: { di->parts = ( unsigned char )value; } break;
+				case HISTORY_FIELD_PARTS_LIMIT: { di->parts_limit = ( unsigned char )value; } break;
+				case HISTORY_FIELD_STATUS: { di->status = ( unsigned int )value; } break;
+				case HISTORY_FIELD_SSL_VERSION: { di->ssl_version = ( char )value; } break;
+				case HISTORY_FIELD_PROCESSED_HEADER: { di->processed_header = ( value != 0 ); } break;
+				case HISTORY_FIELD_DOWNLOAD_OPERATIONS: { di->download_operations = ( unsigned char )value; } break;
+				case HISTORY_FIELD_METHOD: { di->method = ( unsigned char )value; } break;
+				case HISTORY_FIELD_LAST_MODIFIED: { di->last_modified.QuadPart = value; } break;
+			}
+		}
+	}
+
+	// Every entry needs a URL and a filename.
+	if ( di->url == NULL || filename_length == 0 ) { goto CLEANUP; }
+
+	di->last_downloaded = di->downloaded;
+	di->print_range_list = di->range_list;
+
+	string_length = 0;
+
+	if ( download_directory_length > 0 )
+	{
+		string_length = decode_history_utf8( download_directory, download_directory_length, di->file_path, MAX_PATH - 2 );
+		if ( string_length == 0 ) { goto CLEANUP; }
+	}
+
+	di->file_path[ string_length ] = 0;	// Sanity.
+
+	di->filename_offset = string_length + 1;	// Includes the NULL terminator.
+
+	string_length = decode_history_utf8( filename, filename_length, di->file_path + di->filename_offset, MAX_PATH - di->filename_offset - 1 );
+	if ( string_length == 0 ) { goto CLEANUP; }
+
+	di->file_path[ di->filename_offset + string_length ] = 0;	// Sanity.
+
+	di->file_extension_offset = di->filename_offset + ( ( di->download_operations & DOWNLOAD_OPERATION_GET_EXTENSION ) ? string_length : get_file_extension_offset( di->file_path + di->filename_offset, string_length ) );
+
+	if ( di->file_extension_offset == ( di->filename_offset + string_length ) )
+	{
+		di->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
+	}
+
+	return di;
+
+CLEANUP:
+
+	free_download_history_entry( di );
+
+	return NULL;
+}
+
+// Returns a copy of the download model's items. The caller must prevent items from being added or removed while it's in use.
+DOWNLOAD_INFO **get_download_history_items( unsigned int &item_count )
+{
+	DOWNLOAD_INFO **items = NULL;
+
+	EnterCriticalSection( &download_model_cs );
+
+	item_count = DM_GetItemCount();
+
+	if ( item_count > 0 )
+	{
+		items = ( DOWNLOAD_INFO ** )GlobalAlloc( GMEM_FIXED, sizeof( DOWNLOAD_INFO * ) * item_count );
+		if ( items != NULL )
+		{
+			for ( unsigned int i = 0; i < item_count; ++i )
+			{
+				items[ i ] = DM_GetItem( i );
+			}
+		}
+		else
+		{
+			item_count = 0;
+		}
+	}
+
+	LeaveCriticalSection( &download_model_cs );
+
+	return items;
+}
+
+char write_download_history( HANDLE hFile_downloads, DOWNLOAD_INFO **items, unsigned int item_count )
+{
+	//unsigned int size = ( 32768 + 1 );
+	unsigned int size = ( 524288 + 1 );
+	unsigned int pos = 0;
+	DWORD write = 0;
+	BOOL write_ret = TRUE;
+
+	char *write_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * size );
+	if ( write_buf == NULL )
+	{
+		return -1;
+	}
+
+	_memcpy_s( write_buf + pos, size - pos, MAGIC_ID_DOWNLOADS, sizeof( char ) * 4 );	// Magic identifier for the call log history.
+	pos += ( sizeof( char ) * 4 );
+
+	for ( unsigned int i = 0; i < item_count && write_ret != FALSE; ++i )
+	{
+		DOWNLOAD_INFO *di = items[ i ];
+
+		// The bound must still hold when the entry is encoded. Finished parts can split and merge the ranges in the meantime.
+		EnterCriticalSection( &range_list_cs );
+
+		unsigned int entry_length = get_download_history_entry_bound( di );
+
+		// See if the next entry can fit in the buffer. If it can't, then we dump the buffer.
+		if ( pos + entry_length > size )
+		{
+			// Dump the buffer.
+			write_ret = WriteFile( hFile_downloads, write_buf, pos, &write, NULL );
+			pos = 0;
+		}
+
+		// The entry is larger than our buffer (really long cookies, headers, or data). Write it separately.
+		if ( entry_length > size )
+		{
+			char *entry_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * entry_length );
+			if ( entry_buf != NULL )
+			{
+				if ( write_ret != FALSE )
+				{
+					write_ret = WriteFile( hFile_downloads, entry_buf, encode_download_history_entry( di, entry_buf, entry_length ), &write, NULL );
+				}
+
+				GlobalFree( entry_buf );
+			}
+			else
+			{
+				write_ret = FALSE;
+			}
+		}
+		else
+		{
+			pos += encode_download_history_entry( di, write_buf + pos, size - pos );
+		}
+
+		LeaveCriticalSection( &range_list_cs );
+	}
+
+	// If there's anything remaining in the buffer, then write it to the file.
+	if ( pos > 0 && write_ret != FALSE )
+	{
+		write_ret = WriteFile( hFile_downloads, write_buf, pos, &write, NULL );
+	}
+
+	GlobalFree( write_buf );
+
+	return ( write_ret != FALSE ? 0 : -1 );
+}
+
+char save_download_history( wchar_t *file_path )
+{
+	char ret_status = 0;
+
+	HANDLE hFile_downloads = CreateFile( file_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile_downloads != INVALID_HANDLE_VALUE )
+	{
+		unsigned int item_count = 0;
+		DOWNLOAD_INFO **items = get_download_history_items( item_count );
+
+		ret_status = write_download_history( hFile_downloads, items, item_count );
+
+		GlobalFree( items );
+
+		CloseHandle( hFile_downloads );
+	}
+	else
+	{
+		ret_status = -1;	// Can't open file for writing.
+	}
+
+	return ret_status;
+}
+
+void get_download_history_journal_path( wchar_t *file_path, wchar_t *journal_path )
+{
+	int file_path_length = lstrlenW( file_path );
+	if ( file_path_length > MAX_PATH - 9 )
+	{
+		file_path_length = MAX_PATH - 9;
+	}
+
+	_wmemcpy_s( journal_path, MAX_PATH, file_path, file_path_length );
+	_wmemcpy_s( journal_path + file_path_length, MAX_PATH - file_path_length, L"_journal\0", 9 );
+	journal_path[ file_path_length + 8 ] = 0;	// Sanity.
+}
+
+// The journal header identifies the history file that its records apply to.
+void get_download_history_journal_header( wchar_t *file_path, char *header )
+{
+	ULARGE_INTEGER file_size, last_write;
+	file_size.QuadPart = last_write.QuadPart = 0;
+
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if ( GetFileAttributesExW( file_path, GetFileExInfoStandard, &fad ) != FALSE )
+	{
+		file_size.HighPart = fad.nFileSizeHigh;
+		file_size.LowPart = fad.nFileSizeLow;
+		last_write.HighPart = fad.ftLastWriteTime.dwHighDateTime;
+		last_write.LowPart = fad.ftLastWriteTime.dwLowDateTime;
+	}
+
+	_memcpy_s( header, JOURNAL_HEADER_SIZE, MAGIC_ID_JOURNAL, sizeof( char ) * 4 );
+	_memcpy_s( header + 4, JOURNAL_HEADER_SIZE - 4, &file_size.QuadPart, sizeof( ULONGLONG ) );
+	_memcpy_s( header + 12, JOURNAL_HEADER_SIZE - 12, &last_write.QuadPart, sizeof( ULONGLONG ) );
+}
+
+// Empties the journal so that its records start from the current history file. history_journal_cs must be held.
+void reset_download_history_journal( wchar_t *file_path )
+{
+	char header[ JOURNAL_HEADER_SIZE ];
+	DWORD write = 0;
+
+	get_download_history_journal_header( file_path, header );
+
+	SetFilePointer( g_hFile_journal, 0, NULL, FILE_BEGIN );
+	SetEndOfFile( g_hFile_journal );
+
+	WriteFile( g_hFile_journal, header, JOURNAL_HEADER_SIZE, &write, NULL );
+
+	g_journal_size = JOURNAL_HEADER_SIZE;
+}
+
+// Rebuilds a download info's progress from a checkpoint record.
+// Journals before version 3 stored the range count in a single byte.
+// The download info is left alone if the record's length doesn't match its range count, or if the ranges can't be allocated.
+bool apply_download_history_progress( DOWNLOAD_INFO *di, unsigned char version, char *p, DWORD length )
+{
+	DWORD range_count_size = ( version >= 3 ? sizeof( unsigned int ) : sizeof( unsigned char ) );
+	DWORD offset = ( sizeof( unsigned long long ) * 2 ) + sizeof( unsigned int ) + sizeof( bool ) + sizeof( ULONGLONG ) + range_count_size;
+	if ( length < offset )
+	{
+		return false;
+	}
+
+	unsigned int range_count = 0;
+	_memcpy_s( &range_count, sizeof( unsigned int ), p + ( offset - range_count_size ), range_count_size );
+
+	if ( range_count > ( ( length - offset ) / ( sizeof( unsigned long long ) * 5 ) ) ||
+		 length != offset + ( range_count * ( sizeof( unsigned long long ) * 5 ) ) )
+	{
+		return false;
+	}
+
+	DoublyLinkedList *range_list = NULL;
+
+	char *range_p = p + offset;
+
+	for ( unsigned int i = 0; i < range_count; ++i )
+	{
+		RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
+		DoublyLinkedList *range_node = ( ri != NULL ? DLL_CreateNode( ( void * )ri ) : NULL );
+
+		if ( range_node == NULL )
+		{
+			GlobalFree( ri );
+
+			while ( range_list != NULL )
+			{
+				range_node = range_list;
+				range_list = range_list->next;
+
+				GlobalFree( range_node->data );
+				GlobalFree( range_node );
+			}
+
+			return false;
+		}
+
+		_memcpy_s( &ri->range_start, sizeof( unsigned long long ), range_p, sizeof( unsigned long long ) );
+		range_p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->range_end, sizeof( unsigned long long ), range_p, sizeof( unsigned long long ) );
+		range_p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->content_length, sizeof( unsigned long long ), range_p, sizeof( unsigned long long ) );
+		range_p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->content_offset, sizeof( unsigned long long ), range_p, sizeof( unsigned long long ) );
+		range_p += sizeof( unsigned long long );
+
+		_memcpy_s( &ri->file_write_offset, sizeof( unsigned long long ), range_p, sizeof( unsigned long long ) );
+		range_p += sizeof( unsigned long long );
+
+		DLL_AddNode( &range_list, range_node, -1 );
+	}
+
+	_memcpy_s( &di->downloaded, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
+
+	_memcpy_s( &di->file_size, sizeof( unsigned long long ), p, sizeof( unsigned long long ) );
+	p += sizeof( unsigned long long );
+
+	_memcpy_s( &di->status, sizeof( unsigned int ), p, sizeof( unsigned int ) );
+	p += sizeof( unsigned int );
+
+	_memcpy_s( &di->processed_header, sizeof( bool ), p, sizeof( bool ) );
+	p += sizeof( bool );
+
+	_memcpy_s( &di->last_modified.QuadPart, sizeof( ULONGLONG ), p, sizeof( ULONGLONG ) );
+
+	di->last_downloaded = di->downloaded;
+
+	while ( di->range_list != NULL )
+	{
+		DoublyLinkedList *range_node = di->range_list;
+		di->range_list = di->range_list->next;
+
+		GlobalFree( range_node->data );
+		GlobalFree( range_node );
+	}
+
+	di->range_list = range_list;
+	di->print_range_list = di->range_list;
+
+	return true;
+}
+
+// Returns false if the record is incomplete or unknown.
+bool apply_download_history_record( HISTORY_ENTRIES *he, unsigned char version, unsigned char type, unsigned int history_id, char *payload, DWORD length )
+{
+	if ( history_id == 0 )
+	{
+		return false;
+	}
+
+	unsigned int index = history_id - 1;
+	DOWNLOAD_INFO *di = ( index < he->count ? he->entries[ index ] : NULL );
+
+	switch ( type )
+	{
+		case JOURNAL_RECORD_ADDED:
+		{
+			if ( version == 1 )
+			{
+				DWORD entry_length = 0;
+
+				di = parse_download_history_entry( payload, length, entry_length );
+			}
+			else
+			{
+				di = decode_download_history_entry( payload, length );
+			}
+
+			if ( di == NULL )
+			{
+				return false;
+			}
+
+			di->history_id = history_id;
+
+			// Replaces any earlier version of the entry.
+			if ( !set_history_entry( he, index, di ) )
+			{
+				free_download_history_entry( di );
+			}
+		}
+		break;
+
+		case JOURNAL_RECORD_PROGRESS:
+		{
+			if ( di != NULL )
+			{
+				return apply_download_history_progress( di, version, payload, length );
+			}
+		}
+		break;
+
+		case JOURNAL_RECORD_STATUS:
+		{
+			if ( length < sizeof( unsigned int ) )
+			{
+				return false;
+			}
+
+			if ( di != NULL )
+			{
+				_memcpy_s( &di->status, sizeof( unsigned int ), payload, sizeof( unsigned int ) );
+			}
+		}
+		break;
+
+		case JOURNAL_RECORD_REMOVED:
+		{
+			if ( di != NULL )
+			{
+				free_download_history_entry( di );
+
+				he->entries[ index ] = NULL;
+			}
+		}
+		break;
+
+		default:
+		{
+			return false;
+		}
+		break;
+	}
+
+	return true;
+}
+
+// Replays the journal's records on top of the entries that were read from the history file and keeps the journal open for new records.
+void open_download_history_journal( wchar_t *file_path, HISTORY_ENTRIES *he )
+{
+	wchar_t journal_path[ MAX_PATH ];
+	get_download_history_journal_path( file_path, journal_path );
+
+	EnterCriticalSection( &history_journal_cs );
+
+	if ( g_hFile_journal != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( g_hFile_journal );
+	}
+
+	g_hFile_journal = CreateFile( journal_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( g_hFile_journal != INVALID_HANDLE_VALUE )
+	{
+		unsigned int max_history_id = 0;
+		DWORD valid_size = 0;
+		unsigned char version = 0;
+
+		DWORD fz = GetFileSize( g_hFile_journal, NULL );
+		if ( fz != INVALID_FILE_SIZE && fz >= JOURNAL_HEADER_SIZE )
+		{
+			DWORD read = 0;
+
+			char *journal_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( fz + ( sizeof( wchar_t ) * 2 ) ) );
+			if ( journal_buf != NULL )
+			{
+				ReadFile( g_hFile_journal, journal_buf, fz, &read, NULL );
+
+				_memzero( journal_buf + read, sizeof( wchar_t ) * 2 );	// Guarantee a NULL terminated buffer for the string values.
+
+				char header[ JOURNAL_HEADER_SIZE ];
+				get_download_history_journal_header( file_path, header );
+
+				if ( read >= JOURNAL_HEADER_SIZE )
+				{
+					if ( _memcmp( journal_buf, MAGIC_ID_JOURNAL, 4 ) == 0 )
+					{
+						version = 3;
+					}
+					else if ( _memcmp( journal_buf, MAGIC_ID_JOURNAL_2, 4 ) == 0 )
+					{
+						version = 2;
+					}
+					else if ( _memcmp( journal_buf, MAGIC_ID_JOURNAL_1, 4 ) == 0 )
+					{
+						version = 1;
+					}
+				}
+
+				// The records only apply to the history file that the journal was started with.
+				if ( version != 0 && _memcmp( journal_buf + 4, header + 4, JOURNAL_HEADER_SIZE - 4 ) == 0 )
+				{
+					DWORD offset = JOURNAL_HEADER_SIZE;
+
+					// Stop at the first incomplete record. Anything after it was torn by an unexpected shutdown.
+					while ( read - offset >= JOURNAL_RECORD_HEADER_SIZE )
+					{
+						unsigned char type = *( journal_buf + offset );
+
+						unsigned int history_id;
+						_memcpy_s( &history_id, sizeof( unsigned int ), journal_buf + offset + 1, sizeof( unsigned int ) );
+
+						DWORD length;
+						_memcpy_s( &length, sizeof( DWORD ), journal_buf + offset + 5, sizeof( DWORD ) );
+
+						if ( length > read - offset - JOURNAL_RECORD_HEADER_SIZE )
+						{
+							break;
+						}
+
+						if ( !apply_download_history_record( he, version, type, history_id, journal_buf + offset + JOURNAL_RECORD_HEADER_SIZE, length ) )
+						{
+							break;
+						}
+
+						if ( history_id > max_history_id )
+						{
+							max_history_id = history_id;
+						}
+
+						offset += JOURNAL_RECORD_HEADER_SIZE + length;
+					}
+
+					valid_size = offset;
+				}
+
+				GlobalFree( journal_buf );
+			}
+		}
+
+		if ( ( version == 1 || version == 2 ) && valid_size > JOURNAL_HEADER_SIZE )
+		{
+			// New records can't be added to an older journal. Leave it (and the history file) alone until the next save replaces them both.
+			CloseHandle( g_hFile_journal );
+			g_hFile_journal = INVALID_HANDLE_VALUE;
+
+			download_history_changed = true;
+		}
+		else if ( version == 3 && valid_size > 0 )
+		{
+			// Drop any torn record so that new records follow the last complete one.
+			SetFilePointer( g_hFile_journal, valid_size, NULL, FILE_BEGIN );
+			SetEndOfFile( g_hFile_journal );
+
+			g_journal_size = valid_size;
+		}
+		else
+		{
+			reset_download_history_journal( file_path );
+		}
+
+		g_next_history_id = ( max_history_id >= he->count ? max_history_id : he->count ) + 1;
+	}
+
+	LeaveCriticalSection( &history_journal_cs );
+}
+
+void close_download_history_journal()
+{
+	EnterCriticalSection( &history_journal_cs );
+
+	if ( g_hFile_journal != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( g_hFile_journal );
+		g_hFile_journal = INVALID_HANDLE_VALUE;
+	}
+
+	GlobalFree( g_journal_buf );
+	g_journal_buf = NULL;
+	g_journal_buf_size = 0;
+
+	LeaveCriticalSection( &history_journal_cs );
+}
+
+bool download_history_journal_full()
+{
+	return ( g_journal_size >= JOURNAL_COMPACT_SIZE );
+}
+
+// Makes sure the record buffer can hold size bytes. history_journal_cs must be held.
+bool reserve_download_history_journal_buffer( unsigned int size )
+{
+	if ( size > g_journal_buf_size )
+	{
+		char *journal_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * size );
+		if ( journal_buf == NULL )
+		{
+			return false;
+		}
+
+		GlobalFree( g_journal_buf );
+		g_journal_buf = journal_buf;
+		g_journal_buf_size = size;
+	}
+
+	return true;
+}
+
+// Appends a single record to the journal. history_journal_cs must be held.
+void write_download_history_record( DOWNLOAD_INFO *di, unsigned char type )
+{
+	DWORD length = 0;
+
+	switch ( type )
+	{
+		case JOURNAL_RECORD_ADDED:
+		{
+			length = get_download_history_entry_bound( di );	// The actual length is set once the entry is encoded.
+		}
+		break;
+
+		case JOURNAL_RECORD_PROGRESS:
+		{
+			unsigned int range_count = 0;
+			DoublyLinkedList *range_node = di->range_list;
+			while ( range_node != NULL )
+			{
+				++range_count;
+
+				range_node = range_node->next;
+			}
+
+			length = ( sizeof( unsigned long long ) * 2 ) + sizeof( unsigned int ) + sizeof( bool ) + sizeof( ULONGLONG ) + sizeof( unsigned int ) + ( range_count * ( sizeof( unsigned long long ) * 5 ) );
+		}
+		break;
+
+		case JOURNAL_RECORD_STATUS:
+		{
+			length = sizeof( unsigned int );
+		}
+		break;
+	}
+
+	unsigned int size = JOURNAL_RECORD_HEADER_SIZE + length;
+
+	if ( !reserve_download_history_journal_buffer( size ) )
+	{
+		return;
+	}
+
+	unsigned int pos = JOURNAL_RECORD_HEADER_SIZE;
+
+	switch ( type )
+	{
+		case JOURNAL_RECORD_ADDED:
+		{
+			length = encode_download_history_entry( di, g_journal_buf + pos, size - pos );
+			size = JOURNAL_RECORD_HEADER_SIZE + length;
+		}
+		break;
+
+		case JOURNAL_RECORD_PROGRESS:
+		{
+			_memcpy_s( g_journal_buf + pos, size - pos, &di->downloaded, sizeof( unsigned long long ) );
+			pos += sizeof( unsigned long long );
+
+			_memcpy_s( g_journal_buf + pos, size - pos, &di->file_size, sizeof( unsigned long long ) );
+			pos += sizeof( unsigned long long );
+
+			_memcpy_s( g_journal_buf + pos, size - pos, &di->status, sizeof( unsigned int ) );
+			pos += sizeof( unsigned int );
+
+			_memcpy_s( g_journal_buf + pos, size - pos, &di->processed_header, sizeof( bool ) );
+			pos += sizeof( bool );
+
+			_memcpy_s( g_journal_buf + pos, size - pos, &di->last_modified.QuadPart, sizeof( ULONGLONG ) );
+			pos += sizeof( ULONGLONG );
+
+			write_download_history_ranges( di, g_journal_buf + pos, size - pos );
+		}
+		break;
+
+		case JOURNAL_RECORD_STATUS:
+		{
+			_memcpy_s( g_journal_buf + pos, size - pos, &di->status, sizeof( unsigned int ) );
+		}
+		break;
+	}
+
+	g_journal_buf[ 0 ] = type;
+	_memcpy_s( g_journal_buf + 1, size - 1, &di->history_id, sizeof( unsigned int ) );
+	_memcpy_s( g_journal_buf + 5, size - 5, &length, sizeof( DWORD ) );
+
+	// A single write keeps the record whole unless the system goes down in the middle of it.
+	DWORD write = 0;
+	if ( WriteFile( g_hFile_journal, g_journal_buf, size, &write, NULL ) != FALSE )
+	{
+		g_journal_size += write;
+	}
+}
+
+// Records a change to a download in the history journal.
+// If wait is false, then the record is skipped when the journal is busy (it's being compacted).
+void journal_download_history( DOWNLOAD_INFO *di, unsigned char type, bool wait )
+{
+	if ( di == NULL || !cfg_enable_download_history )
+	{
+		return;
+	}
+
+	if ( wait )
+	{
+		EnterCriticalSection( &di->shared_cs );
+		EnterCriticalSection( &history_journal_cs );
+	}
+	else
+	{
+		if ( TryEnterCriticalSection( &di->shared_cs ) == FALSE )
+		{
+			return;
+		}
+
+		if ( TryEnterCriticalSection( &history_journal_cs ) == FALSE )
+		{
+			LeaveCriticalSection( &di->shared_cs );
+
+			return;
+		}
+	}
+
+	// Without a journal, the whole history file will need to be saved.
+	if ( g_hFile_journal == INVALID_HANDLE_VALUE )
+	{
+		download_history_changed = true;
+	}
+	else if ( di->history_id != 0 || type != JOURNAL_RECORD_REMOVED )
+	{
+		if ( di->history_id == 0 )
+		{
+			di->history_id = g_next_history_id++;
+
+			// The other records need the full entry to apply to.
+			if ( type != JOURNAL_RECORD_ADDED )
+			{
+				write_download_history_record( di, JOURNAL_RECORD_ADDED );
+			}
+		}
+
+		write_download_history_record( di, type );
+	}
+
+	LeaveCriticalSection( &history_journal_cs );
+	LeaveCriticalSection( &di->shared_cs );
+}
+
+// Writes the progress of each active download to the journal.
+void checkpoint_download_history( bool wait )
+{
+	if ( wait )
+	{
+		EnterCriticalSection( &active_download_list_cs );
+	}
+	else if ( TryEnterCriticalSection( &active_download_list_cs ) == FALSE )
+	{
+		return;
+	}
+
+	DoublyLinkedList *active_download_node = active_download_list;
+	while ( active_download_node != NULL )
+	{
+		DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )active_download_node->data;
+
+		// Skip any download that's busy. CleanupConnection holds its lock while it waits for the active download list.
+		if ( di != NULL && TryEnterCriticalSection( &di->shared_cs ) == TRUE )
+		{
+			if ( di->status == STATUS_DOWNLOADING )
+			{
+				journal_download_history( di, JOURNAL_RECORD_PROGRESS, wait );
+			}
+
+			LeaveCriticalSection( &di->shared_cs );
+		}
+
+		active_download_node = active_download_node->next;
+	}
+
+	LeaveCriticalSection( &active_download_list_cs );
+}
+
+// Adds a download info that was read from a history file to the listview.
+void add_download_history_entry( DOWNLOAD_INFO *di, SHFILEINFO *sfi )
+{
+	// Cache our file's icon.
+	ICON_INFO *ii = CacheIcon( di, sfi );
+
+	if ( ii != NULL )
+	{
+		di->icon = &ii->icon;
+	}
+
+	InitializeCriticalSection( &di->shared_cs );
+
+	SYSTEMTIME st;
+	FILETIME ft;
+	ft.dwHighDateTime = di->add_time.HighPart;
+	ft.dwLowDateTime = di->add_time.LowPart;
+	FileTimeToSystemTime( &ft, &st );
+
+	int buffer_length = 0;
+
+	#ifndef NTDLL_USE_STATIC_LIB
+		//buffer_length = 64;	// Should be enough to hold most translated values.
+		buffer_length = __snwprintf( NULL, 0, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
+	#else
+		buffer_length = _scwprintf( L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) ) + 1;	// Include the NULL character.
+	#endif
+
+	di->w_add_time = ( wchar_t * )GlobalAlloc( GMEM_FIXED, sizeof( wchar_t ) * buffer_length );
+
+	__snwprintf( di->w_add_time, buffer_length, L"%s, %s %d, %04d %d:%02d:%02d %s", GetDay( st.wDayOfWeek ), GetMonth( st.wMonth ), st.wDay, st.wYear, ( st.wHour > 12 ? st.wHour - 12 : ( st.wHour != 0 ? st.wHour : 12 ) ), st.wMinute, st.wSecond, ( st.wHour >= 12 ? L"PM" : L"AM" ) );
+
+
+	DM_InsertItem( di );	// The caller updates the listview's item count.
+
+	// Imported entries aren't in the journal yet.
+	if ( di->history_id == 0 )
+	{
+		journal_download_history( di, JOURNAL_RECORD_ADDED );
+	}
+
+	if ( IS_STATUS( di->status, STATUS_PAUSED ) )	// Paused
+	{
+		di->status = STATUS_STOPPED;	// Stopped
+	}
+	else if ( IS_STATUS( di->status,
+				 STATUS_CONNECTING |
+				 STATUS_DOWNLOADING |
+				 STATUS_RESTART ) )	// Connecting, Downloading, Queued, or Restarting
+	{
+		if ( cfg_resume_downloads )
+		{
+			StartDownload( di, false );	// Journals the new status.
+		}
+		else
+		{
+			di->status = STATUS_STOPPED;	// Stopped
+		}
+	}
+	else if ( di->status == STATUS_ALLOCATING_FILE )	// If we were allocating the file, then set it to a File IO Error.
+	{
+		di->status = STATUS_FILE_IO_ERROR;
+	}
+}
+
+// Returns the size of the entry at buf without building it, or 0 if the entry is incomplete.
+// This must agree with the checks in parse_download_history_entry.
+DWORD get_download_history_entry_size( char *buf, DWORD length )
+{
+	DWORD offset = HISTORY_ENTRY_FIXED_SIZE;
+	int string_length;
+
+	if ( offset >= length ) { return 0; }
+
+	// Download Directory, Filename, and URL
+	for ( unsigned char i = 0; i < 3; ++i )
+	{
+		string_length = get_history_string_length_w( buf + offset, length - offset );
+		if ( string_length == 0 ) { return 0; }
+
+		offset += ( string_length * sizeof( wchar_t ) );
+		if ( offset >= length ) { return 0; }
+	}
+
+	// Cookies, Headers, and Data
+	for ( unsigned char i = 0; i < 3; ++i )
+	{
+		string_length = get_history_string_length_a( buf + offset, length - offset );
+		if ( string_length == 0 ) { return 0; }
+
+		offset += string_length;
+		if ( offset >= length ) { return 0; }
+	}
+
+	// Username and Password
+	for ( unsigned char i = 0; i < 2; ++i )
+	{
+		offset += sizeof( int );
+		if ( offset >= length ) { return 0; }
+
+		_memcpy_s( &string_length, sizeof( int ), buf + ( offset - sizeof( int ) ), sizeof( int ) );
+		if ( string_length < 0 ) { return 0; }
+
+		offset += string_length;
+		if ( offset >= length ) { return 0; }
+	}
+
+	// Range Info.
+	unsigned char range_count = *( buf + offset );
+
+	offset += sizeof( unsigned char ) + ( range_count * ( sizeof( unsigned long long ) * 5 ) );
+	if ( offset > length ) { return 0; }
+
+	return offset;
+}
+
+// Builds a list of where each entry begins. The list has one more offset than the number of entries (the end of the last entry).
+// Scanning stops at the first incomplete entry.
+DWORD *index_download_history( char *buf, DWORD length, unsigned char version, unsigned int &entry_count )
+{
+	unsigned int capacity = 1024;
+	DWORD offset = 0;
+
+	entry_count = 0;
+
+	DWORD *offsets = ( DWORD * )GlobalAlloc( GMEM_FIXED, sizeof( DWORD ) * capacity );
+	if ( offsets == NULL )
+	{
+		return NULL;
+	}
+
+	offsets[ 0 ] = 0;
+
+	while ( offset < length )
+	{
+		DWORD entry_size = ( version == 5 ? get_download_history_entry_size( buf + offset, length - offset ) : get_encoded_history_entry_size( buf + offset, length - offset ) );
+		if ( entry_size == 0 )
+		{
+			break;
+		}
+
+		offset += entry_size;
+
+		if ( entry_count + 2 > capacity )
+		{
+			capacity *= 2;
+
+			DWORD *realloc_buffer = ( DWORD * )GlobalReAlloc( offsets, sizeof( DWORD ) * capacity, GMEM_MOVEABLE );
+			if ( realloc_buffer == NULL )
+			{
+				break;
+			}
+
+			offsets = realloc_buffer;
+		}
+
+		offsets[ ++entry_count ] = offset;
+	}
+
+	return offsets;
+}
+
+void parse_download_history_range( HISTORY_PARSE_INFO *hpi )
+{
+	for ( unsigned int i = hpi->start; i < hpi->end; ++i )
+	{
+		if ( hpi->version == 5 )
+		{
+			DWORD entry_length = 0;
+
+			hpi->entries[ i ] = parse_download_history_entry( hpi->buf + hpi->offsets[ i ], hpi->offsets[ i + 1 ] - hpi->offsets[ i ], entry_length );
+		}
+		else	// An entry that fails its checksum is left out. The ones around it are unaffected.
+		{
+			hpi->entries[ i ] = decode_download_history_entry( hpi->buf + hpi->offsets[ i ], hpi->offsets[ i + 1 ] - hpi->offsets[ i ] );
+		}
+	}
+}
+
+THREAD_RETURN parse_download_history_entries( void *pArguments )
+{
+	parse_download_history_range( ( HISTORY_PARSE_INFO * )pArguments );
+
+	_ExitThread( 0 );
+	return 0;
+}
+
+// Splits the indexed entries between as many threads as there are processors.
+void parse_download_history( char *buf, DWORD *offsets, unsigned char version, DOWNLOAD_INFO **entries, unsigned int entry_count )
+{
+	HISTORY_PARSE_INFO hpi[ MAXIMUM_WAIT_OBJECTS ];
+	HANDLE threads[ MAXIMUM_WAIT_OBJECTS ];
+	unsigned int thread_count = 0;
+
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo( &systemInfo );
+
+	unsigned int part_count = entry_count / HISTORY_PARSE_MIN_ENTRIES;
+	if ( part_count > systemInfo.dwNumberOfProcessors )
+	{
+		part_count = systemInfo.dwNumberOfProcessors;
+	}
+
+	if ( part_count > MAXIMUM_WAIT_OBJECTS )
+	{
+		part_count = MAXIMUM_WAIT_OBJECTS;
+	}
+	else if ( part_count == 0 )
+	{
+		part_count = 1;
+	}
+
+	unsigned int part_size = entry_count / part_count;
+
+	for ( unsigned int i = 0; i < part_count; ++i )
+	{
+		hpi[ i ].buf = buf;
+		hpi[ i ].offsets = offsets;
+		hpi[ i ].entries = entries;
+		hpi[ i ].start = i * part_size;
+		hpi[ i ].end = ( i == part_count - 1 ? entry_count : ( i + 1 ) * part_size );
+		hpi[ i ].version = version;
+	}
+
+	// The first part is parsed on this thread.
+	for ( unsigned int i = 1; i < part_count; ++i )
+	{
+		HANDLE thread = ( HANDLE )_CreateThread( NULL, 0, parse_download_history_entries, ( void * )&hpi[ i ], 0, NULL );
+		if ( thread != NULL )
+		{
+			threads[ thread_count++ ] = thread;
+		}
+		else	// Parse it ourself if we couldn't create the thread.
+		{
+			parse_download_history_range( &hpi[ i ] );
+		}
+	}
+
+	parse_download_history_range( &hpi[ 0 ] );
+
+	if ( thread_count > 0 )
+	{
+		WaitForMultipleObjects( thread_count, threads, TRUE, INFINITE );
+
+		for ( unsigned int i = 0; i < thread_count; ++i )
+		{
+			CloseHandle( threads[ i ] );
+		}
+	}
+}
+
+// If use_journal is set, then the history journal is replayed on top of the file and kept open for new records.
+char read_download_history( wchar_t *file_path, bool use_journal )
+{
+	char ret_status = 0;
+
+	HISTORY_ENTRIES he;
+	_memzero( &he, sizeof( HISTORY_ENTRIES ) );
+
+	HANDLE hFile_read = CreateFile( file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile_read != INVALID_HANDLE_VALUE )
+	{
+		DWORD fz_high = 0;
+		DWORD fz = GetFileSize( hFile_read, &fz_high );
+
+		char *history_buf = NULL;
+		HANDLE hMap = NULL;
+
+		// Map the whole file rather than reading it in pieces. Entries never straddle a buffer boundary this way.
+		if ( fz_high == 0 && fz != INVALID_FILE_SIZE && fz >= 4 )
+		{
+			hMap = CreateFileMapping( hFile_read, NULL, PAGE_READONLY, 0, 0, NULL );
+			if ( hMap != NULL )
+			{
+				history_buf = ( char * )MapViewOfFile( hMap, FILE_MAP_READ, 0, 0, 0 );
+			}
+		}
+
+		unsigned char version = 0;
+		if ( history_buf != NULL )
+		{
+			if ( _memcmp( history_buf, MAGIC_ID_DOWNLOADS, 4 ) == 0 )
+			{
+				version = 6;
+			}
+			else if ( _memcmp( history_buf, MAGIC_ID_DOWNLOADS_5, 4 ) == 0 )
+			{
+				version = 5;
+			}
+		}
+
+		if ( version != 0 )
+		{
+			unsigned int entry_count = 0;
+			DWORD *offsets = index_download_history( history_buf + 4, fz - 4, version, entry_count );	// Offset past the magic identifier.
+
+			if ( entry_count > 0 )
+			{
+				he.entries = ( DOWNLOAD_INFO ** )GlobalAlloc( GPTR, sizeof( DOWNLOAD_INFO * ) * entry_count );
+				if ( he.entries != NULL )
+				{
+					he.count = he.capacity = entry_count;
+
+					parse_download_history( history_buf + 4, offsets, version, he.entries, entry_count );
+
+					if ( use_journal )
+					{
+						// The snapshot's entries are numbered in the order that they were written.
+						for ( unsigned int i = 0; i < he.count; ++i )
+						{
+							if ( he.entries[ i ] != NULL )
+							{
+								he.entries[ i ]->history_id = i + 1;
+							}
+						}
+					}
+				}
+			}
+
+			GlobalFree( offsets );
+		}
+		else
+		{
+			ret_status = -2;	// Bad file format.
+		}
+
+		if ( history_buf != NULL )
+		{
+			UnmapViewOfFile( history_buf );
+		}
+
+		if ( hMap != NULL )
+		{
+			CloseHandle( hMap );
+		}
+
+		CloseHandle( hFile_read );
+	}
+	else
+	{
+		ret_status = -1;	// Can't open file for reading.
+	}
+
+	if ( use_journal )
+	{
+		// Replays any changes that were made since the file was written.
+		open_download_history_journal( file_path, &he );
+	}
+
+	if ( he.count > 0 )
+	{
+		SHFILEINFO *sfi = ( SHFILEINFO * )GlobalAlloc( GMEM_FIXED, sizeof( SHFILEINFO ) );
+
+		// Allocate space for all of the entries at once.
+		DM_ReserveItems( he.count );
+
+		for ( unsigned int i = 0; i < he.count; ++i )
+		{
+			if ( he.entries[ i ] != NULL )
+			{
+				add_download_history_entry( he.entries[ i ], sfi );
+			}
+		}
+
+		GlobalFree( sfi );
+
+		UpdateDownloadListCount( false );
+	}
+
+	GlobalFree( he.entries );
+
+	if ( ret_status != -2 && cfg_sorted_column_index != COLUMN_NUM )		// #
+	{
+		SORT_INFO si;
+		si.column = cfg_sorted_column_index;
+		si.hWnd = g_hWnd_files;
+		si.direction = cfg_sorted_direction;
+
+		SortDownloadList( &si );
+	}
+
+	return ret_status;
+}
+
+// Saves the whole history to a new file, replaces the old one with it, and empties the journal.
+// The caller must prevent items from being added or removed while the history is being saved.
+char compact_download_history( wchar_t *file_path )
+{
+	char ret_status = 0;
+
+	wchar_t temp_file_path[ MAX_PATH ];
+	int file_path_length = lstrlenW( file_path );
+	if ( file_path_length > MAX_PATH - 5 )
+	{
+		file_path_length = MAX_PATH - 5;
+	}
+
+	_wmemcpy_s( temp_file_path, MAX_PATH, file_path, file_path_length );
+	_wmemcpy_s( temp_file_path + file_path_length, MAX_PATH - file_path_length, L".tmp\0", 5 );
+	temp_file_path[ file_path_length + 4 ] = 0;	// Sanity.
+
+	unsigned int item_count = 0;
+	DOWNLOAD_INFO **items = get_download_history_items( item_count );
+
+	// Any record that's written while we hold this is already reflected in the new file.
+	EnterCriticalSection( &history_journal_cs );
+
+	HANDLE hFile_downloads = CreateFile( temp_file_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile_downloads != INVALID_HANDLE_VALUE )
+	{
+		ret_status = write_download_history( hFile_downloads, items, item_count );
+
+		if ( ret_status == 0 && FlushFileBuffers( hFile_downloads ) == FALSE )
+		{
+			ret_status = -1;
+		}
+
+		CloseHandle( hFile_downloads );
+
+		// The old file stays in place (along with its journal) until the new one is complete.
+		if ( ret_status == 0 && MoveFileExW( temp_file_path, file_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) != FALSE )
+		{
+			for ( unsigned int i = 0; i < item_count; ++i )
+			{
+				items[ i ]->history_id = i + 1;
+			}
+
+			g_next_history_id = item_count + 1;
+
+			if ( g_hFile_journal == INVALID_HANDLE_VALUE )
+			{
+				wchar_t journal_path[ MAX_PATH ];
+				get_download_history_journal_path( file_path, journal_path );
+
+				g_hFile_journal = CreateFile( journal_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+			}
+
+			if ( g_hFile_journal != INVALID_HANDLE_VALUE )
+			{
+				reset_download_history_journal( file_path );
+			}
+		}
+		else
+		{
+			DeleteFileW( temp_file_path );
+
+			ret_status = -1;
+		}
+	}
+	else
+	{
+		ret_status = -1;	// Can't open file for writing.
+	}
+
+	LeaveCriticalSection( &history_journal_cs );
+
+	GlobalFree( items );
+
+	return ret_status;
+}
+
+char read_host_parts()
+{
+	char ret_status = 0;
+
+	_wmemcpy_s( base_directory + base_directory_length, MAX_PATH - base_directory_length, L"\\http_downloader_host_parts\0", 28 );
+	base_directory[ base_directory_length + 27 ] = 0;	// Sanity.
+
+	HANDLE hFile_read = CreateFile( base_directory, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile_read != INVALID_HANDLE_VALUE )
+	{
+		DWORD read = 0;
+		DWORD fz = GetFileSize( hFile_read, NULL );
+
+		// Our host parts file is going to be small. If it's something else, we're not going to read it.
+		if ( fz > 4 && fz < 1048576 )
+		{
+			char *buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * ( fz + 1 ) );
+
+			ReadFile( hFile_read, buf, sizeof( char ) * fz, &read, NULL );
+
+			buf[ read ] = 0;	// Guarantee a NULL terminated buffer.
+
+			if ( read == fz && _memcmp( buf, MAGIC_ID_HOST_PARTS, 4 ) == 0 )
+			{
+				char *next = buf + 4;
+				char *end = buf + read;
+
+				// Each entry is a NULL terminated host followed by its number of parts.
+				while ( next < end )
+				{
+					int string_length = lstrlenA( next ) + 1;
+
+					if ( next + string_length >= end )
+					{
+						break;
+					}
+
+					unsigned char parts = *( unsigned char * )( next + string_length );
+
+					if ( string_length > 1 && parts > 0 && parts <= 100 )
+					{
+						HOST_PARTS *hp = ( HOST_PARTS * )GlobalAlloc( GMEM_FIXED, sizeof( HOST_PARTS ) );
+
+						hp->host = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * string_length );
+						_memcpy_s( hp->host, string_length, next, string_length );
+
+						hp->parts = parts;
+
+						if ( dllrbt_insert( g_host_parts, ( void * )hp->host, ( void * )hp ) != DLLRBT_STATUS_OK )
+						{
+							GlobalFree( hp->host );
+							GlobalFree( hp );
+						}
+					}
+
+					next += ( string_length + sizeof( unsigned char ) );
+				}
+			}
+			else
+			{
+				ret_status = -2;	// Bad file format.
+			}
+
+			GlobalFree( buf );
+		}
+
+		CloseHandle( hFile_read );
+	}
+	else
+	{
+		ret_status = -1;	// Can't open file for reading.
+	}
+
+	return ret_status;
+}
+
+char save_host_parts()
+{
+	char ret_status = 0;
+
+	_wmemcpy_s( base_directory + base_directory_length, MAX_PATH - base_directory_length, L"\\http_downloader_host_parts\0", 28 );
+	base_directory[ base_directory_length + 27 ] = 0;	// Sanity.
+
+	HANDLE hFile = CreateFile( base_directory, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile != INVALID_HANDLE_VALUE )
+	{
+		int size = ( 32768 + 1 );
+		int pos = 0;
+		DWORD write = 0;
+
+		char *buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * size );
+
+		_memcpy_s( buf + pos, size - pos, MAGIC_ID_HOST_PARTS, sizeof( char ) * 4 );	// Magic identifier for the host parts.
+		pos += ( sizeof( char ) * 4 );
+
+		EnterCriticalSection( &host_parts_cs );
+
+		node_type *node = dllrbt_get_head( g_host_parts );
+		while ( node != NULL )
+		{
+			HOST_PARTS *hp = ( HOST_PARTS * )node->val;
+			if ( hp != NULL )
+			{
+				int host_length = lstrlenA( hp->host ) + 1;
+
+				// Hosts are limited to 255 characters, but skip anything that won't fit.
+				if ( host_length < 1024 )
+				{
+					// See if the next entry can fit in the buffer. If it can't, then we dump the buffer.
+					if ( ( signed )( pos + host_length + sizeof( unsigned char ) ) > size )
+					{
+						// Dump the buffer.
+						WriteFile( hFile, buf, pos, &write, NULL );
+						pos = 0;
+					}
+
+					_memcpy_s( buf + pos, size - pos, hp->host, host_length );
+					pos += host_length;
+
+					_memcpy_s( buf + pos, size - pos, &hp->parts, sizeof( unsigned char ) );
+					pos += sizeof( unsigned char );
+				}
+			}
+
+			node = node->next;
+		}
+
+		LeaveCriticalSection( &host_parts_cs );
+
+		// If there's anything remaining in the buffer, then write it to the file.
+		if ( pos > 0 )
+		{
+			WriteFile( hFile, buf, pos, &write, NULL );
+		}
+
+		GlobalFree( buf );
+
+		CloseHandle( hFile );
+	}
+	else
+	{
+		ret_status = -1;	// Can't open file for writing.
+	}
+
+	return ret_status;
 }
 
 char save_download_history_csv_file( wchar_t *file_path )
@@ -2630,17 +4343,11 @@ char save_download_history_csv_file( wchar_t *file_path )
 		// Write the UTF-8 BOM and CSV column titles.
 		WriteFile( hFile_download_history, "\xEF\xBB\xBF\"Filename\",\"Download Directory\",\"Date and Time Added\",\"Unix Timestamp\",\"Downloaded (bytes)\",\"File Size (bytes)\",\"URL\"", 120, &write, NULL );
 
-		int item_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
+		int item_count = ( int )DM_GetItemCount();
 
-		LVITEM lvi;
-		_memzero( &lvi, sizeof( LVITEM ) );
-		lvi.mask = LVIF_PARAM;
-
-		for ( lvi.iItem = 0; lvi.iItem < item_count; ++lvi.iItem )
+		for ( int i = 0; i < item_count; ++i )
 		{
-			_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-			DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+			DOWNLOAD_INFO *di = DM_GetItem( i );
 
 			int download_directory_length = WideCharToMultiByte( CP_UTF8, 0, di->file_path, -1, NULL, 0, NULL, NULL );
 			char *utf8_download_directory = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * download_directory_length ); // Size includes the null character.
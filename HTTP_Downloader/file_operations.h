@@ -20,14 +20,43 @@
 #define _FILE_OPERATIONS_H
 
 #define MAGIC_ID_SETTINGS		"HDM\x05"	// Version 6
-#define MAGIC_ID_DOWNLOADS		"HDM\x14"	// Version 5
+#define MAGIC_ID_DOWNLOADS		"HDM\x15"	// Version 6
+#define MAGIC_ID_DOWNLOADS_5	"HDM\x14"	// Version 5 - Only read.
 #define MAGIC_ID_LOGINS			"HDM\x20"	// Version 1
+#define MAGIC_ID_HOST_PARTS		"HDM\x30"	// Version 1
+#define MAGIC_ID_JOURNAL		"HDM\x42"	// Version 3
+#define MAGIC_ID_JOURNAL_2		"HDM\x41"	// Version 2 - Only replayed.
+#define MAGIC_ID_JOURNAL_1		"HDM\x40"	// Version 1 - Only replayed.
+
+#define JOURNAL_HEADER_SIZE			20		// Magic identifier, and the size and last write time of the history file that the records apply to.
+#define JOURNAL_RECORD_HEADER_SIZE	9		// Type, history id, and payload length.
+
+#define JOURNAL_RECORD_ADDED		1		// The full entry. Replaces any earlier version.
+#define JOURNAL_RECORD_PROGRESS		2		// Downloaded amount, file size, status, and ranges.
+#define JOURNAL_RECORD_STATUS		3
+#define JOURNAL_RECORD_REMOVED		4
+
+#define JOURNAL_COMPACT_SIZE		8388608	// Rewrite the history file once the journal reaches 8 MB.
+#define JOURNAL_CHECKPOINT_INTERVAL	30		// Seconds between saving the progress of active downloads.
+
+struct DOWNLOAD_INFO;
+
+extern CRITICAL_SECTION history_journal_cs;
 
 char read_config();
 char save_config();
 
-char read_download_history( wchar_t *file_path );
+char read_download_history( wchar_t *file_path, bool use_journal = false );
 char save_download_history( wchar_t *file_path );
+char compact_download_history( wchar_t *file_path );
+
+void journal_download_history( DOWNLOAD_INFO *di, unsigned char type, bool wait = true );
+void checkpoint_download_history( bool wait );
+bool download_history_journal_full();
+void close_download_history_journal();
+
+char read_host_parts();
+char save_host_parts();
 
 char save_download_history_csv_file( wchar_t *file_path );
 
@@ -36,4 +65,6 @@ wchar_t *read_url_list_file( wchar_t *file_path, unsigned int &url_list_length )
 wchar_t *UTF8StringToWideString( char *utf8_string, int string_length );
 char *WideStringToUTF8String( wchar_t *wide_string, int *utf8_string_length, int buffer_offset = 0 );
 
+bool SetSparseFile( HANDLE hFile, bool sparse = true );
+
 #endif
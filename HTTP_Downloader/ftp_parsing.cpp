@@ -20,6 +20,7 @@
 #include "http_parsing.h"
 
 #include "utilities.h"
+#include "byte_scan.h"
 
 CRITICAL_SECTION ftp_listen_info_cs;
 
@@ -448,8 +449,13 @@ char MakeRangeDataRequest( SOCKET_CONTEXT *context )
 					ri->file_write_offset = ri->range_start;
 
 					DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+
+					EnterCriticalSection( &range_list_cs );
+
 					DLL_AddNode( &context->download_info->range_list, range_node, -1 );
 
+					LeaveCriticalSection( &range_list_cs );
+
 					if ( context->download_info->range_queue == NULL )
 					{
 						context->download_info->range_queue = range_node;
@@ -528,8 +534,13 @@ char MakeRangeDataRequest( SOCKET_CONTEXT *context )
 				++( new_context->download_info->active_parts );
 
 				DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+
+				EnterCriticalSection( &range_list_cs );
+
 				DLL_AddNode( &new_context->download_info->range_list, range_node, -1 );
 
+				LeaveCriticalSection( &range_list_cs );
+
 				new_context->parts_node.data = new_context;
 				DLL_AddNode( &new_context->download_info->parts_list, &new_context->parts_node, -1 );
 
@@ -1123,7 +1134,8 @@ char GetFTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsi
 			{
 				last_line = end_of_line;
 
-				end_of_line = _StrStrA( last_line, "\r\n" ) + 2;
+				// The reply ends with "\r\n" so every line will have one.
+				end_of_line = BS_FindCRLF( last_line, ( unsigned int )( end_of_buffer - last_line ) ) + 2;
 
 				if ( ( end_of_line - last_line ) >= 6 )
 				{
@@ -1407,7 +1419,7 @@ char GetFTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsi
 
 							context->download_info->parts = context->parts;
 
-							context->download_info->file_size = context->header_info.range_info->content_length;
+							SetDownloadProgress( context->download_info, context->download_info->downloaded, context->header_info.range_info->content_length );
 
 							LeaveCriticalSection( &context->download_info->shared_cs );
 						}
@@ -1777,9 +1789,9 @@ char GetFTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsi
 		// That will cause us to get a larger response than we need. Make sure we handle only what we need and no more.
 		if ( context->parts > 1 )
 		{
-			if ( context->header_info.range_info->content_offset + response_buffer_length > ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) )
+			if ( GetBufferedContentOffset( context ) + response_buffer_length > ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) )
 			{
-				response_buffer_length = ( unsigned int )( ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) - context->header_info.range_info->content_offset );
+				response_buffer_length = ( unsigned int )( ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) - GetBufferedContentOffset( context ) );
 			}
 		}
 
@@ -1788,9 +1800,9 @@ char GetFTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsi
 
 		// Make sure the server isn't feeding us more data than they claim.
 		if ( context->header_info.range_info->content_length > 0 &&
-		   ( ( ( context->header_info.range_info->file_write_offset - context->header_info.range_info->range_start ) + output_buffer_length ) > ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) )
+		   ( ( ( GetBufferedFileOffset( context ) - context->header_info.range_info->range_start ) + output_buffer_length ) > ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) )
 		{
-			output_buffer_length -= ( unsigned int )( ( ( context->header_info.range_info->file_write_offset - context->header_info.range_info->range_start ) + output_buffer_length ) - ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) );
+			output_buffer_length -= ( unsigned int )( ( ( GetBufferedFileOffset( context ) - context->header_info.range_info->range_start ) + output_buffer_length ) - ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) );
 		}
 
 		// Write buffer to file.
@@ -1799,59 +1811,22 @@ char GetFTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsi
 		{
 			if ( !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
 			{
+				// Coalesce the content into larger blocks and write them in the background.
 				if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
 				{
-					LARGE_INTEGER li;
-					li.QuadPart = context->header_info.range_info->file_write_offset;//context->header_info.range_info->range_start + context->header_info.range_info->content_offset;
-
-					EnterCriticalSection( &context->download_info->shared_cs );
-
-					InterlockedIncrement( &context->pending_operations );
-
-					context->overlapped.current_operation = IO_WriteFile;
-
-					context->write_wsabuf.buf = output_buffer;
-					context->write_wsabuf.len = output_buffer_length;
-
-					context->overlapped.overlapped.hEvent = NULL;
-					context->overlapped.overlapped.Internal = NULL;
-					context->overlapped.overlapped.InternalHigh = NULL;
-					//context->overlapped.Pointer = NULL;	// union
-					context->overlapped.overlapped.Offset = li.LowPart;
-					context->overlapped.overlapped.OffsetHigh = li.HighPart;
-
-//					context->overlapped.context = context;
+					bool flush = ( context->header_info.range_info->content_length > 0 &&
+								 ( ( GetBufferedContentOffset( context ) + output_buffer_length ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) );
 
-					context->content_status = FTP_CONTENT_STATUS_READ_MORE_CONTENT;
+					content_status = BufferFileData( context, output_buffer, output_buffer_length, flush, FTP_CONTENT_STATUS_READ_MORE_CONTENT );
 
-					content_status = FTP_CONTENT_STATUS_NONE;	// Exits IO_GetContent.
-
-					context->content_offset = response_buffer_length;	// The true amount that was downloaded. Allows us to resume if we stop the download.
-					//context->header_info.range_info->content_offset += response_buffer_length;	// The true amount that was downloaded. Allows us to resume if we stop the download.
-					//context->header_info.range_info->file_write_offset += output_buffer_length;	// The size of the non-encoded/decoded data that we're writing to the file.
-
-					BOOL bRet = WriteFile( context->download_info->hFile, context->write_wsabuf.buf, context->write_wsabuf.len, NULL, ( OVERLAPPED * )&context->overlapped );
-					if ( bRet == FALSE && ( GetLastError() != ERROR_IO_PENDING ) )
+					if ( content_status == FTP_CONTENT_STATUS_READ_MORE_CONTENT &&
+						 context->parts > 1 &&
+					   ( context->header_info.range_info->content_length == 0 ||
+					   ( GetBufferedContentOffset( context ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
 					{
-						InterlockedDecrement( &context->pending_operations );
-
-						context->download_info->status = STATUS_FILE_IO_ERROR;
-						context->status = STATUS_FILE_IO_ERROR;
-
-						context->content_status = FTP_CONTENT_STATUS_FAILED;
-
-						content_status = FTP_CONTENT_STATUS_FAILED;
-
-						context->content_offset = 0;	// The true amount that was downloaded. Allows us to resume if we stop the download.
-						//context->header_info.range_info->content_offset -= response_buffer_length;	// The true amount that was downloaded. Allows us to resume if we stop the download.
-						//context->header_info.range_info->file_write_offset -= output_buffer_length;	// The size of the non-encoded/decoded data that we're writing to the file.
-
-						CloseHandle( context->download_info->hFile );
-						context->download_info->hFile = INVALID_HANDLE_VALUE;
+						return FTP_CONTENT_STATUS_FAILED;	// We have no more data, so just close the connection.
 					}
 
-					LeaveCriticalSection( &context->download_info->shared_cs );
-
 					return content_status;
 				}
 				else	// Shouldn't happen.
@@ -1862,9 +1837,15 @@ char GetFTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsi
 			else	// Simulated download.
 			{
 				EnterCriticalSection( &context->download_info->shared_cs );
-				context->download_info->downloaded += output_buffer_length;					// The total amount of data (decoded) that was saved/simulated.
+				AddDownloadProgress( context->download_info, output_buffer_length );		// The total amount of data (decoded) that was saved/simulated.
+				bool add_part = UpdateAdaptiveParts( context );
 				LeaveCriticalSection( &context->download_info->shared_cs );
 
+				if ( add_part )
+				{
+					AddAdaptivePart( context );
+				}
+
 				EnterCriticalSection( &session_totals_cs );
 				g_session_total_downloaded += output_buffer_length;
 				LeaveCriticalSection( &session_totals_cs );
@@ -325,6 +325,7 @@ extern bool cfg_show_notification;
 extern bool cfg_always_on_top;
 extern bool cfg_enable_download_history;
 extern bool cfg_enable_quick_allocation;
+extern bool cfg_enable_file_mapping;
 extern bool cfg_set_filetime;
 extern bool cfg_use_one_instance;
 extern bool cfg_enable_drop_window;
@@ -347,6 +348,8 @@ extern unsigned char cfg_retry_parts_count;
 
 extern unsigned char cfg_default_ssl_version;
 extern unsigned char cfg_default_download_parts;
+extern bool cfg_adaptive_download_parts;
+extern bool cfg_accept_compressed_content;
 
 extern unsigned char cfg_max_redirects;
 
@@ -537,7 +540,6 @@ extern int *download_columns_width[ NUM_COLUMNS ];
 
 extern unsigned char g_total_columns;
 
-extern HANDLE g_timeout_semaphore;	// For updating the connection states.
 extern HANDLE g_timer_semaphore;	// For updating the listview.
 
 extern unsigned int g_session_status_count[ 8 ];	// 8 states that can be considered finished (Completed, Stopped, Failed, etc.)
@@ -0,0 +1,232 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "header_index.h"
+
+#include "lite_shell32.h"
+#include "byte_scan.h"
+
+char *GetHeaderValue( char *header, char *field_name, unsigned long field_name_length, char **value_start, char **value_end )
+{
+	char *field_name_start = NULL;
+	char *field_end = NULL;
+	char *itr_field = header;
+
+	while ( true )
+	{
+		// Find the end of the field.
+		field_end = _StrStrA( itr_field, "\r\n" );
+		if ( field_end != NULL && ( field_end != itr_field ) )	// Ensures we don't go past the last "\r\n".
+		{
+			// Skip whitespace that might appear before the field name.
+			while ( *itr_field == ' ' || *itr_field == '\t' || *itr_field == '\f' )
+			{
+				++itr_field;
+			}
+
+			field_name_start = itr_field;
+
+			while ( true )
+			{
+				// Find the end of the field name.
+				if ( itr_field < field_end )
+				{
+					// The field name will end with a colon.
+					if ( *itr_field == ':' )
+					{
+						// We found the field name.
+						if ( ( itr_field - field_name_start ) == field_name_length &&
+							 ( _StrCmpNIA( field_name_start, field_name, field_name_length ) == 0 ) )
+						{
+							++itr_field;
+
+							// Skip whitespace that might appear before the field value.
+							while ( *itr_field == ' ' || *itr_field == '\t' || *itr_field == '\f' )
+							{
+								++itr_field;
+							}
+
+							// Skip whitespace that could appear before the "\r\n", but after the field value.
+							while ( ( field_end - 1 ) >= itr_field )
+							{
+								if ( *( field_end - 1 ) != ' ' && *( field_end - 1 ) != '\t' && *( field_end - 1 ) != '\f' )
+								{
+									break;
+								}
+
+								--field_end;
+							}
+
+							*value_start = itr_field;
+							*value_end = field_end;
+
+							return field_name_start;
+						}
+						else	// Bad/wrong field name. Move to the next field.
+						{
+							itr_field = field_end + 2;
+
+							break;
+						}
+					}
+
+					++itr_field;
+				}
+				else	// Bad/wrong field name. Move to the next field.
+				{
+					itr_field = field_end + 2;
+
+					break;
+				}
+			}
+		}
+		else	// A complete field end was not found, or we reached the end of the header.
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+struct HEADER_FIELD_NAME
+{
+	char			*name;
+	unsigned char	name_length;	// 0 = empty slot
+	unsigned char	field;
+};
+
+// A perfect hash of the field names that we look up. The slot is ( name length + lowercase first character ) & 31.
+HEADER_FIELD_NAME g_header_field_names[ 32 ] =
+{
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 },
+	{ "Proxy-Authenticate", 18, HEADER_FIELD_PROXY_AUTHENTICATE },
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 },
+	{ "Transfer-Encoding", 17, HEADER_FIELD_TRANSFER_ENCODING },
+	{ NULL, 0, 0 },
+	{ "WWW-Authenticate", 16, HEADER_FIELD_WWW_AUTHENTICATE },
+	{ NULL, 0, 0 },
+	{ "ETag", 4, HEADER_FIELD_ETAG },
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 },
+	{ "Connection", 10, HEADER_FIELD_CONNECTION },
+	{ "Authorization", 13, HEADER_FIELD_AUTHORIZATION },
+	{ "Content-Type", 12, HEADER_FIELD_CONTENT_TYPE },
+	{ "Content-Range", 13, HEADER_FIELD_CONTENT_RANGE },
+	{ "Content-Length", 14, HEADER_FIELD_CONTENT_LENGTH },
+	{ NULL, 0, 0 },
+	{ "Content-Encoding", 16, HEADER_FIELD_CONTENT_ENCODING },
+	{ "Location", 8, HEADER_FIELD_LOCATION },
+	{ NULL, 0, 0 },
+	{ "Content-Disposition", 19, HEADER_FIELD_CONTENT_DISPOSITION },
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 },
+	{ "Last-Modified", 13, HEADER_FIELD_LAST_MODIFIED },
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 },
+	{ "Set-Cookie", 10, HEADER_FIELD_SET_COOKIE },
+	{ NULL, 0, 0 },
+	{ NULL, 0, 0 }
+};
+
+// Finds the "\r\n" that ends the field and, if it's a field that we look up, adds it to the index.
+// Only the first occurrence of a field is indexed. The rest are counted.
+// Returns the position of the "\r\n", or NULL if the field isn't complete before end.
+char *IndexHeaderField( HEADER_INDEX *header_index, char *field, char *end )
+{
+	if ( field >= end )
+	{
+		return NULL;
+	}
+
+	char *field_end = BS_FindCRLF( field, ( unsigned int )( end - field ) );
+	if ( field_end == NULL )
+	{
+		return NULL;
+	}
+
+	char *field_name_start = field;
+
+	// Skip whitespace that might appear before the field name.
+	while ( field_name_start < field_end && ( *field_name_start == ' ' || *field_name_start == '\t' || *field_name_start == '\f' ) )
+	{
+		++field_name_start;
+	}
+
+	// The field name will end with a colon.
+	char *field_name_end = BS_FindChar( field_name_start, ( unsigned int )( field_end - field_name_start ), ':' );
+
+	if ( field_name_end != NULL && field_name_end > field_name_start )
+	{
+		unsigned int field_name_length = ( unsigned int )( field_name_end - field_name_start );
+
+		HEADER_FIELD_NAME *hfn = &g_header_field_names[ ( field_name_length + ( *field_name_start | 0x20 ) ) & 31 ];
+
+		if ( hfn->name_length == field_name_length && _StrCmpNIA( field_name_start, hfn->name, field_name_length ) == 0 )
+		{
+			HEADER_FIELD *hf = &header_index->fields[ hfn->field ];
+
+			if ( hf->count++ == 0 )
+			{
+				char *value_start = field_name_end + 1;
+				char *value_end = field_end;
+
+				// Skip whitespace that might appear before the field value.
+				while ( *value_start == ' ' || *value_start == '\t' || *value_start == '\f' )
+				{
+					++value_start;
+				}
+
+				// Skip whitespace that could appear before the "\r\n", but after the field value.
+				while ( ( value_end - 1 ) >= value_start )
+				{
+					if ( *( value_end - 1 ) != ' ' && *( value_end - 1 ) != '\t' && *( value_end - 1 ) != '\f' )
+					{
+						break;
+					}
+
+					--value_end;
+				}
+
+				hf->field_name = field_name_start;
+				hf->value_start = value_start;
+				hf->value_end = value_end;
+			}
+		}
+	}
+
+	return field_end;
+}
+
+// The same as GetHeaderValue(), but for the first occurrence of a field that IndexHeaderField() has indexed.
+char *GetIndexedHeaderValue( HEADER_INDEX *header_index, unsigned char field, char **value_start, char **value_end )
+{
+	if ( header_index == NULL || field >= HEADER_FIELD_COUNT || header_index->fields[ field ].count == 0 )
+	{
+		return NULL;
+	}
+
+	*value_start = header_index->fields[ field ].value_start;
+	*value_end = header_index->fields[ field ].value_end;
+
+	return header_index->fields[ field ].field_name;
+}
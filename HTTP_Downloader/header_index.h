@@ -0,0 +1,56 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HEADER_INDEX_H
+#define _HEADER_INDEX_H
+
+#define HEADER_FIELD_TRANSFER_ENCODING		0
+#define HEADER_FIELD_CONTENT_LENGTH			1
+#define HEADER_FIELD_CONTENT_RANGE			2
+#define HEADER_FIELD_LOCATION				3
+#define HEADER_FIELD_CONNECTION				4
+#define HEADER_FIELD_CONTENT_ENCODING		5
+#define HEADER_FIELD_CONTENT_TYPE			6
+#define HEADER_FIELD_AUTHORIZATION			7
+#define HEADER_FIELD_WWW_AUTHENTICATE		8
+#define HEADER_FIELD_PROXY_AUTHENTICATE		9
+#define HEADER_FIELD_CONTENT_DISPOSITION	10
+#define HEADER_FIELD_LAST_MODIFIED			11
+#define HEADER_FIELD_ETAG					12
+#define HEADER_FIELD_SET_COOKIE				13
+#define HEADER_FIELD_COUNT					14
+
+struct HEADER_FIELD
+{
+	char			*field_name;	// The start of the first field with this name.
+	char			*value_start;
+	char			*value_end;
+	unsigned short	count;			// The number of fields with this name.
+};
+
+// Built with a single pass over the header so that each field can be looked up without searching for it.
+struct HEADER_INDEX
+{
+	HEADER_FIELD	fields[ HEADER_FIELD_COUNT ];
+};
+
+char *GetHeaderValue( char *header, char *field_name, unsigned long field_name_length, char **value_start, char **value_end );
+char *IndexHeaderField( HEADER_INDEX *header_index, char *field, char *end );
+char *GetIndexedHeaderValue( HEADER_INDEX *header_index, unsigned char field, char **value_start, char **value_end );
+
+#endif
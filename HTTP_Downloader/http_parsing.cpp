@@ -24,137 +24,57 @@
 
 #include "lite_ole32.h"
 #include "lite_zlib1.h"
+#include "lite_brotli.h"
+#include "lite_zstd.h"
 
 #include "cmessagebox.h"
 
+#include "file_operations.h"
+#include "byte_scan.h"
+
 // This basically skips past an expression string when searching for a particular character.
 // end is set if the end of the string is reached and the character is not found.
 char *FindCharExcludeExpression( char *start, char **end, char character )
 {
-	unsigned char opened_quote = 0;
+	if ( start == NULL )
+	{
+		return NULL;
+	}
+
+	// If an end was supplied, then search until we reach it. If not, then search until we reach the NULL terminator.
+	char *search_end = ( *end != NULL ? *end : start + lstrlenA( start ) );
 
 	char *pos = start;
 
-	while ( pos != NULL )
+	while ( pos < search_end )
 	{
-		// If an end was supplied, then search until we reach it. If not, then search until we reach the NULL terminator.
-		if ( ( *end != NULL && pos < *end ) || ( *end == NULL && *pos != NULL ) )
+		// Find the character, or a single or double quote that opens an expression.
+		pos = BS_FindChars( pos, ( unsigned int )( search_end - pos ), character, '\'', '\"' );
+		if ( pos == NULL )
 		{
-			if ( opened_quote == 0 )
-			{
-				// Exit if we've found the end of the value.
-				if ( *pos == character )
-				{
-					break;
-				}
-				else if ( *pos == '\'' || *pos == '\"' )	// A single or double quote has been opened.
-				{
-					opened_quote = *pos;
-				}
-			}
-			else	// Find the single or double quote's pair (closing quote).
-			{
-				if ( *pos == opened_quote || *pos == opened_quote )
-				{
-					opened_quote = 0;
-				}
-			}
-
-			++pos;
+			break;
 		}
-		else
-		{
-			// Make sure there's no open quote if we've reached the end.
-			if ( *end == NULL && opened_quote == 0 )
-			{
-				*end = pos;
-			}
 
-			pos = NULL;
+		// Exit if we've found the end of the value.
+		if ( *pos == character )
+		{
+			return pos;
 		}
-	}
 
-	return pos;
-}
-
-char *GetHeaderValue( char *header, char *field_name, unsigned long field_name_length, char **value_start, char **value_end )
-{
-	char *field_name_start = NULL;
-	char *field_end = NULL;
-	char *itr_field = header;
-
-	while ( true )
-	{
-		// Find the end of the field.
-		field_end = _StrStrA( itr_field, "\r\n" );
-		if ( field_end != NULL && ( field_end != itr_field ) )	// Ensures we don't go past the last "\r\n".
+		// Find the single or double quote's pair (closing quote).
+		char *closing_quote = BS_FindChar( pos + 1, ( unsigned int )( search_end - ( pos + 1 ) ), *pos );
+		if ( closing_quote == NULL )
 		{
-			// Skip whitespace that might appear before the field name.
-			while ( *itr_field == ' ' || *itr_field == '\t' || *itr_field == '\f' )
-			{
-				++itr_field;
-			}
-
-			field_name_start = itr_field;
-
-			while ( true )
-			{
-				// Find the end of the field name.
-				if ( itr_field < field_end )
-				{
-					// The field name will end with a colon.
-					if ( *itr_field == ':' )
-					{
-						// We found the field name.
-						if ( ( itr_field - field_name_start ) == field_name_length &&
-							 ( _StrCmpNIA( field_name_start, field_name, field_name_length ) == 0 ) )
-						{
-							++itr_field;
-
-							// Skip whitespace that might appear before the field value.
-							while ( *itr_field == ' ' || *itr_field == '\t' || *itr_field == '\f' )
-							{
-								++itr_field;
-							}
-
-							// Skip whitespace that could appear before the "\r\n", but after the field value.
-							while ( ( field_end - 1 ) >= itr_field )
-							{
-								if ( *( field_end - 1 ) != ' ' && *( field_end - 1 ) != '\t' && *( field_end - 1 ) != '\f' )
-								{
-									break;
-								}
-
-								--field_end;
-							}
-
-							*value_start = itr_field;
-							*value_end = field_end;
-
-							return field_name_start;
-						}
-						else	// Bad/wrong field name. Move to the next field.
-						{
-							itr_field = field_end + 2;
-
-							break;
-						}
-					}
+			return NULL;	// Don't set the end if there's an open quote.
+		}
 
-					++itr_field;
-				}
-				else	// Bad/wrong field name. Move to the next field.
-				{
-					itr_field = field_end + 2;
+		pos = closing_quote + 1;
+	}
 
-					break;
-				}
-			}
-		}
-		else	// A complete field end was not found, or we reached the end of the header.
-		{
-			break;
-		}
+	// We've reached the end without finding the character.
+	if ( *end == NULL )
+	{
+		*end = search_end;
 	}
 
 	return NULL;
@@ -525,12 +445,17 @@ bool ParseCookieValues( char *cookie_list, dllrbt_tree **cookie_tree, char **coo
 }
 
 // Modifies decoded_buffer
-bool ParseCookies( char *header, dllrbt_tree **cookie_tree, char **cookies, char *end_of_header = 0 )
+bool ParseCookies( HEADER_INDEX *header_index, dllrbt_tree **cookie_tree, char **cookies )
 {
 	char *set_cookie_header = NULL;
-	char *set_cookie_header_end = header;
+	char *set_cookie_header_end = NULL;
 
-	while ( GetHeaderValue( set_cookie_header_end, "Set-Cookie", 10, &set_cookie_header, &set_cookie_header_end ) != NULL )
+	// Only the first field is indexed. Any others are searched for after it.
+	unsigned short set_cookie_count = header_index->fields[ HEADER_FIELD_SET_COOKIE ].count;
+
+	char *set_cookie_field = GetIndexedHeaderValue( header_index, HEADER_FIELD_SET_COOKIE, &set_cookie_header, &set_cookie_header_end );
+
+	while ( set_cookie_field != NULL )
 	{
 		char *cookie_name_end = _StrChrA( set_cookie_header, '=' );
 		if ( cookie_name_end != NULL && cookie_name_end < set_cookie_header_end )
@@ -615,6 +540,8 @@ bool ParseCookies( char *header, dllrbt_tree **cookie_tree, char **cookies, char
 		}
 
 		set_cookie_header_end += 2;
+
+		set_cookie_field = ( --set_cookie_count > 0 ? GetHeaderValue( set_cookie_header_end, "Set-Cookie", 10, &set_cookie_header, &set_cookie_header_end ) : NULL );
 	}
 
 	ConstructCookie( *cookie_tree, cookies );
@@ -1053,16 +980,121 @@ bool ParseURL_W( wchar_t *url, wchar_t *original_resource,
 	return true;
 }
 
-unsigned int DecompressStream( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_size )
+// Counts a full decompression window for a simulated download so that the window can be reused.
+// Downloads that are saved hand their window to IO_WriteFile instead, and decoding resumes once it's written (see ResumeDecompression()).
+void CountDecompressedData( SOCKET_CONTEXT *context, unsigned int buffer_length )
 {
-	int stream_ret = Z_OK;
-	unsigned int total_data_length = 0;
+	DOWNLOAD_INFO *di = context->download_info;
 
-	if ( context->decompressed_buf == NULL )
+	if ( di == NULL || context->header_info.range_info == NULL || buffer_length == 0 )
 	{
-		context->decompressed_buf_size = ZLIB_CHUNK;
-		context->decompressed_buf = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * context->decompressed_buf_size );	// Allocate 16 kilobytes.
+		return;
+	}
+
+	EnterCriticalSection( &di->shared_cs );
+	AddDownloadProgress( di, buffer_length );	// The total amount of data (decoded) that was simulated.
+	bool add_part = UpdateAdaptiveParts( context );
+	LeaveCriticalSection( &di->shared_cs );
+
+	if ( add_part )
+	{
+		AddAdaptivePart( context );
+	}
+
+	EnterCriticalSection( &session_totals_cs );
+	g_session_total_downloaded += buffer_length;
+	LeaveCriticalSection( &session_totals_cs );
+
+	context->header_info.range_info->file_write_offset += buffer_length;	// The size of the non-encoded/decoded data that we would have written to a file.
+}
+
+DECODER_STATS g_decoder_stats[ CONTENT_ENCODING_COUNT ];	// decode_time is kept in performance counter ticks until it's read.
+
+// Returns true if we have a decoder for the content encoding.
+bool CanDecompressStream( unsigned char content_encoding )
+{
+	if ( content_encoding == CONTENT_ENCODING_GZIP || content_encoding == CONTENT_ENCODING_DEFLATE )
+	{
+	#ifndef ZLIB1_USE_STATIC_LIB
+		return ( zlib1_state == ZLIB1_STATE_RUNNING );
+	#else
+		return true;
+	#endif
+	}
+	else if ( content_encoding == CONTENT_ENCODING_BROTLI )
+	{
+	#ifndef BROTLI_USE_STATIC_LIB
+		return ( brotli_state == BROTLI_STATE_RUNNING );
+	#else
+		return true;
+	#endif
+	}
+	else if ( content_encoding == CONTENT_ENCODING_ZSTD )
+	{
+	#ifndef ZSTD_USE_STATIC_LIB
+		return ( zstd_state == ZSTD_STATE_RUNNING );
+	#else
+		return true;
+	#endif
+	}
+
+	return false;
+}
+
+// Copies the totals for a content encoding. decode_time is returned in microseconds.
+bool GetDecoderStats( unsigned char content_encoding, DECODER_STATS *stats )
+{
+	if ( stats == NULL || content_encoding >= CONTENT_ENCODING_COUNT )
+	{
+		return false;
+	}
+
+	EnterCriticalSection( &decoder_stats_cs );
+
+	_memcpy_s( stats, sizeof( DECODER_STATS ), &g_decoder_stats[ content_encoding ], sizeof( DECODER_STATS ) );
+
+	LeaveCriticalSection( &decoder_stats_cs );
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency( &frequency );
+
+	// Split the division so that the multiplication doesn't overflow.
+	stats->decode_time = ( ( stats->decode_time / ( unsigned long long )frequency.QuadPart ) * 1000000 ) +
+						 ( ( ( stats->decode_time % ( unsigned long long )frequency.QuadPart ) * 1000000 ) / ( unsigned long long )frequency.QuadPart );
+
+	return true;
+}
+
+// Releases whichever decoder the context's stream was set up with.
+void FreeDecompressionState( SOCKET_CONTEXT *context )
+{
+	if ( context->decoder_encoding == CONTENT_ENCODING_GZIP || context->decoder_encoding == CONTENT_ENCODING_DEFLATE )
+	{
+		_inflateEnd( &context->stream );
+	}
+	else if ( context->decoder_encoding == CONTENT_ENCODING_BROTLI )
+	{
+		_BrotliDecoderDestroyInstance( ( BrotliDecoderState * )context->decoder_state );
+	}
+	else if ( context->decoder_encoding == CONTENT_ENCODING_ZSTD )
+	{
+		_ZSTD_freeDStream( ( ZSTD_DStream * )context->decoder_state );
+	}
+
+	context->decoder_state = NULL;
+	context->decoder_encoding = CONTENT_ENCODING_NONE;
+
+	context->decompressed_length = 0;
+}
 
+// Each of the decoders picks up after the output that's already in the window, and stops once the window is full or the input is used up.
+// They return the number of bytes of the buffer that were decoded.
+unsigned int InflateStream( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_size )
+{
+	int stream_ret = Z_OK;
+
+	if ( context->decoder_encoding == CONTENT_ENCODING_NONE )
+	{
 		_memzero( &context->stream, sizeof( z_stream ) );
 		context->stream.zalloc = zGlobalAlloc;
 		context->stream.zfree = zGlobalFree;
@@ -1072,21 +1104,24 @@ unsigned int DecompressStream( SOCKET_CONTEXT *context, char *buffer, unsigned i
 		// MAX_WBITS + 16	= gzip
 		// MAX_WBITS + 32	= Detects gzip or zlib
 		stream_ret = _inflateInit2( &context->stream, ( context->header_info.content_encoding == CONTENT_ENCODING_GZIP ? MAX_WBITS + 16 : ( context->header_info.content_encoding == CONTENT_ENCODING_DEFLATE ? -MAX_WBITS : MAX_WBITS ) ) );	// 1 = gzip, 2 = deflate, everything else = default
+		if ( stream_ret != Z_OK )
+		{
+			return 0;
+		}
+
+		context->decoder_encoding = context->header_info.content_encoding;
 	}
 
 	context->stream.next_in = ( Bytef * )buffer;
 	context->stream.avail_in = buffer_size;
-	if ( context->stream.avail_in == 0 )
-	{
-		stream_ret = Z_DATA_ERROR;
-	}
 
 	bool retry = false;
 
-	while ( stream_ret == Z_OK && context->stream.avail_in > 0 )
+	// An empty buffer still lets zlib flush any output that it was holding when the window filled up.
+	while ( stream_ret == Z_OK && context->decompressed_length < context->decompressed_buf_size )
 	{
-		context->stream.next_out = ( Bytef * )context->decompressed_buf + total_data_length;
-		context->stream.avail_out = context->decompressed_buf_size - total_data_length;
+		context->stream.next_out = ( Bytef * )context->decompressed_buf + context->decompressed_length;
+		context->stream.avail_out = context->decompressed_buf_size - context->decompressed_length;
 
 		stream_ret = _inflate( &context->stream, Z_NO_FLUSH );
 		if ( stream_ret == Z_NEED_DICT )
@@ -1095,11 +1130,14 @@ unsigned int DecompressStream( SOCKET_CONTEXT *context, char *buffer, unsigned i
 		}
 		else if ( stream_ret == Z_DATA_ERROR )
 		{
-			if ( retry )
+			// We can only start over if nothing has been decompressed yet.
+			if ( retry || context->stream.total_out > 0 )
 			{
 				break;
 			}
-			
+
+			_inflateEnd( &context->stream );
+
 			_memzero( &context->stream, sizeof( z_stream ) );
 			context->stream.zalloc = zGlobalAlloc;
 			context->stream.zfree = zGlobalFree;
@@ -1114,24 +1152,198 @@ unsigned int DecompressStream( SOCKET_CONTEXT *context, char *buffer, unsigned i
 
 			continue;
 		}
+		else if ( stream_ret == Z_BUF_ERROR )	// There was nothing left to output.
+		{
+			break;
+		}
 
-		total_data_length = ( context->decompressed_buf_size - context->stream.avail_out );
+		context->decompressed_length = ( context->decompressed_buf_size - context->stream.avail_out );
 
-		// Allocate more memory if we have any remaining data in our buffer to decompress.
-		if ( stream_ret == Z_OK && context->stream.avail_in > 0 )
+		// The input was used up without filling the window, so zlib isn't holding anything back.
+		if ( context->stream.avail_in == 0 && context->stream.avail_out > 0 )
 		{
-			context->decompressed_buf_size += ZLIB_CHUNK;
-			char *realloc_buffer = ( char * )GlobalReAlloc( context->decompressed_buf, sizeof( char ) * context->decompressed_buf_size, GMEM_MOVEABLE );
-			if ( realloc_buffer != NULL )
-			{
-				context->decompressed_buf = realloc_buffer;
-			}
+			break;
 		}
 	}
 
-	return total_data_length;
+	return ( buffer_size - context->stream.avail_in );
 }
 
+unsigned int BrotliStream( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_size )
+{
+	if ( context->decoder_encoding == CONTENT_ENCODING_NONE )
+	{
+		context->decoder_state = _BrotliDecoderCreateInstance( NULL, NULL, NULL );
+		if ( context->decoder_state == NULL )
+		{
+			return 0;
+		}
+
+		context->decoder_encoding = CONTENT_ENCODING_BROTLI;
+	}
+
+	const unsigned char *next_in = ( const unsigned char * )buffer;
+	size_t avail_in = buffer_size;
+
+	unsigned char *next_out = ( unsigned char * )context->decompressed_buf + context->decompressed_length;
+	size_t avail_out = context->decompressed_buf_size - context->decompressed_length;
+
+	// The decoder returns when it needs more input, when the window is full (BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT), or when the stream ends or is bad.
+	_BrotliDecoderDecompressStream( ( BrotliDecoderState * )context->decoder_state, &avail_in, &next_in, &avail_out, &next_out, NULL );
+
+	context->decompressed_length = ( context->decompressed_buf_size - ( unsigned int )avail_out );
+
+	return ( buffer_size - ( unsigned int )avail_in );
+}
+
+unsigned int ZstdStream( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_size )
+{
+	if ( context->decoder_encoding == CONTENT_ENCODING_NONE )
+	{
+		ZSTD_DStream *zds = _ZSTD_createDStream();
+		if ( zds == NULL )
+		{
+			return 0;
+		}
+
+		// Don't let the server make us allocate a window larger than the one the encoding allows.
+		if ( _ZSTD_isError( _ZSTD_initDStream( zds ) ) || _ZSTD_isError( _ZSTD_DCtx_setParameter( zds, ZSTD_d_windowLogMax, ZSTD_WINDOW_LOG_MAX ) ) )
+		{
+			_ZSTD_freeDStream( zds );
+
+			return 0;
+		}
+
+		context->decoder_state = zds;
+		context->decoder_encoding = CONTENT_ENCODING_ZSTD;
+	}
+
+	ZSTD_inBuffer input;
+	input.src = buffer;
+	input.size = buffer_size;
+	input.pos = 0;
+
+	ZSTD_outBuffer output;
+	output.dst = context->decompressed_buf;
+	output.size = context->decompressed_buf_size;
+	output.pos = context->decompressed_length;
+
+	// A full window means the decoder may still be holding output, even if all of the input was consumed.
+	while ( output.pos < output.size )
+	{
+		size_t ret = _ZSTD_decompressStream( ( ZSTD_DStream * )context->decoder_state, &output, &input );
+
+		if ( _ZSTD_isError( ret ) || input.pos == input.size )
+		{
+			break;
+		}
+	}
+
+	context->decompressed_length = ( unsigned int )output.pos;
+
+	return ( unsigned int )input.pos;
+}
+
+// Decodes the buffer into a fixed window, after any output that's still waiting in it.
+// This keeps the memory that a context uses constant no matter how well the content compresses.
+// Decoding stops once the window is full. The caller writes the window and calls us again with the rest of the buffer.
+// Simulated downloads don't write anything, so their full windows are counted and reused right away.
+// Returns the number of bytes of the buffer that were decoded. The output's length is in context->decompressed_length.
+unsigned int DecompressStream( SOCKET_CONTEXT *context, char *buffer, unsigned int buffer_size )
+{
+	unsigned int decoded_length = 0;
+	unsigned long long output_length = 0;
+	unsigned char content_encoding = context->header_info.content_encoding;
+
+	if ( content_encoding >= CONTENT_ENCODING_COUNT )
+	{
+		return 0;
+	}
+
+	if ( context->decompressed_buf == NULL )
+	{
+		context->decompressed_buf_size = ZLIB_CHUNK;
+		context->decompressed_buf = BP_Allocate( sizeof( char ) * context->decompressed_buf_size );	// Allocate 16 kilobytes.
+		if ( context->decompressed_buf == NULL )
+		{
+			return 0;
+		}
+
+		context->decompressed_length = 0;
+	}
+
+	// The window has to be written before anything else can be decoded into it.
+	if ( context->decompressed_length >= context->decompressed_buf_size )
+	{
+		return 0;
+	}
+
+	// The stream was set up for a different encoding.
+	if ( context->decoder_encoding != CONTENT_ENCODING_NONE && context->decoder_encoding != content_encoding )
+	{
+		FreeDecompressionState( context );
+	}
+
+	bool new_stream = ( context->decoder_encoding == CONTENT_ENCODING_NONE );
+	bool reuse_window = ( context->download_info == NULL || ( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) );
+
+	LARGE_INTEGER start_time, end_time;
+	QueryPerformanceCounter( &start_time );
+
+	for ( ;; )
+	{
+		unsigned int window_length = context->decompressed_length;
+
+		if ( content_encoding == CONTENT_ENCODING_BROTLI )
+		{
+			decoded_length += BrotliStream( context, buffer + decoded_length, buffer_size - decoded_length );
+		}
+		else if ( content_encoding == CONTENT_ENCODING_ZSTD )
+		{
+			decoded_length += ZstdStream( context, buffer + decoded_length, buffer_size - decoded_length );
+		}
+		else
+		{
+			decoded_length += InflateStream( context, buffer + decoded_length, buffer_size - decoded_length );
+		}
+
+		output_length += ( context->decompressed_length - window_length );
+
+		if ( !reuse_window || context->decompressed_length < context->decompressed_buf_size )
+		{
+			break;
+		}
+
+		CountDecompressedData( context, context->decompressed_length );
+
+		context->decompressed_length = 0;
+	}
+
+	QueryPerformanceCounter( &end_time );
+
+	EnterCriticalSection( &decoder_stats_cs );
+
+	g_decoder_stats[ content_encoding ].input_bytes += decoded_length;
+	g_decoder_stats[ content_encoding ].output_bytes += output_length;
+	g_decoder_stats[ content_encoding ].decode_time += ( unsigned long long )( end_time.QuadPart - start_time.QuadPart );
+	if ( new_stream && context->decoder_encoding != CONTENT_ENCODING_NONE )
+	{
+		++g_decoder_stats[ content_encoding ].streams;
+	}
+
+	LeaveCriticalSection( &decoder_stats_cs );
+
+	return decoded_length;
+}
+
+// Called by IO_WriteFile once a full decompression window has been written.
+// The decoder might still be holding output, so it's drained before the rest of what we received is decoded.
+char ResumeDecompression( SOCKET_CONTEXT *context )
+{
+	DecompressStream( context, context->decode_wsabuf.buf, 0 );
+
+	return GetHTTPResponseContent( context, context->decode_wsabuf.buf, context->decode_wsabuf.len );
+}
 
 //
 //
@@ -1221,12 +1433,12 @@ unsigned char GetHTTPMethod( char *header )
 	return method_type;
 }
 
-bool GetTransferEncoding( char *header )
+bool GetTransferEncoding( HEADER_INDEX *header_index )
 {
 	char *transfer_encoding_header = NULL;
 	char *transfer_encoding_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Transfer-Encoding", 17, &transfer_encoding_header, &transfer_encoding_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_TRANSFER_ENCODING, &transfer_encoding_header, &transfer_encoding_header_end ) != NULL )
 	{
 		if ( ( transfer_encoding_header_end - transfer_encoding_header ) == 7 && _StrCmpNIA( transfer_encoding_header, "chunked", 7 ) == 0 )
 		{
@@ -1237,12 +1449,12 @@ bool GetTransferEncoding( char *header )
 	return false;
 }
 
-unsigned long long GetContentLength( char *header )
+unsigned long long GetContentLength( HEADER_INDEX *header_index )
 {
 	char *content_length_header = NULL;
 	char *content_length_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Content-Length", 14, &content_length_header, &content_length_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_CONTENT_LENGTH, &content_length_header, &content_length_header_end ) != NULL )
 	{
 		int content_length_length = ( int )( content_length_header_end - content_length_header );
 		if ( content_length_length > 20 )
@@ -1261,12 +1473,12 @@ unsigned long long GetContentLength( char *header )
 	return 0;
 }
 
-void GetContentRange( char *header, RANGE_INFO *range_info )
+void GetContentRange( HEADER_INDEX *header_index, RANGE_INFO *range_info )
 {
 	char *content_range_header = NULL;
 	char *content_range_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Content-Range", 13, &content_range_header, &content_range_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_CONTENT_RANGE, &content_range_header, &content_range_header_end ) != NULL )
 	{
 		char *content_range_value = _StrStrIA( content_range_header, "bytes" );
 		if ( content_range_value != NULL )
@@ -1378,12 +1590,12 @@ void GetContentRange( char *header, RANGE_INFO *range_info )
 	}
 }
 
-void GetLocation( char *header, char *resource, URL_LOCATION *url_location )
+void GetLocation( HEADER_INDEX *header_index, char *resource, URL_LOCATION *url_location )
 {
 	char *location_header = NULL;
 	char *location_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Location", 8, &location_header, &location_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_LOCATION, &location_header, &location_header_end ) != NULL )
 	{
 		// Temporary string terminator.
 		char tmp_end = *location_header_end;
@@ -1432,14 +1644,14 @@ void GetLocation( char *header, char *resource, URL_LOCATION *url_location )
 	}
 }
 
-unsigned char GetConnection( char *header )
+unsigned char GetConnection( HEADER_INDEX *header_index )
 {
 	unsigned char connection_type = CONNECTION_NONE;
 
 	char *connection_header = NULL;
 	char *connection_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Connection", 10, &connection_header, &connection_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_CONNECTION, &connection_header, &connection_header_end ) != NULL )
 	{
 		char tmp_end = *connection_header_end;
 		*connection_header_end = 0;	// Sanity
@@ -1465,12 +1677,12 @@ unsigned char GetConnection( char *header )
 	return connection_type;
 }
 
-unsigned char GetContentEncoding( char *header )
+unsigned char GetContentEncoding( HEADER_INDEX *header_index )
 {
 	char *content_encoding_header = NULL;
 	char *content_encoding_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Content-Encoding", 16, &content_encoding_header, &content_encoding_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_CONTENT_ENCODING, &content_encoding_header, &content_encoding_header_end ) != NULL )
 	{
 		if ( ( content_encoding_header_end - content_encoding_header ) == 4 && _StrCmpNIA( content_encoding_header, "gzip", 4 ) == 0 )
 		{
@@ -1480,6 +1692,14 @@ unsigned char GetContentEncoding( char *header )
 		{
 			return CONTENT_ENCODING_DEFLATE;
 		}
+		else if ( ( content_encoding_header_end - content_encoding_header ) == 2 && _StrCmpNIA( content_encoding_header, "br", 2 ) == 0 )
+		{
+			return CONTENT_ENCODING_BROTLI;
+		}
+		else if ( ( content_encoding_header_end - content_encoding_header ) == 4 && _StrCmpNIA( content_encoding_header, "zstd", 4 ) == 0 )
+		{
+			return CONTENT_ENCODING_ZSTD;
+		}
 		else
 		{
 			return CONTENT_ENCODING_UNHANDLED;	// Unhandled.
@@ -1489,12 +1709,12 @@ unsigned char GetContentEncoding( char *header )
 	return CONTENT_ENCODING_NONE;
 }
 
-bool GetContentType( char *header, wchar_t *extension_buffer, unsigned int extension_buffer_size )
+bool GetContentType( HEADER_INDEX *header_index, wchar_t *extension_buffer, unsigned int extension_buffer_size )
 {
 	char *content_encoding_header = NULL;
 	char *content_encoding_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Content-Type", 12, &content_encoding_header, &content_encoding_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_CONTENT_TYPE, &content_encoding_header, &content_encoding_header_end ) != NULL )
 	{
 		char tmp_end = *content_encoding_header_end;
 		*content_encoding_header_end = 0;	// Sanity
@@ -1578,12 +1798,12 @@ bool GetContentType( char *header, wchar_t *extension_buffer, unsigned int exten
 	return ( extension_buffer[ 0 ] != 0 ? true : false );
 }
 
-void GetAuthorization( char *header, AUTH_INFO *auth_info )
+void GetAuthorization( HEADER_INDEX *header_index, AUTH_INFO *auth_info )
 {
 	char *authorization_header = NULL;
 	char *authorization_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Authorization", 13, &authorization_header, &authorization_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_AUTHORIZATION, &authorization_header, &authorization_header_end ) != NULL )
 	{
 		if ( _StrStrIA( authorization_header, "Basic " ) != NULL )	// The protocol doesn't specify whether "Basic" is case-sensitive or not. Note that the protocol requires a single space (SP) after "Basic".
 		{
@@ -1879,7 +2099,7 @@ void GetAuthorization( char *header, AUTH_INFO *auth_info )
 	}
 }
 
-void GetAuthenticate( char *header, unsigned char auth_header_type, AUTH_INFO *auth_info )
+void GetAuthenticate( HEADER_INDEX *header_index, unsigned char auth_header_type, AUTH_INFO *auth_info )
 {
 	char *authenticate_header = NULL;
 	char *authenticate_header_end = NULL;
@@ -1888,11 +2108,11 @@ void GetAuthenticate( char *header, unsigned char auth_header_type, AUTH_INFO *a
 
 	if ( auth_header_type == 1 )
 	{
-		authentication_field = GetHeaderValue( header, "WWW-Authenticate", 16, &authenticate_header, &authenticate_header_end );
+		authentication_field = GetIndexedHeaderValue( header_index, HEADER_FIELD_WWW_AUTHENTICATE, &authenticate_header, &authenticate_header_end );
 	}
 	else if ( auth_header_type == 2 )
 	{
-		authentication_field = GetHeaderValue( header, "Proxy-Authenticate", 18, &authenticate_header, &authenticate_header_end );
+		authentication_field = GetIndexedHeaderValue( header_index, HEADER_FIELD_PROXY_AUTHENTICATE, &authenticate_header, &authenticate_header_end );
 	}
 
 	if ( authentication_field != NULL )
@@ -2085,12 +2305,12 @@ void GetAuthenticate( char *header, unsigned char auth_header_type, AUTH_INFO *a
 	}
 }
 
-char *GetContentDisposition( char *header, unsigned int &filename_length )
+char *GetContentDisposition( HEADER_INDEX *header_index, unsigned int &filename_length )
 {
 	char *content_disposition_header = NULL;
 	char *content_disposition_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Content-Disposition", 19, &content_disposition_header, &content_disposition_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_CONTENT_DISPOSITION, &content_disposition_header, &content_disposition_header_end ) != NULL )
 	{
 		// Case insensitive. The RFC doesn't mention anything about it.
 		content_disposition_header = _StrStrIA( content_disposition_header, "filename" );
@@ -2177,7 +2397,7 @@ char *GetContentDisposition( char *header, unsigned int &filename_length )
 	return NULL;
 }
 
-bool GetLastModified( char *header, SYSTEMTIME &date_time )
+bool GetLastModified( HEADER_INDEX *header_index, SYSTEMTIME &date_time )
 {
 	bool ret = false;
 
@@ -2186,7 +2406,7 @@ bool GetLastModified( char *header, SYSTEMTIME &date_time )
 	char *last_modified_header = NULL;
 	char *last_modified_header_end = NULL;
 
-	if ( GetHeaderValue( header, "Last-Modified", 13, &last_modified_header, &last_modified_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_LAST_MODIFIED, &last_modified_header, &last_modified_header_end ) != NULL )
 	{
 		char tmp_end = *last_modified_header_end;
 		*last_modified_header_end = 0;	// Sanity
@@ -2386,12 +2606,12 @@ bool GetLastModified( char *header, SYSTEMTIME &date_time )
 	return ret;
 }
 /*
-char *GetETag( char *header )
+char *GetETag( HEADER_INDEX *header_index )
 {
 	char *etag_header = NULL;
 	char *etag_header_end = NULL;
 
-	if ( GetHeaderValue( header, "ETag", 4, &etag_header, &etag_header_end ) != NULL )
+	if ( GetIndexedHeaderValue( header_index, HEADER_FIELD_ETAG, &etag_header, &etag_header_end ) != NULL )
 	{
 		int etag_length = etag_header_end - etag_header;
 
@@ -2431,8 +2651,11 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 
 	unsigned long long content_length = 0;
 
-	// Try to find the end of the last valid field.
-	char *next_field = _StrStrA( header_buffer, "\r\n" );
+	HEADER_INDEX header_index;
+	_memzero( &header_index, sizeof( HEADER_INDEX ) );
+
+	// Try to find the end of the last valid field. Each field is indexed as we go.
+	char *next_field = IndexHeaderField( &header_index, header_buffer, header_buffer + header_buffer_length );
 	if ( next_field != NULL )
 	{
 		do
@@ -2452,7 +2675,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 				}
 				else	// Find the next field if we didn't find the header terminator.
 				{
-					next_field = _StrStrA( next_field, "\r\n" );
+					next_field = IndexHeaderField( &header_index, next_field, header_buffer + header_buffer_length );
 				}
 			}
 			else	// Not enough characters to search for anything else.
@@ -2494,9 +2717,9 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 		{
 			if ( _StrCmpNIA( header_buffer, "Set-Cookie", 10 ) == 0 )
 			{
-				context->buffer_size += BUFFER_SIZE;
+				char *realloc_buffer = BP_Reallocate( context->buffer, sizeof( char ) * ( context->buffer_size + 1 ), sizeof( char ) * ( context->buffer_size + BUFFER_SIZE + 1 ) );
 
-				char *realloc_buffer = ( char * )GlobalReAlloc( context->buffer, sizeof( char ) * ( context->buffer_size + 1 ), GMEM_MOVEABLE | GMEM_ZEROINIT );
+				context->buffer_size += BUFFER_SIZE;
 				if ( realloc_buffer != NULL )
 				{
 					context->buffer = realloc_buffer;
@@ -2560,14 +2783,14 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 			if ( context->header_info.digest_info != NULL &&
 				 context->header_info.digest_info->auth_type == AUTH_TYPE_NONE )
 			{
-				GetAuthorization( header_buffer, context->header_info.digest_info );
+				GetAuthorization( &header_index, context->header_info.digest_info );
 			}
 		}
 
 		char *new_cookies = NULL;
 
 		// This value will be saved
-		if ( !ParseCookies( header_buffer, &context->header_info.cookie_tree, &new_cookies, end_of_header ) )
+		if ( !ParseCookies( &header_index, &context->header_info.cookie_tree, &new_cookies ) )
 		{
 			GlobalFree( new_cookies );
 			new_cookies = NULL;
@@ -2601,14 +2824,14 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 
 		if ( !context->header_info.chunked_transfer )
 		{
-			context->header_info.chunked_transfer = GetTransferEncoding( header_buffer );
+			context->header_info.chunked_transfer = GetTransferEncoding( &header_index );
 		}
 
 		if ( context->header_info.range_info->content_length == 0 )
 		{
-			content_length = GetContentLength( header_buffer );
+			content_length = GetContentLength( &header_index );
 
-			GetContentRange( header_buffer, context->header_info.range_info );
+			GetContentRange( &header_index, context->header_info.range_info );
 
 			// Set the content_length and range content_length to the same value. (Use the greater of the two values.)
 			if ( content_length > context->header_info.range_info->content_length )
@@ -2619,7 +2842,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 
 		if ( context->header_info.url_location.host == NULL )
 		{
-			GetLocation( header_buffer, context->request_info.resource, &context->header_info.url_location );
+			GetLocation( &header_index, context->request_info.resource, &context->header_info.url_location );
 
 			// This is so stupid. Match the relative URI protocol/port with the request URI protocol/port.
 			if ( context->header_info.url_location.protocol == PROTOCOL_RELATIVE )
@@ -2636,7 +2859,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 
 		if ( context->header_info.connection == CONNECTION_NONE )
 		{
-			context->header_info.connection = GetConnection( header_buffer );
+			context->header_info.connection = GetConnection( &header_index );
 
 			// If the Connection header field does not exist, then by default, it'll be keep-alive.
 			if ( context->header_info.connection == CONNECTION_NONE )
@@ -2647,7 +2870,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 
 		if ( context->header_info.content_encoding == CONTENT_ENCODING_NONE )
 		{
-			context->header_info.content_encoding = GetContentEncoding( header_buffer );
+			context->header_info.content_encoding = GetContentEncoding( &header_index );
 		}
 
 		if ( context->download_info != NULL &&
@@ -2656,8 +2879,10 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 		{
 			context->download_info->download_operations &= ~DOWNLOAD_OPERATION_GET_EXTENSION;
 
-			if ( GetContentType( header_buffer, context->download_info->file_path + context->download_info->file_extension_offset, MAX_PATH - context->download_info->file_extension_offset ) )
+			if ( GetContentType( &header_index, context->download_info->file_path + context->download_info->file_extension_offset, MAX_PATH - context->download_info->file_extension_offset ) )
 			{
+				UpdateFilenameIndex( context->download_info );
+
 				EnterCriticalSection( &icon_cache_cs );
 				// Find the icon info
 				dllrbt_iterator *itr = dllrbt_find( g_icon_handles, ( void * )L"", false );
@@ -2745,7 +2970,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 			if ( context->header_info.digest_info != NULL &&
 				 context->header_info.digest_info->auth_type == AUTH_TYPE_NONE )
 			{
-				GetAuthenticate( header_buffer, 1, context->header_info.digest_info );
+				GetAuthenticate( &header_index, 1, context->header_info.digest_info );
 			}
 		}
 
@@ -2762,7 +2987,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 				if ( context->header_info.proxy_digest_info != NULL &&
 					 context->header_info.proxy_digest_info->auth_type == AUTH_TYPE_NONE )
 				{
-					GetAuthenticate( header_buffer, 2, context->header_info.proxy_digest_info );
+					GetAuthenticate( &header_index, 2, context->header_info.proxy_digest_info );
 				}
 			}
 		}
@@ -2773,7 +2998,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 		{
 			unsigned int filename_length = 0;
 
-			char *filename = GetContentDisposition( header_buffer, filename_length );
+			char *filename = GetContentDisposition( &header_index, filename_length );
 			if ( filename != NULL )
 			{
 				// Remove directory paths.
@@ -2831,6 +3056,8 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 
 				context->download_info->file_extension_offset = context->download_info->filename_offset + get_file_extension_offset( context->download_info->file_path + context->download_info->filename_offset, w_filename_length );
 
+				UpdateFilenameIndex( context->download_info );
+
 				// Make sure any existing file hasn't started downloading.
 				if ( !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) && context->download_info->downloaded == 0 )
 				{
@@ -2891,7 +3118,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 					SYSTEMTIME date_time;
 					_memzero( &date_time, sizeof( SYSTEMTIME ) );
 
-					if ( GetLastModified( header_buffer, date_time ) )
+					if ( GetLastModified( &header_index, date_time ) )
 					{
 						SystemTimeToFileTime( &date_time, &context->header_info.last_modified );
 
@@ -2924,7 +3151,7 @@ char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int
 
 		/*if ( !context->header_info.etag )
 		{
-			char *etag = GetETag( header_buffer );
+			char *etag = GetETag( &header_index );
 			if ( etag != NULL )
 			{
 				if ( context->download_info != NULL )
@@ -3111,6 +3338,8 @@ char GetHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int h
 						context->download_info->download_operations |= DOWNLOAD_OPERATION_GET_EXTENSION;
 					}
 
+					UpdateFilenameIndex( context->download_info );
+
 					// Make sure any existing file hasn't started downloading.
 					if ( !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) && context->download_info->downloaded == 0 )
 					{
@@ -3325,7 +3554,7 @@ char GetHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int h
 
 			context->download_info->parts = context->parts;
 
-			context->download_info->file_size = context->header_info.range_info->content_length;
+			SetDownloadProgress( context->download_info, context->download_info->downloaded, context->header_info.range_info->content_length );
 
 			if ( context->ssl == NULL )
 			{
@@ -3471,6 +3700,68 @@ char HandleRedirect( SOCKET_CONTEXT *context )
 	return content_status;
 }
 
+// Copies the request information of a part so that another connection can download one of the download's ranges.
+SOCKET_CONTEXT *CreatePartContext( SOCKET_CONTEXT *context )
+{
+	SOCKET_CONTEXT *new_context = CreateSocketContext();
+	if ( new_context == NULL )
+	{
+		return NULL;
+	}
+
+	new_context->processed_header = true;
+
+	new_context->parts = context->parts;
+
+	new_context->got_filename = context->got_filename;	// No need to rename it again.
+	new_context->got_last_modified = context->got_last_modified;	// No need to get the date/time again.
+	new_context->show_file_size_prompt = context->show_file_size_prompt;	// No need to prompt again.
+
+	new_context->request_info.host = GlobalStrDupA( context->request_info.host );
+	new_context->request_info.port = context->request_info.port;
+	new_context->request_info.resource = GlobalStrDupA( context->request_info.resource );
+	new_context->request_info.protocol = context->request_info.protocol;
+
+	new_context->request_info.auth_info.username = GlobalStrDupA( context->request_info.auth_info.username );
+	new_context->request_info.auth_info.password = GlobalStrDupA( context->request_info.auth_info.password );
+
+	new_context->header_info.cookie_tree = CopyCookieTree( context->header_info.cookie_tree );
+	new_context->header_info.cookies = GlobalStrDupA( context->header_info.cookies );
+
+	// We can copy the digest info so that we don't have to make any extra requests to 401 and 407 responses.
+	if ( context->header_info.digest_info != NULL )
+	{
+		new_context->header_info.digest_info = ( AUTH_INFO * )GlobalAlloc( GPTR, sizeof( AUTH_INFO ) );
+
+		new_context->header_info.digest_info->algorithm = context->header_info.digest_info->algorithm;
+		new_context->header_info.digest_info->auth_type = context->header_info.digest_info->auth_type;
+		new_context->header_info.digest_info->qop_type = context->header_info.digest_info->qop_type;
+
+		new_context->header_info.digest_info->domain = GlobalStrDupA( context->header_info.digest_info->domain );
+		new_context->header_info.digest_info->nonce = GlobalStrDupA( context->header_info.digest_info->nonce );
+		new_context->header_info.digest_info->opaque = GlobalStrDupA( context->header_info.digest_info->opaque );
+		new_context->header_info.digest_info->qop = GlobalStrDupA( context->header_info.digest_info->qop );
+		new_context->header_info.digest_info->realm = GlobalStrDupA( context->header_info.digest_info->realm );
+	}
+
+	if ( context->header_info.proxy_digest_info != NULL )
+	{
+		new_context->header_info.proxy_digest_info = ( AUTH_INFO * )GlobalAlloc( GPTR, sizeof( AUTH_INFO ) );
+
+		new_context->header_info.proxy_digest_info->algorithm = context->header_info.proxy_digest_info->algorithm;
+		new_context->header_info.proxy_digest_info->auth_type = context->header_info.proxy_digest_info->auth_type;
+		new_context->header_info.proxy_digest_info->qop_type = context->header_info.proxy_digest_info->qop_type;
+
+		new_context->header_info.proxy_digest_info->domain = GlobalStrDupA( context->header_info.proxy_digest_info->domain );
+		new_context->header_info.proxy_digest_info->nonce = GlobalStrDupA( context->header_info.proxy_digest_info->nonce );
+		new_context->header_info.proxy_digest_info->opaque = GlobalStrDupA( context->header_info.proxy_digest_info->opaque );
+		new_context->header_info.proxy_digest_info->qop = GlobalStrDupA( context->header_info.proxy_digest_info->qop );
+		new_context->header_info.proxy_digest_info->realm = GlobalStrDupA( context->header_info.proxy_digest_info->realm );
+	}
+
+	return new_context;
+}
+
 char MakeRangeRequest( SOCKET_CONTEXT *context )
 {
 	char content_status = CONTENT_STATUS_FAILED;
@@ -3489,6 +3780,9 @@ char MakeRangeRequest( SOCKET_CONTEXT *context )
 				LeaveCriticalSection( &context->download_info->shared_cs );
 			}
 
+			// Adaptive downloads queue most of their ranges and add parts as the throughput allows.
+			InitializeAdaptiveParts( context );
+
 			unsigned long long range_size = context->header_info.range_info->content_length / context->parts;
 			unsigned long long range_offset = range_size;
 
@@ -3524,8 +3818,13 @@ char MakeRangeRequest( SOCKET_CONTEXT *context )
 						ri->file_write_offset = ri->range_start;
 
 						DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+
+						EnterCriticalSection( &range_list_cs );
+
 						DLL_AddNode( &context->download_info->range_list, range_node, -1 );
 
+						LeaveCriticalSection( &range_list_cs );
+
 						if ( context->download_info->range_queue == NULL )
 						{
 							context->download_info->range_queue = range_node;
@@ -3543,58 +3842,9 @@ char MakeRangeRequest( SOCKET_CONTEXT *context )
 				}
 
 				// Save the request information, the header information (if we got any), and create a new connection.
-				SOCKET_CONTEXT *new_context = CreateSocketContext();
-
-				new_context->processed_header = true;
+				SOCKET_CONTEXT *new_context = CreatePartContext( context );
 
 				new_context->part = part;
-				new_context->parts = context->parts;
-
-				new_context->got_filename = context->got_filename;	// No need to rename it again.
-				new_context->got_last_modified = context->got_last_modified;	// No need to get the date/time again.
-				new_context->show_file_size_prompt = context->show_file_size_prompt;	// No need to prompt again.
-
-				new_context->request_info.host = GlobalStrDupA( context->request_info.host );
-				new_context->request_info.port = context->request_info.port;
-				new_context->request_info.resource = GlobalStrDupA( context->request_info.resource );
-				new_context->request_info.protocol = context->request_info.protocol;
-
-				new_context->request_info.auth_info.username = GlobalStrDupA( context->request_info.auth_info.username );
-				new_context->request_info.auth_info.password = GlobalStrDupA( context->request_info.auth_info.password );
-
-				new_context->header_info.cookie_tree = CopyCookieTree( context->header_info.cookie_tree );
-				new_context->header_info.cookies = GlobalStrDupA( context->header_info.cookies );
-
-				// We can copy the digest info so that we don't have to make any extra requests to 401 and 407 responses.
-				if ( context->header_info.digest_info != NULL )
-				{
-					new_context->header_info.digest_info = ( AUTH_INFO * )GlobalAlloc( GPTR, sizeof( AUTH_INFO ) );
-
-					new_context->header_info.digest_info->algorithm = context->header_info.digest_info->algorithm;
-					new_context->header_info.digest_info->auth_type = context->header_info.digest_info->auth_type;
-					new_context->header_info.digest_info->qop_type = context->header_info.digest_info->qop_type;
-
-					new_context->header_info.digest_info->domain = GlobalStrDupA( context->header_info.digest_info->domain );
-					new_context->header_info.digest_info->nonce = GlobalStrDupA( context->header_info.digest_info->nonce );
-					new_context->header_info.digest_info->opaque = GlobalStrDupA( context->header_info.digest_info->opaque );
-					new_context->header_info.digest_info->qop = GlobalStrDupA( context->header_info.digest_info->qop );
-					new_context->header_info.digest_info->realm = GlobalStrDupA( context->header_info.digest_info->realm );
-				}
-
-				if ( context->header_info.proxy_digest_info != NULL )
-				{
-					new_context->header_info.proxy_digest_info = ( AUTH_INFO * )GlobalAlloc( GPTR, sizeof( AUTH_INFO ) );
-
-					new_context->header_info.proxy_digest_info->algorithm = context->header_info.proxy_digest_info->algorithm;
-					new_context->header_info.proxy_digest_info->auth_type = context->header_info.proxy_digest_info->auth_type;
-					new_context->header_info.proxy_digest_info->qop_type = context->header_info.proxy_digest_info->qop_type;
-
-					new_context->header_info.proxy_digest_info->domain = GlobalStrDupA( context->header_info.proxy_digest_info->domain );
-					new_context->header_info.proxy_digest_info->nonce = GlobalStrDupA( context->header_info.proxy_digest_info->nonce );
-					new_context->header_info.proxy_digest_info->opaque = GlobalStrDupA( context->header_info.proxy_digest_info->opaque );
-					new_context->header_info.proxy_digest_info->qop = GlobalStrDupA( context->header_info.proxy_digest_info->qop );
-					new_context->header_info.proxy_digest_info->realm = GlobalStrDupA( context->header_info.proxy_digest_info->realm );
-				}
 
 				RANGE_INFO *ri = ( RANGE_INFO * )GlobalAlloc( GPTR, sizeof( RANGE_INFO ) );
 
@@ -3634,8 +3884,13 @@ char MakeRangeRequest( SOCKET_CONTEXT *context )
 					++( new_context->download_info->active_parts );
 
 					DoublyLinkedList *range_node = DLL_CreateNode( ( void * )ri );
+
+					EnterCriticalSection( &range_list_cs );
+
 					DLL_AddNode( &new_context->download_info->range_list, range_node, -1 );
 
+					LeaveCriticalSection( &range_list_cs );
+
 					new_context->parts_node.data = new_context;
 					DLL_AddNode( &new_context->download_info->parts_list, &new_context->parts_node, -1 );
 
@@ -3682,7 +3937,7 @@ char MakeRequest( SOCKET_CONTEXT *context, IO_OPERATION next_operation, bool use
 			context->header_info.content_encoding = CONTENT_ENCODING_NONE;
 			context->header_info.chunked_transfer = false;
 			//context->header_info.etag = false;
-			context->header_info.got_chunk_start = false;
+			context->header_info.chunk_state = CHUNK_STATE_SIZE_START;
 			context->header_info.got_chunk_terminator = false;
 
 			context->header_info.range_info->content_length = 0;	// We must reset this to get the real request length (not the length of the 401/407 request).
@@ -4011,7 +4266,8 @@ char AllocateFile( SOCKET_CONTEXT *context )
 				if ( GetFileAttributesW( file_path ) != INVALID_FILE_ATTRIBUTES && context->download_info->downloaded > 0 )
 				{
 					// If the file has downloaded data (we're resuming), then open it, otherwise truncate its size to 0.
-					context->download_info->hFile = CreateFile( file_path, GENERIC_WRITE | FILE_WRITE_ATTRIBUTES | DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL );
+					// Read access is needed for the parts to map the file. See MapFileData().
+					context->download_info->hFile = CreateFile( file_path, GENERIC_READ | GENERIC_WRITE | FILE_WRITE_ATTRIBUTES | DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL );
 
 					if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
 					{
@@ -4036,7 +4292,7 @@ char AllocateFile( SOCKET_CONTEXT *context )
 				}
 				else	// Pre-allocate our file on the disk if it does not exist, or if we're overwriting one that already exists.
 				{
-					context->download_info->hFile = CreateFile( file_path, GENERIC_WRITE | FILE_WRITE_ATTRIBUTES | DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL );
+					context->download_info->hFile = CreateFile( file_path, GENERIC_READ | GENERIC_WRITE | FILE_WRITE_ATTRIBUTES | DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL );
 
 					if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
 					{
@@ -4045,6 +4301,11 @@ char AllocateFile( SOCKET_CONTEXT *context )
 							SetFileTime( context->download_info->hFile, &context->header_info.last_modified, &context->header_info.last_modified, &context->header_info.last_modified );
 						}
 
+						bool quick_allocation = ( cfg_enable_quick_allocation && g_can_fast_allocate );
+
+						// If we can't set the valid data length, then a sparse file lets each part write into its range without waiting for the file to be zeroed.
+						bool sparse_allocation = ( !quick_allocation && SetSparseFile( context->download_info->hFile ) );
+
 						g_hIOCP = CreateIoCompletionPort( context->download_info->hFile, g_hIOCP, 0, 0 );
 						if ( g_hIOCP != NULL )
 						{
@@ -4056,7 +4317,7 @@ char AllocateFile( SOCKET_CONTEXT *context )
 							SetFilePointerEx( context->download_info->hFile, li, NULL, FILE_BEGIN );
 							SetEndOfFile( context->download_info->hFile );
 
-							if ( cfg_enable_quick_allocation && g_can_fast_allocate )	// Fast disk allocation if we're an administrator.
+							if ( quick_allocation )	// Fast disk allocation if we're an administrator.
 							{
 								if ( SetFileValidData( context->download_info->hFile, li.QuadPart ) == FALSE )
 								{
@@ -4070,6 +4331,16 @@ char AllocateFile( SOCKET_CONTEXT *context )
 									file_status = 2;	// Start writing to the file immediately.
 								}
 							}
+							else if ( sparse_allocation )
+							{
+								file_status = 2;	// Start writing to the file immediately. Space is allocated as each range is written.
+							}
+							else if ( context->download_info->parts == 1 && !cfg_adaptive_download_parts )
+							{
+								// A single part writes the file in order, so the file system never has to zero the space ahead of it.
+								// Adaptive parts are set up after the file is allocated, and a part that's added would write ahead of the first one.
+								file_status = 2;
+							}
 							else	// Trigger the system to allocate the file on disk. Sloooow.
 							{
 								file_status = 1;
@@ -4340,6 +4611,55 @@ char HandleLastModifiedPrompt( SOCKET_CONTEXT *context )
 	return content_status;
 }
 
+// Copies the slices that reference the receive buffer into the chunk buffer.
+bool GatherChunkSlices( SOCKET_CONTEXT *context, WSABUF *slices, unsigned int &slice_count )
+{
+	if ( slice_count > 0 && context->write_wsabuf.buf == NULL )
+	{
+		return false;
+	}
+
+	for ( unsigned int i = 0; i < slice_count; ++i )
+	{
+		_memcpy_s( context->write_wsabuf.buf + context->write_wsabuf.len, context->buffer_size - context->write_wsabuf.len, slices[ i ].buf, slices[ i ].len );
+		context->write_wsabuf.len += slices[ i ].len;
+	}
+
+	slice_count = 0;
+
+	return true;
+}
+
+// Decoded chunk data is referenced in place unless the slice list is full, or the chunk buffer is already in use.
+// Returns false if the data needs to be copied and there's no chunk buffer.
+bool AddChunkSlice( SOCKET_CONTEXT *context, WSABUF *slices, unsigned int &slice_count, char *buffer, unsigned int buffer_length )
+{
+	if ( buffer_length == 0 )
+	{
+		return true;
+	}
+
+	if ( slice_count >= CHUNK_SLICE_COUNT || context->write_wsabuf.len > 0 )
+	{
+		// Keep the data in order.
+		if ( context->write_wsabuf.buf == NULL || !GatherChunkSlices( context, slices, slice_count ) )
+		{
+			return false;
+		}
+
+		_memcpy_s( context->write_wsabuf.buf + context->write_wsabuf.len, context->buffer_size - context->write_wsabuf.len, buffer, buffer_length );
+		context->write_wsabuf.len += buffer_length;
+	}
+	else
+	{
+		slices[ slice_count ].buf = buffer;
+		slices[ slice_count ].len = buffer_length;
+		++slice_count;
+	}
+
+	return true;
+}
+
 char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsigned int response_buffer_length )
 {
 	if ( context == NULL )
@@ -4424,7 +4744,8 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 		}
 	}
 
-	if ( response_buffer_length == 0 )
+	// Decoded output can be left in the window after ResumeDecompression() drains the decoder.
+	if ( response_buffer_length == 0 && context->decompressed_length == 0 )
 	{
 		return CONTENT_STATUS_READ_MORE_CONTENT;	// Need more content data.
 	}
@@ -4432,217 +4753,326 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 	// Now we need to decode the buffer in case it was a chunked transfer. Boo!!!
 	if ( context->header_info.chunked_transfer )
 	{
-		if ( context->download_info != NULL && !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
+		bool simulate = ( context->download_info != NULL && ( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) );
+		bool decompress = CanDecompressStream( context->header_info.content_encoding );
+
+		// Identity encoded slices are gathered into the chunk buffer. Compressed data is written from the decompression window.
+		if ( context->download_info != NULL && !simulate && !decompress )
 		{
 			if ( context->header_info.chunk_buffer == NULL )
 			{
 				context->header_info.chunk_buffer = ( char * )GlobalAlloc( GMEM_FIXED, sizeof( char ) * context->buffer_size );
+				if ( context->header_info.chunk_buffer == NULL )
+				{
+					return CONTENT_STATUS_FAILED;
+				}
 			}
 		}
 
 		context->write_wsabuf.buf = context->header_info.chunk_buffer;
 		context->write_wsabuf.len = 0;
 
-		content_status = CONTENT_STATUS_READ_MORE_CONTENT;
+		// Identity encoded chunk data is referenced where it sits in the receive buffer.
+		WSABUF slices[ CHUNK_SLICE_COUNT ];
+		unsigned int slice_count = 0;
 
-		// Offset past the chunk terminating token.
-		if ( response_buffer_length >= 2 && response_buffer[ 0 ] == '\r' && response_buffer[ 1 ] == '\n' )
-		{
-			response_buffer_length -= 2;
-			response_buffer += 2;
+		// Compressed data is decoded into the window, and we stop once it fills up. Draining the decoder in ResumeDecompression() can fill it on its own.
+		bool window_full = ( decompress && context->decompressed_buf != NULL && context->decompressed_length >= context->decompressed_buf_size );
 
-			context->header_info.got_chunk_start = false;
-		}
+		content_status = CONTENT_STATUS_READ_MORE_CONTENT;
+
+		char *response_buffer_end = response_buffer + response_buffer_length;
 
-		while ( response_buffer_length > 0 )
+		// The decoder's state is kept between reads so the framing can be split anywhere.
+		while ( response_buffer < response_buffer_end &&
+				content_status == CONTENT_STATUS_READ_MORE_CONTENT &&
+				context->header_info.chunk_state != CHUNK_STATE_DONE &&
+				!window_full )
 		{
-			if ( !context->header_info.got_chunk_start )
+			switch ( context->header_info.chunk_state )
 			{
-				// End of chunk value.
-				char *end_chunk = _StrStrA( response_buffer, "\r\n" );
-				if ( end_chunk == NULL )
+				case CHUNK_STATE_SIZE_START:
+				case CHUNK_STATE_SIZE:
 				{
-					if ( response_buffer > context->buffer )
+					char c = *response_buffer;
+					unsigned char digit = 0xFF;
+
+					if ( c >= '0' && c <= '9' )
+					{
+						digit = c - '0';
+					}
+					else if ( ( c | 0x20 ) >= 'a' && ( c | 0x20 ) <= 'f' )
 					{
-						_memmove( context->buffer, response_buffer, response_buffer_length );
+						digit = ( c | 0x20 ) - 'a' + 10;
+					}
+
+					if ( digit != 0xFF )
+					{
+						// The value won't fit.
+						if ( context->header_info.chunk_length > 0x0FFFFFFFFFFFFFFF )
+						{
+							content_status = CONTENT_STATUS_FAILED;
+							break;
+						}
 
-						context->wsabuf.buf += response_buffer_length;
-						context->wsabuf.len -= response_buffer_length;
+						context->header_info.chunk_length = ( context->header_info.chunk_length << 4 ) | digit;
 
-						content_status = CONTENT_STATUS_READ_MORE_CONTENT;	// Read more content data.
-						break;
+						context->header_info.chunk_state = CHUNK_STATE_SIZE;
 					}
-					else	// Buffer is too small.
+					else if ( context->header_info.chunk_state == CHUNK_STATE_SIZE_START )
+					{
+						// Skip whitespace that might appear before the value.
+						if ( c != ' ' && c != '\t' )
+						{
+							content_status = CONTENT_STATUS_FAILED;
+							break;
+						}
+					}
+					else if ( c == ';' || c == ' ' || c == '\t' )
+					{
+						context->header_info.chunk_state = CHUNK_STATE_EXTENSION;
+					}
+					else if ( c == '\r' )
+					{
+						context->header_info.chunk_state = CHUNK_STATE_SIZE_LF;
+					}
+					else	// Bad chunk value. Can't continue.
 					{
 						content_status = CONTENT_STATUS_FAILED;
 						break;
 					}
-				}
 
-				// Get the chunk value (including any extensions).
-				char chunk[ 32 ];
-				_memzero( chunk, 32 );
-				_memcpy_s( chunk, 32, response_buffer, ( ( end_chunk - response_buffer ) > 32 ? 32 : ( end_chunk - response_buffer ) ) );
-				chunk[ 31 ] = 0; // Sanity
-
-				// Find any chunked extension and ignore it.
-				char *find_extension = _StrChrA( chunk, ';' );
-				if ( find_extension != NULL )
-				{
-					*find_extension = NULL;
+					++response_buffer;
 				}
+				break;
 
-				end_chunk += 2;
-
-				// Convert the hexidecimal chunk value into an integer. Stupid...
-				context->header_info.chunk_length = strtoull( chunk, true );
-
-				if ( context->header_info.chunk_length == 0 )
+				case CHUNK_STATE_EXTENSION:	// Ignore any chunked extension.
 				{
-					// Make sure the chunk terminator looks like "0\r\n\r\n" before we exit. We need to flush all the data if it's not complete.
-					if ( ( response_buffer_length - ( end_chunk - response_buffer ) ) < 2 )
+					char *end_extension = BS_FindChar( response_buffer, ( unsigned int )( response_buffer_end - response_buffer ), '\r' );
+					if ( end_extension != NULL )
 					{
-						_memmove( context->buffer, response_buffer, response_buffer_length );
-
-						context->wsabuf.buf = context->buffer + response_buffer_length;
-						context->wsabuf.len = context->buffer_size - response_buffer_length;
+						response_buffer = end_extension + 1;
 
-						content_status = CONTENT_STATUS_READ_MORE_CONTENT;	// Read more content data.
-						break;
+						context->header_info.chunk_state = CHUNK_STATE_SIZE_LF;
 					}
 					else
 					{
-						context->header_info.got_chunk_terminator = true;
+						response_buffer = response_buffer_end;
+					}
+				}
+				break;
 
-						content_status = ( !context->processed_header ? CONTENT_STATUS_HANDLE_RESPONSE : CONTENT_STATUS_READ_MORE_CONTENT );	// We're done reading the chunked transfer stream.
+				case CHUNK_STATE_SIZE_LF:
+				{
+					if ( *response_buffer != '\n' )
+					{
+						content_status = CONTENT_STATUS_FAILED;
 						break;
 					}
-				}
 
-				response_buffer_length -= ( unsigned int )( end_chunk - response_buffer );
-				response_buffer = end_chunk;
+					++response_buffer;
 
-				context->header_info.got_chunk_start = true;
-			}
-			
-			if ( context->header_info.chunk_length > response_buffer_length )	// The chunk is too large, dump our response buffer.
-			{
-				char *output_buffer = response_buffer;
-				unsigned int output_buffer_length = response_buffer_length;
+					// A 0 length chunk is the last chunk.
+					context->header_info.chunk_state = ( context->header_info.chunk_length > 0 ? CHUNK_STATE_DATA : CHUNK_STATE_TRAILER );
+				}
+				break;
 
-				if ( zlib1_state == ZLIB1_STATE_RUNNING )
+				case CHUNK_STATE_DATA:
 				{
-					if ( context->header_info.content_encoding == CONTENT_ENCODING_GZIP || context->header_info.content_encoding == CONTENT_ENCODING_DEFLATE )
+					unsigned int data_length = ( unsigned int )( response_buffer_end - response_buffer );
+					if ( context->header_info.chunk_length < data_length )
 					{
-						unsigned int total_data_length = DecompressStream( context, output_buffer, output_buffer_length );
+						data_length = ( unsigned int )context->header_info.chunk_length;
+					}
+
+					if ( decompress )
+					{
+						unsigned int decoded_length = DecompressStream( context, response_buffer, data_length );
 
-						if ( context->decompressed_buf != NULL )
+						if ( context->decompressed_buf == NULL )
 						{
-							output_buffer = context->decompressed_buf;
-							output_buffer_length = total_data_length;
+							content_status = CONTENT_STATUS_FAILED;
+							break;
 						}
-					}
-				}
 
-				context->content_offset += response_buffer_length;	// The remainder length of our response. The true amount that was downloaded. Allows us to resume if we stop the download.
-				//context->header_info.range_info->content_offset += response_buffer_length;	// The remainder length of our response. The true amount that was downloaded. Allows us to resume if we stop the download.
-				context->header_info.chunk_length -= response_buffer_length;				// Exclude the remainder length from the content length.
+						// The output stays in the window until it's written below. Whatever didn't fit is decoded once the window has been written.
+						if ( context->decompressed_length >= context->decompressed_buf_size )
+						{
+							data_length = decoded_length;
 
-				if ( context->download_info != NULL )
-				{
-					if ( !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
+							window_full = true;
+						}
+					}
+					else if ( context->download_info != NULL )
 					{
-						_memcpy_s( context->write_wsabuf.buf + context->write_wsabuf.len, context->buffer_size - context->write_wsabuf.len, output_buffer, output_buffer_length );
+						if ( simulate )
+						{
+							context->write_wsabuf.len += data_length;
+						}
+						else if ( !AddChunkSlice( context, slices, slice_count, response_buffer, data_length ) )
+						{
+							content_status = CONTENT_STATUS_FAILED;
+							break;
+						}
 					}
 
-					context->write_wsabuf.len += output_buffer_length;
-				}
+					context->content_offset += data_length;	// The true amount that was downloaded. Allows us to resume if we stop the download.
+					//context->header_info.range_info->content_offset += data_length;	// The true amount that was downloaded. Allows us to resume if we stop the download.
+					context->header_info.chunk_length -= data_length;
 
-				content_status = CONTENT_STATUS_READ_MORE_CONTENT;
-				break;
-			}
-			else	// We have a complete chunk(s) in our response buffer.
-			{
-				char *output_buffer = response_buffer;
-				unsigned int output_buffer_length = ( unsigned int )context->header_info.chunk_length;
+					response_buffer += data_length;
 
-				if ( zlib1_state == ZLIB1_STATE_RUNNING )
-				{
-					if ( context->header_info.content_encoding == CONTENT_ENCODING_GZIP || context->header_info.content_encoding == CONTENT_ENCODING_DEFLATE )
+					if ( context->header_info.chunk_length == 0 )
 					{
-						unsigned int total_data_length = DecompressStream( context, output_buffer, output_buffer_length );
-
-						if ( context->decompressed_buf != NULL )
-						{
-							output_buffer = context->decompressed_buf;
-							output_buffer_length = total_data_length;
-						}
+						context->header_info.chunk_state = CHUNK_STATE_DATA_CR;
 					}
 				}
+				break;
 
-				context->content_offset += context->header_info.chunk_length;	// The true amount that was downloaded. Allows us to resume if we stop the download.
-				//context->header_info.range_info->content_offset += context->header_info.chunk_length;	// The true amount that was downloaded. Allows us to resume if we stop the download.
+				case CHUNK_STATE_DATA_CR:
+				case CHUNK_STATE_DATA_LF:
+				{
+					// Bad terminator. Can't continue.
+					if ( *response_buffer != ( context->header_info.chunk_state == CHUNK_STATE_DATA_CR ? '\r' : '\n' ) )
+					{
+						content_status = CONTENT_STATUS_FAILED;
+						break;
+					}
 
-				response_buffer_length -= ( unsigned int )context->header_info.chunk_length;
-				response_buffer += ( unsigned int )context->header_info.chunk_length;
+					++response_buffer;
 
-				context->header_info.chunk_length = 0;	// Reset the length of the new chunk.
+					// Get the new chunk length once we're past the terminator.
+					context->header_info.chunk_state = ( context->header_info.chunk_state == CHUNK_STATE_DATA_CR ? CHUNK_STATE_DATA_LF : CHUNK_STATE_SIZE_START );
+				}
+				break;
 
-				if ( context->download_info != NULL )
+				case CHUNK_STATE_TRAILER:
 				{
-					if ( !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
+					// A blank line ends the chunked transfer. Anything else is a trailer field that we ignore.
+					if ( *response_buffer == '\r' )
 					{
-						_memcpy_s( context->write_wsabuf.buf + context->write_wsabuf.len, context->buffer_size - context->write_wsabuf.len, output_buffer, output_buffer_length );
-					}
+						++response_buffer;
 
-					context->write_wsabuf.len += output_buffer_length;
+						context->header_info.chunk_state = CHUNK_STATE_TRAILER_LF;
+					}
+					else
+					{
+						context->header_info.chunk_state = CHUNK_STATE_TRAILER_FIELD;
+					}
 				}
+				break;
 
-				// See if we have more chunks.
-				if ( response_buffer_length >=2 )
+				case CHUNK_STATE_TRAILER_FIELD:
 				{
-					// Move to the next chunk.
-					if ( response_buffer[ 0 ] == '\r' && response_buffer[ 1 ] == '\n' )
+					char *end_field = BS_FindChar( response_buffer, ( unsigned int )( response_buffer_end - response_buffer ), '\n' );
+					if ( end_field != NULL )
 					{
-						response_buffer_length -= 2;
-						response_buffer += 2;
+						response_buffer = end_field + 1;
 
-						context->header_info.got_chunk_start = false;	// Get the new chunk length.
-
-						content_status = CONTENT_STATUS_READ_MORE_CONTENT;
+						context->header_info.chunk_state = CHUNK_STATE_TRAILER;
 					}
-					else	// Bad terminator. Can't continue.
+					else
 					{
-						content_status = CONTENT_STATUS_FAILED;
-						break;
+						response_buffer = response_buffer_end;
 					}
 				}
-				else	// Incomplete chunk terminator. Request more data to complete the chunk.
+				break;
+
+				case CHUNK_STATE_TRAILER_LF:
 				{
-					if ( response_buffer_length >= 1 )
+					if ( *response_buffer != '\n' )
 					{
-						_memmove( context->buffer, response_buffer, response_buffer_length );
-
-						context->wsabuf.buf += response_buffer_length;
-						context->wsabuf.len -= response_buffer_length;
+						content_status = CONTENT_STATUS_FAILED;
+						break;
 					}
 
-					content_status = CONTENT_STATUS_READ_MORE_CONTENT;
-					break;
+					++response_buffer;
+
+					context->header_info.chunk_state = CHUNK_STATE_DONE;
+
+					context->header_info.got_chunk_terminator = true;
+
+					content_status = ( !context->processed_header ? CONTENT_STATUS_HANDLE_RESPONSE : CONTENT_STATUS_READ_MORE_CONTENT );	// We're done reading the chunked transfer stream.
 				}
+				break;
 			}
 		}
 
-		// The response buffer length is 0. We need more content.
+		// Everything that was received has been decoded, unless the window filled up. What's left is decoded after the window is written. Nothing is carried over to the next read.
 
-		if ( context->write_wsabuf.len > 0 )
+		// The decoded output is written (or counted) straight from the window.
+		if ( decompress && context->decompressed_buf != NULL )
 		{
 			if ( context->download_info != NULL )
 			{
-				if ( !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
+				if ( simulate )
 				{
-					if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
+					context->write_wsabuf.len += context->decompressed_length;
+				}
+				else
+				{
+					context->write_wsabuf.buf = context->decompressed_buf;
+					context->write_wsabuf.len = context->decompressed_length;
+				}
+			}
+
+			context->decompressed_length = 0;
+		}
+
+		WSABUF *buffers = slices;
+		unsigned int buffer_count = slice_count;
+		unsigned int buffers_length = 0;
+
+		// The decoded data was copied into the chunk buffer.
+		if ( slice_count == 0 && context->write_wsabuf.len > 0 )
+		{
+			buffers = &context->write_wsabuf;
+			buffer_count = 1;
+		}
+
+		for ( unsigned int i = 0; i < buffer_count; ++i )
+		{
+			buffers_length += buffers[ i ].len;
+		}
+
+		if ( buffers_length > 0 )
+		{
+			if ( context->download_info != NULL )
+			{
+				if ( !simulate )
+				{
+					// Coalesce the decoded chunks into larger blocks once our range requests have been made.
+					if ( context->processed_header && context->header_info.content_encoding == CONTENT_ENCODING_NONE && context->download_info->hFile != INVALID_HANDLE_VALUE )
 					{
+						bool flush = ( context->header_info.got_chunk_terminator ||
+									 ( context->parts > 1 && ( ( GetBufferedContentOffset( context ) + buffers_length ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) );
+
+						context->content_offset = 0;	// The decoded length is the amount that was downloaded. BufferFileSlices() accounts for it.
+
+						content_status = BufferFileSlices( context, buffers, buffer_count, flush, content_status );
+
+						if ( content_status == CONTENT_STATUS_NONE || content_status == CONTENT_STATUS_FAILED )
+						{
+							return content_status;
+						}
+					}
+					else if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
+					{
+						// The write needs a single buffer. A lone slice is written from the receive buffer since it won't be reused until the write completes.
+						if ( slice_count > 1 )
+						{
+							if ( !GatherChunkSlices( context, slices, slice_count ) )
+							{
+								return CONTENT_STATUS_FAILED;
+							}
+						}
+						else if ( slice_count == 1 )
+						{
+							context->write_wsabuf.buf = slices[ 0 ].buf;
+							context->write_wsabuf.len = slices[ 0 ].len;
+						}
+
+
 						LARGE_INTEGER li;
 						li.QuadPart = context->header_info.range_info->file_write_offset;//context->header_info.range_info->range_start + context->header_info.range_info->write_length;
 
@@ -4661,7 +5091,18 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 
 //						context->overlapped.context = context;
 
-						context->content_status = content_status;	// Causes IO_WriteFile to call HandleResponse().
+						// IO_WriteFile decodes the rest of what we received once the full window has been written.
+						if ( window_full )
+						{
+							context->decode_wsabuf.buf = response_buffer;
+							context->decode_wsabuf.len = ( unsigned int )( response_buffer_end - response_buffer );
+
+							context->content_status = CONTENT_STATUS_DECODE_CONTENT;
+						}
+						else
+						{
+							context->content_status = content_status;	// Causes IO_WriteFile to call HandleResponse().
+						}
 
 						content_status = CONTENT_STATUS_NONE;	// Exits IO_GetContent.
 
@@ -4698,11 +5139,17 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 				else	// Simulated download.
 				{
 					EnterCriticalSection( &context->download_info->shared_cs );
-					context->download_info->downloaded += context->write_wsabuf.len;			// The total amount of data (decoded) that was saved/simulated.
+					AddDownloadProgress( context->download_info, buffers_length );	// The total amount of data (decoded) that was saved/simulated.
+					bool add_part = UpdateAdaptiveParts( context );
 					LeaveCriticalSection( &context->download_info->shared_cs );
 
+					if ( add_part )
+					{
+						AddAdaptivePart( context );
+					}
+
 					EnterCriticalSection( &session_totals_cs );
-					g_session_total_downloaded += context->write_wsabuf.len;
+					g_session_total_downloaded += buffers_length;
 					LeaveCriticalSection( &session_totals_cs );
 
 					context->header_info.range_info->content_offset += context->content_offset;	// The true amount that was downloaded. Allows us to resume if we stop the download.
@@ -4716,7 +5163,7 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 		}
 
 		if ( ( context->parts == 1 && context->header_info.connection == CONNECTION_KEEP_ALIVE && context->header_info.got_chunk_terminator ) ||
-			 ( context->parts > 1 && ( context->header_info.range_info->content_offset >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
+			 ( context->parts > 1 && ( GetBufferedContentOffset( context ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
 		{
 			return CONTENT_STATUS_FAILED;	// We have no more data, so just close the connection.
 		}
@@ -4730,34 +5177,67 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 		char *output_buffer = response_buffer;
 		unsigned int output_buffer_length = response_buffer_length;
 
+		bool window_full = false;
+
 		// Write buffer to file.
 
 		if ( context->download_info != NULL )
 		{
-			if ( zlib1_state == ZLIB1_STATE_RUNNING )
+			if ( CanDecompressStream( context->header_info.content_encoding ) )
 			{
-				if ( context->header_info.content_encoding == CONTENT_ENCODING_GZIP || context->header_info.content_encoding == CONTENT_ENCODING_DEFLATE )
+				unsigned int decoded_length = DecompressStream( context, output_buffer, output_buffer_length );
+
+				if ( context->decompressed_buf != NULL )
 				{
-					unsigned int total_data_length = DecompressStream( context, output_buffer, output_buffer_length );
+					output_buffer = context->decompressed_buf;
+					output_buffer_length = context->decompressed_length;
+
+					context->decompressed_length = 0;	// The window is handed to the write below.
 
-					if ( context->decompressed_buf != NULL )
+					// Whatever didn't fit is decoded once the window has been written.
+					// Only what was decoded counts as downloaded until then.
+					if ( output_buffer_length >= context->decompressed_buf_size )
 					{
-						output_buffer = context->decompressed_buf;
-						output_buffer_length = total_data_length;
+						context->decode_wsabuf.buf = response_buffer + decoded_length;
+						context->decode_wsabuf.len = response_buffer_length - decoded_length;
+
+						response_buffer_length = decoded_length;
+
+						window_full = true;
 					}
 				}
 			}
 
 			// Make sure the server isn't feeding us more data than they claim.
 			if ( context->header_info.range_info->content_length > 0 &&
-			   ( ( ( context->header_info.range_info->file_write_offset - context->header_info.range_info->range_start ) + output_buffer_length ) > ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) )
+			   ( ( ( GetBufferedFileOffset( context ) - context->header_info.range_info->range_start ) + output_buffer_length ) > ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) )
 			{
-				output_buffer_length -= ( unsigned int )( ( ( context->header_info.range_info->file_write_offset - context->header_info.range_info->range_start ) + output_buffer_length ) - ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) );
+				output_buffer_length -= ( unsigned int )( ( ( GetBufferedFileOffset( context ) - context->header_info.range_info->range_start ) + output_buffer_length ) - ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) );
 			}
 
 			if ( !( context->download_info->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
 			{
-				if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
+				// Coalesce the content into larger blocks once our range requests have been made. Compressed content is written as it's decoded.
+				if ( context->processed_header && context->header_info.content_encoding == CONTENT_ENCODING_NONE && context->download_info->hFile != INVALID_HANDLE_VALUE )
+				{
+					bool flush = ( context->header_info.range_info->content_length > 0 &&
+								 ( ( GetBufferedContentOffset( context ) + output_buffer_length ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) );
+
+					content_status = BufferFileData( context, output_buffer, output_buffer_length, flush, CONTENT_STATUS_READ_MORE_CONTENT );
+
+					// We need to force the keep-alive connections closed since the server will just keep it open after we've gotten all the data.
+					// Range requests are also closed since their range might have been shortened by StealRange.
+					if ( content_status == CONTENT_STATUS_READ_MORE_CONTENT &&
+					   ( context->header_info.connection == CONNECTION_KEEP_ALIVE || context->parts > 1 ) &&
+					   ( context->header_info.range_info->content_length == 0 ||
+					   ( GetBufferedContentOffset( context ) >= ( ( context->header_info.range_info->range_end - context->header_info.range_info->range_start ) + 1 ) ) ) )
+					{
+						return CONTENT_STATUS_FAILED;	// We have no more data, so just close the connection.
+					}
+
+					return content_status;
+				}
+				else if ( context->download_info->hFile != INVALID_HANDLE_VALUE )
 				{
 					LARGE_INTEGER li;
 					li.QuadPart = context->header_info.range_info->file_write_offset;//context->header_info.range_info->range_start + context->header_info.range_info->content_offset;
@@ -4780,7 +5260,8 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 
 //					context->overlapped.context = context;
 
-					context->content_status = ( !context->processed_header ? CONTENT_STATUS_HANDLE_RESPONSE : CONTENT_STATUS_READ_MORE_CONTENT );
+					// IO_WriteFile decodes the rest of what we received once the full window has been written.
+					context->content_status = ( window_full ? CONTENT_STATUS_DECODE_CONTENT : ( !context->processed_header ? CONTENT_STATUS_HANDLE_RESPONSE : CONTENT_STATUS_READ_MORE_CONTENT ) );
 
 					content_status = CONTENT_STATUS_NONE;	// Exits IO_GetContent.
 
@@ -4820,9 +5301,15 @@ char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, uns
 			else	// Simulated download. Get the decompressed size of the stream.
 			{
 				EnterCriticalSection( &context->download_info->shared_cs );
-				context->download_info->downloaded += output_buffer_length;					// The total amount of data (decoded) that was saved/simulated.
+				AddDownloadProgress( context->download_info, output_buffer_length );		// The total amount of data (decoded) that was saved/simulated.
+				bool add_part = UpdateAdaptiveParts( context );
 				LeaveCriticalSection( &context->download_info->shared_cs );
 
+				if ( add_part )
+				{
+					AddAdaptivePart( context );
+				}
+
 				EnterCriticalSection( &session_totals_cs );
 				g_session_total_downloaded += output_buffer_length;
 				LeaveCriticalSection( &session_totals_cs );
@@ -20,6 +20,9 @@
 #define _HTTP_PARSING_H
 
 #include "connection.h"
+#include "header_index.h"
+
+#define CHUNK_SLICE_COUNT					32	// The number of decoded chunks that can be written from the receive buffer before they're copied.
 
 struct COOKIE_CONTAINER
 {
@@ -29,7 +32,14 @@ struct COOKIE_CONTAINER
 	int value_length;
 };
 
-char *GetHeaderValue( char *header, char *field_name, unsigned long field_name_length, char **value_start, char **value_end );
+struct DECODER_STATS
+{
+	unsigned long long	input_bytes;	// Encoded bytes that were given to the decoder.
+	unsigned long long	output_bytes;	// Decoded bytes that the decoder produced.
+	unsigned long long	decode_time;	// Microseconds spent decoding.
+	unsigned long		streams;		// The number of responses that were decoded.
+};
+
 bool ParseURL_A( char *url, char *original_resource,
 				 PROTOCOL &protocol, char **host, unsigned int &host_length, unsigned short &port, char **resource, unsigned int &resource_length,
 				 char **username, unsigned int *username_length, char **password, unsigned int *password_length );
@@ -39,15 +49,19 @@ bool ParseURL_W( wchar_t *url, wchar_t *original_resource,
 bool ParseCookieValues( char *cookie_list, dllrbt_tree **cookie_tree, char **cookies );
 
 unsigned short GetHTTPStatus( char *header );
-void GetAuthorization( char *header, AUTH_INFO *auth_info );
-void GetAuthenticate( char *header, unsigned char auth_header_type, AUTH_INFO *auth_info );
-bool GetTransferEncoding( char *header );
-unsigned long long GetContentLength( char *header );
-void GetContentRange( char *header, RANGE_INFO *range_info );
-void GetLocation( char *header, URL_LOCATION *url_location );
-unsigned char GetConnection( char *header );
-unsigned char GetContentEncoding( char *header );
-char *GetContentDisposition( char *header, unsigned int &filename_length );
+void GetAuthorization( HEADER_INDEX *header_index, AUTH_INFO *auth_info );
+void GetAuthenticate( HEADER_INDEX *header_index, unsigned char auth_header_type, AUTH_INFO *auth_info );
+bool GetTransferEncoding( HEADER_INDEX *header_index );
+unsigned long long GetContentLength( HEADER_INDEX *header_index );
+void GetContentRange( HEADER_INDEX *header_index, RANGE_INFO *range_info );
+void GetLocation( HEADER_INDEX *header_index, char *resource, URL_LOCATION *url_location );
+unsigned char GetConnection( HEADER_INDEX *header_index );
+unsigned char GetContentEncoding( HEADER_INDEX *header_index );
+char *GetContentDisposition( HEADER_INDEX *header_index, unsigned int &filename_length );
+
+bool CanDecompressStream( unsigned char content_encoding );
+void FreeDecompressionState( SOCKET_CONTEXT *context );
+bool GetDecoderStats( unsigned char content_encoding, DECODER_STATS *stats );
 //char *GetETag( char *header );
 
 dllrbt_tree *CopyCookieTree( dllrbt_tree *cookie_tree );
@@ -55,11 +69,13 @@ dllrbt_tree *CopyCookieTree( dllrbt_tree *cookie_tree );
 char ParseHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int header_buffer_length, bool request = false );
 char GetHTTPHeader( SOCKET_CONTEXT *context, char *header_buffer, unsigned int header_buffer_length );
 char GetHTTPResponseContent( SOCKET_CONTEXT *context, char *response_buffer, unsigned int response_buffer_length );
+char ResumeDecompression( SOCKET_CONTEXT *context );
 char GetHTTPRequestContent( SOCKET_CONTEXT *context, char *request_buffer, unsigned int request_buffer_length );
 
 char MakeResponse( SOCKET_CONTEXT *context );
 char MakeRequest( SOCKET_CONTEXT *context, IO_OPERATION next_operation, bool use_connect );
 char MakeRangeRequest( SOCKET_CONTEXT *context );
+SOCKET_CONTEXT *CreatePartContext( SOCKET_CONTEXT *context );
 char HandleRedirect( SOCKET_CONTEXT *context );
 
 char AllocateFile( SOCKET_CONTEXT *context );
@@ -22,6 +22,7 @@
 #include "lite_pcre2.h"
 
 #include "connection.h"
+#include "download_model.h"
 
 #include "doublylinkedlist.h"
 
@@ -52,6 +53,76 @@ void ProcessingList( bool processing )
 	}
 }
 
+// Sets the listview's item count to the number of items in the download model.
+// Items that were only added at the end don't need the rest of the list to be redrawn.
+void UpdateDownloadListCount( bool invalidate )
+{
+	_SendMessageW( g_hWnd_files, LVM_SETITEMCOUNT, DM_GetItemCount(), LVSICF_NOSCROLL | ( invalidate ? 0 : LVSICF_NOINVALIDATEALL ) );
+}
+
+// Sorts the download model and moves the listview's selection and focus to wherever their items ended up.
+void SortDownloadList( SORT_INFO *si )
+{
+	int item_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
+	int sel_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETSELECTEDCOUNT, 0, 0 );
+	int focused_index = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED );
+
+	int *index_array = NULL;
+
+	// Nothing needs to move if every item is selected.
+	if ( sel_count > 0 && sel_count < item_count )
+	{
+		index_array = ( int * )GlobalAlloc( GMEM_FIXED, sizeof( int ) * sel_count );
+		if ( index_array != NULL )
+		{
+			int index = -1;	// Set this to -1 so that the LVM_GETNEXTITEM call can go through the list correctly.
+
+			for ( int i = 0; i < sel_count; ++i )
+			{
+				index = index_array[ i ] = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, index, LVNI_SELECTED );
+			}
+		}
+	}
+
+	unsigned int model_count = 0;
+	int *index_map = DM_SortItems( DMCompareFunc, ( LPARAM )si, model_count );
+	if ( index_map != NULL )
+	{
+		LVITEM lvi;
+		_memzero( &lvi, sizeof( LVITEM ) );
+
+		if ( index_array != NULL )
+		{
+			lvi.stateMask = LVIS_SELECTED;
+			lvi.state = 0;
+			_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, -1, ( LPARAM )&lvi );
+
+			lvi.state = LVIS_SELECTED;
+
+			for ( int i = 0; i < sel_count; ++i )
+			{
+				if ( index_array[ i ] >= 0 && ( unsigned int )index_array[ i ] < model_count )
+				{
+					_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, index_map[ index_array[ i ] ], ( LPARAM )&lvi );
+				}
+			}
+		}
+
+		if ( focused_index >= 0 && ( unsigned int )focused_index < model_count )
+		{
+			lvi.stateMask = LVIS_FOCUSED;
+			lvi.state = LVIS_FOCUSED;
+			_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, index_map[ focused_index ], ( LPARAM )&lvi );
+		}
+
+		GlobalFree( index_map );
+	}
+
+	GlobalFree( index_array );
+
+	_InvalidateRect( g_hWnd_files, NULL, FALSE );
+}
+
 void ResetDownload( DOWNLOAD_INFO *di, bool from_beginning, bool check_if_file_exists )
 {
 	if ( di != NULL )
@@ -73,9 +144,11 @@ void ResetDownload( DOWNLOAD_INFO *di, bool from_beginning, bool check_if_file_e
 
 			di->processed_header = false;
 
-			di->downloaded = 0;
+			SetDownloadProgress( di, 0, di->file_size );
 
 			di->last_modified.QuadPart = 0;
+
+			journal_download_history( di, JOURNAL_RECORD_PROGRESS );
 		}
 
 		// If we manually start a download, then set the incomplete retry attempts back to 0.
@@ -153,7 +226,7 @@ THREAD_RETURN remove_items( void *pArguments )
 
 	in_worker_thread = true;
 
-	// Prevent the listviews from drawing while freeing lParam values.
+	// Prevent the listviews from drawing while freeing the download info values.
 	skip_list_draw = true;
 
 	ProcessingList( true );
@@ -161,14 +234,11 @@ THREAD_RETURN remove_items( void *pArguments )
 	bool delete_success = true;
 	unsigned char error_type = 0;
 
-	LVITEM lvi;
-	_memzero( &lvi, sizeof( LVITEM ) );
-	lvi.mask = LVIF_PARAM;
-
-	int item_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
+	int item_count = ( int )DM_GetItemCount();
 	int sel_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETSELECTEDCOUNT, 0, 0 );
 
 	int *index_array = NULL;
+	DOWNLOAD_INFO **di_array = NULL;
 
 	bool handle_all = false;
 	if ( item_count == sel_count )
@@ -181,14 +251,14 @@ THREAD_RETURN remove_items( void *pArguments )
 
 		index_array = ( int * )GlobalAlloc( GMEM_FIXED, sizeof( int ) * sel_count );
 
-		lvi.iItem = -1;	// Set this to -1 so that the LVM_GETNEXTITEM call can go through the list correctly.
+		int index = -1;	// Set this to -1 so that the LVM_GETNEXTITEM call can go through the list correctly.
 
 		_EnableWindow( g_hWnd_files, FALSE );	// Prevent any interaction with the listview while we're processing.
 
-		// Create an index list of selected items (in reverse order).
+		// Create an index list of selected items.
 		for ( int i = 0; i < sel_count; ++i )
 		{
-			lvi.iItem = index_array[ sel_count - 1 - i ] = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, lvi.iItem, LVNI_SELECTED );
+			index = index_array[ i ] = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, index, LVNI_SELECTED );
 		}
 
 		_EnableWindow( g_hWnd_files, TRUE );	// Allow the listview to be interactive.
@@ -196,40 +266,55 @@ THREAD_RETURN remove_items( void *pArguments )
 		item_count = sel_count;
 	}
 
-	// Go through each item, and free their lParam values.
-	for ( int i = 0; i < item_count; ++i )
+	// Take all of the items out of the model at once and then free them.
+	if ( item_count > 0 )
 	{
-		// Stop processing and exit the thread.
-		if ( kill_worker_thread_flag )
+		di_array = ( DOWNLOAD_INFO ** )GlobalAlloc( GMEM_FIXED, sizeof( DOWNLOAD_INFO * ) * item_count );
+	}
+
+	if ( di_array != NULL )
+	{
+		for ( int i = 0; i < item_count; ++i )
 		{
-			break;
+			di_array[ i ] = DM_GetItem( ( handle_all ? i : index_array[ i ] ) );
 		}
 
 		if ( handle_all )
 		{
-			lvi.iItem = i;
+			DM_RemoveAllItems();
 		}
 		else
 		{
-			lvi.iItem = index_array[ i ];
+			DM_RemoveItems( index_array, sel_count );
 		}
 
-		// Wait, specifically for CleanupConnection to do its thing.
-		EnterCriticalSection( &cleanup_cs );
-
-		_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
+		// The selection belongs to items that are gone.
+		LVITEM lvi;
+		_memzero( &lvi, sizeof( LVITEM ) );
+		lvi.stateMask = LVIS_SELECTED | LVIS_FOCUSED;
+		_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, -1, ( LPARAM )&lvi );
 
-		DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+		UpdateDownloadListCount( true );
+	}
+	else
+	{
+		item_count = 0;
+	}
 
-		if ( !handle_all )
-		{
-			_SendMessageW( g_hWnd_files, LVM_DELETEITEM, index_array[ i ], 0 );
-		}
-		else if ( i >= ( item_count - 1 ) )
+	// Go through each item, and free their values.
+	for ( int i = 0; i < item_count; ++i )
+	{
+		// Stop processing and exit the thread.
+		if ( kill_worker_thread_flag )
 		{
-			_SendMessageW( g_hWnd_files, LVM_DELETEALLITEMS, 0, 0 );
+			break;
 		}
 
+		// Wait, specifically for CleanupConnection to do its thing.
+		EnterCriticalSection( &cleanup_cs );
+
+		DOWNLOAD_INFO *di = di_array[ i ];
+
 		if ( di != NULL )
 		{
 			// Is our update window open and are we removing the item we want to update? Close the window if we are.
@@ -242,6 +327,8 @@ THREAD_RETURN remove_items( void *pArguments )
 
 			_SendMessageW( g_hWnd_main, WM_RESET_PROGRESS, 0, ( LPARAM )di );
 
+			journal_download_history( di, JOURNAL_RECORD_REMOVED );
+
 			EnterCriticalSection( &di->shared_cs );
 
 			DoublyLinkedList *context_node = di->parts_list;
@@ -269,8 +356,11 @@ THREAD_RETURN remove_items( void *pArguments )
 					EnterCriticalSection( &download_queue_cs );
 
 					DLL_RemoveNode( &download_queue, &di->queue_node );
+					di->queue_node.data = NULL;
 
 					LeaveCriticalSection( &download_queue_cs );
+
+					RemoveFilenameIndex( di );
 				}
 
 				LeaveCriticalSection( &di->shared_cs );
@@ -405,7 +495,7 @@ THREAD_RETURN remove_items( void *pArguments )
 		GlobalFree( index_array );
 	}
 
-	download_history_changed = true;
+	GlobalFree( di_array );
 
 	skip_list_draw = false;
 
@@ -527,6 +617,8 @@ THREAD_RETURN handle_download_list( void *pArguments )
 				// Remove the item from the download queue.
 				DLL_RemoveNode( &download_queue, &di->queue_node );
 				di->queue_node.data = NULL;
+
+				RemoveFilenameIndex( di );
 			}
 		}
 
@@ -587,6 +679,8 @@ THREAD_RETURN handle_download_list( void *pArguments )
 							di->queue_node.data = NULL;
 
 							LeaveCriticalSection( &download_queue_cs );
+
+							RemoveFilenameIndex( di );
 						}
 
 						LeaveCriticalSection( &di->shared_cs );
@@ -605,114 +699,134 @@ THREAD_RETURN handle_download_list( void *pArguments )
 	}
 	else if ( handle_type == 2 )	// Remove completed downloads.
 	{
-		// Get the number of items in the listview.
-		int num_items = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
+		// Get the number of items in the model.
+		int num_items = ( int )DM_GetItemCount();
+		int remove_count = 0;
 
-		LVITEM lvi;
-		_memzero( &lvi, sizeof( LVITEM ) );
-		lvi.mask = LVIF_PARAM;
+		int *index_array = NULL;
+		DOWNLOAD_INFO **di_array = NULL;
 
-		_SendMessageW( g_hWnd_files, LVM_ENSUREVISIBLE, 0, FALSE );
+		if ( num_items > 0 )
+		{
+			index_array = ( int * )GlobalAlloc( GMEM_FIXED, sizeof( int ) * num_items );
+			di_array = ( DOWNLOAD_INFO ** )GlobalAlloc( GMEM_FIXED, sizeof( DOWNLOAD_INFO * ) * num_items );
+		}
 
-		// Start from the end and work backwards.
-		for ( lvi.iItem = num_items - 1; lvi.iItem >= 0; --lvi.iItem )
+		if ( index_array != NULL && di_array != NULL )
 		{
-			// Stop processing and exit the thread.
-			if ( kill_worker_thread_flag )
+			_SendMessageW( g_hWnd_files, LVM_ENSUREVISIBLE, 0, FALSE );
+
+			for ( int i = 0; i < num_items; ++i )
 			{
-				break;
-			}
+				DOWNLOAD_INFO *di = DM_GetItem( i );
+				if ( di != NULL )
+				{
+					EnterCriticalSection( &di->shared_cs );
 
-			_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
+					if ( di->status == STATUS_COMPLETED )
+					{
+						index_array[ remove_count ] = i;
+						di_array[ remove_count ] = di;
 
-			DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
-			if ( di != NULL )
+						++remove_count;
+					}
+
+					LeaveCriticalSection( &di->shared_cs );
+				}
+			}
+
+			if ( remove_count > 0 )
 			{
-				bool remove_item = false;
+				DM_RemoveItems( index_array, remove_count );
 
-				EnterCriticalSection( &di->shared_cs );
+				// The remaining items have moved, so the selection no longer applies to them.
+				LVITEM lvi;
+				_memzero( &lvi, sizeof( LVITEM ) );
+				lvi.stateMask = LVIS_SELECTED | LVIS_FOCUSED;
+				_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, -1, ( LPARAM )&lvi );
+
+				UpdateDownloadListCount( true );
+			}
 
-				if ( di->status == STATUS_COMPLETED )
+			for ( int i = 0; i < remove_count; ++i )
+			{
+				// Stop processing and exit the thread.
+				if ( kill_worker_thread_flag )
 				{
-					remove_item = true;
+					break;
 				}
 
-				LeaveCriticalSection( &di->shared_cs );
+				DOWNLOAD_INFO *di = di_array[ i ];
 
-				if ( remove_item )
-				{
-					_SendMessageW( g_hWnd_files, LVM_DELETEITEM, lvi.iItem, 0 );
+				journal_download_history( di, JOURNAL_RECORD_REMOVED );
 
-					EnterCriticalSection( &icon_cache_cs );
-					// Find the icon info
-					dllrbt_iterator *itr = dllrbt_find( g_icon_handles, ( void * )( di->file_path + di->file_extension_offset ), false );
+				EnterCriticalSection( &icon_cache_cs );
+				// Find the icon info
+				dllrbt_iterator *itr = dllrbt_find( g_icon_handles, ( void * )( di->file_path + di->file_extension_offset ), false );
 
-					// Free its values and remove it from the tree if there are no other items using it.
-					if ( itr != NULL )
+				// Free its values and remove it from the tree if there are no other items using it.
+				if ( itr != NULL )
+				{
+					ICON_INFO *ii = ( ICON_INFO * )( ( node_type * )itr )->val;
+					if ( ii != NULL )
 					{
-						ICON_INFO *ii = ( ICON_INFO * )( ( node_type * )itr )->val;
-						if ( ii != NULL )
+						if ( --ii->count == 0 )
 						{
-							if ( --ii->count == 0 )
-							{
-								DestroyIcon( ii->icon );
-								GlobalFree( ii->file_extension );
-								GlobalFree( ii );
+							DestroyIcon( ii->icon );
+							GlobalFree( ii->file_extension );
+							GlobalFree( ii );
 
-								dllrbt_remove( g_icon_handles, itr );
-							}
-						}
-						else
-						{
 							dllrbt_remove( g_icon_handles, itr );
 						}
 					}
-					LeaveCriticalSection( &icon_cache_cs );
-
-					GlobalFree( di->url );
-					GlobalFree( di->w_add_time );
-					GlobalFree( di->cookies );
-					GlobalFree( di->headers );
-					GlobalFree( di->data );
-					//GlobalFree( di->etag );
-					GlobalFree( di->auth_info.username );
-					GlobalFree( di->auth_info.password );
-
-					if ( di->hFile != INVALID_HANDLE_VALUE )
+					else
 					{
-						CloseHandle( di->hFile );
+						dllrbt_remove( g_icon_handles, itr );
 					}
+				}
+				LeaveCriticalSection( &icon_cache_cs );
 
-					while ( di->range_list != NULL )
-					{
-						DoublyLinkedList *range_node = di->range_list;
-						di->range_list = di->range_list->next;
+				GlobalFree( di->url );
+				GlobalFree( di->w_add_time );
+				GlobalFree( di->cookies );
+				GlobalFree( di->headers );
+				GlobalFree( di->data );
+				//GlobalFree( di->etag );
+				GlobalFree( di->auth_info.username );
+				GlobalFree( di->auth_info.password );
 
-						GlobalFree( range_node->data );
-						GlobalFree( range_node );
-					}
+				if ( di->hFile != INVALID_HANDLE_VALUE )
+				{
+					CloseHandle( di->hFile );
+				}
 
-					DeleteCriticalSection( &di->shared_cs );
+				while ( di->range_list != NULL )
+				{
+					DoublyLinkedList *range_node = di->range_list;
+					di->range_list = di->range_list->next;
 
-					GlobalFree( di );
+					GlobalFree( range_node->data );
+					GlobalFree( range_node );
 				}
+
+				DeleteCriticalSection( &di->shared_cs );
+
+				GlobalFree( di );
 			}
 		}
 
-		download_history_changed = true;
+		GlobalFree( di_array );
+		GlobalFree( index_array );
 	}
 	else if ( handle_type == 3 )	// Restart selected download (from the beginning).
 	{
 		LVITEM lvi;
 		_memzero( &lvi, sizeof( LVITEM ) );
-		lvi.mask = LVIF_PARAM;
 		lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
 
 		if ( lvi.iItem != -1 )
 		{
-			_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-			DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+			DOWNLOAD_INFO *di = DM_GetItem( lvi.iItem );
 			if ( di != NULL )
 			{
 				EnterCriticalSection( &di->shared_cs );
@@ -720,8 +834,6 @@ THREAD_RETURN handle_download_list( void *pArguments )
 				// Ensure that there are no active parts downloading.
 				if ( di->active_parts == 0 )
 				{
-					download_history_changed = true;
-
 					ResetDownload( di, true, false );
 				}
 
@@ -761,7 +873,6 @@ THREAD_RETURN handle_connection( void *pArguments )
 
 	LVITEM lvi;
 	_memzero( &lvi, sizeof( LVITEM ) );
-	lvi.mask = LVIF_PARAM;
 	lvi.iItem = -1;
 
 	int sel_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETSELECTEDCOUNT, 0, 0 );
@@ -791,9 +902,7 @@ THREAD_RETURN handle_connection( void *pArguments )
 
 		lvi.iItem = index_array[ i ];
 
-		_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-		DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+		DOWNLOAD_INFO *di = DM_GetItem( lvi.iItem );
 		if ( di != NULL )
 		{
 			unsigned int tmp_status;
@@ -979,6 +1088,8 @@ THREAD_RETURN handle_connection( void *pArguments )
 										}
 
 										LeaveCriticalSection( &download_queue_cs );
+
+										RemoveFilenameIndex( di );
 									}
 									/*else
 									{
@@ -1019,6 +1130,8 @@ THREAD_RETURN handle_connection( void *pArguments )
 									di->queue_node.data = NULL;
 
 									LeaveCriticalSection( &download_queue_cs );
+
+									RemoveFilenameIndex( di );
 								}
 
 								LeaveCriticalSection( &di->shared_cs );
@@ -1105,8 +1218,6 @@ THREAD_RETURN handle_connection( void *pArguments )
 							// Ensure that the download is actually stopped and that there are no active parts downloading.
 							if ( di->active_parts == 0 )
 							{
-								download_history_changed = true;
-
 								ResetDownload( di, ( status == STATUS_RESTART ? true : false ), ( di->status == STATUS_SKIPPED ? true : false ) );
 							}
 
@@ -1160,8 +1271,6 @@ THREAD_RETURN handle_connection( void *pArguments )
 						// Ensure that there are no active parts downloading.
 						if ( di->active_parts == 0 )
 						{
-							download_history_changed = true;
-
 							ResetDownload( di, true, false );
 						}
 					}
@@ -1212,16 +1321,14 @@ THREAD_RETURN handle_download_queue( void *pArguments )
 
 	EnterCriticalSection( &cleanup_cs );
 
-	// Retrieve the lParam value from the selected listview item.
+	// Retrieve the download info of the selected listview item.
 	LVITEM lvi;
 	_memzero( &lvi, sizeof( LVITEM ) );
-	lvi.mask = LVIF_PARAM;
 	lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
 
 	if ( lvi.iItem != -1 )
 	{
-		_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-		DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+		DOWNLOAD_INFO *di = DM_GetItem( lvi.iItem );
 
 		// Make sure the item is queued.
 		if ( di != NULL && IS_STATUS( di->status, STATUS_QUEUED ) )
@@ -1391,6 +1498,7 @@ THREAD_RETURN handle_download_update( void *pArguments )
 
 				di->ssl_version = ai->ssl_version;
 				di->parts_limit = ai->parts;
+				di->adaptive_state = ADAPTIVE_PARTS_OFF;	// The user has chosen the number of parts.
 				di->method = ai->method;
 
 				if ( ai->urls != NULL )
@@ -1434,12 +1542,14 @@ THREAD_RETURN handle_download_update( void *pArguments )
 				 cfg_sorted_column_index == COLUMN_URL ) )
 			{
 				SORT_INFO si;
-				si.column = GetColumnIndexFromVirtualIndex( cfg_sorted_column_index, download_columns, NUM_COLUMNS );
+				si.column = cfg_sorted_column_index;
 				si.hWnd = g_hWnd_files;
 				si.direction = cfg_sorted_direction;
 
-				_SendMessageW( g_hWnd_files, LVM_SORTITEMS, ( WPARAM )&si, ( LPARAM )( PFNLVCOMPARE )DMCompareFunc );
+				SortDownloadList( &si );
 			}
+
+			journal_download_history( di, JOURNAL_RECORD_ADDED );
 		}
 
 		// This is all that should be set for this function.
@@ -1450,8 +1560,6 @@ THREAD_RETURN handle_download_update( void *pArguments )
 		GlobalFree( ai->auth_info.password );
 		GlobalFree( ai->urls );
 		GlobalFree( ai );
-
-		download_history_changed = true;
 	}
 
 	g_update_download_info = NULL;
@@ -1492,7 +1600,6 @@ THREAD_RETURN copy_urls( void *pArguments )
 
 	LVITEM lvi;
 	_memzero( &lvi, sizeof( LVITEM ) );
-	lvi.mask = LVIF_PARAM;
 	lvi.iItem = -1;	// Set this to -1 so that the LVM_GETNEXTITEM call can go through the list correctly.
 
 	int item_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
@@ -1526,9 +1633,7 @@ THREAD_RETURN copy_urls( void *pArguments )
 			lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, lvi.iItem, LVNI_SELECTED );
 		}
 
-		_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-		DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+		DOWNLOAD_INFO *di = DM_GetItem( lvi.iItem );
 
 		if ( di != NULL )
 		{
@@ -1731,6 +1836,8 @@ THREAD_RETURN rename_file( void *pArguments )
 						// Get the new file extension offset.
 						di->file_extension_offset = di->filename_offset + get_file_extension_offset( di->file_path + di->filename_offset, lstrlenW( di->file_path + di->filename_offset ) );
 
+						UpdateFilenameIndex( di );
+
 						DoublyLinkedList *context_node;
 
 						// If we manually renamed our download, then prevent it from being set elsewhere.
@@ -1795,7 +1902,7 @@ THREAD_RETURN rename_file( void *pArguments )
 
 						GlobalFree( sfi );
 
-						download_history_changed = true;
+						journal_download_history( di, JOURNAL_RECORD_ADDED );
 					}
 					else
 					{
@@ -1950,7 +2057,8 @@ THREAD_RETURN import_list( void *pArguments )
 
 				_wmemcpy_s( file_path + iei->file_offset, MAX_PATH - iei->file_offset, filename, filename_length );
 
-				if ( read_download_history( file_path ) == -2 )
+				// The journal only applies to the history that's loaded during startup.
+				if ( read_download_history( file_path, ( iei->type == 0 ) ) == -2 )
 				{
 					bad_format = true;
 				}
@@ -2011,7 +2119,6 @@ THREAD_RETURN delete_files( void *pArguments )
 
 	LVITEM lvi;
 	_memzero( &lvi, sizeof( LVITEM ) );
-	lvi.mask = LVIF_PARAM;
 	lvi.iItem = -1;	// Set this to -1 so that the LVM_GETNEXTITEM call can go through the list correctly.
 
 	int item_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
@@ -2045,9 +2152,7 @@ THREAD_RETURN delete_files( void *pArguments )
 			lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, lvi.iItem, LVNI_SELECTED );
 		}
 
-		_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-		DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+		DOWNLOAD_INFO *di = DM_GetItem( lvi.iItem );
 
 		if ( di != NULL )
 		{
@@ -2176,18 +2281,31 @@ THREAD_RETURN search_list( void *pArguments )
 	{
 		if ( si->text != NULL )
 		{
-			LVITEM lvi, new_lvi;
-
-			_memzero( &lvi, sizeof( LVITEM ) );
-			lvi.mask = LVIF_PARAM | LVIF_STATE;
-			lvi.stateMask = LVIS_FOCUSED | LVIS_SELECTED;
+			LVITEM new_lvi;
 
 			_memzero( &new_lvi, sizeof( LVITEM ) );
 			new_lvi.mask = LVIF_STATE;
 			new_lvi.state = LVIS_FOCUSED | LVIS_SELECTED;
 			new_lvi.stateMask = LVIS_FOCUSED | LVIS_SELECTED;
 
-			int item_count = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
+			int item_count = ( int )DM_GetItemCount();
+
+			pcre2_code *regex_code = NULL;
+			pcre2_match_data *match = NULL;
+
+			// Compile the expression once for every item.
+			if ( si->search_flag == 0x04 && g_use_regular_expressions )
+			{
+				int error_code;
+				size_t error_offset;
+
+				regex_code = _pcre2_compile_16( ( PCRE2_SPTR16 )si->text, PCRE2_ZERO_TERMINATED, 0, &error_code, &error_offset, NULL );
+
+				if ( regex_code != NULL )
+				{
+					match = _pcre2_match_data_create_from_pattern_16( regex_code, NULL );
+				}
+			}
 
 			int current_item_index;
 
@@ -2200,6 +2318,10 @@ THREAD_RETURN search_list( void *pArguments )
 				current_item_index = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED ) + 1;
 			}
 
+			// Only the items that match will be selected.
+			new_lvi.state = 0;
+			_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, -1, ( LPARAM )&new_lvi );
+
 			// Go through each item, and delete the file.
 			for ( int i = 0; i < item_count; ++i, ++current_item_index )
 			{
@@ -2214,10 +2336,7 @@ THREAD_RETURN search_list( void *pArguments )
 					current_item_index = 0;
 				}
 
-				lvi.iItem = current_item_index;
-				_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-				DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+				DOWNLOAD_INFO *di = DM_GetItem( current_item_index );
 
 				if ( di != NULL )
 				{
@@ -2227,28 +2346,11 @@ THREAD_RETURN search_list( void *pArguments )
 
 					if ( si->search_flag == 0x04 )	// Regular expression search.
 					{
-						if ( g_use_regular_expressions )
+						if ( match != NULL )
 						{
-							int error_code;
-							size_t error_offset;
-
-							pcre2_code *regex_code = _pcre2_compile_16( ( PCRE2_SPTR16 )si->text, PCRE2_ZERO_TERMINATED, 0, &error_code, &error_offset, NULL );
-
-							if ( regex_code != NULL )
+							if ( _pcre2_match_16( regex_code, ( PCRE2_SPTR16 )text, lstrlenW( text ), 0, 0, match, NULL ) >= 0 )
 							{
-								pcre2_match_data *match = _pcre2_match_data_create_from_pattern_16( regex_code, NULL );
-
-								if ( match != NULL )
-								{
-									if ( _pcre2_match_16( regex_code, ( PCRE2_SPTR16 )text, lstrlenW( text ), 0, 0, match, NULL ) >= 0 )
-									{
-										found_match = true;
-									}
-
-									_pcre2_match_data_free_16( match );
-								}
-
-								_pcre2_code_free_16( regex_code );
+								found_match = true;
 							}
 						}
 					}
@@ -2286,12 +2388,6 @@ THREAD_RETURN search_list( void *pArguments )
 
 					if ( found_match )
 					{
-						if ( !si->search_all )
-						{
-							new_lvi.state = 0;
-							_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, -1, ( LPARAM )&new_lvi );
-						}
-
 						new_lvi.state = LVIS_FOCUSED | LVIS_SELECTED;
 						_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, current_item_index, ( LPARAM )&new_lvi );
 
@@ -2302,17 +2398,19 @@ THREAD_RETURN search_list( void *pArguments )
 							break;
 						}
 					}
-					else
-					{
-						if ( lvi.state & LVIS_SELECTED )
-						{
-							new_lvi.state = 0;
-							_SendMessageW( g_hWnd_files, LVM_SETITEMSTATE, current_item_index, ( LPARAM )&new_lvi );
-						}
-					}
 				}
 			}
 
+			if ( match != NULL )
+			{
+				_pcre2_match_data_free_16( match );
+			}
+
+			if ( regex_code != NULL )
+			{
+				_pcre2_code_free_16( regex_code );
+			}
+
 			GlobalFree( si->text );
 		}
 
@@ -2661,7 +2759,7 @@ THREAD_RETURN save_session( void *pArguments )
 
 	in_worker_thread = true;
 
-	if ( cfg_enable_download_history && download_history_changed )
+	if ( cfg_enable_download_history && ( download_history_changed || download_history_journal_full() ) )
 	{
 		wchar_t t_base_directory[ MAX_PATH ];
 
@@ -2669,8 +2767,10 @@ THREAD_RETURN save_session( void *pArguments )
 		_wmemcpy_s( t_base_directory + base_directory_length, MAX_PATH - base_directory_length, L"\\download_history\0", 18 );
 		t_base_directory[ base_directory_length + 17 ] = 0;	// Sanity.
 
-		save_download_history( t_base_directory );
-		download_history_changed = false;
+		if ( compact_download_history( t_base_directory ) == 0 )
+		{
+			download_history_changed = false;
+		}
 	}
 
 	// Release the semaphore if we're killing the thread.
@@ -28,6 +28,9 @@ struct importexportinfo
 
 void ProcessingList( bool processing );
 
+void UpdateDownloadListCount( bool invalidate );
+void SortDownloadList( SORT_INFO *si );
+
 THREAD_RETURN remove_items( void *pArguments );
 
 THREAD_RETURN handle_download_list( void *pArguments );
@@ -0,0 +1,67 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lite_dlls.h"
+#include "lite_brotli.h"
+
+#ifndef BROTLI_USE_STATIC_LIB
+
+	pBrotliDecoderCreateInstance	_BrotliDecoderCreateInstance;
+	pBrotliDecoderDecompressStream	_BrotliDecoderDecompressStream;
+	pBrotliDecoderDestroyInstance	_BrotliDecoderDestroyInstance;
+
+	HMODULE hModule_brotli = NULL;
+
+	unsigned char brotli_state = 0;	// 0 = Not running, 1 = running.
+
+	bool InitializeBrotli()
+	{
+		if ( brotli_state != BROTLI_STATE_SHUTDOWN )
+		{
+			return true;
+		}
+
+		hModule_brotli = LoadLibraryDEMW( L"brotlidec.dll" );
+
+		if ( hModule_brotli == NULL )
+		{
+			return false;
+		}
+
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_brotli, ( void ** )&_BrotliDecoderCreateInstance, "BrotliDecoderCreateInstance" ) )
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_brotli, ( void ** )&_BrotliDecoderDecompressStream, "BrotliDecoderDecompressStream" ) )
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_brotli, ( void ** )&_BrotliDecoderDestroyInstance, "BrotliDecoderDestroyInstance" ) )
+
+		brotli_state = BROTLI_STATE_RUNNING;
+
+		return true;
+	}
+
+	bool UnInitializeBrotli()
+	{
+		if ( brotli_state != BROTLI_STATE_SHUTDOWN )
+		{
+			brotli_state = BROTLI_STATE_SHUTDOWN;
+
+			return ( FreeLibrary( hModule_brotli ) == FALSE ? false : true );
+		}
+
+		return true;
+	}
+
+#endif
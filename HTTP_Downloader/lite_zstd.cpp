@@ -0,0 +1,73 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lite_dlls.h"
+#include "lite_zstd.h"
+
+#ifndef ZSTD_USE_STATIC_LIB
+
+	pZSTD_createDStream		_ZSTD_createDStream;
+	pZSTD_freeDStream		_ZSTD_freeDStream;
+	pZSTD_initDStream		_ZSTD_initDStream;
+	pZSTD_decompressStream	_ZSTD_decompressStream;
+	pZSTD_DCtx_setParameter	_ZSTD_DCtx_setParameter;
+	pZSTD_isError			_ZSTD_isError;
+
+	HMODULE hModule_zstd = NULL;
+
+	unsigned char zstd_state = 0;	// 0 = Not running, 1 = running.
+
+	bool InitializeZstd()
+	{
+		if ( zstd_state != ZSTD_STATE_SHUTDOWN )
+		{
+			return true;
+		}
+
+		hModule_zstd = LoadLibraryDEMW( L"libzstd.dll" );
+
+		if ( hModule_zstd == NULL )
+		{
+			return false;
+		}
+
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_zstd, ( void ** )&_ZSTD_createDStream, "ZSTD_createDStream" ) )
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_zstd, ( void ** )&_ZSTD_freeDStream, "ZSTD_freeDStream" ) )
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_zstd, ( void ** )&_ZSTD_initDStream, "ZSTD_initDStream" ) )
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_zstd, ( void ** )&_ZSTD_decompressStream, "ZSTD_decompressStream" ) )
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_zstd, ( void ** )&_ZSTD_DCtx_setParameter, "ZSTD_DCtx_setParameter" ) )
+		VALIDATE_FUNCTION_POINTER( SetFunctionPointer( hModule_zstd, ( void ** )&_ZSTD_isError, "ZSTD_isError" ) )
+
+		zstd_state = ZSTD_STATE_RUNNING;
+
+		return true;
+	}
+
+	bool UnInitializeZstd()
+	{
+		if ( zstd_state != ZSTD_STATE_SHUTDOWN )
+		{
+			zstd_state = ZSTD_STATE_SHUTDOWN;
+
+			return ( FreeLibrary( hModule_zstd ) == FALSE ? false : true );
+		}
+
+		return true;
+	}
+
+#endif
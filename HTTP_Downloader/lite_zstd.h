@@ -0,0 +1,89 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LITE_ZSTD_H
+#define _LITE_ZSTD_H
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+//#define ZSTD_USE_STATIC_LIB
+
+#ifdef ZSTD_USE_STATIC_LIB
+
+	//__pragma( comment( lib, "libzstd.lib" ) )
+
+	#include <zstd.h>
+
+	#define _ZSTD_createDStream			ZSTD_createDStream
+	#define _ZSTD_freeDStream			ZSTD_freeDStream
+	#define _ZSTD_initDStream			ZSTD_initDStream
+	#define _ZSTD_decompressStream		ZSTD_decompressStream
+	#define _ZSTD_DCtx_setParameter		ZSTD_DCtx_setParameter
+	#define _ZSTD_isError				ZSTD_isError
+
+#else
+
+	#define ZSTD_STATE_SHUTDOWN		0
+	#define ZSTD_STATE_RUNNING		1
+
+	// The parts of zstd.h that we use.
+	typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+	typedef ZSTD_DCtx ZSTD_DStream;
+
+	typedef struct ZSTD_inBuffer_s
+	{
+		const void	*src;
+		size_t		size;
+		size_t		pos;
+	} ZSTD_inBuffer;
+
+	typedef struct ZSTD_outBuffer_s
+	{
+		void		*dst;
+		size_t		size;
+		size_t		pos;
+	} ZSTD_outBuffer;
+
+	#define ZSTD_d_windowLogMax		100
+
+	typedef ZSTD_DStream * ( __cdecl *pZSTD_createDStream )( void );
+	typedef size_t ( __cdecl *pZSTD_freeDStream )( ZSTD_DStream *zds );
+	typedef size_t ( __cdecl *pZSTD_initDStream )( ZSTD_DStream *zds );
+	typedef size_t ( __cdecl *pZSTD_decompressStream )( ZSTD_DStream *zds, ZSTD_outBuffer *output, ZSTD_inBuffer *input );
+	typedef size_t ( __cdecl *pZSTD_DCtx_setParameter )( ZSTD_DCtx *dctx, int param, int value );
+	typedef unsigned ( __cdecl *pZSTD_isError )( size_t code );
+
+	extern pZSTD_createDStream		_ZSTD_createDStream;
+	extern pZSTD_freeDStream		_ZSTD_freeDStream;
+	extern pZSTD_initDStream		_ZSTD_initDStream;
+	extern pZSTD_decompressStream	_ZSTD_decompressStream;
+	extern pZSTD_DCtx_setParameter	_ZSTD_DCtx_setParameter;
+	extern pZSTD_isError			_ZSTD_isError;
+
+	extern unsigned char zstd_state;
+
+	bool InitializeZstd();
+	bool UnInitializeZstd();
+
+#endif
+
+	#define ZSTD_WINDOW_LOG_MAX	23	// 8 megabytes. The largest window that a zstd Content-Encoding may use (RFC 8878).
+
+#endif
@@ -38,6 +38,8 @@
 #include "lite_ole32.h"
 #include "lite_winmm.h"
 #include "lite_zlib1.h"
+#include "lite_brotli.h"
+#include "lite_zstd.h"
 #include "lite_powrprof.h"
 #include "lite_normaliz.h"
 #include "lite_pcre2.h"
@@ -45,6 +47,8 @@
 #include "cmessagebox.h"
 
 #include "connection.h"
+#include "download_model.h"
+#include "byte_scan.h"
 #include "ftp_parsing.h"
 
 #include "login_manager_utilities.h"
@@ -188,6 +192,19 @@ int APIENTRY WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 			g_use_regular_expressions = true;
 		}
 	#endif
+	// The brotli and zstd decoders are optional. Servers won't be offered an encoding that we can't decode.
+	#ifndef BROTLI_USE_STATIC_LIB
+		if ( !InitializeBrotli() )
+		{
+			UnInitializeBrotli();
+		}
+	#endif
+	#ifndef ZSTD_USE_STATIC_LIB
+		if ( !InitializeZstd() )
+		{
+			UnInitializeZstd();
+		}
+	#endif
 	// Loaded only for SetFileInformationByHandle and GetUserDefaultLocaleName.
 	// If SetFileInformationByHandle doesn't exist (on Windows XP), then rename won't work when the file is in use.
 	// But at least the program will run.
@@ -543,6 +560,22 @@ int APIENTRY WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 	InitializeCriticalSection( &last_modified_prompt_list_cs );
 	InitializeCriticalSection( &move_file_queue_cs );
 	InitializeCriticalSection( &cleanup_cs );
+	InitializeCriticalSection( &bandwidth_cs );
+	InitializeCriticalSection( &timer_wheel_cs );
+	InitializeCriticalSection( &host_parts_cs );
+	InitializeCriticalSection( &connection_pool_cs );
+	InitializeCriticalSection( &dns_cache_cs );
+	InitializeCriticalSection( &resolve_queue_cs );
+	InitializeCriticalSection( &decoder_stats_cs );
+	InitializeCriticalSection( &filename_index_cs );
+	InitializeCriticalSection( &range_list_cs );
+	InitializeCriticalSection( &history_journal_cs );
+
+	BP_Initialize();
+
+	BS_Initialize();
+
+	DM_Initialize();
 
 	// Get the default message system font.
 	NONCLIENTMETRICS ncm;
@@ -1000,10 +1033,16 @@ int APIENTRY WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdL
 
 	g_icon_handles = dllrbt_create( dllrbt_compare_w );
 
+	g_filename_index = dllrbt_create( dllrbt_compare_i_w );
+
 	g_login_info = dllrbt_create( dllrbt_compare_login_info );
 
 	read_login_info();
 
+	g_host_parts = dllrbt_create( dllrbt_compare_a );
+
+	read_host_parts();
+
 	downloader_ready_semaphore = CreateSemaphore( NULL, 0, 1, NULL );
 
 	CloseHandle( _CreateThread( NULL, 0, IOCPDownloader, NULL, 0, NULL ) );
@@ -1241,6 +1280,11 @@ CLEANUP:
 		save_login_info();
 	}
 
+	if ( host_parts_changed )
+	{
+		save_host_parts();
+	}
+
 	if ( cla != NULL )
 	{
 		if ( cla->download_directory != NULL ) { GlobalFree( cla->download_directory ); }
@@ -1326,6 +1370,22 @@ CLEANUP:
 
 	dllrbt_delete_recursively( g_icon_handles );
 
+	node = dllrbt_get_head( g_filename_index );
+	while ( node != NULL )
+	{
+		FILENAME_INFO *fi = ( FILENAME_INFO * )node->val;
+
+		if ( fi != NULL )
+		{
+			GlobalFree( fi->filename );
+			GlobalFree( fi );
+		}
+
+		node = node->next;
+	}
+
+	dllrbt_delete_recursively( g_filename_index );
+
 	node = dllrbt_get_head( g_login_info );
 	while ( node != NULL )
 	{
@@ -1347,6 +1407,22 @@ CLEANUP:
 
 	dllrbt_delete_recursively( g_login_info );
 
+	node = dllrbt_get_head( g_host_parts );
+	while ( node != NULL )
+	{
+		HOST_PARTS *hp = ( HOST_PARTS * )node->val;
+
+		if ( hp != NULL )
+		{
+			GlobalFree( hp->host );
+			GlobalFree( hp );
+		}
+
+		node = node->next;
+	}
+
+	dllrbt_delete_recursively( g_host_parts );
+
 	if ( cfg_even_row_font_settings.font != NULL ){ _DeleteObject( cfg_even_row_font_settings.font ); }
 	if ( cfg_odd_row_font_settings.font != NULL ){ _DeleteObject( cfg_odd_row_font_settings.font ); }
 
@@ -1378,6 +1454,23 @@ CLEANUP:
 	DeleteCriticalSection( &last_modified_prompt_list_cs );
 	DeleteCriticalSection( &move_file_queue_cs );
 	DeleteCriticalSection( &cleanup_cs );
+	DeleteCriticalSection( &bandwidth_cs );
+	DeleteCriticalSection( &timer_wheel_cs );
+	DeleteCriticalSection( &host_parts_cs );
+	DeleteCriticalSection( &connection_pool_cs );
+	DeleteCriticalSection( &dns_cache_cs );
+	DeleteCriticalSection( &resolve_queue_cs );
+	DeleteCriticalSection( &decoder_stats_cs );
+	DeleteCriticalSection( &filename_index_cs );
+	DeleteCriticalSection( &range_list_cs );
+
+	close_download_history_journal();
+
+	DeleteCriticalSection( &history_journal_cs );
+
+	DM_Uninitialize();
+
+	BP_Uninitialize();
 
 	DeleteCriticalSection( &ftp_listen_info_cs );
 
@@ -1458,6 +1551,12 @@ UNLOAD_DLLS:
 	#ifndef ZLIB1_USE_STATIC_LIB
 		UnInitializeZLib1();
 	#endif
+	#ifndef BROTLI_USE_STATIC_LIB
+		UnInitializeBrotli();
+	#endif
+	#ifndef ZSTD_USE_STATIC_LIB
+		UnInitializeZstd();
+	#endif
 	#ifndef KERNEL32_USE_STATIC_LIB
 		UnInitializeKernel32();
 	#endif
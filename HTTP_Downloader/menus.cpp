@@ -22,6 +22,7 @@
 #include "utilities.h"
 
 #include "connection.h"
+#include "download_model.h"
 
 #include "string_tables.h"
 
@@ -59,22 +60,18 @@ void UpdateMenus( bool enable )
 
 		DOWNLOAD_INFO *di = NULL;
 
-		// Retrieve the lParam value from the selected listview item.
-		LVITEM lvi;
-		_memzero( &lvi, sizeof( LVITEM ) );
-		lvi.mask = LVIF_PARAM;
-		lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
+		// Retrieve the download info of the selected listview item.
+		int index = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
 
 		// See if something is at least highlighted.
-		if ( lvi.iItem == -1 )
+		if ( index == -1 )
 		{
-			lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_SELECTED );
+			index = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_SELECTED );
 		}
 
-		if ( lvi.iItem != -1 )
+		if ( index != -1 )
 		{
-			_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-			di = ( DOWNLOAD_INFO * )lvi.lParam;
+			di = DM_GetItem( index );
 		}
 
 		if ( sel_count == 1 )
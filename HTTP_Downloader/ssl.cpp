@@ -256,12 +256,6 @@ void SSL_free( SSL *ssl )
 		ssl->sd.pbDataBuffer = NULL;
 	}
 
-	if ( ssl->pbRecDataBuf != NULL )
-	{
-		GlobalFree( ssl->pbRecDataBuf );
-		ssl->pbRecDataBuf = NULL;
-	}
-
 	if ( ssl->pbIoBuffer != NULL )
 	{
 		GlobalFree( ssl->pbIoBuffer );
@@ -1260,7 +1254,7 @@ SECURITY_STATUS SSL_WSARecv_Decrypt( SSL *ssl, LPWSABUF lpBuffers, DWORD &lpNumb
 
 	if ( ssl->rd.scRet == SEC_I_CONTINUE_NEEDED )
 	{
-		// Handle any remaining data that was already decoded.
+		// Handle any remaining data that was already decoded. It's still in place in our input buffer.
 		if ( lpBuffers->buf != NULL && lpBuffers->len > 0 && ssl->cbRecDataBuf > 0 )
 		{
 			lpNumberOfBytesDecrypted = min( ( DWORD )lpBuffers->len, ssl->cbRecDataBuf );
@@ -1269,10 +1263,12 @@ SECURITY_STATUS SSL_WSARecv_Decrypt( SSL *ssl, LPWSABUF lpBuffers, DWORD &lpNumb
 			DWORD rbytes = ssl->cbRecDataBuf - lpNumberOfBytesDecrypted;
 			if ( rbytes > 0 )
 			{
-				_memmove( ssl->pbRecDataBuf, ( ( char * )ssl->pbRecDataBuf ) + lpNumberOfBytesDecrypted, rbytes );
+				ssl->pbRecDataBuf += lpNumberOfBytesDecrypted;
 			}
 			else
 			{
+				ssl->pbRecDataBuf = NULL;
+
 				ssl->rd.scRet = SEC_E_OK;
 			}
 			ssl->cbRecDataBuf = rbytes;
@@ -1285,8 +1281,8 @@ SECURITY_STATUS SSL_WSARecv_Decrypt( SSL *ssl, LPWSABUF lpBuffers, DWORD &lpNumb
 
 	//ssl->cbIoBuffer = lpBuffers->len;
 
-	// Attempt to decrypt the received data.
-	ssl->rd.Buffers[ 0 ].pvBuffer = ssl->pbIoBuffer;
+	// Attempt to decrypt the received data. Records are decrypted in place.
+	ssl->rd.Buffers[ 0 ].pvBuffer = ssl->pbIoBuffer + ssl->ibIoBuffer;
 	ssl->rd.Buffers[ 0 ].cbBuffer = ssl->cbIoBuffer;
 	ssl->rd.Buffers[ 0 ].BufferType = SECBUFFER_DATA;
 
@@ -1310,6 +1306,17 @@ SECURITY_STATUS SSL_WSARecv_Decrypt( SSL *ssl, LPWSABUF lpBuffers, DWORD &lpNumb
 	if ( ssl->rd.scRet == SEC_E_INCOMPLETE_MESSAGE )
 	{
 		// The input buffer contains only a fragment of an encrypted record. Need to read some more data.
+		// Move the fragment to the front of the input buffer so that the data we receive is appended to it.
+		if ( ssl->ibIoBuffer > 0 )
+		{
+			if ( ssl->cbIoBuffer > 0 )
+			{
+				_memmove( ssl->pbIoBuffer, ssl->pbIoBuffer + ssl->ibIoBuffer, ssl->cbIoBuffer );
+			}
+
+			ssl->ibIoBuffer = 0;
+		}
+
 		return ssl->rd.scRet;
 	}
 
@@ -1346,39 +1353,34 @@ SECURITY_STATUS SSL_WSARecv_Decrypt( SSL *ssl, LPWSABUF lpBuffers, DWORD &lpNumb
 		lpNumberOfBytesDecrypted = min( ( DWORD )lpBuffers->len, pDataBuffer->cbBuffer );
 		_memcpy_s( lpBuffers->buf, lpBuffers->len, pDataBuffer->pvBuffer, lpNumberOfBytesDecrypted );
 
-		// Remaining bytes.
+		// Remaining bytes. They stay where they were decrypted until the caller has room for them.
+		// Nothing is received into the input buffer until they've been handed out.
 		DWORD rbytes = pDataBuffer->cbBuffer - lpNumberOfBytesDecrypted;
 		if ( rbytes > 0 )
 		{
-			if ( ssl->sbRecDataBuf < rbytes ) 
-			{
-				ssl->sbRecDataBuf = rbytes;
-
-				if ( ssl->pbRecDataBuf == NULL )
-				{
-					ssl->pbRecDataBuf = ( PUCHAR )GlobalAlloc( GPTR, ssl->sbRecDataBuf );
-				}
-				else
-				{
-					ssl->pbRecDataBuf = ( PUCHAR )GlobalReAlloc( ssl->pbRecDataBuf, ssl->sbRecDataBuf, GMEM_MOVEABLE );
-				}
-			}
-	
-			_memcpy_s( ssl->pbRecDataBuf, ssl->sbRecDataBuf, ( char * )pDataBuffer->pvBuffer + lpNumberOfBytesDecrypted, rbytes );
+			ssl->pbRecDataBuf = ( BYTE * )pDataBuffer->pvBuffer + lpNumberOfBytesDecrypted;
 			ssl->cbRecDataBuf = rbytes;
 
 			ssl->rd.scRet = SEC_I_CONTINUE_NEEDED;
 		}
 	}
 
-	// Move any extra data to the input buffer.
+	// The next record begins with any extra data. Decrypt it where it is rather than moving it to the front of the input buffer.
 	if ( pExtraBuffer != NULL )
 	{
-		_memmove( ssl->pbIoBuffer, pExtraBuffer->pvBuffer, pExtraBuffer->cbBuffer );
+		ssl->ibIoBuffer = ( DWORD )( ( BYTE * )pExtraBuffer->pvBuffer - ssl->pbIoBuffer );
 		ssl->cbIoBuffer = pExtraBuffer->cbBuffer;
+
+		// The handshake functions expect the data to be at the front of the input buffer.
+		if ( ssl->rd.scRet == SEC_I_RENEGOTIATE )
+		{
+			_memmove( ssl->pbIoBuffer, ssl->pbIoBuffer + ssl->ibIoBuffer, ssl->cbIoBuffer );
+			ssl->ibIoBuffer = 0;
+		}
 	}
 	else
 	{
+		ssl->ibIoBuffer = 0;
 		ssl->cbIoBuffer = 0;
 	}
 
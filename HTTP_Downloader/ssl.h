@@ -99,7 +99,7 @@ struct SSL
 
 	CtxtHandle hContext;
 
-	BYTE *pbRecDataBuf;
+	BYTE *pbRecDataBuf;		// Decrypted data that didn't fit in the caller's buffer. Points into pbIoBuffer.
 	BYTE *pbIoBuffer;
 
 	SOCKET s;
@@ -107,8 +107,8 @@ struct SSL
 	//DWORD dwProtocol;
 
 	DWORD cbRecDataBuf;
-	DWORD sbRecDataBuf;
 
+	DWORD ibIoBuffer;		// The offset of the data in pbIoBuffer that has yet to be decrypted.
 	DWORD cbIoBuffer;
 	DWORD sbIoBuffer;
 
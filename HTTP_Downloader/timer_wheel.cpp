@@ -0,0 +1,284 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "timer_wheel.h"
+
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#define TIMER_WHEEL_MASK		( TIMER_WHEEL_SLOTS - 1 )
+#define TIMER_WHEEL_OUTER_MASK	( TIMER_WHEEL_OUTER_SLOTS - 1 )
+
+unsigned long long g_performance_frequency = 0;
+
+// Returns a monotonic time in milliseconds. GetTickCount64 isn't available on XP.
+unsigned long long TW_GetTickCount()
+{
+	LARGE_INTEGER counter;
+
+	if ( g_performance_frequency == 0 )
+	{
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency( &frequency );
+		g_performance_frequency = ( unsigned long long )frequency.QuadPart;
+	}
+
+	QueryPerformanceCounter( &counter );
+
+	// Split the division so that the multiplication doesn't overflow.
+	return ( ( ( unsigned long long )counter.QuadPart / g_performance_frequency ) * 1000 ) +
+		   ( ( ( ( unsigned long long )counter.QuadPart % g_performance_frequency ) * 1000 ) / g_performance_frequency );
+}
+
+void TW_Initialize( TIMER_WHEEL *tw )
+{
+	if ( tw != NULL )
+	{
+		for ( unsigned int i = 0; i < TIMER_WHEEL_SLOTS; ++i )
+		{
+			tw->slots[ i ] = NULL;
+		}
+
+		for ( unsigned int i = 0; i < TIMER_WHEEL_OUTER_SLOTS; ++i )
+		{
+			tw->outer_slots[ i ] = NULL;
+		}
+
+		tw->current_tick = TW_GetTickCount() / TIMER_WHEEL_RESOLUTION;
+		tw->count = 0;
+	}
+}
+
+// The timer's expiration must be later than the current tick.
+void TW_InsertTimer( TIMER_WHEEL *tw, TIMER *timer )
+{
+	// The node might still be linked to the expired list that TW_Advance returned.
+	timer->node.prev = NULL;
+	timer->node.next = NULL;
+
+	// Timers that expire within one turn of the inner wheel go directly into it.
+	if ( timer->expires - tw->current_tick < TIMER_WHEEL_SLOTS )
+	{
+		timer->level = 0;
+
+		DLL_AddNode( &tw->slots[ timer->expires & TIMER_WHEEL_MASK ], &timer->node, -1 );
+	}
+	else
+	{
+		timer->level = 1;
+
+		DLL_AddNode( &tw->outer_slots[ ( timer->expires >> TIMER_WHEEL_BITS ) & TIMER_WHEEL_OUTER_MASK ], &timer->node, -1 );
+	}
+}
+
+// The timer will expire after delay milliseconds, rounded up to the next tick.
+void TW_AddTimer( TIMER_WHEEL *tw, TIMER *timer, void *data, unsigned long delay )
+{
+	if ( tw == NULL || timer == NULL )
+	{
+		return;
+	}
+
+	if ( timer->active )
+	{
+		TW_RemoveTimer( tw, timer );
+	}
+
+	unsigned long long expires = ( TW_GetTickCount() + delay + ( TIMER_WHEEL_RESOLUTION - 1 ) ) / TIMER_WHEEL_RESOLUTION;
+
+	// Never place a timer in a slot that's already been processed.
+	if ( expires <= tw->current_tick )
+	{
+		expires = tw->current_tick + 1;
+	}
+
+	timer->expires = expires;
+	timer->active = true;
+	timer->node.data = data;
+
+	TW_InsertTimer( tw, timer );
+
+	++tw->count;
+}
+
+void TW_RemoveTimer( TIMER_WHEEL *tw, TIMER *timer )
+{
+	if ( tw == NULL || timer == NULL || !timer->active )
+	{
+		return;
+	}
+
+	if ( timer->level == 0 )
+	{
+		DLL_RemoveNode( &tw->slots[ timer->expires & TIMER_WHEEL_MASK ], &timer->node );
+	}
+	else
+	{
+		DLL_RemoveNode( &tw->outer_slots[ ( timer->expires >> TIMER_WHEEL_BITS ) & TIMER_WHEEL_OUTER_MASK ], &timer->node );
+	}
+
+	timer->active = false;
+
+	--tw->count;
+}
+
+// Moves the timers in an outer slot to the inner wheel if they expire during its current turn.
+void TW_Cascade( TIMER_WHEEL *tw )
+{
+	DoublyLinkedList **slot = &tw->outer_slots[ ( tw->current_tick >> TIMER_WHEEL_BITS ) & TIMER_WHEEL_OUTER_MASK ];
+	DoublyLinkedList *node = *slot;
+
+	while ( node != NULL )
+	{
+		DoublyLinkedList *next_node = node->next;
+
+		TIMER *timer = ( TIMER * )node;
+
+		// Timers from a later round stay where they are.
+		if ( ( timer->expires >> TIMER_WHEEL_BITS ) == ( tw->current_tick >> TIMER_WHEEL_BITS ) )
+		{
+			DLL_RemoveNode( slot, node );
+
+			TW_InsertTimer( tw, timer );
+		}
+
+		node = next_node;
+	}
+}
+
+// Returns a list of the timers that have expired since the last call.
+// The list must be walked while holding the same lock that guards the wheel since the nodes are reused when a timer is added again.
+DoublyLinkedList *TW_Advance( TIMER_WHEEL *tw )
+{
+	DoublyLinkedList *expired_list = NULL;
+
+	if ( tw == NULL )
+	{
+		return NULL;
+	}
+
+	unsigned long long tick = TW_GetTickCount() / TIMER_WHEEL_RESOLUTION;
+
+	if ( tw->count > 0 && tick - tw->current_tick > TIMER_WHEEL_SLOTS )
+	{
+		// We've fallen more than a full turn behind (the system was likely suspended).
+		// Pull every timer out of the wheel and put it back relative to the current tick.
+		DoublyLinkedList *timer_list = NULL;
+
+		for ( unsigned int i = 0; i < TIMER_WHEEL_SLOTS; ++i )
+		{
+			while ( tw->slots[ i ] != NULL )
+			{
+				DoublyLinkedList *node = tw->slots[ i ];
+				DLL_RemoveNode( &tw->slots[ i ], node );
+				DLL_AddNode( &timer_list, node, -1 );
+			}
+		}
+
+		for ( unsigned int i = 0; i < TIMER_WHEEL_OUTER_SLOTS; ++i )
+		{
+			while ( tw->outer_slots[ i ] != NULL )
+			{
+				DoublyLinkedList *node = tw->outer_slots[ i ];
+				DLL_RemoveNode( &tw->outer_slots[ i ], node );
+				DLL_AddNode( &timer_list, node, -1 );
+			}
+		}
+
+		tw->current_tick = tick;
+
+		while ( timer_list != NULL )
+		{
+			DoublyLinkedList *node = timer_list;
+			DLL_RemoveNode( &timer_list, node );
+
+			TIMER *timer = ( TIMER * )node;
+
+			if ( timer->expires <= tick )
+			{
+				timer->active = false;
+
+				--tw->count;
+
+				DLL_AddNode( &expired_list, node, -1 );
+			}
+			else
+			{
+				TW_InsertTimer( tw, timer );
+			}
+		}
+	}
+
+	while ( tw->count > 0 && tw->current_tick < tick )
+	{
+		++tw->current_tick;
+
+		// The inner wheel has made a full turn.
+		if ( ( tw->current_tick & TIMER_WHEEL_MASK ) == 0 )
+		{
+			TW_Cascade( tw );
+		}
+
+		DoublyLinkedList **slot = &tw->slots[ tw->current_tick & TIMER_WHEEL_MASK ];
+
+		while ( *slot != NULL )
+		{
+			DoublyLinkedList *node = *slot;
+
+			DLL_RemoveNode( slot, node );
+
+			( ( TIMER * )node )->active = false;
+
+			--tw->count;
+
+			DLL_AddNode( &expired_list, node, -1 );
+		}
+	}
+
+	tw->current_tick = tick;
+
+	return expired_list;
+}
+
+// Returns the number of milliseconds until the next occupied slot, or INFINITE if there are no timers.
+unsigned long TW_GetNextDelay( TIMER_WHEEL *tw )
+{
+	if ( tw == NULL || tw->count == 0 )
+	{
+		return INFINITE;
+	}
+
+	unsigned long long current_time = TW_GetTickCount();
+	unsigned long long tick = tw->current_tick + TIMER_WHEEL_SLOTS;	// If nothing is found, then wake up after a full turn and look again.
+
+	for ( unsigned long long i = tw->current_tick + 1; i <= tw->current_tick + TIMER_WHEEL_SLOTS; ++i )
+	{
+		if ( tw->slots[ i & TIMER_WHEEL_MASK ] != NULL ||
+		   ( ( i & TIMER_WHEEL_MASK ) == 0 && tw->outer_slots[ ( i >> TIMER_WHEEL_BITS ) & TIMER_WHEEL_OUTER_MASK ] != NULL ) )
+		{
+			tick = i;
+
+			break;
+		}
+	}
+
+	unsigned long long wake_time = tick * TIMER_WHEEL_RESOLUTION;
+
+	return ( wake_time > current_time ? ( unsigned long )( wake_time - current_time ) : 0 );
+}
@@ -0,0 +1,56 @@
+/*
+	HTTP Downloader can download files through HTTP(S) and FTP(S) connections.
+	Copyright (C) 2015-2020 Eric Kutcher
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include "doublylinkedlist.h"
+
+#define TIMER_WHEEL_RESOLUTION	10		// Milliseconds per tick.
+#define TIMER_WHEEL_BITS		8
+#define TIMER_WHEEL_SLOTS		( 1 << TIMER_WHEEL_BITS )	// The inner wheel has a slot for each tick (2.56 seconds in total).
+#define TIMER_WHEEL_OUTER_SLOTS	256		// Must be a power of 2. Each slot covers one turn of the inner wheel (655.36 seconds in total).
+										// Timers that expire beyond the outer wheel remain in their slot until their round comes up.
+
+struct TIMER
+{
+	DoublyLinkedList	node;		// Self reference to the wheel slot (or expired list) that the timer is in.
+	unsigned long long	expires;	// The tick that the timer expires on.
+	unsigned char		level;		// 0 = inner wheel, 1 = outer wheel
+	bool				active;		// The timer is in the wheel.
+};
+
+struct TIMER_WHEEL
+{
+	DoublyLinkedList	*slots[ TIMER_WHEEL_SLOTS ];
+	DoublyLinkedList	*outer_slots[ TIMER_WHEEL_OUTER_SLOTS ];	// Timers are moved to the inner wheel when their slot comes up.
+	unsigned long long	current_tick;	// The last tick that was processed.
+	unsigned int		count;			// The number of active timers.
+};
+
+unsigned long long TW_GetTickCount();
+
+void TW_Initialize( TIMER_WHEEL *tw );
+
+void TW_AddTimer( TIMER_WHEEL *tw, TIMER *timer, void *data, unsigned long delay );
+void TW_RemoveTimer( TIMER_WHEEL *tw, TIMER *timer );
+
+DoublyLinkedList *TW_Advance( TIMER_WHEEL *tw );
+unsigned long TW_GetNextDelay( TIMER_WHEEL *tw );
+
+#endif
@@ -34,10 +34,13 @@ bool IsWindowsVersionOrGreater( WORD wMajorVersion, WORD wMinorVersion, WORD wSe
 
 int dllrbt_compare_a( void *a, void *b );
 int dllrbt_compare_w( void *a, void *b );
+int dllrbt_compare_i_w( void *a, void *b );
 
 void encode_cipher( char *buffer, int buffer_length );
 void decode_cipher( char *buffer, int buffer_length );
 
+unsigned int crc32_checksum( char *buffer, unsigned int length );
+
 wchar_t *GetMonth( unsigned short month );
 wchar_t *GetDay( unsigned short day );
 void UnixTimeToSystemTime( DWORD t, SYSTEMTIME *st );
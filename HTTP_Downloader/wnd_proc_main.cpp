@@ -30,6 +30,7 @@
 #include "login_manager_utilities.h"
 
 #include "connection.h"
+#include "download_model.h"
 #include "menus.h"
 
 #include "http_parsing.h"
@@ -44,6 +45,8 @@
 #include "system_tray.h"
 #include "drop_window.h"
 
+#define SPEED_SMOOTHING_WEIGHT	30	// The percentage that each new sample contributes to a download's speed.
+
 HWND g_hWnd_toolbar = NULL;
 HWND g_hWnd_files_columns = NULL;		// The header control window for the listview.
 HWND g_hWnd_files = NULL;
@@ -158,11 +161,9 @@ void FormatTooltipStatus()
 	}
 }
 
-// Sort function for columns.
+// Sort function for columns. si->column is the virtual index of the column (COLUMN_*).
 int CALLBACK DMCompareFunc( LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort )
 {
-	int arr[ NUM_COLUMNS ];
-
 	SORT_INFO *si = ( SORT_INFO * )lParamSort;
 
 	if ( si->hWnd == g_hWnd_files )
@@ -170,12 +171,7 @@ int CALLBACK DMCompareFunc( LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort )
 		DOWNLOAD_INFO *di1 = ( DOWNLOAD_INFO * )( ( si->direction == 1 ) ? lParam1 : lParam2 );
 		DOWNLOAD_INFO *di2 = ( DOWNLOAD_INFO * )( ( si->direction == 1 ) ? lParam2 : lParam1 );
 
-		_SendMessageW( g_hWnd_files, LVM_GETCOLUMNORDERARRAY, g_total_columns, ( LPARAM )arr );
-
-		// Offset the virtual indices to match the actual index.
-		OffsetVirtualIndices( arr, download_columns, NUM_COLUMNS, g_total_columns );
-
-		switch ( arr[ si->column ] )
+		switch ( si->column )
 		{
 			case COLUMN_DOWNLOAD_DIRECTORY:		{ return _wcsicmp_s( di1->file_path, di2->file_path ); } break;
 			case COLUMN_FILE_TYPE:				{ return _wcsicmp_s( di1->file_path + di1->file_extension_offset, di2->file_path + di2->file_extension_offset ); } break;
@@ -385,6 +381,7 @@ DWORD WINAPI UpdateWindow( LPVOID WorkThreadContext )
 
 	bool run_timer = g_timers_running;
 	unsigned char standby_counter = 0;
+	unsigned char checkpoint_counter = 0;
 
 	COLORREF border_color_t, border_color_d;		// Tray and Drop window
 	COLORREF progress_color_t, progress_color_d;	// Tray and Drop window
@@ -420,110 +417,119 @@ DWORD WINAPI UpdateWindow( LPVOID WorkThreadContext )
 
 		g_session_downloaded_speed = 0;
 
-		if ( TryEnterCriticalSection( &worker_cs ) == TRUE )
+		if ( g_taskbar != NULL )
 		{
-			if ( TryEnterCriticalSection( &active_download_list_cs ) == TRUE )
-			{
-				DoublyLinkedList *active_download_node = active_download_list;
+			g_taskbar->lpVtbl->SetProgressState( g_taskbar, g_hWnd_main, TBPF_NORMAL );
+		}
 
-				unsigned long long time_difference = 0;
+		// The active download list is only locked long enough to add or remove a download, so we don't skip the update.
+		// The progress of each download is read without locking it. See GetDownloadProgress.
+		EnterCriticalSection( &active_download_list_cs );
 
-				if ( g_taskbar != NULL )
-				{
-					g_taskbar->lpVtbl->SetProgressState( g_taskbar, g_hWnd_main, TBPF_NORMAL );
-				}
+		DoublyLinkedList *active_download_node = active_download_list;
 
-				g_progress_info.current_total_downloaded = g_progress_info.current_total_file_size = 0;
+		g_progress_info.current_total_downloaded = g_progress_info.current_total_file_size = 0;
 
-				all_paused = 0;
+		all_paused = 0;
 
-				GetSystemTimeAsFileTime( &current_time.ft );
+		GetSystemTimeAsFileTime( &current_time.ft );
 
-				// Calculate the download totals, speed, elapsed time, etc. while we have active connections.
-				while ( active_download_node != NULL && !g_end_program )
-				{
-					DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )active_download_node->data;
+		// Determine the difference (in milliseconds) between the current time and our last update time.
+		unsigned long long time_difference = ( current_time.ull - last_update.ull ) / ( FILETIME_TICKS_PER_SECOND / 1000 );	// Use milliseconds.
 
-					// Skip any files that can block us (large files that are currently allocating).
-					if ( di != NULL )
-					{
-						if ( TryEnterCriticalSection( &di->shared_cs ) == TRUE )
-						{
-							// If connecting, downloading, paused, or allocating then calculate the elapsed time.
-							if ( IS_STATUS( di->status,
-									STATUS_CONNECTING |
-									STATUS_DOWNLOADING |
-									STATUS_ALLOCATING_FILE ) )
-							{
-								di->time_elapsed = ( current_time.ull - di->start_time.QuadPart ) / FILETIME_TICKS_PER_SECOND;
-							}
+		// Calculate the download totals, speed, elapsed time, etc. while we have active connections.
+		while ( active_download_node != NULL && !g_end_program )
+		{
+			DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )active_download_node->data;
 
-							// If downloading, then calculate the speed.
-							if ( di->status == STATUS_DOWNLOADING )
-							{
-								// Determine the difference (in milliseconds) between the current time and our last update time.
-								time_difference = ( current_time.ull - last_update.ull ) / ( FILETIME_TICKS_PER_SECOND / 1000 );	// Use milliseconds.
+			if ( di != NULL )
+			{
+				unsigned long long downloaded, file_size;
+				GetDownloadProgress( di, downloaded, file_size );
 
-								// See if at least 1 second has elapsed since we last updated our speed and download time estimate.
-								if ( time_difference >= 1000 )	// Measure in milliseconds for better precision. 1000 milliseconds = 1 second.
-								{
-									// Get the speed.
-									di->speed = ( ( di->downloaded - di->last_downloaded ) * 1000 ) / time_difference;	// Multiply by 1000 to match the millisecond precision. Gives us bytes/second.
+				unsigned int status = di->status;
 
-									// Get the time remaining.
-									if ( di->speed > 0 )
-									{
-										if ( di->file_size > 0 && di->downloaded <= di->file_size )
-										{
-											// Get the remaining bytes and divide it by the speed.
-											di->time_remaining = ( di->file_size - di->downloaded ) / di->speed;
-										}
-										else
-										{
-											di->time_remaining = 0;
-										}
-
-										g_session_downloaded_speed += di->speed;
-									}
-									else	// The remaining time will be unknown if the download stalls.
-									{
-										di->time_remaining = 0;
-									}
+				// If connecting, downloading, paused, or allocating then calculate the elapsed time.
+				if ( IS_STATUS( status,
+						STATUS_CONNECTING |
+						STATUS_DOWNLOADING |
+						STATUS_ALLOCATING_FILE ) )
+				{
+					di->time_elapsed = ( current_time.ull - di->start_time.QuadPart ) / FILETIME_TICKS_PER_SECOND;
+				}
 
-									di->last_downloaded = di->downloaded;
-								}
+				// If downloading, then calculate the speed.
+				if ( status == STATUS_DOWNLOADING )
+				{
+					// See if at least 1 second has elapsed since we last updated our speed and download time estimate.
+					if ( time_difference >= 1000 )	// Measure in milliseconds for better precision. 1000 milliseconds = 1 second.
+					{
+						// Get the speed of this sample. The download may have been reset since the last one.
+						unsigned long long speed = ( downloaded >= di->last_downloaded ? ( ( downloaded - di->last_downloaded ) * 1000 ) / time_difference : 0 );	// Multiply by 1000 to match the millisecond precision. Gives us bytes/second.
 
-								g_progress_info.current_total_downloaded += di->downloaded;
-								g_progress_info.current_total_file_size += di->file_size;
+						// Smooth the samples so that the speed and time remaining don't jump around from one update to the next.
+						// A stalled download decays to 0 since the result is truncated.
+						if ( di->speed > 0 )
+						{
+							speed = ( ( speed * SPEED_SMOOTHING_WEIGHT ) + ( di->speed * ( 100 - SPEED_SMOOTHING_WEIGHT ) ) ) / 100;
+						}
+
+						di->speed = speed;
 
-								all_paused = 2;
+						// Get the time remaining.
+						if ( speed > 0 )
+						{
+							if ( file_size > 0 && downloaded <= file_size )
+							{
+								// Get the remaining bytes and divide it by the speed.
+								di->time_remaining = ( file_size - downloaded ) / speed;
 							}
-							else if ( IS_STATUS( di->status, STATUS_PAUSED | STATUS_QUEUED ) )
+							else
 							{
 								di->time_remaining = 0;
-								di->speed = 0;
-
-								if ( all_paused == 0 )
-								{
-									all_paused = 1;
-								}
 							}
 
-							LeaveCriticalSection( &di->shared_cs );
+							g_session_downloaded_speed += speed;
 						}
+						else	// The remaining time will be unknown if the download stalls.
+						{
+							di->time_remaining = 0;
+						}
+
+						di->last_downloaded = downloaded;
+					}
+					else
+					{
+						g_session_downloaded_speed += di->speed;
 					}
 
-					active_download_node = active_download_node->next;
-				}
+					g_progress_info.current_total_downloaded += downloaded;
+					g_progress_info.current_total_file_size += file_size;
 
-				last_update = current_time;
+					all_paused = 2;
+				}
+				else if ( IS_STATUS( status, STATUS_PAUSED | STATUS_QUEUED ) )
+				{
+					di->time_remaining = 0;
+					di->speed = 0;
 
-				LeaveCriticalSection( &active_download_list_cs );
+					if ( all_paused == 0 )
+					{
+						all_paused = 1;
+					}
+				}
 			}
 
-			LeaveCriticalSection( &worker_cs );
+			active_download_node = active_download_node->next;
+		}
+
+		if ( time_difference >= 1000 )
+		{
+			last_update = current_time;
 		}
 
+		LeaveCriticalSection( &active_download_list_cs );
+
 		_InvalidateRect( g_hWnd_files, NULL, FALSE );
 
 		update_text_values = false;
@@ -660,11 +666,11 @@ DWORD WINAPI UpdateWindow( LPVOID WorkThreadContext )
 				 cfg_sorted_column_index != COLUMN_URL )
 			{
 				SORT_INFO si;
-				si.column = GetColumnIndexFromVirtualIndex( cfg_sorted_column_index, download_columns, NUM_COLUMNS );
+				si.column = cfg_sorted_column_index;
 				si.hWnd = g_hWnd_files;
 				si.direction = cfg_sorted_direction;
 
-				_SendMessageW( g_hWnd_files, LVM_SORTITEMS, ( WPARAM )&si, ( LPARAM )( PFNLVCOMPARE )DMCompareFunc );
+				SortDownloadList( &si );
 			}
 		}
 		else
@@ -742,11 +748,11 @@ DWORD WINAPI UpdateWindow( LPVOID WorkThreadContext )
 				 cfg_sorted_column_index != COLUMN_URL )
 			{
 				SORT_INFO si;
-				si.column = GetColumnIndexFromVirtualIndex( cfg_sorted_column_index, download_columns, NUM_COLUMNS );
+				si.column = cfg_sorted_column_index;
 				si.hWnd = g_hWnd_files;
 				si.direction = cfg_sorted_direction;
 
-				_SendMessageW( g_hWnd_files, LVM_SORTITEMS, ( WPARAM )&si, ( LPARAM )( PFNLVCOMPARE )DMCompareFunc );
+				SortDownloadList( &si );
 			}
 
 			if ( cfg_play_sound && cfg_sound_file_path != NULL )
@@ -762,8 +768,9 @@ DWORD WINAPI UpdateWindow( LPVOID WorkThreadContext )
 				if ( play ) { _PlaySoundW( cfg_sound_file_path, NULL, SND_ASYNC | SND_FILENAME ); }
 			}
 
+			// Completed downloads are already in the history journal. Only save the whole history if it's needed.
 			HANDLE save_session_handle = NULL;
-			if ( cfg_enable_download_history && download_history_changed )
+			if ( cfg_enable_download_history && ( download_history_changed || download_history_journal_full() ) )
 			{
 				save_session_handle = ( HANDLE )_CreateThread( NULL, 0, save_session, ( void * )NULL, 0, NULL );
 			}
@@ -816,6 +823,27 @@ DWORD WINAPI UpdateWindow( LPVOID WorkThreadContext )
 				SetThreadExecutionState( ES_CONTINUOUS | ES_SYSTEM_REQUIRED );
 			}
 		}
+
+		// Save the progress of active downloads in case we're shut down unexpectedly.
+		if ( cfg_enable_download_history && run_timer )
+		{
+			if ( ++checkpoint_counter >= JOURNAL_CHECKPOINT_INTERVAL )
+			{
+				checkpoint_counter = 0;
+
+				checkpoint_download_history( false );
+
+				// The journal has grown too large. Fold it into the history file.
+				if ( download_history_journal_full() )
+				{
+					HANDLE save_session_handle = ( HANDLE )_CreateThread( NULL, 0, save_session, ( void * )NULL, 0, NULL );
+					if ( save_session_handle != NULL )
+					{
+						CloseHandle( save_session_handle );
+					}
+				}
+			}
+		}
 	}
 
 	CloseHandle( g_timer_semaphore );
@@ -1237,9 +1265,6 @@ LRESULT CALLBACK ListViewSubProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPa
 						{
 							wchar_t tbuf[ 128 ];
 
-							LVITEM lvi;
-							_memzero( &lvi, sizeof( LVITEM ) );
-
 							int index = ( int )_SendMessageW( hWnd, LVM_GETTOPINDEX, 0, 0 );
 							int index_end = ( int )_SendMessageW( hWnd, LVM_GETCOUNTPERPAGE, 0, 0 ) + index;
 
@@ -1254,6 +1279,8 @@ LRESULT CALLBACK ListViewSubProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPa
 								_DeleteObject( ohf );
 							}
 
+							EnterCriticalSection( &download_model_cs );
+
 							for ( ; index <= index_end; ++index )
 							{
 								if ( switch_fonts )
@@ -1267,30 +1294,25 @@ LRESULT CALLBACK ListViewSubProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPa
 									}
 								}
 
-								lvi.iItem = index;
-								lvi.mask = LVIF_PARAM;
-								if ( _SendMessageW( hWnd, LVM_GETITEM, 0, ( LPARAM )&lvi ) == TRUE )
+								DOWNLOAD_INFO *di = DM_GetItem( index );
+								if ( di != NULL )
 								{
-									DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
-									if ( di != NULL )
-									{
-										wchar_t *buf = GetDownloadInfoString( di, virtual_index, index + 1, tbuf, 128 );
+									wchar_t *buf = GetDownloadInfoString( di, virtual_index, index + 1, tbuf, 128 );
 
-										if ( buf == NULL )
-										{
-											tbuf[ 0 ] = L'\0';
-											buf = tbuf;
-										}
+									if ( buf == NULL )
+									{
+										tbuf[ 0 ] = L'\0';
+										buf = tbuf;
+									}
 
-										rc.bottom = rc.left = rc.right = rc.top = 0;
+									rc.bottom = rc.left = rc.right = rc.top = 0;
 
-										_DrawTextW( hDC, buf, -1, &rc, DT_SINGLELINE | DT_NOPREFIX | DT_CALCRECT );
+									_DrawTextW( hDC, buf, -1, &rc, DT_SINGLELINE | DT_NOPREFIX | DT_CALCRECT );
 
-										int width = ( rc.right - rc.left ) + 10;	// 5 + 5 padding.
-										if ( width > largest_width )
-										{
-											largest_width = width;
-										}
+									int width = ( rc.right - rc.left ) + 10;	// 5 + 5 padding.
+									if ( width > largest_width )
+									{
+										largest_width = width;
 									}
 								}
 								else
@@ -1299,6 +1321,8 @@ LRESULT CALLBACK ListViewSubProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPa
 								}
 							}
 
+							LeaveCriticalSection( &download_model_cs );
+
 							_ReleaseDC( hWnd, hDC );
 						}
 					}
@@ -1327,16 +1351,11 @@ void HandleCommand( HWND hWnd, WPARAM wParam, LPARAM lParam )
 		case MENU_OPEN_FILE:
 		case MENU_OPEN_DIRECTORY:
 		{
-			LVITEM lvi;
-			_memzero( &lvi, sizeof( LVITEM ) );
-			lvi.mask = LVIF_PARAM;
-			lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
+			int index = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
 
-			if ( lvi.iItem != -1 )
+			if ( index != -1 )
 			{
-				_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-				DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+				DOWNLOAD_INFO *di = DM_GetItem( index );
 				if ( di != NULL && !( di->download_operations & DOWNLOAD_OPERATION_SIMULATE ) )
 				{
 					bool destroy = true;
@@ -1567,16 +1586,12 @@ void HandleCommand( HWND hWnd, WPARAM wParam, LPARAM lParam )
 
 		case MENU_UPDATE_DOWNLOAD:
 		{
-			LVITEM lvi;
-			_memzero( &lvi, sizeof( LVITEM ) );
-			lvi.mask = LVIF_PARAM;
-			lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
+			int index = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
 
-			if ( lvi.iItem != -1 )
+			if ( index != -1 )
 			{
-				_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-				if ( lvi.lParam != NULL )
+				DOWNLOAD_INFO *di = DM_GetItem( index );
+				if ( di != NULL )
 				{
 					if ( g_hWnd_update_download == NULL )
 					{
@@ -1587,7 +1602,7 @@ void HandleCommand( HWND hWnd, WPARAM wParam, LPARAM lParam )
 						_ShowWindow( g_hWnd_update_download, SW_RESTORE );
 					}
 
-					_SendMessageW( g_hWnd_update_download, WM_PROPAGATE, 0, lvi.lParam );
+					_SendMessageW( g_hWnd_update_download, WM_PROPAGATE, 0, ( LPARAM )di );
 				}
 			}
 		}
@@ -1656,16 +1671,13 @@ void HandleCommand( HWND hWnd, WPARAM wParam, LPARAM lParam )
 
 		case MENU_RENAME:
 		{
-			LVITEM lvi;
-			_memzero( &lvi, sizeof( LVITEM ) );
-			lvi.mask = LVIF_PARAM;
-			lvi.iItem = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
+			int index = ( int )_SendMessageW( g_hWnd_files, LVM_GETNEXTITEM, -1, LVNI_FOCUSED | LVNI_SELECTED );
 
-			if ( lvi.iItem != -1 )
+			if ( index != -1 )
 			{
 				edit_from_menu = true;
 
-				_SendMessageW( g_hWnd_files, LVM_EDITLABEL, lvi.iItem, 0 );
+				_SendMessageW( g_hWnd_files, LVM_EDITLABEL, index, 0 );
 			}
 		}
 		break;
@@ -1946,7 +1958,7 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 
 			_SendMessageW( g_hWnd_toolbar, TB_ADDBUTTONS, 14, ( LPARAM )&tbb );
 
-			g_hWnd_files = _CreateWindowW( WC_LISTVIEW, NULL, LVS_REPORT | LVS_EDITLABELS | LVS_OWNERDRAWFIXED | WS_CHILDWINDOW | WS_VISIBLE | ( cfg_show_toolbar ? WS_BORDER : 0 ) | ( cfg_show_column_headers ? 0 : LVS_NOCOLUMNHEADER ), 0, 0, 0, 0, hWnd, NULL, NULL, NULL );
+			g_hWnd_files = _CreateWindowW( WC_LISTVIEW, NULL, LVS_REPORT | LVS_EDITLABELS | LVS_OWNERDRAWFIXED | LVS_OWNERDATA | WS_CHILDWINDOW | WS_VISIBLE | ( cfg_show_toolbar ? WS_BORDER : 0 ) | ( cfg_show_column_headers ? 0 : LVS_NOCOLUMNHEADER ), 0, 0, 0, 0, hWnd, NULL, NULL, NULL );
 			_SendMessageW( g_hWnd_files, LVM_SETEXTENDEDLISTVIEWSTYLE, 0, LVS_EX_DOUBLEBUFFER | LVS_EX_FULLROWSELECT | ( cfg_show_gridlines ? LVS_EX_GRIDLINES : 0 ) | LVS_EX_HEADERDRAGDROP );
 
 			g_hWnd_status = _CreateWindowW( STATUSCLASSNAME, NULL, SBARS_SIZEGRIP | WS_CHILDWINDOW | ( cfg_show_status_bar ? WS_VISIBLE : 0 ), 0, 0, 0, 0, hWnd, NULL, NULL, NULL );
@@ -2427,7 +2439,7 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 						}
 
 						SORT_INFO si;
-						si.column = lvc.iOrder;
+						si.column = index;
 						si.hWnd = nmlv->hdr.hwndFrom;
 
 						if ( HDF_SORTUP & lvc.fmt )	// Column is sorted upward.
@@ -2473,7 +2485,7 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 							download_history_changed = true;
 						}
 
-						_SendMessageW( nmlv->hdr.hwndFrom, LVM_SORTITEMS, ( WPARAM )&si, ( LPARAM )( PFNLVCOMPARE )DMCompareFunc );
+						SortDownloadList( &si );
 					}
 				}
 				break;
@@ -2644,6 +2656,7 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 				break;*/
 
 				case LVN_ITEMCHANGED:
+				case LVN_ODSTATECHANGED:	// Sent instead of LVN_ITEMCHANGED when a range of items changes state.
 				{
 					//NMLISTVIEW *nmlv = ( NMLISTVIEW * )lParam;
 
@@ -2680,14 +2693,7 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 
 						if ( lvhti.iItem != -1 )
 						{
-							LVITEM lvi;
-							_memzero( &lvi, sizeof( LVITEM ) );
-							lvi.mask = LVIF_PARAM;
-							lvi.iItem = lvhti.iItem;
-
-							_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-							DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+							DOWNLOAD_INFO *di = DM_GetItem( lvhti.iItem );
 
 							if ( di != NULL )
 							{
@@ -2705,13 +2711,16 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 
 								__snwprintf( tooltip_buffer + tooltip_buffer_offset, 512 - tooltip_buffer_offset, L" bytes\r\n%s: %s", ST_V_Added, di->w_add_time );*/
 
-								if ( di->file_size > 0 )
+								unsigned long long downloaded, file_size;
+								GetDownloadProgress( di, downloaded, file_size );
+
+								if ( file_size > 0 )
 								{
-									__snwprintf( tooltip_buffer, 512, L"%s: %s\r\n%s: %I64u / %I64u bytes\r\n%s: %s", ST_V_Filename, di->file_path + di->filename_offset, ST_V_Downloaded, di->downloaded, di->file_size, ST_V_Added, di->w_add_time );
+									__snwprintf( tooltip_buffer, 512, L"%s: %s\r\n%s: %I64u / %I64u bytes\r\n%s: %s", ST_V_Filename, di->file_path + di->filename_offset, ST_V_Downloaded, downloaded, file_size, ST_V_Added, di->w_add_time );
 								}
 								else
 								{
-									__snwprintf( tooltip_buffer, 512, L"%s: %s\r\n%s: %I64u / ? bytes\r\n%s: %s", ST_V_Filename, di->file_path + di->filename_offset, ST_V_Downloaded, di->downloaded, ST_V_Added, di->w_add_time );
+									__snwprintf( tooltip_buffer, 512, L"%s: %s\r\n%s: %I64u / ? bytes\r\n%s: %s", ST_V_Filename, di->file_path + di->filename_offset, ST_V_Downloaded, downloaded, ST_V_Added, di->w_add_time );
 								}
 
 								ti.lpszText = tooltip_buffer;
@@ -2728,6 +2737,28 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 				}
 				break;
 
+				case LVN_GETDISPINFO:
+				{
+					NMLVDISPINFO *pdi = ( NMLVDISPINFO * )lParam;
+
+					// The listview doesn't store any item text. Everything is drawn from the download model, but the label edit asks for the filename.
+					if ( pdi->item.mask & LVIF_TEXT && pdi->item.pszText != NULL && pdi->item.cchTextMax > 0 )
+					{
+						pdi->item.pszText[ 0 ] = 0;
+
+						EnterCriticalSection( &download_model_cs );
+
+						DOWNLOAD_INFO *di = DM_GetItem( pdi->item.iItem );
+						if ( di != NULL )
+						{
+							_wcsncpy_s( pdi->item.pszText, pdi->item.cchTextMax, di->file_path + di->filename_offset, pdi->item.cchTextMax );
+						}
+
+						LeaveCriticalSection( &download_model_cs );
+					}
+				}
+				break;
+
 				case LVN_BEGINLABELEDIT:
 				{
 					NMLVDISPINFO *pdi = ( NMLVDISPINFO * )lParam;
@@ -2741,14 +2772,8 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 						return TRUE;
 					}
 
-					// Get the current list item text from its lParam.
-					LVITEM lvi;
-					_memzero( &lvi, sizeof( LVITEM ) );
-					lvi.iItem = pdi->item.iItem;
-					lvi.mask = LVIF_PARAM;
-					_SendMessageW( pdi->hdr.hwndFrom, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-					DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+					// Get the current list item text from its download info.
+					DOWNLOAD_INFO *di = DM_GetItem( pdi->item.iItem );
 					if ( di != NULL )
 					{
 						if ( skip_hit_test )
@@ -2811,14 +2836,8 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 						unsigned int filename_length = lstrlenW( pdi->item.pszText );
 						if ( filename_length > 0 )
 						{
-							// Get the current list item text from its lParam.
-							LVITEM lvi;
-							_memzero( &lvi, sizeof( LVITEM ) );
-							lvi.iItem = pdi->item.iItem;
-							lvi.mask = LVIF_PARAM;
-							_SendMessageW( pdi->hdr.hwndFrom, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-							DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+							// Get the current list item's download info.
+							DOWNLOAD_INFO *di = DM_GetItem( pdi->item.iItem );
 							if ( di != NULL )
 							{
 								RENAME_INFO *ri = ( RENAME_INFO * )GlobalAlloc( GPTR, sizeof( RENAME_INFO ) );
@@ -3045,7 +3064,16 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 			DRAWITEMSTRUCT *dis = ( DRAWITEMSTRUCT * )lParam;
 
 			// The item we want to draw is our listview.
-			if ( dis->CtlType == ODT_LISTVIEW && dis->itemData != NULL )
+			if ( dis->CtlType != ODT_LISTVIEW )
+			{
+				return TRUE;
+			}
+
+			// Hold the model for the whole draw so that the item can't be removed and freed out from under us.
+			EnterCriticalSection( &download_model_cs );
+
+			DOWNLOAD_INFO *di = DM_GetItem( ( int )dis->itemID );
+			if ( di != NULL )
 			{
 				// Alternate item color's background.
 				HBRUSH color = _CreateSolidBrush( ( dis->itemID & 1 ? cfg_even_row_background_color : cfg_odd_row_background_color ) );
@@ -3058,7 +3086,9 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 				{
 					if ( skip_list_draw )
 					{
-						return TRUE;	// Don't draw selected items because their lParam values are being deleted.
+						LeaveCriticalSection( &download_model_cs );
+
+						return TRUE;	// Don't draw selected items because they're being deleted.
 					}
 
 					HBRUSH color = _CreateSolidBrush( ( dis->itemID & 1 ? cfg_even_row_highlight_color : cfg_odd_row_highlight_color ) );
@@ -3095,8 +3125,6 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 					column_count = g_total_columns;
 				}
 
-				DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )dis->itemData;
-
 				LVCOLUMN lvc;
 				_memzero( &lvc, sizeof( LVCOLUMN ) );
 				lvc.mask = LVCF_WIDTH;
@@ -3283,10 +3311,13 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 							_SetTextColor( hdcMem, color_ref_body_text );
 							_DrawTextW( hdcMem, buf, -1, &rc, DT_NOPREFIX | DT_SINGLELINE | DT_CENTER | DT_VCENTER | DT_END_ELLIPSIS );
 
-							unsigned char range_info_count = 0;
+							unsigned int range_info_count = 0;
 
 							unsigned long long last_range_end = 0;
 
+							// Finished parts can split and merge the ranges while we walk them.
+							EnterCriticalSection( &range_list_cs );
+
 							RANGE_INFO *ri;
 							DoublyLinkedList *range_node = di->print_range_list;
 
@@ -3354,6 +3385,8 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 								range_node = range_node->next;
 							}
 
+							LeaveCriticalSection( &range_list_cs );
+
 							// Fill out the remaining progress bar if later parts have completed.
 							if ( ( IS_STATUS_NOT( di->status, STATUS_CONNECTING ) || range_info_count == di->parts ) && last_range_end < di->file_size )
 							{
@@ -3469,6 +3502,9 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 					_DeleteDC( hdcMem );
 				}
 			}
+
+			LeaveCriticalSection( &download_model_cs );
+
 			return TRUE;
 		}
 		break;
@@ -3789,28 +3825,31 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 				_DestroyWindow( g_hWnd_url_drop_window );
 			}
 
-			if ( cfg_enable_download_history && download_history_changed )
+			if ( cfg_enable_download_history )
 			{
-				_wmemcpy_s( base_directory + base_directory_length, MAX_PATH - base_directory_length, L"\\download_history\0", 18 );
-				base_directory[ base_directory_length + 17 ] = 0;	// Sanity.
+				if ( download_history_changed || download_history_journal_full() )
+				{
+					_wmemcpy_s( base_directory + base_directory_length, MAX_PATH - base_directory_length, L"\\download_history\0", 18 );
+					base_directory[ base_directory_length + 17 ] = 0;	// Sanity.
 
-				save_download_history( base_directory );
-				download_history_changed = false;
+					if ( compact_download_history( base_directory ) == 0 )
+					{
+						download_history_changed = false;
+					}
+				}
+				else	// Everything else is already in the journal.
+				{
+					checkpoint_download_history( true );
+				}
 			}
 
-			// Get the number of items in the listview.
-			int num_items = ( int )_SendMessageW( g_hWnd_files, LVM_GETITEMCOUNT, 0, 0 );
+			// Get the number of items in the download model.
+			int num_items = ( int )DM_GetItemCount();
 
-			LVITEM lvi;
-			_memzero( &lvi, sizeof( LVITEM ) );
-			lvi.mask = LVIF_PARAM;
-
-			// Go through each item, and free their lParam values.
-			for ( lvi.iItem = 0; lvi.iItem < num_items; ++lvi.iItem )
+			// Go through each item, and free their values.
+			for ( int i = 0; i < num_items; ++i )
 			{
-				_SendMessageW( g_hWnd_files, LVM_GETITEM, 0, ( LPARAM )&lvi );
-
-				DOWNLOAD_INFO *di = ( DOWNLOAD_INFO * )lvi.lParam;
+				DOWNLOAD_INFO *di = DM_GetItem( i );
 				if ( di != NULL )
 				{
 					// di->icon is stored in the icon_handles tree and is destroyed in main.
@@ -3843,6 +3882,8 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 				}
 			}
 
+			DM_RemoveAllItems();
+
 			UpdateColumnOrders();
 
 			DestroyMenus();
@@ -3909,13 +3950,22 @@ LRESULT CALLBACK MainWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam
 				login_list_changed = false;
 			}
 
-			if ( cfg_enable_download_history && download_history_changed )
+			if ( cfg_enable_download_history )
 			{
-				_wmemcpy_s( base_directory + base_directory_length, MAX_PATH - base_directory_length, L"\\download_history\0", 18 );
-				base_directory[ base_directory_length + 17 ] = 0;	// Sanity.
+				if ( download_history_changed || download_history_journal_full() )
+				{
+					_wmemcpy_s( base_directory + base_directory_length, MAX_PATH - base_directory_length, L"\\download_history\0", 18 );
+					base_directory[ base_directory_length + 17 ] = 0;	// Sanity.
 
-				save_download_history( base_directory );
-				download_history_changed = false;
+					if ( compact_download_history( base_directory ) == 0 )
+					{
+						download_history_changed = false;
+					}
+				}
+				else	// Everything else is already in the journal.
+				{
+					checkpoint_download_history( true );
+				}
 			}
 
 			return 0;
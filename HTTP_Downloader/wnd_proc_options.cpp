@@ -886,20 +886,10 @@ LRESULT CALLBACK OptionsWndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPar
 
 					if ( timeout != cfg_timeout )
 					{
-						if ( cfg_timeout == 0 )
-						{
-							cfg_timeout = timeout;	// New value will not be 0 and the timeout thread will poll every 1 second.
+						cfg_timeout = timeout;
 
-							// Trigger the timeout thread to poll.
-							if ( g_timeout_semaphore != NULL )
-							{
-								ReleaseSemaphore( g_timeout_semaphore, 1, NULL );
-							}
-						}
-						else
-						{
-							cfg_timeout = timeout;
-						}
+						// Reschedule the connection timeouts with the new value.
+						UpdateTimeoutTimers();
 					}
 
 					_SendMessageA( g_hWnd_default_download_parts, WM_GETTEXT, 11, ( LPARAM )value );